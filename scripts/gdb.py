@@ -31,6 +31,49 @@ def unhexify(s):
 	"""Convert a hex-encoded bytes into bytes object"""
 	return bytes.fromhex(s.decode())
 
+def _lz4_length(out, length):
+	"""Append the bytes carrying on a length of 15 or more"""
+	while length >= 255:
+		out.append(255)
+		length -= 255
+	out.append(length)
+
+def _lz4_sequence(out, literals, offset, match):
+	"""Append a sequence, match is 0 for the literals ending the block"""
+	token = min(len(literals), 15) << 4
+	if match:
+		token |= min(match - 4, 15)
+	out.append(token)
+	if len(literals) >= 15:
+		_lz4_length(out, len(literals) - 15)
+	out += literals
+	if match:
+		out += struct.pack("<H", offset)
+		if match - 4 >= 15:
+			_lz4_length(out, match - 19)
+
+def lz4_compress(data):
+	"""Compress data into a single LZ4 block, as taken by vFlashWriteLZ4"""
+	out = bytearray()
+	table = {}
+	anchor = pos = 0
+	# As the format asks, the last match starts 12 bytes before the end and ends 5 before it
+	while pos < len(data) - 12:
+		key = data[pos:pos + 4]
+		ref = table.get(key)
+		table[key] = pos
+		if ref is None or pos - ref > 0xffff:
+			pos += 1
+			continue
+		match = 4
+		while pos + match < len(data) - 5 and data[ref + match] == data[pos + match]:
+			match += 1
+		_lz4_sequence(out, data[anchor:pos], pos - ref, match)
+		pos += match
+		anchor = pos
+	_lz4_sequence(out, data[anchor:], 0, 0)
+	return bytes(out)
+
 class FakeSocket:
 	"""Emulate socket functions send and recv on a file object"""
 	def __init__(self, file):
@@ -50,6 +93,7 @@ class Target:
 			self.sock = FakeSocket(sock)
 
 		self.PacketSize=0x100 # default
+		self.FlashLZ4Size=0 # vFlashWriteLZ4 not supported
 
 	def getpacket(self):
 		"""Return the first correctly received packet from GDB target"""
@@ -111,6 +155,15 @@ class Target:
 			if self.sock.recv(1) == b'+':
 				break
 
+	def supported(self):
+		"""Ask the target for the features it supports (gdb "qSupported")"""
+		self.putpacket(b"qSupported")
+		for feature in self.getpacket().split(b';'):
+			if feature.startswith(b"PacketSize="):
+				self.PacketSize = int(feature[11:], 16)
+			elif feature.startswith(b"vFlashWriteLZ4="):
+				self.FlashLZ4Size = int(feature[15:], 16)
+
 	def monitor(self, cmd):
 		"""Send gdb "monitor" command to target"""
 		if type(cmd) == str:
@@ -300,9 +353,19 @@ class Target:
 
 				while data:
 					d = data[0:980]
+					packet = b"vFlashWrite:%08X:%s" % (addr, d)
+					# Send as much as fits a packet compressed, if the target takes that
+					if self.target.FlashLZ4Size:
+						for size in (self.target.FlashLZ4Size, 980 * 3):
+							lz4 = lz4_compress(data[0:size])
+							escaped = len(lz4) + sum(lz4.count(c) for c in b'$#}')
+							if escaped < self.target.PacketSize - 64 and len(lz4) < len(d):
+								d = data[0:size]
+								packet = b"vFlashWriteLZ4:%08X,%08X:%s" % (addr, len(d), lz4)
+								break
 					data = data[len(d):]
 					#print("Writing %d bytes at 0x%X" % (len(d), addr))
-					self.target.putpacket(b"vFlashWrite:%08X:%s" % (addr, d))
+					self.target.putpacket(packet)
 					addr += len(d)
 					if self.target.getpacket() != b'OK':
 						raise Exception("Failed to write flash")
@@ -316,6 +379,7 @@ class Target:
 
 	def flash_probe(self):
 		self.mem = []
+		self.supported()
 		xmldom = parseString(self.memmap_read())
 
 		for memrange in xmldom.getElementsByTagName("memory"):
@@ -37,6 +37,8 @@
 #include <limits.h>
 #include <termios.h>
 #include <signal.h>
+#include <errno.h>
+#include <sys/time.h>
 
 #define VID       (0x1d50)
 #define PID       (0x6018)
@@ -47,6 +49,16 @@
 #define NUM_FIFOS     32
 #define MAX_FIFOS     128
 
+/* Each USB transfer collects this many packets, several are kept in flight */
+#define USB_TRANSFER_SIZE (TRANSFER_SIZE*64)
+#define NUM_TRANSFERS     8
+#define MAX_TRANSFERS     64
+/* A transfer that isn't full by then hands over what it has */
+#define USB_TIMEOUT_MS    50
+
+/* Channel data is gathered up and written to the FIFOs once per batch */
+#define CHAN_BUF_SIZE 4096
+
 #define CHANNELNAME   "chan"
 
 #define BOOL       char
@@ -62,12 +74,27 @@ struct
   char *chanPath;
   char *port;
   int speed;
-} options = {.nChannels=NUM_FIFOS, .chanPath="", .speed=115200};
+  int nTransfers;
+  char *rawFile;
+  char *timeFile;
+} options = {.nChannels=NUM_FIFOS, .chanPath="", .speed=115200, .nTransfers=NUM_TRANSFERS};
 
 // Runtime state
 struct
 {
   int fifo[MAX_FIFOS];
+  struct
+  {
+    uint8_t d[CHAN_BUF_SIZE];
+    int len;
+  } chan[MAX_FIFOS];
+  unsigned long dropped;	/* Channel bytes the FIFO readers were too slow for */
+  FILE *rawFile;		/* Copy of the trace stream as it came in */
+  FILE *timeFile;		/* Packets, one per line with their times */
+  struct timeval batchTime;	/* When the batch being decoded arrived */
+  unsigned long long itmTime;	/* Sum of the target's local timestamps */
+  int inFlight;			/* USB transfers submitted and not back yet */
+  BOOL usbError;
 } _r;
 
 // ====================================================================================================
@@ -178,6 +205,40 @@ static void _removeFifoTasks(void)
     }
 }
 // ====================================================================================================
+static void _flushChannel(int addr)
+
+/* Hand what a channel gathered to its FIFO, it is lost if the reader lags too far */
+
+{
+  int written=0;
+
+  while (written<_r.chan[addr].len)
+    {
+      int t=write(_r.fifo[addr],&_r.chan[addr].d[written],_r.chan[addr].len-written);
+      if (t<0 && errno==EINTR)
+	continue;
+      if (t<=0)
+	{
+	  _r.dropped+=_r.chan[addr].len-written;
+	  break;
+	}
+      written+=t;
+    }
+  _r.chan[addr].len=0;
+}
+// ====================================================================================================
+static void _flushChannels(void)
+
+{
+  for (int t=0; t<options.nChannels; t++)
+    {
+      if (_r.chan[t].len)
+	_flushChannel(t);
+    }
+  if (_r.timeFile)
+    fflush(_r.timeFile);
+}
+// ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
 // Handlers for each message type
@@ -187,17 +248,42 @@ static void _removeFifoTasks(void)
 void _handleSWIT(uint8_t addr, uint8_t length, uint8_t *d)
 
 {
-  if (addr<options.nChannels)
-    write(_r.fifo[addr],d,length);
+  if (addr>=options.nChannels)
+    return;
+
+  if (_r.chan[addr].len+length>CHAN_BUF_SIZE)
+    _flushChannel(addr);
+  memcpy(&_r.chan[addr].d[_r.chan[addr].len],d,length);
+  _r.chan[addr].len+=length;
 
-  //  if (addr==0)
-  //  fprintf(stdout,"%c",*d);
+  if (_r.timeFile)
+    {
+      /* Host time of the batch, target time from the timestamps, channel, then the bytes */
+      fprintf(_r.timeFile,"%ld.%06ld %llu %02d",(long)_r.batchTime.tv_sec,(long)_r.batchTime.tv_usec,_r.itmTime,addr);
+      for (int t=0; t<length; t++)
+	fprintf(_r.timeFile," %02x",d[t]);
+      fprintf(_r.timeFile,"\n");
+    }
 }
 // ====================================================================================================
 void _handleTS(uint8_t length, uint8_t *d)
 
+/* Local timestamps count the target's time since the previous one */
+
 {
+  unsigned long long delta=0;
 
+  if (length==1)
+    {
+      /* Short form, the time is in the header */
+      delta=(d[0]>>4)&0x07;
+    }
+  else
+    {
+      for (int t=length-1; t>0; t--)
+	delta=(delta<<7)|(d[t]&0x7f);
+    }
+  _r.itmTime+=delta;
 }
 // ====================================================================================================
 // ====================================================================================================
@@ -346,21 +432,24 @@ void intHandler(int dummy)
 void _printHelp(char *progName)
 
 {
-  printf("Useage: %s <dhnv> <b basedir> <p port> <s speed>\n",progName);
+  printf("Useage: %s <dhnv> <b basedir> <p port> <s speed> <u transfers> <w file> <t file>\n",progName);
   printf("        b: <basedir> for channels\n");
   printf("        h: This help\n");
   printf("        d: Dump received data without further processing\n");
   printf("        n: <Number> of channels to populate\n");
   printf("        p: <serialPort> to use\n");
   printf("        s: <serialSpeed> to use\n");
+  printf("        t: <file> to log each channel packet to with its host and target time\n");
+  printf("        u: <Number> of USB transfers to keep in flight (1..%d)\n",MAX_TRANSFERS);
   printf("        v: Verbose mode\n");
+  printf("        w: <file> to write the raw trace stream to\n");
 }
 // ====================================================================================================
 int _processOptions(int argc, char *argv[])
 
 {
   int c;
-  while ((c = getopt (argc, argv, "vdn:b:hp:s:")) != -1)
+  while ((c = getopt (argc, argv, "vdn:b:hp:s:t:u:w:")) != -1)
     switch (c)
       {
       case 'v':
@@ -389,8 +478,22 @@ int _processOptions(int argc, char *argv[])
       case 'b':
         options.chanPath = optarg;
         break;
+      case 't':
+	options.timeFile=optarg;
+	break;
+      case 'u':
+	options.nTransfers=atoi(optarg);
+	if ((options.nTransfers<1) || (options.nTransfers>MAX_TRANSFERS))
+	  {
+	    fprintf(stderr,"Number of transfers out of range (1..%d)\n",MAX_TRANSFERS);
+	    return FALSE;
+	  }
+	break;
+      case 'w':
+	options.rawFile=optarg;
+	break;
       case '?':
-        if (optopt == 'b')
+        if (strchr("bnpstuw",optopt))
           fprintf (stderr, "Option '%c' requires an argument.\n", optopt);
         else if (!isprint (optopt))
 	    fprintf (stderr,"Unknown option character `\\x%x'.\n", optopt);
@@ -410,47 +513,122 @@ int _processOptions(int argc, char *argv[])
   return TRUE;
 }
 // ====================================================================================================
-int usbFeeder(void)
+static void _processBatch(uint8_t *c, int size)
+
+/* Decode a batch of the trace stream and pass the channel data on in one go */
+
+{
+  if (_r.rawFile)
+    fwrite(c,1,size,_r.rawFile);
+
+  if (options.dump)
+    {
+      fwrite(c,1,size,stdout);
+      fflush(stdout);
+      return;
+    }
+
+  gettimeofday(&_r.batchTime,NULL);
+  while (size--)
+    _protocolPump(c++);
+  _flushChannels();
+}
+// ====================================================================================================
+static void LIBUSB_CALL _usbCallback(struct libusb_transfer *t)
+
+/* A transfer came back, decode what it got and send it straight out again */
 
 {
+  switch (t->status)
+    {
+    case LIBUSB_TRANSFER_COMPLETED:
+    case LIBUSB_TRANSFER_TIMED_OUT:
+      if (t->actual_length)
+	_processBatch(t->buffer,t->actual_length);
+      if (!_r.usbError && !libusb_submit_transfer(t))
+	return;
+      break;
+
+    case LIBUSB_TRANSFER_CANCELLED:
+      break;
+
+    default:
+      if (options.verbose)
+	fprintf(stderr,"USB transfer failed (%d)\n",t->status);
+      break;
+    }
+  /* Anything but a resubmission means the device needs reopening */
+  _r.usbError=TRUE;
+  _r.inFlight--;
+}
+// ====================================================================================================
+int usbFeeder(void)
 
-  unsigned char cbw[TRANSFER_SIZE];
+{
   libusb_device_handle *handle;
   libusb_device *dev;
-  int size;
+  struct libusb_transfer *transfer[MAX_TRANSFERS];
+  static unsigned char buffer[MAX_TRANSFERS][USB_TRANSFER_SIZE];
 
-  while (1)
+  if (libusb_init(NULL) < 0)
     {
-      if (libusb_init(NULL) < 0)
+      fprintf(stderr,"Failed to initalise USB interface\n");
+      return (-1);
+    }
+
+  for (int t=0; t<options.nTransfers; t++)
+    {
+      if (!(transfer[t]=libusb_alloc_transfer(0)))
 	{
-	  fprintf(stderr,"Failed to initalise USB interface\n");
+	  fprintf(stderr,"Failed to allocate USB transfers\n");
 	  return (-1);
 	}
+    }
 
+  while (1)
+    {
       while (!(handle = libusb_open_device_with_vid_pid(NULL, VID, PID)))
 	{
 	  usleep(500000);
 	}
 
-      if (!(dev = libusb_get_device(handle)))
-	continue;
+      if (!(dev = libusb_get_device(handle)) || libusb_claim_interface (handle, INTERFACE)<0)
+	{
+	  libusb_close(handle);
+	  usleep(500000);
+	  continue;
+	}
 
-      if (libusb_claim_interface (handle, INTERFACE)<0)
-	continue;
+      /* Keep several transfers queued so the probe never waits on the host */
+      _r.usbError=FALSE;
+      _r.inFlight=0;
+      for (int t=0; t<options.nTransfers; t++)
+	{
+	  libusb_fill_bulk_transfer(transfer[t], handle, ENDPOINT, buffer[t], USB_TRANSFER_SIZE,
+				    _usbCallback, NULL, USB_TIMEOUT_MS);
+	  if (libusb_submit_transfer(transfer[t]))
+	    {
+	      _r.usbError=TRUE;
+	      break;
+	    }
+	  _r.inFlight++;
+	}
 
-      while (0==libusb_bulk_transfer(handle, ENDPOINT, cbw, TRANSFER_SIZE, &size, 10))
+      while (!_r.usbError)
 	{
-	  unsigned char *c=cbw;
-          if (options.dump)
-          {
-              cbw[size] = 0;
-              printf("%s", (char*)cbw);
-          }
-          else
-              while (size--)
-                  _protocolPump(c++);
+	  if (libusb_handle_events(NULL)<0 && errno!=EINTR)
+	    _r.usbError=TRUE;
 	}
 
+      /* Get every transfer back before the device goes */
+      for (int t=0; t<options.nTransfers; t++)
+	libusb_cancel_transfer(transfer[t]);
+      while (_r.inFlight>0)
+	libusb_handle_events(NULL);
+
+      if (options.verbose)
+	fprintf(stderr,"Device lost, %lu channel bytes dropped\n",_r.dropped);
+      libusb_release_interface(handle, INTERFACE);
       libusb_close(handle);
     }
 }
@@ -459,7 +637,7 @@ int serialFeeder(void)
 
 {
   int f;
-  unsigned char cbw[TRANSFER_SIZE];
+  unsigned char cbw[USB_TRANSFER_SIZE];
   ssize_t t;
   struct termios settings;
 
@@ -505,12 +683,8 @@ int serialFeeder(void)
 
       tcflush(f, TCOFLUSH);
 
-      while ((t=read(f,cbw,TRANSFER_SIZE))>0)
-	{
-	  unsigned char *c=cbw;
-	  while (t--)
-	    _protocolPump(c++);
-	}
+      while ((t=read(f,cbw,USB_TRANSFER_SIZE))>0)
+	_processBatch(cbw,t);
       if (options.verbose)
 	{
 	  fprintf(stderr,"Read failed\n");
@@ -527,6 +701,17 @@ int main(int argc, char *argv[])
       exit(-1);
     }
 
+  if (options.rawFile && !(_r.rawFile=fopen(options.rawFile,"wb")))
+    {
+      perror(options.rawFile);
+      exit(-1);
+    }
+  if (options.timeFile && !(_r.timeFile=fopen(options.timeFile,"w")))
+    {
+      perror(options.timeFile);
+      exit(-1);
+    }
+
   atexit(_removeFifoTasks);
   /* This ensures the atexit gets called */
   signal(SIGINT, intHandler);
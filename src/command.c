@@ -31,18 +31,32 @@
 #include "target.h"
 #include "target_internal.h"
 #include "morse.h"
+#include "gdb_main.h"
 #include "version.h"
 #include "serialno.h"
 #include "jtagtap.h"
+#include "cortexm.h"
+#include "stats.h"
+#include "profile.h"
+#include "gcov.h"
+
+#ifdef PLATFORM_HAS_IMAGE_STORE
+#include "image_store.h"
+#endif
 
 #ifdef ENABLE_RTT
 #include "rtt.h"
+#include "sample.h"
 #endif
 
 #ifdef PLATFORM_HAS_TRACESWO
 #include "traceswo.h"
 #endif
 
+#ifdef PLATFORM_HAS_USBUART_FRAMED
+#include "usbuart.h"
+#endif
+
 #if defined(_WIN32) || defined(__CYGWIN__)
 #include <malloc.h>
 #else
@@ -54,27 +68,47 @@ static bool cmd_help(target *t, int argc, const char **argv);
 
 static bool cmd_jtag_scan(target *t, int argc, const char **argv);
 static bool cmd_swdp_scan(target *t, int argc, const char **argv);
-static bool cmd_auto_scan(target *t, int argc, const char **argv);
+static bool cmd_reattach(target *t, int argc, const char **argv);
 static bool cmd_frequency(target *t, int argc, const char **argv);
 static bool cmd_targets(target *t, int argc, const char **argv);
 static bool cmd_morse(target *t, int argc, const char **argv);
 static bool cmd_halt_timeout(target *t, int argc, const char **argv);
+static bool cmd_halt_poll(target *t, int argc, const char **argv);
+static bool cmd_swd_wait(target *t, int argc, const char **argv);
 static bool cmd_connect_reset(target *t, int argc, const char **argv);
+static bool cmd_lowpower_debug(target *t, int argc, const char **argv);
 static bool cmd_reset(target *t, int argc, const char **argv);
 static bool cmd_tdi_low_reset(target *t, int argc, const char **argv);
 #ifdef PLATFORM_HAS_POWER_SWITCH
 static bool cmd_target_power(target *t, int argc, const char **argv);
 #endif
 #ifdef PLATFORM_HAS_TRACESWO
+static bool cmd_trace(target *t, int argc, const char **argv);
 static bool cmd_traceswo(target *t, int argc, const char **argv);
+#if PC_HOSTED == 1
+static bool cmd_swo(target *t, int argc, const char **argv);
+#endif
 #endif
 static bool cmd_heapinfo(target *t, int argc, const char **argv);
+static bool cmd_bench(target *t, int argc, const char **argv);
+static bool cmd_stats(target *t, int argc, const char **argv);
+static bool cmd_latency(target *t, int argc, const char **argv);
+static bool cmd_profile(target *t, int argc, const char **argv);
+static bool cmd_gcov(target *t, int argc, const char **argv);
+#ifdef PLATFORM_HAS_IMAGE_STORE
+static bool cmd_image(target *t, int argc, const char **argv);
+static bool cmd_program(target *t, int argc, const char **argv);
+#endif
 #ifdef ENABLE_RTT
 static bool cmd_rtt(target *t, int argc, const char **argv);
+static bool cmd_sample(target *t, int argc, const char **argv);
 #endif
 #if defined(PLATFORM_HAS_DEBUG) && (PC_HOSTED == 0)
 static bool cmd_debug_bmp(target *t, int argc, const char **argv);
 #endif
+#ifdef PLATFORM_HAS_USBUART_FRAMED
+static bool cmd_uart_framed(target *t, int argc, const char **argv);
+#endif
 
 const command_t cmd_list[] = {
 	{"version", cmd_version, "Display firmware version info"},
@@ -82,29 +116,63 @@ const command_t cmd_list[] = {
 	{"jtag_scan", cmd_jtag_scan, "Scan JTAG chain for devices"},
 	{"swdp_scan", cmd_swdp_scan, "Scan SW-DP for devices"},
 	{"auto_scan", cmd_auto_scan, "Automatically scan all chain types for devices"},
-	{"frequency", cmd_frequency, "set minimum high and low times"},
+	{"reattach", cmd_reattach, "Keep the targets of the last scan if they still match, else scan again: (scan args)"},
+	{"frequency", cmd_frequency, "set minimum high and low times: (<freq>|auto)"},
 	{"targets", cmd_targets, "Display list of available targets"},
 	{"morse", cmd_morse, "Display morse error message"},
 	{"halt_timeout", cmd_halt_timeout, "Timeout (ms) to wait until Cortex-M is halted: (Default 2000)"},
+	{"halt_poll", cmd_halt_poll, "Halt poll interval backoff while running: (minms maxms (waitms))"},
+	{"swd_wait", cmd_swd_wait, "DP WAIT handling: (idle_cycles backoff_max timeout_ms (adaptive enable|disable))"},
 	{"connect_rst", cmd_connect_reset, "Configure connect under reset: (enable|disable)"},
+	{"lowpower_debug", cmd_lowpower_debug, "Keep debug running in target sleep/stop/standby on attach: (enable|disable)"},
 	{"reset", cmd_reset, "Pulse the nRST line - disconnects target"},
 	{"tdi_low_reset", cmd_tdi_low_reset, "Pulse nRST with TDI set low to attempt to wake certain targets up (eg LPC82x)"},
 #ifdef PLATFORM_HAS_POWER_SWITCH
 	{"tpwr", cmd_target_power, "Supplies power to the target: (enable|disable)"},
 #endif
 #ifdef ENABLE_RTT
-	{"rtt", cmd_rtt, "enable|disable|status|channel 0..15|ident (str)|cblock|poll maxms minms maxerr"},
+	{"rtt", cmd_rtt, "enable|disable|status|channel 0..15|ident (str)|address (addr)|mux (enable|disable|port)|auto (enable|disable)|cblock|poll maxms minms maxerr"},
+	{"sample", cmd_sample, "Read variables while the target runs: (add ADDR SIZE|clear|start RATE_HZ (channel)|stop|status)"},
 #endif
 #ifdef PLATFORM_HAS_TRACESWO
 #if defined TRACESWO_PROTOCOL && TRACESWO_PROTOCOL == 2
-	{"traceswo", cmd_traceswo, "Start trace capture, NRZ mode: (baudrate) (decode channel ...)"},
+	{"trace", cmd_trace, "Trace every write to a variable over SWO: var (ADDR (SIZE (baudrate (traceclk))))|clear"},
 #else
-	{"traceswo", cmd_traceswo, "Start trace capture, Manchester mode: (decode channel ...)"},
+	{"trace", cmd_trace, "Trace every write to a variable over SWO: var (ADDR (SIZE))|clear"},
+#endif
+#if defined TRACESWO_PROTOCOL && TRACESWO_PROTOCOL == 2
+	{"traceswo", cmd_traceswo,
+		"Start trace capture, NRZ mode: (baudrate|auto) (decode|records channel ...) | profile (baudrate (traceclk))"},
+#else
+	{"traceswo", cmd_traceswo, "Start trace capture, Manchester mode: (decode|records channel ...) | profile"},
+#endif
+#if PC_HOSTED == 1
+	{"swo", cmd_swo, "Where decoded SWO goes: (status|sink CHANNEL (stdout|off|tcp:PORT|FILE))"},
 #endif
 #endif
 	{"heapinfo", cmd_heapinfo, "Set semihosting heapinfo"},
+	{"bench", cmd_bench, "Measure DP, target memory and GDB link throughput"},
+	{"stats", cmd_stats, "Display performance counters: (reset)"},
+	{"latency", cmd_latency, "Display GDB packet service time histograms: (reset)"},
+#if PC_HOSTED == 1
+	{"profile", cmd_profile, "Sample the PC while the target runs: (start|stop|status|dump [gmon FILE])"},
+#else
+	{"profile", cmd_profile, "Sample the PC while the target runs: (start|stop|status|dump)"},
+#endif
+#if PC_HOSTED == 1
+	{"gcov", cmd_gcov, "Read out coverage counters, as qXfer:gcov:read or to a file: (ADDR SIZE (FILE))"},
+#else
+	{"gcov", cmd_gcov, "Read out coverage counters as qXfer:gcov:read: (ADDR SIZE)"},
+#endif
+#ifdef PLATFORM_HAS_IMAGE_STORE
+	{"image", cmd_image, "Target image kept on the probe: (status|store ADDR SIZE|erase)"},
+	{"program", cmd_program, "Program the target with the image kept on the probe"},
+#endif
 #if defined(PLATFORM_HAS_DEBUG) && (PC_HOSTED == 0)
 	{"debug_bmp", cmd_debug_bmp, "Output BMP \"debug\" strings to the second vcom: (enable|disable)"},
+#endif
+#ifdef PLATFORM_HAS_USBUART_FRAMED
+	{"uart_framed", cmd_uart_framed, "Timestamp the UART data on the second vcom, in frames: (enable|disable)"},
 #endif
 	{NULL, NULL, NULL},
 };
@@ -187,9 +255,13 @@ bool cmd_help(target *t, int argc, const char **argv)
 	return true;
 }
 
+/* Run again by "monitor reattach" when the targets no longer match */
+static bool (*last_scan)(target *t, int argc, const char **argv) = cmd_swdp_scan;
+
 static bool cmd_jtag_scan(target *t, int argc, const char **argv)
 {
 	(void)t;
+	last_scan = cmd_jtag_scan;
 	uint8_t irlens[argc];
 
 	if (platform_target_voltage())
@@ -239,6 +311,7 @@ static bool cmd_jtag_scan(target *t, int argc, const char **argv)
 bool cmd_swdp_scan(target *t, int argc, const char **argv)
 {
 	(void)t;
+	last_scan = cmd_swdp_scan;
 	volatile uint32_t targetid = 0;
 	if (argc > 1)
 		targetid = strtol(argv[1], NULL, 0);
@@ -284,6 +357,7 @@ bool cmd_auto_scan(target *t, int argc, const char **argv)
 	(void)t;
 	(void)argc;
 	(void)argv;
+	last_scan = cmd_auto_scan;
 
 	if (platform_target_voltage())
 		gdb_outf("Target voltage: %s\n", platform_target_voltage());
@@ -334,10 +408,116 @@ bool cmd_auto_scan(target *t, int argc, const char **argv)
 	return true;
 }
 
+/*
+ * Between detaching and attaching again the target list of the last scan is
+ * kept. If every target still answers as the part probed, the scan with its
+ * AP and ROM table walk and the probing of the drivers is skipped.
+ */
+static bool cmd_reattach(target *t, int argc, const char **argv)
+{
+	if (connect_assert_nrst)
+		platform_nrst_set_val(true); /* will be deasserted after attach */
+
+	bool valid = target_list;
+	for (target *cur = target_list; valid && cur; cur = cur->next)
+		valid = target_revalidate(cur);
+	if (!valid) {
+		platform_target_clk_output_enable(false);
+		if (target_list)
+			gdb_out("Targets changed, scanning again\n");
+		return last_scan(t, argc, argv);
+	}
+
+	cmd_targets(NULL, 0, NULL);
+	platform_target_clk_output_enable(false);
+	morse(NULL, false);
+	return true;
+}
+
+/* Set by "monitor frequency auto", cleared again by any explicit frequency */
+static bool frequency_auto = false;
+static bool frequency_retune = false;
+
+#define FREQUENCY_AUTO_MIN    100000U
+#define FREQUENCY_AUTO_MAX    100000000U
+#define FREQUENCY_AUTO_PASSES 8U
+
+static bool frequency_link_test(ADIv5_AP_t *ap)
+{
+	for (size_t pass = 0; pass < FREQUENCY_AUTO_PASSES; ++pass) {
+		if (!adiv5_link_test(ap))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Step the clock up by half again each time until the link test fails, then
+ * settle one step below the fastest rate that passed to leave some margin.
+ */
+static bool frequency_auto_tune(target *t)
+{
+	if (!t || !target_is_cortexm(t)) {
+		gdb_out("Automatic frequency selection needs an attached ARM Cortex-M target\n");
+		return false;
+	}
+	const uint32_t initial = platform_max_frequency_get();
+	if (initial == FREQ_FIXED)
+		return true;
+
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	uint32_t good = 0;
+	uint32_t margin = 0;
+	uint32_t last = 0;
+	for (uint32_t freq = FREQUENCY_AUTO_MIN; freq <= FREQUENCY_AUTO_MAX; freq += freq / 2U) {
+		platform_max_frequency_set(freq);
+		/* Several steps can map to the same divider, only test each rate once */
+		const uint32_t actual = platform_max_frequency_get();
+		if (actual == last)
+			continue;
+		last = actual;
+		if (!frequency_link_test(ap))
+			break;
+		margin = good;
+		good = freq;
+	}
+
+	platform_max_frequency_set(margin ? margin : good ? good : initial);
+	/* Clear whatever the failing pass left behind before checking the chosen rate */
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		adiv5_dp_error(ap->dp);
+	}
+	if (!good || !frequency_link_test(ap)) {
+		platform_max_frequency_set(initial);
+		gdb_out("No reliable SWJ frequency found\n");
+		return false;
+	}
+	return true;
+}
+
+void frequency_auto_lost(void)
+{
+	frequency_retune = frequency_auto;
+}
+
+void frequency_auto_attached(target *t)
+{
+	if (!frequency_retune)
+		return;
+	frequency_retune = false;
+	if (frequency_auto_tune(t))
+		DEBUG_INFO("SWJ frequency re-tuned to %" PRIu32 "Hz\n", platform_max_frequency_get());
+}
+
 bool cmd_frequency(target *t, int argc, const char **argv)
 {
-	(void)t;
-	if (argc == 2) {
+	if (argc == 2 && !strcmp(argv[1], "auto")) {
+		frequency_auto = true;
+		frequency_retune = false;
+		if (!frequency_auto_tune(t))
+			return false;
+	} else if (argc == 2) {
 		char *multiplier = NULL;
 		uint32_t frequency = strtoul(argv[1], &multiplier, 10);
 		if (!multiplier) {
@@ -352,6 +532,7 @@ bool cmd_frequency(target *t, int argc, const char **argv)
 			frequency *= 1000U * 1000U;
 			break;
 		}
+		frequency_auto = false;
 		platform_max_frequency_set(frequency);
 	}
 	const uint32_t freq = platform_max_frequency_get();
@@ -435,6 +616,57 @@ static bool cmd_connect_reset(target *t, int argc, const char **argv)
 	return true;
 }
 
+static bool cmd_lowpower_debug(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 2 || (argc == 2 && !parse_enable_or_disable(argv[1], &target_lowpower_debug)))
+		return false;
+	gdb_outf("Debug in low power modes on attach: %s\n", target_lowpower_debug ? "enabled" : "disabled");
+	return true;
+}
+
+static bool cmd_halt_poll(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 3 || argc == 4) {
+		halt_poll_min_ms = strtoul(argv[1], NULL, 0);
+		halt_poll_max_ms = strtoul(argv[2], NULL, 0);
+		if (argc == 4)
+			adiv5_poll_wait_ms = strtoul(argv[3], NULL, 0);
+	} else if (argc != 1) {
+		gdb_out("usage: monitor halt_poll [minms maxms [waitms]]\n");
+		return false;
+	}
+	gdb_outf("Halt poll interval: %" PRIu32 "ms to %" PRIu32 "ms, WAITs given up after %" PRIu32
+			 "ms, last measured %" PRIu32 " polls/s\n",
+		halt_poll_min_ms, halt_poll_max_ms, adiv5_poll_wait_ms, halt_poll_rate);
+	return true;
+}
+
+static bool cmd_swd_wait(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 4 || argc == 5) {
+		bool adaptive = adiv5_wait_policy.adaptive;
+		if (argc == 5 && !parse_enable_or_disable(argv[4], &adaptive))
+			return false;
+		adiv5_wait_policy.idle_cycles = MIN(strtoul(argv[1], NULL, 0), ADIV5_IDLE_CYCLES_MAX);
+		adiv5_wait_policy.backoff_max = MIN(strtoul(argv[2], NULL, 0), UINT8_MAX);
+		adiv5_wait_policy.timeout_ms = strtoul(argv[3], NULL, 0);
+		adiv5_wait_policy.adaptive = adaptive;
+#if PC_HOSTED == 1
+		platform_wait_policy_set();
+#endif
+	} else if (argc != 1) {
+		gdb_out("usage: monitor swd_wait [idle_cycles backoff_max timeout_ms [enable|disable]]\n");
+		return false;
+	}
+	gdb_outf("Idle cycles: %u%s, WAIT backoff up to %u cycles, WAITs given up after %" PRIu32 "ms\n",
+		adiv5_wait_policy.idle_cycles, adiv5_wait_policy.adaptive ? " and more as learned per AP" : "",
+		adiv5_wait_policy.backoff_max, adiv5_wait_policy.timeout_ms);
+	return true;
+}
+
 static bool cmd_halt_timeout(target *t, int argc, const char **argv)
 {
 	(void)t;
@@ -509,6 +741,8 @@ static bool cmd_rtt(target *t, int argc, const char **argv)
 		gdb_outf("rtt: %s found: %s ident: \"%s\"", on_or_off(rtt_enabled), rtt_found ? "yes" : "no",
 			rtt_ident[0] == '\0' ? "off" : rtt_ident);
 		gdb_outf(" halt: %s", on_or_off(target_no_background_memory_access(t)));
+		gdb_outf(" mux: %s", on_or_off(rtt_mux));
+		gdb_outf(" auto: %s", on_or_off(rtt_auto));
 		gdb_out(" channels: ");
 		if (rtt_auto_channel)
 			gdb_out("auto ");
@@ -554,6 +788,27 @@ static bool cmd_rtt(target *t, int argc, const char **argv)
 			if (rtt_ident[i] == '_')
 				rtt_ident[i] = ' ';
 		}
+	} else if ((argc == 2 || argc == 3) && !strncmp(argv[1], "address", command_len)) {
+		/* address of the control block, from the ELF, to save searching RAM for it */
+		rtt_cbaddr_hint = argc == 3 ? strtoul(argv[2], NULL, 0) : 0;
+		rtt_found = false;
+	} else if ((argc == 2 || argc == 3) && !strncmp(argv[1], "mux", command_len)) {
+		/* up channels kept apart, each on its own tcp port or framed on the usb uart */
+		const bool port_given = argc == 3 && argv[2][0] >= '0' && argv[2][0] <= '9';
+		bool mux = true;
+		if (argc == 3 && !port_given && !parse_enable_or_disable(argv[2], &mux))
+			return false;
+#if PC_HOSTED == 1
+		if (port_given)
+			rtt_mux_port = strtoul(argv[2], NULL, 0);
+#endif
+		rtt_mux = mux;
+	} else if ((argc == 2 || argc == 3) && !strncmp(argv[1], "auto", command_len)) {
+		/* capture from whatever target is found when gdb has none, the settings made so far are kept */
+		bool enable = true;
+		if (argc == 3 && !parse_enable_or_disable(argv[2], &enable))
+			return false;
+		rtt_auto_set(enable);
 	} else if (argc == 5 && !strncmp(argv[1], "poll", command_len)) {
 		/* set polling params */
 		rtt_max_poll_ms = strtoul(argv[2], NULL, 0);
@@ -563,28 +818,82 @@ static bool cmd_rtt(target *t, int argc, const char **argv)
 		gdb_out("what?\n");
 	return true;
 }
+
+static bool cmd_sample(target *t, int argc, const char **argv)
+{
+	const char *const action = argc > 1 ? argv[1] : "status";
+	if (!strcmp(action, "add") && argc == 4) {
+		const uint32_t addr = strtoul(argv[2], NULL, 0);
+		const size_t size = strtoul(argv[3], NULL, 0);
+		if (!sample_add(addr, size)) {
+			gdb_out("Sizes are 1, 2, 4 or 8, up to 8 variables and 48 bytes\n");
+			return false;
+		}
+	} else if (!strcmp(action, "clear"))
+		sample_clear();
+	else if (!strcmp(action, "start") && (argc == 3 || argc == 4)) {
+		const uint32_t rate = strtoul(argv[2], NULL, 0);
+		const uint32_t channel = argc == 4 ? strtoul(argv[3], NULL, 0) : SAMPLE_CHANNEL;
+		if (!sample_start(rate, channel)) {
+			gdb_out("Add variables first, the rate is 1 to 1000000 Hz and the channel 0..15\n");
+			return false;
+		}
+		if (t && target_no_background_memory_access(t))
+			gdb_out("This target must be halted to read its memory, it won't be sampled\n");
+		else
+			gdb_outf("Sampling on RTT channel %" PRIu32 " while the target runs\n", channel);
+		if (rtt_enabled && !rtt_mux)
+			gdb_out("RTT output shares the channel, use \"monitor rtt mux enable\" to keep them apart\n");
+	} else if (!strcmp(action, "stop")) {
+		sample_stop();
+		sample_print(gdb_outf);
+	} else if (!strcmp(action, "status"))
+		sample_print(gdb_outf);
+	else {
+		gdb_out("usage: monitor sample [add ADDR SIZE|clear|start RATE_HZ (channel)|stop|status]\n");
+		return false;
+	}
+	return true;
+}
 #endif
 
 #ifdef PLATFORM_HAS_TRACESWO
 static bool cmd_traceswo(target *t, int argc, const char **argv)
 {
-	(void)t;
 #if TRACESWO_PROTOCOL == 2
 	uint32_t baudrate = SWO_DEFAULT_BAUD;
+	uint32_t traceclk = 0;
 #endif
 	uint32_t swo_channelmask = 0; /* swo decoding off */
 	uint8_t decode_arg = 1;
+	/* argument: 'profile' literal, the target sends PC samples and exception trace */
+	const bool profile = argc > 1 && !strcmp(argv[1], "profile");
+	if (profile)
+		++decode_arg;
 #if TRACESWO_PROTOCOL == 2
 	/* argument: optional baud rate for async mode */
-	if (argc > 1 && argv[1][0] >= '0' && argv[1][0] <= '9') {
-		baudrate = strtoul(argv[1], NULL, 0);
+	if (argc > decode_arg && argv[decode_arg][0] >= '0' && argv[decode_arg][0] <= '9') {
+		baudrate = strtoul(argv[decode_arg], NULL, 0);
 		if (baudrate == 0)
 			baudrate = SWO_DEFAULT_BAUD;
-		decode_arg = 2;
+		++decode_arg;
 	}
+#if PC_HOSTED == 0
+	/* argument: 'auto' literal, the baud rate is measured from the line */
+	else if (!profile && argc > decode_arg && !strcmp(argv[decode_arg], "auto")) {
+		baudrate = SWO_AUTO_BAUD;
+		++decode_arg;
+	}
+#endif
+	/* argument: optional trace clock of the target, to set its SWO baud rate to match */
+	if (profile && argc > decode_arg)
+		traceclk = strtoul(argv[decode_arg], NULL, 0);
 #endif
+	/* argument: 'records' literal, every packet goes out as a binary record */
+	const bool records = !profile && argc > decode_arg && !strcmp(argv[decode_arg], "records");
 	/* argument: 'decode' literal */
-	if (argc > decode_arg && !strncmp(argv[decode_arg], "decode", strlen(argv[decode_arg]))) {
+	if (!profile && argc > decode_arg &&
+		(records || !strncmp(argv[decode_arg], "decode", strlen(argv[decode_arg])))) {
 		swo_channelmask = 0xFFFFFFFFU; /* decoding all channels */
 		/* arguments: channels to decode */
 		if (argc > decode_arg + 1) {
@@ -597,8 +906,31 @@ static bool cmd_traceswo(target *t, int argc, const char **argv)
 		}
 	}
 
+	if (profile) {
+		if (!t || !target_is_cortexm(t)) {
+			gdb_out("Profiling over SWO needs an attached Cortex-M target\n");
+			return false;
+		}
 #if TRACESWO_PROTOCOL == 2
-	gdb_outf("Baudrate: %lu ", baudrate);
+		const bool setup = cortexm_trace_profile_setup(t, false, traceclk, baudrate);
+#else
+		const bool setup = cortexm_trace_profile_setup(t, true, 0, 0);
+#endif
+		if (!setup) {
+			gdb_out("Target has no DWT PC sampling\n");
+			return false;
+		}
+		profile_start(PROFILE_SOURCE_SWO);
+	}
+	traceswo_setprofile(profile);
+	traceswo_setrecords(records);
+	traceswo_setdatatrace(false);
+
+#if TRACESWO_PROTOCOL == 2
+	if (baudrate)
+		gdb_outf("Baudrate: %" PRIu32 " ", baudrate);
+	else
+		gdb_out("Baudrate: auto ");
 #endif
 	gdb_outf("Channel mask: ");
 	for (size_t i = 0; i < 32; ++i) {
@@ -607,13 +939,106 @@ static bool cmd_traceswo(target *t, int argc, const char **argv)
 	}
 	gdb_outf("\n");
 
+#if PC_HOSTED == 1
+	if (!traceswo_init(baudrate, swo_channelmask)) {
+		gdb_out("Trace capture failed or not supported by this probe\n");
+		return false;
+	}
+	if (!profile)
+		gdb_out("Trace enabled, see \"monitor swo\" for where the channels go\n");
+#else
 #if TRACESWO_PROTOCOL == 2
-	traceswo_init(baudrate, swo_channelmask);
+	const bool measured = baudrate == SWO_AUTO_BAUD;
+	baudrate = traceswo_init(baudrate, swo_channelmask);
+	if (!baudrate) {
+		gdb_out("Could not measure the baud rate, is the target sending trace?\n");
+		return false;
+	}
+	if (measured)
+		gdb_outf("Measured baud rate: %" PRIu32 "\n", baudrate);
 #else
 	traceswo_init(swo_channelmask);
 #endif
 
-	gdb_outf("Trace enabled for BMP serial %s, USB EP 5\n", serial_no);
+	if (!profile)
+		gdb_outf("Trace enabled for BMP serial %s, USB EP 5\n", serial_no);
+#endif
+	if (profile)
+		gdb_out("Profiling over SWO, see \"monitor profile\" for the results\n");
+	return true;
+}
+
+#if PC_HOSTED == 1
+static bool cmd_swo(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc < 2 || !strcmp(argv[1], "status")) {
+		traceswo_status(gdb_outf);
+		return true;
+	}
+	if (strcmp(argv[1], "sink") || argc < 4) {
+		gdb_out("usage: monitor swo (status|sink CHANNEL (stdout|off|tcp:PORT|FILE))\n");
+		return false;
+	}
+	const uint32_t channel = strtoul(argv[2], NULL, 0);
+	if (channel >= 32U || !traceswo_sink(channel, argv[3])) {
+		gdb_outf("Can't send channel %s to %s\n", argv[2], argv[3]);
+		return false;
+	}
+	return true;
+}
+#endif
+
+/*
+ * Data trace, each write to a variable goes out as a record with its value.
+ * Anything else is "monitor traceswo" abbreviated, as it was before this.
+ */
+static bool cmd_trace(target *t, int argc, const char **argv)
+{
+	if (argc < 2 || (strcmp(argv[1], "var") && strcmp(argv[1], "clear")))
+		return cmd_traceswo(t, argc, argv);
+	if (!t || !target_is_cortexm(t)) {
+		gdb_out("Data trace needs an attached Cortex-M target\n");
+		return false;
+	}
+	if (!strcmp(argv[1], "clear")) {
+		cortexm_trace_var_clear(t);
+		traceswo_setdatatrace(false);
+		return true;
+	}
+	if (argc == 2) {
+		cortexm_trace_var_print(t, gdb_outf);
+		return true;
+	}
+	const uint32_t addr = strtoul(argv[2], NULL, 0);
+	const size_t size = argc > 3 ? strtoul(argv[3], NULL, 0) : 4U;
+#if TRACESWO_PROTOCOL == 2
+	uint32_t baudrate = argc > 4 ? strtoul(argv[4], NULL, 0) : 0;
+	if (!baudrate)
+		baudrate = SWO_DEFAULT_BAUD;
+	const uint32_t traceclk = argc > 5 ? strtoul(argv[5], NULL, 0) : 0;
+	const int comparator = cortexm_trace_var(t, addr, size, false, traceclk, baudrate);
+#else
+	const int comparator = cortexm_trace_var(t, addr, size, true, 0, 0);
+#endif
+	if (comparator < 0) {
+		gdb_out("No data trace for this: needs ARMv7-M, an aligned 1, 2 or 4 byte variable and a free comparator\n");
+		return false;
+	}
+	/* A profile over SWO carries on alongside */
+	traceswo_setrecords(false);
+	traceswo_setdatatrace(true);
+#if PC_HOSTED == 1
+	if (!traceswo_init(baudrate, 0)) {
+		gdb_out("Trace capture failed or not supported by this probe\n");
+		return false;
+	}
+#elif TRACESWO_PROTOCOL == 2
+	traceswo_init(baudrate, 0);
+#else
+	traceswo_init(0);
+#endif
+	gdb_outf("Writes to 0x%08" PRIx32 " traced by comparator %d\n", addr, comparator);
 	return true;
 }
 #endif
@@ -636,6 +1061,25 @@ static bool cmd_debug_bmp(target *t, int argc, const char **argv)
 }
 #endif
 
+#ifdef PLATFORM_HAS_USBUART_FRAMED
+static bool cmd_uart_framed(target *t, int argc, const char **argv)
+{
+	(void)t;
+	static bool framed;
+	if (argc == 2) {
+		if (!parse_enable_or_disable(argv[1], &framed))
+			return false;
+		usbuart_set_framed(framed);
+	} else if (argc > 2) {
+		gdb_outf("usage: monitor uart_framed [enable|disable]\n");
+		return false;
+	}
+
+	gdb_outf("UART framing is %s\n", framed ? "enabled" : "disabled");
+	return true;
+}
+#endif
+
 static bool cmd_heapinfo(target *t, int argc, const char **argv)
 {
 	if (t == NULL)
@@ -652,3 +1096,237 @@ static bool cmd_heapinfo(target *t, int argc, const char **argv)
 		gdb_outf("heapinfo heap_base heap_limit stack_base stack_limit\n");
 	return true;
 }
+
+/* Each measurement repeats for at least this long so the figures settle */
+#define BENCH_US          250000U
+#define BENCH_BLOCK_SIZE  1024U
+#define BENCH_GDB_PACKETS 32U
+
+static uint32_t bench_rate(const uint32_t count, const uint32_t elapsed_us)
+{
+	return (uint32_t)(((uint64_t)count * 1000000U) / MAX(elapsed_us, 1U));
+}
+
+static bool cmd_bench(target *t, int argc, const char **argv)
+{
+	(void)argc;
+	(void)argv;
+	uint32_t start;
+	uint32_t elapsed = 0;
+
+	if (t && t->core && t->core[0] == 'M') {
+		ADIv5_DP_t *const dp = cortexm_ap(t)->dp;
+		uint32_t count = 0;
+		start = platform_time_us();
+		do {
+			adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
+			++count;
+			elapsed = platform_time_us() - start;
+		} while (elapsed < BENCH_US);
+		gdb_outf("DP reads:          %8" PRIu32 " /s\n", bench_rate(count, elapsed));
+	}
+
+	struct target_ram *ram = t ? t->ram : NULL;
+	while (ram && ram->length < BENCH_BLOCK_SIZE)
+		ram = ram->next;
+	uint8_t *const buf = ram ? malloc(BENCH_BLOCK_SIZE) : NULL;
+	if (buf) {
+		uint32_t bytes = 0;
+		start = platform_time_us();
+		do {
+			if (target_mem_read(t, buf, ram->start, BENCH_BLOCK_SIZE))
+				break;
+			bytes += BENCH_BLOCK_SIZE;
+			elapsed = platform_time_us() - start;
+		} while (elapsed < BENCH_US);
+		gdb_outf("Memory read:       %8" PRIu32 " B/s\n", bench_rate(bytes, elapsed));
+		/* Writing back what was just read leaves the target's RAM as it was */
+		bytes = 0;
+		start = platform_time_us();
+		do {
+			if (target_mem_write(t, ram->start, buf, BENCH_BLOCK_SIZE))
+				break;
+			bytes += BENCH_BLOCK_SIZE;
+			elapsed = platform_time_us() - start;
+		} while (elapsed < BENCH_US);
+		gdb_outf("Memory write:      %8" PRIu32 " B/s\n", bench_rate(bytes, elapsed));
+		free(buf);
+	} else if (!t)
+		gdb_out("Attach to a target to measure DP and memory throughput\n");
+
+	/* Console output packets, blank so they don't flood GDB's console */
+	char line[128];
+	memset(line, ' ', sizeof(line) - 2U);
+	line[sizeof(line) - 2U] = '\r';
+	line[sizeof(line) - 1U] = '\0';
+	start = platform_time_us();
+	for (size_t i = 0; i < BENCH_GDB_PACKETS; ++i)
+		gdb_out(line);
+	elapsed = platform_time_us() - start;
+	const uint32_t payload = BENCH_GDB_PACKETS * (sizeof(line) - 1U);
+	/* Each is sent hex encoded with "$O" in front and "#xx" behind it */
+	const uint32_t wire = BENCH_GDB_PACKETS * ((2U * (sizeof(line) - 1U)) + 5U);
+	gdb_outf("GDB console out:   %8" PRIu32 " B/s, %" PRIu32 " B/s on the wire\n", bench_rate(payload, elapsed),
+		bench_rate(wire, elapsed));
+	return true;
+}
+
+static bool cmd_stats(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 2 && !strcmp(argv[1], "reset")) {
+		stats_reset();
+		gdb_out("Counters reset\n");
+		return true;
+	}
+	if (argc > 1) {
+		gdb_out("usage: monitor stats [reset]\n");
+		return false;
+	}
+	stats_print(gdb_outf);
+	return true;
+}
+
+static bool cmd_latency(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 2 && !strcmp(argv[1], "reset")) {
+		latency_reset();
+		gdb_out("Histograms reset\n");
+		return true;
+	}
+	if (argc > 1) {
+		gdb_out("usage: monitor latency [reset]\n");
+		return false;
+	}
+	if (!latency_print(gdb_outf))
+		gdb_out("No packets yet\n");
+	return true;
+}
+
+static bool cmd_profile(target *t, int argc, const char **argv)
+{
+	(void)t;
+	const char *const action = argc > 1 ? argv[1] : "status";
+	if (!strcmp(action, "start")) {
+		profile_start(PROFILE_SOURCE_PCSR);
+		gdb_out("Profiling started, samples are taken while the target runs\n");
+	} else if (!strcmp(action, "stop")) {
+		profile_stop();
+		profile_print(gdb_outf, false);
+	} else if (!strcmp(action, "status"))
+		profile_print(gdb_outf, false);
+#if PC_HOSTED == 1
+	else if (!strcmp(action, "dump") && argc == 4 && !strcmp(argv[2], "gmon")) {
+		if (!profile_write_gmon(argv[3])) {
+			gdb_outf("Writing %s failed\n", argv[3]);
+			return false;
+		}
+		gdb_outf("Histogram written to %s\n", argv[3]);
+	}
+#endif
+	else if (!strcmp(action, "dump") && argc == 2)
+		profile_print(gdb_outf, true);
+	else {
+#if PC_HOSTED == 1
+		gdb_out("usage: monitor profile [start|stop|status|dump [gmon FILE]]\n");
+#else
+		gdb_out("usage: monitor profile [start|stop|status|dump]\n");
+#endif
+		return false;
+	}
+	return true;
+}
+
+static bool cmd_gcov(target *t, int argc, const char **argv)
+{
+	target_addr base;
+	size_t size;
+	if (argc == 1) {
+		if (gcov_region(&base, &size))
+			gdb_outf("Coverage counters: %zu bytes at 0x%08" PRIx32 "\n", size, base);
+		else
+			gdb_out("No coverage counters set\n");
+		return true;
+	}
+#if PC_HOSTED == 1
+	if (argc != 3 && argc != 4) {
+		gdb_out("usage: monitor gcov [ADDR SIZE [FILE]]\n");
+#else
+	if (argc != 3) {
+		gdb_out("usage: monitor gcov [ADDR SIZE]\n");
+#endif
+		return false;
+	}
+	base = strtoul(argv[1], NULL, 0);
+	size = strtoul(argv[2], NULL, 0);
+	gcov_region_set(base, size);
+#if PC_HOSTED == 1
+	if (argc == 4) {
+		if (!t) {
+			gdb_out("No target attached\n");
+			return false;
+		}
+		const uint32_t start = platform_time_ms();
+		if (!gcov_write_file(t, argv[3])) {
+			gdb_outf("Writing %s failed\n", argv[3]);
+			return false;
+		}
+		gdb_outf("%zu bytes written to %s in %" PRIu32 " ms\n", size, argv[3], platform_time_ms() - start);
+	}
+#else
+	(void)t;
+#endif
+	return true;
+}
+
+#ifdef PLATFORM_HAS_IMAGE_STORE
+static bool cmd_image(target *t, int argc, const char **argv)
+{
+	uint32_t addr;
+	uint32_t len;
+	uint32_t crc;
+	const char *const action = argc > 1 ? argv[1] : "status";
+	if (!strcmp(action, "store") && argc == 4) {
+		if (!t) {
+			gdb_out("No target attached\n");
+			return false;
+		}
+		/* Typically the flash of a target GDB just loaded, which becomes the image */
+		if (!image_store_save(t, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0))) {
+			gdb_out("Storing the image failed\n");
+			return false;
+		}
+	} else if (!strcmp(action, "erase") && argc == 2) {
+		if (!image_store_erase()) {
+			gdb_out("Erasing the image store failed\n");
+			return false;
+		}
+	} else if (strcmp(action, "status") || argc > 2) {
+		gdb_out("usage: monitor image [status|store ADDR SIZE|erase]\n");
+		return false;
+	}
+	if (image_store_info(&addr, &len, &crc))
+		gdb_outf("Image: %" PRIu32 " bytes for 0x%08" PRIx32 ", CRC 0x%08" PRIx32 "\n", len, addr, crc);
+	else
+		gdb_out("No image stored\n");
+	return true;
+}
+
+static bool cmd_program(target *t, int argc, const char **argv)
+{
+	(void)argc;
+	(void)argv;
+	if (!t) {
+		gdb_out("No target attached\n");
+		return false;
+	}
+	const uint32_t start = platform_time_ms();
+	if (!image_store_program(t)) {
+		gdb_out("Programming failed\n");
+		return false;
+	}
+	gdb_outf("Programmed and verified in %" PRIu32 " ms\n", platform_time_ms() - start);
+	return true;
+}
+#endif
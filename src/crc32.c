@@ -21,6 +21,26 @@
 #include "general.h"
 #include "target.h"
 #include "gdb_if.h"
+#include "crc32.h"
+
+/* Nibble-wide table for checksumming data held on the probe itself */
+static const uint32_t crc32_nibble_table[16] = {
+	0x00000000, 0x04C11DB7, 0x09823B6E, 0x0D4326D9,
+	0x130476DC, 0x17C56B6B, 0x1A864DB2, 0x1E475005,
+	0x2608EDB8, 0x22C9F00F, 0x2F8AD6D6, 0x2B4BCB61,
+	0x350C9B64, 0x31CD86D3, 0x3C8EA00A, 0x384FBDBD,
+};
+
+uint32_t crc32_buf(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *data = buf;
+	while (len--) {
+		crc = (crc << 4) ^ crc32_nibble_table[(crc >> 28) ^ (*data >> 4)];
+		crc = (crc << 4) ^ crc32_nibble_table[(crc >> 28) ^ (*data & 0x0f)];
+		++data;
+	}
+	return crc;
+}
 
 #if !defined(STM32F0) && !defined(STM32F1) && !defined(STM32F2) && \
 	!defined(STM32F3) && !defined(STM32F4) && !defined(STM32F7) && \
@@ -98,16 +118,70 @@ static uint32_t crc32_calc(uint32_t crc, uint8_t data)
 	return (crc << 8) ^ crc32_table[((crc >> 24) ^ data) & 255];
 }
 
-int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
+#if PC_HOSTED == 1
+/*
+ * Slicing by 8: crc32_slice[k][b] is the CRC of byte b followed by k zero
+ * bytes, so eight bytes are folded in with eight independent lookups.
+ */
+static uint32_t crc32_slice[8][256];
+
+static void crc32_slice_init(void)
+{
+	if (crc32_slice[1][1])
+		return;
+	for (size_t b = 0; b < 256U; ++b)
+		crc32_slice[0][b] = crc32_table[b];
+	for (size_t k = 1; k < 8U; ++k) {
+		for (size_t b = 0; b < 256U; ++b) {
+			const uint32_t prev = crc32_slice[k - 1U][b];
+			crc32_slice[k][b] = (prev << 8U) ^ crc32_table[prev >> 24U];
+		}
+	}
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+	for (; len >= 8U; len -= 8U, data += 8U) {
+		crc ^= ((uint32_t)data[0] << 24U) | ((uint32_t)data[1] << 16U) | ((uint32_t)data[2] << 8U) | data[3];
+		crc = crc32_slice[7][crc >> 24U] ^ crc32_slice[6][(crc >> 16U) & 0xffU] ^
+			crc32_slice[5][(crc >> 8U) & 0xffU] ^ crc32_slice[4][crc & 0xffU] ^ crc32_slice[3][data[4]] ^
+			crc32_slice[2][data[5]] ^ crc32_slice[1][data[6]] ^ crc32_slice[0][data[7]];
+	}
+	while (len--)
+		crc = crc32_calc(crc, *data++);
+	return crc;
+}
+
+/*
+ * Reads are made larger while they come back quickly, which spares the
+ * per read overhead of the probe, and smaller again when they don't, so
+ * the keep alives for GDB still go out in time on a slow link.
+ */
+#define CRC32_CHUNK_MIN 0x1000U
+#define CRC32_CHUNK_MAX 0x10000U
+#define CRC32_CHUNK_MS  100U
+#else
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+	while (len--)
+		crc = crc32_calc(crc, *data++);
+	return crc;
+}
+#endif
+
+int crc32_range(crc32_read_func read, void *priv, uint32_t *crc_res, uint32_t base, size_t len)
 {
 	uint32_t crc = -1;
 #if PC_HOSTED == 1
 	/* Reading a 2 MByte on a H743 takes about 80 s@128, 28s @ 1k,
 	 * 22 s @ 4k and 21 s @ 64k
 	 */
-	uint8_t bytes[0x1000];
+	static uint8_t bytes[CRC32_CHUNK_MAX];
+	size_t chunk = CRC32_CHUNK_MIN;
+	crc32_slice_init();
 #else
 	uint8_t bytes[128];
+	const size_t chunk = sizeof(bytes);
 #endif
 #if defined(ENABLE_DEBUG)
 	uint32_t start_time = platform_time_ms();
@@ -119,15 +193,21 @@ int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 			last_time = actual_time;
 			gdb_if_putchar(0, true);
 		}
-		size_t read_len = MIN(sizeof(bytes), len);
-		if (target_mem_read(t, bytes, base, read_len)) {
+		size_t read_len = MIN(chunk, len);
+		if (read(priv, bytes, base, read_len)) {
 			DEBUG_WARN("generic_crc32 error around address 0x%08" PRIx32 "\n",
 					   base);
 			return -1;
 		}
+#if PC_HOSTED == 1
+		const uint32_t read_ms = platform_time_ms() - actual_time;
+		if (read_ms < CRC32_CHUNK_MS / 2U && read_len == chunk && chunk < CRC32_CHUNK_MAX)
+			chunk *= 2U;
+		else if (read_ms > CRC32_CHUNK_MS * 2U && chunk > CRC32_CHUNK_MIN)
+			chunk /= 2U;
+#endif
 
-		for (unsigned i = 0; i < read_len; i++)
-			crc = crc32_calc(crc, bytes[i]);
+		crc = crc32_update(crc, bytes, read_len);
 
 		base += read_len;
 		len -= read_len;
@@ -138,37 +218,127 @@ int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 }
 #else
 #include <libopencm3/stm32/crc.h>
-int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
+#ifdef CRC_DMA_BUS
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/rcc.h>
+#endif
+
+/*
+ * The target is read in blocks into two buffers in turn. Where the platform
+ * names a DMA channel for it, the CRC unit is fed from one buffer by memory
+ * to memory DMA while the next block comes in over SWD into the other.
+ * The CRC unit of the F1, F2 and F4 only takes words, most significant byte
+ * first, so those are byte swapped in the buffer. Later parts take the bytes
+ * themselves, in order, tail included.
+ */
+#define CRC32_BLOCK_SIZE 512U
+
+#if defined(STM32F1) || defined(STM32F2) || defined(STM32F4)
+#define CRC32_FEED_WORDS
+#else
+#define CRC32_DR8 (*(volatile uint8_t *)&CRC_DR)
+#endif
+
+static uint32_t crc32_blocks[2][CRC32_BLOCK_SIZE / 4U];
+#ifdef CRC_DMA_BUS
+static bool crc32_feeding;
+#endif
+
+static void crc32_feed_wait(void)
 {
-	uint8_t bytes[128];
-	uint32_t crc;
+#ifdef CRC_DMA_BUS
+	if (!crc32_feeding)
+		return;
+	while (!dma_get_interrupt_flag(CRC_DMA_BUS, CRC_DMA_CHAN, DMA_TCIF | DMA_TEIF))
+		continue;
+	dma_disable_channel(CRC_DMA_BUS, CRC_DMA_CHAN);
+	dma_clear_interrupt_flags(CRC_DMA_BUS, CRC_DMA_CHAN, DMA_GIF);
+	crc32_feeding = false;
+#endif
+}
+
+static void crc32_feed_start(const uint32_t *const block, const size_t len)
+{
+#ifdef CRC_DMA_BUS
+	dma_channel_reset(CRC_DMA_BUS, CRC_DMA_CHAN);
+	dma_set_peripheral_address(CRC_DMA_BUS, CRC_DMA_CHAN, (uint32_t)&CRC_DR);
+	dma_set_memory_address(CRC_DMA_BUS, CRC_DMA_CHAN, (uint32_t)block);
+	dma_set_read_from_memory(CRC_DMA_BUS, CRC_DMA_CHAN);
+	dma_enable_memory_increment_mode(CRC_DMA_BUS, CRC_DMA_CHAN);
+	dma_enable_mem2mem_mode(CRC_DMA_BUS, CRC_DMA_CHAN);
+#ifdef CRC32_FEED_WORDS
+	dma_set_number_of_data(CRC_DMA_BUS, CRC_DMA_CHAN, len / 4U);
+	dma_set_peripheral_size(CRC_DMA_BUS, CRC_DMA_CHAN, DMA_CCR_PSIZE_32BIT);
+	dma_set_memory_size(CRC_DMA_BUS, CRC_DMA_CHAN, DMA_CCR_MSIZE_32BIT);
+#else
+	dma_set_number_of_data(CRC_DMA_BUS, CRC_DMA_CHAN, len);
+	dma_set_peripheral_size(CRC_DMA_BUS, CRC_DMA_CHAN, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(CRC_DMA_BUS, CRC_DMA_CHAN, DMA_CCR_MSIZE_8BIT);
+#endif
+	dma_enable_channel(CRC_DMA_BUS, CRC_DMA_CHAN);
+	crc32_feeding = true;
+#else
+#ifdef CRC32_FEED_WORDS
+	for (size_t i = 0; i < len / 4U; ++i)
+		CRC_DR = block[i];
+#else
+	const uint8_t *const bytes = (const uint8_t *)block;
+	for (size_t i = 0; i < len; ++i)
+		CRC32_DR8 = bytes[i];
+#endif
+#endif
+}
 
+int crc32_range(crc32_read_func read, void *priv, uint32_t *crc_res, uint32_t base, size_t len)
+{
+#ifdef CRC_DMA_BUS
+	rcc_periph_clock_enable(CRC_DMA_CLK);
+#endif
 	CRC_CR |= CRC_CR_RESET;
 
+	size_t current = 0;
 	uint32_t last_time = platform_time_ms();
-	while (len > 3) {
+#ifdef CRC32_FEED_WORDS
+	while (len > 3U) {
+#else
+	while (len) {
+#endif
 		uint32_t actual_time = platform_time_ms();
 		if ( actual_time > last_time + 1000) {
 			last_time = actual_time;
 			gdb_if_putchar(0, true);
 		}
-		size_t read_len = MIN(sizeof(bytes), len) & ~3;
-		if (target_mem_read(t, bytes, base, read_len)) {
+		uint32_t *const block = crc32_blocks[current];
+#ifdef CRC32_FEED_WORDS
+		const size_t read_len = MIN(CRC32_BLOCK_SIZE, len) & ~3U;
+#else
+		const size_t read_len = MIN(CRC32_BLOCK_SIZE, len);
+#endif
+		if (read(priv, block, base, read_len)) {
+			crc32_feed_wait();
 			DEBUG_WARN("generic_crc32 error around address 0x%08" PRIx32 "\n",
 					   base);
 			return -1;
 		}
-
-		for (unsigned i = 0; i < read_len; i += 4)
-			CRC_DR = __builtin_bswap32(*(uint32_t*)(bytes+i));
+#ifdef CRC32_FEED_WORDS
+		for (size_t i = 0; i < read_len / 4U; ++i)
+			block[i] = __builtin_bswap32(block[i]);
+#endif
+		/* The other buffer has gone into the CRC unit while this one was read */
+		crc32_feed_wait();
+		crc32_feed_start(block, read_len);
+		current ^= 1U;
 
 		base += read_len;
 		len -= read_len;
 	}
+	crc32_feed_wait();
 
-	crc = CRC_DR;
+	uint32_t crc = CRC_DR;
 
-	if (target_mem_read(t, bytes, base, len)) {
+#ifdef CRC32_FEED_WORDS
+	uint8_t bytes[4];
+	if (read(priv, bytes, base, len)) {
 		DEBUG_WARN("generic_crc32 error around address 0x%08" PRIx32 "\n",
 				   base);
 		return -1;
@@ -183,8 +353,18 @@ int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 				crc <<= 1;
 		}
 	}
+#endif
 	*crc_res = crc;
 	return 0;
 }
 #endif
 
+static int crc32_target_read(void *priv, void *dest, uint32_t src, size_t len)
+{
+	return target_mem_read((target *)priv, dest, src, len);
+}
+
+int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
+{
+	return crc32_range(crc32_target_read, t, crc_res, base, len);
+}
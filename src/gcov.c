@@ -0,0 +1,88 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements the coverage counter dump behind "monitor gcov".
+ * Firmware built with -fprofile-arcs keeps its counters in RAM; with the
+ * counters gathered into one region by the linker script, that region is
+ * read out as it is, in as few transfers as the probe allows. Turning the
+ * raw counters into .gcda files is left to the host, which has the ELF and
+ * knows the compiler's gcov_info layout.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "gcov.h"
+
+#if PC_HOSTED == 1
+#include <errno.h>
+
+/* Big enough for the probe's per transfer overhead to stop mattering */
+#define GCOV_CHUNK 0x10000U
+#endif
+
+static target_addr gcov_base;
+static size_t gcov_size;
+
+void gcov_region_set(const target_addr base, const size_t size)
+{
+	gcov_base = base;
+	gcov_size = size;
+}
+
+bool gcov_region(target_addr *const base, size_t *const size)
+{
+	*base = gcov_base;
+	*size = gcov_size;
+	return gcov_size != 0;
+}
+
+ssize_t gcov_read(target *const t, void *const buf, const size_t offset, size_t len)
+{
+	if (!gcov_size || offset > gcov_size)
+		return -1;
+	len = MIN(len, gcov_size - offset);
+	if (len && target_mem_read(t, buf, gcov_base + offset, len))
+		return -1;
+	return len;
+}
+
+#if PC_HOSTED == 1
+bool gcov_write_file(target *const t, const char *const filename)
+{
+	uint8_t *const buf = malloc(MIN(gcov_size, GCOV_CHUNK));
+	if (!buf) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	FILE *const file = fopen(filename, "wb");
+	if (!file) {
+		DEBUG_WARN("Can not open %s: %s\n", filename, strerror(errno));
+		free(buf);
+		return false;
+	}
+	bool ok = true;
+	for (size_t offset = 0; ok && offset < gcov_size; offset += GCOV_CHUNK) {
+		const ssize_t len = gcov_read(t, buf, offset, GCOV_CHUNK);
+		ok = len > 0 && fwrite(buf, len, 1, file) == 1;
+	}
+	ok = fclose(file) == 0 && ok;
+	free(buf);
+	if (!ok)
+		DEBUG_WARN("Writing %s failed\n", filename);
+	return ok;
+}
+#endif
@@ -27,6 +27,7 @@
 #include "general.h"
 #include "ctype.h"
 #include "hex_utils.h"
+#include "lz4.h"
 #include "gdb_if.h"
 #include "gdb_packet.h"
 #include "gdb_main.h"
@@ -35,6 +36,10 @@
 #include "command.h"
 #include "crc32.h"
 #include "morse.h"
+#include "stats.h"
+#include "gcov.h"
+#include "rtos.h"
+#include "sched_tasks.h"
 #ifdef ENABLE_RTT
 #include "rtt.h"
 #endif
@@ -52,10 +57,29 @@ enum gdb_signal {
 	GDB_SIGLOST = 29,
 };
 
-#define BUF_SIZE	1024U
+/* GDB_PACKET_BUFFER_SIZE is set in ram_budget.h, or by platforms with RAM to spare */
+#define BUF_SIZE	GDB_PACKET_BUFFER_SIZE
+
+/*
+ * Largest data a vFlashWriteLZ4 packet may decode to. Flash images are mostly
+ * padding and repeated constants, so a packet carries a few times its size.
+ */
+#ifndef GDB_FLASH_LZ4_SIZE
+#define GDB_FLASH_LZ4_SIZE (4U * GDB_PACKET_BUFFER_SIZE)
+#endif
 
 #define ERROR_IF_NO_TARGET()	\
 	if(!cur_target) { gdb_putpacketz("EFF"); break; }
+/*
+ * In non-stop mode packets keep coming while the target runs, these need it
+ * halted. A semihosting call's packets come with the target halted on it.
+ */
+#define ERROR_IF_RUNNING()	\
+	if(cur_target_running && !in_syscall) { gdb_putpacketz("E01"); break; }
+/* And memory access while it runs only where the target allows that */
+#define ERROR_IF_NO_BACKGROUND_ACCESS()	\
+	if(cur_target_running && !in_syscall && target_no_background_memory_access(cur_target)) { \
+		gdb_putpacketz("E01"); break; }
 
 typedef struct
 {
@@ -65,22 +89,72 @@ typedef struct
 
 static char pbuf[BUF_SIZE + 1U];
 
+/*
+ * While the target runs, halt polling starts out fast right after resume and
+ * backs off exponentially towards halt_poll_max_ms, so a long running target
+ * doesn't keep the debug link saturated with DHCSR reads.
+ */
+uint32_t halt_poll_min_ms = 0;
+uint32_t halt_poll_max_ms = 32;
+uint32_t halt_poll_rate = 0; /* Polls per second measured during the last run */
+
 static target *cur_target;
 static target *last_target;
+/* Set while GDB waits on cur_target to halt */
+static bool cur_target_running = false;
+/*
+ * GDB's non-stop mode: resuming is answered at once and GDB goes on sending
+ * packets while the target runs. The halt is found polling between them and
+ * reported with a %Stop notification.
+ */
+static bool gdb_non_stop = false;
+/* The halt was asked for with vCont;t, which is reported as signal 0 rather than SIGINT */
+static bool gdb_stop_requested = false;
+static uint32_t gdb_poll_interval;
 static bool gdb_needs_detach_notify = false;
+/* The thread 'Hg' selected for register access, 0 for the one on the core */
+static uint32_t gdb_thread = 0;
+static uint8_t flash_mode = 0;
+/* Set when a write-behind vFlashWrite failed, reported on the next Flash packet */
+static bool flash_write_failed = false;
+/* Decoded vFlashWriteLZ4 data, only held on to until vFlashDone */
+static uint8_t *flash_lz4_buf = NULL;
 
 static void handle_q_packet(char *packet, size_t len);
 static void handle_v_packet(char *packet, size_t len);
+static bool handle_vcont(const char *packet);
 static void handle_z_packet(char *packet, size_t len);
 static void handle_kill_target(void);
+#if PC_HOSTED == 1
+static bool gdb_sessions_destroy(struct target_controller *tc, target *t);
+#endif
+
+/* The target ran or changed, so the threads read while it was halted are stale */
+static void gdb_threads_lost(void)
+{
+	gdb_thread = 0;
+	rtos_invalidate();
+}
+
+/* The RTOS's threads are read with the target halted, in non-stop mode it may not be */
+static target *gdb_threads_target(void)
+{
+	return cur_target_running ? NULL : cur_target;
+}
 
 static void gdb_target_destroy_callback(struct target_controller *tc, target *t)
 {
+#if PC_HOSTED == 1
+	if (gdb_sessions_destroy(tc, t))
+		return;
+#endif
 	(void)tc;
+	gdb_threads_lost();
 	if (cur_target == t) {
-		gdb_put_notificationz("%Stop:W00");
+		gdb_put_notificationz("Stop:W00");
 		gdb_out("You are now detached from the previous target.\n");
 		cur_target = NULL;
+		cur_target_running = false;
 		gdb_needs_detach_notify = true;
 	}
 
@@ -113,14 +187,397 @@ static struct target_controller gdb_controller = {
 	.system = hostio_system,
 };
 
+/* What GDB attaches targets with, each session has its own so its targets can be told apart */
+static struct target_controller *gdb_tc = &gdb_controller;
+
+#if PC_HOSTED == 1
+/*
+ * Hosted can serve a GDB per core, each on a port of its own (-g). Packets
+ * are served a session at a time, and the state above is swapped for that
+ * of the session each one came from. The targets stay on target_list, so
+ * moving between sessions needs no scan and each core's DP and AP keep
+ * their cached selection. No session's resume is waited on: its halt is
+ * polled for between packets, as in non-stop mode, and reported with the
+ * stop reply GDB is waiting for.
+ */
+#define GDB_MAX_SESSIONS 8U
+
+typedef struct gdb_session {
+	struct target_controller controller;
+	target *cur_target;
+	target *last_target;
+	bool cur_target_running;
+	bool non_stop;
+	bool stop_requested;
+	uint32_t poll_interval;
+	bool needs_detach_notify;
+	uint32_t thread;
+	bool noackmode;
+	uint8_t flash_mode;
+	bool flash_write_failed;
+	uint8_t *flash_lz4_buf;
+} gdb_session_s;
+
+static gdb_session_s gdb_sessions[GDB_MAX_SESSIONS];
+static bool gdb_sessions_ready = false;
+
+static void gdb_session_save(gdb_session_s *const session)
+{
+	session->cur_target = cur_target;
+	session->last_target = last_target;
+	session->cur_target_running = cur_target_running;
+	session->non_stop = gdb_non_stop;
+	session->stop_requested = gdb_stop_requested;
+	session->poll_interval = gdb_poll_interval;
+	session->needs_detach_notify = gdb_needs_detach_notify;
+	session->thread = gdb_thread;
+	session->noackmode = gdb_noackmode();
+	session->flash_mode = flash_mode;
+	session->flash_write_failed = flash_write_failed;
+	session->flash_lz4_buf = flash_lz4_buf;
+}
+
+static void gdb_session_load(gdb_session_s *const session)
+{
+	cur_target = session->cur_target;
+	last_target = session->last_target;
+	cur_target_running = session->cur_target_running;
+	gdb_non_stop = session->non_stop;
+	gdb_stop_requested = session->stop_requested;
+	gdb_poll_interval = session->poll_interval;
+	gdb_needs_detach_notify = session->needs_detach_notify;
+	gdb_thread = session->thread;
+	gdb_set_noackmode(session->noackmode);
+	flash_mode = session->flash_mode;
+	flash_write_failed = session->flash_write_failed;
+	flash_lz4_buf = session->flash_lz4_buf;
+	gdb_tc = &session->controller;
+}
+
+/* Every session starts out as the one GDB session there is without -g */
+static void gdb_sessions_init(void)
+{
+	if (gdb_sessions_ready || gdb_if_sessions() < 2U)
+		return;
+	for (size_t i = 0; i < gdb_if_sessions(); ++i) {
+		gdb_session_save(&gdb_sessions[i]);
+		gdb_sessions[i].controller = gdb_controller;
+	}
+	gdb_tc = &gdb_sessions[gdb_if_session()].controller;
+	gdb_sessions_ready = true;
+}
+
+void gdb_session_switch(const size_t session)
+{
+	const size_t current = gdb_if_session();
+	if (session == current)
+		return;
+	gdb_session_save(&gdb_sessions[current]);
+	gdb_session_load(&gdb_sessions[session]);
+	gdb_if_session_select(session);
+	/* The RTOS threads read are those of the target of the session before */
+	rtos_invalidate();
+}
+
+/* The target session is attached to, the current one's is in cur_target */
+static target *gdb_session_target(const size_t session)
+{
+	return session == gdb_if_session() ? cur_target : gdb_sessions[session].cur_target;
+}
+
+/* Whether the GDB of another session is attached to t, which is then left to that one */
+static bool gdb_target_taken(const target *const t)
+{
+	for (size_t i = 0; i < gdb_if_sessions(); ++i) {
+		if (i != gdb_if_session() && gdb_session_target(i) == t) {
+			DEBUG_WARN("Target is attached to by the GDB of session %zu\n", i);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Any session may have had a target that goes away, each is told on its own port */
+static bool gdb_sessions_destroy(struct target_controller *const tc, target *const t)
+{
+	static bool all_sessions = false;
+	if (!gdb_sessions_ready || all_sessions)
+		return false;
+	const size_t current = gdb_if_session();
+	all_sessions = true;
+	for (size_t i = 0; i < gdb_if_sessions(); ++i) {
+		gdb_session_switch(i);
+		gdb_target_destroy_callback(tc, t);
+	}
+	gdb_session_switch(current);
+	all_sessions = false;
+	return true;
+}
+
+typedef struct gdb_target_find {
+	size_t n;
+	target *t;
+} gdb_target_find_s;
+
+static void gdb_target_find(const int i, target *const t, void *const context)
+{
+	gdb_target_find_s *const find = (gdb_target_find_s *)context;
+	if ((size_t)i == find->n)
+		find->t = t;
+}
+#endif
+
+static target *gdb_attach(target *const t)
+{
+#if PC_HOSTED == 1
+	if (gdb_target_taken(t))
+		return NULL;
+#endif
+	return target_attach(t, gdb_tc);
+}
+
+static target *gdb_attach_n(const size_t n)
+{
+#if PC_HOSTED == 1
+	gdb_target_find_s find = {n, NULL};
+	target_foreach(gdb_target_find, &find);
+	if (find.t && gdb_target_taken(find.t))
+		return NULL;
+#endif
+	return target_attach_n(n, gdb_tc);
+}
+
+target *gdb_background_target(void)
+{
+	/* GDB's own target is halted while GDB is between packets */
+	if (cur_target)
+		return NULL;
+#ifdef ENABLE_RTT
+	/* One GDB detached from is left running, RTT can go on if that doesn't need a halt */
+	if (last_target && !target_no_background_memory_access(last_target))
+		return last_target;
+	/* Or the one found for capturing RTT without GDB */
+	if (!last_target)
+		return rtt_auto_target();
+#endif
+	return NULL;
+}
+
+target *gdb_shared_target(bool *const running)
+{
+	*running = !cur_target || cur_target_running;
+	if (cur_target)
+		return cur_target;
+	if (last_target && !target_no_background_memory_access(last_target))
+		return last_target;
+	return gdb_background_target();
+}
+
+bool gdb_target_attached(void)
+{
+#if PC_HOSTED == 1
+	for (size_t i = 0; gdb_sessions_ready && i < gdb_if_sessions(); ++i) {
+		if (gdb_session_target(i))
+			return true;
+	}
+#endif
+	return cur_target != NULL;
+}
+
+void gdb_background_lost(void)
+{
+	target_list_free();
+	last_target = NULL;
+#ifdef ENABLE_RTT
+	rtt_auto_lost();
+#endif
+}
+
+/* Sends the stop reply for reason, or as the %Stop notification of non-stop mode */
+static void gdb_stop_reply(const enum target_halt_reason reason, const target_addr watch, const bool notify)
+{
+	/* With an RTOS running, say which of its threads stopped. Non-stop mode always needs one */
+	char thread[20] = "";
+	uint32_t thread_id = reason == TARGET_HALT_ERROR ? 0 : rtos_current_thread(cur_target);
+	if (!thread_id && gdb_non_stop)
+		thread_id = 1;
+	if (thread_id)
+		snprintf(thread, sizeof(thread), "thread:%" PRIx32 ";", thread_id);
+
+	/* Translate reason to GDB signal, "Stop:" leaves room for the notification's name */
+	char reply[48] = "Stop:";
+	char *const stop = reply + 5U;
+	const size_t stop_size = sizeof(reply) - 5U;
+	switch (reason) {
+	case TARGET_HALT_ERROR:
+		snprintf(stop, stop_size, "X%02X", GDB_SIGLOST);
+		morse("TARGET LOST.", true);
+		frequency_auto_lost();
+		break;
+	case TARGET_HALT_REQUEST:
+		snprintf(stop, stop_size, "T%02X%s", gdb_stop_requested ? 0 : GDB_SIGINT, thread);
+		break;
+	case TARGET_HALT_WATCHPOINT:
+		snprintf(stop, stop_size, "T%02Xwatch:%08X;%s", GDB_SIGTRAP, watch, thread);
+		break;
+	case TARGET_HALT_FAULT:
+		snprintf(stop, stop_size, "T%02X%s", GDB_SIGSEGV, thread);
+		break;
+	default:
+		snprintf(stop, stop_size, "T%02X%s", GDB_SIGTRAP, thread);
+	}
+	gdb_stop_requested = false;
+	if (notify)
+		gdb_put_notificationz(reply);
+	else
+		gdb_putpacketz(stop);
+}
+
+/* Wait for the target to halt and send the stop reply */
+static void handle_halt_wait(void)
+{
+	target_addr watch;
+	enum target_halt_reason reason;
+
+	if (!cur_target) {
+		/* Report "target exited" if no target */
+		gdb_putpacketz("W00");
+		return;
+	}
+
+	/* Wait for target halt */
+	gdb_threads_lost();
+	cur_target_running = true;
+	uint32_t poll_interval = halt_poll_min_ms;
+	uint32_t polls = 0;
+	uint32_t poll_window_start = platform_time_ms();
+	while(!(reason = target_halt_poll(cur_target, &watch))) {
+		const uint32_t now = platform_time_ms();
+		++polls;
+		if (now - poll_window_start >= 1000U) {
+			halt_poll_rate = (polls * 1000U) / (now - poll_window_start);
+			polls = 0;
+			poll_window_start = now;
+		}
+		/* Don't starve the background tasks of their slots */
+		uint32_t wait = MIN(poll_interval, sched_poll(cur_target));
+		/* Sleep until the next poll is due, while still reacting to GDB at once */
+		#if PC_HOSTED == 1
+		/* Or spend that time waiting for the halt on the probe when it can */
+		if (wait && target_halt_wait(cur_target, wait))
+			wait = 0;
+		#endif
+		char c = (char)gdb_getchar_to(wait);
+		if(c == '\x03' || c == '\x04') {
+			target_halt_request(cur_target);
+			/* The halt should follow shortly, go back to polling fast */
+			poll_interval = halt_poll_min_ms;
+		} else
+			poll_interval = MIN(poll_interval * 2U + 1U, MAX(halt_poll_max_ms, halt_poll_min_ms));
+	}
+	cur_target_running = false;
+	SET_RUN_STATE(0);
+	gdb_stop_reply(reason, watch, false);
+}
+
+/* The target was resumed, wait for the halt or in non-stop mode answer at once and poll for it while idle */
+static void gdb_resumed(void)
+{
+#if PC_HOSTED == 1
+	/* A ^C from before the resume isn't for this run */
+	gdb_if_interrupted();
+	/* With several sessions the halt is polled for even in all-stop mode, to serve the others meanwhile */
+	const bool wait = !gdb_non_stop && !gdb_sessions_ready;
+#else
+	const bool wait = !gdb_non_stop;
+#endif
+	if (wait) {
+		handle_halt_wait();
+		return;
+	}
+	gdb_threads_lost();
+	cur_target_running = true;
+	gdb_poll_interval = halt_poll_min_ms;
+	/* In all-stop mode the stop reply, once it halts, is the answer */
+	if (gdb_non_stop)
+		gdb_putpacketz("OK");
+}
+
+/* Polls the running target, returns how long until it wants polling again */
+static uint32_t gdb_target_poll(void)
+{
+#if PC_HOSTED == 1
+	/* GDB in all-stop mode interrupts the run with ^C */
+	if (gdb_if_interrupted()) {
+		target_halt_request(cur_target);
+		gdb_poll_interval = halt_poll_min_ms;
+	}
+#endif
+	target_addr watch;
+	const enum target_halt_reason reason = target_halt_poll(cur_target, &watch);
+	if (reason == TARGET_HALT_RUNNING) {
+		const uint32_t wait = MIN(gdb_poll_interval, sched_poll(cur_target));
+		gdb_poll_interval = MIN(gdb_poll_interval * 2U + 1U, MAX(halt_poll_max_ms, halt_poll_min_ms));
+		return wait;
+	}
+	cur_target_running = false;
+	SET_RUN_STATE(0);
+	/* Whatever was read of the threads while it ran is stale now */
+	gdb_threads_lost();
+	gdb_stop_reply(reason, watch, gdb_non_stop);
+	return 0;
+}
+
+#if PC_HOSTED == 1
+/* Polls the running targets of all sessions in turn, each halt going to its own session's GDB */
+static uint32_t gdb_sessions_poll(void)
+{
+	uint32_t wait = SCHED_IDLE;
+	bool running = false;
+	for (size_t i = 0; i < gdb_if_sessions(); ++i) {
+		if (i == gdb_if_session() ? !cur_target_running : !gdb_sessions[i].cur_target_running)
+			continue;
+		gdb_session_switch(i);
+		running = true;
+		const uint32_t target_wait = gdb_target_poll();
+		wait = MIN(wait, target_wait);
+	}
+	return running ? wait : sched_idle_poll();
+}
+#endif
+
+/* Called while waiting for a packet, returns how long until it wants calling again */
+uint32_t gdb_idle_poll(void)
+{
+#if PC_HOSTED == 1
+	/* While a semihosting call is served only its session is */
+	if (gdb_sessions_ready && !gdb_if_session_pinned())
+		return gdb_sessions_poll();
+#endif
+	if (!cur_target_running)
+		return sched_idle_poll();
+	return gdb_target_poll();
+}
+
 int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 {
 	bool single_step = false;
 
+#if PC_HOSTED == 1
+	/* A semihosting call's packets come from the session whose target made it */
+	gdb_if_session_pin(in_syscall);
+#endif
 	/* GDB protocol main loop */
+	uint32_t host_wait_start = platform_time_us();
 	while (1) {
 		SET_IDLE_STATE(1);
 		size_t size = gdb_getpacket(pbuf, BUF_SIZE);
+		const uint32_t service_start = platform_time_us();
+		latency_add(LATENCY_HOST, service_start - host_wait_start);
+		const uint8_t latency_type = latency_kind(pbuf, size);
+#if PC_HOSTED == 1
+		stats_poll();
+#endif
 		// If port closed and target detached, stay idle
 		if ((pbuf[0] != 0x04) || cur_target) {
 			SET_IDLE_STATE(0);
@@ -129,14 +586,29 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 		/* Implementation of these is mandatory! */
 		case 'g': { /* 'g': Read general registers */
 			ERROR_IF_NO_TARGET();
-			uint8_t gp_regs[target_regs_size(cur_target)];
-			target_regs_read(cur_target, gp_regs);
-			gdb_putpacket(hexify(pbuf, gp_regs, sizeof(gp_regs)), sizeof(gp_regs) * 2U);
+			ERROR_IF_RUNNING();
+			const size_t regs_size = target_regs_size_core(cur_target);
+			if (regs_size > sizeof(pbuf) / 2U) {
+				gdb_putpacketz("E02");
+				break;
+			}
+			/* A switched out thread only has what it stacked, the rest is unavailable */
+			const uint32_t *const stacked = rtos_thread_regs(cur_target, gdb_thread);
+			if (stacked) {
+				const size_t stacked_size = MIN(RTOS_STACKED_REGS * 4U, regs_size);
+				hexify(pbuf, stacked, stacked_size);
+				memset(pbuf + stacked_size * 2U, 'x', (regs_size - stacked_size) * 2U);
+				gdb_putpacket(pbuf, regs_size * 2U);
+				break;
+			}
+			target_regs_read_core(cur_target, pbuf);
+			gdb_putpacket(hexify_in_place(pbuf, regs_size), regs_size * 2U);
 			break;
 		}
 		case 'm': {	/* 'm addr,len': Read len bytes from addr */
 			uint32_t addr, len;
 			ERROR_IF_NO_TARGET();
+			ERROR_IF_NO_BACKGROUND_ACCESS();
 			sscanf(pbuf, "m%" SCNx32 ",%" SCNx32, &addr, &len);
 			if (len > sizeof(pbuf) / 2) {
 				gdb_putpacketz("E02");
@@ -144,17 +616,45 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 			}
 			DEBUG_GDB("m packet: addr = %" PRIx32 ", len = %" PRIx32 "\n",
 					  addr, len);
-			uint8_t mem[len];
-			if (target_mem_read(cur_target, mem, addr, len))
+			/* Read into the packet buffer rather than onto the stack and hexify it there */
+			if (target_mem_read(cur_target, pbuf, addr, len))
+				gdb_putpacketz("E01");
+			else
+				gdb_putpacket(hexify_in_place(pbuf, len), len * 2U);
+			break;
+		}
+		case 'x': {	/* 'x addr,len': Read len bytes from addr as binary data */
+			uint32_t addr, len;
+			ERROR_IF_NO_TARGET();
+			ERROR_IF_NO_BACKGROUND_ACCESS();
+			sscanf(pbuf, "x%" SCNx32 ",%" SCNx32, &addr, &len);
+			if (len > BUF_SIZE) {
+				gdb_putpacketz("E02");
+				break;
+			}
+			DEBUG_GDB("x packet: addr = %" PRIx32 ", len = %" PRIx32 "\n",
+					  addr, len);
+			/* The request has been parsed, so read straight into the packet
+			 * buffer and let gdb_putpacket2() escape the data as it's sent */
+			if (target_mem_read(cur_target, pbuf, addr, len))
 				gdb_putpacketz("E01");
 			else
-				gdb_putpacket(hexify(pbuf, mem, len), len * 2U);
+				gdb_putpacket2("b", 1U, pbuf, len);
 			break;
 		}
 		case 'G': {	/* 'G XX': Write general registers */
 			ERROR_IF_NO_TARGET();
+			ERROR_IF_RUNNING();
+			if (rtos_thread_regs(cur_target, gdb_thread)) {
+				gdb_putpacketz("E01");
+				break;
+			}
 			uint8_t gp_regs[target_regs_size(cur_target)];
-			unhexify(gp_regs, &pbuf[1], sizeof(gp_regs));
+			/* It only carries what 'g' did, the rest stays as it is */
+			const size_t len = MIN((size - 1U) / 2U, sizeof(gp_regs));
+			if (len < sizeof(gp_regs))
+				target_regs_read(cur_target, gp_regs);
+			unhexify(gp_regs, &pbuf[1], len);
 			target_regs_write(cur_target, gp_regs);
 			gdb_putpacketz("OK");
 			break;
@@ -164,6 +664,7 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 			uint32_t len = 0;
 			int hex;
 			ERROR_IF_NO_TARGET();
+			ERROR_IF_NO_BACKGROUND_ACCESS();
 			sscanf(pbuf, "M%" SCNx32 ",%" SCNx32 ":%n", &addr, &len, &hex);
 			if (len > (unsigned)(size - hex) / 2) {
 				gdb_putpacketz("E02");
@@ -171,24 +672,27 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 			}
 			DEBUG_GDB("M packet: addr = %" PRIx32 ", len = %" PRIx32 "\n",
 					  addr, len);
-			uint8_t mem[len];
-			unhexify(mem, pbuf + hex, len);
-			if (target_mem_write(cur_target, addr, mem, len))
+			/* Decode in place, each byte lands before the hex pair it came from */
+			unhexify(pbuf, pbuf + hex, len);
+			if (target_mem_write(cur_target, addr, pbuf, len))
 				gdb_putpacketz("E01");
 			else
 				gdb_putpacketz("OK");
 			break;
 		}
 		/* '[m|M|g|G|c][thread-id]' : Set the thread ID for the given subsequent operation
-		 * (we don't actually care which as we only care about the TID for whether to send OK or an error)
+		 * Only 'g' matters, register access then goes to what that thread stacked.
+		 * 0 and -1 leave it to us, so that's the thread on the core.
 		 */
 		case 'H': {
 			char operation = 0;
 			uint32_t thread_id = 0;
 			sscanf(pbuf, "H%c%" SCNx32, &operation, &thread_id);
-			if (thread_id <= 1)
+			if (thread_id <= 1 || thread_id == UINT32_MAX || (gdb_threads_target() && rtos_thread_known(cur_target, thread_id))) {
+				if (operation == 'g')
+					gdb_thread = thread_id;
 				gdb_putpacketz("OK");
-			else
+			} else
 				gdb_putpacketz("E01");
 			break;
 		}
@@ -200,63 +704,39 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 				gdb_putpacketz("X1D");
 				break;
 			}
+			ERROR_IF_RUNNING();
 
 			target_halt_resume(cur_target, single_step);
 			SET_RUN_STATE(1);
 			single_step = false;
-			/* fall through */
-		case '?': {	/* '?': Request reason for target halt */
+			gdb_resumed();
+			break;
+		case '?':	/* '?': Request reason for target halt */
 			/* This packet isn't documented as being mandatory,
 			 * but GDB doesn't work without it. */
-			target_addr watch;
-			enum target_halt_reason reason;
-
-			if (!cur_target) {
-				/* Report "target exited" if no target */
-				gdb_putpacketz("W00");
-				break;
-			}
-
-			/* Wait for target halt */
-			while(!(reason = target_halt_poll(cur_target, &watch))) {
-				char c = (char)gdb_if_getchar_to(0);
-				if(c == '\x03' || c == '\x04')
-					target_halt_request(cur_target);
-				#ifdef ENABLE_RTT
-				if (rtt_enabled)
-					poll_rtt(cur_target);
-				#endif
-			}
-			SET_RUN_STATE(0);
-
-			/* Translate reason to GDB signal */
-			switch (reason) {
-			case TARGET_HALT_ERROR:
-				gdb_putpacket_f("X%02X", GDB_SIGLOST);
-				morse("TARGET LOST.", true);
-				break;
-			case TARGET_HALT_REQUEST:
-				gdb_putpacket_f("T%02X", GDB_SIGINT);
-				break;
-			case TARGET_HALT_WATCHPOINT:
-				gdb_putpacket_f("T%02Xwatch:%08X;", GDB_SIGTRAP, watch);
-				break;
-			case TARGET_HALT_FAULT:
-				gdb_putpacket_f("T%02X", GDB_SIGSEGV);
-				break;
-			default:
-				gdb_putpacket_f("T%02X", GDB_SIGTRAP);
-			}
+			/* In non-stop mode it asks for the stopped threads, none while running or without a target */
+			if (gdb_non_stop && (!cur_target || cur_target_running))
+				gdb_putpacketz("OK");
+			else
+				handle_halt_wait();
 			break;
-		}
 
 		/* Optional GDB packet support */
 		case 'p': { /* Read single register */
 			ERROR_IF_NO_TARGET();
+			ERROR_IF_RUNNING();
 			uint32_t reg;
 			sscanf(pbuf, "p%" SCNx32, &reg);
 			uint8_t val[8];
-			size_t s = target_reg_read(cur_target, reg, val, sizeof(val));
+			const uint32_t *const stacked = rtos_thread_regs(cur_target, gdb_thread);
+			if (stacked) {
+				if (reg < RTOS_STACKED_REGS)
+					gdb_putpacket(hexify(pbuf, &stacked[reg], 4U), 8U);
+				else
+					gdb_putpacketz("xxxxxxxx");
+				break;
+			}
+			const ssize_t s = target_reg_read(cur_target, reg, val, sizeof(val));
 			if (s > 0)
 				gdb_putpacket(hexify(pbuf, val, s), s * 2);
 			else
@@ -265,6 +745,11 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 		}
 		case 'P': { /* Write single register */
 			ERROR_IF_NO_TARGET();
+			ERROR_IF_RUNNING();
+			if (rtos_thread_regs(cur_target, gdb_thread)) {
+				gdb_putpacketz("EFF");
+				break;
+			}
 			uint32_t reg;
 			int n;
 			sscanf(pbuf, "P%" SCNx32 "=%n", &reg, &n);
@@ -279,8 +764,12 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 		}
 
 		case 'F':	/* Semihosting call finished */
-			if (in_syscall)
+			if (in_syscall) {
+#if PC_HOSTED == 1
+				gdb_if_session_pin(false);
+#endif
 				return hostio_reply(tc, pbuf, size);
+			}
 			else {
 				DEBUG_GDB("*** F packet when not in syscall! '%s'\n", pbuf);
 				gdb_putpacketz("");
@@ -297,6 +786,8 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 
 		case 0x04:
 		case 'D':	/* GDB 'detach' command. */
+			gdb_threads_lost();
+			cur_target_running = false;
 			if(cur_target) {
 				SET_RUN_STATE(1);
 				target_detach(cur_target);
@@ -305,6 +796,9 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 			}
 			if (pbuf[0] == 'D')
 				gdb_putpacketz("OK");
+			else
+				/* The connection went away, the next one starts in all-stop mode */
+				gdb_non_stop = false;
 			break;
 
 		case 'k':	/* Kill the target */
@@ -313,10 +807,12 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 
 		case 'r':	/* Reset the target system */
 		case 'R':	/* Restart the target program */
+			gdb_threads_lost();
+			cur_target_running = false;
 			if (cur_target)
 				target_reset(cur_target);
 			else if (last_target) {
-				cur_target = target_attach(last_target, &gdb_controller);
+				cur_target = gdb_attach(last_target);
 				if (cur_target)
 					morse(NULL, false);
 				target_reset(cur_target);
@@ -327,6 +823,7 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 			uint32_t addr, len;
 			int bin;
 			ERROR_IF_NO_TARGET();
+			ERROR_IF_NO_BACKGROUND_ACCESS();
 			sscanf(pbuf, "X%" SCNx32 ",%" SCNx32 ":%n", &addr, &len, &bin);
 			if (len > (unsigned)(size - bin)) {
 				gdb_putpacketz("E02");
@@ -342,11 +839,17 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 		}
 
 		case 'q':	/* General query packet */
+		case 'Q':	/* General set packet */
 			handle_q_packet(pbuf, size);
 			break;
 
 		case 'v':	/* Verbose command packet */
-			handle_v_packet(pbuf, size);
+			/* A vCont that resumes the target is answered with the stop reply, as for 'c' */
+			if (!strncmp(pbuf, "vCont", 5)) {
+				if (handle_vcont(pbuf + 5))
+					gdb_resumed();
+			} else
+				handle_v_packet(pbuf, size);
 			break;
 
 		/* These packet implement hardware break-/watchpoints */
@@ -360,6 +863,8 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 			DEBUG_GDB("*** Unsupported packet: %s\n", pbuf);
 			gdb_putpacketz("");
 		}
+		host_wait_start = platform_time_us();
+		latency_add(latency_type, host_wait_start - service_start);
 	}
 }
 
@@ -397,9 +902,8 @@ static void exec_q_rcmd(const char *packet, const size_t length)
 				2 * strlen("Failed\n"));
 }
 
-static void handle_q_string_reply(const char *reply, const char *param)
+static void handle_q_string_reply(const char *reply, const size_t reply_length, const char *param)
 {
-	const size_t reply_length = strlen(reply);
 	uint32_t addr = 0;
 	uint32_t len = 0;
 
@@ -425,7 +929,9 @@ static void exec_q_supported(const char *packet, const size_t length)
 {
 	(void)packet;
 	(void)length;
-	gdb_putpacket_f("PacketSize=%X;qXfer:memory-map:read+;qXfer:features:read+", BUF_SIZE);
+	gdb_putpacket_f("PacketSize=%X;qXfer:memory-map:read+;qXfer:features:read+;binary-upload+;QStartNoAckMode+;QNonStop+;"
+					"vFlashWriteLZ4=%X;Qbtrace:bts+;Qbtrace:off+;qXfer:btrace:read+;qXfer:btrace-conf:read+",
+		BUF_SIZE, GDB_FLASH_LZ4_SIZE);
 }
 
 static void exec_q_memory_map(const char *packet, const size_t length)
@@ -435,16 +941,19 @@ static void exec_q_memory_map(const char *packet, const size_t length)
 	/* Read target XML memory map */
 	if ((!cur_target) && last_target) {
 		/* Attach to last target if detached. */
-		cur_target = target_attach(last_target,
-				   &gdb_controller);
+		cur_target = gdb_attach(last_target);
 	}
 	if (!cur_target) {
 		gdb_putpacketz("E01");
 		return;
 	}
-	char buf[1024];
-	target_mem_map(cur_target, buf, sizeof(buf)); /* Fixme: Check size!*/
-	handle_q_string_reply(buf, packet);
+	size_t map_length = 0;
+	const char *const map = target_mem_map(cur_target, &map_length);
+	if (!map) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	handle_q_string_reply(map, map_length, packet);
 }
 
 static void exec_q_feature_read(const char *packet, const size_t length)
@@ -453,13 +962,20 @@ static void exec_q_feature_read(const char *packet, const size_t length)
 	/* Read target description */
 	if ((!cur_target) && last_target) {
 	  /* Attach to last target if detached. */
-	  cur_target = target_attach(last_target, &gdb_controller);
+	  cur_target = gdb_attach(last_target);
 	}
 	if (!cur_target) {
 	  gdb_putpacketz("E01");
 	  return;
 	}
-	handle_q_string_reply(target_tdesc(cur_target), packet);
+	/* The descriptions are constant, only measure one again when it's another */
+	static const char *tdesc = NULL;
+	static size_t tdesc_length = 0;
+	if (target_tdesc(cur_target) != tdesc) {
+		tdesc = target_tdesc(cur_target);
+		tdesc_length = strlen(tdesc);
+	}
+	handle_q_string_reply(tdesc, tdesc_length, packet);
 }
 
 static void exec_q_crc(const char *packet, const size_t length)
@@ -473,7 +989,7 @@ static void exec_q_crc(const char *packet, const size_t length)
 			return;
 		}
 		uint32_t crc;
-		if (generic_crc32(cur_target, &crc, addr, addr_length))
+		if (target_mem_crc32(cur_target, &crc, addr, addr_length))
 			gdb_putpacketz("E03");
 		else
 			gdb_putpacket_f("C%lx", crc);
@@ -481,30 +997,181 @@ static void exec_q_crc(const char *packet, const size_t length)
 }
 
 /*
- * qC queries are for the current thread. We don't support threads but GDB 11 and 12 require this,
- * so we always answer that the current thread is thread 1.
+ * qC queries are for the current thread. GDB 11 and 12 require this even without threads,
+ * so without an RTOS running we answer that the current thread is thread 1.
  */
 static void exec_q_c(const char *packet, const size_t length)
 {
 	(void)packet;
 	(void)length;
-	gdb_putpacketz("QC1");
+	const uint32_t thread_id = gdb_threads_target() ? rtos_current_thread(cur_target) : 0;
+	gdb_putpacket_f("QC%" PRIx32, thread_id ? thread_id : 1U);
 }
 
 /*
  * qfThreadInfo queries are required in GDB 11 and 12 as these GDBs require the server to support
  * threading even when there's only the possiblity for one thread to exist. In this instance,
  * we have to tell GDB that there is a single active thread so it doesn't think the "thread" died.
- * qsThreadInfo will always follow qfThreadInfo when we reply as we have to specify 'l' at the
- * end to terminate the list.. GDB doesn't like this not happening.
+ * With an RTOS running, its threads are listed instead, as many per reply as fit, and each
+ * qsThreadInfo carries on from there. The 'l' at the end terminates the list, GDB doesn't like
+ * this not happening.
  */
 static void exec_q_thread_info(const char *packet, const size_t length)
 {
 	(void)length;
+	static size_t next_thread = 0;
 	if (packet[-11] == 'f')
+		next_thread = 0;
+	const size_t count = gdb_threads_target() ? rtos_thread_count(cur_target) : 0;
+	if (next_thread >= MAX(count, 1U)) {
+		gdb_putpacketz("l");
+		return;
+	}
+	if (!count) {
+		++next_thread;
 		gdb_putpacketz("m1");
+		return;
+	}
+	size_t reply_length = 0;
+	/* Room for the 'm', a full length ID and its separator */
+	while (next_thread < count && reply_length + 10U <= BUF_SIZE)
+		reply_length += snprintf(pbuf + reply_length, BUF_SIZE + 1U - reply_length, "%c%" PRIx32,
+			reply_length ? ',' : 'm', rtos_thread_id(cur_target, next_thread++));
+	gdb_putpacket(pbuf, reply_length);
+}
+
+/* qThreadExtraInfo,id: what "info threads" shows next to each RTOS thread */
+static void exec_q_thread_extra_info(const char *packet, const size_t length)
+{
+	(void)length;
+	char info[64];
+	const uint32_t thread_id = strtoul(packet, NULL, 16);
+	if (!gdb_threads_target() || !rtos_thread_info(cur_target, thread_id, info, sizeof(info))) {
+		gdb_putpacketz("");
+		return;
+	}
+	const size_t info_length = strlen(info);
+	gdb_putpacket(hexify(pbuf, info, info_length), info_length * 2U);
+}
+
+/*
+ * qSymbol:: offers to look symbols up for us. Each answer comes back as qSymbol:value:name,
+ * or qSymbol::name if the ELF doesn't have it, and the reply asks for the next symbol the RTOS
+ * awareness wants, until there's nothing more to ask and it's 'OK'.
+ */
+static void exec_q_symbol(const char *packet, const size_t length)
+{
+	(void)length;
+	const char *const name_hex = strchr(packet, ':');
+	if (!name_hex) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	if (!name_hex[1])
+		rtos_symbols_reset();
+	else {
+		char name[64];
+		const size_t name_length = MIN(strlen(name_hex + 1U) / 2U, sizeof(name) - 1U);
+		unhexify(name, name_hex + 1U, name_length);
+		name[name_length] = '\0';
+		rtos_symbol_set(name, name_hex != packet, strtoul(packet, NULL, 16));
+	}
+	const char *const symbol = rtos_symbol_next();
+	if (!symbol) {
+		gdb_putpacketz("OK");
+		return;
+	}
+	const size_t symbol_length = strlen(symbol);
+	memcpy(pbuf, "qSymbol:", 8U);
+	hexify(pbuf + 8U, symbol, symbol_length);
+	gdb_putpacket(pbuf, 8U + symbol_length * 2U);
+}
+
+static void exec_q_noackmode(const char *packet, const size_t length)
+{
+	(void)packet;
+	(void)length;
+	/* The 'OK' itself is still subject to an ack, so only switch afterwards */
+	gdb_putpacketz("OK");
+	gdb_set_noackmode(true);
+}
+
+static void exec_q_nonstop(const char *packet, const size_t length)
+{
+	(void)length;
+	if (cur_target_running) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	gdb_non_stop = packet[0] == '1';
+	gdb_putpacketz("OK");
+}
+
+/*
+ * Branch trace, "record btrace bts" in GDB, for cores with a Micro Trace
+ * Buffer. The XML is generated piece by piece at the offset asked for, so
+ * only what fits the reply is ever held, in the packet buffer it came in.
+ */
+static void exec_q_btrace(const char *packet, const size_t length)
+{
+	(void)length;
+	if (!cur_target || !target_branch_trace_enable(cur_target, !strcmp(packet, "bts")))
+		gdb_putpacketz("E01");
 	else
+		gdb_putpacketz("OK");
+}
+
+static void exec_q_btrace_read(const char *packet, const size_t length)
+{
+	(void)length;
+	uint32_t offset = 0;
+	uint32_t len = 0;
+	/* The trace is read once per halt, so "new" is all of it too, and there are no deltas */
+	if (!cur_target || (strncmp(packet, "all:", 4U) && strncmp(packet, "new:", 4U)) ||
+		sscanf(packet + 4U, "%08" PRIx32 ",%08" PRIx32, &offset, &len) != 2) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	const ssize_t result = target_branch_trace_read(cur_target, pbuf, offset, MIN(len, BUF_SIZE));
+	if (result < 0)
+		gdb_putpacketz("E01");
+	else if (result == 0)
 		gdb_putpacketz("l");
+	else
+		gdb_putpacket2("m", 1U, pbuf, result);
+}
+
+static void exec_q_btrace_conf(const char *packet, const size_t length)
+{
+	(void)length;
+	if (!cur_target) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	char conf[160];
+	const int conf_length = snprintf(conf, sizeof(conf),
+		"<?xml version=\"1.0\"?>\n<!DOCTYPE btrace-conf SYSTEM \"btrace-conf.dtd\">\n<btrace-conf "
+		"version=\"1.0\">\n<bts size=\"0x%zx\"/>\n</btrace-conf>\n",
+		target_branch_trace_size(cur_target));
+	handle_q_string_reply(conf, conf_length, packet);
+}
+
+static void exec_q_gcov_read(const char *packet, const size_t length)
+{
+	(void)length;
+	uint32_t offset = 0;
+	uint32_t len = 0;
+	if (!cur_target || sscanf(packet, "%08" PRIx32 ",%08" PRIx32, &offset, &len) != 2) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	const ssize_t result = gcov_read(cur_target, pbuf, offset, MIN(len, BUF_SIZE));
+	if (result < 0)
+		gdb_putpacketz("E01");
+	else if (result == 0)
+		gdb_putpacketz("l");
+	else
+		gdb_putpacket2("m", 1U, pbuf, result);
 }
 
 static const cmd_executer q_commands[]=
@@ -517,11 +1184,21 @@ static const cmd_executer q_commands[]=
 	{"qC",                             exec_q_c},
 	{"qfThreadInfo",                   exec_q_thread_info},
 	{"qsThreadInfo",                   exec_q_thread_info},
+	{"qThreadExtraInfo,",              exec_q_thread_extra_info},
+	{"qSymbol:",                       exec_q_symbol},
+	{"QStartNoAckMode",                exec_q_noackmode},
+	{"QNonStop:",                      exec_q_nonstop},
+	{"Qbtrace:",                       exec_q_btrace},
+	{"qXfer:btrace:read:",             exec_q_btrace_read},
+	{"qXfer:btrace-conf:read::",       exec_q_btrace_conf},
+	{"qXfer:gcov:read::",              exec_q_gcov_read},
 	{NULL, NULL},
 };
 
 static void handle_kill_target(void)
 {
+	gdb_threads_lost();
+	cur_target_running = false;
 	if (cur_target) {
 		target_reset(cur_target);
 		target_detach(cur_target);
@@ -543,13 +1220,15 @@ static void handle_v_packet(char *packet, const size_t plen)
 	uint32_t addr = 0;
 	uint32_t len = 0;
 	int bin;
-	static uint8_t flash_mode = 0;
 
 	if (sscanf(packet, "vAttach;%08" PRIx32, &addr) == 1) {
 		/* Attach to remote target processor */
-		cur_target = target_attach_n(addr, &gdb_controller);
+		gdb_threads_lost();
+		cur_target_running = false;
+		cur_target = gdb_attach_n(addr);
 		if(cur_target) {
 			morse(NULL, false);
+			frequency_auto_attached(cur_target);
 			/*
 			 * We don't actually support threads, but GDB 11 and 12 can't work without
 			 * us saying we attached to thread 1.. see the following for the low-down of this:
@@ -559,7 +1238,8 @@ static void handle_v_packet(char *packet, const size_t plen)
 			 * https://sourceware.org/pipermail/gdb-patches/2022-April/188058.html
 			 * https://sourceware.org/pipermail/gdb-patches/2022-July/190869.html
 			 */
-			gdb_putpacketz("T05thread:1;");
+			/* In non-stop mode the stop is left for GDB to ask after with vCont;t */
+			gdb_putpacketz(gdb_non_stop ? "OK" : "T05thread:1;");
 		} else
 			gdb_putpacketz("E01");
 
@@ -603,13 +1283,14 @@ static void handle_v_packet(char *packet, const size_t plen)
 		rtt_found = false;
 		#endif
 		/* Run target program. For us (embedded) this means reset. */
+		gdb_threads_lost();
+		cur_target_running = false;
 		if (cur_target) {
 			target_set_cmdline(cur_target, cmdline);
 			target_reset(cur_target);
 			gdb_putpacketz("T05");
 		} else if (last_target) {
-			cur_target = target_attach(last_target,
-						   &gdb_controller);
+			cur_target = gdb_attach(last_target);
 
 			/* If we were able to attach to the target again */
 			if (cur_target) {
@@ -626,7 +1307,7 @@ static void handle_v_packet(char *packet, const size_t plen)
 	} else if (sscanf(packet, "vFlashErase:%08" PRIx32 ",%08" PRIx32, &addr, &len) == 2) {
 		/* Erase Flash Memory */
 		DEBUG_GDB("Flash Erase %08" PRIX32 " %08" PRIX32 "\n", addr, len);
-		if (!cur_target) {
+		if (!cur_target || cur_target_running) {
 			gdb_putpacketz("EFF");
 			return;
 		}
@@ -648,17 +1329,47 @@ static void handle_v_packet(char *packet, const size_t plen)
 		/* Write Flash Memory */
 		const uint32_t count = plen - bin;
 		DEBUG_GDB("Flash Write %08" PRIX32 " %08" PRIX32 "\n", addr, count);
-		if (cur_target && target_flash_write(cur_target, addr, (void*)packet + bin, count) == 0)
-			gdb_putpacketz("OK");
-		else {
+		if (!cur_target || flash_write_failed) {
+			flash_mode = 0;
+			flash_write_failed = false;
+			gdb_putpacketz("EFF");
+			return;
+		}
+		/*
+		 * Write-behind: acknowledge the data first so GDB can send the next
+		 * packet while this one is programmed. The packet buffer is not touched
+		 * again until the next call to gdb_getpacket(), so it is safe to program
+		 * from it after replying. Failures get reported on the next Flash packet.
+		 */
+		gdb_putpacketz("OK");
+		if (target_flash_write(cur_target, addr, (void*)packet + bin, count))
+			flash_write_failed = true;
+
+	} else if (sscanf(packet, "vFlashWriteLZ4:%08" PRIx32 ",%08" PRIx32 ":%n", &addr, &len, &bin) == 2) {
+		/* Write Flash Memory from an LZ4 block, len being the length it decodes to */
+		DEBUG_GDB("Flash Write LZ4 %08" PRIX32 " %08" PRIX32 "\n", addr, len);
+		if (!flash_lz4_buf)
+			flash_lz4_buf = malloc(GDB_FLASH_LZ4_SIZE);
+		if (!cur_target || flash_write_failed || len > GDB_FLASH_LZ4_SIZE || !flash_lz4_buf ||
+			lz4_decompress(flash_lz4_buf, len, packet + bin, plen - bin) != (ssize_t)len) {
 			flash_mode = 0;
+			flash_write_failed = false;
 			gdb_putpacketz("EFF");
+			return;
 		}
+		/* Write-behind as for vFlashWrite, the decoded data stays put until the next packet */
+		gdb_putpacketz("OK");
+		if (target_flash_write(cur_target, addr, flash_lz4_buf, len))
+			flash_write_failed = true;
 
 	} else if (!strcmp(packet, "vFlashDone")) {
 		/* Commit flash operations. */
-		gdb_putpacketz(target_flash_done(cur_target) ? "EFF" : "OK");
+		const bool failed = !cur_target || target_flash_done(cur_target) || flash_write_failed;
+		gdb_putpacketz(failed ? "EFF" : "OK");
+		flash_write_failed = false;
 		flash_mode = 0;
+		free(flash_lz4_buf);
+		flash_lz4_buf = NULL;
 
 	} else if (!strcmp(packet, "vStopped")) {
 		if (gdb_needs_detach_notify) {
@@ -676,6 +1387,91 @@ static void handle_v_packet(char *packet, const size_t plen)
 	}
 }
 
+/*
+ * 'vCont?' and 'vCont;action[:thread-id]...'. There is only the one thread,
+ * so the first action for it or for all threads is taken. 'r start,end' steps
+ * while PC stays in the range, without a round trip to GDB per instruction.
+ * 't' stops the target in non-stop mode, which is reported once it has.
+ * Returns true if the target was resumed.
+ */
+static bool handle_vcont(const char *packet)
+{
+	if (!strcmp(packet, "?")) {
+		gdb_putpacketz("vCont;c;C;s;S;r;t");
+		return false;
+	}
+	if (*packet != ';') {
+		gdb_putpacketz("");
+		return false;
+	}
+	if (!cur_target) {
+		gdb_putpacketz("X1D");
+		return false;
+	}
+	for (const char *action = packet + 1; action; action = strchr(action, ';')) {
+		if (*action == ';')
+			++action;
+		/* An RTOS thread on the core is the core, those switched out can't be resumed on their own */
+		const char *const thread = strpbrk(action, ":;");
+		if (thread && *thread == ':' && strncmp(thread + 1, "-1", 2)) {
+			const uint32_t thread_id = strtoul(thread + 1, NULL, 16);
+			if (thread_id > 1 && (cur_target_running || thread_id != rtos_current_thread(cur_target)))
+				continue;
+		}
+		if (*action == 't') {
+			if (!gdb_non_stop) {
+				gdb_putpacketz("E01");
+				return false;
+			}
+			gdb_putpacketz("OK");
+			/* Already stopped, which still wants reporting */
+			if (!cur_target_running) {
+				gdb_stop_requested = true;
+				gdb_stop_reply(TARGET_HALT_REQUEST, 0, true);
+			} else if (!gdb_stop_requested) {
+				gdb_stop_requested = true;
+				target_halt_request(cur_target);
+				/* The halt should follow shortly, go back to polling fast */
+				gdb_poll_interval = halt_poll_min_ms;
+			}
+			return false;
+		}
+		/* Resuming it again before its stop was reported is GDB's mistake */
+		if (cur_target_running) {
+			gdb_putpacketz("E01");
+			return false;
+		}
+		uint32_t start;
+		uint32_t end;
+		switch (*action) {
+		case 'c': /* Continue, the signal of 'C sig' is not delivered */
+		case 'C':
+			target_halt_resume(cur_target, false);
+			break;
+		case 's':
+		case 'S':
+			target_halt_resume(cur_target, true);
+			break;
+		case 'r':
+			if (sscanf(action, "r%" SCNx32 ",%" SCNx32, &start, &end) != 2) {
+				gdb_putpacketz("E01");
+				return false;
+			}
+			DEBUG_GDB("Range step %08" PRIx32 " to %08" PRIx32 "\n", start, end);
+			target_halt_resume_range(cur_target, start, end);
+			break;
+		default:
+			gdb_putpacketz("E01");
+			return false;
+		}
+		SET_RUN_STATE(1);
+		return true;
+	}
+	/* No action for our thread, so it stays stopped */
+	gdb_putpacketz("OK");
+	return false;
+}
+
 static void handle_z_packet(char *packet, const size_t plen)
 {
 	(void)plen;
@@ -701,5 +1497,8 @@ static void handle_z_packet(char *packet, const size_t plen)
 
 void gdb_main(void)
 {
-	gdb_main_loop(&gdb_controller, false);
+#if PC_HOSTED == 1
+	gdb_sessions_init();
+#endif
+	gdb_main_loop(gdb_tc, false);
 }
@@ -24,17 +24,147 @@
 
 #include "general.h"
 #include "gdb_if.h"
+#include "gdb_main.h"
 #include "gdb_packet.h"
 #include "hex_utils.h"
 #include "remote.h"
+#include "stats.h"
+#include "sched_tasks.h"
 
 #include <stdarg.h>
 
+static bool noackmode = false;
+static bool out_muted = false;
+static void (*out_sink)(const char *buf) = NULL;
+
+/* Enable must only happen after the 'OK' reply to QStartNoAckMode has been acked */
+void gdb_set_noackmode(bool enable)
+{
+	noackmode = enable;
+}
+
+bool gdb_noackmode(void)
+{
+	return noackmode;
+}
+
+#if PC_HOSTED == 0
+/*
+ * Received data is pulled from the interface a whole USB packet at a time.
+ * Anything left over once a packet is complete stays here, so every consumer
+ * of GDB input has to go through the functions below.
+ */
+#ifndef GDB_RX_BUF_SIZE
+#define GDB_RX_BUF_SIZE 64U
+#endif
+
+static char rx_buf[GDB_RX_BUF_SIZE];
+static size_t rx_pos = 0;
+static size_t rx_len = 0;
+
+/* Remote protocol frames have their own buffer, sized apart from GDB's in ram_budget.h */
+static char remote_packet[REMOTE_PACKET_BUFFER_SIZE];
+
+static inline char gdb_rx_getchar(void)
+{
+	if (rx_pos == rx_len) {
+		rx_len = gdb_if_read_buf(rx_buf, sizeof(rx_buf));
+		rx_pos = 0;
+	}
+	return rx_buf[rx_pos++];
+}
+
+/*
+ * Wait for input between packets, running the background tasks meanwhile
+ * and in non-stop mode polling the running target for its halt.
+ * A timeout reads as 0xff, which is fine here as anything other than a
+ * packet start is dropped anyway.
+ */
+static char gdb_rx_getchar_idle(void)
+{
+	while (rx_pos == rx_len) {
+		const uint32_t wait = gdb_idle_poll();
+		if (wait == SCHED_IDLE)
+			return gdb_rx_getchar();
+		const unsigned char c = gdb_if_getchar_to(wait);
+		if (c != 0xffU)
+			return c;
+	}
+	return rx_buf[rx_pos++];
+}
+
+unsigned char gdb_getchar_to(const int timeout)
+{
+	if (rx_pos < rx_len)
+		return rx_buf[rx_pos++];
+	return gdb_if_getchar_to(timeout);
+}
+
+/* Blocks until exactly len raw bytes, such as a binary remote payload, have been read */
+void gdb_getraw(void *const buf, const size_t len)
+{
+	uint8_t *const data = (uint8_t *)buf;
+	for (size_t offset = 0; offset < len;) {
+		if (rx_pos == rx_len) {
+			rx_len = gdb_if_read_buf(rx_buf, sizeof(rx_buf));
+			rx_pos = 0;
+		}
+		const size_t count = MIN(rx_len - rx_pos, len - offset);
+		memcpy(data + offset, rx_buf + rx_pos, count);
+		rx_pos += count;
+		offset += count;
+	}
+}
+
+/*
+ * Copy packet data from the receive buffer until one of '#', '$' or '}' is
+ * found or the packet buffer is full, returning the number of bytes copied.
+ * This is the hot path for large packets such as vFlashWrite and X.
+ */
+static size_t gdb_rx_copy_data(char *packet, size_t space, unsigned char *csum)
+{
+	const size_t avail = MIN(rx_len - rx_pos, space);
+	const char *const data = rx_buf + rx_pos;
+	unsigned char sum = *csum;
+	size_t count = 0;
+	for (; count < avail; ++count) {
+		const char c = data[count];
+		if (c == '#' || c == '$' || c == '}')
+			break;
+		sum += c;
+		packet[count] = c;
+	}
+	rx_pos += count;
+	*csum = sum;
+	return count;
+}
+#else
+/* Hosted, packets come in whole from the receive thread, see platforms/hosted/gdb_if.c */
+unsigned char gdb_getchar_to(const int timeout)
+{
+	return gdb_if_getchar_to(timeout);
+}
+#endif
+
 size_t gdb_getpacket(char *packet, size_t size)
 {
+	size_t offset = 0;
+#if PC_HOSTED == 1
+	while (true) {
+		bool valid;
+		/* Lone characters between packets are dropped, as below */
+		while (!gdb_if_getpacket(packet, size, &offset, &valid)) {
+			const uint32_t wait = gdb_idle_poll();
+			gdb_if_idle_wait(wait == SCHED_IDLE ? -1 : (int)wait);
+		}
+		/* In no-ack mode GDB won't retransmit, so take the packet as is */
+		if (valid || noackmode)
+			break;
+		gdb_if_putchar('-', 1); /* send nack */
+	}
+#else
 	unsigned char csum;
 	char recv_csum[3];
-	size_t offset = 0;
 
 	while (1) {
 	    /* Wait for packet start */
@@ -44,27 +174,29 @@ size_t gdb_getpacket(char *packet, size_t size)
 			 */
 			do {
 				/* Smells like bad code */
-				packet[0] = (char)gdb_if_getchar();
-				if (packet[0] == 0x04)
+				packet[0] = gdb_rx_getchar_idle();
+				if (packet[0] == 0x04) {
+					/* The connection went away, the next session starts in ack mode */
+					noackmode = false;
 					return 1;
+				}
 			} while ((packet[0] != '$') && (packet[0] != REMOTE_SOM));
-#if PC_HOSTED == 0
 			if (packet[0] == REMOTE_SOM) {
 				/* This is probably a remote control packet
 				 * - get and handle it */
-				offset = 0;
+				size_t remote_len = 0;
 				bool gettingRemotePacket = true;
 				while (gettingRemotePacket) {
 					/* Smells like bad code */
-					const char c = (char)gdb_if_getchar();
+					const char c = gdb_rx_getchar();
 					switch (c) {
 					case REMOTE_SOM: /* Oh dear, packet restarts */
-						offset = 0;
+						remote_len = 0;
 						break;
 
 					case REMOTE_EOM: /* Complete packet for processing */
-						packet[offset] = 0;
-						remotePacketProcess(offset, packet);
+						remote_packet[remote_len] = 0;
+						remotePacketProcess(remote_len, remote_packet);
 						gettingRemotePacket = false;
 						break;
 
@@ -74,8 +206,8 @@ size_t gdb_getpacket(char *packet, size_t size)
 						break;
 
 					default:
-						if (offset < size) {
-							packet[offset++] = c;
+						if (remote_len < sizeof(remote_packet) - 1U) {
+							remote_packet[remote_len++] = c;
 						} else {
 							/* Who knows what is going on...return to normality */
 							gettingRemotePacket = false;
@@ -83,53 +215,60 @@ size_t gdb_getpacket(char *packet, size_t size)
 						break;
 					}
 				}
-				/* Reset the packet buffer start character to zero, because function
-				 * 'remotePacketProcess()' above overwrites this buffer, and
-				 * an arbitrary character may have been placed there. If this is a '$'
-				 * character, this will cause this loop to be terminated, which is wrong.
-				 */
-				packet[0] = 0;
 			}
-#endif
 	    } while (packet[0] != '$');
 
 		offset = 0;
 		csum = 0;
-		char c;
 		/* Capture packet data into buffer */
-		while ((c = (char)gdb_if_getchar()) != '#') {
+		while (1) {
+			/* Copy runs of plain data straight out of the receive buffer */
+			if (rx_pos == rx_len) {
+				rx_len = gdb_if_read_buf(rx_buf, sizeof(rx_buf));
+				rx_pos = 0;
+			}
+			offset += gdb_rx_copy_data(packet + offset, size - offset, &csum);
 
 			/* If we run out of buffer space, exit early */
 			if (offset == size)
 				break;
+			if (rx_pos == rx_len)
+				continue;
 
+			char c = rx_buf[rx_pos++];
+			if (c == '#')
+				break;
 			if (c == '$') { /* Restart capture */
 				offset = 0;
 				csum = 0;
 				continue;
 			}
-			if (c == '}') { /* escaped char */
-				c = gdb_if_getchar();
-				csum += c + '}';
-				packet[offset++] = c ^ 0x20;
-				continue;
-			}
-			csum += c;
-			packet[offset++] = c;
+			/* Only '}' is left: an escaped char */
+			c = gdb_rx_getchar();
+			csum += c + '}';
+			packet[offset++] = c ^ 0x20;
 		}
-		recv_csum[0] = (char)gdb_if_getchar();
-		recv_csum[1] = (char)gdb_if_getchar();
+		recv_csum[0] = gdb_rx_getchar();
+		recv_csum[1] = gdb_rx_getchar();
 		recv_csum[2] = 0;
 
 		/* return packet if checksum matches */
 		if (csum == strtol(recv_csum, NULL, 16))
 			break;
 
+		/* In no-ack mode GDB won't retransmit, so take the packet as is */
+		if (noackmode)
+			break;
+
 		/* get here if checksum fails */
 		gdb_if_putchar('-', 1); /* send nack */
 	}
-	gdb_if_putchar('+', 1); /* send ack */
+#endif
+	if (!noackmode)
+		gdb_if_putchar('+', 1); /* send ack */
 	packet[offset] = 0;
+	STATS_INC(gdb_packets_in);
+	STATS_ADD(gdb_bytes_in, offset);
 
 #if PC_HOSTED == 1
 	DEBUG_GDB_WIRE("%s : ", __func__);
@@ -184,7 +323,9 @@ void gdb_putpacket2(const char *packet1, size_t size1, const char *packet2, size
 		gdb_if_putchar(xmit_csum[0], 0);
 		gdb_if_putchar(xmit_csum[1], 1);
 		DEBUG_GDB_WIRE("\n");
-	} while (gdb_if_getchar_to(2000) != '+' && tries++ < 3);
+	} while (!noackmode && gdb_getchar_to(2000) != '+' && tries++ < 3);
+	STATS_INC(gdb_packets_out);
+	STATS_ADD(gdb_bytes_out, size1 + size2);
 }
 
 void gdb_putpacket(const char *packet, size_t size)
@@ -203,7 +344,9 @@ void gdb_putpacket(const char *packet, size_t size)
 		gdb_if_putchar(xmit_csum[0], 0);
 		gdb_if_putchar(xmit_csum[1], 1);
 		DEBUG_GDB_WIRE("\n");
-	} while (gdb_if_getchar_to(2000) != '+' && tries++ < 3);
+	} while (!noackmode && gdb_getchar_to(2000) != '+' && tries++ < 3);
+	STATS_INC(gdb_packets_out);
+	STATS_ADD(gdb_bytes_out, size);
 }
 
 void gdb_put_notification(const char *const packet, const size_t size)
@@ -220,6 +363,8 @@ void gdb_put_notification(const char *const packet, const size_t size)
 	gdb_if_putchar(xmit_csum[0], 0);
 	gdb_if_putchar(xmit_csum[1], 1);
 	DEBUG_GDB_WIRE("\n");
+	STATS_INC(gdb_packets_out);
+	STATS_ADD(gdb_bytes_out, size);
 }
 
 void gdb_putpacket_f(const char *fmt, ...)
@@ -235,8 +380,24 @@ void gdb_putpacket_f(const char *fmt, ...)
 	va_end(ap);
 }
 
+void gdb_out_mute(const bool mute)
+{
+	out_muted = mute;
+}
+
+void gdb_out_redirect(void (*const sink)(const char *buf))
+{
+	out_sink = sink;
+}
+
 void gdb_out(const char *buf)
 {
+	if (out_sink) {
+		out_sink(buf);
+		return;
+	}
+	if (out_muted)
+		return;
 	int l = strlen(buf);
 	char *hexdata = calloc(1, 2 * l + 1);
 	if (!hexdata)
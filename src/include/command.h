@@ -35,5 +35,12 @@ int command_process(target *t, char *cmd);
  */
 bool parse_enable_or_disable(const char *s, bool *out);
 
+/* Scans JTAG, then SWD, for targets. Also used to find a target to capture RTT from */
+bool cmd_auto_scan(target *t, int argc, const char **argv);
+
+/* Hooks that let "monitor frequency auto" search again once a lost target is reattached */
+void frequency_auto_lost(void);
+void frequency_auto_attached(target *t);
+
 #endif
 
@@ -21,6 +21,12 @@
 #ifndef __CRC32_H
 #define __CRC32_H
 
-int generic_crc32(target *t, uint32_t *crc, uint32_t base, int len);
+int generic_crc32(target *t, uint32_t *crc, uint32_t base, size_t len);
+/* Reads len bytes at src into dest, returning non-zero on error */
+typedef int (*crc32_read_func)(void *priv, void *dest, uint32_t src, size_t len);
+/* generic_crc32() over any memory a read function can reach, such as a bare AP */
+int crc32_range(crc32_read_func read, void *priv, uint32_t *crc, uint32_t base, size_t len);
+/* CRC over a buffer on the probe, start with crc = 0xffffffff to match generic_crc32() */
+uint32_t crc32_buf(uint32_t crc, const void *buf, size_t len);
 
 #endif
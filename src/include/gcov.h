@@ -0,0 +1,37 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GCOV_H
+#define __GCOV_H
+
+#include "target.h"
+
+/*
+ * Coverage counter extraction: the target's counter region is read out in
+ * bulk, by GDB as qXfer:gcov:read or into a file on hosted, rather than
+ * written out by the target a record at a time over semihosting.
+ */
+void gcov_region_set(target_addr base, size_t size);
+/* false if no region is set */
+bool gcov_region(target_addr *base, size_t *size);
+/* Reads up to len bytes of the region from offset, returns how many or -1 */
+ssize_t gcov_read(target *t, void *buf, size_t offset, size_t len);
+#if PC_HOSTED == 1
+bool gcov_write_file(target *t, const char *filename);
+#endif
+
+#endif /* __GCOV_H */
@@ -21,14 +21,47 @@
 #ifndef __GDB_IF_H
 #define __GDB_IF_H
 
+#include <stddef.h>
+
 #if PC_HOSTED == 0
 #include <libopencm3/usb/usbd.h>
 void gdb_usb_out_cb(usbd_device *dev, uint8_t ep);
+void gdb_usb_in_cb(usbd_device *dev, uint8_t ep);
 #endif
 
 int gdb_if_init(void);
 unsigned char gdb_if_getchar(void);
 unsigned char gdb_if_getchar_to(int timeout);
+#if PC_HOSTED == 0
+/* Blocks until data is available, then copies up to max bytes of it into buf */
+size_t gdb_if_read_buf(void *buf, size_t max);
+#else
+#include <stdbool.h>
+/*
+ * Takes the next packet, already framed, unescaped and checked by the
+ * receive thread, dropping any lone characters before it. False if there
+ * is none yet, valid is false if it failed its checksum or didn't fit.
+ */
+bool gdb_if_getpacket(char *packet, size_t size, size_t *len, bool *valid);
+/* Waits up to timeout ms, forever if negative, for input for gdb_if_getpacket() */
+void gdb_if_idle_wait(int timeout);
+
+/*
+ * Several GDB sessions, each on a port of its own, set before gdb_if_init().
+ * gdb_if_getpacket() takes the packets of all of them in turn, switching
+ * the current session with gdb_session_switch(), unless it is pinned.
+ */
+void gdb_if_sessions_set(size_t count);
+size_t gdb_if_sessions(void);
+/* The session input is taken from and output goes to */
+size_t gdb_if_session(void);
+void gdb_if_session_select(size_t session);
+/* Keeps gdb_if_getpacket() to the current session, while a semihosting call is served */
+void gdb_if_session_pin(bool pin);
+bool gdb_if_session_pinned(void);
+/* Whether a ^C came for the current session since the last call */
+bool gdb_if_interrupted(void);
+#endif
 
 /* sending gdb_if_putchar(0, true) seems to work as keep alive */
 void gdb_if_putchar(unsigned char c, int flush);
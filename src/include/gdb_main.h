@@ -21,7 +21,28 @@
 #ifndef __GDB_MAIN_H
 #define __GDB_MAIN_H
 
+#include <stdint.h>
+#include "target.h"
+
+extern uint32_t halt_poll_min_ms;
+extern uint32_t halt_poll_max_ms;
+extern uint32_t halt_poll_rate;
+
 void gdb_main(void);
+/* The target the background tasks may work on while GDB waits for a packet */
+target *gdb_background_target(void);
+/* Whether GDB has a target, which nobody else may then take over */
+bool gdb_target_attached(void);
+/* The background target went away, drop it */
+void gdb_background_lost(void);
+/* The target other clients share with GDB, running set if it may be running */
+target *gdb_shared_target(bool *running);
+/* Background work while waiting for a packet, returns how long until it wants calling again or SCHED_IDLE */
+uint32_t gdb_idle_poll(void);
+#if PC_HOSTED == 1
+/* Makes session the one GDB packets are handled for, see gdb_if_getpacket() */
+void gdb_session_switch(size_t session);
+#endif
 
 #endif
 
@@ -23,8 +23,13 @@
 
 #include <stddef.h>
 #include <stdarg.h>
+#include <stdbool.h>
 
 size_t gdb_getpacket(char *packet, size_t size);
+unsigned char gdb_getchar_to(int timeout);
+void gdb_getraw(void *buf, size_t len);
+void gdb_set_noackmode(bool enable);
+bool gdb_noackmode(void);
 void gdb_putpacket(const char *packet, size_t size);
 void gdb_putpacket2(const char *packet1, size_t size1, const char *packet2, size_t size2);
 #define gdb_putpacketz(packet) gdb_putpacket((packet), strlen(packet))
@@ -33,6 +38,10 @@ void gdb_put_notification(const char *packet, size_t size);
 #define gdb_put_notificationz(packet) gdb_put_notification((packet), strlen(packet))
 
 void gdb_out(const char *buf);
+/* Drops console output, for work done while GDB isn't expecting any */
+void gdb_out_mute(bool mute);
+/* Sends console output to sink rather than GDB, NULL to undo */
+void gdb_out_redirect(void (*sink)(const char *buf));
 void gdb_voutf(const char *fmt, va_list);
 void gdb_outf(const char *fmt, ...);
 
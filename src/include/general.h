@@ -41,6 +41,7 @@
 
 #include "platform.h"
 #include "platform_support.h"
+#include "ram_budget.h"
 
 extern uint32_t delay_cnt;
 
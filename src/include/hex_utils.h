@@ -21,7 +21,12 @@
 #ifndef __HEX_UTILS_H
 #define __HEX_UTILS_H
 
+#include <stddef.h>
+
 char * hexify(char *hex, const void *buf, size_t size);
+/* The size bytes at the start of buf become 2 * size digits and a NUL there */
+char * hexify_in_place(char *buf, size_t size);
+/* Decoding in place, with buf == hex, is fine */
 char * unhexify(void *buf, const char *hex, size_t size);
 
 #endif
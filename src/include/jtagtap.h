@@ -51,6 +51,19 @@ typedef struct jtag_proc_s {
 	void (*jtagtap_tdi_seq)(const bool final_tms, const uint8_t *data_in, size_t clock_cycles);
 	void (*jtagtap_cycle)(const bool tms, const bool tdi, const size_t clock_cycles);
 
+	/*
+	 * Optional deferred variant of tdi_tdo_seq, for adaptors where each read
+	 * back costs a round trip. DI is used up before returning, but DO is the
+	 * handle for the result and only gets written at the next jtagtap_flush(),
+	 * so it has to stay valid until then. Other operations may be held back
+	 * along with it, jtagtap_flush() must be called before the scan results
+	 * are used or anything besides JTAG is done with the adaptor.
+	 * See jtag_dev_shift_dr_deferred() for the fallback.
+	 */
+	void (*jtagtap_tdi_tdo_seq_deferred)(
+		uint8_t *data_out, const bool final_tms, const uint8_t *data_in, size_t clock_cycles);
+	void (*jtagtap_flush)(void);
+
 	/*
 	 * Some debug controllers such as the RISC-V debug controller use idle
 	 * cycles during operations as part of their function, while others
@@ -0,0 +1,27 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LZ4_H
+#define __LZ4_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Decode an LZ4 block, returns the decoded length or -1 if the block is malformed or doesn't fit */
+ssize_t lz4_decompress(void *dest, size_t dest_len, const void *src, size_t src_len);
+
+#endif
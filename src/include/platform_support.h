@@ -32,8 +32,15 @@ void platform_init(int argc, char **argv);
 void platform_init(void);
 #endif
 
+#if PC_HOSTED == 1 || defined(PLATFORM_HAS_CACHE)
+/* Small blobs kept between runs, read returns false if there is none of that size */
+bool platform_cache_read(const char *name, void *data, size_t len);
+void platform_cache_write(const char *name, const void *data, size_t len);
+#endif
+
 typedef struct platform_timeout platform_timeout;
 void platform_timeout_set(platform_timeout *t, uint32_t ms);
+void platform_timeout_set_us(platform_timeout *t, uint32_t us);
 bool platform_timeout_is_expired(platform_timeout *t);
 void platform_delay(uint32_t ms);
 
@@ -50,6 +57,25 @@ void platform_request_boot(void);
 void platform_max_frequency_set(uint32_t frequency);
 uint32_t platform_max_frequency_get(void);
 
+/*
+ * Keeps the interrupts that would stretch SWCLK cycles off for one
+ * bit-banged SWD transaction, returning what to restore when it ends.
+ */
+#ifndef PLATFORM_HAS_SWD_CRITICAL
+static inline uint32_t platform_swd_critical_enter(void)
+{
+	return 0;
+}
+
+static inline void platform_swd_critical_exit(const uint32_t state)
+{
+	(void)state;
+}
+#else
+uint32_t platform_swd_critical_enter(void);
+void platform_swd_critical_exit(uint32_t state);
+#endif
+
 void platform_target_clk_output_enable(bool enable);
 
 #endif
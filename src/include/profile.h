@@ -0,0 +1,54 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include "target.h"
+
+/*
+ * Statistical profiler: while the target runs, its PC is sampled in the
+ * background and counted into a histogram, which is then printed or saved
+ * for gprof. The samples are either read by the GDB server's poll loop, or
+ * sent by the target itself over SWO and fed in by the trace decoder.
+ */
+typedef enum profile_source {
+	PROFILE_SOURCE_PCSR,
+	PROFILE_SOURCE_SWO,
+} profile_source_e;
+
+/* Exception trace functions, as in the DWT's exception trace packets */
+typedef enum profile_exception_event {
+	PROFILE_EXCEPTION_ENTERED = 1,
+	PROFILE_EXCEPTION_EXITED = 2,
+	PROFILE_EXCEPTION_RETURNED = 3,
+} profile_exception_event_e;
+
+void profile_start(profile_source_e source);
+void profile_stop(void);
+/* True while the poll loop should be taking samples */
+bool profile_polling(void);
+void profile_poll(target *t);
+void profile_sample(uint32_t pc);
+void profile_sleep_sample(void);
+void profile_exception(uint16_t number, profile_exception_event_e event);
+void profile_print(void (*print)(const char *fmt, ...), bool counts);
+#if PC_HOSTED == 1
+bool profile_write_gmon(const char *filename);
+#endif
+
+#endif /* __PROFILE_H */
@@ -0,0 +1,110 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RAM_BUDGET_H
+#define __RAM_BUDGET_H
+
+/*
+ * The buffers that take most of a probe's RAM, sized in one place.
+ * A size set in platform.h is used as it is; the defaults here are multiplied
+ * by BUFFER_SCALE (make BUFFER_SCALE=n), for builds with RAM to spare.
+ */
+#ifndef BUFFER_SCALE
+#define BUFFER_SCALE 1U
+#endif
+
+/*
+ * GDB packets. A larger PacketSize negotiated with GDB means fewer round
+ * trips for memory and Flash transfers.
+ */
+#ifndef GDB_PACKET_BUFFER_SIZE
+#define GDB_PACKET_BUFFER_SIZE (1024U * BUFFER_SCALE)
+#endif
+
+/* The most a target's Flash write buffer grows to, bounded by the Flash block size */
+#ifndef FLASH_BUFFER_SIZE
+#define FLASH_BUFFER_SIZE (1024U * BUFFER_SCALE)
+#endif
+
+/* Packet types the GDB latency histograms keep apart, see stats.h */
+#ifndef LATENCY_KINDS
+#if PC_HOSTED == 1
+#define LATENCY_KINDS 32U
+#else
+#define LATENCY_KINDS (8U * BUFFER_SCALE)
+#endif
+#endif
+
+/* RTOS threads read per halt, see rtos.c. Only held while GDB looks at them */
+#ifndef RTOS_MAX_THREADS
+#if PC_HOSTED == 1
+#define RTOS_MAX_THREADS 256U
+#else
+#define RTOS_MAX_THREADS (16U * BUFFER_SCALE)
+#endif
+#endif
+
+/*
+ * RTT, 8 bytes added to the up buffer for alignment and padding.
+ * The up buffer is used by pc-hosted only, the probe reads straight into usb packets.
+ */
+#if !defined(RTT_UP_BUF_SIZE) || !defined(RTT_DOWN_BUF_SIZE)
+#if PC_HOSTED == 1
+#define RTT_UP_BUF_SIZE   (4096U + 8U)
+#define RTT_DOWN_BUF_SIZE 512U
+#elif defined(STM32F7)
+#define RTT_UP_BUF_SIZE   (4096U * BUFFER_SCALE + 8U)
+#define RTT_DOWN_BUF_SIZE (2048U * BUFFER_SCALE)
+#elif defined(STM32F4)
+#define RTT_UP_BUF_SIZE   (2048U * BUFFER_SCALE + 8U)
+#define RTT_DOWN_BUF_SIZE (256U * BUFFER_SCALE)
+#else /* stm32f103 */
+#define RTT_UP_BUF_SIZE   (1024U * BUFFER_SCALE + 8U)
+#define RTT_DOWN_BUF_SIZE (256U * BUFFER_SCALE)
+#endif
+#endif
+
+#if PC_HOSTED == 0
+/* The USB UART DMA buffers, per direction */
+#ifndef USART_DMA_BUF_SIZE
+#if defined(STM32F4)
+/* Room for a few ms of a multi-Mbaud UART while USB catches up */
+#define USART_DMA_BUF_SIZE (1024U * BUFFER_SCALE)
+#else
+#define USART_DMA_BUF_SIZE (128U * BUFFER_SCALE)
+#endif
+#endif
+
+/*
+ * Remote protocol frames from hosted BMP, received apart from GDB packets.
+ * The host asks for this size (HF) and sizes its memory transfers to match.
+ */
+#ifndef REMOTE_PACKET_BUFFER_SIZE
+#if defined(STM32F4) || defined(STM32F7)
+#define REMOTE_PACKET_BUFFER_SIZE (4096U * BUFFER_SCALE)
+#else
+#define REMOTE_PACKET_BUFFER_SIZE (1024U * BUFFER_SCALE)
+#endif
+#endif
+
+/* Trace packets buffered for the async (NRZ) SWO capture, 8K by default */
+#ifndef NUM_TRACE_PACKETS
+#define NUM_TRACE_PACKETS (128U * BUFFER_SCALE)
+#endif
+#endif
+
+#endif /* __RAM_BUDGET_H */
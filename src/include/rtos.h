@@ -0,0 +1,55 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RTOS_H
+#define __RTOS_H
+
+#include "target.h"
+
+/*
+ * RTOS awareness: the threads of a FreeRTOS or Zephyr application on a
+ * Cortex-M, found through the symbols GDB looks up for us with qSymbol and
+ * read once per halt. Thread IDs are the addresses of the thread control
+ * blocks. Without an RTOS running there are no threads and GDB is left
+ * with the one thread it always had.
+ */
+
+/* r0-r15 and xpsr, all a switched out thread has saved */
+#define RTOS_STACKED_REGS 17U
+
+/* GDB offers to look symbols up, which starts the lookup over */
+void rtos_symbols_reset(void);
+/* The next symbol to ask GDB for, NULL once there is nothing more to ask */
+const char *rtos_symbol_next(void);
+/* GDB's answer for the symbol asked for last */
+void rtos_symbol_set(const char *name, bool found, target_addr value);
+
+/* Drops what was read at the last halt, for when the target runs again */
+void rtos_invalidate(void);
+
+/* 0 if no RTOS is running on t */
+size_t rtos_thread_count(target *t);
+uint32_t rtos_thread_id(target *t, size_t index);
+/* The thread on the core, 0 if no RTOS is running */
+uint32_t rtos_current_thread(target *t);
+bool rtos_thread_known(target *t, uint32_t id);
+/* Name, state and priority of the thread, false if id isn't one */
+bool rtos_thread_info(target *t, uint32_t id, char *buf, size_t len);
+/* The registers stacked by a switched out thread, NULL for the one on the core or an unknown one */
+const uint32_t *rtos_thread_regs(target *t, uint32_t id);
+
+#endif /* __RTOS_H */
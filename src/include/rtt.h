@@ -8,12 +8,18 @@ extern char rtt_ident[16];	    // string
 extern bool rtt_enabled;	    // rtt on/off
 extern bool rtt_found;              // control block found
 extern uint32_t rtt_cbaddr;         // control block address
+extern uint32_t rtt_cbaddr_hint;    // control block address to try first
 extern uint32_t rtt_min_poll_ms;    // min time between polls (ms)
 extern uint32_t rtt_max_poll_ms;    // max time between polls (ms)
 extern uint32_t rtt_max_poll_errs;  // max number of errors before disconnect
 extern bool rtt_auto_channel;       // manual or auto channel selection
+extern bool rtt_mux;                // keep the up channels apart, see rtt_if.c
+#if PC_HOSTED == 1
+extern uint32_t rtt_mux_port;       // tcp port of channel 0, channel n is on the port n above
+#endif
 extern bool rtt_flag_skip;          // skip if host-to-target fifo full
 extern bool rtt_flag_block;         // block if host-to-target fifo full
+extern bool rtt_auto;               // capture without gdb, see rtt.c
 
 struct rtt_channel_struct {
 	bool is_enabled;            // does user want to see this channel?
@@ -28,7 +34,9 @@ struct rtt_channel_struct {
 
 extern struct rtt_channel_struct rtt_channel[MAX_RTT_CHAN];
 
-// true if target memory access does not work when target running
-extern bool target_no_background_memory_access(target *cur_target);
 extern void poll_rtt(target *cur_target);
+// capture without gdb
+extern void rtt_auto_set(bool enable);
+extern target *rtt_auto_target(void);
+extern void rtt_auto_lost(void);
 #endif
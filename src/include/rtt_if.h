@@ -2,34 +2,26 @@
 #define RTT_IF_H
 /* rtt i/o to terminal */
 
-/* default buffer sizes, 8 bytes added to up buffer for alignment and padding */
-/* override RTT_UP_BUF_SIZE and RTT_DOWN_BUF_SIZE in platform.h if needed */
-
-#if !defined(RTT_UP_BUF_SIZE) || !defined(RTT_DOWN_BUF_SIZE)
-#if (PC_HOSTED == 1)
-#define RTT_UP_BUF_SIZE    (4096 + 8)
-#define RTT_DOWN_BUF_SIZE  (512)
-#elif defined(STM32F7)
-#define RTT_UP_BUF_SIZE    (4096 + 8)
-#define RTT_DOWN_BUF_SIZE  (2048)
-#elif defined(STM32F4)
-#define RTT_UP_BUF_SIZE    (2048 + 8)
-#define RTT_DOWN_BUF_SIZE  (256)
-#else /* stm32f103 */
-#define RTT_UP_BUF_SIZE    (1024 + 8)
-#define RTT_DOWN_BUF_SIZE  (256)
-#endif
-#endif
+/* RTT_UP_BUF_SIZE and RTT_DOWN_BUF_SIZE are set in ram_budget.h, or in platform.h if needed */
 
 /* hosted initialisation */
 extern int rtt_if_init(void);
 /* hosted teardown */
 extern int rtt_if_exit(void);
+/* hosted: serve the clients of the channel ports, called on every poll */
+extern void rtt_if_poll(void);
+/* hosted: where rtt goes, "stdout", a tcp port or a unix socket path. false if not usable */
+extern bool rtt_if_transport(const char *transport);
 
-/* target to host: write len bytes from the buffer starting at buf. return number bytes written */
-extern uint32_t rtt_write(const char *buf, uint32_t len);
-/* host to target: read one character, non-blocking. return character, -1 if no character */
-extern int32_t rtt_getchar();
+/* target to host: buffer to read an up channel's data into, with len set to how much the host can
+   take now. NULL if it can't take any, the data then waits in the target. 8 bytes past len are
+   spare for alignment and padding */
+extern char *rtt_write_buf(uint32_t channel, uint32_t *len);
+/* target to host: send the first len bytes of the buffer rtt_write_buf returned */
+extern void rtt_write_done(uint32_t channel, uint32_t len);
+/* host to target: read up to len bytes for down channel number channel, non-blocking.
+   return how many were read */
+extern uint32_t rtt_read_buf(uint32_t channel, char *buf, uint32_t len);
 /* host to target: true if no characters available for reading */
 extern bool rtt_nodata();
 
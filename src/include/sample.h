@@ -0,0 +1,42 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SAMPLE_H
+#define __SAMPLE_H
+
+#include "target.h"
+
+/*
+ * Live variable sampler: while the target runs, a list of variables is read
+ * at a fixed rate in the background and each set of values goes out as a
+ * timestamped binary record on an RTT up channel's output, the second vcom
+ * or a TCP port on hosted.
+ */
+#define SAMPLE_CHANNEL 15U
+
+bool sample_add(target_addr addr, size_t size);
+void sample_clear(void);
+bool sample_start(uint32_t rate_hz, uint32_t channel);
+void sample_stop(void);
+/* True while the poll loop should be taking samples */
+bool sample_polling(void);
+/* Least time between polls, sample_poll() keeps to the exact rate itself */
+uint32_t sample_period_ms(void);
+void sample_poll(target *t);
+void sample_print(void (*print)(const char *fmt, ...));
+
+#endif /* __SAMPLE_H */
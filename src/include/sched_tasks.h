@@ -0,0 +1,34 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SCHED_TASKS_H
+#define __SCHED_TASKS_H
+
+#include "target.h"
+
+/* No task has anything to do, wait for GDB for as long as it takes */
+#define SCHED_IDLE UINT32_MAX
+
+/*
+ * Runs the background tasks that are due for a running target, NULL if
+ * there is none. Returns the ms until the next one is due, or SCHED_IDLE.
+ */
+uint32_t sched_poll(target *t);
+/* The same while GDB has no packet in flight */
+uint32_t sched_idle_poll(void);
+
+#endif /* __SCHED_TASKS_H */
@@ -0,0 +1,83 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STATS_H
+#define __STATS_H
+
+#ifdef ENABLE_RTT
+#include "rtt.h"
+#endif
+
+/*
+ * Counters for where the probe spends its time. They are plain increments,
+ * the ones bumped from interrupt handlers may lose the odd count to a race
+ * with "monitor stats reset", which is fine for what they are used for.
+ */
+typedef struct bmp_stats {
+	uint32_t swd_transactions;
+	uint32_t swd_waits;
+	uint32_t swd_faults;
+	uint32_t swd_retries;
+	uint32_t tar_writes;
+	uint32_t gdb_packets_in;
+	uint32_t gdb_packets_out;
+	uint32_t gdb_bytes_in;
+	uint32_t gdb_bytes_out;
+	uint32_t halt_polls;
+#ifdef ENABLE_RTT
+	uint32_t rtt_up_bytes[MAX_RTT_CHAN];
+	uint32_t rtt_down_bytes[MAX_RTT_CHAN];
+	uint32_t rtt_halts;
+	uint32_t rtt_halt_us;
+	uint32_t rtt_halt_max_us;
+#endif
+	uint32_t swo_bytes;
+	uint32_t swo_drops;
+	uint32_t swo_overruns;
+	uint32_t uart_overruns;
+} bmp_stats_t;
+
+extern bmp_stats_t bmp_stats;
+
+#define STATS_ADD(field, n) (bmp_stats.field += (n))
+#define STATS_INC(field)    STATS_ADD(field, 1U)
+
+void stats_reset(void);
+void stats_print(void (*print)(const char *fmt, ...));
+
+/*
+ * Service time histograms per GDB packet type, in log2 microsecond buckets,
+ * plus the time spent waiting for the host between packets. Types are named
+ * by the packet letter, or the command name for q, Q and v packets; the ones
+ * that don't fit in the table share an "other" entry.
+ */
+#define LATENCY_BUCKETS  20U
+#define LATENCY_NAME_LEN 20U
+/* The entry the host wait is counted in */
+#define LATENCY_HOST 0U
+
+/* Returns the entry packet is counted in, taken before the reply overwrites it */
+uint8_t latency_kind(const char *packet, size_t len);
+void latency_add(uint8_t kind, uint32_t us);
+void latency_reset(void);
+/* false if nothing was recorded */
+bool latency_print(void (*print)(const char *fmt, ...));
+#if PC_HOSTED == 1
+void stats_poll(void);
+#endif
+
+#endif /* __STATS_H */
@@ -37,6 +37,8 @@ struct target_controller;
 #if PC_HOSTED == 1
 uint32_t platform_adiv5_swdp_scan(uint32_t targetid);
 uint32_t platform_jtag_scan(const uint8_t *lrlens);
+/* Applies adiv5_wait_policy to the probe, after it changed */
+void platform_wait_policy_set(void);
 #endif
 uint32_t adiv5_swdp_scan(uint32_t targetid);
 uint32_t jtag_scan(const uint8_t *lrlens);
@@ -47,17 +49,27 @@ void target_list_free(void);
 /* Attach/detach functions */
 target *target_attach(target *t, struct target_controller *);
 target *target_attach_n(size_t n, struct target_controller *);
+bool target_revalidate(target *t);
 void target_detach(target *t);
 bool target_attached(target *t);
+/* Keep debug alive in the target's low power modes while attached, where its driver knows how */
+extern bool target_lowpower_debug;
 const char *target_driver_name(target *t);
 const char *target_core_name(target *t);
 unsigned int target_designer(target *t);
 unsigned int target_part_id(target *t);
 
 /* Memory access functions */
-bool target_mem_map(target *t, char *buf, size_t len);
+const char *target_mem_map(target *t, size_t *len);
 int target_mem_read(target *t, void *dest, target_addr src, size_t len);
 int target_mem_write(target *t, target_addr dest, const void *src, size_t len);
+int target_mem_crc32(target *t, uint32_t *crc, target_addr addr, size_t len);
+/* Fill with a 1, 2 or 4 byte pattern, its first byte at addr */
+int target_mem_fill(target *t, target_addr addr, size_t len, uint32_t pattern, size_t size);
+/* Look for the pattern, or where it isn't with mismatch, at each multiple of
+ * its size from addr. Returns 0 with found set, 1 if there's none, -1 on error */
+int target_mem_find(target *t, target_addr *found, target_addr addr, size_t len, uint32_t pattern, size_t size,
+	bool mismatch);
 /* Flash memory access functions */
 int target_flash_erase(target *t, target_addr addr, size_t len);
 int target_flash_write(target *t, target_addr dest, const void *src, size_t len);
@@ -65,6 +77,9 @@ int target_flash_done(target *t);
 
 /* Register access functions */
 size_t target_regs_size(target *t);
+/* The registers 'g' covers, the start of those target_regs_read() does */
+size_t target_regs_size_core(target *t);
+void target_regs_read_core(target *t, void *data);
 const char *target_tdesc(target *t);
 void target_regs_read(target *t, void *data);
 void target_regs_write(target *t, const void *data);
@@ -86,6 +101,13 @@ void target_reset(target *t);
 void target_halt_request(target *t);
 enum target_halt_reason target_halt_poll(target *t, target_addr *watch);
 void target_halt_resume(target *t, bool step);
+void target_halt_resume_range(target *t, target_addr start, target_addr end);
+bool target_halt_wait(target *t, uint32_t timeout_ms);
+size_t target_pc_sample(target *t, uint32_t *pcs, size_t count);
+bool target_no_background_memory_access(target *t);
+bool target_branch_trace_enable(target *t, bool enable);
+size_t target_branch_trace_size(target *t);
+ssize_t target_branch_trace_read(target *t, char *buf, size_t offset, size_t len);
 void target_set_cmdline(target *t, char *cmdline);
 void target_set_heapinfo(target *t, target_addr heap_base, target_addr heap_limit,
 	target_addr stack_base, target_addr stack_limit);
@@ -21,10 +21,13 @@
 #define __TIMING_H
 
 struct platform_timeout {
+	/* Deadline in us, compared as a difference so the wrap doesn't matter */
 	uint32_t time;
 };
 
 extern int32_t swj_delay_cnt;
 uint32_t platform_time_ms(void);
+/* Free running, wraps after 71 minutes so only differences are meaningful */
+uint32_t platform_time_us(void);
 
 #endif /* __TIMING_H */
@@ -0,0 +1,83 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Decoder for the LZ4 block format, as sent by vFlashWriteLZ4.
+ *
+ * A block is a run of sequences, each a token byte, literals copied as they
+ * are and a match copied from earlier output. The top nibble of the token is
+ * the number of literals, the bottom one the match length less 4, either
+ * continued in further bytes when 15. The match offset is 16 bits, little
+ * endian. The last sequence ends after its literals.
+ */
+
+#include "general.h"
+#include "lz4.h"
+
+#define LZ4_MIN_MATCH 4U
+
+/* Lengths of 15 carry on in the bytes that follow, for as long as they are 255 */
+static bool lz4_length(const uint8_t **src, const uint8_t *const src_end, size_t *length)
+{
+	if (*length != 15U)
+		return true;
+	uint8_t byte;
+	do {
+		if (*src == src_end)
+			return false;
+		byte = *(*src)++;
+		*length += byte;
+	} while (byte == 255U);
+	return true;
+}
+
+ssize_t lz4_decompress(void *const dest, const size_t dest_len, const void *const src, const size_t src_len)
+{
+	uint8_t *const out_start = (uint8_t *)dest;
+	uint8_t *out = out_start;
+	const uint8_t *const out_end = out_start + dest_len;
+	const uint8_t *in = (const uint8_t *)src;
+	const uint8_t *const in_end = in + src_len;
+
+	while (in < in_end) {
+		const uint8_t token = *in++;
+		size_t literals = token >> 4U;
+		if (!lz4_length(&in, in_end, &literals) || literals > (size_t)(in_end - in) ||
+			literals > (size_t)(out_end - out))
+			return -1;
+		memcpy(out, in, literals);
+		out += literals;
+		in += literals;
+		if (in == in_end)
+			break;
+
+		if (in_end - in < 2)
+			return -1;
+		const size_t offset = in[0] | (in[1] << 8U);
+		in += 2;
+		size_t match = token & 0x0fU;
+		if (!lz4_length(&in, in_end, &match))
+			return -1;
+		match += LZ4_MIN_MATCH;
+		if (!offset || offset > (size_t)(out - out_start) || match > (size_t)(out_end - out))
+			return -1;
+		/* Byte by byte, the match may overlap what it's producing */
+		const uint8_t *from = out - offset;
+		for (size_t i = 0; i < match; ++i)
+			*out++ = *from++;
+	}
+	return out - out_start;
+}
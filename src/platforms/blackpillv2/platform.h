@@ -32,6 +32,21 @@
 
 #define PLATFORM_HAS_TRACESWO
 #define PLATFORM_IDENT "(BlackPillV2) "
+
+/* The F4 has plenty of RAM to spare, so use a larger GDB packet buffer */
+#define GDB_PACKET_BUFFER_SIZE 4096U
+/*
+ * The top 256 KiB of flash, which the firmware doesn't reach, store a target
+ * image for standalone programming, see image_store.c. The USER button
+ * programs it into the first target found.
+ */
+#define PLATFORM_HAS_IMAGE_STORE
+#define IMAGE_STORE_BASE         0x08040000U
+#define IMAGE_STORE_FIRST_SECTOR 6U
+#define IMAGE_STORE_SECTORS      2U
+#define IMAGE_STORE_SECTOR_SIZE  0x20000U
+#define IMAGE_BUTTON_PORT        GPIOA
+#define IMAGE_BUTTON_PIN         GPIO0
 /* Important pin mappings for STM32 implementation:
         * JTAG/SWD
                 * PA1: TDI
@@ -63,6 +78,10 @@
 #define SWCLK_PORT JTAG_PORT
 #define SWDIO_PIN TMS_PIN
 #define SWCLK_PIN TCK_PIN
+/* SWDIO and SWCLK share a port, swdptap.c can update both in one BSRR write */
+#define SWDPTAP_SINGLE_PORT
+/* Likewise TDI and TCK for jtagtap.c */
+#define JTAGTAP_SINGLE_PORT
 
 #define TRST_PORT GPIOB
 #define TRST_PIN GPIO5
@@ -0,0 +1,36 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IMAGE_STORE_H
+#define __IMAGE_STORE_H
+
+#include "target.h"
+
+/* How often the programming button is looked at */
+#define IMAGE_BUTTON_POLL_MS 50U
+
+/* Copies len bytes of the target's memory from addr into the store, to be programmed back to addr */
+bool image_store_save(target *t, uint32_t addr, uint32_t len);
+bool image_store_erase(void);
+/* false if the store holds no image or it fails its CRC */
+bool image_store_info(uint32_t *addr, uint32_t *len, uint32_t *crc);
+/* Erases, programs and verifies the target's flash with the stored image */
+bool image_store_program(target *t);
+/* Programs the first target found when the button is pressed, unless GDB has a target */
+void image_store_button_poll(target *t);
+
+#endif /* __IMAGE_STORE_H */
@@ -73,12 +73,10 @@ static void jtagtap_reset(void)
 static bool jtagtap_next_swd_delay()
 {
 	gpio_set(TCK_PORT, TCK_PIN);
-	for (volatile int32_t cnt = swd_delay_cnt - 2U; cnt > 0; cnt--)
-		continue;
+	platform_clock_delay();
 	const uint16_t result = gpio_get(TDO_PORT, TDO_PIN);
 	gpio_clear(TCK_PORT, TCK_PIN);
-	for (volatile int32_t cnt = swd_delay_cnt - 2U; cnt > 0; cnt--)
-		continue;
+	platform_clock_delay();
 	return result != 0;
 }
 
@@ -106,13 +104,11 @@ static void jtagtap_tms_seq_swd_delay(uint32_t tms_states, size_t ticks)
 		const bool state = tms_states & 1;
 		gpio_set_val(TMS_PORT, TMS_PIN, state);
 		gpio_set(TCK_PORT, TCK_PIN);
-		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-			continue;
+		platform_clock_delay();
 		tms_states >>= 1;
 		ticks--;
 		gpio_clear(TCK_PORT, TCK_PIN);
-		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-			continue;
+		platform_clock_delay();
 	}
 }
 
@@ -138,119 +134,182 @@ static void jtagtap_tms_seq(const uint32_t tms_states, const size_t ticks)
 		jtagtap_tms_seq_no_delay(tms_states, ticks);
 }
 
-static void jtagtap_tdi_tdo_seq_swd_delay(const uint8_t *const data_in, uint8_t *const data_out, const bool final_tms, size_t clock_cycles)
+/* Load up to the next 32 clock cycles worth of TDI bits */
+static inline uint32_t jtagtap_load_bits(const uint8_t *const data, const size_t clock_cycles)
 {
-	size_t byte = 0;
+	uint32_t value = 0;
+	memcpy(&value, data, clock_cycles >= 32U ? 4U : (clock_cycles + 7U) >> 3U);
+	return value;
+}
+
+/* Store the TDO bits of the last 32 or fewer clock cycles */
+static inline void jtagtap_store_bits(uint8_t *const data, const uint32_t value, const size_t clock_cycles)
+{
+	memcpy(data, &value, (clock_cycles + 7U) >> 3U);
+}
+
+/* Present the next TDI bit and drop TCK */
+static inline void jtagtap_next_tdi(const bool bit)
+{
+#ifdef JTAGTAP_SINGLE_PORT
+	/* TDI is sampled on the rising edge, so it can change along with the falling one */
+	const uint32_t bsrr = ((uint32_t)TCK_PIN << 16U) | (bit ? TDI_PIN : (uint32_t)TDI_PIN << 16U);
+	GPIO_BSRR(TDI_PORT) = bsrr;
+#ifdef STM32F4
+	/* Match the doubled writes of gpio_set()/gpio_clear() */
+	GPIO_BSRR(TDI_PORT) = bsrr;
+#endif
+#else
+	gpio_clear(TCK_PORT, TCK_PIN);
+	gpio_set_val(TDI_PORT, TDI_PIN, bit);
+#endif
+}
+
+/*
+ * The sequences below run all but the last clock cycle with TMS low, taking
+ * TDI a word at a time and collecting TDO into a word. The last cycle, which
+ * carries final_tms, is clocked on its own afterwards.
+ */
+static void jtagtap_tdi_tdo_seq_swd_delay(const uint8_t *data_in, uint8_t *data_out, bool final_tms, size_t clock_cycles)
+	__attribute__((optimize(3)));
+static void jtagtap_tdi_tdo_seq_swd_delay(
+	const uint8_t *data_in, uint8_t *data_out, const bool final_tms, const size_t clock_cycles)
+{
+	uint32_t tdi = jtagtap_load_bits(data_in, clock_cycles);
+	uint32_t tdo = 0;
 	size_t index = 0;
-	uint8_t value = 0;
-	while (clock_cycles--) {
-		/* On the last cycle, assert final_tms to TMS_PIN */
-		gpio_set_val(TMS_PORT, TMS_PIN, clock_cycles ? false : final_tms);
-		/* Set up the TDI pin and start the clock cycle */
-		gpio_set_val(TDI_PORT, TDI_PIN, data_in[byte] & (1U << index));
+	gpio_set_val(TDI_PORT, TDI_PIN, tdi & 1U);
+	for (size_t cycle = 1; cycle < clock_cycles; ++cycle) {
 		gpio_set(TCK_PORT, TCK_PIN);
-		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-			continue;
-		/* If TDO is high, store a 1 in the appropriate position in the value being accumulated */
+		platform_clock_delay();
 		if (gpio_get(TDO_PORT, TDO_PIN))
-			value |= (1 << index);
-		if (index++ == 7U) {
-			data_out[byte++] = value;
+			tdo |= 1U << index;
+		/* On a word boundary, store the accumulated TDO bits and fetch the next TDI bits */
+		if (++index == 32U) {
+			jtagtap_store_bits(data_out, tdo, 32U);
+			data_in += 4U;
+			data_out += 4U;
+			tdi = jtagtap_load_bits(data_in, clock_cycles - cycle);
+			tdo = 0;
 			index = 0;
-			value = 0;
-		}
-		/* Finish the clock cycle */
-		gpio_clear(TCK_PORT, TCK_PIN);
-		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-			continue;
+		} else
+			tdi >>= 1U;
+		jtagtap_next_tdi(tdi & 1U);
+		platform_clock_delay();
 	}
-	if (index)
-		data_out[byte] = value;
+	/* On the last cycle, assert final_tms to TMS_PIN */
+	gpio_set_val(TMS_PORT, TMS_PIN, final_tms);
+	gpio_set(TCK_PORT, TCK_PIN);
+	platform_clock_delay();
+	if (gpio_get(TDO_PORT, TDO_PIN))
+		tdo |= 1U << index;
+	gpio_clear(TCK_PORT, TCK_PIN);
+	platform_clock_delay();
+	jtagtap_store_bits(data_out, tdo, index + 1U);
 }
 
-static void jtagtap_tdi_tdo_seq_no_delay(const uint8_t *const data_in, uint8_t *const data_out, const bool final_tms, size_t clock_cycles)
+static void jtagtap_tdi_tdo_seq_no_delay(const uint8_t *data_in, uint8_t *data_out, bool final_tms, size_t clock_cycles)
+	__attribute__((optimize(3)));
+static void jtagtap_tdi_tdo_seq_no_delay(
+	const uint8_t *data_in, uint8_t *data_out, const bool final_tms, const size_t clock_cycles)
 {
-	size_t byte = 0;
+	uint32_t tdi = jtagtap_load_bits(data_in, clock_cycles);
+	uint32_t tdo = 0;
 	size_t index = 0;
-	uint8_t value = 0;
-	while (clock_cycles--) {
-		/* On the last tick, assert final_tms to TMS_PIN */
-		gpio_set_val(TMS_PORT, TMS_PIN, clock_cycles ? false : final_tms);
-		/* Set up the TDI pin and start the clock cycle */
-		gpio_set_val(TDI_PORT, TDI_PIN, data_in[byte] & (1U << index));
+	gpio_set_val(TDI_PORT, TDI_PIN, tdi & 1U);
+	for (size_t cycle = 1; cycle < clock_cycles; ++cycle) {
 		gpio_set(TCK_PORT, TCK_PIN);
-		/* If TDO is high, store a 1 in the appropriate position in the value being accumulated */
 		if (gpio_get(TDO_PORT, TDO_PIN))
-			value |= (1 << index);
-		/* If we've got to the next whole byte, store the accumulated value and reset state */
-		if (index++ == 7U) {
-			data_out[byte++] = value;
+			tdo |= 1U << index;
+		/* On a word boundary, store the accumulated TDO bits and fetch the next TDI bits */
+		if (++index == 32U) {
+			jtagtap_store_bits(data_out, tdo, 32U);
+			data_in += 4U;
+			data_out += 4U;
+			tdi = jtagtap_load_bits(data_in, clock_cycles - cycle);
+			tdo = 0;
 			index = 0;
-			value = 0;
-		}
-		/* Finish the clock cycle */
-		gpio_clear(TCK_PORT, TCK_PIN);
+		} else
+			tdi >>= 1U;
+		jtagtap_next_tdi(tdi & 1U);
 	}
-	if (index)
-		data_out[byte] = value;
+	/* On the last cycle, assert final_tms to TMS_PIN */
+	gpio_set_val(TMS_PORT, TMS_PIN, final_tms);
+	gpio_set(TCK_PORT, TCK_PIN);
+	if (gpio_get(TDO_PORT, TDO_PIN))
+		tdo |= 1U << index;
+	gpio_clear(TCK_PORT, TCK_PIN);
+	jtagtap_store_bits(data_out, tdo, index + 1U);
 }
 
 static void jtagtap_tdi_tdo_seq(uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, size_t ticks)
 {
+	if (!ticks)
+		return;
 	gpio_clear(TMS_PORT, TMS_PIN);
-	gpio_clear(TDI_PORT, TDI_PIN);
 	if (swd_delay_cnt)
 		jtagtap_tdi_tdo_seq_swd_delay(data_in, data_out, final_tms, ticks);
 	else
 		jtagtap_tdi_tdo_seq_no_delay(data_in, data_out, final_tms, ticks);
 }
 
-static void jtagtap_tdi_seq_swd_delay(const uint8_t *const data_in, const bool final_tms, size_t clock_cycles)
+static void jtagtap_tdi_seq_swd_delay(const uint8_t *data_in, bool final_tms, size_t clock_cycles)
+	__attribute__((optimize(3)));
+static void jtagtap_tdi_seq_swd_delay(const uint8_t *data_in, const bool final_tms, const size_t clock_cycles)
 {
-	size_t byte = 0;
+	uint32_t tdi = jtagtap_load_bits(data_in, clock_cycles);
 	size_t index = 0;
-	while (clock_cycles--) {
-		/* On the last tick, assert final_tms to TMS_PIN */
-		gpio_set_val(TMS_PORT, TMS_PIN, clock_cycles ? false : final_tms);
-		/* Set up the TDI pin and start the clock cycle */
-		gpio_set_val(TDI_PORT, TDI_PIN, data_in[byte] & (1U << index));
+	gpio_set_val(TDI_PORT, TDI_PIN, tdi & 1U);
+	for (size_t cycle = 1; cycle < clock_cycles; ++cycle) {
 		gpio_set(TCK_PORT, TCK_PIN);
-		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-			continue;
-		/* If we've used a whole byte, reset state for the next */
-		if (index++ == 7U) {
-			++byte;
+		platform_clock_delay();
+		/* If we've used a whole word, fetch the next */
+		if (++index == 32U) {
+			data_in += 4U;
+			tdi = jtagtap_load_bits(data_in, clock_cycles - cycle);
 			index = 0;
-		}
-		/* Finish the clock cycle */
-		gpio_clear(TCK_PORT, TCK_PIN);
-		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-			continue;
+		} else
+			tdi >>= 1U;
+		jtagtap_next_tdi(tdi & 1U);
+		platform_clock_delay();
 	}
+	/* On the last cycle, assert final_tms to TMS_PIN */
+	gpio_set_val(TMS_PORT, TMS_PIN, final_tms);
+	gpio_set(TCK_PORT, TCK_PIN);
+	platform_clock_delay();
+	gpio_clear(TCK_PORT, TCK_PIN);
+	platform_clock_delay();
 }
 
-static void jtagtap_tdi_seq_no_delay(const uint8_t *const data_in, const bool final_tms, size_t clock_cycles)
+static void jtagtap_tdi_seq_no_delay(const uint8_t *data_in, bool final_tms, size_t clock_cycles)
+	__attribute__((optimize(3)));
+static void jtagtap_tdi_seq_no_delay(const uint8_t *data_in, const bool final_tms, const size_t clock_cycles)
 {
-	size_t byte = 0;
+	uint32_t tdi = jtagtap_load_bits(data_in, clock_cycles);
 	size_t index = 0;
-	while (clock_cycles--) {
-		/* On the last tick, assert final_tms to TMS_PIN */
-		gpio_set_val(TMS_PORT, TMS_PIN, clock_cycles ? false : final_tms);
-		/* Set up the TDI pin and start the clock cycle */
-		gpio_set_val(TDI_PORT, TDI_PIN, data_in[byte] & (1U << index));
+	gpio_set_val(TDI_PORT, TDI_PIN, tdi & 1U);
+	for (size_t cycle = 1; cycle < clock_cycles; ++cycle) {
 		gpio_set(TCK_PORT, TCK_PIN);
-		/* If we've used a whole byte, reset state for the next */
-		if (index++ == 7U) {
-			++byte;
+		/* If we've used a whole word, fetch the next */
+		if (++index == 32U) {
+			data_in += 4U;
+			tdi = jtagtap_load_bits(data_in, clock_cycles - cycle);
 			index = 0;
-		}
-		/* Finish the clock cycle */
-		gpio_clear(TCK_PORT, TCK_PIN);
+		} else
+			tdi >>= 1U;
+		jtagtap_next_tdi(tdi & 1U);
 	}
+	/* On the last cycle, assert final_tms to TMS_PIN */
+	gpio_set_val(TMS_PORT, TMS_PIN, final_tms);
+	gpio_set(TCK_PORT, TCK_PIN);
+	__asm__("nop");
+	gpio_clear(TCK_PORT, TCK_PIN);
 }
 
 static void jtagtap_tdi_seq(const bool final_tms, const uint8_t *const data_in, const size_t ticks)
 {
+	if (!ticks)
+		return;
 	gpio_clear(TMS_PORT, TMS_PIN);
 	if (swd_delay_cnt)
 		jtagtap_tdi_seq_swd_delay(data_in, final_tms, ticks);
@@ -262,11 +321,9 @@ static void jtagtap_cycle_swd_delay(const size_t clock_cycles)
 {
 	for (size_t cycle = 0; cycle < clock_cycles; ++cycle) {
 		gpio_set(TCK_PORT, TCK_PIN);
-		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-			continue;
+		platform_clock_delay();
 		gpio_clear(TCK_PORT, TCK_PIN);
-		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-			continue;
+		platform_clock_delay();
 	}
 }
 
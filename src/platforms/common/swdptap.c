@@ -50,11 +50,9 @@ static void swdptap_turnaround(const swdio_status_t dir)
 	if (dir == SWDIO_STATUS_FLOAT)
 		SWDIO_MODE_FLOAT();
 	gpio_set(SWCLK_PORT, SWCLK_PIN);
-	for (volatile int32_t cnt = swd_delay_cnt; --cnt > 0;)
-		continue;
+	platform_clock_delay();
 	gpio_clear(SWCLK_PORT, SWCLK_PIN);
-	for (volatile int32_t cnt = swd_delay_cnt; --cnt > 0;)
-		continue;
+	platform_clock_delay();
 	if (dir == SWDIO_STATUS_DRIVE)
 		SWDIO_MODE_DRIVE();
 }
@@ -67,12 +65,10 @@ static uint32_t swdptap_seq_in_swd_delay(const size_t clock_cycles)
 		if (gpio_get(SWDIO_PORT, SWDIO_PIN))
 			value |= (1U << cycle);
 		gpio_set(SWCLK_PORT, SWCLK_PIN);
-		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-			continue;
+		platform_clock_delay();
 		++cycle;
 		gpio_clear(SWCLK_PORT, SWCLK_PIN);
-		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-			continue;
+		platform_clock_delay();
 	}
 	return value;
 }
@@ -107,30 +103,42 @@ static bool swdptap_seq_in_parity(uint32_t *ret, size_t clock_cycles)
 	int parity = __builtin_popcount(result);
 	const bool bit = gpio_get(SWDIO_PORT, SWDIO_PIN);
 	gpio_set(SWCLK_PORT, SWCLK_PIN);
-	for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-		continue;
+	platform_clock_delay();
 	parity += bit ? 1 : 0;
 	gpio_clear(SWCLK_PORT, SWCLK_PIN);
-	for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-		continue;
+	platform_clock_delay();
 	*ret = result;
 	/* Terminate the read cycle now */
 	swdptap_turnaround(SWDIO_STATUS_DRIVE);
 	return parity & 1;
 }
 
+/* Present the next data bit and drop SWCLK */
+static inline void swdptap_next_bit(const bool bit)
+{
+#ifdef SWDPTAP_SINGLE_PORT
+	/* Both pins share a port, so the data change and falling edge happen in one store */
+	const uint32_t bsrr = ((uint32_t)SWCLK_PIN << 16U) | (bit ? SWDIO_PIN : (uint32_t)SWDIO_PIN << 16U);
+	GPIO_BSRR(SWDIO_PORT) = bsrr;
+#ifdef STM32F4
+	/* Match the doubled writes of gpio_set()/gpio_clear() */
+	GPIO_BSRR(SWDIO_PORT) = bsrr;
+#endif
+#else
+	gpio_set_val(SWDIO_PORT, SWDIO_PIN, bit);
+	gpio_clear(SWCLK_PORT, SWCLK_PIN);
+#endif
+}
+
 static void swdptap_seq_out_swd_delay(uint32_t tms_states, size_t clock_cycles) __attribute__((optimize(3)));
 static void swdptap_seq_out_swd_delay(const uint32_t tms_states, const size_t clock_cycles)
 {
 	for (size_t cycle = 0; cycle < clock_cycles;) {
 		++cycle;
 		gpio_set(SWCLK_PORT, SWCLK_PIN);
-		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-			continue;
-		gpio_set_val(SWDIO_PORT, SWDIO_PIN, tms_states & (1 << cycle));
-		gpio_clear(SWCLK_PORT, SWCLK_PIN);
-		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-			continue;
+		platform_clock_delay();
+		swdptap_next_bit(tms_states & (1 << cycle));
+		platform_clock_delay();
 	}
 }
 
@@ -140,8 +148,7 @@ static void swdptap_seq_out_no_delay(const uint32_t tms_states, const size_t clo
 	for (size_t cycle = 0; cycle < clock_cycles;) {
 		++cycle;
 		gpio_set(SWCLK_PORT, SWCLK_PIN);
-		gpio_set_val(SWDIO_PORT, SWDIO_PIN, tms_states & (1 << cycle));
-		gpio_clear(SWCLK_PORT, SWCLK_PIN);
+		swdptap_next_bit(tms_states & (1 << cycle));
 	}
 }
 
@@ -161,11 +168,9 @@ static void swdptap_seq_out_parity(const uint32_t tms_states, const size_t clock
 	swdptap_seq_out(tms_states, clock_cycles);
 	gpio_set_val(SWDIO_PORT, SWDIO_PIN, parity & 1U);
 	gpio_set(SWCLK_PORT, SWCLK_PIN);
-	for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-		continue;
+	platform_clock_delay();
 	gpio_clear(SWCLK_PORT, SWCLK_PIN);
-	for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
-		continue;
+	platform_clock_delay();
 }
 
 int swdptap_init(ADIv5_DP_t *dp)
@@ -20,23 +20,84 @@
 #ifndef __TRACESWO_H
 #define __TRACESWO_H
 
+#if PC_HOSTED == 0
 #include <libopencm3/usb/usbd.h>
+#endif
 
 #if defined TRACESWO_PROTOCOL && TRACESWO_PROTOCOL == 2
 /* Default line rate, used as default for a request without baudrate */
 #define SWO_DEFAULT_BAUD (2250000)
-void traceswo_init(uint32_t baudrate, uint32_t swo_chan_bitmask);
+#if PC_HOSTED == 1
+/* false when the probe can't capture SWO */
+bool traceswo_init(uint32_t baudrate, uint32_t swo_chan_bitmask);
+#else
+/* Baud rate to measure from the line instead */
+#define SWO_AUTO_BAUD 0U
+/* Returns the baud rate set up, 0 when it could not be measured */
+uint32_t traceswo_init(uint32_t baudrate, uint32_t swo_chan_bitmask);
+#endif
 #else
 void traceswo_init(uint32_t swo_chan_bitmask);
 #endif
 
+#if PC_HOSTED == 0
 void trace_buf_drain(usbd_device *dev, uint8_t ep);
+#endif
+
+/*
+ * With records enabled, each ITM packet goes out as a record of
+ *   kind << 5 | id, payload length, payload bytes least significant first
+ * Software packets are only sent for the channels in the mask. The id is
+ * the channel, the hardware source discriminator, the relation of a local
+ * timestamp to its packet, 1 or 2 for the halves of a global timestamp and
+ * the SH bit of an extension. Timestamps and extensions give the value
+ * as the target sent it, without the continuation bits.
+ *
+ * With data trace on, only the DWT's data value packets go out, each as a
+ * record of the same shape, kind TRACESWO_RECORD_DATA_VALUE, the id being
+ * the comparator, with bit 2 set for a write, and the payload the value.
+ */
+typedef enum traceswo_record {
+	TRACESWO_RECORD_SOFTWARE = 0,
+	TRACESWO_RECORD_HARDWARE = 1,
+	TRACESWO_RECORD_LOCAL_TIMESTAMP = 2,
+	TRACESWO_RECORD_GLOBAL_TIMESTAMP = 3,
+	TRACESWO_RECORD_EXTENSION = 4,
+	TRACESWO_RECORD_OVERFLOW = 5,
+	TRACESWO_RECORD_SYNC = 6,
+	TRACESWO_RECORD_DATA_VALUE = 7,
+} traceswo_record_e;
+
+#define TRACESWO_RECORD_KIND_SHIFT 5U
+/* Header, length and up to 4 bytes of payload */
+#define TRACESWO_RECORD_MAX 6U
 
 /* set bitmask of swo channels to be decoded */
 void traceswo_setmask(uint32_t mask);
+/* send all packets as records, see above, set before traceswo_init() */
+void traceswo_setrecords(bool enable);
+/* hand the hardware source packets to the profiler, set before traceswo_init() */
+void traceswo_setprofile(bool enable);
+/* send only the data trace records, see above, set before traceswo_init() */
+void traceswo_setdatatrace(bool enable);
+/* false when the stream should be passed on raw */
+bool traceswo_decoding(void);
+
+#if PC_HOSTED == 1
+/* print decoded swo packets on stdout */
+void traceswo_decode(const void *buf, size_t len);
 
+/* drain the probe's trace capture, called while the target runs */
+void traceswo_poll(void);
+
+/* send the text of a software channel to "stdout", "off", "tcp:PORT" or a file, false if it can't */
+bool traceswo_sink(uint8_t channel, const char *where);
+/* show where each channel goes and what the sinks and the capture dropped */
+void traceswo_status(void (*print)(const char *fmt, ...));
+#else
 /* print decoded swo packet on usb serial */
 uint16_t traceswo_decode(usbd_device *usbd_dev, uint8_t addr,
 				const void *buf, uint16_t len);
+#endif
 
 #endif
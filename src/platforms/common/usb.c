@@ -25,6 +25,7 @@
 #include "usb_descriptors.h"
 #include "usb_serial.h"
 #include "usb_dfu_stub.h"
+#include "usb_remote.h"
 #include "serialno.h"
 
 usbd_device *usbdev = NULL;
@@ -42,6 +43,9 @@ void blackmagic_usb_init(void)
 
 	usbd_register_set_config_callback(usbdev, usb_serial_set_config);
 	usbd_register_set_config_callback(usbdev, dfu_set_config);
+#ifdef PLATFORM_HAS_REMOTE_IF
+	usbd_register_set_config_callback(usbdev, usb_remote_set_config);
+#endif
 
 	nvic_set_priority(USB_IRQ, IRQ_PRI_USB);
 	nvic_enable_irq(USB_IRQ);
@@ -27,20 +27,44 @@
 extern usbd_device *usbdev;
 extern uint16_t usb_config;
 
+/*
+ * A platform with an OTG_HS controller and a high speed PHY defines PLATFORM_USB_HS
+ * and points USB_DRIVER at otghs_usb_driver. High speed bulk endpoints must be 512 bytes.
+ */
+#ifdef PLATFORM_USB_HS
+#define CDCACM_PACKET_SIZE 512
+#else
 #define CDCACM_PACKET_SIZE 64
+#endif
+#define TRACE_PACKET_SIZE CDCACM_PACKET_SIZE
 
 #define CDCACM_GDB_ENDPOINT  1
 #define CDCACM_UART_ENDPOINT 3
 #define TRACE_ENDPOINT       5
+#define REMOTE_ENDPOINT      6
+
+#ifdef PLATFORM_USB_HS
+#define USBUART_OUT_PACKET_SIZE CDCACM_PACKET_SIZE
+#define REMOTE_PACKET_SIZE      CDCACM_PACKET_SIZE
+#else
+/* The endpoint buffers left over on the smallest parts only fit half size packets */
+#define USBUART_OUT_PACKET_SIZE (CDCACM_PACKET_SIZE / 2)
+#define REMOTE_PACKET_SIZE      32
+#endif
 
 #define GDB_IF_NO  0
 #define UART_IF_NO 2
 #define DFU_IF_NO  4
 #ifdef PLATFORM_HAS_TRACESWO
-#define TRACE_IF_NO      5
-#define TOTAL_INTERFACES 6
+#define TRACE_IF_NO  5
+#define REMOTE_IF_NO 6
+#else
+#define REMOTE_IF_NO 5
+#endif
+#ifdef PLATFORM_HAS_REMOTE_IF
+#define TOTAL_INTERFACES (REMOTE_IF_NO + 1)
 #else
-#define TOTAL_INTERFACES 5
+#define TOTAL_INTERFACES REMOTE_IF_NO
 #endif
 
 void blackmagic_usb_init(void);
@@ -183,7 +183,7 @@ static const struct usb_endpoint_descriptor uart_data_endp[] = {
 		.bDescriptorType = USB_DT_ENDPOINT,
 		.bEndpointAddress = CDCACM_UART_ENDPOINT,
 		.bmAttributes = USB_ENDPOINT_ATTR_BULK,
-		.wMaxPacketSize = CDCACM_PACKET_SIZE / 2,
+		.wMaxPacketSize = USBUART_OUT_PACKET_SIZE,
 		.bInterval = 1,
 	},
 	{
@@ -321,7 +321,7 @@ static const struct usb_endpoint_descriptor trace_endp = {
 	.bDescriptorType = USB_DT_ENDPOINT,
 	.bEndpointAddress = TRACE_ENDPOINT | USB_REQ_TYPE_IN,
 	.bmAttributes = USB_ENDPOINT_ATTR_BULK,
-	.wMaxPacketSize = 64,
+	.wMaxPacketSize = TRACE_PACKET_SIZE,
 	.bInterval = 0,
 };
 
@@ -351,6 +351,60 @@ static const struct usb_iface_assoc_descriptor trace_assoc = {
 };
 #endif
 
+/* Remote protocol interface, a plain pair of bulk endpoints for the hosted app */
+
+#ifdef PLATFORM_HAS_REMOTE_IF
+#ifdef PLATFORM_HAS_TRACESWO
+#define REMOTE_IF_STRING 8
+#else
+#define REMOTE_IF_STRING 7
+#endif
+
+static const struct usb_endpoint_descriptor remote_endp[] = {
+	{
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = REMOTE_ENDPOINT,
+		.bmAttributes = USB_ENDPOINT_ATTR_BULK,
+		.wMaxPacketSize = REMOTE_PACKET_SIZE,
+		.bInterval = 0,
+	},
+	{
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = REMOTE_ENDPOINT | USB_REQ_TYPE_IN,
+		.bmAttributes = USB_ENDPOINT_ATTR_BULK,
+		.wMaxPacketSize = REMOTE_PACKET_SIZE,
+		.bInterval = 0,
+	},
+};
+
+const struct usb_interface_descriptor remote_iface = {
+	.bLength = USB_DT_INTERFACE_SIZE,
+	.bDescriptorType = USB_DT_INTERFACE,
+	.bInterfaceNumber = REMOTE_IF_NO,
+	.bAlternateSetting = 0,
+	.bNumEndpoints = 2,
+	.bInterfaceClass = 0xFF,
+	.bInterfaceSubClass = 0xFF,
+	.bInterfaceProtocol = 0x01,
+	.iInterface = REMOTE_IF_STRING,
+
+	.endpoint = remote_endp,
+};
+
+static const struct usb_iface_assoc_descriptor remote_assoc = {
+	.bLength = USB_DT_INTERFACE_ASSOCIATION_SIZE,
+	.bDescriptorType = USB_DT_INTERFACE_ASSOCIATION,
+	.bFirstInterface = REMOTE_IF_NO,
+	.bInterfaceCount = 1,
+	.bFunctionClass = 0xFF,
+	.bFunctionSubClass = 0xFF,
+	.bFunctionProtocol = 0x01,
+	.iFunction = REMOTE_IF_STRING,
+};
+#endif
+
 /* Interface and configuration descriptors */
 
 static const struct usb_interface ifaces[] = {
@@ -384,6 +438,13 @@ static const struct usb_interface ifaces[] = {
 		.altsetting = &trace_iface,
 	},
 #endif
+#if defined(PLATFORM_HAS_REMOTE_IF)
+	{
+		.num_altsetting = 1,
+		.iface_assoc = &remote_assoc,
+		.altsetting = &remote_iface,
+	},
+#endif
 };
 
 static const struct usb_config_descriptor config = {
@@ -409,6 +470,9 @@ static const char *const usb_strings[] = {
 #if defined(PLATFORM_HAS_TRACESWO)
 	"Black Magic Trace Capture",
 #endif
+#if defined(PLATFORM_HAS_REMOTE_IF)
+	"Black Magic Remote",
+#endif
 };
 
 #endif /*USB_DESCRIPTORS_H*/
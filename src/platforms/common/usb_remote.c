@@ -0,0 +1,136 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements a vendor specific bulk interface carrying the remote
+ * protocol, so the hosted app can drive the probe without going through the
+ * CDC-ACM tty and its line discipline. The GDB and UART ports are untouched.
+ *
+ * The OUT endpoint is set up without a callback and polled from the GDB
+ * interface's wait loops, the same way gdb_if does it on parts where the
+ * hardware NAKs the endpoint until the packet has been read out.
+ */
+
+#include <libopencm3/cm3/nvic.h>
+
+#include "general.h"
+#include "usb_remote.h"
+#include "remote.h"
+
+#ifdef PLATFORM_HAS_REMOTE_IF
+
+static uint8_t buffer_out[REMOTE_PACKET_SIZE];
+static size_t count_out;
+static size_t out_ptr;
+
+static uint8_t buffer_in[REMOTE_PACKET_SIZE];
+static size_t count_in;
+
+/* Sized like the GDB port's, see ram_budget.h, so HF holds for either */
+static char packet[REMOTE_PACKET_BUFFER_SIZE];
+static size_t packet_len;
+static bool in_packet;
+
+void usb_remote_set_config(usbd_device *dev, uint16_t value)
+{
+	(void)value;
+	usbd_ep_setup(dev, REMOTE_ENDPOINT, USB_ENDPOINT_ATTR_BULK, REMOTE_PACKET_SIZE, NULL);
+	usbd_ep_setup(dev, REMOTE_ENDPOINT | USB_REQ_TYPE_IN, USB_ENDPOINT_ATTR_BULK, REMOTE_PACKET_SIZE, NULL);
+	count_out = 0;
+	out_ptr = 0;
+	count_in = 0;
+	in_packet = false;
+}
+
+static bool usb_remote_update_buf(void)
+{
+	if (usb_get_config() != 1)
+		return false;
+	count_out = usbd_ep_read_packet(usbdev, REMOTE_ENDPOINT, buffer_out, REMOTE_PACKET_SIZE);
+	out_ptr = 0;
+	return count_out != 0;
+}
+
+static void usb_remote_send(const size_t len)
+{
+	while (true) {
+		/* Drop the data if the host went away while we were waiting */
+		if (usb_get_config() != 1)
+			return;
+		nvic_disable_irq(USB_IRQ);
+		const uint16_t sent = usbd_ep_write_packet(usbdev, REMOTE_ENDPOINT | USB_REQ_TYPE_IN, buffer_in, len);
+		nvic_enable_irq(USB_IRQ);
+		if (sent)
+			return;
+	}
+}
+
+static void usb_remote_putchar(const unsigned char c, const int flush)
+{
+	buffer_in[count_in++] = c;
+	if (flush || count_in == REMOTE_PACKET_SIZE) {
+		const size_t len = count_in;
+		count_in = 0;
+		usb_remote_send(len);
+		/* A full packet doesn't end the transfer, follow it with a short one */
+		if (flush && len == REMOTE_PACKET_SIZE) {
+			buffer_in[0] = '\0';
+			usb_remote_send(1);
+		}
+	}
+}
+
+/* Binary payloads follow their request directly, so keep reading the same endpoint */
+static void usb_remote_getraw(void *const buf, const size_t len)
+{
+	uint8_t *const data = (uint8_t *)buf;
+	for (size_t offset = 0; offset < len;) {
+		if (out_ptr == count_out && !usb_remote_update_buf()) {
+			if (usb_get_config() != 1)
+				return;
+			continue;
+		}
+		const size_t count = MIN(count_out - out_ptr, len - offset);
+		memcpy(data + offset, buffer_out + out_ptr, count);
+		out_ptr += count;
+		offset += count;
+	}
+}
+
+void usb_remote_poll(void)
+{
+	while (out_ptr < count_out || usb_remote_update_buf()) {
+		const char c = buffer_out[out_ptr++];
+		if (c == REMOTE_SOM) {
+			/* A start always (re)starts the packet */
+			in_packet = true;
+			packet_len = 0;
+		} else if (!in_packet) {
+			continue;
+		} else if (c == REMOTE_EOM) {
+			in_packet = false;
+			packet[packet_len] = '\0';
+			remote_packet_process_via(usb_remote_putchar, usb_remote_getraw, packet_len, packet);
+		} else if (packet_len < sizeof(packet) - 1U) {
+			packet[packet_len++] = c;
+		} else {
+			/* Who knows what is going on... wait for the next start */
+			in_packet = false;
+		}
+	}
+}
+
+#endif
@@ -28,5 +28,7 @@ void usbuart_init(void);
 void usbuart_set_line_coding(struct usb_cdc_line_coding *coding);
 void usbuart_usb_out_cb(usbd_device *dev, uint8_t ep);
 void usbuart_usb_in_cb(usbd_device *dev, uint8_t ep);
+/* Send the UART data in timestamped frames, see usbuart.c */
+void usbuart_set_framed(bool framed);
 
 #endif
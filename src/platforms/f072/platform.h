@@ -127,6 +127,11 @@
 #define USBUSART_DMA_RXTX_IRQ NVIC_DMA1_CHANNEL4_7_DMA2_CHANNEL3_5_IRQ
 #define USBUSART_DMA_RXTX_ISR(x) dma1_channel4_7_dma2_channel3_5_isr(x)
 
+/* Memory to memory DMA feeding the CRC unit in generic_crc32() */
+#define CRC_DMA_BUS  DMA1
+#define CRC_DMA_CLK  RCC_DMA1
+#define CRC_DMA_CHAN DMA_CHANNEL1
+
 #define STK_CSR_CLKSOURCE_AHB_DIV8 STK_CSR_CLKSOURCE_AHB
 
 /* TX/RX on the REV 0/1 boards are swapped against ftdijtag.*/
@@ -122,6 +122,11 @@
 #define USBUSART_DMA_RX_IRQ NVIC_DMA1_CHANNEL6_IRQ
 #define USBUSART_DMA_RX_ISR(x) dma1_channel6_isr(x)
 
+/* Memory to memory DMA feeding the CRC unit in generic_crc32() */
+#define CRC_DMA_BUS  DMA1
+#define CRC_DMA_CLK  RCC_DMA1
+#define CRC_DMA_CHAN DMA_CHANNEL1
+
 /* TX/RX on the REV 0/1 boards are swapped against ftdijtag.*/
 #define UART_PIN_SETUP() do {											\
 		gpio_mode_setup(USBUSART_PORT, GPIO_MODE_AF, GPIO_PUPD_PULLUP,  \
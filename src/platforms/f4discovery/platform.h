@@ -33,6 +33,21 @@
 #define PLATFORM_HAS_TRACESWO
 #define PLATFORM_IDENT "(F4Discovery) "
 
+/* The F4 has plenty of RAM to spare, so use a larger GDB packet buffer */
+#define GDB_PACKET_BUFFER_SIZE 4096U
+/*
+ * The top 512 KiB of flash, which the firmware doesn't reach, store a target
+ * image for standalone programming, see image_store.c. The USER button
+ * programs it into the first target found.
+ */
+#define PLATFORM_HAS_IMAGE_STORE
+#define IMAGE_STORE_BASE         0x08080000U
+#define IMAGE_STORE_FIRST_SECTOR 8U
+#define IMAGE_STORE_SECTORS      4U
+#define IMAGE_STORE_SECTOR_SIZE  0x20000U
+#define IMAGE_BUTTON_PORT        GPIOA
+#define IMAGE_BUTTON_PIN         GPIO0
+
 /* Important pin mappings for STM32 implementation:
  *
  * LED0 = 	PD12	(Green  LED : Running)
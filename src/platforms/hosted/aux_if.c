@@ -0,0 +1,332 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements the auxiliary client server of hosted BMP. Tools
+ * that run alongside GDB, a variable viewer or a script, connect to the
+ * TCP port AUX_PORT_OFFSET above GDB's and share the probe with it. GDB
+ * keeps run control: auxiliary clients only read memory and run monitor
+ * commands. RTT streams already have their own ports with rtt mux.
+ *
+ * Requests are lines of text, each answered by a line starting with "OK"
+ * or "E", after any monitor output:
+ *   read ADDR LEN   "OK " and the hex of LEN bytes from ADDR
+ *   monitor CMD     as "monitor CMD" in GDB, its output, then "OK"
+ * They are served from the background task poll, between GDB packets and
+ * while GDB waits on a running target, a few at a time so GDB is never
+ * held up for long. A running target is only read when it allows memory
+ * access without halting.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "command.h"
+#include "exception.h"
+#include "gdb_main.h"
+#include "gdb_packet.h"
+#include "hex_utils.h"
+#include "aux_if.h"
+#include "sched_tasks.h"
+
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define AUX_CLIENTS           4U
+#define AUX_LINE_MAX          256U
+#define AUX_READ_MAX          1024U
+#define AUX_REQUESTS_PER_POLL 8U
+#define AUX_IDLE_MS           1000U
+
+typedef struct aux_client {
+	int conn; /* -1 when the slot is free */
+	size_t len;
+	char line[AUX_LINE_MAX];
+} aux_client_s;
+
+static int aux_serv = -1;
+static aux_client_s aux_clients[AUX_CLIENTS];
+/* The client whose monitor command is running, for its output */
+static aux_client_s *aux_current;
+
+void aux_if_init(const uint16_t port)
+{
+	for (size_t i = 0; i < AUX_CLIENTS; ++i)
+		aux_clients[i].conn = -1;
+	aux_serv = socket(PF_INET, SOCK_STREAM, 0);
+	if (aux_serv == -1)
+		return;
+	const int opt = 1;
+	setsockopt(aux_serv, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(aux_serv, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(aux_serv, AUX_CLIENTS) == -1) {
+		DEBUG_WARN("Can't serve auxiliary clients on port %u: %s\n", port, strerror(errno));
+		close(aux_serv);
+		aux_serv = -1;
+		return;
+	}
+	fcntl(aux_serv, F_SETFL, fcntl(aux_serv, F_GETFL, 0) | O_NONBLOCK);
+	DEBUG_WARN("Auxiliary clients on TCP: %4u\n", port);
+}
+
+void aux_if_exit(void)
+{
+	for (size_t i = 0; i < AUX_CLIENTS; ++i) {
+		if (aux_clients[i].conn != -1)
+			close(aux_clients[i].conn);
+		aux_clients[i].conn = -1;
+	}
+	if (aux_serv != -1)
+		close(aux_serv);
+	aux_serv = -1;
+}
+
+bool aux_if_listening(void)
+{
+	return aux_serv != -1;
+}
+
+int aux_if_fd_set(fd_set *const fds, int max)
+{
+	if (aux_serv == -1)
+		return max;
+	FD_SET(aux_serv, fds);
+	max = MAX(max, aux_serv);
+	for (size_t i = 0; i < AUX_CLIENTS; ++i) {
+		if (aux_clients[i].conn == -1)
+			continue;
+		FD_SET(aux_clients[i].conn, fds);
+		max = MAX(max, aux_clients[i].conn);
+	}
+	return max;
+}
+
+static bool aux_has_line(const aux_client_s *const client)
+{
+	return client->conn != -1 && memchr(client->line, '\n', client->len);
+}
+
+uint32_t aux_if_period(void)
+{
+	if (aux_serv == -1)
+		return AUX_IDLE_MS;
+	/* Requests left over from the last poll go first */
+	for (size_t i = 0; i < AUX_CLIENTS; ++i) {
+		if (aux_has_line(&aux_clients[i]))
+			return 0;
+	}
+	fd_set fds;
+	FD_ZERO(&fds);
+	const int max = aux_if_fd_set(&fds, -1);
+	struct timeval tv = {0};
+	return select(max + 1, &fds, NULL, NULL, &tv) > 0 ? 0 : AUX_IDLE_MS;
+}
+
+static void aux_drop(aux_client_s *const client)
+{
+	close(client->conn);
+	client->conn = -1;
+	client->len = 0;
+}
+
+static void aux_send(aux_client_s *const client, const char *const buf, const size_t len)
+{
+	/* Replies are short, the socket blocks rather than losing any of one */
+	for (size_t offset = 0; client->conn != -1 && offset < len;) {
+#ifdef MSG_NOSIGNAL
+		const ssize_t sent = send(client->conn, buf + offset, len - offset, MSG_NOSIGNAL);
+#else
+		const ssize_t sent = send(client->conn, buf + offset, len - offset, 0);
+#endif
+		if (sent < 0) {
+			if (errno != EINTR)
+				aux_drop(client);
+			continue;
+		}
+		offset += sent;
+	}
+}
+
+static void aux_reply(aux_client_s *const client, const char *const reply)
+{
+	aux_send(client, reply, strlen(reply));
+	aux_send(client, "\n", 1U);
+}
+
+static void aux_out(const char *const buf)
+{
+	aux_send(aux_current, buf, strlen(buf));
+}
+
+static void aux_read(aux_client_s *const client, target *const t, const bool running, const char *const args)
+{
+	char *end = NULL;
+	const uint32_t addr = strtoul(args, &end, 0);
+	const uint32_t len = strtoul(end, NULL, 0);
+	if (!t) {
+		aux_reply(client, "E no target");
+		return;
+	}
+	if (running && target_no_background_memory_access(t)) {
+		aux_reply(client, "E target running");
+		return;
+	}
+	if (!len || len > AUX_READ_MAX) {
+		aux_reply(client, "E bad length");
+		return;
+	}
+	uint8_t data[AUX_READ_MAX];
+	char reply[3U + AUX_READ_MAX * 2U + 1U] = "OK ";
+	if (target_mem_read(t, data, addr, len)) {
+		aux_reply(client, "E read failed");
+		return;
+	}
+	hexify(reply + 3U, data, len);
+	aux_reply(client, reply);
+}
+
+static void aux_monitor(aux_client_s *const client, target *const t, char *const cmd)
+{
+	aux_current = client;
+	gdb_out_redirect(aux_out);
+	volatile int result = -1;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = command_process(t, cmd);
+	}
+	gdb_out_redirect(NULL);
+	aux_current = NULL;
+	if (e.type) {
+		aux_reply(client, "E target lost");
+		/* Lost targets are cleaned up by whoever polled us, as for any other task */
+		raise_exception(e.type, e.msg);
+	}
+	aux_reply(client, result == 0 ? "OK" : result < 0 ? "E unknown command" : "E failed");
+}
+
+static void aux_request(aux_client_s *const client, char *const line)
+{
+	bool running = false;
+	target *const t = gdb_shared_target(&running);
+	if (!strncmp(line, "read ", 5U))
+		aux_read(client, t, running, line + 5U);
+	else if (!strncmp(line, "monitor ", 8U))
+		aux_monitor(client, t, line + 8U);
+	else if (line[0])
+		aux_reply(client, "E unknown request");
+}
+
+static void aux_accept(void)
+{
+	while (true) {
+		const int conn = accept(aux_serv, NULL, NULL);
+		if (conn == -1)
+			return;
+		aux_client_s *client = NULL;
+		for (size_t i = 0; i < AUX_CLIENTS && !client; ++i) {
+			if (aux_clients[i].conn == -1)
+				client = &aux_clients[i];
+		}
+		if (!client) {
+			const char busy[] = "E too many clients\n";
+			send(conn, busy, sizeof(busy) - 1U, 0);
+			close(conn);
+			continue;
+		}
+		client->conn = conn;
+		client->len = 0;
+		DEBUG_INFO("Auxiliary client connected\n");
+	}
+}
+
+static void aux_receive(aux_client_s *const client)
+{
+	if (client->len == AUX_LINE_MAX) {
+		/* A line too long to ever be a request */
+		aux_reply(client, "E line too long");
+		client->len = 0;
+	}
+	const ssize_t len = recv(client->conn, client->line + client->len, AUX_LINE_MAX - client->len, MSG_DONTWAIT);
+	if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		aux_drop(client);
+	else if (len > 0)
+		client->len += len;
+}
+
+void aux_if_poll(target *const t)
+{
+	(void)t;
+	if (aux_serv == -1)
+		return;
+	aux_accept();
+	size_t budget = AUX_REQUESTS_PER_POLL;
+	for (size_t i = 0; i < AUX_CLIENTS; ++i) {
+		aux_client_s *const client = &aux_clients[i];
+		if (client->conn == -1)
+			continue;
+		aux_receive(client);
+		while (budget && aux_has_line(client)) {
+			char *const newline = memchr(client->line, '\n', client->len);
+			const size_t line_len = newline - client->line + 1U;
+			char line[AUX_LINE_MAX];
+			memcpy(line, client->line, line_len - 1U);
+			line[line_len - 1U] = '\0';
+			if (line_len > 1U && line[line_len - 2U] == '\r')
+				line[line_len - 2U] = '\0';
+			client->len -= line_len;
+			memmove(client->line, newline + 1, client->len);
+			aux_request(client, line);
+			--budget;
+		}
+	}
+}
+
+#else
+
+/* No auxiliary clients on windows */
+
+void aux_if_init(const uint16_t port)
+{
+	(void)port;
+}
+
+void aux_if_exit(void)
+{
+}
+
+bool aux_if_listening(void)
+{
+	return false;
+}
+
+uint32_t aux_if_period(void)
+{
+	return SCHED_IDLE;
+}
+
+void aux_if_poll(target *const t)
+{
+	(void)t;
+}
+
+#endif
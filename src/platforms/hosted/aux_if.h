@@ -0,0 +1,42 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __AUX_IF_H
+#define __AUX_IF_H
+
+#include "general.h"
+#include "target.h"
+
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+#include <sys/select.h>
+#endif
+
+/* Auxiliary clients are served this far above the GDB server's port */
+#define AUX_PORT_OFFSET 100U
+
+void aux_if_init(uint16_t port);
+void aux_if_exit(void);
+bool aux_if_listening(void);
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+/* Adds the sockets to wait on to fds, returns the highest of them and max */
+int aux_if_fd_set(fd_set *fds, int max);
+#endif
+/* 0 when a request is waiting, otherwise the longest the poll loop may go without checking */
+uint32_t aux_if_period(void);
+void aux_if_poll(target *t);
+
+#endif /* __AUX_IF_H */
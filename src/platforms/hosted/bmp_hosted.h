@@ -41,6 +41,8 @@ typedef struct bmp_info_s {
 	uint8_t interface_num;
 	uint8_t in_ep;
 	uint8_t out_ep;
+	/* Optional CMSIS-DAP v2 SWO streaming endpoint */
+	uint8_t swo_ep;
 #endif
 } bmp_info_t;
 
@@ -49,6 +51,19 @@ void bmp_ident(bmp_info_t *info);
 int find_debuggers(BMP_CL_OPTIONS_t *cl_opts,bmp_info_t *info);
 void libusb_exit_function(bmp_info_t *info);
 
+#if HOSTED_BMP_ONLY != 1
+/* Remote protocol over the native probe's vendor interface instead of its tty */
+int bmp_remote_usb_open(bmp_info_t *info);
+bool bmp_remote_usb_active(void);
+void bmp_remote_usb_close(void);
+int bmp_remote_usb_write(const uint8_t *data, size_t size);
+int bmp_remote_usb_read(uint8_t *data, size_t size, uint32_t timeout_ms);
+/* SWO capture from the native probe's trace endpoint, decoded in traceswo_poll() */
+bool bmp_traceswo_init(const bmp_info_t *info, uint32_t baudrate, uint32_t swo_chan_bitmask);
+void bmp_traceswo_poll(void);
+void bmp_traceswo_stop(void);
+#endif
+
 #if defined(_WIN32) || defined(__CYGWIN__)
 #include <wchar.h>
 #define PRINT_INFO(fmt, ...) wprintf(L ## fmt, ##__VA_ARGS__)
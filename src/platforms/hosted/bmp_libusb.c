@@ -39,6 +39,8 @@ void bmp_ident(bmp_info_t *info)
 
 void libusb_exit_function(bmp_info_t *info)
 {
+	if (bmp_remote_usb_active())
+		bmp_remote_usb_close();
 	if (!info->usb_link)
 		return;
 	libusb_free_transfer(info->usb_link->req_trans);
@@ -50,7 +52,35 @@ void libusb_exit_function(bmp_info_t *info)
 	}
 }
 
-static bmp_type_t find_cmsis_dap_interface(libusb_device *dev,bmp_info_t *info) {
+/*
+ * Whether the device could be a supported probe, judged from what libusb
+ * knows without opening it: the VID/PID of a known probe or cable, or an
+ * interface a CMSIS-DAP could be behind, HID or vendor specific. Opening
+ * every device and fetching its strings is what makes a scan slow.
+ */
+static bool probe_candidate(libusb_device *dev, const struct libusb_device_descriptor *desc)
+{
+	if (desc->idVendor == VENDOR_ID_BMP || desc->idVendor == VENDOR_ID_STLINK || desc->idVendor == VENDOR_ID_SEGGER)
+		return true;
+	for (const cable_desc_t *cable = cable_desc; cable->name; ++cable) {
+		if (cable->vendor == desc->idVendor && cable->product == desc->idProduct)
+			return true;
+	}
+	struct libusb_config_descriptor *conf;
+	/* Without the configuration there is no telling, so look closer */
+	if (libusb_get_active_config_descriptor(dev, &conf) < 0)
+		return true;
+	bool candidate = false;
+	for (size_t i = 0; i < conf->bNumInterfaces && !candidate; ++i) {
+		const uint8_t interface_class = conf->interface[i].altsetting[0].bInterfaceClass;
+		candidate = interface_class == LIBUSB_CLASS_HID || interface_class == LIBUSB_CLASS_VENDOR_SPEC;
+	}
+	libusb_free_config_descriptor(conf);
+	return candidate;
+}
+
+static bmp_type_t find_cmsis_dap_interface(libusb_device *dev, libusb_device_handle *handle, bmp_info_t *info)
+{
 	bmp_type_t type = BMP_TYPE_NONE;
 
 	struct libusb_config_descriptor *conf;
@@ -63,15 +93,6 @@ static bmp_type_t find_cmsis_dap_interface(libusb_device *dev,bmp_info_t *info)
 		return type;
 	}
 
-	libusb_device_handle *handle;
-	res = libusb_open(dev, &handle);
-	if (res != LIBUSB_SUCCESS) {
-		DEBUG_INFO("INFO: libusb_open() failed: %s\n",
-					libusb_strerror(res));
-		libusb_free_config_descriptor(conf);
-		return type;
-	}
-
 	for (int i = 0; i < conf->bNumInterfaces; i++) {
 		const struct libusb_interface_descriptor *interface = &conf->interface[i].altsetting[0];
 
@@ -93,13 +114,17 @@ static bmp_type_t find_cmsis_dap_interface(libusb_device *dev,bmp_info_t *info)
 		}
 		type = BMP_TYPE_CMSIS_DAP;
 
-		if (interface->bInterfaceClass == 0xff && interface->bNumEndpoints == 2) {
+		/* A third endpoint, if any, is the bulk in SWO streaming one */
+		if (interface->bInterfaceClass == 0xff && interface->bNumEndpoints >= 2) {
 			info->interface_num = interface->bInterfaceNumber;
 
-			for (int j = 0; j < interface->bNumEndpoints; j++) {
+			for (int j = 0; j < interface->bNumEndpoints && j < 3; j++) {
 				uint8_t n = interface->endpoint[j].bEndpointAddress;
 
-				if (n & 0x80) {
+				if (j == 2) {
+					if (n & 0x80)
+						info->swo_ep = n;
+				} else if (n & 0x80) {
 					info->in_ep = n;
 				} else {
 					info->out_ep = n;
@@ -151,6 +176,13 @@ int find_debuggers(BMP_CL_OPTIONS_t *cl_opts, bmp_info_t *info)
 	bool access_problems = false;
 	char *active_cable = NULL;
 	bool ftdi_unknown = false;
+	/* The devices counted on the first pass, the only ones a listing pass needs to look at again */
+	bool *const counted = calloc(n_devs + 1U, sizeof(bool));
+	if (!counted) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		libusb_free_device_list(devs, 1);
+		return -1;
+	}
 rescan:
 	found_debuggers = 0;
 	serial[0] = 0;
@@ -162,11 +194,12 @@ rescan:
 	for (size_t i = 0; devs[i]; ++i) {
 		bmp_type_t type = BMP_TYPE_NONE;
 		libusb_device *dev = devs[i];
+		if (report && !counted[i])
+			continue;
 		int res = libusb_get_device_descriptor(dev, &desc);
 		if (res < 0) {
             DEBUG_WARN( "WARN: libusb_get_device_descriptor() failed: %s",
 					libusb_strerror(res));
-			libusb_free_device_list(devs, 1);
 			continue;
 		}
 		/* Exclude hubs from testing. Probably more classes could be excluded here!*/
@@ -175,6 +208,8 @@ rescan:
 		case LIBUSB_CLASS_WIRELESS:
 			continue;
 		}
+		if (!probe_candidate(dev, &desc))
+			continue;
 		libusb_device_handle *handle = NULL;
 		res = libusb_open(dev, &handle);
 		if (res != LIBUSB_SUCCESS) {
@@ -238,15 +273,20 @@ rescan:
 		}
 		else
 			product[0] = '\0';
-		libusb_close(handle);
 		if (cl_opts->opt_ident_string) {
 			char *match_manu = NULL;
 			char *match_product = NULL;
 			match_manu = strstr(manufacturer, cl_opts->opt_ident_string);
 			match_product = strstr(product, cl_opts->opt_ident_string);
-			if (!match_manu && !match_product)
+			if (!match_manu && !match_product) {
+				libusb_close(handle);
 				continue;
+			}
 		}
+		/* Interface strings are only looked at for what isn't a BMP, while the device is open anyway */
+		const bmp_type_t cmsis_type =
+			desc.idVendor == VENDOR_ID_BMP ? BMP_TYPE_NONE : find_cmsis_dap_interface(dev, handle, info);
+		libusb_close(handle);
 		/* Either serial and/or ident_string match or are not given.
 		 * Check type.*/
 		if (desc.idVendor == VENDOR_ID_BMP) {
@@ -257,9 +297,9 @@ rescan:
 					DEBUG_WARN("BMP in bootloader mode found. Restart or reflash!\n");
 				continue;
 			}
-		} else if (type == BMP_TYPE_NONE &&
-				   (type = find_cmsis_dap_interface(dev, info)) != BMP_TYPE_NONE) {
+		} else if (cmsis_type != BMP_TYPE_NONE) {
 			/* find_cmsis_dap_interface has set valid type*/
+			type = cmsis_type;
 		} else if (strstr(manufacturer, "CMSIS") || strstr(product, "CMSIS"))
 			type = BMP_TYPE_CMSIS_DAP;
 		else if (desc.idVendor ==  VENDOR_ID_STLINK) {
@@ -328,8 +368,10 @@ rescan:
 			cl_opts->opt_position == found_debuggers + 1) {
 			found_debuggers = 1;
 			break;
-		} else
+		} else {
+			counted[i] = true;
 			++found_debuggers;
+		}
 	}
 	if (found_debuggers == 0 && ftdi_unknown && !cl_opts->opt_cable)
 		DEBUG_WARN("Generic FTDI MPSSE VID/PID found. Please specify exact type with \"-c <cable>\" !\n");
@@ -355,6 +397,7 @@ rescan:
 	if (!found_debuggers && access_problems)
 		DEBUG_WARN(
 			"No debugger found. Please check access rights to USB devices!\n");
+	free(counted);
 	libusb_free_device_list(devs, 1);
 	return found_debuggers == 1 ? 0 : -1;
 }
@@ -379,39 +422,55 @@ static void LIBUSB_CALL on_trans_done(struct libusb_transfer *trans)
     ctx->flags |= TRANS_FLAGS_IS_DONE;
 }
 
-static int submit_wait(usb_link_t *link, struct libusb_transfer *trans) {
-	struct trans_ctx trans_ctx;
+static void submit(struct libusb_transfer *trans, struct trans_ctx *ctx)
+{
 	enum libusb_error error;
 
-	trans_ctx.flags = 0;
+	ctx->flags = 0;
 
 	/* brief intrusion inside the libusb interface */
 	trans->callback = on_trans_done;
-	trans->user_data = &trans_ctx;
+	trans->user_data = ctx;
 
 	if ((error = libusb_submit_transfer(trans))) {
 		DEBUG_WARN("libusb_submit_transfer(%d): %s\n", error,
 			  libusb_strerror(error));
 		exit(-1);
 	}
+}
 
+/* Cancel a submitted transfer, ctx has to stay valid until libusb is done with it */
+static void cancel_wait(usb_link_t *link, struct libusb_transfer *trans, struct trans_ctx *ctx)
+{
+	libusb_cancel_transfer(trans);
+	while (!(ctx->flags & TRANS_FLAGS_IS_DONE)) {
+		struct timeval timeout = {1, 0};
+		if (libusb_handle_events_timeout_completed(link->ul_libusb_ctx, &timeout, NULL))
+			break;
+	}
+}
+
+static int transfer_wait_timeout(usb_link_t *link, struct libusb_transfer *trans, struct trans_ctx *ctx,
+	const uint32_t timeout_ms)
+{
 	uint32_t start_time = platform_time_ms();
-	while (trans_ctx.flags == 0) {
+	while (!(ctx->flags & TRANS_FLAGS_IS_DONE)) {
 		struct timeval timeout;
 		timeout.tv_sec = 1;
 		timeout.tv_usec = 0;
-		if (libusb_handle_events_timeout(link->ul_libusb_ctx, &timeout)) {
+		if (libusb_handle_events_timeout_completed(link->ul_libusb_ctx, &timeout, NULL)) {
 			DEBUG_WARN("libusb_handle_events()\n");
+			cancel_wait(link, trans, ctx);
 			return -1;
 		}
 		uint32_t now = platform_time_ms();
-		if (now - start_time > 1000) {
-			libusb_cancel_transfer(trans);
+		if (!(ctx->flags & TRANS_FLAGS_IS_DONE) && now - start_time > timeout_ms) {
+			cancel_wait(link, trans, ctx);
 			DEBUG_WARN("libusb_handle_events() timeout\n");
 			return -1;
 		}
 	}
-	if (trans_ctx.flags & TRANS_FLAGS_HAS_ERROR) {
+	if (ctx->flags & TRANS_FLAGS_HAS_ERROR) {
 		DEBUG_WARN("libusb_handle_events() | has_error\n");
 		return -1;
 	}
@@ -419,30 +478,52 @@ static int submit_wait(usb_link_t *link, struct libusb_transfer *trans) {
 	return 0;
 }
 
-/* One USB transaction */
+static int transfer_wait(usb_link_t *link, struct libusb_transfer *trans, struct trans_ctx *ctx)
+{
+	return transfer_wait_timeout(link, trans, ctx, 1000);
+}
+
+/*
+ * One USB transaction. The response transfer is queued before the request
+ * goes out, so it is already waiting when the probe answers and both
+ * directions are in flight together.
+ */
 int send_recv(usb_link_t *link,
 					 uint8_t *txbuf, size_t txsize,
 					 uint8_t *rxbuf, size_t rxsize)
 {
+	struct trans_ctx req_ctx;
+	struct trans_ctx rep_ctx;
 	int res = 0;
+	if (rxsize != 0) {
+		libusb_fill_bulk_transfer(link->rep_trans, link->ul_libusb_device_handle,
+								  link->ep_rx | LIBUSB_ENDPOINT_IN,
+								  rxbuf, rxsize, NULL, NULL, 0);
+		submit(link->rep_trans, &rep_ctx);
+	}
 	if (txsize) {
 		libusb_fill_bulk_transfer(link->req_trans,
 								  link->ul_libusb_device_handle,
 								  link->ep_tx | LIBUSB_ENDPOINT_OUT,
 								  txbuf, txsize,
 								  NULL, NULL, 0);
-		size_t i = 0;
-		DEBUG_WIRE(" Send (%3zu): ", txsize);
-		for (; i < txsize; ++i) {
-			DEBUG_WIRE("%02x", txbuf[i]);
-			if ((i & 7U) == 7U)
-				DEBUG_WIRE(".");
-			if ((i & 31U) == 31U)
-				DEBUG_WIRE("\n             ");
+		if (cl_debuglevel & BMP_DEBUG_WIRE) {
+			size_t i = 0;
+			DEBUG_WIRE(" Send (%3zu): ", txsize);
+			for (; i < txsize; ++i) {
+				DEBUG_WIRE("%02x", txbuf[i]);
+				if ((i & 7U) == 7U)
+					DEBUG_WIRE(".");
+				if ((i & 31U) == 31U)
+					DEBUG_WIRE("\n             ");
+			}
+			if (!(i & 31U))
+				DEBUG_WIRE("\n");
 		}
-		if (!(i & 31U))
-			DEBUG_WIRE("\n");
-		if (submit_wait(link, link->req_trans)) {
+		submit(link->req_trans, &req_ctx);
+		if (transfer_wait(link, link->req_trans, &req_ctx)) {
+			if (rxsize != 0)
+				cancel_wait(link, link->rep_trans, &rep_ctx);
 			libusb_clear_halt(link->ul_libusb_device_handle, link->ep_tx);
 			return -1;
 		}
@@ -450,17 +531,13 @@ int send_recv(usb_link_t *link,
 	/* send_only */
 	if (rxsize != 0) {
 		/* read the response */
-		libusb_fill_bulk_transfer(link->rep_trans, link->ul_libusb_device_handle,
-								  link->ep_rx | LIBUSB_ENDPOINT_IN,
-								  rxbuf, rxsize, NULL, NULL, 0);
-
-		if (submit_wait(link, link->rep_trans)) {
+		if (transfer_wait(link, link->rep_trans, &rep_ctx)) {
 			DEBUG_WARN("clear 1\n");
 			libusb_clear_halt(link->ul_libusb_device_handle, link->ep_rx);
 			return -1;
 		}
 		res = link->rep_trans->actual_length;
-		if (res > 0) {
+		if (res > 0 && (cl_debuglevel & BMP_DEBUG_WIRE)) {
 			const size_t rxlen = (size_t)res;
 			DEBUG_WIRE(" Rec (%zu/%zu)", rxsize, rxlen);
 			for (size_t i = 0; i < rxlen && i < 32 ; ++i) {
@@ -473,3 +550,162 @@ int send_recv(usb_link_t *link,
 	DEBUG_WIRE("\n");
 	return res;
 }
+
+/*
+ * Native probes with new enough firmware carry the remote protocol on a vendor
+ * bulk interface as well as on the GDB tty. Talking to that directly skips
+ * the tty layer, and an IN transfer is always kept queued so the reply is
+ * picked up as soon as the probe sends it.
+ */
+#define BMP_REMOTE_IF_PROTOCOL 0x01U
+#define BMP_REMOTE_RX_SIZE     4096U
+
+static usb_link_t remote_link;
+static bool remote_link_open = false;
+static struct trans_ctx remote_rx_ctx;
+static bool remote_rx_pending = false;
+static uint8_t remote_rx_buf[BMP_REMOTE_RX_SIZE];
+
+static bool bmp_remote_usb_find_interface(libusb_device *dev, uint8_t *iface, uint8_t *ep_in, uint8_t *ep_out)
+{
+	struct libusb_config_descriptor *conf;
+	if (libusb_get_active_config_descriptor(dev, &conf) < 0)
+		return false;
+	bool found = false;
+	for (int i = 0; i < conf->bNumInterfaces && !found; ++i) {
+		const struct libusb_interface_descriptor *interface = &conf->interface[i].altsetting[0];
+		if (interface->bInterfaceClass != 0xff || interface->bInterfaceSubClass != 0xff ||
+			interface->bInterfaceProtocol != BMP_REMOTE_IF_PROTOCOL || interface->bNumEndpoints != 2)
+			continue;
+		*iface = interface->bInterfaceNumber;
+		for (int j = 0; j < 2; ++j) {
+			const uint8_t n = interface->endpoint[j].bEndpointAddress;
+			if (n & LIBUSB_ENDPOINT_IN)
+				*ep_in = n & 0x7fU;
+			else
+				*ep_out = n;
+		}
+		found = true;
+	}
+	libusb_free_config_descriptor(conf);
+	return found;
+}
+
+int bmp_remote_usb_open(bmp_info_t *info)
+{
+	if (!info->libusb_ctx || info->vid != VENDOR_ID_BMP || info->pid != PRODUCT_ID_BMP)
+		return -1;
+	libusb_device **devs;
+	const ssize_t n_devs = libusb_get_device_list(info->libusb_ctx, &devs);
+	if (n_devs < 0)
+		return -1;
+	libusb_device_handle *handle = NULL;
+	uint8_t iface = 0;
+	for (ssize_t i = 0; i < n_devs && !handle; ++i) {
+		struct libusb_device_descriptor desc;
+		if (libusb_get_device_descriptor(devs[i], &desc) < 0 ||
+			desc.idVendor != info->vid || desc.idProduct != info->pid)
+			continue;
+		if (!bmp_remote_usb_find_interface(devs[i], &iface, &remote_link.ep_rx, &remote_link.ep_tx))
+			continue;
+		if (libusb_open(devs[i], &handle) != LIBUSB_SUCCESS) {
+			handle = NULL;
+			continue;
+		}
+		/* Find the probe find_debuggers() picked by its serial number */
+		char serial[64] = {0};
+		if (desc.iSerialNumber &&
+			libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, (uint8_t *)serial, sizeof(serial)) < 0)
+			serial[0] = '\0';
+		if (strcmp(serial, info->serial)) {
+			libusb_close(handle);
+			handle = NULL;
+		}
+	}
+	libusb_free_device_list(devs, 1);
+	if (!handle)
+		return -1;
+
+	const int res = libusb_claim_interface(handle, iface);
+	if (res) {
+		DEBUG_WARN("WARN: Can not claim remote interface %d: %s, falling back to the serial port\n", iface,
+			libusb_strerror(res));
+		libusb_close(handle);
+		return -1;
+	}
+	remote_link.ul_libusb_ctx = info->libusb_ctx;
+	remote_link.ul_libusb_device_handle = handle;
+	remote_link.priv = (void *)(uintptr_t)iface;
+	remote_link.req_trans = libusb_alloc_transfer(0);
+	remote_link.rep_trans = libusb_alloc_transfer(0);
+	if (!remote_link.req_trans || !remote_link.rep_trans) {
+		DEBUG_WARN("libusb_alloc_transfer() failed\n");
+		bmp_remote_usb_close();
+		return -1;
+	}
+	remote_link_open = true;
+	remote_rx_pending = false;
+	DEBUG_INFO("Using the remote protocol interface\n");
+	return 0;
+}
+
+bool bmp_remote_usb_active(void)
+{
+	return remote_link_open;
+}
+
+void bmp_remote_usb_close(void)
+{
+	if (remote_rx_pending)
+		cancel_wait(&remote_link, remote_link.rep_trans, &remote_rx_ctx);
+	remote_rx_pending = false;
+	remote_link_open = false;
+	libusb_free_transfer(remote_link.req_trans);
+	libusb_free_transfer(remote_link.rep_trans);
+	remote_link.req_trans = NULL;
+	remote_link.rep_trans = NULL;
+	if (remote_link.ul_libusb_device_handle) {
+		libusb_release_interface(remote_link.ul_libusb_device_handle, (int)(uintptr_t)remote_link.priv);
+		libusb_close(remote_link.ul_libusb_device_handle);
+		remote_link.ul_libusb_device_handle = NULL;
+	}
+}
+
+static void bmp_remote_usb_submit_rx(void)
+{
+	if (remote_rx_pending)
+		return;
+	libusb_fill_bulk_transfer(remote_link.rep_trans, remote_link.ul_libusb_device_handle,
+		remote_link.ep_rx | LIBUSB_ENDPOINT_IN, remote_rx_buf, sizeof(remote_rx_buf), NULL, NULL, 0);
+	submit(remote_link.rep_trans, &remote_rx_ctx);
+	remote_rx_pending = true;
+}
+
+int bmp_remote_usb_write(const uint8_t *const data, const size_t size)
+{
+	/* Have the reply transfer waiting before the request goes out */
+	bmp_remote_usb_submit_rx();
+	struct trans_ctx req_ctx;
+	libusb_fill_bulk_transfer(remote_link.req_trans, remote_link.ul_libusb_device_handle,
+		remote_link.ep_tx | LIBUSB_ENDPOINT_OUT, (uint8_t *)data, size, NULL, NULL, 0);
+	submit(remote_link.req_trans, &req_ctx);
+	if (transfer_wait(&remote_link, remote_link.req_trans, &req_ctx)) {
+		libusb_clear_halt(remote_link.ul_libusb_device_handle, remote_link.ep_tx);
+		return -1;
+	}
+	return size;
+}
+
+int bmp_remote_usb_read(uint8_t *const data, const size_t size, const uint32_t timeout_ms)
+{
+	bmp_remote_usb_submit_rx();
+	/* The transfer now belongs to us either way, a fresh one is queued on the next call */
+	remote_rx_pending = false;
+	if (transfer_wait_timeout(&remote_link, remote_link.rep_trans, &remote_rx_ctx, timeout_ms)) {
+		libusb_clear_halt(remote_link.ul_libusb_device_handle, remote_link.ep_rx);
+		return -1;
+	}
+	const size_t count = MIN((size_t)remote_link.rep_trans->actual_length, size);
+	memcpy(data, remote_rx_buf, count);
+	return count;
+}
@@ -27,6 +27,7 @@
 #include "bmp_remote.h"
 #include "cli.h"
 #include "hex_utils.h"
+#include "cortexm.h"
 
 #include <assert.h>
 #include <sys/time.h>
@@ -35,6 +36,9 @@
 
 #include "adiv5.h"
 
+/* Largest frame both ends handle, from HF once remote_adiv5_dp_defaults() has asked for it */
+static size_t remote_frame_size = REMOTE_FRAME_SIZE_MIN;
+
 int remote_init(void)
 {
 	char construct[REMOTE_MAX_MSG_SIZE];
@@ -142,6 +146,19 @@ void remote_max_frequency_set(uint32_t freq)
     }
 }
 
+void remote_wait_policy_set(void)
+{
+	uint8_t construct[REMOTE_MAX_MSG_SIZE];
+	int s = snprintf((char *)construct, REMOTE_MAX_MSG_SIZE, REMOTE_WAIT_POLICY_STR, adiv5_wait_policy.idle_cycles,
+		adiv5_wait_policy.backoff_max, adiv5_wait_policy.adaptive ? '1' : '0', adiv5_wait_policy.timeout_ms);
+	platform_buffer_write(construct, s);
+
+	s = platform_buffer_read(construct, REMOTE_MAX_MSG_SIZE);
+
+	if (s < 1 || construct[0] == REMOTE_RESP_ERR)
+		DEBUG_WARN("Update Firmware to allow to set the SWD WAIT policy\n");
+}
+
 uint32_t remote_max_frequency_get(void)
 {
 	uint8_t construct[REMOTE_MAX_MSG_SIZE];
@@ -191,6 +208,21 @@ void remote_target_clk_output_enable(const bool enable)
 		DEBUG_WARN("remote_target_clk_output_enable failed, error %s\n", length ? buffer + 1 : "unknown");
 }
 
+bool remote_traceswo_init(uint32_t *const baudrate)
+{
+	char buffer[REMOTE_MAX_MSG_SIZE];
+	int length = snprintf(buffer, REMOTE_MAX_MSG_SIZE, REMOTE_TRACESWO_STR, *baudrate);
+	platform_buffer_write((uint8_t *)buffer, length);
+
+	length = platform_buffer_read((uint8_t *)buffer, REMOTE_MAX_MSG_SIZE);
+	if (length < 1 || buffer[0] != REMOTE_RESP_OK) {
+		DEBUG_WARN("remote_traceswo_init failed, error %s\n", length ? buffer + 1 : "unknown");
+		return false;
+	}
+	*baudrate = remotehston(8, buffer + 1);
+	return true;
+}
+
 static uint32_t remote_adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr)
 {
 	(void)dp;
@@ -303,7 +335,7 @@ static void remote_ap_mem_read(
 	if (len == 0)
 		return;
 	char construct[REMOTE_MAX_MSG_SIZE];
-	int batchsize = (REMOTE_MAX_MSG_SIZE - 0x20) / 2;
+	int batchsize = (remote_frame_size - 0x20) / 2;
 	while (len) {
 		int s;
 		int count = len;
@@ -341,9 +373,11 @@ static void remote_ap_mem_write_sized(
 	(void)ap;
 	if (len == 0)
 		return;
+	/* The batches stay double word aligned */
+	align = adiv5_ap_align(ap, dest, len, align);
 	char construct[REMOTE_MAX_MSG_SIZE];
 	/* (5 * 1 (char)) + (2 * 2 (bytes)) + (3 * 8 (words)) */
-	int batchsize = (REMOTE_MAX_MSG_SIZE - 0x30) / 2;
+	int batchsize = (remote_frame_size - 0x30) / 2;
 	while (len) {
 		int count = len;
 		if (count > batchsize)
@@ -375,15 +409,226 @@ static void remote_ap_mem_write_sized(
 	}
 }
 
-void remote_adiv5_dp_defaults(ADIv5_DP_t *dp)
+/*
+ * Binary transfers keep up to REMOTE_MAX_IN_FLIGHT requests outstanding so
+ * the probe can process them back to back instead of waiting a USB round trip
+ * for each one. Responses come back in request order on the one stream, so
+ * each request's sequence number is simply its position in the queue. After
+ * an error the remaining responses are still drained to stay in step.
+ */
+#define REMOTE_MAX_IN_FLIGHT 4U
+
+static void remote_ap_mem_read_bin(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	uint8_t *const data = (uint8_t *)dest;
+	size_t requested = 0;
+	size_t received = 0;
+	size_t in_flight = 0;
+	bool failed = false;
+	while (in_flight || (!failed && received < len)) {
+		for (; !failed && in_flight < REMOTE_MAX_IN_FLIGHT && requested < len; ++in_flight) {
+			const size_t count = MIN(len - requested, REMOTE_BIN_MAX_LEN(remote_frame_size));
+			const int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_AP_MEM_READ_BIN_STR, ap->dp->dp_jd_index,
+				ap->apsel, ap->csw, src + (uint32_t)requested, (uint32_t)count);
+			platform_buffer_write((uint8_t *)construct, s);
+			requested += count;
+		}
+		/* The payload goes straight into the caller's buffer */
+		const size_t count = MIN(len - received, REMOTE_BIN_MAX_LEN(remote_frame_size));
+		const int s = platform_buffer_read_bin(data + received, count);
+		if (s != (int)count && !failed) {
+			failed = true;
+			ap->dp->fault = 1;
+			DEBUG_WARN("%s error %d at apsel %d, addr: 0x%08" PRIx32 "\n", __func__, s, ap->apsel,
+				src + (uint32_t)received);
+		}
+		received += count;
+		--in_flight;
+		/* A timeout means the stream is out of step, there's nothing left to drain */
+		if (s < -1)
+			return;
+	}
+}
+
+static void remote_ap_mem_write_bin(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align)
+{
+	char construct[REMOTE_MAX_MSG_SIZE + REMOTE_BIN_MAX_LEN(REMOTE_MAX_MSG_SIZE) + 1U];
+	const uint8_t *const data = (const uint8_t *)src;
+	align = adiv5_ap_align(ap, dest, len, align);
+	size_t sent = 0;
+	size_t acked = 0;
+	size_t in_flight = 0;
+	bool failed = false;
+	while (acked < sent || sent < len) {
+		for (; !failed && in_flight < REMOTE_MAX_IN_FLIGHT && sent < len; ++in_flight) {
+			const size_t count = MIN(len - sent, REMOTE_BIN_MAX_LEN(remote_frame_size));
+			const int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_AP_MEM_WRITE_BIN_STR, ap->dp->dp_jd_index,
+				ap->apsel, ap->csw, align, dest + (uint32_t)sent, (uint32_t)count);
+			/* Send the header and the raw payload behind it in one go */
+			memcpy(construct + s, data + sent, count);
+			construct[s + count] = 0;
+			platform_buffer_write((uint8_t *)construct, s + count);
+			sent += count;
+		}
+		if (!in_flight)
+			break;
+
+		const int s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+		if ((s < 1 || construct[0] != REMOTE_RESP_OK) && !failed) {
+			failed = true;
+			ap->dp->fault = 1;
+			DEBUG_WARN("%s error %d at apsel %d, addr: 0x%08" PRIx32 "\n", __func__, s, ap->apsel,
+				dest + (uint32_t)acked);
+		}
+		acked += MIN(len - acked, REMOTE_BIN_MAX_LEN(remote_frame_size));
+		--in_flight;
+		if (s < 0)
+			return;
+	}
+}
+
+static uint32_t remote_ap_mem_wait32(
+	ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t busy_value, uint32_t timeout_ms)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_AP_MEM_WAIT_STR, ap->dp->dp_jd_index, ap->apsel, ap->csw,
+		addr, mask, busy_value, timeout_ms);
+	platform_buffer_write((uint8_t *)construct, s);
+	s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+	if (s < 1 || construct[0] != REMOTE_RESP_OK) {
+		ap->dp->fault = 1;
+		DEBUG_WARN("%s error %d at apsel %d, addr: 0x%08" PRIx32 "\n", __func__, s, ap->apsel, addr);
+		return busy_value;
+	}
+	uint32_t value;
+	unhexify(&value, construct + 1, 4);
+	return value;
+}
+
+static int remote_ap_mem_crc32(ADIv5_AP_t *ap, uint32_t *crc, uint32_t addr, size_t len)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_AP_MEM_CRC32_STR, ap->dp->dp_jd_index, ap->apsel,
+		ap->csw, addr, (uint32_t)len);
+	platform_buffer_write((uint8_t *)construct, s);
+	/* The probe reads the whole range before it answers, allow for 16kiB/s */
+	const unsigned saved_timeout = cortexm_wait_timeout;
+	cortexm_wait_timeout = MAX(saved_timeout, len / 16U);
+	s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+	cortexm_wait_timeout = saved_timeout;
+	if (s < 1 || construct[0] != REMOTE_RESP_OK) {
+		DEBUG_WARN("%s error %d at apsel %d, addr: 0x%08" PRIx32 "\n", __func__, s, ap->apsel, addr);
+		return -1;
+	}
+	*crc = remotehston(8, construct + 1);
+	return 0;
+}
+
+/* Encode one HQ step, returns the number of characters written */
+static int remote_seq_encode(char *const buf, const size_t size, const adiv5_seq_op_t *const op)
+{
+	switch (op->type) {
+	case ADIV5_SEQ_DP_READ:
+		return snprintf(buf, size, "%c%04" PRIx32, REMOTE_SEQ_DP_READ, op->addr);
+	case ADIV5_SEQ_DP_WRITE:
+		return snprintf(buf, size, "%c%04" PRIx32 "%08" PRIx32, REMOTE_SEQ_DP_WRITE, op->addr, op->value);
+	case ADIV5_SEQ_AP_READ:
+		return snprintf(buf, size, "%c%04" PRIx32, REMOTE_SEQ_AP_READ, op->addr);
+	case ADIV5_SEQ_AP_WRITE:
+		return snprintf(buf, size, "%c%04" PRIx32 "%08" PRIx32, REMOTE_SEQ_AP_WRITE, op->addr, op->value);
+	case ADIV5_SEQ_MEM_READ:
+		return snprintf(buf, size, "%c%08" PRIx32, REMOTE_SEQ_MEM_READ, op->addr);
+	case ADIV5_SEQ_MEM_WRITE:
+		return snprintf(buf, size, "%c%08" PRIx32 "%08" PRIx32, REMOTE_SEQ_MEM_WRITE, op->addr, op->value);
+	case ADIV5_SEQ_MEM_WAIT:
+		return snprintf(buf, size, "%c%08" PRIx32 "%08" PRIx32 "%08" PRIx32 "%08" PRIx32, REMOTE_SEQ_MEM_WAIT,
+			op->addr, op->mask, op->busy_value, op->timeout_ms);
+	case ADIV5_SEQ_DELAY:
+		return snprintf(buf, size, "%c%08" PRIx32, REMOTE_SEQ_DELAY, op->addr);
+	}
+	return 0;
+}
+
+/* Runs as many steps per HQ as fit, so a whole sequence mostly takes a single round trip */
+static bool remote_ap_sequence(ADIv5_AP_t *ap, adiv5_seq_op_t *ops, size_t count)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	while (count) {
+		int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_AP_SEQUENCE_STR, ap->dp->dp_jd_index, ap->apsel,
+			ap->csw);
+		const int header = s;
+		size_t steps = 0;
+		/* The probe answers once all steps have run, so allow for their waits */
+		uint32_t wait_ms = 0;
+		for (; steps < count && steps < REMOTE_SEQ_MAX_OPS; ++steps) {
+			char step[40];
+			const int len = remote_seq_encode(step, sizeof(step), &ops[steps]);
+			if ((size_t)(s - header + len) > REMOTE_SEQ_MAX_LEN)
+				break;
+			memcpy(construct + s, step, len);
+			s += len;
+			if (ops[steps].type == ADIV5_SEQ_MEM_WAIT)
+				wait_ms += ops[steps].timeout_ms;
+			else if (ops[steps].type == ADIV5_SEQ_DELAY)
+				wait_ms += ops[steps].addr;
+		}
+		construct[s++] = REMOTE_EOM;
+		construct[s] = 0;
+		platform_buffer_write((uint8_t *)construct, s);
+
+		const unsigned saved_timeout = cortexm_wait_timeout;
+		cortexm_wait_timeout = saved_timeout + wait_ms;
+		s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+		cortexm_wait_timeout = saved_timeout;
+		if (s < 1 + (int)steps * 8 || construct[0] != REMOTE_RESP_OK) {
+			ap->dp->fault = 1;
+			DEBUG_WARN("%s error %d at apsel %d\n", __func__, s, ap->apsel);
+			return false;
+		}
+		uint32_t results[REMOTE_SEQ_MAX_OPS];
+		unhexify(results, construct + 1, steps * sizeof(results[0]));
+		for (size_t i = 0; i < steps; ++i)
+			ops[i].value = results[i];
+		ops += steps;
+		count -= steps;
+	}
+	return true;
+}
+
+uint32_t remote_hl_version(void)
 {
 	uint8_t construct[REMOTE_MAX_MSG_SIZE];
 	int s = snprintf((char *)construct, REMOTE_MAX_MSG_SIZE, "%s",
 		REMOTE_HL_CHECK_STR);
 	platform_buffer_write(construct, s);
 	s = platform_buffer_read(construct, REMOTE_MAX_MSG_SIZE);
-	if (s < 1 || construct[0] == REMOTE_RESP_ERR ||
-		construct[1] - '0' < REMOTE_HL_VERSION) {
+	return s < 1 || construct[0] == REMOTE_RESP_ERR ? 0 : remotehston(8, (const char *)construct + 1);
+}
+
+/* Older probes don't know HF, they take REMOTE_FRAME_SIZE_MIN */
+static size_t remote_frame_size_get(void)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, "%s", REMOTE_HL_FRAME_SIZE_STR);
+	platform_buffer_write((uint8_t *)construct, s);
+	s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+	if (s < 1 || construct[0] != REMOTE_RESP_OK)
+		return REMOTE_FRAME_SIZE_MIN;
+	const size_t frame_size = remotehston(8, construct + 1);
+	return MIN(MAX(frame_size, REMOTE_FRAME_SIZE_MIN), (size_t)REMOTE_MAX_MSG_SIZE);
+}
+
+void remote_batch_flush(void)
+{
+	remote_jtagtap_flush();
+	remote_swdptap_flush();
+}
+
+void remote_adiv5_dp_defaults(ADIv5_DP_t *dp)
+{
+	const uint32_t version = remote_hl_version();
+	if (version < 2) {
 		DEBUG_WARN("Please update BMP firmware for substantial speed increase!\n");
 		return;
 	}
@@ -391,8 +636,23 @@ void remote_adiv5_dp_defaults(ADIv5_DP_t *dp)
 	dp->dp_read    = remote_adiv5_dp_read;
 	dp->ap_write   = remote_adiv5_ap_write;
 	dp->ap_read    = remote_adiv5_ap_read;
-	dp->mem_read   = remote_ap_mem_read;
-	dp->mem_write_sized = remote_ap_mem_write_sized;
+	remote_frame_size = version >= 9 ? remote_frame_size_get() : REMOTE_FRAME_SIZE_MIN;
+	DEBUG_PROBE("Remote frame size %zu\n", remote_frame_size);
+	if (version >= 3) {
+		/* Binary payloads, no hex encoding on the wire */
+		dp->mem_read   = remote_ap_mem_read_bin;
+		dp->mem_write_sized = remote_ap_mem_write_bin;
+	} else {
+		dp->mem_read   = remote_ap_mem_read;
+		dp->mem_write_sized = remote_ap_mem_write_sized;
+	}
+	if (version >= 5)
+		dp->mem_crc32 = remote_ap_mem_crc32;
+	/* Status register and halt polls run on the probe, HP took its busy value in version 6 */
+	if (version >= 6)
+		dp->mem_wait32 = remote_ap_mem_wait32;
+	if (version >= 7)
+		dp->sequence = remote_ap_sequence;
 }
 
 void remote_add_jtag_dev(uint32_t i, const jtag_dev_t *jtag_dev)
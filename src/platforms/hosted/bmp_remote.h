@@ -24,14 +24,23 @@
 #include "target.h"
 #include "target_internal.h"
 
-#define REMOTE_MAX_MSG_SIZE (1024)
+/* Largest frame the host handles, what a probe reports beyond this goes unused */
+#define REMOTE_MAX_MSG_SIZE (16384)
 
 int platform_buffer_write(const uint8_t *data, int size);
 int platform_buffer_read(uint8_t *data, int size);
+/* Reads a binary response of exactly size payload bytes, returns size or a negative error */
+int platform_buffer_read_bin(uint8_t *data, int size);
 
 int remote_init(void);
 int remote_swdptap_init(ADIv5_DP_t *dp);
 int remote_jtagtap_init(jtag_proc_t *jtag_proc);
+/* HL protocol version the probe speaks, 0 if it doesn't know HL at all */
+uint32_t remote_hl_version(void);
+/* Sends the SWD and JTAG sequences still queued up, before anything else goes to the probe */
+void remote_batch_flush(void);
+void remote_swdptap_flush(void);
+void remote_jtagtap_flush(void);
 bool remote_target_get_power(void);
 const char *remote_target_voltage(void);
 bool remote_target_set_power(bool power);
@@ -39,7 +48,10 @@ void remote_nrst_set_val(bool assert);
 bool remote_nrst_get_val(void);
 void remote_max_frequency_set(uint32_t freq);
 uint32_t remote_max_frequency_get(void);
+void remote_wait_policy_set(void);
 void remote_target_clk_output_enable(bool enable);
+/* Starts the probe's SWO capture, false if it can't. baudrate gets what it set up, 0 for Manchester */
+bool remote_traceswo_init(uint32_t *baudrate);
 
 void remote_adiv5_dp_defaults(ADIv5_DP_t *dp);
 void remote_add_jtag_dev(uint32_t i, const jtag_dev_t *jtag_dev);
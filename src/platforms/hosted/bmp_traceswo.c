@@ -0,0 +1,273 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements SWO capture from a native BMP while hosted. The
+ * probe is told over the remote protocol to capture undecoded, and what it
+ * sends on its trace endpoint is read here, so scripts/swolisten isn't
+ * needed alongside. A thread of its own, with a libusb context of its own
+ * so it never contends with the remote protocol, keeps several bulk
+ * transfers queued on the endpoint and moves what they bring into a ring.
+ * The main loop decodes from the ring in traceswo_poll(). What the ring
+ * has no room for is counted as dropped by the capture.
+ */
+
+#if defined(_WIN32) || defined(__CYGWIN__)
+#include <windows.h>
+#endif
+
+#include "general.h"
+#include <stdatomic.h>
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+#include <pthread.h>
+#endif
+
+#include "bmp_hosted.h"
+#include "bmp_remote.h"
+#include "traceswo.h"
+#include "swo_if.h"
+
+#define SWO_TRANSFER_COUNT 8U
+#define SWO_TRANSFER_SIZE  64U
+#define SWO_RING_SIZE      (64U * 1024U)
+/* How long the thread waits on libusb before checking whether to stop */
+#define SWO_EVENT_TIMEOUT_US 100000
+
+static libusb_context *swo_ctx;
+static libusb_device_handle *swo_handle;
+static uint8_t swo_iface;
+static uint8_t swo_ep;
+static struct libusb_transfer *swo_transfers[SWO_TRANSFER_COUNT];
+static uint8_t swo_buffers[SWO_TRANSFER_COUNT][SWO_TRANSFER_SIZE];
+/* Only touched by the thread, which runs the completions */
+static size_t swo_in_flight;
+static atomic_bool swo_running;
+#if defined(_WIN32) || defined(__CYGWIN__)
+static HANDLE swo_thread;
+#else
+static pthread_t swo_thread;
+#endif
+static bool swo_thread_started;
+
+/* Filled by the thread, drained by the main loop */
+static uint8_t swo_ring[SWO_RING_SIZE];
+static atomic_size_t swo_head;
+static atomic_size_t swo_tail;
+
+static void swo_ring_put(const uint8_t *const data, const size_t len)
+{
+	const size_t head = atomic_load_explicit(&swo_head, memory_order_relaxed);
+	const size_t space = SWO_RING_SIZE - (head - atomic_load_explicit(&swo_tail, memory_order_acquire));
+	const size_t count = MIN(len, space);
+	for (size_t i = 0; i < count; ++i)
+		swo_ring[(head + i) % SWO_RING_SIZE] = data[i];
+	atomic_store_explicit(&swo_head, head + count, memory_order_release);
+	if (count < len)
+		swo_if_capture_dropped(len - count);
+}
+
+static void LIBUSB_CALL swo_transfer_complete(struct libusb_transfer *const transfer)
+{
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+		if (transfer->actual_length > 0)
+			swo_ring_put(transfer->buffer, transfer->actual_length);
+		if (atomic_load(&swo_running) && libusb_submit_transfer(transfer) == 0)
+			return;
+	} else if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT && atomic_load(&swo_running) &&
+		libusb_submit_transfer(transfer) == 0)
+		return;
+	--swo_in_flight;
+}
+
+#if defined(_WIN32) || defined(__CYGWIN__)
+static DWORD WINAPI swo_receive(LPVOID arg)
+#else
+static void *swo_receive(void *arg)
+#endif
+{
+	(void)arg;
+	while (swo_in_flight) {
+		struct timeval timeout = {0, SWO_EVENT_TIMEOUT_US};
+		libusb_handle_events_timeout_completed(swo_ctx, &timeout, NULL);
+		if (!atomic_load(&swo_running)) {
+			for (size_t i = 0; i < SWO_TRANSFER_COUNT; ++i)
+				libusb_cancel_transfer(swo_transfers[i]);
+		}
+	}
+#if defined(_WIN32) || defined(__CYGWIN__)
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+/* The vendor specific interface with a single bulk in endpoint is the trace one */
+static bool swo_find_interface(libusb_device *const dev)
+{
+	struct libusb_config_descriptor *conf;
+	if (libusb_get_active_config_descriptor(dev, &conf) < 0)
+		return false;
+	bool found = false;
+	for (size_t i = 0; i < conf->bNumInterfaces && !found; ++i) {
+		const struct libusb_interface_descriptor *const interface = &conf->interface[i].altsetting[0];
+		if (interface->bInterfaceClass != 0xff || interface->bInterfaceSubClass != 0xff ||
+			interface->bInterfaceProtocol != 0xff || interface->bNumEndpoints != 1 ||
+			!(interface->endpoint[0].bEndpointAddress & LIBUSB_ENDPOINT_IN))
+			continue;
+		swo_iface = interface->bInterfaceNumber;
+		swo_ep = interface->endpoint[0].bEndpointAddress;
+		found = true;
+	}
+	libusb_free_config_descriptor(conf);
+	return found;
+}
+
+/* Open the probe find_debuggers() picked, by its serial number */
+static bool swo_open(const bmp_info_t *const info)
+{
+	libusb_device **devs;
+	const ssize_t n_devs = libusb_get_device_list(swo_ctx, &devs);
+	if (n_devs < 0)
+		return false;
+	for (ssize_t i = 0; i < n_devs && !swo_handle; ++i) {
+		struct libusb_device_descriptor desc;
+		if (libusb_get_device_descriptor(devs[i], &desc) < 0 || desc.idVendor != info->vid ||
+			desc.idProduct != info->pid || !swo_find_interface(devs[i]) ||
+			libusb_open(devs[i], &swo_handle) != LIBUSB_SUCCESS)
+			continue;
+		char serial[64] = {0};
+		if (desc.iSerialNumber &&
+			libusb_get_string_descriptor_ascii(swo_handle, desc.iSerialNumber, (uint8_t *)serial, sizeof(serial)) < 0)
+			serial[0] = '\0';
+		if (strcmp(serial, info->serial)) {
+			libusb_close(swo_handle);
+			swo_handle = NULL;
+		}
+	}
+	libusb_free_device_list(devs, 1);
+	if (!swo_handle)
+		return false;
+	const int res = libusb_claim_interface(swo_handle, swo_iface);
+	if (res) {
+		DEBUG_WARN("Can not claim the trace interface %u: %s\n", swo_iface, libusb_strerror(res));
+		libusb_close(swo_handle);
+		swo_handle = NULL;
+		return false;
+	}
+	return true;
+}
+
+static bool swo_start_thread(void)
+{
+	atomic_store(&swo_running, true);
+	for (size_t i = 0; i < SWO_TRANSFER_COUNT; ++i) {
+		swo_transfers[i] = libusb_alloc_transfer(0);
+		if (!swo_transfers[i])
+			return false;
+		libusb_fill_bulk_transfer(
+			swo_transfers[i], swo_handle, swo_ep, swo_buffers[i], SWO_TRANSFER_SIZE, swo_transfer_complete, NULL, 0);
+		if (libusb_submit_transfer(swo_transfers[i]))
+			return false;
+		++swo_in_flight;
+	}
+#if defined(_WIN32) || defined(__CYGWIN__)
+	swo_thread = CreateThread(NULL, 0, swo_receive, NULL, 0, NULL);
+	swo_thread_started = swo_thread != NULL;
+#else
+	swo_thread_started = !pthread_create(&swo_thread, NULL, swo_receive, NULL);
+#endif
+	return swo_thread_started;
+}
+
+void bmp_traceswo_stop(void)
+{
+	atomic_store(&swo_running, false);
+	if (swo_thread_started) {
+#if defined(_WIN32) || defined(__CYGWIN__)
+		WaitForSingleObject(swo_thread, INFINITE);
+		CloseHandle(swo_thread);
+#else
+		pthread_join(swo_thread, NULL);
+#endif
+		swo_thread_started = false;
+	} else {
+		/* Never got going, so nothing runs the completions but here */
+		for (size_t i = 0; i < SWO_TRANSFER_COUNT; ++i) {
+			if (swo_transfers[i])
+				libusb_cancel_transfer(swo_transfers[i]);
+		}
+		while (swo_in_flight)
+			libusb_handle_events(swo_ctx);
+	}
+	for (size_t i = 0; i < SWO_TRANSFER_COUNT; ++i) {
+		libusb_free_transfer(swo_transfers[i]);
+		swo_transfers[i] = NULL;
+	}
+	if (swo_handle) {
+		libusb_release_interface(swo_handle, swo_iface);
+		libusb_close(swo_handle);
+		swo_handle = NULL;
+	}
+	if (swo_ctx)
+		libusb_exit(swo_ctx);
+	swo_ctx = NULL;
+}
+
+bool bmp_traceswo_init(const bmp_info_t *const info, const uint32_t baudrate, const uint32_t swo_chan_bitmask)
+{
+	bmp_traceswo_stop();
+	if (!info->vid) {
+		DEBUG_WARN("SWO capture needs the probe found over USB, not given with --device\n");
+		return false;
+	}
+	if (libusb_init(&swo_ctx) != LIBUSB_SUCCESS) {
+		swo_ctx = NULL;
+		return false;
+	}
+	if (!swo_open(info)) {
+		DEBUG_WARN("Probe has no trace endpoint\n");
+		bmp_traceswo_stop();
+		return false;
+	}
+	atomic_store(&swo_head, 0);
+	atomic_store(&swo_tail, 0);
+	traceswo_setmask(swo_chan_bitmask);
+	/* Reading before the probe starts capturing loses nothing */
+	uint32_t actual_baudrate = baudrate;
+	if (!swo_start_thread() || !remote_traceswo_init(&actual_baudrate)) {
+		DEBUG_WARN("SWO capture start failed\n");
+		bmp_traceswo_stop();
+		return false;
+	}
+	if (actual_baudrate)
+		DEBUG_INFO("SWO NRZ capture at %" PRIu32 " baud via the trace endpoint\n", actual_baudrate);
+	else
+		DEBUG_INFO("SWO Manchester capture via the trace endpoint\n");
+	return true;
+}
+
+void bmp_traceswo_poll(void)
+{
+	const size_t tail = atomic_load_explicit(&swo_tail, memory_order_relaxed);
+	const size_t head = atomic_load_explicit(&swo_head, memory_order_acquire);
+	if (head == tail)
+		return;
+	/* Up to the end of the ring now, the rest on the next poll */
+	const size_t start = tail % SWO_RING_SIZE;
+	const size_t len = MIN(head - tail, SWO_RING_SIZE - start);
+	traceswo_decode(swo_ring + start, len);
+	atomic_store_explicit(&swo_tail, tail + len, memory_order_release);
+}
@@ -29,13 +29,18 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <getopt.h>
+#include <strings.h>
 #include "version.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "crc32.h"
 #include "command.h"
+#include "hex_utils.h"
+#include "profile.h"
 
 #include "cli.h"
 #include "bmp_hosted.h"
+#include "svf.h"
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -44,6 +49,7 @@
 # include <windows.h>
 #else
 # include <sys/mman.h>
+# include <sys/wait.h>
 #endif
 
 static void cl_target_printf(struct target_controller *tc,
@@ -71,6 +77,221 @@ struct mmap_data {
 int cl_debuglevel;
 static struct mmap_data map; /* Portable way way to nullify the struct!*/
 
+/*
+ * What is to be programmed or verified, as address ranges with their data.
+ * A raw binary is one segment at the start address, ELF and Intel HEX images
+ * give one for each loaded range so gaps between them are never touched.
+ */
+struct image_segment {
+	uint32_t addr;
+	const uint8_t *data;
+	size_t size;
+};
+
+static struct image_segment *segments;
+static size_t segment_count;
+static uint8_t *ihex_data; /* Backing store for decoded Intel HEX records */
+
+static uint32_t image_read32le(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8U) | (p[2] << 16U) | ((uint32_t)p[3] << 24U);
+}
+
+static uint16_t image_read16le(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8U);
+}
+
+static int image_add_segment(const uint32_t addr, const uint8_t *const data, const size_t size)
+{
+	if (!size)
+		return 0;
+	/* Records that carry on where the last stopped just grow its segment */
+	if (segment_count) {
+		struct image_segment *const last = &segments[segment_count - 1U];
+		if (last->addr + last->size == addr && last->data + last->size == data) {
+			last->size += size;
+			return 0;
+		}
+	}
+	struct image_segment *const new_segments = realloc(segments, (segment_count + 1U) * sizeof(*segments));
+	if (!new_segments) {
+		DEBUG_WARN("realloc: failed in %s\n", __func__);
+		return -1;
+	}
+	segments = new_segments;
+	segments[segment_count].addr = addr;
+	segments[segment_count].data = data;
+	segments[segment_count].size = size;
+	++segment_count;
+	return 0;
+}
+
+static bool image_is_elf(const struct mmap_data *map)
+{
+	const uint8_t *const data = map->data;
+	return map->size >= 52U && data[0] == 0x7fU && data[1] == 'E' && data[2] == 'L' && data[3] == 'F';
+}
+
+/* Loadable segments of a 32-bit little endian ELF, placed at their load (physical) address */
+static int image_elf_segments(const struct mmap_data *map)
+{
+	const uint8_t *const data = map->data;
+	if (data[4] != 1U || data[5] != 1U) {
+		DEBUG_WARN("Only 32-bit little endian ELF files are supported\n");
+		return -1;
+	}
+	const uint32_t phoff = image_read32le(data + 28U);
+	const uint16_t phentsize = image_read16le(data + 42U);
+	const uint16_t phnum = image_read16le(data + 44U);
+	if (phentsize < 32U || phoff > map->size || (size_t)phnum * phentsize > map->size - phoff) {
+		DEBUG_WARN("ELF program headers are truncated\n");
+		return -1;
+	}
+	for (size_t i = 0; i < phnum; ++i) {
+		const uint8_t *const phdr = data + phoff + (i * phentsize);
+		/* Only PT_LOAD has anything to program, .bss and the like have no file data */
+		if (image_read32le(phdr) != 1U)
+			continue;
+		const uint32_t offset = image_read32le(phdr + 4U);
+		const uint32_t paddr = image_read32le(phdr + 12U);
+		const uint32_t filesz = image_read32le(phdr + 16U);
+		if (offset > map->size || filesz > map->size - offset) {
+			DEBUG_WARN("ELF segment %zu lies outside the file\n", i);
+			return -1;
+		}
+		if (image_add_segment(paddr, data + offset, filesz))
+			return -1;
+	}
+	return 0;
+}
+
+static bool image_is_ihex(const char *const name)
+{
+	const char *const ext = strrchr(name, '.');
+	return ext && (!strcasecmp(ext, ".hex") || !strcasecmp(ext, ".ihex") || !strcasecmp(ext, ".ihx"));
+}
+
+static int ihex_byte(const char *const hex)
+{
+	if (!isxdigit((unsigned char)hex[0]) || !isxdigit((unsigned char)hex[1]))
+		return -1;
+	uint8_t value;
+	unhexify(&value, hex, 1);
+	return value;
+}
+
+/* Decode the data records, only the bytes the file actually defines are kept */
+static int image_ihex_segments(const struct mmap_data *map)
+{
+	const char *const text = map->data;
+	const size_t len = map->size;
+	/* Every data byte takes at least two characters in the file */
+	ihex_data = malloc((len / 2U) + 1U);
+	if (!ihex_data) {
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return -1;
+	}
+	size_t used = 0;
+	uint32_t base = 0;
+	size_t line = 0;
+	for (size_t pos = 0; pos < len;) {
+		const char *const start = memchr(text + pos, ':', len - pos);
+		if (!start)
+			break;
+		pos = (start - text) + 1U;
+		++line;
+		uint8_t record[4U + 255U + 1U];
+		const int count = pos + 2U <= len ? ihex_byte(text + pos) : -1;
+		const size_t record_len = 4U + (size_t)count + 1U;
+		if (count < 0 || pos + (record_len * 2U) > len) {
+			DEBUG_WARN("Intel HEX record %zu is truncated\n", line);
+			return -1;
+		}
+		uint8_t checksum = 0;
+		for (size_t i = 0; i < record_len; ++i) {
+			const int value = ihex_byte(text + pos + (i * 2U));
+			if (value < 0) {
+				DEBUG_WARN("Intel HEX record %zu is not valid hex\n", line);
+				return -1;
+			}
+			record[i] = value;
+			checksum += value;
+		}
+		pos += record_len * 2U;
+		if (checksum) {
+			DEBUG_WARN("Intel HEX record %zu has a bad checksum\n", line);
+			return -1;
+		}
+		const uint16_t offset = (record[1] << 8U) | record[2];
+		switch (record[3]) {
+		case 0x00: /* Data */
+			memcpy(ihex_data + used, record + 4U, count);
+			if (image_add_segment(base + offset, ihex_data + used, count))
+				return -1;
+			used += count;
+			break;
+		case 0x01: /* End of file */
+			return 0;
+		case 0x02: /* Extended segment address */
+			base = ((record[4] << 8U) | record[5]) << 4U;
+			break;
+		case 0x04: /* Extended linear address */
+			base = ((uint32_t)record[4] << 24U) | (record[5] << 16U);
+			break;
+		default: /* Start addresses mean nothing to Flash */
+			break;
+		}
+	}
+	return 0;
+}
+
+static int image_segment_compare(const void *a, const void *b)
+{
+	const struct image_segment *const seg_a = a;
+	const struct image_segment *const seg_b = b;
+	return seg_a->addr < seg_b->addr ? -1 : seg_a->addr > seg_b->addr;
+}
+
+static int image_segments(BMP_CL_OPTIONS_t *opt)
+{
+	int res;
+	if (image_is_elf(&map))
+		res = image_elf_segments(&map);
+	else if (image_is_ihex(opt->opt_flash_file))
+		res = image_ihex_segments(&map);
+	else {
+		/* restrict to size given on command line */
+		return image_add_segment(opt->opt_flash_start, map.data, MIN(map.size, opt->opt_flash_size));
+	}
+	if (res)
+		return res;
+	if (!segment_count) {
+		DEBUG_WARN("%s has nothing to program\n", opt->opt_flash_file);
+		return -1;
+	}
+	/* Ascending order lets neighbouring segments share Flash write buffers */
+	qsort(segments, segment_count, sizeof(*segments), image_segment_compare);
+	return 0;
+}
+
+static size_t image_size(void)
+{
+	size_t size = 0;
+	for (size_t i = 0; i < segment_count; ++i)
+		size += segments[i].size;
+	return size;
+}
+
+static void image_free(void)
+{
+	free(segments);
+	segments = NULL;
+	segment_count = 0;
+	free(ihex_data);
+	ihex_data = NULL;
+}
+
 
 static int bmp_mmap(char *file, struct mmap_data *map)
 {
@@ -133,9 +354,10 @@ static void cl_help(char **argv)
 	bmp_ident(NULL);
 	PRINT_INFO(
 		"\n"
-		"Usage: %s [-h | -l | [-vBITMASK] [-d PATH | -P NUMBER | -s SERIAL | -c TYPE]\n"
-		"\t[-n NUMBER] [-j | -A] [-C] [-t | -T] [-e] [-p] [-R[h]] [-H] [-M STRING ...]\n"
-		"\t[-f | -m] [-E | -w | -V | -r] [-a ADDR] [-S number] [file]]\n"
+		"Usage: %s [-h | -l | [-vBITMASK] [-d PATH | -P NUMBER | -s SERIAL | -G SERIALS | -c TYPE]\n"
+		"\t[-n NUMBER] [-j | -A] [-C] [-t | -T | -B[OPTIONS]] [-e] [-p] [-R[h]] [-H] [-M STRING ...]\n"
+		"\t[-x FILE | -X FILE | -y[OPTIONS]] [-f | -m] [-E | -w | -V | -r | -b FILE | -J FILE] [-a ADDR] [-S number]\n"
+		"\t[file]]\n"
 		"\n"
 		"The default is to start a debug server at localhost:2000\n\n"
 		"Single-shot and verbosity options [-h | -l | -vBITMASK]:\n"
@@ -144,16 +366,18 @@ static void cl_help(char **argv)
 		"\t-v, --verbose    Set the output verbosity level based on some combination of:\n"
 		"\t                   1 = INFO, 2 = GDB, 4 = TARGET, 8 = PROBE, 16 = WIRE\n"
 		"\n"
-		"Probe selection arguments [-d PATH | -P NUMBER | -s SERIAL | -c TYPE]:\n"
+		"Probe selection arguments [-d PATH | -P NUMBER | -s SERIAL | -G SERIALS | -c TYPE]:\n"
 		"\t-d, --device     Use a serial device at the given path\n"
 		"\t-P, --probe      Use the <number>th debug probe found while scanning the\n"
 		"\t                   system, see the output from list for the order\n"
 		"\t-s, --serial     Select the debug probe with the given serial number\n"
+		"\t-G, --gang       Run the Flash operation on each probe in a comma separated\n"
+		"\t                   list of serial numbers, all probes working in parallel\n"
 		"\t-c, --ftdi-type  Select the FTDI-based debug probe with of the given\n"
 		"\t                   type (cable)\n"
 		"\n"
 		"General configuration options: [-n NUMBER] [-j] [-C] [-t | -T] [-e] [-p] [-R[h]]\n"
-		"\t\t[-H] [-M STRING ...]\n"
+		"\t\t[-H] [-M STRING ...] [-x FILE | -X FILE | -y[OPTIONS]] [-g NUMBER]\n"
 		"\t-n, --number     Select the target device at the given position in the\n"
 		"\t                   scan chain (use the -t option to get a scan chain listing)\n"
 		"\t-j, --jtag       Use JTAG instead of SWD\n"
@@ -163,6 +387,11 @@ static void cl_help(char **argv)
 		"\t                   conected devices\n"
 		"\t-T, --timing     Perform continues read- or write-back of a value to allow\n"
 		"\t                   measurement of protocol timing. Aborted by ^C\n"
+		"\t-B, --bench      Measure link and target throughput: DP read latency, memory\n"
+		"\t                   read and write bandwidth in RAM and register read latency.\n"
+		"\t                   A comma separated list can add 'flash' to also time erase\n"
+		"\t                   and program of the last sector of each Flash (its contents\n"
+		"\t                   are restored), and 'json' for machine readable output\n"
 		"\t-e, --ext-res    Assume external resistors for FTDI devices, that is having the\n"
 		"\t                   FTDI chip connected through resistors to TMS, TDI and TDO\n"
 		"\t-p, --power      Power the target from the probe (if possible)\n"
@@ -173,25 +402,52 @@ static void cl_help(char **argv)
 		"\t                   can be repeated for as many commands you wish to run.\n"
 		"\t                   If the command contains spaces, use quotes around the\n"
 		"\t                   complete command\n"
+		"\t-x, --record     Record the accesses made through the debug port and their\n"
+		"\t                   results to a binary wire trace file\n"
+		"\t-X, --replay     Instead of using a probe, replay a recorded wire trace.\n"
+		"\t                   Give the same options as for the recording\n"
+		"\t-y, --sim        Instead of using a probe, debug a simulated STM32 over a\n"
+		"\t                   simulated SWD link. A comma separated list can select\n"
+		"\t                   the part, 'f1' (the default) or 'f4', and give each SWD\n"
+		"\t                   transfer a latency with 'latency=MICROSECONDS'\n"
+		"\t-z, --rtt        Where RTT goes when built with ENABLE_RTT=1: 'stdout' (the\n"
+		"\t                   default) for the terminal, a TCP PORT or a unix socket\n"
+		"\t                   PATH. Channel n is then served on PORT + n or PATH.n, a\n"
+		"\t                   client gets up channel n and its input goes to down channel n\n"
+		"\t-g, --gdb-ports  Serve this many GDB sessions, up to 8, on consecutive ports\n"
+		"\t                   from 2000 on, each attaching to a core of its own, so the\n"
+		"\t                   cores of a part or of a multi-drop bus are debugged at once\n"
 		"\n"
 		"SWD-specific configuration options [-f FREQUENCY | -m TARGET]:\n"
 		"\t-f, --freq       Set an operating frequency for SWD\n"
 		"\t-m, --mult-drop  Use the given target ID for selection in SWD multi-drop\n"
 		"\n"
-		"Flash operation selection options [-E | -w | -V | -r]:\n"
+		"Flash operation selection options [-E | -w | -V | -r | -b FILE | -J FILE]:\n"
 		"\t-E, --erase      Erase the target device Flash\n"
 		"\t-w, --write      Write the specified binary file to the target device\n"
 		"\t                   Flash (the default)\n"
 		"\t-V, --verify     Verify the target device Flash against the specified\n"
-		"\t                   binary file\n"
+		"\t                   binary file. With --verify=crc (-Vcrc) a mismatch is\n"
+		"\t                   narrowed down by sector CRCs and only the sectors that\n"
+		"\t                   differ are read back\n"
 		"\t-r, --read       Read the target device Flash\n"
+		"\t-b, --script     Run the operations listed in a script file ('-' for stdin)\n"
+		"\t                   one per line, all on one connection to the target:\n"
+		"\t                   erase [ADDR SIZE], flash FILE [ADDR], verify FILE [ADDR],\n"
+		"\t                   read FILE [ADDR SIZE], monitor COMMAND, write32 ADDR VALUE,\n"
+		"\t                   read32 ADDR, reset, delay MS and profile MS FILE\n"
+		"\t-J, --svf        Play an SVF file, or XSVF if it ends in .xsvf, to the JTAG\n"
+		"\t                   chain to program CPLDs and FPGAs. Only the scans whose TDO\n"
+		"\t                   doesn't match are reported, no target is scanned\n"
 		"\n"
 		"Flash operation modifiers options: [-a ADDR] [-S number] [FILE]\n"
 		"\t-a, --addr       Start address for the given Flash operation (defaults to\n"
 		"\t                   the start of Flash)\n"
 		"\t-S, --byte-count Number of bytes to work on in the Flash operation (default\n"
 		"\t                   is till the operation fails or is complete)\n"
-		"\t<file>           Binary file to use in Flash operations\n",
+		"\t<file>           Binary file to use in Flash operations. ELF and Intel HEX\n"
+		"\t                   (.hex) images are programmed and verified segment by\n"
+		"\t                   segment at their own addresses, ignoring -a and -S\n",
 		argv[0]
 	);
 	exit(0);
@@ -204,6 +460,7 @@ static const struct option long_options[] = {
 	{"device", required_argument, NULL, 'd'},
 	{"probe", required_argument, NULL, 'P'},
 	{"serial", required_argument, NULL, 's'},
+	{"gang", required_argument, NULL, 'G'},
 	{"ftdi-type", required_argument, NULL, 'c'},
 	{"number", required_argument, NULL, 'n'},
 	{"jtag", no_argument, NULL, 'j'},
@@ -211,16 +468,24 @@ static const struct option long_options[] = {
 	{"hw-reset", no_argument, NULL, 'C'},
 	{"list-chain", no_argument, NULL, 't'},
 	{"timing", no_argument, NULL, 'T'},
+	{"bench", optional_argument, NULL, 'B'},
 	{"ext-res", no_argument, NULL, 'e'},
 	{"power", no_argument, NULL, 'p'},
 	{"reset", optional_argument, NULL, 'R'},
 	{"high-level", no_argument, NULL, 'H'},
 	{"monitor", required_argument, NULL, 'M'},
+	{"record", required_argument, NULL, 'x'},
+	{"replay", required_argument, NULL, 'X'},
+	{"sim", optional_argument, NULL, 'y'},
+	{"rtt", required_argument, NULL, 'z'},
+	{"gdb-ports", required_argument, NULL, 'g'},
+	{"script", required_argument, NULL, 'b'},
+	{"svf", required_argument, NULL, 'J'},
 	{"freq", required_argument, NULL, 'f'},
 	{"multi-drop", required_argument, NULL, 'm'},
 	{"erase", no_argument, NULL, 'E'},
 	{"write", no_argument, NULL, 'W'},
-	{"verify", no_argument, NULL, 'V'},
+	{"verify", optional_argument, NULL, 'V'},
 	{"read", no_argument, NULL, 'r'},
 	{"addr", required_argument, NULL, 'a'},
 	{"byte-count", required_argument, NULL, 'S'},
@@ -236,7 +501,7 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 	opt->opt_max_swj_frequency = 4000000;
 	opt->opt_scanmode = BMP_SCAN_SWD;
 	opt->opt_mode = BMP_MODE_DEBUG;
-	while((c = getopt_long(argc, argv, "eEhHv:d:f:s:I:c:Cln:m:M:wVtTa:S:jApP:rR::", long_options, NULL)) != -1) {
+	while((c = getopt_long(argc, argv, "eEhHv:d:f:s:G:I:c:Cln:m:M:wV::tTB::a:S:jApP:rR::x:X:y::z:g:b:J:", long_options, NULL)) != -1) {
 		switch(c) {
 		case 'c':
 			if (optarg)
@@ -292,6 +557,10 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 			if (optarg)
 				opt->opt_serial = optarg;
 			break;
+		case 'G':
+			if (optarg)
+				opt->opt_gang = optarg;
+			break;
 		case 'I':
 			if (optarg)
 				opt->opt_ident_string = optarg;
@@ -306,6 +575,17 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 		case 'T':
 			opt->opt_mode = BMP_MODE_SWJ_TEST;
 			break;
+		case 'B':
+			opt->opt_mode = BMP_MODE_BENCH;
+			for (char *item = optarg ? strtok(optarg, ",") : NULL; item; item = strtok(NULL, ",")) {
+				if (!strcmp(item, "flash"))
+					opt->opt_bench_flash = true;
+				else if (!strcmp(item, "json"))
+					opt->opt_bench_json = true;
+				else
+					DEBUG_WARN("Ignoring unknown bench option \"%s\"\n", item);
+			}
+			break;
 		case 'w':
 			if (opt->opt_mode == BMP_MODE_FLASH_VERIFY)
 				opt->opt_mode = BMP_MODE_FLASH_WRITE_VERIFY;
@@ -313,6 +593,10 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 				opt->opt_mode = BMP_MODE_FLASH_WRITE;
 			break;
 		case 'V':
+			if (optarg && !strcmp(optarg, "crc"))
+				opt->opt_verify_crc = true;
+			else if (optarg && strcmp(optarg, "read"))
+				DEBUG_WARN("Unknown verify strategy \"%s\", reading back\n", optarg);
 			if (opt->opt_mode == BMP_MODE_FLASH_WRITE)
 				opt->opt_mode = BMP_MODE_FLASH_WRITE_VERIFY;
 			else
@@ -346,6 +630,43 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 			if (optarg)
 				opt->opt_monitor = optarg;
 			break;
+		case 'x':
+			if (optarg)
+				opt->opt_record_file = optarg;
+			break;
+		case 'X':
+			if (optarg)
+				opt->opt_replay_file = optarg;
+			break;
+		case 'y':
+			opt->opt_sim = true;
+			for (char *item = optarg ? strtok(optarg, ",") : NULL; item; item = strtok(NULL, ",")) {
+				if (!strncmp(item, "latency=", 8))
+					opt->opt_sim_latency_us = strtoul(item + 8, NULL, 0);
+				else
+					opt->opt_sim_model = item;
+			}
+			break;
+		case 'z':
+			if (optarg)
+				opt->opt_rtt = optarg;
+			break;
+		case 'g':
+			if (optarg)
+				opt->opt_gdb_ports = atoi(optarg);
+			break;
+		case 'b':
+			if (optarg) {
+				opt->opt_mode = BMP_MODE_SCRIPT;
+				opt->opt_script = optarg;
+			}
+			break;
+		case 'J':
+			if (optarg) {
+				opt->opt_mode = BMP_MODE_SVF;
+				opt->opt_svf_file = optarg;
+			}
+			break;
 		case 'P':
 			if (optarg)
 				opt->opt_position = atoi(optarg);
@@ -381,13 +702,591 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 	/* Checks */
 	if ((opt->opt_flash_file) && ((opt->opt_mode == BMP_MODE_TEST ) ||
 								  (opt->opt_mode == BMP_MODE_SWJ_TEST) ||
+								  (opt->opt_mode == BMP_MODE_BENCH) ||
+								  (opt->opt_mode == BMP_MODE_SCRIPT) ||
+								  (opt->opt_mode == BMP_MODE_SVF) ||
 								  (opt->opt_mode == BMP_MODE_RESET) ||
 								  (opt->opt_mode == BMP_MODE_RESET_HW))) {
-		DEBUG_WARN("Ignoring filename in reset/test mode\n");
+		DEBUG_WARN("Ignoring filename in reset/test/script mode\n");
 		opt->opt_flash_file = NULL;
 	}
 }
 
+/*
+ * Find what differs in a range whose CRC didn't match by checksumming it a
+ * Flash sector at a time. Only sectors that mismatch are read back, to say
+ * where. Returns the number of sectors that differ.
+ */
+static size_t cl_verify_crc_sectors(target *t, uint32_t addr, const uint8_t *image, size_t size,
+	uint8_t *data, const size_t data_size)
+{
+	size_t bad_sectors = 0;
+	while (size) {
+		const struct target_flash *const f = target_flash_for_addr(t, addr);
+		const uint32_t sector_size = f ? f->blocksize : data_size;
+		const size_t len = MIN(size, sector_size - (addr % sector_size));
+		uint32_t crc;
+		if (target_mem_crc32(t, &crc, addr, len) || crc != crc32_buf(0xffffffffU, image, len)) {
+			++bad_sectors;
+			size_t differ = 0;
+			uint32_t first = 0;
+			uint8_t got = 0;
+			for (size_t offset = 0; offset < len;) {
+				const size_t chunk = MIN(len - offset, data_size);
+				if (target_mem_read(t, data, addr + offset, chunk)) {
+					DEBUG_WARN("Read failed at flash address 0x%08" PRIx32 "\n", (uint32_t)(addr + offset));
+					break;
+				}
+				for (size_t i = 0; i < chunk; ++i) {
+					if (data[i] == image[offset + i])
+						continue;
+					if (!differ++) {
+						first = addr + offset + i;
+						got = data[i];
+					}
+				}
+				offset += chunk;
+			}
+			DEBUG_WARN("Verify failed in sector 0x%08" PRIx32 ": %zu bytes differ, first at 0x%08" PRIx32
+				" (read 0x%02x, expected 0x%02x)\n", addr, differ, first, got,
+				differ ? image[first - addr] : 0);
+		}
+		addr += len;
+		image += len;
+		size -= len;
+	}
+	return bad_sectors;
+}
+
+/*
+ * Benchmark results are printed as they come, either as text or as the
+ * members of one flat JSON object for tracking across probes and firmware.
+ */
+#define BENCH_MIN_MS 250U
+
+static bool bench_json;
+static bool bench_first;
+
+static void bench_result(const char *const key, const char *const description, const double value,
+	const char *const unit)
+{
+	if (bench_json) {
+		printf("%s\n  \"%s\": %.3f", bench_first ? "" : ",", key, value);
+		bench_first = false;
+	} else
+		DEBUG_WARN("%-36s %12.3f %s\n", description, value, unit);
+}
+
+/* Front-runs a memory test with one call so setup costs don't count, returns kiB/s */
+static double bench_mem(target *t, const uint32_t addr, uint8_t *const buf, const size_t len, const bool write)
+{
+	if (write ? target_mem_write(t, addr, buf, len) : target_mem_read(t, buf, addr, len))
+		return 0;
+	size_t bytes = 0;
+	const uint32_t start = platform_time_ms();
+	uint32_t elapsed;
+	do {
+		if (write ? target_mem_write(t, addr, buf, len) : target_mem_read(t, buf, addr, len))
+			return 0;
+		bytes += len;
+		elapsed = platform_time_ms() - start;
+	} while (elapsed < BENCH_MIN_MS);
+	return (bytes * 1.0) / elapsed;
+}
+
+static void bench_link(target *t)
+{
+	/* The DP is only reachable through the AP of a Cortex-M */
+	if (!target_is_cortexm(t))
+		return;
+	ADIv5_DP_t *const dp = cortexm_ap(t)->dp;
+	size_t count = 0;
+	const uint32_t start = platform_time_ms();
+	uint32_t elapsed;
+	do {
+		adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
+		++count;
+		elapsed = platform_time_ms() - start;
+	} while (elapsed < BENCH_MIN_MS);
+	bench_result("dp_read_us", "DP read latency", (elapsed * 1000.0) / count, "us");
+	bench_result("dp_reads_per_s", "DP transaction rate", (count * 1000.0) / elapsed, "/s");
+}
+
+static void bench_ram(target *t)
+{
+	static const size_t sizes[] = {4, 64, 1024, 16384};
+	static const uint32_t offsets[] = {0, 1};
+	const size_t max_len = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1U] + 4U;
+	struct target_ram *ram = t->ram;
+	while (ram && ram->length < max_len)
+		ram = ram->next;
+	if (!ram) {
+		DEBUG_WARN("No RAM of at least %zu bytes, skipping memory bandwidth\n", max_len);
+		return;
+	}
+	uint8_t *const backup = malloc(max_len);
+	uint8_t *const buf = malloc(max_len);
+	if (!backup || !buf) {
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		free(backup);
+		free(buf);
+		return;
+	}
+	/* The write tests clobber this RAM, put it back afterwards */
+	if (target_mem_read(t, backup, ram->start, max_len) == 0) {
+		for (size_t i = 0; i < max_len; ++i)
+			buf[i] = i;
+		char key[48];
+		char description[48];
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+			for (size_t j = 0; j < sizeof(offsets) / sizeof(offsets[0]); ++j) {
+				const uint32_t addr = ram->start + offsets[j];
+				snprintf(key, sizeof(key), "mem_read_%zu_off%" PRIu32 "_kibps", sizes[i], offsets[j]);
+				snprintf(description, sizeof(description), "Memory read %zu bytes at +%" PRIu32, sizes[i], offsets[j]);
+				bench_result(key, description, bench_mem(t, addr, buf, sizes[i], false), "kiB/s");
+				snprintf(key, sizeof(key), "mem_write_%zu_off%" PRIu32 "_kibps", sizes[i], offsets[j]);
+				snprintf(description, sizeof(description), "Memory write %zu bytes at +%" PRIu32, sizes[i], offsets[j]);
+				bench_result(key, description, bench_mem(t, addr, buf, sizes[i], true), "kiB/s");
+			}
+		}
+		target_mem_write(t, ram->start, backup, max_len);
+	}
+	free(backup);
+	free(buf);
+}
+
+static void bench_regs(target *t)
+{
+	const size_t regs_size = target_regs_size(t);
+	if (!regs_size)
+		return;
+	uint8_t *const regs = malloc(regs_size);
+	if (!regs)
+		return;
+	size_t count = 0;
+	const uint32_t start = platform_time_ms();
+	uint32_t elapsed;
+	do {
+		target_regs_read(t, regs);
+		++count;
+		elapsed = platform_time_ms() - start;
+	} while (elapsed < BENCH_MIN_MS);
+	free(regs);
+	bench_result("regs_read_us", "Register file read latency", (elapsed * 1000.0) / count, "us");
+}
+
+/* Times erase and program of the last sector of each Flash, then puts the old contents back */
+static void bench_flash(target *t)
+{
+	size_t index = 0;
+	for (struct target_flash *f = t->flash; f; f = f->next, ++index) {
+		const uint32_t addr = f->start + f->length - f->blocksize;
+		uint8_t *const backup = malloc(f->blocksize);
+		uint8_t *const pattern = malloc(f->blocksize);
+		if (!backup || !pattern || target_mem_read(t, backup, addr, f->blocksize)) {
+			DEBUG_WARN("Can not save the Flash sector at 0x%08" PRIx32 ", skipping it\n", addr);
+			free(backup);
+			free(pattern);
+			continue;
+		}
+		for (size_t i = 0; i < f->blocksize; ++i)
+			pattern[i] = i;
+		uint32_t start = platform_time_ms();
+		const bool erased = !target_flash_erase(t, addr, f->blocksize) && !target_flash_done(t);
+		const uint32_t erase_time = platform_time_ms() - start;
+		start = platform_time_ms();
+		const bool written = erased && !target_flash_write(t, addr, pattern, f->blocksize) && !target_flash_done(t);
+		const uint32_t write_time = platform_time_ms() - start;
+		if (target_flash_erase(t, addr, f->blocksize) || target_flash_write(t, addr, backup, f->blocksize) ||
+			target_flash_done(t))
+			DEBUG_WARN("Restoring the Flash sector at 0x%08" PRIx32 " failed!\n", addr);
+		free(backup);
+		free(pattern);
+		if (!erased || !written) {
+			DEBUG_WARN("Flash benchmark at 0x%08" PRIx32 " failed\n", addr);
+			continue;
+		}
+		char key[48];
+		char description[48];
+		snprintf(key, sizeof(key), "flash%zu_erase_kibps", index);
+		snprintf(description, sizeof(description), "Flash 0x%08" PRIx32 " erase", f->start);
+		bench_result(key, description, (f->blocksize * 1.0) / MAX(erase_time, 1U), "kiB/s");
+		snprintf(key, sizeof(key), "flash%zu_program_kibps", index);
+		snprintf(description, sizeof(description), "Flash 0x%08" PRIx32 " program", f->start);
+		bench_result(key, description, (f->blocksize * 1.0) / MAX(write_time, 1U), "kiB/s");
+	}
+}
+
+static int cl_bench(BMP_CL_OPTIONS_t *opt, target *t)
+{
+	bench_json = opt->opt_bench_json;
+	if (bench_json)
+		printf("{\n  \"probe\": \"%s %s\",\n  \"version\": \"%s\",\n  \"target\": \"%s\",\n  "
+			   "\"frequency\": %" PRIu32, info.manufacturer, info.product, info.version, target_driver_name(t),
+			platform_max_frequency_get());
+	else
+		DEBUG_WARN("Benchmarking %s, SWJ frequency %" PRIu32 " Hz\n", target_driver_name(t),
+			platform_max_frequency_get());
+	/* The JSON header already opened the object, so every result follows a member */
+	bench_first = false;
+	bench_link(t);
+	bench_ram(t);
+	bench_regs(t);
+	if (opt->opt_bench_flash)
+		bench_flash(t);
+	if (bench_json)
+		printf("\n}\n");
+	return 0;
+}
+
+/*
+ * Run the Flash, monitor or reset operation opt asks for on an attached
+ * target. The start and size of the lowest Flash are the defaults for the
+ * address range. Unless reset is false, the target is reset once the
+ * operation has changed the Flash contents.
+ */
+static int cl_operation(BMP_CL_OPTIONS_t *opt, target *t, const uint32_t lowest_flash_start,
+	const uint32_t lowest_flash_size, const bool reset)
+{
+	int res = 0;
+	if (opt->opt_flash_start == 0xffffffff)
+		opt->opt_flash_start = lowest_flash_start;
+	if ((opt->opt_flash_size == 0xffffffff) &&
+	    (opt->opt_mode != BMP_MODE_FLASH_WRITE) &&
+	    (opt->opt_mode != BMP_MODE_FLASH_VERIFY) &&
+	    (opt->opt_mode != BMP_MODE_FLASH_WRITE_VERIFY))
+		opt->opt_flash_size = lowest_flash_size;
+	int read_file = -1;
+	if ((opt->opt_mode == BMP_MODE_FLASH_WRITE) ||
+	    (opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
+	    (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
+		/* Gang sessions inherit the image the parent mapped once for all of them */
+		if (!map.data && bmp_mmap(opt->opt_flash_file, &map)) {
+			DEBUG_WARN("Can not map file: %s. Aborting!\n", strerror(errno));
+			return -1;
+		}
+		if (image_segments(opt)) {
+			res = -1;
+			goto free_map;
+		}
+	} else if (opt->opt_mode == BMP_MODE_FLASH_READ) {
+		/* Open as binary */
+		read_file = open(opt->opt_flash_file, O_TRUNC | O_CREAT | O_RDWR | O_BINARY,
+						 S_IRUSR | S_IWUSR);
+		if (read_file == -1) {
+			DEBUG_WARN("Error opening flashfile %s for read: %s\n",
+					   opt->opt_flash_file, strerror(errno));
+			return -1;
+		}
+	}
+	if (opt->opt_monitor) {
+		res = command_process(t, opt->opt_monitor);
+		if (res)
+			DEBUG_WARN("Command \"%s\" failed\n", opt->opt_monitor);
+	}
+	if (opt->opt_mode == BMP_MODE_RESET) {
+		target_reset(t);
+	} else if (opt->opt_mode == BMP_MODE_FLASH_ERASE) {
+		DEBUG_INFO("Erase %zu bytes at 0x%08" PRIx32 "\n", opt->opt_flash_size,
+			  opt->opt_flash_start);
+		unsigned int erased = target_flash_erase(t, opt->opt_flash_start,
+												 opt->opt_flash_size);
+		if (!erased)
+			erased = target_flash_done(t);
+		if (erased) {
+			DEBUG_WARN("Erasure failed!\n");
+			res = -1;
+			goto free_map;
+		}
+		if (reset)
+			target_reset(t);
+	} else if ((opt->opt_mode == BMP_MODE_FLASH_WRITE) ||
+	           (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
+		const size_t image_bytes = image_size();
+		uint32_t start_time = platform_time_ms();
+		/* Everything is erased before anything is written, segments may share a sector */
+		unsigned int erased = 0;
+		for (size_t i = 0; i < segment_count && !erased; ++i) {
+			DEBUG_INFO("Erase    %zu bytes at 0x%08" PRIx32 "\n", segments[i].size, segments[i].addr);
+			erased = target_flash_erase(t, segments[i].addr, segments[i].size);
+		}
+		if (erased) {
+			DEBUG_WARN("Erasure failed!\n");
+			res = -1;
+			goto free_map;
+		} else {
+			unsigned int flashed = 0;
+			for (size_t i = 0; i < segment_count && !flashed; ++i) {
+				DEBUG_INFO("Flashing %zu bytes at 0x%08" PRIx32 "\n", segments[i].size, segments[i].addr);
+				flashed = target_flash_write(t, segments[i].addr, segments[i].data, segments[i].size);
+			}
+			/* Buffered write cares for padding*/
+			if (!flashed)
+				flashed = target_flash_done(t);
+			if (flashed) {
+				DEBUG_WARN("Flashing failed!\n");
+				res = -1;
+				goto free_map;
+			} else {
+				DEBUG_INFO("Success!\n");
+			}
+		}
+		uint32_t end_time = platform_time_ms();
+		DEBUG_WARN("Flash Write succeeded for %d bytes, %8.3f kiB/s\n",
+			   (int)image_bytes, (((image_bytes * 1.0)/(end_time - start_time))));
+		if (opt->opt_mode != BMP_MODE_FLASH_WRITE_VERIFY) {
+			if (reset)
+				target_reset(t);
+			goto free_map;
+		}
+	}
+	if ((opt->opt_mode == BMP_MODE_FLASH_READ) ||
+	    (opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
+	    (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
+#define WORKSIZE 0x1000
+/* Reads to a file go in much bigger pieces, fewer and longer transfers keep the link busy */
+#define READ_WORKSIZE 0x10000
+		const bool reading = opt->opt_mode == BMP_MODE_FLASH_READ;
+		const size_t worksize_max = reading ? READ_WORKSIZE : WORKSIZE;
+		uint8_t *data = alloca(worksize_max);
+		if (!data) {
+			DEBUG_WARN("Can not malloc memory for flash read/verify "
+					   "operation\n");
+			res = -1;
+			goto free_map;
+		}
+		if (opt->opt_mode == BMP_MODE_FLASH_READ)
+			DEBUG_INFO("Reading flash from 0x%08" PRIx32 " for %zu"
+				   " bytes to %s\n", opt->opt_flash_start,  opt->opt_flash_size,
+				   opt->opt_flash_file);
+		/* Reads cover the requested range, verification the segments of the image */
+		const struct image_segment read_segment = {opt->opt_flash_start, NULL, opt->opt_flash_size};
+		const struct image_segment *const ranges = reading ? &read_segment : segments;
+		const size_t range_count = reading ? 1U : segment_count;
+		int bytes_read = 0;
+		uint32_t start_time = platform_time_ms();
+		uint32_t last_report = start_time;
+		for (size_t range = 0; range < range_count; ++range) {
+			uint32_t flash_src = ranges[range].addr;
+			size_t size = ranges[range].size;
+			const uint8_t *flash = ranges[range].data;
+			if (!reading) {
+				/* Compare digests first, the image only has to be read back to locate a difference */
+				uint32_t crc;
+				if (target_mem_crc32(t, &crc, flash_src, size) == 0 && crc == crc32_buf(0xffffffffU, flash, size)) {
+					bytes_read += size;
+					size = 0;
+				} else if (opt->opt_verify_crc) {
+					if (cl_verify_crc_sectors(t, flash_src, flash, size, data, WORKSIZE)) {
+						res = -1;
+						goto free_map;
+					}
+					bytes_read += size;
+					size = 0;
+				}
+			}
+			while (size) {
+				int worksize = MIN(size, worksize_max);
+				int n_read = target_mem_read(t, data, flash_src, worksize);
+				if (n_read) {
+					if (opt->opt_flash_size == 0) {/* we reached end of flash */
+						DEBUG_INFO("Reached end of flash at size %" PRId32 "\n",
+							   flash_src - ranges[range].addr);
+						break;
+					} else {
+						DEBUG_WARN("Read failed at flash address 0x%08" PRIx32 "\n",
+							   flash_src);
+						break;
+					}
+				} else {
+					bytes_read += worksize;
+				}
+				if ((opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
+				    (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
+					int difference = memcmp(data, flash, worksize);
+					if (difference){
+						DEBUG_WARN("Verify failed at flash region 0x%08"
+								   PRIx32 "\n", flash_src);
+						res = -1;
+						goto free_map;
+					}
+					flash += worksize;
+				} else if (read_file != -1) {
+					int written = write(read_file, data, worksize);
+					if (written < worksize) {
+						DEBUG_WARN("Read failed at flash region 0x%08" PRIx32 "\n",
+							   flash_src);
+						res = -1;
+						goto free_map;
+					}
+					const uint32_t now = platform_time_ms();
+					if (now - last_report >= 1000U) {
+						DEBUG_INFO("\r%8d of %zu kiB, %8.3f kiB/s", bytes_read / 1024, opt->opt_flash_size / 1024U,
+							(bytes_read * 1.0) / (now - start_time));
+						last_report = now;
+					}
+				}
+				flash_src += worksize;
+				size -= worksize;
+			}
+		}
+		uint32_t end_time = platform_time_ms();
+		if (last_report != start_time)
+			DEBUG_INFO("\n");
+		if (read_file != -1)
+			close(read_file);
+		DEBUG_WARN("Read/Verify succeeded for %d bytes, %8.3f kiB/s\n",
+		           bytes_read,
+		           (((bytes_read * 1.0)/(end_time - start_time))));
+		if (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY && reset)
+			target_reset(t);
+	}
+  free_map:
+	image_free();
+	if (map.size)
+		bmp_munmap(&map);
+	memset(&map, 0, sizeof(map));
+	return res;
+}
+
+/* Let the target run for ms while sampling its PC, then halt it and save the histogram */
+static int cl_profile(target *t, const uint32_t ms, const char *const filename)
+{
+	profile_start(PROFILE_SOURCE_PCSR);
+	target_halt_resume(t, false);
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, ms);
+	target_addr watch;
+	enum target_halt_reason reason = TARGET_HALT_RUNNING;
+	while (!platform_timeout_is_expired(&timeout) && (reason = target_halt_poll(t, &watch)) == TARGET_HALT_RUNNING)
+		profile_poll(t);
+	profile_stop();
+	if (reason == TARGET_HALT_ERROR)
+		return -1;
+	if (reason == TARGET_HALT_RUNNING) {
+		target_halt_request(t);
+		while ((reason = target_halt_poll(t, &watch)) == TARGET_HALT_RUNNING)
+			continue;
+	}
+	profile_print(DEBUG_INFO, false);
+	return profile_write_gmon(filename) ? 0 : -1;
+}
+
+/*
+ * Run the operations of a script one per line on the one attached target,
+ * so a sequence of them only pays for the scan and attach once:
+ *   erase [ADDR SIZE]      erase Flash, all of the lowest Flash by default
+ *   flash FILE [ADDR]      write an image to Flash
+ *   verify FILE [ADDR]     verify Flash against an image
+ *   read FILE [ADDR SIZE]  read Flash to a file
+ *   monitor COMMAND        run a monitor command
+ *   write32 ADDR VALUE     write a word of memory
+ *   read32 ADDR            print a word of memory
+ *   reset                  reset the target
+ *   delay MS               wait
+ *   profile MS FILE        run the target sampling its PC, save a gmon.out
+ * Empty lines and lines starting with '#' are skipped. The script stops at
+ * the first operation that fails.
+ */
+static int cl_script(BMP_CL_OPTIONS_t *opt, target *t, const uint32_t lowest_flash_start,
+	const uint32_t lowest_flash_size)
+{
+	FILE *const script = strcmp(opt->opt_script, "-") ? fopen(opt->opt_script, "r") : stdin;
+	if (!script) {
+		DEBUG_WARN("Can not open script %s: %s\n", opt->opt_script, strerror(errno));
+		return -1;
+	}
+	int res = 0;
+	unsigned int line_number = 0;
+	char line[512];
+	while (!res && fgets(line, sizeof(line), script)) {
+		++line_number;
+		line[strcspn(line, "\r\n")] = '\0';
+		char *cmd = line + strspn(line, " \t");
+		if (!*cmd || *cmd == '#')
+			continue;
+		char *args = cmd + strcspn(cmd, " \t");
+		if (*args)
+			*args++ = '\0';
+		args += strspn(args, " \t");
+		DEBUG_INFO("Script line %u: %s %s\n", line_number, cmd, args);
+		char *argv[3] = {NULL, NULL, NULL};
+		/* monitor takes the rest of the line as it is */
+		if (strcmp(cmd, "monitor")) {
+			for (size_t i = 0; i < 3U; ++i)
+				argv[i] = strtok(i ? NULL : args, " \t");
+		}
+
+		BMP_CL_OPTIONS_t op = *opt;
+		op.opt_monitor = NULL;
+		op.opt_flash_file = NULL;
+		op.opt_flash_start = 0xffffffff;
+		op.opt_flash_size = 0xffffffff;
+		if (!strcmp(cmd, "erase")) {
+			op.opt_mode = BMP_MODE_FLASH_ERASE;
+			if (argv[0])
+				op.opt_flash_start = strtoul(argv[0], NULL, 0);
+			if (argv[1])
+				op.opt_flash_size = strtoul(argv[1], NULL, 0);
+		} else if (!strcmp(cmd, "flash") || !strcmp(cmd, "verify") || !strcmp(cmd, "read")) {
+			op.opt_mode = !strcmp(cmd, "flash") ? BMP_MODE_FLASH_WRITE :
+				!strcmp(cmd, "verify") ? BMP_MODE_FLASH_VERIFY : BMP_MODE_FLASH_READ;
+			op.opt_flash_file = argv[0];
+			if (argv[1])
+				op.opt_flash_start = strtoul(argv[1], NULL, 0);
+			if (argv[2] && op.opt_mode == BMP_MODE_FLASH_READ)
+				op.opt_flash_size = strtoul(argv[2], NULL, 0);
+			if (!op.opt_flash_file) {
+				DEBUG_WARN("Script line %u: %s needs a file\n", line_number, cmd);
+				res = -1;
+				break;
+			}
+		} else if (!strcmp(cmd, "monitor")) {
+			op.opt_mode = BMP_MODE_MONITOR;
+			op.opt_monitor = args;
+		} else if (!strcmp(cmd, "write32") && argv[0] && argv[1]) {
+			const uint32_t addr = strtoul(argv[0], NULL, 0);
+			const uint32_t value = strtoul(argv[1], NULL, 0);
+			target_mem_write32(t, addr, value);
+			if (target_check_error(t)) {
+				DEBUG_WARN("Script line %u: writing 0x%08" PRIx32 " failed\n", line_number, addr);
+				res = -1;
+			}
+			continue;
+		} else if (!strcmp(cmd, "read32") && argv[0]) {
+			const uint32_t addr = strtoul(argv[0], NULL, 0);
+			uint32_t value;
+			if (target_mem_read(t, &value, addr, sizeof(value))) {
+				DEBUG_WARN("Script line %u: reading 0x%08" PRIx32 " failed\n", line_number, addr);
+				res = -1;
+			} else
+				printf("0x%08" PRIx32 ": 0x%08" PRIx32 "\n", addr, value);
+			continue;
+		} else if (!strcmp(cmd, "reset")) {
+			target_reset(t);
+			continue;
+		} else if (!strcmp(cmd, "delay") && argv[0]) {
+			platform_delay(strtoul(argv[0], NULL, 0));
+			continue;
+		} else if (!strcmp(cmd, "profile") && argv[0] && argv[1]) {
+			res = cl_profile(t, strtoul(argv[0], NULL, 0), argv[1]);
+			if (res)
+				DEBUG_WARN("Script line %u: profiling failed\n", line_number);
+			continue;
+		} else {
+			DEBUG_WARN("Script line %u: can not parse \"%s\"\n", line_number, cmd);
+			res = -1;
+			break;
+		}
+		res = cl_operation(&op, t, lowest_flash_start, lowest_flash_size, false);
+		if (res)
+			DEBUG_WARN("Script line %u: %s failed\n", line_number, cmd);
+	}
+	if (script != stdin)
+		fclose(script);
+	return res;
+}
+
 static void display_target(int i, target *t, void *context)
 {
 	(void)context;
@@ -427,6 +1326,14 @@ int cl_execute(BMP_CL_OPTIONS_t *opt)
 		DEBUG_INFO("Running in Test Mode\n");
 	DEBUG_INFO("Target voltage: %s Volt\n", platform_target_voltage());
 
+	if (opt->opt_mode == BMP_MODE_SVF) {
+		if (platform_jtag_raw_init()) {
+			DEBUG_WARN("JTAG not available\n");
+			return -1;
+		}
+		return svf_play(opt->opt_svf_file);
+	}
+
 	if (opt->opt_scanmode == BMP_SCAN_JTAG)
 		num_targets = platform_jtag_scan(NULL);
 	else if (opt->opt_scanmode == BMP_SCAN_SWD)
@@ -493,13 +1400,6 @@ found_targets:
 				}
 			}
 	}
-	if (opt->opt_flash_start == 0xffffffff)
-		opt->opt_flash_start = lowest_flash_start;
-	if ((opt->opt_flash_size == 0xffffffff) &&
-	    (opt->opt_mode != BMP_MODE_FLASH_WRITE) &&
-	    (opt->opt_mode != BMP_MODE_FLASH_VERIFY) &&
-	    (opt->opt_mode != BMP_MODE_FLASH_WRITE_VERIFY))
-		opt->opt_flash_size = lowest_flash_size;
 	if (opt->opt_mode == BMP_MODE_SWJ_TEST) {
 		switch (t->core[0]) {
 		case 'M':
@@ -514,160 +1414,108 @@ found_targets:
 			DEBUG_WARN("No test for this core type yet\n");
 		}
 	}
+	if (opt->opt_mode == BMP_MODE_BENCH) {
+		res = cl_bench(opt, t);
+		goto target_detach;
+	}
 	if ((opt->opt_mode == BMP_MODE_TEST) ||
 		(opt->opt_mode == BMP_MODE_SWJ_TEST))
 		goto target_detach;
-	int read_file = -1;
-	if ((opt->opt_mode == BMP_MODE_FLASH_WRITE) ||
-	    (opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
-	    (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
-		int mmap_res = bmp_mmap(opt->opt_flash_file, &map);
-		if (mmap_res) {
-			DEBUG_WARN("Can not map file: %s. Aborting!\n", strerror(errno));
-			res = -1;
-			goto target_detach;
-		}
-	} else if (opt->opt_mode == BMP_MODE_FLASH_READ) {
-		/* Open as binary */
-		read_file = open(opt->opt_flash_file, O_TRUNC | O_CREAT | O_RDWR | O_BINARY,
-						 S_IRUSR | S_IWUSR);
-		if (read_file == -1) {
-			DEBUG_WARN("Error opening flashfile %s for read: %s\n",
-					   opt->opt_flash_file, strerror(errno));
-			res = -1;
-			goto target_detach;
-		}
+	if (opt->opt_mode == BMP_MODE_SCRIPT)
+		res = cl_script(opt, t, lowest_flash_start, lowest_flash_size);
+	else
+		res = cl_operation(opt, t, lowest_flash_start, lowest_flash_size, true);
+  target_detach:
+	if (t)
+		target_detach(t);
+	target_list_free();
+	return res;
+}
+
+/*
+ * Probe, target and transport state are all global, so each probe of a gang
+ * gets a process of its own. The sessions are started one after the other,
+ * the next being forked only once the previous one has found and opened its
+ * probe, so USB enumeration never overlaps. The Flash operations then run in
+ * parallel, all sharing the one mapping of the image.
+ */
+int cl_gang_execute(BMP_CL_OPTIONS_t *opt, void (*probe_init)(void))
+{
+#if defined(_WIN32) || defined(__CYGWIN__)
+	(void)opt;
+	(void)probe_init;
+	DEBUG_WARN("Gang programming is not supported on this platform\n");
+	return -1;
+#else
+#define GANG_MAX 32
+	if (opt->opt_mode == BMP_MODE_DEBUG) {
+		DEBUG_WARN("Gang mode needs a Flash operation\n");
+		return -1;
 	}
-	if (opt->opt_flash_size < map.size)
-		/* restrict to size given on command line */
-		map.size = opt->opt_flash_size;
-	if (opt->opt_monitor) {
-		res = command_process(t, opt->opt_monitor);
-		if (res)
-			DEBUG_WARN("Command \"%s\" failed\n", opt->opt_monitor);
+	if (opt->opt_flash_file && opt->opt_mode != BMP_MODE_FLASH_READ && bmp_mmap(opt->opt_flash_file, &map)) {
+		DEBUG_WARN("Can not map file: %s. Aborting!\n", strerror(errno));
+		return -1;
 	}
-	if (opt->opt_mode == BMP_MODE_RESET) {
-		target_reset(t);
-	} else if (opt->opt_mode == BMP_MODE_FLASH_ERASE) {
-		DEBUG_INFO("Erase %zu bytes at 0x%08" PRIx32 "\n", opt->opt_flash_size,
-			  opt->opt_flash_start);
-		unsigned int erased = target_flash_erase(t, opt->opt_flash_start,
-												 opt->opt_flash_size);
-		if (erased) {
-			DEBUG_WARN("Erasure failed!\n");
-			res = -1;
-			goto free_map;
+	char *serials[GANG_MAX];
+	pid_t pids[GANG_MAX];
+	size_t count = 0;
+	for (char *serial = strtok(opt->opt_gang, ","); serial; serial = strtok(NULL, ",")) {
+		if (count == GANG_MAX) {
+			DEBUG_WARN("Gang limited to %d probes, ignoring the rest\n", GANG_MAX);
+			break;
 		}
-		target_reset(t);
-	} else if ((opt->opt_mode == BMP_MODE_FLASH_WRITE) ||
-	           (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
-		DEBUG_INFO("Erase    %zu bytes at 0x%08" PRIx32 "\n", map.size,
-			  opt->opt_flash_start);
-		uint32_t start_time = platform_time_ms();
-		unsigned int erased = target_flash_erase(t, opt->opt_flash_start,
-												 map.size);
-		if (erased) {
-			DEBUG_WARN("Erasure failed!\n");
-			res = -1;
-			goto free_map;
-		} else {
-			DEBUG_INFO("Flashing %zu bytes at 0x%08" PRIx32 "\n",
-				  map.size, opt->opt_flash_start);
-			unsigned int flashed = target_flash_write(t, opt->opt_flash_start,
-													  map.data, map.size);
-			/* Buffered write cares for padding*/
-			if (!flashed)
-				flashed = target_flash_done(t);
-			if (flashed) {
-				DEBUG_WARN("Flashing failed!\n");
-				res = -1;
-				goto free_map;
-			} else {
-				DEBUG_INFO("Success!\n");
-			}
+		int ready[2];
+		if (pipe(ready)) {
+			DEBUG_WARN("pipe() failed: %s\n", strerror(errno));
+			break;
 		}
-		uint32_t end_time = platform_time_ms();
-		DEBUG_WARN("Flash Write succeeded for %d bytes, %8.3f kiB/s\n",
-			   (int)map.size, (((map.size * 1.0)/(end_time - start_time))));
-		if (opt->opt_mode != BMP_MODE_FLASH_WRITE_VERIFY) {
-			target_reset(t);
-			goto free_map;
+		fflush(stdout);
+		fflush(stderr);
+		const pid_t pid = fork();
+		if (pid == 0) {
+			close(ready[0]);
+			opt->opt_gang = NULL;
+			opt->opt_serial = serial;
+			opt->opt_position = 0;
+			probe_init();
+			/* Let the parent move on to the next probe */
+			close(ready[1]);
+			exit(cl_execute(opt) ? 1 : 0);
 		}
-	}
-	if ((opt->opt_mode == BMP_MODE_FLASH_READ) ||
-	    (opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
-	    (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
-#define WORKSIZE 0x1000
-		uint8_t *data = alloca(WORKSIZE);
-		if (!data) {
-			DEBUG_WARN("Can not malloc memory for flash read/verify "
-					   "operation\n");
-			res = -1;
-			goto free_map;
+		close(ready[1]);
+		if (pid < 0) {
+			DEBUG_WARN("fork() failed: %s\n", strerror(errno));
+			close(ready[0]);
+			break;
 		}
-		if (opt->opt_mode == BMP_MODE_FLASH_READ)
-			DEBUG_INFO("Reading flash from 0x%08" PRIx32 " for %zu"
-				   " bytes to %s\n", opt->opt_flash_start,  opt->opt_flash_size,
-				   opt->opt_flash_file);
-		uint32_t flash_src = opt->opt_flash_start;
-		size_t size = (opt->opt_mode == BMP_MODE_FLASH_READ) ? opt->opt_flash_size:
-			map.size;
-		int bytes_read = 0;
-		void *flash = map.data;
-		uint32_t start_time = platform_time_ms();
-		while (size) {
-			int worksize = (size > WORKSIZE) ? WORKSIZE : size;
-			int n_read = target_mem_read(t, data, flash_src, worksize);
-			if (n_read) {
-				if (opt->opt_flash_size == 0) {/* we reached end of flash */
-					DEBUG_INFO("Reached end of flash at size %" PRId32 "\n",
-						   flash_src - opt->opt_flash_start);
-					break;
-				} else {
-					DEBUG_WARN("Read failed at flash address 0x%08" PRIx32 "\n",
-						   flash_src);
-					break;
-				}
-			} else {
-				bytes_read += worksize;
-			}
-			if ((opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
-			    (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
-				int difference = memcmp(data, flash, worksize);
-				if (difference){
-					DEBUG_WARN("Verify failed at flash region 0x%08"
-							   PRIx32 "\n", flash_src);
-					res = -1;
-					goto free_map;
-				}
-				flash += worksize;
-			} else if (read_file != -1) {
-				int written = write(read_file, data, worksize);
-				if (written < worksize) {
-					DEBUG_WARN("Read failed at flash region 0x%08" PRIx32 "\n",
-						   flash_src);
-					res = -1;
-					goto free_map;
-				}
+		/* Returns at end of file, so when the session is ready or has already died */
+		char c;
+		while (read(ready[0], &c, 1) < 0 && errno == EINTR)
+			continue;
+		close(ready[0]);
+		serials[count] = serial;
+		pids[count++] = pid;
+	}
+
+	size_t failed = 0;
+	int status[GANG_MAX];
+	for (size_t i = 0; i < count; ++i) {
+		while (waitpid(pids[i], &status[i], 0) < 0) {
+			if (errno != EINTR) {
+				status[i] = -1;
+				break;
 			}
-			flash_src += worksize;
-			size -= worksize;
 		}
-		uint32_t end_time = platform_time_ms();
-		if (read_file != -1)
-			close(read_file);
-		DEBUG_WARN("Read/Verify succeeded for %d bytes, %8.3f kiB/s\n",
-		           bytes_read,
-		           (((bytes_read * 1.0)/(end_time - start_time))));
-		if (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)
-			target_reset(t);
+		if (status[i] == -1 || !WIFEXITED(status[i]) || WEXITSTATUS(status[i]))
+			++failed;
 	}
-  free_map:
+	DEBUG_WARN("Gang results:\n");
+	for (size_t i = 0; i < count; ++i)
+		DEBUG_WARN("  %-24s %s\n", serials[i],
+			(status[i] != -1 && WIFEXITED(status[i]) && !WEXITSTATUS(status[i])) ? "OK" : "FAILED");
+	DEBUG_WARN("%zu of %zu probes succeeded\n", count - failed, count);
 	if (map.size)
 		bmp_munmap(&map);
-  target_detach:
-	if (t)
-		target_detach(t);
-	target_list_free();
-	return res;
+	return failed || !count ? -1 : 0;
+#endif
 }
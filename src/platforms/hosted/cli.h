@@ -38,6 +38,9 @@ enum bmp_cl_mode {
 	BMP_MODE_FLASH_VERIFY,
 	BMP_MODE_SWJ_TEST,
 	BMP_MODE_MONITOR,
+	BMP_MODE_BENCH,
+	BMP_MODE_SCRIPT,
+	BMP_MODE_SVF,
 };
 
 typedef enum bmp_scan_mode_e {
@@ -54,16 +57,29 @@ typedef struct BMP_CL_OPTIONS_s {
 	bool opt_connect_under_reset;
 	bool external_resistor_swd;
 	bool opt_no_hl;
+	bool opt_verify_crc;
+	bool opt_bench_flash;
+	bool opt_bench_json;
+	bool opt_sim;
 	char *opt_flash_file;
 	char *opt_device;
 	char *opt_serial;
+	char *opt_gang;
+	char *opt_record_file;
+	char *opt_replay_file;
+	char *opt_sim_model;
+	uint32_t opt_sim_latency_us;
 	uint32_t opt_targetid;
 	char *opt_ident_string;
 	int  opt_position;
 	char *opt_cable;
 	char *opt_monitor;
+	char *opt_script;
+	char *opt_svf_file;
+	char *opt_rtt;
 	int opt_debuglevel;
 	int opt_target_dev;
+	int opt_gdb_ports;
 	uint32_t opt_flash_start;
 	uint32_t opt_max_swj_frequency;
 	size_t opt_flash_size;
@@ -71,6 +87,7 @@ typedef struct BMP_CL_OPTIONS_s {
 
 void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv);
 int cl_execute(BMP_CL_OPTIONS_t *opt);
+int cl_gang_execute(BMP_CL_OPTIONS_t *opt, void (*probe_init)(void));
 int serial_open(BMP_CL_OPTIONS_t *opt, char *serial);
 void serial_close(void);
 #endif
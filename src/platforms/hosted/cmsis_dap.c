@@ -42,11 +42,20 @@
 #include "cli.h"
 #include "target.h"
 #include "target_internal.h"
+#include "traceswo.h"
 
 uint8_t dap_caps;
 uint8_t mode;
 
 #define TRANSFER_TIMEOUT_MS (100)
+/* Most commands kept in flight, whatever packet count the probe reports */
+#define DAP_MAX_IN_FLIGHT 8U
+/*
+ * SWO streaming keeps this many transfers queued on the trace endpoint, so
+ * the probe can carry on sending while we decode and between polls.
+ */
+#define SWO_TRANSFER_COUNT 8U
+#define SWO_TRANSFER_SIZE 16384U
 
 typedef enum cmsis_type_e {
 	CMSIS_TYPE_NONE = 0,
@@ -59,11 +68,21 @@ static cmsis_type_t type;
 static libusb_device_handle *usb_handle = NULL;
 static uint8_t in_ep;
 static uint8_t out_ep;
+static uint8_t swo_ep;
+static libusb_context *usb_ctx = NULL;
 static hid_device *handle = NULL;
 static uint8_t buffer[1024 + 1];
-static int report_size = 64 + 1; // TODO: read actual report size
+/* Packet size from DAP_Info, plus the HID report ID */
+static int report_size = 64 + 1;
+/* Commands the probe can buffer, from DAP_Info */
+static size_t packet_count = 1;
 static bool has_swd_sequence = false;
 
+static dap_swo_transport_t swo_transport = DAP_SWO_TRANSPORT_NONE;
+static struct libusb_transfer *swo_transfers[SWO_TRANSFER_COUNT];
+static uint8_t swo_buffers[SWO_TRANSFER_COUNT][SWO_TRANSFER_SIZE];
+static size_t swo_in_flight = 0;
+
 static size_t mbslen(const char *str)
 {
 	const char *const end = str + strlen(str);
@@ -132,13 +151,6 @@ static bool dap_init_hid(const bmp_info_t *const info)
 		return false;
 	}
 	serial[size] = 0;
-	/* Blacklist devices that do not work with 513 byte report length
-	* FIXME: Find a solution to decipher from the device.
-	*/
-	if (info->vid == 0x1fc9 && info->pid == 0x0132) {
-		DEBUG_WARN("Blacklist\n");
-		report_size = 64 + 1;
-	}
 	handle = hid_open(info->vid, info->pid, serial[0] ? serial : NULL);
 	if (!handle) {
 		PRINT_INFO("hid_open failed: %ls\n", hid_error(NULL));
@@ -165,10 +177,27 @@ static bool dap_init_bulk(const bmp_info_t *const info)
 	}
 	in_ep = info->in_ep;
 	out_ep = info->out_ep;
+	swo_ep = info->swo_ep;
+	usb_ctx = info->libusb_ctx;
 	return true;
 }
 
-/* LPC845 Breakout Board Rev. 0 report invalid response with > 65 bytes */
+static void dap_init_packet_size(const bmp_info_t *const info)
+{
+	uint8_t data[2];
+	if (dap_info(DAP_INFO_PACKET_SIZE, data, sizeof(data)) == 2U) {
+		const size_t packet_size = data[0] | (data[1] << 8U);
+		/* LPC845 Breakout Board Rev. 0 report invalid response with > 65 bytes */
+		if (info->vid == 0x1fc9 && info->pid == 0x0132)
+			DEBUG_WARN("Blacklist\n");
+		else if (packet_size >= 64U)
+			report_size = MIN(packet_size, sizeof(buffer) - 1U) + 1U;
+	}
+	if (dap_info(DAP_INFO_PACKET_COUNT, data, sizeof(data)) && data[0])
+		packet_count = MIN(data[0], DAP_MAX_IN_FLIGHT);
+	DEBUG_INFO("Packet size %d, count %zu\n", report_size - 1, packet_count);
+}
+
 int dap_init(bmp_info_t *info)
 {
 	type = (info->in_ep && info->out_ep) ? CMSIS_TYPE_BULK : CMSIS_TYPE_HID;
@@ -181,6 +210,7 @@ int dap_init(bmp_info_t *info)
 			return -1;
 	}
 	dap_disconnect();
+	dap_init_packet_size(info);
 	size_t size = dap_info(DAP_INFO_FW_VER, buffer, sizeof(buffer));
 	if (size) {
 		DEBUG_INFO("Ver %s, ", buffer);
@@ -222,27 +252,17 @@ void dap_nrst_set_val(bool assert)
 
 static void dap_dp_abort(ADIv5_DP_t *dp, uint32_t abort)
 {
-	/* DP Write to Reg 0.*/
-	dap_write_reg(dp, ADIV5_DP_ABORT, abort);
+	dap_write_abort(dp, abort);
 }
 
 static uint32_t dap_dp_error(ADIv5_DP_t *dp)
 {
-	/* Not used for SWD debugging, so no TARGETID switch needed!*/
+	/* Only used for JTAG, where ABORT can't clear the sticky flags but writing them back to CTRL/STAT does */
 	uint32_t ctrlstat = dap_read_reg(dp, ADIV5_DP_CTRLSTAT);
 	uint32_t err = ctrlstat &
 		(ADIV5_DP_CTRLSTAT_STICKYORUN | ADIV5_DP_CTRLSTAT_STICKYCMP |
 		ADIV5_DP_CTRLSTAT_STICKYERR | ADIV5_DP_CTRLSTAT_WDATAERR);
-	uint32_t clr = 0;
-	if(err & ADIV5_DP_CTRLSTAT_STICKYORUN)
-		clr |= ADIV5_DP_ABORT_ORUNERRCLR;
-	if(err & ADIV5_DP_CTRLSTAT_STICKYCMP)
-		clr |= ADIV5_DP_ABORT_STKCMPCLR;
-	if(err & ADIV5_DP_CTRLSTAT_STICKYERR)
-		clr |= ADIV5_DP_ABORT_STKERRCLR;
-	if(err & ADIV5_DP_CTRLSTAT_WDATAERR)
-		clr |= ADIV5_DP_ABORT_WDERRCLR;
-	dap_write_reg(dp, ADIV5_DP_ABORT, clr);
+	dap_write_reg(dp, ADIV5_DP_CTRLSTAT, ctrlstat);
 	dp->fault = 0;
 	return err;
 }
@@ -256,6 +276,8 @@ static uint32_t dap_dp_low_access(struct ADIv5_DP_s *dp, uint8_t RnW,
 	if (RnW) {
 		res = dap_read_reg(dp, reg);
 	}
+	else if (addr == ADIV5_DP_ABORT)
+		dap_write_abort(dp, value);
 	else {
 		dap_write_reg(dp, reg, value);
 	}
@@ -271,6 +293,7 @@ static uint32_t dap_dp_read_reg(ADIv5_DP_t *dp, uint16_t addr)
 
 void dap_exit_function(void)
 {
+	dap_swo_stop();
 	if (type == CMSIS_TYPE_HID) {
 		if (handle) {
 			dap_disconnect();
@@ -289,56 +312,73 @@ int dbg_get_report_size(void)
 	return report_size;
 }
 
-int dbg_dap_cmd(uint8_t *data, int size, int rsize)
-
+/*
+ * HID reports always go out whole, the report ID (0, as CMSIS-DAP doesn't
+ * number them) then the packet padded out to the probe's packet size.
+ */
+static int dap_send(const uint8_t *const data, const int rsize)
 {
-	char cmd = data[0];
-	int res = -1;
-
-	memset(buffer, 0xff, report_size + 1);
-
-	buffer[0] = 0x00; // Report ID??
-	memcpy(&buffer[1], data, rsize);
-
-	DEBUG_WIRE("cmd :   ");
-	for(int i = (type == CMSIS_TYPE_HID) ? 0 : 1; (i < rsize + 1); i++)
-		DEBUG_WIRE("%02x.",	buffer[i]);
-	DEBUG_WIRE("\n");
 	if (type == CMSIS_TYPE_HID) {
-		res = hid_write(handle, buffer, 65);
+		uint8_t report[sizeof(buffer)];
+		memset(report, 0xff, report_size);
+		report[0] = 0x00;
+		memcpy(report + 1, data, MIN(rsize, report_size - 1));
+		const int res = hid_write(handle, report, report_size);
 		if (res < 0) {
 			DEBUG_WARN("Error: %ls\n", hid_error(handle));
 			exit(-1);
 		}
-		do {
-			res = hid_read_timeout(handle, buffer, 65, 1000);
-			if (res < 0) {
+		return res;
+	}
+	int transferred = 0;
+	const int res = libusb_bulk_transfer(usb_handle, out_ep, (uint8_t *)data, rsize, &transferred, TRANSFER_TIMEOUT_MS);
+	if (res < 0)
+		DEBUG_WARN("OUT error: %d\n", res);
+	return res;
+}
+
+/* Reads back the response to cmd into buffer, returning its length */
+static int dap_receive(const uint8_t cmd)
+{
+	int transferred = 0;
+	/* We repeat the read in case we're out of step with the transmitter */
+	do {
+		if (type == CMSIS_TYPE_HID) {
+			/* Input reports come without the report ID, so are just the packet */
+			transferred = hid_read_timeout(handle, buffer, report_size - 1, 1000);
+			if (transferred < 0) {
 				DEBUG_WARN("debugger read(): %ls\n", hid_error(handle));
 				exit(-1);
-			} else if (res == 0) {
+			} else if (transferred == 0) {
 				DEBUG_WARN("timeout\n");
 				exit(-1);
 			}
-		} while (buffer[0] != cmd);
-	} else if (type == CMSIS_TYPE_BULK) {
-		int transferred = 0;
-
-		res = libusb_bulk_transfer(usb_handle, out_ep, data, rsize, &transferred, TRANSFER_TIMEOUT_MS);
+			continue;
+		}
+		const int res = libusb_bulk_transfer(usb_handle, in_ep, buffer, report_size, &transferred, TRANSFER_TIMEOUT_MS);
 		if (res < 0) {
-			DEBUG_WARN("OUT error: %d\n", res);
+			DEBUG_WARN("IN error: %d\n", res);
 			return res;
 		}
+	} while (buffer[0] != cmd);
+	return transferred;
+}
 
-		/* We repeat the read in case we're out of step with the transmitter */
-		do {
-			res = libusb_bulk_transfer(usb_handle, in_ep, buffer, report_size, &transferred, TRANSFER_TIMEOUT_MS);
-			if (res < 0) {
-				DEBUG_WARN("IN error: %d\n", res);
-				return res;
-			}
-		} while (buffer[0] != cmd);
-		res = transferred;
-	}
+int dbg_dap_cmd(uint8_t *data, int size, int rsize)
+
+{
+	char cmd = data[0];
+
+	DEBUG_WIRE("cmd :   ");
+	for (int i = 0; i < rsize; i++)
+		DEBUG_WIRE("%02x.", data[i]);
+	DEBUG_WIRE("\n");
+	int res = dap_send(data, rsize);
+	if (res < 0)
+		return res;
+	res = dap_receive(cmd);
+	if (res < 0)
+		return res;
 	DEBUG_WIRE("cmd res:");
 	for (int i = 0; i < res; i++)
 		DEBUG_WIRE("%02x.",	buffer[i]);
@@ -354,6 +394,76 @@ int dbg_dap_cmd(uint8_t *data, int size, int rsize)
 #define ALIGNOF(x) (((x) & 3) == 0 ? ALIGN_WORD :					\
                     (((x) & 1) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
 
+typedef struct dap_in_flight {
+	uint8_t cmd;
+	/* Address setup rather than a block transfer */
+	bool setup;
+	uint8_t *dest;
+	uint32_t addr;
+	size_t len;
+} dap_in_flight_s;
+
+/*
+ * Probes buffer up to packet_count commands, so stream the address
+ * setups and block transfers of a memory access rather than waiting for
+ * each response in turn. Reads go to dest, writes come from src.
+ */
+static bool dap_mem_pipelined(ADIv5_AP_t *const ap, uint8_t *dest, const uint8_t *src, uint32_t addr, size_t len,
+	const enum align align, const size_t max_size)
+{
+	dap_in_flight_s queue[DAP_MAX_IN_FLIGHT];
+	uint8_t request[1024];
+	size_t issued = 0;
+	size_t completed = 0;
+	/* Bytes left before TAR has to be set up again */
+	size_t run = 0;
+	bool failed = false;
+	while (completed < issued || (!failed && len)) {
+		if (!failed && len && issued - completed < packet_count) {
+			dap_in_flight_s *const entry = &queue[issued % packet_count];
+			size_t rsize;
+			entry->setup = !run;
+			if (entry->setup) {
+				rsize = dap_ap_mem_access_setup_request(ap, request, addr, align);
+				run = MIN((addr | 0x3ffU) - addr + 1U, len);
+			} else {
+				entry->dest = dest;
+				entry->addr = addr;
+				entry->len = MIN(run, max_size);
+				if (dest) {
+					rsize = dap_read_block_request(ap, request, entry->len, align);
+					dest += entry->len;
+				} else {
+					rsize = dap_write_block_request(ap, request, addr, src, entry->len, align);
+					src += entry->len;
+				}
+				addr += entry->len;
+				len -= entry->len;
+				run -= entry->len;
+			}
+			entry->cmd = request[0];
+			if (dap_send(request, rsize) < 0)
+				failed = true;
+			else
+				++issued;
+			continue;
+		}
+		const dap_in_flight_s *const entry = &queue[completed++ % packet_count];
+		if (dap_receive(entry->cmd) < 0)
+			failed = true;
+		else if (entry->setup)
+			failed |= !dap_ap_mem_access_setup_response(buffer + 1);
+		else if (entry->dest)
+			failed |= dap_read_block_response(buffer + 1, entry->dest, entry->addr, entry->len, align) != 0;
+		else
+			failed |= dap_write_block_response(buffer + 1) != 0;
+	}
+	/* Only recover once nothing is in flight any more */
+	if (failed)
+		dap_line_reset();
+	return !failed;
+}
+
 static void dap_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 {
 	if (len == 0)
@@ -366,6 +476,13 @@ static void dap_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 	/* One word transfer for every byte/halfword/word
 	 * Total number of bytes in transfer*/
 	unsigned int max_size = ((dbg_get_report_size() - 6) >> (2 - align)) & ~3;
+	if (packet_count > 1U) {
+		if (!dap_mem_pipelined(ap, dest, NULL, src, len, align, max_size)) {
+			DEBUG_WIRE("mem_read failed\n");
+			ap->dp->fault = 1;
+		}
+		return;
+	}
 	while (len) {
 		dap_ap_mem_access_setup(ap, src, align);
 		/* Calculate length until next access setup is needed */
@@ -398,29 +515,39 @@ static void dap_mem_write_sized( ADIv5_AP_t *ap, uint32_t dest, const void *src,
 		return;
 	DEBUG_WIRE("memwrite @ %" PRIx32 " len %ld, align %d , %08x start: \n",
 		dest, len, align, *(uint32_t *)src);
-	if (((unsigned)(1 << align)) == len)
+	align = adiv5_ap_align(ap, dest, len, align);
+	if (((unsigned)(1 << align)) == len && align != ALIGN_DWORD)
 		return dap_write_single(ap, dest, src, align);
-	unsigned int max_size = ((dbg_get_report_size() - 6) >> (2 - align) & ~3);
-	while (len) {
-		dap_ap_mem_access_setup(ap, dest, align);
-		unsigned int blocksize = (dest | 0x3ff) - dest + 1;
-		if (blocksize > len)
-			blocksize = len;
-		while (blocksize) {
-			unsigned int transfersize = blocksize;
-			if (transfersize > max_size)
-				transfersize = max_size;
-			unsigned int res = dap_write_block(ap, dest, src, transfersize,
-											   align);
-			if (res) {
-				DEBUG_WARN("mem_write failed %02x\n", res);
-				ap->dp->fault = 1;
-				return;
+	/* One word transfer per byte, halfword or word, two per double word */
+	unsigned int max_size = ((dbg_get_report_size() - 6) >> (2 - MIN(align, ALIGN_WORD)) & ~3);
+	if (packet_count > 1U) {
+		if (!dap_mem_pipelined(ap, NULL, src, dest, len, align, max_size)) {
+			DEBUG_WARN("mem_write failed\n");
+			ap->dp->fault = 1;
+			return;
+		}
+	} else {
+		while (len) {
+			dap_ap_mem_access_setup(ap, dest, align);
+			unsigned int blocksize = (dest | 0x3ff) - dest + 1;
+			if (blocksize > len)
+				blocksize = len;
+			while (blocksize) {
+				unsigned int transfersize = blocksize;
+				if (transfersize > max_size)
+					transfersize = max_size;
+				unsigned int res = dap_write_block(ap, dest, src, transfersize,
+												   align);
+				if (res) {
+					DEBUG_WARN("mem_write failed %02x\n", res);
+					ap->dp->fault = 1;
+					return;
+				}
+				blocksize -= transfersize;
+				len       -= transfersize;
+				dest      += transfersize;
+				src       += transfersize;
 			}
-			blocksize -= transfersize;
-			len       -= transfersize;
-			dest      += transfersize;
-			src       += transfersize;
 		}
 	}
 
@@ -431,12 +558,19 @@ static void dap_mem_write_sized( ADIv5_AP_t *ap, uint32_t dest, const void *src,
 
 void dap_adiv5_dp_defaults(ADIv5_DP_t *dp)
 {
-	if ((mode == DAP_CAP_JTAG) && dap_jtag_configure())
+	/* A JTAG-DP the probe couldn't take on is driven with DAP_JTAG_Sequence, see dap_jtag_dp_init() */
+	if (mode == DAP_CAP_JTAG && dp->low_access != dap_dp_low_access)
 		return;
 	dp->ap_read  = dap_ap_read;
 	dp->ap_write = dap_ap_write;
 	dp->mem_read = dap_mem_read;
 	dp->mem_write_sized =  dap_mem_write_sized;
+	dp->mem_wait32 = dap_mem_wait32;
+	dp->sequence = dap_sequence;
+	/* Merges runs of register accesses into one DAP_Transfer */
+	dp->queue_write = dap_queue_write;
+	dp->queue_read = dap_queue_read;
+	dp->flush = dap_queue_flush;
 }
 
 static void cmsis_dap_jtagtap_reset(void)
@@ -483,17 +617,26 @@ int cmsis_dap_jtagtap_init(jtag_proc_t *jtag_proc)
 	mode =  DAP_CAP_JTAG;
 	dap_disconnect();
 	dap_connect(true);
+	dap_wait_policy_set();
 	dap_reset_link(true);
 	jtag_proc->jtagtap_reset = cmsis_dap_jtagtap_reset;
 	jtag_proc->jtagtap_next = cmsis_dap_jtagtap_next;
 	jtag_proc->jtagtap_tms_seq = cmsis_dap_jtagtap_tms_seq;
 	jtag_proc->jtagtap_tdi_tdo_seq = cmsis_dap_jtagtap_tdi_tdo_seq;
 	jtag_proc->jtagtap_tdi_seq = cmsis_dap_jtagtap_tdi_seq;
+	jtag_proc->jtagtap_tdi_tdo_seq_deferred = dap_jtagtap_tdi_tdo_seq_deferred;
+	jtag_proc->jtagtap_flush = dap_jtag_flush;
 	return 0;
 }
 
+/*
+ * JTAG-DP accesses go through DAP_Transfer by the DP's index in the chain,
+ * the probe doing the IR and DR scans, once it knows the chain's layout.
+ */
 int dap_jtag_dp_init(ADIv5_DP_t *dp)
 {
+	if (dap_jtag_configure())
+		return false;
 	dp->dp_read = dap_dp_read_reg;
 	dp->error = dap_dp_error;
 	dp->low_access = dap_dp_low_access;
@@ -537,7 +680,7 @@ int dap_swdptap_init(ADIv5_DP_t *dp)
 	if (!(dap_caps & DAP_CAP_SWD))
 		return 1;
 	mode =  DAP_CAP_SWD;
-	dap_transfer_configure(2, 128, 128);
+	dap_wait_policy_set();
 	dap_swd_configure(0);
 	dap_connect(false);
 	dap_led(0, 1);
@@ -554,3 +697,122 @@ int dap_swdptap_init(ADIv5_DP_t *dp)
 	dp->abort = dap_dp_abort;
 	return 0;
 }
+
+static void LIBUSB_CALL dap_swo_transfer_complete(struct libusb_transfer *const transfer)
+{
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+		if (transfer->actual_length)
+			traceswo_decode(transfer->buffer, transfer->actual_length);
+		/* Straight back into the ring while the capture runs */
+		if (swo_transport == DAP_SWO_TRANSPORT_ENDPOINT && libusb_submit_transfer(transfer) == 0)
+			return;
+	} else if (transfer->status != LIBUSB_TRANSFER_CANCELLED)
+		DEBUG_WARN("SWO transfer failed: %d\n", transfer->status);
+	--swo_in_flight;
+}
+
+static bool dap_swo_stream_start(void)
+{
+	for (size_t i = 0; i < SWO_TRANSFER_COUNT; ++i) {
+		if (!swo_transfers[i])
+			swo_transfers[i] = libusb_alloc_transfer(0);
+		if (!swo_transfers[i]) {
+			DEBUG_WARN("libusb_alloc_transfer() failed\n");
+			return false;
+		}
+		libusb_fill_bulk_transfer(swo_transfers[i], usb_handle, swo_ep, swo_buffers[i], SWO_TRANSFER_SIZE,
+			dap_swo_transfer_complete, NULL, 0);
+		const int res = libusb_submit_transfer(swo_transfers[i]);
+		if (res) {
+			DEBUG_WARN("SWO libusb_submit_transfer() failed: %s\n", libusb_strerror(res));
+			return false;
+		}
+		++swo_in_flight;
+	}
+	return true;
+}
+
+static void dap_swo_stream_stop(void)
+{
+	for (size_t i = 0; i < SWO_TRANSFER_COUNT; ++i) {
+		if (swo_transfers[i])
+			libusb_cancel_transfer(swo_transfers[i]);
+	}
+	/* The transfers may only be freed once their cancellation has come back */
+	while (swo_in_flight) {
+		struct timeval timeout = {0, 100000};
+		if (libusb_handle_events_timeout_completed(usb_ctx, &timeout, NULL) < 0)
+			break;
+	}
+	for (size_t i = 0; i < SWO_TRANSFER_COUNT; ++i) {
+		libusb_free_transfer(swo_transfers[i]);
+		swo_transfers[i] = NULL;
+	}
+}
+
+void dap_swo_stop(void)
+{
+	const dap_swo_transport_t transport = swo_transport;
+	if (transport == DAP_SWO_TRANSPORT_NONE)
+		return;
+	/* Clear this first, so completing transfers are not resubmitted */
+	swo_transport = DAP_SWO_TRANSPORT_NONE;
+	dap_swo_control(false);
+	if (transport == DAP_SWO_TRANSPORT_ENDPOINT)
+		dap_swo_stream_stop();
+	dap_swo_mode(DAP_SWO_MODE_OFF);
+}
+
+bool dap_swo_init(const uint32_t baudrate, const uint32_t swo_chan_bitmask)
+{
+	dap_swo_stop();
+	if (!(dap_caps & (DAP_CAP_SWO_UART | DAP_CAP_SWO_MANCHESTER))) {
+		DEBUG_WARN("Probe has no SWO support\n");
+		return false;
+	}
+	/* Stream from the trace endpoint when possible, else poll with DAP_SWO_Data */
+	const dap_swo_transport_t transport =
+		(type == CMSIS_TYPE_BULK && swo_ep && (dap_caps & DAP_CAP_SWO_STREAMING)) ?
+		DAP_SWO_TRANSPORT_ENDPOINT : DAP_SWO_TRANSPORT_DATA_CMD;
+	const dap_swo_mode_t swo_mode = (dap_caps & DAP_CAP_SWO_UART) ? DAP_SWO_MODE_UART : DAP_SWO_MODE_MANCHESTER;
+	if (!dap_swo_transport(transport) || !dap_swo_mode(swo_mode)) {
+		DEBUG_WARN("SWO transport or mode setup failed\n");
+		return false;
+	}
+	const uint32_t actual_baudrate = dap_swo_baudrate(baudrate);
+	if (!actual_baudrate) {
+		DEBUG_WARN("SWO baudrate %" PRIu32 " not supported\n", baudrate);
+		dap_swo_mode(DAP_SWO_MODE_OFF);
+		return false;
+	}
+	traceswo_setmask(swo_chan_bitmask);
+	swo_transport = transport;
+	if ((transport == DAP_SWO_TRANSPORT_ENDPOINT && !dap_swo_stream_start()) || !dap_swo_control(true)) {
+		DEBUG_WARN("SWO capture start failed\n");
+		dap_swo_stop();
+		return false;
+	}
+	DEBUG_INFO("SWO %s capture at %" PRIu32 " baud via %s\n", swo_mode == DAP_SWO_MODE_UART ? "NRZ" : "Manchester",
+		actual_baudrate, transport == DAP_SWO_TRANSPORT_ENDPOINT ? "trace endpoint" : "DAP_SWO_Data");
+	return true;
+}
+
+void dap_swo_poll(void)
+{
+	if (swo_transport == DAP_SWO_TRANSPORT_ENDPOINT) {
+		/* Only run the completions already due, their callbacks decode and resubmit */
+		struct timeval timeout = {0, 0};
+		libusb_handle_events_timeout_completed(usb_ctx, &timeout, NULL);
+	} else if (swo_transport == DAP_SWO_TRANSPORT_DATA_CMD) {
+		uint8_t data[1024];
+		const size_t max_len = MIN(sizeof(data), (size_t)report_size - 5U);
+		/* Keep fetching while the probe fills whole responses, but don't starve GDB */
+		for (size_t i = 0; i < 64U; ++i) {
+			const size_t len = dap_swo_data(data, max_len);
+			if (len)
+				traceswo_decode(data, len);
+			if (len < max_len)
+				break;
+		}
+	}
+}
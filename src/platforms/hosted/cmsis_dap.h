@@ -31,7 +31,11 @@ int dap_swdptap_init(ADIv5_DP_t *dp);
 int dap_jtag_dp_init(ADIv5_DP_t *dp);
 uint32_t dap_swj_clock(uint32_t clock);
 void dap_swd_configure(uint8_t cfg);
+void dap_wait_policy_set(void);
 void dap_nrst_set_val(bool assert);
+bool dap_swo_init(uint32_t baudrate, uint32_t swo_chan_bitmask);
+void dap_swo_stop(void);
+void dap_swo_poll(void);
 #else
 int dap_init(bmp_info_t *info)
 {
@@ -48,7 +52,11 @@ int cmsis_dap_jtagtap_init(jtag_proc_t *jtag_proc) { return -1; }
 int dap_swdptap_init(ADIv5_DP_t *dp) { return -1; }
 int dap_jtag_dp_init(ADIv5_DP_t *dp) { return -1; }
 void dap_swd_configure(uint8_t cfg) { }
+void dap_wait_policy_set(void) { }
 void dap_nrst_set_val(bool assert) { }
+bool dap_swo_init(uint32_t baudrate, uint32_t swo_chan_bitmask) { return false; }
+void dap_swo_stop(void) { }
+void dap_swo_poll(void) { }
 # pragma GCC diagnostic pop
 
 #endif
@@ -57,6 +57,12 @@ enum
 	ID_DAP_JTAG_SEQUENCE      = 0x14,
 	ID_DAP_JTAG_CONFIGURE     = 0x15,
 	ID_DAP_JTAG_IDCODE        = 0x16,
+	ID_DAP_SWO_TRANSPORT      = 0x17,
+	ID_DAP_SWO_MODE           = 0x18,
+	ID_DAP_SWO_BAUDRATE       = 0x19,
+	ID_DAP_SWO_CONTROL        = 0x1A,
+	ID_DAP_SWO_STATUS         = 0x1B,
+	ID_DAP_SWO_DATA           = 0x1C,
 	ID_DAP_SWD_SEQUENCE       = 0x1D,
 };
 
@@ -241,6 +247,19 @@ void dap_transfer_configure(uint8_t idle, uint16_t count, uint16_t retry)
 	dbg_dap_cmd(buf, sizeof(buf), 6);
 }
 
+//-----------------------------------------------------------------------------
+/*
+ * The probe retries WAITs itself, back to back, so adiv5_wait_policy's timeout
+ * becomes a retry count at the SWJ clock, each retry taking about 13 cycles.
+ * Backoff and adaptive idle cycles aren't available, and the idle cycles keep
+ * the 2 that were always used as their minimum.
+ */
+void dap_wait_policy_set(void)
+{
+	const uint32_t retries = (uint32_t)((uint64_t)adiv5_wait_policy.timeout_ms * swj_clock / 13000U);
+	dap_transfer_configure(MAX(adiv5_wait_policy.idle_cycles, 2U), 128, MIN(MAX(retries, 128U), UINT16_MAX));
+}
+
 //-----------------------------------------------------------------------------
 void dap_swd_configure(uint8_t cfg)
 {
@@ -270,6 +289,71 @@ size_t dap_info(const dap_info_t info, uint8_t *const data, const size_t size)
 	return rsize;
 }
 
+//-----------------------------------------------------------------------------
+bool dap_swo_transport(const dap_swo_transport_t transport)
+{
+	uint8_t buf[2];
+
+	buf[0] = ID_DAP_SWO_TRANSPORT;
+	buf[1] = transport;
+	dbg_dap_cmd(buf, sizeof(buf), 2);
+	return buf[0] == DAP_OK;
+}
+
+//-----------------------------------------------------------------------------
+bool dap_swo_mode(const dap_swo_mode_t swo_mode)
+{
+	uint8_t buf[2];
+
+	buf[0] = ID_DAP_SWO_MODE;
+	buf[1] = swo_mode;
+	dbg_dap_cmd(buf, sizeof(buf), 2);
+	return buf[0] == DAP_OK;
+}
+
+/* Returns the baudrate the probe actually uses, or 0 if it can't do it */
+uint32_t dap_swo_baudrate(const uint32_t baudrate)
+{
+	uint8_t buf[5];
+
+	buf[0] = ID_DAP_SWO_BAUDRATE;
+	buf[1] = baudrate & 0xff;
+	buf[2] = (baudrate >> 8) & 0xff;
+	buf[3] = (baudrate >> 16) & 0xff;
+	buf[4] = (baudrate >> 24) & 0xff;
+	dbg_dap_cmd(buf, sizeof(buf), 5);
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+//-----------------------------------------------------------------------------
+bool dap_swo_control(const bool start)
+{
+	uint8_t buf[2];
+
+	buf[0] = ID_DAP_SWO_CONTROL;
+	buf[1] = start ? 1 : 0;
+	dbg_dap_cmd(buf, sizeof(buf), 2);
+	return buf[0] == DAP_OK;
+}
+
+/* Fetches captured trace data through the command endpoint, returning its length */
+size_t dap_swo_data(uint8_t *const data, const size_t size)
+{
+	uint8_t buf[1024];
+	/* Status and count come first in the response */
+	const size_t count = MIN(MIN(size, sizeof(buf) - 4U), (size_t)dbg_get_report_size() - 5U);
+
+	buf[0] = ID_DAP_SWO_DATA;
+	buf[1] = count & 0xff;
+	buf[2] = (count >> 8) & 0xff;
+	dbg_dap_cmd(buf, sizeof(buf), 3);
+	if (buf[0] & (DAP_SWO_STATUS_ERROR | DAP_SWO_STATUS_OVERRUN))
+		DEBUG_WARN("SWO capture lost data\n");
+	const size_t len = MIN((size_t)(buf[1] | (buf[2] << 8)), count);
+	memcpy(data, buf + 3, len);
+	return len;
+}
+
 void dap_reset_pin(int state)
 {
 	uint8_t buf[7];
@@ -303,7 +387,7 @@ void dap_trst_reset(void)
 	dbg_dap_cmd(buf, sizeof(buf), 7);
 }
 
-static void dap_line_reset(void)
+void dap_line_reset(void)
 {
 	uint8_t buf[] = {
 		ID_DAP_SWJ_SEQUENCE,
@@ -397,31 +481,29 @@ void dap_write_reg(ADIv5_DP_t *dp, uint8_t reg, uint32_t data)
 	}
 }
 
-unsigned int dap_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src,
-							size_t len, enum align align)
+/* Block transfers count DRW beats, a double word takes two */
+size_t dap_read_block_request(ADIv5_AP_t *ap, uint8_t *buf, size_t len, enum align align)
 {
-	uint8_t buf[1024];
-	unsigned int sz = len >> align;
-	uint8_t dap_index = 0;
-	dap_index = ap->dp->dp_jd_index;
-    buf[0] = ID_DAP_TRANSFER_BLOCK;
-    buf[1] = dap_index;
-    buf[2] =  sz & 0xff;
-    buf[3] = (sz >> 8) & 0xff;
-    buf[4] = SWD_AP_DRW | DAP_TRANSFER_RnW;
-    dbg_dap_cmd(buf, 1023, 5);
+	unsigned int sz = len >> MIN(align, ALIGN_WORD);
+	buf[0] = ID_DAP_TRANSFER_BLOCK;
+	buf[1] = ap->dp->dp_jd_index;
+	buf[2] = sz & 0xff;
+	buf[3] = (sz >> 8) & 0xff;
+	buf[4] = SWD_AP_DRW | DAP_TRANSFER_RnW;
+	return 5;
+}
+
+unsigned int dap_read_block_response(const uint8_t *buf, void *dest, uint32_t src, size_t len, enum align align)
+{
+	unsigned int sz = len >> MIN(align, ALIGN_WORD);
 	unsigned int transferred = buf[0] + (buf[1] << 8);
-	if (buf[2] >= DAP_TRANSFER_FAULT) {
-		DEBUG_WARN("dap_read_block @ %08" PRIx32 " fault -> line reset\n", src);
-		dap_line_reset();
-	}
 	if (sz != transferred)
 		return 1;
 
 	if (align > ALIGN_HALFWORD)
 		memcpy(dest, &buf[3], len);
 	else {
-		uint32_t *p = (uint32_t *)&buf[3];
+		const uint32_t *p = (const uint32_t *)&buf[3];
 		while(sz) {
 			dest = extract(dest, src, *p, align);
 			p++;
@@ -432,18 +514,27 @@ unsigned int dap_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src,
 	return (buf[2] > DAP_TRANSFER_WAIT) ? 1 : 0;
 }
 
-unsigned int dap_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src,
-							 size_t len, enum align align)
+unsigned int dap_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src,
+							size_t len, enum align align)
 {
 	uint8_t buf[1024];
-	unsigned int sz = len >> align;
-	uint8_t dap_index = 0;
-	dap_index = ap->dp->dp_jd_index;
-    buf[0] = ID_DAP_TRANSFER_BLOCK;
-    buf[1] = dap_index;
-    buf[2] =  sz & 0xff;
-    buf[3] = (sz >> 8) & 0xff;
-    buf[4] = SWD_AP_DRW;
+	dbg_dap_cmd(buf, 1023, dap_read_block_request(ap, buf, len, align));
+	if (buf[2] >= DAP_TRANSFER_FAULT) {
+		DEBUG_WARN("dap_read_block @ %08" PRIx32 " fault -> line reset\n", src);
+		dap_line_reset();
+	}
+	return dap_read_block_response(buf, dest, src, len, align);
+}
+
+size_t dap_write_block_request(
+	ADIv5_AP_t *ap, uint8_t *buf, uint32_t dest, const void *src, size_t len, enum align align)
+{
+	unsigned int sz = len >> MIN(align, ALIGN_WORD);
+	buf[0] = ID_DAP_TRANSFER_BLOCK;
+	buf[1] = ap->dp->dp_jd_index;
+	buf[2] = sz & 0xff;
+	buf[3] = (sz >> 8) & 0xff;
+	buf[4] = SWD_AP_DRW;
 	if (align > ALIGN_HALFWORD)
 		memcpy(&buf[5], src, len);
 	else {
@@ -463,11 +554,196 @@ unsigned int dap_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 			*p++ = tmp;
 		}
 	}
-	dbg_dap_cmd(buf, 1023, 5 + (sz << 2U));
+	return 5 + (sz << 2U);
+}
+
+unsigned int dap_write_block_response(const uint8_t *buf)
+{
+	return (buf[2] > DAP_TRANSFER_WAIT) ? 1 : 0;
+}
+
+unsigned int dap_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src,
+							 size_t len, enum align align)
+{
+	uint8_t buf[1024];
+	dbg_dap_cmd(buf, 1023, dap_write_block_request(ap, buf, dest, src, len, align));
 	if (buf[2] > DAP_TRANSFER_FAULT) {
 		dap_line_reset();
 	}
-	return (buf[2] > DAP_TRANSFER_WAIT) ? 1 : 0;
+	return dap_write_block_response(buf);
+}
+
+/*
+ * Register accesses queued up for a single DAP_Transfer. Read results are
+ * only stored once the queue is flushed, which happens when the command is
+ * full or when the caller needs a result.
+ */
+#define DAP_QUEUE_MAX_TRANSFERS 255U
+
+static uint8_t queue_request[1024] = {ID_DAP_TRANSFER};
+static size_t queue_len = 3;
+static size_t queue_count;
+static size_t queue_reads;
+static uint32_t *queue_dest[DAP_QUEUE_MAX_TRANSFERS];
+
+static inline uint8_t dap_transfer_reg(uint16_t addr)
+{
+	return (addr & 0x0c) | ((addr & ADIV5_APnDP) ? DAP_TRANSFER_APnDP : 0);
+}
+
+/* Make room for a transfer with data_len bytes of data, flushing the queue as needed */
+static void dap_queue_reserve(ADIv5_DP_t *dp, size_t data_len, bool read)
+{
+	const size_t packet_size = dbg_get_report_size() - 1;
+	/* The response carries the command, transfer count and response ahead of the read data */
+	if (queue_count == DAP_QUEUE_MAX_TRANSFERS || queue_len + 1U + data_len > packet_size ||
+		(read && 3U + 4U * (queue_reads + 1U) > packet_size) ||
+		(queue_count && queue_request[1] != dp->dp_jd_index))
+		dap_queue_flush(dp);
+	queue_request[1] = dp->dp_jd_index;
+}
+
+void dap_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
+{
+	dap_queue_reserve(dp, 4U, false);
+	uint8_t *p = queue_request + queue_len;
+	*p++ = dap_transfer_reg(addr);
+	*p++ = (value >>  0) & 0xff;
+	*p++ = (value >>  8) & 0xff;
+	*p++ = (value >> 16) & 0xff;
+	*p++ = (value >> 24) & 0xff;
+	queue_len = p - queue_request;
+	queue_dest[queue_count++] = NULL;
+}
+
+void dap_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value)
+{
+	dap_queue_reserve(dp, 0, true);
+	queue_request[queue_len++] = dap_transfer_reg(addr) | DAP_TRANSFER_RnW;
+	*value = 0;
+	queue_dest[queue_count++] = value;
+	++queue_reads;
+}
+
+bool dap_queue_flush(ADIv5_DP_t *dp)
+{
+	if (!queue_count)
+		return !dp->fault;
+	uint8_t buf[1024];
+	queue_request[2] = queue_count;
+	memcpy(buf, queue_request, queue_len);
+	dbg_dap_cmd(buf, sizeof(buf), queue_len);
+	/* Reads that did complete still get their value */
+	const size_t done = MIN(buf[0], queue_count);
+	const uint8_t *data = &buf[2];
+	for (size_t i = 0; i < done; ++i) {
+		if (!queue_dest[i])
+			continue;
+		*queue_dest[i] = ((uint32_t)data[3] << 24) | ((uint32_t)data[2] << 16) |
+			((uint32_t)data[1] << 8) | (uint32_t)data[0];
+		data += 4;
+	}
+	if (done != queue_count || buf[1] != DAP_TRANSFER_OK) {
+		DEBUG_WARN("dap_queue_flush %zu of %zu transfers done, response %02x\n", done, queue_count, buf[1]);
+		dp->fault = 1;
+		if (buf[1] & DAP_TRANSFER_ERROR)
+			dap_line_reset();
+	}
+	queue_len = 3;
+	queue_count = 0;
+	queue_reads = 0;
+	return !dp->fault;
+}
+
+/*
+ * Register steps go through the queue, so a run of them costs a single
+ * DAP_Transfer. Memory steps, waits and delays flush it and run as usual.
+ */
+bool dap_sequence(ADIv5_AP_t *ap, adiv5_seq_op_t *ops, size_t count)
+{
+	ADIv5_DP_t *const dp = ap->dp;
+	for (size_t i = 0; i < count; ++i) {
+		adiv5_seq_op_t *const op = &ops[i];
+		switch (op->type) {
+		case ADIV5_SEQ_DP_READ:
+			dap_queue_read(dp, op->addr, &op->value);
+			break;
+		case ADIV5_SEQ_DP_WRITE:
+			dap_queue_write(dp, op->addr, op->value);
+			break;
+		case ADIV5_SEQ_AP_READ:
+			dap_queue_write(dp, ADIV5_DP_SELECT, ((uint32_t)ap->apsel << 24U) | (op->addr & 0xf0U));
+			dap_queue_read(dp, op->addr | ADIV5_APnDP, &op->value);
+			break;
+		case ADIV5_SEQ_AP_WRITE:
+			dap_queue_write(dp, ADIV5_DP_SELECT, ((uint32_t)ap->apsel << 24U) | (op->addr & 0xf0U));
+			dap_queue_write(dp, op->addr | ADIV5_APnDP, op->value);
+			break;
+		default:
+			if (!dap_queue_flush(dp) || !firmware_sequence(ap, op, 1))
+				return false;
+			break;
+		}
+	}
+	return dap_queue_flush(dp);
+}
+
+/*
+ * DAP_Transfer can repeat a read on the probe until the value matches, which
+ * covers waiting on a single busy bit. Anything else is polled from here.
+ */
+uint32_t dap_mem_wait32(ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t busy_value, uint32_t timeout_ms)
+{
+	if (__builtin_popcount(mask) != 1 || (busy_value & ~mask))
+		return firmware_mem_wait32(ap, addr, mask, busy_value, timeout_ms);
+	const uint32_t match = busy_value ^ mask;
+	const uint32_t csw = ap->csw | ADIV5_AP_CSW_SIZE_WORD | ADIV5_AP_CSW_ADDRINC_NONE;
+	const struct {
+		uint8_t request;
+		uint32_t value;
+	} transfers[] = {
+		{SWD_DP_W_SELECT, ((uint32_t)ap->apsel << 24U) | (ADIV5_AP_CSW & 0xf0U)},
+		{SWD_AP_CSW, csw},
+		{SWD_AP_TAR, addr},
+		{DAP_TRANSFER_MATCH_MASK, mask},
+		{SWD_AP_DRW | DAP_TRANSFER_RnW | DAP_TRANSFER_MATCH_VALUE, match},
+		{SWD_AP_DRW | DAP_TRANSFER_RnW, 0},
+	};
+	const size_t count = sizeof(transfers) / sizeof(transfers[0]);
+	uint8_t request[64], *p = request;
+	*p++ = ID_DAP_TRANSFER;
+	*p++ = ap->dp->dp_jd_index;
+	*p++ = count;
+	for (size_t i = 0; i < count; ++i) {
+		*p++ = transfers[i].request;
+		if (transfers[i].request & DAP_TRANSFER_RnW && !(transfers[i].request & DAP_TRANSFER_MATCH_VALUE))
+			continue;
+		*p++ = (transfers[i].value >>  0) & 0xff;
+		*p++ = (transfers[i].value >>  8) & 0xff;
+		*p++ = (transfers[i].value >> 16) & 0xff;
+		*p++ = (transfers[i].value >> 24) & 0xff;
+	}
+
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, timeout_ms);
+	do {
+		uint8_t buf[64];
+		memcpy(buf, request, p - request);
+		dbg_dap_cmd(buf, sizeof(buf), p - request);
+		if (buf[0] == count && buf[1] == DAP_TRANSFER_OK)
+			return ((uint32_t)buf[5] << 24) | ((uint32_t)buf[4] << 16) | ((uint32_t)buf[3] << 8) | (uint32_t)buf[2];
+		/* Still busy after the probe's match retries, try again until the timeout */
+		if ((buf[1] & 7U) != DAP_TRANSFER_OK || !(buf[1] & DAP_TRANSFER_MISMATCH)) {
+			DEBUG_WARN("dap_mem_wait32 @ %08" PRIx32 " failed, response %02x\n", addr, buf[1]);
+			ap->dp->fault = 1;
+			if (buf[1] & DAP_TRANSFER_ERROR)
+				dap_line_reset();
+			return busy_value;
+		}
+	} while (!platform_timeout_is_expired(&timeout));
+	uint32_t value = 0;
+	dap_read_single(ap, &value, addr, ALIGN_WORD);
+	return value;
 }
 
 //-----------------------------------------------------------------------------
@@ -532,10 +808,12 @@ static uint8_t *mem_access_setup(ADIv5_AP_t *ap, uint8_t *p,
 	case ALIGN_HALFWORD:
 		csw |= ADIV5_AP_CSW_SIZE_HALFWORD;
 		break;
-	case ALIGN_DWORD:
 	case ALIGN_WORD:
 		csw |= ADIV5_AP_CSW_SIZE_WORD;
 		break;
+	case ALIGN_DWORD:
+		csw |= ADIV5_AP_CSW_SIZE_DWORD;
+		break;
 	}
 	uint8_t dap_index = 0;
 	dap_index = ap->dp->dp_jd_index;
@@ -567,6 +845,17 @@ void dap_ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align)
 	dbg_dap_cmd(buf, sizeof(buf), p - buf);
 }
 
+size_t dap_ap_mem_access_setup_request(ADIv5_AP_t *ap, uint8_t *buf, uint32_t addr, enum align align)
+{
+	return mem_access_setup(ap, buf, addr, align) - buf;
+}
+
+/* Returns true if all three transfers of the setup went through */
+bool dap_ap_mem_access_setup_response(const uint8_t *buf)
+{
+	return buf[0] == 3 && buf[1] == DAP_TRANSFER_OK;
+}
+
 uint32_t dap_ap_read(ADIv5_AP_t *ap, uint16_t addr)
 {
 	DEBUG_PROBE("dap_ap_read_start addr %x\n", addr);
@@ -655,99 +944,149 @@ void dap_write_single(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 	dbg_dap_cmd(buf, sizeof(buf), p - buf);
 }
 
-void dap_jtagtap_tdi_tdo_seq(
-	uint8_t *data_out, bool const final_tms, const uint8_t *tms, const uint8_t *data_in, size_t ticks)
+/*
+ * JTAG sequences are collected into one DAP_JTAG_Sequence command, each with
+ * a note of where its captured TDO goes. Deferred scans leave the command
+ * open until dap_jtag_flush(), along with anything else that captures
+ * nothing, so a whole run of scans costs a single round trip.
+ */
+#define DAP_JTAG_MAX_SEQUENCES 255U
+#define DAP_JTAG_MAX_CAPTURES  64U
+
+typedef struct dap_jtag_capture {
+	uint8_t *data_out;
+	uint8_t bit;
+	uint8_t count;
+} dap_jtag_capture_t;
+
+static uint8_t jtag_seq_buf[1024];
+static size_t jtag_seq_len;
+static size_t jtag_seq_count;
+static size_t jtag_seq_reply_len;
+static dap_jtag_capture_t jtag_seq_captures[DAP_JTAG_MAX_CAPTURES];
+static size_t jtag_seq_capture_count;
+static bool jtag_seq_deferred;
+
+static void dap_jtag_seq_send(void)
 {
-	DEBUG_PROBE("dap_jtagtap_tdi_tdo_seq %s %d ticks\n", final_tms ? "final" : "", ticks);
-	uint8_t buf[64];
-	const uint8_t *din = data_in;
-	uint8_t *dout = data_out;
-	if (!tms) {
-		int last_byte = last_byte = (ticks - 1) >> 3;
-		int last_bit = (ticks - 1) & 7;
-		if (final_tms)
-			ticks--;
-		while (ticks) {
-			int transfers = ticks;
-			if (transfers > 64)
-				transfers = 64;
-			uint8_t *p = buf;
-			*p++ = ID_DAP_JTAG_SEQUENCE;
-			*p++ = 1;
-			*p++ = ((transfers == 64) ? 0 : transfers) | ((data_out) ? DAP_JTAG_TDO_CAPTURE : 0);
-			int n_di_bytes = (transfers + 7) >> 3;
-			if (din) {
-				p = memcpy(p, din, n_di_bytes);
-				din += n_di_bytes;
-			} else {
-				p = memset(p, 0xff, n_di_bytes);
-			}
-			p += n_di_bytes;
-			dbg_dap_cmd(buf, sizeof(buf), p - buf);
-			if (buf[0] != DAP_OK)
-				DEBUG_WARN("dap_jtagtap_tdi_tdo_seq failed %02x\n", buf[0]);
-			if (dout) {
-				memcpy(dout, &buf[1], (transfers + 7) >> 3);
-				dout += (transfers + 7) >> 3;
-			}
-			ticks -= transfers;
-		}
-		if (final_tms) {
-			uint8_t *p = buf;
-			*p++ = ID_DAP_JTAG_SEQUENCE;
-			*p++ = 1;
-			*p++ = 1 | ((dout) ? DAP_JTAG_TDO_CAPTURE : 0) | DAP_JTAG_TMS;
-			if (din) {
-				*p++ = ((data_in[last_byte] & (1 << last_bit)) ? 1 : 0);
-			} else {
-				*p++ = 0;
-			}
-			dbg_dap_cmd(buf, sizeof(buf), p - buf);
-			if (buf[0] == DAP_ERROR)
-				DEBUG_WARN("dap_jtagtap_tdi_tdo_seq failed %02x\n", buf[0]);
-			if (dout) {
-				if (buf[1] & 1)
-					data_out[last_byte] |= (1 << last_bit);
+	if (!jtag_seq_count)
+		return;
+	jtag_seq_buf[0] = ID_DAP_JTAG_SEQUENCE;
+	jtag_seq_buf[1] = jtag_seq_count;
+	dbg_dap_cmd(jtag_seq_buf, sizeof(jtag_seq_buf), 2U + jtag_seq_len);
+	if (jtag_seq_buf[0] != DAP_OK)
+		DEBUG_WARN("dap_jtagtap_tdi_tdo_seq failed %02x\n", jtag_seq_buf[0]);
+
+	const uint8_t *tdo = jtag_seq_buf + 1U;
+	for (size_t i = 0; i < jtag_seq_capture_count; ++i) {
+		const dap_jtag_capture_t *const capture = &jtag_seq_captures[i];
+		if (!capture->bit)
+			memcpy(capture->data_out, tdo, (capture->count + 7U) >> 3U);
+		else {
+			for (size_t bit = 0; bit < capture->count; ++bit) {
+				const size_t out_bit = capture->bit + bit;
+				if (tdo[bit >> 3U] & (1U << (bit & 7U)))
+					capture->data_out[out_bit >> 3U] |= 1U << (out_bit & 7U);
 				else
-					data_out[last_byte] &= ~(1 << last_bit);
+					capture->data_out[out_bit >> 3U] &= ~(1U << (out_bit & 7U));
 			}
 		}
-	} else {
-		while (ticks) {
-			uint8_t *p = buf;
-			int transfers = ticks;
-			if (transfers > 64)
-				transfers = 64;
-			p = buf;
-			*p++ = ID_DAP_JTAG_SEQUENCE;
-			*p++ = transfers;
-			for (int i = 0; i < transfers; i++) {
-				*p++ =
-					1 | ((data_out) ? DAP_JTAG_TDO_CAPTURE : 0) | ((tms[i >> 3] & (1 << (i & 7))) ? DAP_JTAG_TMS : 0);
-				if (data_in)
-					*p++ = (data_in[i >> 3] & (1 << (i & 7))) ? 1 : 0;
-				else
-					*p++ = 1;
-			}
-			dbg_dap_cmd(buf, sizeof(buf), p - buf);
-			if (buf[0] == DAP_ERROR)
-				DEBUG_WARN("dap_jtagtap_tdi_tdo_seq failed %02x\n", buf[0]);
-			if (data_out) {
-				for (int i = 0; i < transfers; i++) {
-					if (buf[i + 1])
-						data_out[i >> 3] |= (1 << (i & 7));
-					else
-						data_out[i >> 3] &= ~(1 << (i & 7));
-				}
-			}
-			ticks -= transfers;
+		tdo += (capture->count + 7U) >> 3U;
+	}
+	jtag_seq_len = 0;
+	jtag_seq_count = 0;
+	jtag_seq_reply_len = 0;
+	jtag_seq_capture_count = 0;
+}
+
+/* Add a sequence of up to 64 clocks, capturing to data_out from the given bit on if info asks for it */
+static void dap_jtag_seq_add(const uint8_t info, const uint8_t *const data_in, uint8_t *const data_out, const uint8_t bit)
+{
+	const size_t ticks = (info & 0x3fU) ? (info & 0x3fU) : 64U;
+	const size_t bytes = (ticks + 7U) >> 3U;
+	const size_t packet_size = MIN((size_t)dbg_get_report_size() - 1U, sizeof(jtag_seq_buf));
+	const bool capture = info & DAP_JTAG_TDO_CAPTURE;
+	if (jtag_seq_count == DAP_JTAG_MAX_SEQUENCES || 2U + jtag_seq_len + 1U + bytes > packet_size ||
+		(capture && (jtag_seq_capture_count == DAP_JTAG_MAX_CAPTURES || 1U + jtag_seq_reply_len + bytes > packet_size)))
+		dap_jtag_seq_send();
+
+	uint8_t *const p = jtag_seq_buf + 2U + jtag_seq_len;
+	p[0] = info;
+	if (data_in)
+		memcpy(p + 1U, data_in, bytes);
+	else
+		memset(p + 1U, 0xff, bytes);
+	jtag_seq_len += 1U + bytes;
+	++jtag_seq_count;
+	if (capture) {
+		dap_jtag_capture_t *const entry = &jtag_seq_captures[jtag_seq_capture_count++];
+		entry->data_out = data_out;
+		entry->bit = bit;
+		entry->count = ticks;
+		jtag_seq_reply_len += bytes;
+	}
+}
+
+static void dap_jtag_seq_queue(
+	uint8_t *const data_out, const bool final_tms, const uint8_t *const tms, const uint8_t *const data_in, size_t ticks)
+{
+	if (!ticks)
+		return;
+	const uint8_t capture = data_out ? DAP_JTAG_TDO_CAPTURE : 0;
+	if (tms) {
+		/* TMS only stays the same for a whole sequence, so this takes one per clock */
+		for (size_t i = 0; i < ticks; ++i) {
+			const uint8_t tdi = data_in ? (data_in[i >> 3U] >> (i & 7U)) & 1U : 1U;
+			const uint8_t tms_bit = (tms[i >> 3U] & (1U << (i & 7U))) ? DAP_JTAG_TMS : 0;
+			dap_jtag_seq_add(1U | capture | tms_bit, &tdi, data_out ? data_out + (i >> 3U) : NULL, i & 7U);
 		}
+		return;
+	}
+
+	const size_t last = ticks - 1U;
+	if (final_tms)
+		--ticks;
+	for (size_t offset = 0; offset < ticks; offset += 64U) {
+		const size_t chunk = MIN(ticks - offset, 64U);
+		dap_jtag_seq_add((chunk == 64U ? 0U : chunk) | capture, data_in ? data_in + (offset >> 3U) : NULL,
+			data_out ? data_out + (offset >> 3U) : NULL, 0);
 	}
+	if (final_tms) {
+		const uint8_t tdi = data_in ? (data_in[last >> 3U] >> (last & 7U)) & 1U : 0U;
+		dap_jtag_seq_add(
+			1U | capture | DAP_JTAG_TMS, &tdi, data_out ? data_out + (last >> 3U) : NULL, last & 7U);
+	}
+}
+
+void dap_jtagtap_tdi_tdo_seq(
+	uint8_t *data_out, bool const final_tms, const uint8_t *tms, const uint8_t *data_in, size_t ticks)
+{
+	DEBUG_PROBE("dap_jtagtap_tdi_tdo_seq %s %zu ticks\n", final_tms ? "final" : "", ticks);
+	dap_jtag_seq_queue(data_out, final_tms, tms, data_in, ticks);
+	if (data_out || !jtag_seq_deferred)
+		dap_jtag_seq_send();
+}
+
+void dap_jtagtap_tdi_tdo_seq_deferred(uint8_t *data_out, const bool final_tms, const uint8_t *data_in, size_t ticks)
+{
+	DEBUG_PROBE("dap_jtagtap_tdi_tdo_seq_deferred %s %zu ticks\n", final_tms ? "final" : "", ticks);
+	dap_jtag_seq_queue(data_out, final_tms, NULL, data_in, ticks);
+	jtag_seq_deferred = true;
+}
+
+void dap_jtag_flush(void)
+{
+	dap_jtag_seq_send();
+	jtag_seq_deferred = false;
 }
 
+/*
+ * Tell the probe the IR lengths of the chain, which DAP_Transfer needs to
+ * reach a JTAG-DP by its index. Fails if the probe can't handle the chain.
+ */
 int dap_jtag_configure(void)
 {
-	uint8_t buf[64], *p = &buf[2];
+	uint8_t buf[JTAG_MAX_DEVS + 2U], *p = &buf[2];
 	uint32_t i = 0;
 	for (; i < jtag_dev_count; i++) {
 		struct jtag_dev_s *jtag_dev = &jtag_devs[i];
@@ -756,14 +1095,32 @@ int dap_jtag_configure(void)
 	}
 	if ((!i || i >= JTAG_MAX_DEVS))
 		return -1;
-	buf[0] = 0x15;
+	buf[0] = ID_DAP_JTAG_CONFIGURE;
 	buf[1] = i;
 	dbg_dap_cmd(buf, sizeof(buf), p - buf);
-	if (buf[0] != DAP_OK)
+	if (buf[0] != DAP_OK) {
 		DEBUG_WARN("dap_jtag_configure Failed %02x\n", buf[0]);
+		return -1;
+	}
 	return 0;
 }
 
+/* ABORT is a DP register for SWD but has its own IR for JTAG, the probe takes care of either */
+void dap_write_abort(ADIv5_DP_t *dp, uint32_t abort)
+{
+	uint8_t buf[6] = {
+		ID_DAP_WRITE_ABORT,
+		dp->dp_jd_index,
+		abort & 0xff,
+		(abort >> 8) & 0xff,
+		(abort >> 16) & 0xff,
+		(abort >> 24) & 0xff,
+	};
+	dbg_dap_cmd(buf, sizeof(buf), sizeof(buf));
+	if (buf[0] != DAP_OK)
+		DEBUG_WARN("dap_write_abort failed %02x\n", buf[0]);
+}
+
 void dap_swdptap_seq_out(uint32_t tms_states, size_t clock_cycles)
 {
 	/* clang-format off */
@@ -58,12 +58,35 @@ typedef enum dap_cap_e {
 	DAP_CAP_SWO_STREAMING = (1 << 6),
 } dap_cap_t;
 
+typedef enum dap_swo_transport_e {
+	DAP_SWO_TRANSPORT_NONE = 0,
+	DAP_SWO_TRANSPORT_DATA_CMD = 1,
+	DAP_SWO_TRANSPORT_ENDPOINT = 2,
+} dap_swo_transport_t;
+
+typedef enum dap_swo_mode_e {
+	DAP_SWO_MODE_OFF = 0,
+	DAP_SWO_MODE_UART = 1,
+	DAP_SWO_MODE_MANCHESTER = 2,
+} dap_swo_mode_t;
+
+/* Trace status bits returned by DAP_SWO_Status and DAP_SWO_Data */
+#define DAP_SWO_STATUS_ACTIVE (1U << 0)
+#define DAP_SWO_STATUS_ERROR  (1U << 6)
+#define DAP_SWO_STATUS_OVERRUN (1U << 7)
+
 void dap_led(int index, int state);
 void dap_connect(bool jtag);
 void dap_disconnect(void);
 void dap_transfer_configure(uint8_t idle, uint16_t count, uint16_t retry);
+void dap_wait_policy_set(void);
 void dap_swd_configure(uint8_t cfg);
 size_t dap_info(dap_info_t info, uint8_t *data, size_t size);
+bool dap_swo_transport(dap_swo_transport_t transport);
+bool dap_swo_mode(dap_swo_mode_t swo_mode);
+uint32_t dap_swo_baudrate(uint32_t baudrate);
+bool dap_swo_control(bool start);
+size_t dap_swo_data(uint8_t *data, size_t size);
 void dap_reset_target(void);
 void dap_nrst_set_val(bool assert);
 void dap_trst_reset(void);
@@ -72,17 +95,39 @@ void dap_reset_pin(int state);
 uint32_t dap_read_reg(ADIv5_DP_t *dp, uint8_t reg);
 void dap_write_reg(ADIv5_DP_t *dp, uint8_t reg, uint32_t data);
 void dap_reset_link(bool jtag);
+void dap_line_reset(void);
+void dap_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value);
+void dap_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value);
+bool dap_queue_flush(ADIv5_DP_t *dp);
+bool dap_sequence(ADIv5_AP_t *ap, adiv5_seq_op_t *ops, size_t count);
+uint32_t dap_mem_wait32(ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t busy_value, uint32_t timeout_ms);
 uint32_t dap_read_idcode(ADIv5_DP_t *dp);
 unsigned int dap_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len, enum align align);
 unsigned int dap_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align);
 void dap_ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align);
+/*
+ * Request and response halves of the above, for keeping several commands in
+ * flight. The responses only report errors, recovering is up to the caller.
+ */
+size_t dap_read_block_request(ADIv5_AP_t *ap, uint8_t *buf, size_t len, enum align align);
+unsigned int dap_read_block_response(const uint8_t *buf, void *dest, uint32_t src, size_t len, enum align align);
+size_t dap_write_block_request(
+	ADIv5_AP_t *ap, uint8_t *buf, uint32_t dest, const void *src, size_t len, enum align align);
+unsigned int dap_write_block_response(const uint8_t *buf);
+size_t dap_ap_mem_access_setup_request(ADIv5_AP_t *ap, uint8_t *buf, uint32_t addr, enum align align);
+bool dap_ap_mem_access_setup_response(const uint8_t *buf);
 uint32_t dap_ap_read(ADIv5_AP_t *ap, uint16_t addr);
 void dap_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value);
 void dap_read_single(ADIv5_AP_t *ap, void *dest, uint32_t src, enum align align);
 void dap_write_single(ADIv5_AP_t *ap, uint32_t dest, const void *src, enum align align);
 int dbg_dap_cmd(uint8_t *data, int size, int rsize);
+int dbg_get_report_size(void);
 void dap_jtagtap_tdi_tdo_seq(uint8_t *data_out, bool final_tms, const uint8_t *tms, const uint8_t *data_in, size_t clock_cycles);
+/* As above without TMS, data_out is only written at dap_jtag_flush() */
+void dap_jtagtap_tdi_tdo_seq_deferred(uint8_t *data_out, bool final_tms, const uint8_t *data_in, size_t clock_cycles);
+void dap_jtag_flush(void);
 int dap_jtag_configure(void);
+void dap_write_abort(ADIv5_DP_t *dp, uint32_t abort);
 void dap_swdptap_seq_out(uint32_t tms_states, size_t clock_cycles);
 void dap_swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles);
 
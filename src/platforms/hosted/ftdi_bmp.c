@@ -35,6 +35,26 @@ struct ftdi_context *ftdic;
 static uint8_t outbuf[BUF_SIZE];
 static uint16_t bufptr = 0;
 
+/*
+ * Deferred scans only queue their commands, the TDO stays in the FTDI until
+ * libftdi_jtagtap_flush() reads it back for all of them at once. The chip
+ * stalls rather than drops data once its transmit buffer is full, and the
+ * smaller parts only have a few hundred bytes of that, so the reply is kept
+ * under that. That and the number of scans are the limits for one flush.
+ */
+#define LIBFTDI_JTAG_DEFER_MAX   64U
+#define LIBFTDI_JTAG_DEFER_BYTES 256U
+
+typedef struct libftdi_deferred_scan {
+	uint8_t *data_out;
+	size_t ticks;
+	bool final_tms;
+} libftdi_deferred_scan_t;
+
+static libftdi_deferred_scan_t deferred_scans[LIBFTDI_JTAG_DEFER_MAX];
+static size_t deferred_count = 0;
+static size_t deferred_bytes = 0;
+
 cable_desc_t *active_cable;
 data_desc_t active_state;
 
@@ -606,6 +626,9 @@ size_t libftdi_buffer_write(const uint8_t *data, size_t size)
 
 int libftdi_buffer_read(uint8_t *data, int size)
 {
+	/* Replies come back in order, so those of deferred scans have to be read first */
+	if (deferred_count)
+		libftdi_jtagtap_flush();
 #if defined(USE_USB_VERSION_BIT)
 	struct ftdi_transfer_control *tc;
 	outbuf[bufptr++] = SEND_IMMEDIATE;
@@ -629,23 +652,17 @@ int libftdi_buffer_read(uint8_t *data, int size)
 	return size;
 }
 
-void libftdi_jtagtap_tdi_tdo_seq(uint8_t *DO, const bool final_tms, const uint8_t *DI, size_t ticks)
+/* Queue the MPSSE commands for a scan, returning how many bytes of TDO it reads back */
+static int libftdi_jtagtap_tdi_tdo_cmd(const bool capture, const bool final_tms, const uint8_t *DI, size_t ticks)
 {
 	int rsize, rticks;
 
-	if (!ticks)
-		return;
-	if (!DI && !DO)
-		return;
-
-	DEBUG_WIRE("libftdi_jtagtap_tdi_tdo_seq %s ticks: %d\n",
-			   (DI && DO) ? "read/write" : ((DI) ? "write" : "read"), ticks);
 	if (final_tms)
 		--ticks;
 	rticks = ticks & 7;
 	ticks >>= 3;
 	uint8_t data[8];
-	uint8_t cmd =  ((DO)? MPSSE_DO_READ : 0) |
+	uint8_t cmd =  ((capture)? MPSSE_DO_READ : 0) |
 		((DI)? (MPSSE_DO_WRITE | MPSSE_WRITE_NEG) : 0) | MPSSE_LSB;
 	rsize = ticks;
 	if (ticks) {
@@ -666,7 +683,7 @@ void libftdi_jtagtap_tdi_tdo_seq(uint8_t *DO, const bool final_tms, const uint8_
 	}
 	if (final_tms) {
 		rsize++;
-		data[index++] = MPSSE_WRITE_TMS | ((DO)? MPSSE_DO_READ : 0) |
+		data[index++] = MPSSE_WRITE_TMS | ((capture)? MPSSE_DO_READ : 0) |
 			MPSSE_LSB | MPSSE_BITMODE | MPSSE_WRITE_NEG;
 		data[index++] = 0;
 		if (DI)
@@ -674,29 +691,95 @@ void libftdi_jtagtap_tdi_tdo_seq(uint8_t *DO, const bool final_tms, const uint8_
 	}
 	if (index)
 		libftdi_buffer_write(data, index);
+	return rsize;
+}
+
+/* Turn the bytes read back for a scan into the TDO bits */
+static void libftdi_jtagtap_tdo_decode(uint8_t *DO, const uint8_t *tmp, const bool final_tms, size_t ticks)
+{
+	if (final_tms)
+		--ticks;
+	int rticks = ticks & 7;
+	int rsize = (ticks >> 3) + (rticks ? 1 : 0);
+
+	int index = 0;
+	while (rsize--)
+		*DO++ = tmp[index++];
+	if (rticks == 0)
+		*DO++ = 0;
+
+	if (final_tms) {
+		rticks++;
+		*(--DO) >>= 1;
+		*DO |= tmp[index] & 0x80;
+	} else
+		--DO;
+
+	if (rticks)
+		*DO >>= (8-rticks);
+}
+
+void libftdi_jtagtap_tdi_tdo_seq(uint8_t *DO, const bool final_tms, const uint8_t *DI, size_t ticks)
+{
+	if (!ticks)
+		return;
+	if (!DI && !DO)
+		return;
+
+	DEBUG_WIRE("libftdi_jtagtap_tdi_tdo_seq %s ticks: %d\n",
+			   (DI && DO) ? "read/write" : ((DI) ? "write" : "read"), ticks);
+	const int rsize = libftdi_jtagtap_tdi_tdo_cmd(DO != NULL, final_tms, DI, ticks);
 	if (DO) {
-		int index = 0;
 		uint8_t *tmp = alloca(rsize);
 		libftdi_buffer_read(tmp, rsize);
-		if(final_tms) rsize--;
-
-		while (rsize--)
-			*DO++ = tmp[index++];
-		if (rticks == 0)
-			*DO++ = 0;
-
-		if (final_tms) {
-			rticks++;
-			*(--DO) >>= 1;
-			*DO |= tmp[index] & 0x80;
-		} else
-			--DO;
-
-		if (rticks)
-			*DO >>= (8-rticks);
+		libftdi_jtagtap_tdo_decode(DO, tmp, final_tms, ticks);
+	}
+}
+
+/* The final TMS bit is read back in a byte of its own */
+static inline size_t libftdi_jtagtap_tdo_bytes(const bool final_tms, const size_t ticks)
+{
+	return (ticks - (final_tms ? 1U : 0U) + 7U) / 8U + (final_tms ? 1U : 0U);
+}
+
+void libftdi_jtagtap_flush(void)
+{
+	if (!deferred_count)
+		return;
+	uint8_t reply[LIBFTDI_JTAG_DEFER_BYTES];
+	const size_t count = deferred_count;
+	/* Clear the count first as libftdi_buffer_read() flushes while it isn't zero */
+	deferred_count = 0;
+	libftdi_buffer_read(reply, deferred_bytes);
+	deferred_bytes = 0;
+
+	const uint8_t *tdo = reply;
+	for (size_t i = 0; i < count; ++i) {
+		const libftdi_deferred_scan_t *scan = &deferred_scans[i];
+		libftdi_jtagtap_tdo_decode(scan->data_out, tdo, scan->final_tms, scan->ticks);
+		tdo += libftdi_jtagtap_tdo_bytes(scan->final_tms, scan->ticks);
 	}
 }
 
+void libftdi_jtagtap_tdi_tdo_seq_deferred(uint8_t *DO, const bool final_tms, const uint8_t *DI, size_t ticks)
+{
+	const size_t rsize = libftdi_jtagtap_tdo_bytes(final_tms, ticks);
+	if (!ticks || !DO || rsize > LIBFTDI_JTAG_DEFER_BYTES) {
+		libftdi_jtagtap_tdi_tdo_seq(DO, final_tms, DI, ticks);
+		return;
+	}
+	if (deferred_count == LIBFTDI_JTAG_DEFER_MAX || deferred_bytes + rsize > LIBFTDI_JTAG_DEFER_BYTES)
+		libftdi_jtagtap_flush();
+
+	DEBUG_WIRE("libftdi_jtagtap_tdi_tdo_seq_deferred ticks: %zu\n", ticks);
+	libftdi_jtagtap_tdi_tdo_cmd(true, final_tms, DI, ticks);
+	deferred_scans[deferred_count].data_out = DO;
+	deferred_scans[deferred_count].ticks = ticks;
+	deferred_scans[deferred_count].final_tms = final_tms;
+	++deferred_count;
+	deferred_bytes += rsize;
+}
+
 const char *libftdi_target_voltage(void)
 {
 	uint8_t pin = active_cable->target_voltage_pin;
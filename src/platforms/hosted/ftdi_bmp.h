@@ -132,6 +132,8 @@ size_t libftdi_buffer_write(const uint8_t *data, size_t size);
 int libftdi_buffer_read(uint8_t *data, int size);
 const char *libftdi_target_voltage(void);
 void libftdi_jtagtap_tdi_tdo_seq(uint8_t *data_out, bool final_tms, const uint8_t *data_in, size_t ticks);
+void libftdi_jtagtap_tdi_tdo_seq_deferred(uint8_t *data_out, bool final_tms, const uint8_t *data_in, size_t ticks);
+void libftdi_jtagtap_flush(void);
 bool  libftdi_swd_possible(bool *do_mpsse, bool *direct_bb_swd);
 void libftdi_max_frequency_set(uint32_t freq);
 uint32_t libftdi_max_frequency_get(void);
@@ -20,7 +20,9 @@
 
 /* This file implements a transparent channel over which the GDB Remote
  * Serial Debugging protocol is implemented.  This implementation for Linux
- * uses a TCP server on port 2000.
+ * uses a TCP server on port 2000. With gdb_if_sessions_set() it serves a GDB
+ * session on each of several consecutive ports, the one the current packet
+ * came from gets the output.
  */
 
 #if defined(_WIN32) || defined(__CYGWIN__)
@@ -33,207 +35,583 @@
 #   include <netinet/in.h>
 #   include <netinet/tcp.h>
 #   include <sys/select.h>
-#   include <fcntl.h>
 #endif
 
 #include "general.h"
 #include <assert.h>
 #include <errno.h>
 #include <unistd.h>
+#include <stdatomic.h>
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+#   include <fcntl.h>
+#   include <pthread.h>
+#endif
 
 #include "gdb_if.h"
+#include "gdb_main.h"
+#include "gdb_packet.h"
+#include "aux_if.h"
 
-static int gdb_if_serv, gdb_if_conn;
 #define DEFAULT_PORT 2000
 #define NUM_GDB_SERVER 4
-int gdb_if_init(void)
+
+typedef struct gdb_if_session gdb_if_session_s;
+
+static bool gdb_if_start_receive(gdb_if_session_s *session);
+
+/* Listens on the first free port from *port on, which is then the one taken */
+static int gdb_if_listen(int *const port)
 {
-#if defined(_WIN32) || defined(__CYGWIN__)
-	int iResult;
-	WSADATA wsaData;
-	iResult =  WSAStartup(MAKEWORD(2, 2), &wsaData);
-	if (iResult != NO_ERROR) {
-		DEBUG_WARN("WSAStartup failed with error: %ld\n", iResult);
-		exit(1);
-	}
-#endif
 	struct sockaddr_in addr;
 	int opt;
-	int port = DEFAULT_PORT - 1;
+	const int first = *port;
+	int serv;
 
+	--*port;
 	do {
-		port ++;
-		if (port > DEFAULT_PORT + NUM_GDB_SERVER)
-			return - 1;
+		++*port;
+		if (*port > first + NUM_GDB_SERVER)
+			return -1;
 		addr.sin_family = AF_INET;
-		addr.sin_port = htons(port);
+		addr.sin_port = htons(*port);
 		addr.sin_addr.s_addr = htonl(INADDR_ANY);
 
-		gdb_if_serv = socket(PF_INET, SOCK_STREAM, 0);
-		if (gdb_if_serv == -1) {
-			DEBUG_WARN("PF_INET %d\n",gdb_if_serv);
+		serv = socket(PF_INET, SOCK_STREAM, 0);
+		if (serv == -1) {
+			DEBUG_WARN("PF_INET %d\n", serv);
 			continue;
 		}
 
 		opt = 1;
-		if (setsockopt(gdb_if_serv, SOL_SOCKET, SO_REUSEADDR, (void*)&opt, sizeof(opt)) == -1) {
+		if (setsockopt(serv, SOL_SOCKET, SO_REUSEADDR, (void*)&opt, sizeof(opt)) == -1) {
 #if defined(_WIN32) || defined(__CYGWIN__)
-		    DEBUG_WARN("error setsockopt SOL_SOCKET : %d error: %d\n", gdb_if_serv,
+		    DEBUG_WARN("error setsockopt SOL_SOCKET : %d error: %d\n", serv,
 			WSAGetLastError());
 #else
-			DEBUG_WARN("error setsockopt SOL_SOCKET : %d error: %d\n", gdb_if_serv,
+			DEBUG_WARN("error setsockopt SOL_SOCKET : %d error: %d\n", serv,
 			strerror(errno));
 #endif
-			close(gdb_if_serv);
+			close(serv);
 			continue;
 		}
-		if (setsockopt(gdb_if_serv, IPPROTO_TCP, TCP_NODELAY, (void*)&opt, sizeof(opt)) == -1) {
+		if (setsockopt(serv, IPPROTO_TCP, TCP_NODELAY, (void*)&opt, sizeof(opt)) == -1) {
 #if defined(_WIN32) || defined(__CYGWIN__)
-			DEBUG_WARN("error setsockopt IPPROTO_TCP : %d error: %d\n", gdb_if_serv,
+			DEBUG_WARN("error setsockopt IPPROTO_TCP : %d error: %d\n", serv,
 			WSAGetLastError());
 #else
-			DEBUG_WARN("error setsockopt IPPROTO_TCP : %d error: %d\n", gdb_if_serv,
+			DEBUG_WARN("error setsockopt IPPROTO_TCP : %d error: %d\n", serv,
 			strerror(errno));
 #endif
-			close(gdb_if_serv);
+			close(serv);
 			continue;
 		}
-		if (bind(gdb_if_serv, (void*)&addr, sizeof(addr)) == -1) {
+		if (bind(serv, (void*)&addr, sizeof(addr)) == -1) {
 #if defined(_WIN32) || defined(__CYGWIN__)
-			DEBUG_WARN("error when binding socket: %d error: %d\n", gdb_if_serv,
+			DEBUG_WARN("error when binding socket: %d error: %d\n", serv,
 			WSAGetLastError());
 #else
-			DEBUG_WARN("error when binding socket: %d error: %d\n", gdb_if_serv,
+			DEBUG_WARN("error when binding socket: %d error: %d\n", serv,
 			strerror(errno));
 #endif
-			close(gdb_if_serv);
+			close(serv);
 			continue;
 		}
-		if (listen(gdb_if_serv, 1) == -1) {
-			DEBUG_WARN("listen closed %d\n",gdb_if_serv);
-			close(gdb_if_serv);
+		if (listen(serv, 1) == -1) {
+			DEBUG_WARN("listen closed %d\n", serv);
+			close(serv);
 			continue;
 		}
-		break;
+		return serv;
 	} while(1);
-	DEBUG_WARN("Listening on TCP: %4d\n", port);
+}
 
-	return 0;
+/*
+ * GDB input is taken off the socket by a receive thread, which also frames,
+ * unescapes and checksums the packets, so all of that overlaps with the
+ * probe traffic of the packet before. Packets, and the lone characters
+ * between them such as acks and ^C, reach the main thread through a
+ * lock-free single producer, single consumer queue. Acks and everything
+ * else going to GDB are still sent from the main thread alone.
+ *
+ * Each session has its own port, thread and queue. The main thread takes
+ * the packets of all of them in turn, see gdb_if_getpacket().
+ */
+#define GDB_IF_RX_BUF_SIZE 4096U
+#define GDB_IF_QUEUE_DEPTH 4U
+#define GDB_IF_MAX_SESSIONS 8U
+
+typedef struct gdb_if_frame {
+	char data[GDB_PACKET_BUFFER_SIZE];
+	size_t len;
+	/* A packet rather than a lone character, which is then data[0] */
+	bool packet;
+	/* The checksum matched and the packet fitted */
+	bool valid;
+	/* First thing off a new connection */
+	bool session;
+} gdb_if_frame_s;
+
+struct gdb_if_session {
+	int serv;
+	int port;
+	/* Set up by the receive thread, written to by the main thread */
+	atomic_int conn;
+	gdb_if_frame_s queue[GDB_IF_QUEUE_DEPTH];
+	/* Only the receive thread moves head and only the main thread tail */
+	atomic_size_t head;
+	atomic_size_t tail;
+	/* A ^C came, for a run that is polled for its halt rather than waited on */
+	bool interrupted;
+	uint8_t out[2048];
+	size_t out_len;
+};
+
+static gdb_if_session_s gdb_if_sessions_list[GDB_IF_MAX_SESSIONS];
+static size_t gdb_if_session_count = 1U;
+/* The session input is taken from and output goes to */
+static gdb_if_session_s *gdb_if_current = &gdb_if_sessions_list[0];
+static bool gdb_if_pinned;
+
+void gdb_if_sessions_set(const size_t count)
+{
+	gdb_if_session_count = MAX(MIN(count, GDB_IF_MAX_SESSIONS), 1U);
 }
 
+size_t gdb_if_sessions(void)
+{
+	return gdb_if_session_count;
+}
 
-unsigned char gdb_if_getchar(void)
+size_t gdb_if_session(void)
+{
+	return gdb_if_current - gdb_if_sessions_list;
+}
+
+void gdb_if_session_select(const size_t session)
+{
+	gdb_if_current = &gdb_if_sessions_list[session];
+}
+
+void gdb_if_session_pin(const bool pin)
+{
+	gdb_if_pinned = pin;
+}
+
+bool gdb_if_session_pinned(void)
+{
+	return gdb_if_pinned;
+}
+
+bool gdb_if_interrupted(void)
+{
+	const bool interrupted = gdb_if_current->interrupted;
+	gdb_if_current->interrupted = false;
+	return interrupted;
+}
+
+int gdb_if_init(void)
 {
-	unsigned char ret;
-	int i = 0;
 #if defined(_WIN32) || defined(__CYGWIN__)
 	int iResult;
-	unsigned long opt;
-#else
-	int flags;
+	WSADATA wsaData;
+	iResult =  WSAStartup(MAKEWORD(2, 2), &wsaData);
+	if (iResult != NO_ERROR) {
+		DEBUG_WARN("WSAStartup failed with error: %ld\n", iResult);
+		exit(1);
+	}
 #endif
-	while(i <= 0) {
-		if(gdb_if_conn <= 0) {
+	int port = DEFAULT_PORT;
+	for (size_t i = 0; i < gdb_if_session_count; ++i, ++port) {
+		gdb_if_session_s *const session = &gdb_if_sessions_list[i];
+		atomic_init(&session->conn, -1);
+		session->serv = gdb_if_listen(&port);
+		if (session->serv == -1)
+			return -1;
+		session->port = port;
+		if (!gdb_if_start_receive(session)) {
+			DEBUG_WARN("Failed to start the GDB receive thread\n");
+			close(session->serv);
+			return -1;
+		}
+		if (gdb_if_session_count > 1U)
+			DEBUG_WARN("Listening on TCP: %4d for session %zu\n", port, i);
+		else
+			DEBUG_WARN("Listening on TCP: %4d\n", port);
+	}
+	aux_if_init(gdb_if_sessions_list[0].port + AUX_PORT_OFFSET);
+
+	return 0;
+}
+
 #if defined(_WIN32) || defined(__CYGWIN__)
-			opt = 1;
-			iResult = ioctlsocket(gdb_if_serv, FIONBIO, &opt);
-			if (iResult != NO_ERROR) {
-				DEBUG_WARN("ioctlsocket failed with error: %ld\n", iResult);
-			}
+static HANDLE gdb_if_event;
+
+static void gdb_if_notify(void)
+{
+	SetEvent(gdb_if_event);
+}
+
+static void gdb_if_sleep(void)
+{
+	Sleep(1);
+}
+
+/* Waits up to timeout ms, forever if negative, for a receive thread to queue something */
+static bool gdb_if_wait(const int timeout)
+{
+	return WaitForSingleObject(gdb_if_event, timeout < 0 ? INFINITE : (DWORD)timeout) == WAIT_OBJECT_0;
+}
 #else
-			flags = fcntl(gdb_if_serv, F_GETFL);
-			fcntl(gdb_if_serv, F_SETFL, flags | O_NONBLOCK);
+/* The receive threads write to this pipe for every frame, so the wait can sit in select() with the aux clients */
+static int gdb_if_pipe[2] = {-1, -1};
+
+static void gdb_if_notify(void)
+{
+	const char c = 0;
+	/* A full pipe wakes the main thread just as well */
+	if (write(gdb_if_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+		DEBUG_WARN("GDB receive thread failed to notify: %s\n", strerror(errno));
+}
+
+static void gdb_if_sleep(void)
+{
+	struct timeval tv = {0, 1000};
+	select(0, NULL, NULL, NULL, &tv);
+}
+
+/*
+ * Waits up to timeout ms, forever if negative, for a receive thread to
+ * queue something. A request from an auxiliary client ends the wait early
+ * too, so the background tasks get to it at once.
+ */
+static bool gdb_if_wait(const int timeout)
+{
+	fd_set fds;
+	struct timeval tv;
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	FD_ZERO(&fds);
+	FD_SET(gdb_if_pipe[0], &fds);
+	const int max = aux_if_fd_set(&fds, gdb_if_pipe[0]);
+	if (select(max + 1, &fds, NULL, NULL, timeout < 0 ? NULL : &tv) <= 0 || !FD_ISSET(gdb_if_pipe[0], &fds))
+		return false;
+	char drain[64];
+	while (read(gdb_if_pipe[0], drain, sizeof(drain)) > 0)
+		continue;
+	return true;
+}
 #endif
-			while(1) {
-				gdb_if_conn = accept(gdb_if_serv, NULL, NULL);
-				if (gdb_if_conn == -1) {
+
+/* Blocks until GDB connects */
+static void gdb_if_accept(gdb_if_session_s *const session)
+{
+	const int conn = accept(session->serv, NULL, NULL);
+	if (conn == -1) {
 #if defined(_WIN32) || defined(__CYGWIN__)
-					if (WSAGetLastError() == WSAEWOULDBLOCK) {
+		DEBUG_WARN("error when accepting connection: %d", WSAGetLastError());
 #else
-					if (errno == EWOULDBLOCK) {
+		DEBUG_WARN("error when accepting connection: %s", strerror(errno));
 #endif
-						SET_IDLE_STATE(1);
-						platform_delay(100);
-					} else {
+		exit(1);
+	}
+	DEBUG_INFO("Got connection on %d\n", session->port);
+	atomic_store(&session->conn, conn);
+}
+
+static void gdb_if_drop(gdb_if_session_s *const session)
+{
+	const int conn = atomic_exchange(&session->conn, -1);
 #if defined(_WIN32) || defined(__CYGWIN__)
-						DEBUG_WARN("error when accepting connection: %d",
-								   WSAGetLastError());
+	DEBUG_INFO("Dropped broken connection: %d\n", WSAGetLastError());
+	closesocket(conn);
 #else
-						DEBUG_WARN("error when accepting connection: %s",
-								   strerror(errno));
+	DEBUG_INFO("Dropped broken connection: %s\n", strerror(errno));
+	close(conn);
 #endif
-						exit(1);
-					}
-				} else {
+}
+
+/* Waits for room in the queue, returning the frame to fill in */
+static gdb_if_frame_s *gdb_if_frame_start(gdb_if_session_s *const session)
+{
+	const size_t head = atomic_load_explicit(&session->head, memory_order_relaxed);
+	while (head - atomic_load_explicit(&session->tail, memory_order_acquire) == GDB_IF_QUEUE_DEPTH)
+		gdb_if_sleep();
+	return &session->queue[head % GDB_IF_QUEUE_DEPTH];
+}
+
+static void gdb_if_frame_push(gdb_if_session_s *const session, gdb_if_frame_s *const frame, bool *const first)
+{
+	frame->session = *first;
+	*first = false;
+	atomic_fetch_add_explicit(&session->head, 1U, memory_order_release);
+	gdb_if_notify();
+}
+
+static void gdb_if_push_char(gdb_if_session_s *const session, const char c, bool *const first)
+{
+	gdb_if_frame_s *const frame = gdb_if_frame_start(session);
+	frame->data[0] = c;
+	frame->len = 1U;
+	frame->packet = false;
+	frame->valid = true;
+	gdb_if_frame_push(session, frame, first);
+}
+
+typedef enum gdb_if_rx_state {
+	GDB_IF_RX_IDLE,
+	GDB_IF_RX_DATA,
+	GDB_IF_RX_ESCAPE,
+	GDB_IF_RX_CSUM_HIGH,
+	GDB_IF_RX_CSUM_LOW,
+} gdb_if_rx_state_e;
+
 #if defined(_WIN32) || defined(__CYGWIN__)
-					opt = 0;
-					ioctlsocket(gdb_if_serv, FIONBIO, &opt);
+static DWORD WINAPI gdb_if_receive(LPVOID arg)
 #else
-					fcntl(gdb_if_serv, F_SETFL, flags);
+static void *gdb_if_receive(void *arg)
 #endif
+{
+	gdb_if_session_s *const session = (gdb_if_session_s *)arg;
+	uint8_t buf[GDB_IF_RX_BUF_SIZE];
+	while (true) {
+		gdb_if_accept(session);
+		/* Every new GDB session starts out in ack mode, the main thread sees to that on its first frame */
+		bool first = true;
+		gdb_if_rx_state_e state = GDB_IF_RX_IDLE;
+		gdb_if_frame_s *frame = NULL;
+		uint8_t csum = 0;
+		char recv_csum[3] = {0};
+		bool overflow = false;
+		int len;
+		while ((len = recv(atomic_load(&session->conn), (void *)buf, sizeof(buf), 0)) > 0) {
+			for (int i = 0; i < len; ++i) {
+				char c = (char)buf[i];
+				switch (state) {
+				case GDB_IF_RX_IDLE:
+					if (c != '$') {
+						gdb_if_push_char(session, c, &first);
+						break;
+					}
+					frame = gdb_if_frame_start(session);
+					frame->len = 0;
+					csum = 0;
+					overflow = false;
+					state = GDB_IF_RX_DATA;
+					break;
+				case GDB_IF_RX_DATA:
+				case GDB_IF_RX_ESCAPE:
+					if (state == GDB_IF_RX_ESCAPE) {
+						csum += c + '}';
+						c ^= 0x20;
+						state = GDB_IF_RX_DATA;
+					} else if (c == '#') {
+						state = GDB_IF_RX_CSUM_HIGH;
+						break;
+					} else if (c == '$') { /* Restart capture */
+						frame->len = 0;
+						csum = 0;
+						overflow = false;
+						break;
+					} else if (c == '}') {
+						state = GDB_IF_RX_ESCAPE;
+						break;
+					} else
+						csum += c;
+					if (frame->len < sizeof(frame->data))
+						frame->data[frame->len++] = c;
+					else
+						overflow = true;
+					break;
+				case GDB_IF_RX_CSUM_HIGH:
+					recv_csum[0] = c;
+					state = GDB_IF_RX_CSUM_LOW;
+					break;
+				case GDB_IF_RX_CSUM_LOW:
+					recv_csum[1] = c;
+					frame->packet = true;
+					frame->valid = !overflow && csum == strtol(recv_csum, NULL, 16);
+					gdb_if_frame_push(session, frame, &first);
+					state = GDB_IF_RX_IDLE;
 					break;
 				}
 			}
-			DEBUG_INFO("Got connection\n");
+		}
+		gdb_if_drop(session);
+		/* Return '+' in case we were waiting for an ACK, a packet cut short is lost with the connection */
+		if (state == GDB_IF_RX_IDLE)
+			gdb_if_push_char(session, '+', &first);
+		/* With several sessions the target is let go of, for the others to attach to */
+		if (gdb_if_session_count > 1U) {
+			gdb_if_frame_s *const frame = gdb_if_frame_start(session);
+			frame->data[0] = '\x04';
+			frame->len = 1U;
+			frame->packet = true;
+			frame->valid = true;
+			gdb_if_frame_push(session, frame, &first);
+		}
+	}
 #if defined(_WIN32) || defined(__CYGWIN__)
-			opt = 0;
-			ioctlsocket(gdb_if_conn, FIONBIO, &opt);
+	return 0;
 #else
-			flags = fcntl(gdb_if_conn, F_GETFL);
-			fcntl(gdb_if_conn, F_SETFL, flags & ~O_NONBLOCK);
+	return NULL;
 #endif
-		}
-		i = recv(gdb_if_conn, (void*)&ret, 1, 0);
-		if(i <= 0) {
-			gdb_if_conn = -1;
+}
+
+static bool gdb_if_start_receive(gdb_if_session_s *const session)
+{
 #if defined(_WIN32) || defined(__CYGWIN__)
-			DEBUG_INFO("Dropped broken connection: %d\n", WSAGetLastError());
+	if (!gdb_if_event)
+		gdb_if_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	return gdb_if_event && CreateThread(NULL, 0, gdb_if_receive, session, 0, NULL);
 #else
-			DEBUG_INFO("Dropped broken connection: %s\n", strerror(errno));
+	if (gdb_if_pipe[0] == -1 &&
+		(pipe(gdb_if_pipe) || fcntl(gdb_if_pipe[0], F_SETFL, O_NONBLOCK) || fcntl(gdb_if_pipe[1], F_SETFL, O_NONBLOCK)))
+		return false;
+	pthread_t thread;
+	return !pthread_create(&thread, NULL, gdb_if_receive, session) && !pthread_detach(thread);
 #endif
-			/* Return '+' in case we were waiting for an ACK */
-			return '+';
-		}
+}
+
+static bool gdb_if_pending(gdb_if_session_s *const session)
+{
+	return atomic_load_explicit(&session->head, memory_order_acquire) !=
+		atomic_load_explicit(&session->tail, memory_order_relaxed);
+}
+
+/* Whether another session than the current one has something queued, and may be switched to */
+static bool gdb_if_pending_elsewhere(void)
+{
+	if (gdb_if_pinned)
+		return false;
+	for (size_t i = 0; i < gdb_if_session_count; ++i) {
+		if (&gdb_if_sessions_list[i] != gdb_if_current && gdb_if_pending(&gdb_if_sessions_list[i]))
+			return true;
 	}
-	return ret;
+	return false;
 }
 
-unsigned char gdb_if_getchar_to(int timeout)
+/* The frame at the head of the current session's queue, if any, which stays there until gdb_if_pop() */
+static gdb_if_frame_s *gdb_if_peek(void)
 {
-	fd_set fds;
-# if defined(__CYGWIN__)
-        TIMEVAL tv;
-#else
-	struct timeval tv;
-#endif
+	gdb_if_session_s *const session = gdb_if_current;
+	const size_t tail = atomic_load_explicit(&session->tail, memory_order_relaxed);
+	if (atomic_load_explicit(&session->head, memory_order_acquire) == tail)
+		return NULL;
+	gdb_if_frame_s *const frame = &session->queue[tail % GDB_IF_QUEUE_DEPTH];
+	if (frame->session) {
+		frame->session = false;
+		gdb_set_noackmode(false);
+	}
+	return frame;
+}
 
-	if(gdb_if_conn == -1) return -1;
+static void gdb_if_pop(void)
+{
+	atomic_fetch_add_explicit(&gdb_if_current->tail, 1U, memory_order_release);
+}
 
-	tv.tv_sec = timeout / 1000;
-	tv.tv_usec = (timeout % 1000) * 1000;
+/* Waits up to timeout ms, forever if negative, for a frame, giving up early for the aux clients */
+static gdb_if_frame_s *gdb_if_wait_frame(const int timeout)
+{
+	const uint32_t start = platform_time_ms();
+	while (true) {
+		gdb_if_frame_s *const frame = gdb_if_peek();
+		if (frame)
+			return frame;
+		int remaining = timeout;
+		if (timeout >= 0) {
+			const uint32_t elapsed = platform_time_ms() - start;
+			if (elapsed >= (uint32_t)timeout)
+				return NULL;
+			remaining = timeout - (int)elapsed;
+		}
+		/* Notifications for frames already taken can wake this early, so look again */
+		if (!gdb_if_wait(remaining))
+			return gdb_if_peek();
+	}
+}
 
-	FD_ZERO(&fds);
-	FD_SET(gdb_if_conn, &fds);
+void gdb_if_idle_wait(const int timeout)
+{
+	const uint32_t start = platform_time_ms();
+	while (!gdb_if_pending(gdb_if_current) && !gdb_if_pending_elsewhere()) {
+		int remaining = timeout;
+		if (timeout >= 0) {
+			const uint32_t elapsed = platform_time_ms() - start;
+			if (elapsed >= (uint32_t)timeout)
+				return;
+			remaining = timeout - (int)elapsed;
+		}
+		if (!gdb_if_wait(remaining))
+			return;
+	}
+}
+
+/* Takes the current session's next packet, dropping the lone characters before it */
+static bool gdb_if_take_packet(char *const packet, const size_t size, size_t *const len, bool *const valid)
+{
+	for (gdb_if_frame_s *frame = gdb_if_peek(); frame; frame = gdb_if_peek()) {
+		if (frame->packet) {
+			*len = MIN(frame->len, size);
+			memcpy(packet, frame->data, *len);
+			*valid = frame->valid && frame->len <= size;
+			gdb_if_pop();
+			return true;
+		}
+		if (frame->data[0] == '\x03')
+			gdb_if_current->interrupted = true;
+		gdb_if_pop();
+	}
+	return false;
+}
+
+bool gdb_if_getpacket(char *const packet, const size_t size, size_t *const len, bool *const valid)
+{
+	/* Sessions take turns, the current one goes last so none is starved by a busy one */
+	const size_t current = gdb_if_session();
+	for (size_t i = 1; i <= gdb_if_session_count; ++i) {
+		const size_t next = (current + i) % gdb_if_session_count;
+		if (next != current) {
+			if (gdb_if_pinned || !gdb_if_pending(&gdb_if_sessions_list[next]))
+				continue;
+			gdb_session_switch(next);
+		}
+		if (gdb_if_take_packet(packet, size, len, valid))
+			return true;
+	}
+	return false;
+}
 
-	if(select(gdb_if_conn+1, &fds, NULL, NULL, &tv) > 0)
-		return gdb_if_getchar();
+unsigned char gdb_if_getchar_to(const int timeout)
+{
+	gdb_if_frame_s *const frame = gdb_if_wait_frame(timeout);
+	if (!frame)
+		return -1;
+	/* A packet is left for gdb_getpacket(), this only sees it start */
+	if (frame->packet)
+		return '$';
+	const char c = frame->data[0];
+	if (c == '\x03')
+		gdb_if_current->interrupted = true;
+	gdb_if_pop();
+	return c;
+}
 
-	return -1;
+unsigned char gdb_if_getchar(void)
+{
+	return gdb_if_getchar_to(-1);
 }
 
 void gdb_if_putchar(unsigned char c, int flush)
 {
-#if defined(__WIN32__) || defined(__CYGWIN__)
-	static char buf[2048];
-#else
-	static uint8_t buf[2048];
-#endif
-	static int bufsize = 0;
-	if (gdb_if_conn > 0) {
-		buf[bufsize++] = c;
-		if (flush || (bufsize == sizeof(buf))) {
-			send(gdb_if_conn, buf, bufsize, 0);
-			bufsize = 0;
+	gdb_if_session_s *const session = gdb_if_current;
+	const int conn = atomic_load(&session->conn);
+	if (conn > 0) {
+		session->out[session->out_len++] = c;
+		if (flush || (session->out_len == sizeof(session->out))) {
+			send(conn, (void *)session->out, session->out_len, 0);
+			session->out_len = 0;
 		}
 	}
 }
@@ -224,6 +224,7 @@ int jlink_init(bmp_info_t *info)
 
 const char *jlink_target_voltage(bmp_info_t *info)
 {
+        jlink_jtagtap_flush();
         uint8_t cmd[1] = {CMD_GET_HW_STATUS};
 		uint8_t res[8];
         send_recv(info->usb_link, cmd, 1, res, sizeof(res));
@@ -236,6 +237,7 @@ const char *jlink_target_voltage(bmp_info_t *info)
 static bool nrst_status = false;
 void jlink_nrst_set_val(bmp_info_t *info, bool assert)
 {
+        jlink_jtagtap_flush();
         uint8_t cmd[1];
         cmd[0]= (assert)? CMD_HW_RESET0: CMD_HW_RESET1;
         send_recv(info->usb_link, cmd, 1, NULL, 0);
@@ -244,6 +246,7 @@ void jlink_nrst_set_val(bmp_info_t *info, bool assert)
 }
 
 bool jlink_nrst_get_val(bmp_info_t *info) {
+        jlink_jtagtap_flush();
         uint8_t cmd[1] = {CMD_GET_HW_STATUS};
         uint8_t res[8];
         send_recv(info->usb_link, cmd, 1, res, sizeof(res));
@@ -256,6 +259,7 @@ void jlink_max_frequency_set(bmp_info_t *info, uint32_t freq)
 		return;
 	if (!info->is_jtag)
 		return;
+	jlink_jtagtap_flush();
 	uint16_t freq_kHz = freq /1000;
 	uint16_t divisor = (emu_speed_kHz + freq_kHz - 1) / freq_kHz;
 	if (divisor < emu_min_divisor)
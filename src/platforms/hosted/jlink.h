@@ -99,6 +99,8 @@ enum jaylink_device_capability {
 int jlink_init(bmp_info_t *info);
 uint32_t jlink_swdp_scan(bmp_info_t *info);
 int jlink_jtagtap_init(bmp_info_t *info, jtag_proc_t *jtag_proc);
+/* Sends the queued TAP sequences, before anything else goes to the J-Link */
+void jlink_jtagtap_flush(void);
 const char *jlink_target_voltage(bmp_info_t *info);
 void jlink_nrst_set_val(bmp_info_t *info, bool assert);
 bool jlink_nrst_get_val(bmp_info_t *info);
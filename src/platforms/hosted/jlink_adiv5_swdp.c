@@ -40,6 +40,10 @@ static uint32_t jlink_adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_
 
 static void jlink_adiv5_swdp_abort(ADIv5_DP_t *dp, uint32_t abort);
 
+static void jlink_swd_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value);
+static void jlink_swd_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value);
+static bool jlink_swd_flush(ADIv5_DP_t *dp);
+
 enum {
 	SWDIO_WRITE = 0,
 	SWDIO_READ
@@ -133,6 +137,9 @@ uint32_t jlink_swdp_scan(bmp_info_t *info)
 	dp->error = jlink_adiv5_swdp_error;
 	dp->low_access = jlink_adiv5_swdp_low_access;
 	dp->abort = jlink_adiv5_swdp_abort;
+	dp->queue_write = jlink_swd_queue_write;
+	dp->queue_read = jlink_swd_queue_read;
+	dp->flush = jlink_swd_flush;
 
 	jlink_adiv5_swdp_error(dp);
 
@@ -170,6 +177,7 @@ static uint32_t jlink_adiv5_swdp_error(ADIv5_DP_t *dp)
 	if (dp->fault)
 		err |= 0x8000U;
 	dp->fault = 0;
+	adiv5_dp_invalidate_cache(dp);
 
 	return err;
 }
@@ -271,5 +279,139 @@ static uint32_t jlink_adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_
 
 static void jlink_adiv5_swdp_abort(ADIv5_DP_t *dp, uint32_t abort)
 {
+	adiv5_dp_invalidate_cache(dp);
 	adiv5_dp_write(dp, ADIV5_DP_ABORT, abort);
 }
+
+/*
+ * With overrun detection on, every SWD transfer has a data phase whatever
+ * its ACK, so a run of queued transfers can go out as one CMD_HW_JTAG3 bit
+ * stream without looking at anything in between. Each transfer is laid out
+ * as low_access does its two halves, with the same early sampling of the
+ * read data. The ACKs and read data are picked out of the returned TDO
+ * afterwards. A read takes 46 clocks and a write 54, so a full stream holds
+ * well over a hundred transfers.
+ */
+#define SWD_QUEUE_MAX_BYTES 1024U
+#define SWD_QUEUE_MAX       ((SWD_QUEUE_MAX_BYTES * 8U) / 46U)
+
+static uint8_t swd_queue_direction[SWD_QUEUE_MAX_BYTES];
+static uint8_t swd_queue_data[SWD_QUEUE_MAX_BYTES];
+static size_t swd_queue_bits;
+static uint32_t *swd_queue_dest[SWD_QUEUE_MAX];
+static uint16_t swd_queue_offset[SWD_QUEUE_MAX];
+static size_t swd_queue_count;
+
+static void jlink_swd_queue_bits(const uint32_t value, const size_t count, const bool out)
+{
+	for (size_t i = 0; i < count; ++i, ++swd_queue_bits) {
+		const uint8_t mask = 1U << (swd_queue_bits & 7U);
+		uint8_t *const direction = &swd_queue_direction[swd_queue_bits >> 3U];
+		uint8_t *const data = &swd_queue_data[swd_queue_bits >> 3U];
+		if (out)
+			*direction |= mask;
+		else
+			*direction &= ~mask;
+		if (out && ((value >> i) & 1U))
+			*data |= mask;
+		else
+			*data &= ~mask;
+	}
+}
+
+static uint32_t jlink_swd_tdo_bits(const uint8_t *const tdo, const size_t offset, const size_t count)
+{
+	uint32_t value = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (tdo[(offset + i) >> 3U] & (1U << ((offset + i) & 7U)))
+			value |= 1U << i;
+	}
+	return value;
+}
+
+static void jlink_swd_queue_collect(ADIv5_DP_t *dp)
+{
+	if (!swd_queue_count)
+		return;
+	const size_t bits = swd_queue_bits;
+	const size_t bytes = (bits + 7U) >> 3U;
+	const size_t count = swd_queue_count;
+	swd_queue_bits = 0;
+	swd_queue_count = 0;
+
+	uint8_t cmd[4U + 2U * SWD_QUEUE_MAX_BYTES];
+	cmd[0] = CMD_HW_JTAG3;
+	cmd[1] = 0;
+	cmd[2] = bits & 0xffU;
+	cmd[3] = bits >> 8U;
+	memcpy(cmd + 4U, swd_queue_direction, bytes);
+	memcpy(cmd + 4U + bytes, swd_queue_data, bytes);
+
+	uint8_t tdo[SWD_QUEUE_MAX_BYTES];
+	uint8_t status;
+	send_recv(info.usb_link, cmd, 4U + 2U * bytes, tdo, bytes);
+	send_recv(info.usb_link, NULL, 0, &status, 1);
+	if (status != 0)
+		raise_exception(EXCEPTION_ERROR, "Queued transfers failed");
+
+	for (size_t i = 0; i < count; ++i) {
+		const size_t offset = swd_queue_offset[i];
+		const uint8_t ack = jlink_swd_tdo_bits(tdo, offset + 8U, 3U);
+		/* WAIT and FAULT end up in STICKYORUN, anything else is a lost line */
+		if (ack != SWDP_ACK_OK && ack != SWDP_ACK_WAIT && ack != SWDP_ACK_FAULT)
+			dp->fault = 1;
+		if (!swd_queue_dest[i])
+			continue;
+		*swd_queue_dest[i] = 0;
+		if (ack != SWDP_ACK_OK)
+			continue;
+		const uint32_t value = jlink_swd_tdo_bits(tdo, offset + 11U, 32U);
+		const bool parity = jlink_swd_tdo_bits(tdo, offset + 43U, 1U);
+		if ((__builtin_parity(value) & 1U) != parity)
+			dp->fault = 1;
+		*swd_queue_dest[i] = value;
+	}
+}
+
+static void jlink_swd_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
+{
+	if (!dp->overrun_detect) {
+		jlink_swd_queue_collect(dp);
+		jlink_adiv5_swdp_low_access(dp, ADIV5_LOW_WRITE, addr, value);
+		return;
+	}
+	if (swd_queue_bits + 54U > SWD_QUEUE_MAX_BYTES * 8U)
+		jlink_swd_queue_collect(dp);
+	swd_queue_dest[swd_queue_count] = NULL;
+	swd_queue_offset[swd_queue_count++] = swd_queue_bits;
+	/* Request, turnaround and ACK, turnaround, data, parity and 8 idle cycles */
+	jlink_swd_queue_bits(make_packet_request(ADIV5_LOW_WRITE, addr), 8U, true);
+	jlink_swd_queue_bits(0, 4U, false);
+	jlink_swd_queue_bits(0, 1U, true);
+	jlink_swd_queue_bits(value, 32U, true);
+	jlink_swd_queue_bits(__builtin_parity(value), 1U, true);
+	jlink_swd_queue_bits(0, 8U, true);
+}
+
+static void jlink_swd_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value)
+{
+	if (!dp->overrun_detect) {
+		jlink_swd_queue_collect(dp);
+		*value = jlink_adiv5_swdp_low_access(dp, ADIV5_LOW_READ, addr, 0);
+		return;
+	}
+	if (swd_queue_bits + 46U > SWD_QUEUE_MAX_BYTES * 8U)
+		jlink_swd_queue_collect(dp);
+	swd_queue_dest[swd_queue_count] = value;
+	swd_queue_offset[swd_queue_count++] = swd_queue_bits;
+	/* Request, then turnaround, ACK, data and parity in and two cycles to turn around */
+	jlink_swd_queue_bits(make_packet_request(ADIV5_LOW_READ, addr), 8U, true);
+	jlink_swd_queue_bits(0, 36U, false);
+	jlink_swd_queue_bits(0, 2U, true);
+}
+
+static bool jlink_swd_flush(ADIv5_DP_t *dp)
+{
+	jlink_swd_queue_collect(dp);
+	return !dp->fault;
+}
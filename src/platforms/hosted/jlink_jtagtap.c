@@ -30,107 +30,174 @@
 #include "jlink.h"
 #include "cli.h"
 
-static void jtagtap_reset(void)
+/*
+ * TAP sequences are laid out bit by bit into one CMD_HW_JTAG3 TMS/TDI stream
+ * and only sent once TDO is needed, the stream is full or another command
+ * goes to the J-Link. Deferred captures leave the stream queued, so the IR
+ * write and DR shift of a JTAG-DP access, and a whole run of queued accesses,
+ * take one transfer and one status read. The captures are picked out of the
+ * returned TDO at the flush.
+ */
+#define JLINK_JTAG_BATCH_BYTES    512U
+#define JLINK_JTAG_BATCH_BITS     (JLINK_JTAG_BATCH_BYTES * 8U)
+#define JLINK_JTAG_BATCH_CAPTURES 64U
+
+typedef struct jlink_jtag_capture {
+	uint8_t *data_out;
+	size_t out_offset;
+	size_t tdo_offset;
+	size_t ticks;
+} jlink_jtag_capture_s;
+
+static uint8_t batch_tms[JLINK_JTAG_BATCH_BYTES];
+static uint8_t batch_tdi[JLINK_JTAG_BATCH_BYTES];
+static size_t batch_bits = 0;
+static jlink_jtag_capture_s batch_captures[JLINK_JTAG_BATCH_CAPTURES];
+static size_t batch_capture_count = 0;
+
+static inline bool jlink_jtag_bit(const uint8_t *const data, const size_t offset)
 {
-	jtagtap_soft_reset();
+	return data[offset >> 3U] & (1U << (offset & 7U));
 }
 
-static void jtagtap_tms_seq(uint32_t tms_states, size_t ticks)
+static inline void jlink_jtag_set_bit(uint8_t *const data, const size_t offset, const bool value)
 {
-	DEBUG_PROBE("jtagtap_tms_seq 0x%08" PRIx32 ", ticks %d\n", tms_states, ticks);
-	int len = (ticks + 7) / 8;
-	uint8_t cmd[12];
+	if (value)
+		data[offset >> 3U] |= 1U << (offset & 7U);
+	else
+		data[offset >> 3U] &= ~(1U << (offset & 7U));
+}
+
+void jlink_jtagtap_flush(void)
+{
+	if (!batch_bits)
+		return;
+	const size_t ticks = batch_bits;
+	const size_t len = (ticks + 7U) >> 3U;
+	uint8_t cmd[4U + 2U * JLINK_JTAG_BATCH_BYTES];
 	cmd[0] = CMD_HW_JTAG3;
 	cmd[1] = 0;
-	cmd[2] = ticks;
-	cmd[3] = 0;
-	uint8_t *tms = cmd + 4;
-	for (int i = 0; i < len; i++) {
-		*tms = tms_states & 0xff;
-		*(tms + len) = *tms;
-		tms++;
-		tms_states >>= 8;
-	}
-	uint8_t res[4];
-	send_recv(info.usb_link, cmd, 4 + 2 * len, res, len);
+	cmd[2] = ticks & 0xffU;
+	cmd[3] = ticks >> 8U;
+	memcpy(cmd + 4U, batch_tms, len);
+	memcpy(cmd + 4U + len, batch_tdi, len);
+	memset(batch_tms, 0, len);
+	memset(batch_tdi, 0, len);
+	batch_bits = 0;
+
+	uint8_t tdo[JLINK_JTAG_BATCH_BYTES];
+	send_recv(info.usb_link, cmd, 4U + 2U * len, tdo, len);
+	uint8_t res[1];
 	send_recv(info.usb_link, NULL, 0, res, 1);
+	for (size_t i = 0; i < batch_capture_count; ++i) {
+		const jlink_jtag_capture_s *const capture = &batch_captures[i];
+		for (size_t bit = 0; bit < capture->ticks; ++bit)
+			jlink_jtag_set_bit(
+				capture->data_out, capture->out_offset + bit, jlink_jtag_bit(tdo, capture->tdo_offset + bit));
+	}
+	batch_capture_count = 0;
 	if (res[0] != 0)
-		raise_exception(EXCEPTION_ERROR, "tagtap_tms_seq failed");
+		raise_exception(EXCEPTION_ERROR, "jtagtap batch failed");
 }
 
-static void jtagtap_tdi_tdo_seq(uint8_t *data_out, const bool final_tms,
+/* Makes room for ticks more clocks and returns how many of them fit before the next flush */
+static size_t jlink_jtag_reserve(const size_t ticks, const bool capture)
+{
+	if (batch_bits == JLINK_JTAG_BATCH_BITS || (capture && batch_capture_count == JLINK_JTAG_BATCH_CAPTURES))
+		jlink_jtagtap_flush();
+	return MIN(ticks, JLINK_JTAG_BATCH_BITS - batch_bits);
+}
+
+static void jlink_jtag_queue(
+	uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, const size_t ticks)
+{
+	for (size_t cycle = 0; cycle < ticks;) {
+		const size_t chunk = jlink_jtag_reserve(ticks - cycle, data_out != NULL);
+		if (data_out) {
+			batch_captures[batch_capture_count++] = (jlink_jtag_capture_s){
+				.data_out = data_out,
+				.out_offset = cycle,
+				.tdo_offset = batch_bits,
+				.ticks = chunk,
+			};
+		}
+		for (size_t i = 0; i < chunk; ++i, ++cycle, ++batch_bits) {
+			if (data_in)
+				jlink_jtag_set_bit(batch_tdi, batch_bits, jlink_jtag_bit(data_in, cycle));
+			if (final_tms && cycle == ticks - 1U)
+				jlink_jtag_set_bit(batch_tms, batch_bits, true);
+		}
+	}
+}
+
+static void jtagtap_reset(void)
+{
+	jtagtap_soft_reset();
+}
+
+static void jtagtap_tms_seq(uint32_t tms_states, size_t ticks)
+{
+	DEBUG_PROBE("jtagtap_tms_seq 0x%08" PRIx32 ", ticks %zu\n", tms_states, ticks);
+	for (size_t cycle = 0; cycle < ticks;) {
+		const size_t chunk = jlink_jtag_reserve(ticks - cycle, false);
+		for (size_t i = 0; i < chunk; ++i, ++cycle, ++batch_bits) {
+			jlink_jtag_set_bit(batch_tms, batch_bits, tms_states & 1U);
+			jlink_jtag_set_bit(batch_tdi, batch_bits, true);
+			tms_states >>= 1U;
+		}
+	}
+}
+
+static void jtagtap_tdi_tdo_seq_deferred(uint8_t *data_out, const bool final_tms,
 						 const uint8_t *data_in, size_t ticks)
 {
 	if (!ticks)
 		return;
-	int len = (ticks + 7) / 8;
 	if (cl_debuglevel & BMP_DEBUG_PROBE) {
-		DEBUG_PROBE("jtagtap_tdi_tdo %s, ticks %d, data_in: ",
+		DEBUG_PROBE("jtagtap_tdi_tdo %s, ticks %zu, data_in: ",
 			   (final_tms) ? "Final TMS" : "", ticks);
-		for (int i = 0; i < len; i++) {
-			DEBUG_PROBE("%02x", data_in[i]);
+		if (data_in) {
+			for (size_t i = 0; i < (ticks + 7U) / 8U; i++)
+				DEBUG_PROBE("%02x", data_in[i]);
 		}
 		DEBUG_PROBE("\n");
 	}
-	uint8_t *cmd = alloca(4 + 2 * len);
-	cmd[0] = CMD_HW_JTAG3;
-	cmd[1] = 0;
-	cmd[2] = ticks;
-	cmd[3] = 0;
-	uint8_t *tms = cmd + 4;
-	for (int i = 0; i < len; i++)
-		*tms++ = 0;
-	if (final_tms)
-		cmd[4 + (ticks - 1) / 8] |= (1 << ((ticks - 1) % 8));
-	uint8_t *tdi = tms;
-	if (data_in)
-		for (int i = 0; i < len; i++)
-			*tdi++ = data_in[i];
+	jlink_jtag_queue(data_out, final_tms, data_in, ticks);
+}
+
+static void jtagtap_tdi_tdo_seq(uint8_t *data_out, const bool final_tms,
+						 const uint8_t *data_in, size_t ticks)
+{
+	jtagtap_tdi_tdo_seq_deferred(data_out, final_tms, data_in, ticks);
 	if (data_out)
-		send_recv(info.usb_link, cmd, 4 + 2 * len, data_out, len);
-	else
-		send_recv(info.usb_link, cmd, 4 + 2 * len, cmd, len);
-	uint8_t res[1];
-	send_recv(info.usb_link, NULL, 0, res, 1);
-	if (res[0] != 0)
-		raise_exception(EXCEPTION_ERROR, "jtagtap_tdi_tdi failed");
+		jlink_jtagtap_flush();
 }
 
 static void jtagtap_tdi_seq(const bool final_tms, const uint8_t *data_in,
 							size_t ticks)
 {
-	if (cl_debuglevel & BMP_DEBUG_PROBE) {
-		DEBUG_PROBE("jtagtap_tdi_seq %s:", (final_tms)? "final_tms" : "");
-		const uint8_t *p = data_in;
-		unsigned int i = (ticks & 7) & ~7 ;
-		if (i > 16)
-			i = 16;
-		while (i--)
-			DEBUG_PROBE(" %02x", *p++);
-		if (ticks > (16 * 8))
-			DEBUG_PROBE(" ...");
-		DEBUG_PROBE("\n");
-	}
 	return jtagtap_tdi_tdo_seq(NULL,  final_tms, data_in, ticks);
 }
 
 static bool jtagtap_next(bool tms, bool tdi)
 {
 	DEBUG_PROBE("jtagtap_next TMS 0x%02x, TDI %02x\n", tms, tdi);
-	uint8_t cmd[6];
-	cmd[0] = CMD_HW_JTAG3;
-	cmd[1] = 0;
-	cmd[2] = 1;
-	cmd[3] = 0;
-	cmd[4] = tms ? 0xff : 0;
-	cmd[5] = tdi ? 0xff : 0;
-	uint8_t ret[1];
-	send_recv(info.usb_link, cmd, 6, ret, 1);
-	uint8_t res[1];
-	send_recv(info.usb_link, NULL, 0, res, 1);
-	if (res[0] != 0)
-		raise_exception(EXCEPTION_ERROR, "jtagtap_next failed");
-	return (ret[0] & 1);
+	const uint8_t data_in = tdi ? 1U : 0U;
+	uint8_t ret = 0;
+	jlink_jtag_queue(&ret, tms, &data_in, 1U);
+	jlink_jtagtap_flush();
+	return ret & 1U;
+}
+
+static void jtagtap_cycle(const bool tms, const bool tdi, const size_t clock_cycles)
+{
+	for (size_t cycle = 0; cycle < clock_cycles;) {
+		const size_t chunk = jlink_jtag_reserve(clock_cycles - cycle, false);
+		for (size_t i = 0; i < chunk; ++i, ++cycle, ++batch_bits) {
+			jlink_jtag_set_bit(batch_tms, batch_bits, tms);
+			jlink_jtag_set_bit(batch_tdi, batch_bits, tdi);
+		}
+	}
 }
 
 int jlink_jtagtap_init(bmp_info_t *info, jtag_proc_t *jtag_proc)
@@ -178,5 +245,8 @@ int jlink_jtagtap_init(bmp_info_t *info, jtag_proc_t *jtag_proc)
 	jtag_proc->jtagtap_tms_seq = jtagtap_tms_seq;
 	jtag_proc->jtagtap_tdi_tdo_seq = jtagtap_tdi_tdo_seq;
 	jtag_proc->jtagtap_tdi_seq = jtagtap_tdi_seq;
+	jtag_proc->jtagtap_cycle = jtagtap_cycle;
+	jtag_proc->jtagtap_tdi_tdo_seq_deferred = jtagtap_tdi_tdo_seq_deferred;
+	jtag_proc->jtagtap_flush = jlink_jtagtap_flush;
 	return 0;
 }
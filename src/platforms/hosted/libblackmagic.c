@@ -0,0 +1,334 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements libblackmagic, the API in libblackmagic.h, over the
+ * same target layer GDB uses. Every call takes the session lock and runs
+ * inside a TRY_CATCH, so a probe or target that stops answering ends up as
+ * BM_ERR_TARGET_LOST rather than unwinding into the caller.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "command.h"
+#include "exception.h"
+#include "gdb_packet.h"
+#include "sched_tasks.h"
+#include "libblackmagic.h"
+
+#include <pthread.h>
+
+struct bm_session {
+	pthread_mutex_t lock;
+	struct target_controller controller;
+	target *target;
+	bm_output_fn output;
+	void *output_context;
+};
+
+/* The probe and target layers are global, so is the session on them */
+static bm_session_s *bm_current;
+static pthread_mutex_t bm_open_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void bm_output(const char *const text)
+{
+	if (bm_current && bm_current->output)
+		bm_current->output(bm_current->output_context, text);
+}
+
+static void bm_target_printf(struct target_controller *tc, const char *fmt, va_list ap)
+{
+	(void)tc;
+	char *text;
+	if (vasprintf(&text, fmt, ap) < 0)
+		return;
+	bm_output(text);
+	free(text);
+}
+
+static void bm_target_destroyed(struct target_controller *tc, target *t)
+{
+	(void)tc;
+	if (bm_current && bm_current->target == t)
+		bm_current->target = NULL;
+}
+
+/* Takes the lock, false and not locked if a target is needed and there is none */
+static bool bm_enter(bm_session_s *const session, const bool need_target)
+{
+	pthread_mutex_lock(&session->lock);
+	if (!need_target || session->target)
+		return true;
+	pthread_mutex_unlock(&session->lock);
+	return false;
+}
+
+static int bm_leave(bm_session_s *const session, volatile struct exception *const e, int result)
+{
+	if (e->type) {
+		DEBUG_WARN("libblackmagic: target lost: %s\n", e->msg ? e->msg : "");
+		target_list_free();
+		session->target = NULL;
+		result = BM_ERR_TARGET_LOST;
+	}
+	pthread_mutex_unlock(&session->lock);
+	return result;
+}
+
+int bm_open(bm_session_s **const session, const int argc, char **const argv)
+{
+	*session = NULL;
+	pthread_mutex_lock(&bm_open_lock);
+	if (bm_current) {
+		pthread_mutex_unlock(&bm_open_lock);
+		return BM_ERR_BUSY;
+	}
+	bm_session_s *const result = calloc(1, sizeof(*result));
+	if (!result) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		pthread_mutex_unlock(&bm_open_lock);
+		return BM_ERR;
+	}
+	if (!platform_lib_init(argc, argv)) {
+		free(result);
+		pthread_mutex_unlock(&bm_open_lock);
+		return BM_ERR_NO_PROBE;
+	}
+	pthread_mutex_init(&result->lock, NULL);
+	result->controller.destroy_callback = bm_target_destroyed;
+	result->controller.printf = bm_target_printf;
+	bm_current = result;
+	gdb_out_redirect(bm_output);
+	*session = result;
+	pthread_mutex_unlock(&bm_open_lock);
+	return BM_OK;
+}
+
+void bm_close(bm_session_s *const session)
+{
+	if (!session)
+		return;
+	pthread_mutex_lock(&bm_open_lock);
+	pthread_mutex_lock(&session->lock);
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		if (session->target)
+			target_detach(session->target);
+	}
+	target_list_free();
+	gdb_out_redirect(NULL);
+	platform_lib_exit();
+	bm_current = NULL;
+	pthread_mutex_unlock(&session->lock);
+	pthread_mutex_destroy(&session->lock);
+	free(session);
+	pthread_mutex_unlock(&bm_open_lock);
+}
+
+void bm_set_output(bm_session_s *const session, const bm_output_fn output, void *const context)
+{
+	pthread_mutex_lock(&session->lock);
+	session->output = output;
+	session->output_context = context;
+	pthread_mutex_unlock(&session->lock);
+}
+
+int bm_scan(bm_session_s *const session, const bool jtag)
+{
+	bm_enter(session, false);
+	session->target = NULL;
+	volatile int result = 0;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = jtag ? platform_jtag_scan(NULL) : platform_adiv5_swdp_scan(0);
+	}
+	return bm_leave(session, &e, result);
+}
+
+int bm_attach(bm_session_s *const session, const size_t n)
+{
+	bm_enter(session, false);
+	volatile int result = BM_ERR_NOT_FOUND;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		if (session->target)
+			target_detach(session->target);
+		session->target = target_attach_n(n, &session->controller);
+		if (session->target)
+			result = BM_OK;
+	}
+	return bm_leave(session, &e, result);
+}
+
+void bm_detach(bm_session_s *const session)
+{
+	if (!bm_enter(session, true))
+		return;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		target_detach(session->target);
+	}
+	session->target = NULL;
+	bm_leave(session, &e, BM_OK);
+}
+
+const char *bm_target_name(bm_session_s *const session)
+{
+	if (!bm_enter(session, true))
+		return NULL;
+	const char *const name = target_driver_name(session->target);
+	pthread_mutex_unlock(&session->lock);
+	return name;
+}
+
+int bm_mem_read(bm_session_s *const session, const uint32_t addr, void *const buf, const size_t len)
+{
+	if (!bm_enter(session, true))
+		return BM_ERR_NO_TARGET;
+	volatile int result = BM_ERR;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = target_mem_read(session->target, buf, addr, len) ? BM_ERR : BM_OK;
+	}
+	return bm_leave(session, &e, result);
+}
+
+int bm_mem_write(bm_session_s *const session, const uint32_t addr, const void *const buf, const size_t len)
+{
+	if (!bm_enter(session, true))
+		return BM_ERR_NO_TARGET;
+	volatile int result = BM_ERR;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = target_mem_write(session->target, addr, buf, len) ? BM_ERR : BM_OK;
+	}
+	return bm_leave(session, &e, result);
+}
+
+int bm_flash_erase(bm_session_s *const session, const uint32_t addr, const size_t len)
+{
+	if (!bm_enter(session, true))
+		return BM_ERR_NO_TARGET;
+	volatile int result = BM_ERR;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = target_flash_erase(session->target, addr, len) ? BM_ERR : BM_OK;
+	}
+	return bm_leave(session, &e, result);
+}
+
+int bm_flash_write(bm_session_s *const session, const uint32_t addr, const void *const buf, const size_t len)
+{
+	if (!bm_enter(session, true))
+		return BM_ERR_NO_TARGET;
+	volatile int result = BM_ERR;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = target_flash_write(session->target, addr, buf, len) ? BM_ERR : BM_OK;
+	}
+	return bm_leave(session, &e, result);
+}
+
+int bm_flash_done(bm_session_s *const session)
+{
+	if (!bm_enter(session, true))
+		return BM_ERR_NO_TARGET;
+	volatile int result = BM_ERR;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = target_flash_done(session->target) ? BM_ERR : BM_OK;
+	}
+	return bm_leave(session, &e, result);
+}
+
+int bm_reset(bm_session_s *const session)
+{
+	if (!bm_enter(session, true))
+		return BM_ERR_NO_TARGET;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		target_reset(session->target);
+	}
+	return bm_leave(session, &e, BM_OK);
+}
+
+int bm_halt(bm_session_s *const session)
+{
+	if (!bm_enter(session, true))
+		return BM_ERR_NO_TARGET;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		target_halt_request(session->target);
+	}
+	return bm_leave(session, &e, BM_OK);
+}
+
+int bm_resume(bm_session_s *const session)
+{
+	if (!bm_enter(session, true))
+		return BM_ERR_NO_TARGET;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		target_halt_resume(session->target, false);
+	}
+	return bm_leave(session, &e, BM_OK);
+}
+
+int bm_halted(bm_session_s *const session)
+{
+	if (!bm_enter(session, true))
+		return BM_ERR_NO_TARGET;
+	volatile int result = BM_ERR;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		const enum target_halt_reason reason = target_halt_poll(session->target, NULL);
+		/* On error the target list is gone already */
+		if (reason == TARGET_HALT_ERROR) {
+			session->target = NULL;
+			result = BM_ERR_TARGET_LOST;
+		} else
+			result = reason != TARGET_HALT_RUNNING;
+	}
+	return bm_leave(session, &e, result);
+}
+
+int bm_monitor(bm_session_s *const session, const char *const command)
+{
+	char *const cmd = strdup(command);
+	if (!cmd)
+		return BM_ERR;
+	bm_enter(session, false);
+	volatile int result = BM_ERR;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		const int status = command_process(session->target, cmd);
+		result = status < 0 ? BM_ERR_NOT_FOUND : status ? BM_ERR : BM_OK;
+	}
+	free(cmd);
+	return bm_leave(session, &e, result);
+}
+
+uint32_t bm_poll(bm_session_s *const session)
+{
+	bm_enter(session, false);
+	volatile uint32_t wait = SCHED_IDLE;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		wait = sched_poll(session->target);
+	}
+	bm_leave(session, &e, BM_OK);
+	return wait;
+}
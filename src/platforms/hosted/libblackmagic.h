@@ -0,0 +1,99 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * libblackmagic: the probe and target layers of Black Magic Debug App as a
+ * library, for host tools that access a target directly rather than through
+ * GDB. Build it with "make PROBE_HOST=hosted libblackmagic.so".
+ *
+ * A session owns the probe. The probe and target layers keep global state,
+ * so there is one session per process. Its functions may be called from any
+ * thread, they are serialised on the session's lock. Data is read into and
+ * written from the caller's buffers as they are, without any encoding.
+ *
+ * Functions returning int give BM_OK or one of the negative BM_ERR_ codes.
+ * After BM_ERR_TARGET_LOST the session has no target until the next scan.
+ */
+
+#ifndef __LIBBLACKMAGIC_H
+#define __LIBBLACKMAGIC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BM_OK               0
+#define BM_ERR              -1 /* The target refused or failed the access */
+#define BM_ERR_NO_TARGET    -2 /* Nothing attached */
+#define BM_ERR_TARGET_LOST  -3 /* The probe or target stopped answering */
+#define BM_ERR_BUSY         -4 /* A session is already open */
+#define BM_ERR_NO_PROBE     -5 /* No probe matched the options */
+#define BM_ERR_NOT_FOUND    -6 /* No such target or command */
+
+typedef struct bm_session bm_session_s;
+
+/* Receives monitor command and target output */
+typedef void (*bm_output_fn)(void *context, const char *text);
+
+/*
+ * Opens the probe chosen by command line style options, the same as
+ * blackmagic takes, for example {"bm", "-s", "SERIAL"}. argv[0] is ignored.
+ * On failure session is NULL and the error is returned.
+ */
+int bm_open(bm_session_s **session, int argc, char **argv);
+void bm_close(bm_session_s *session);
+void bm_set_output(bm_session_s *session, bm_output_fn output, void *context);
+
+/* Scans for targets over SWD, or JTAG, returns how many were found or an error */
+int bm_scan(bm_session_s *session, bool jtag);
+/* Attaches the nth target found by the scan, from 1 */
+int bm_attach(bm_session_s *session, size_t n);
+void bm_detach(bm_session_s *session);
+/* The attached target's driver name, NULL if none */
+const char *bm_target_name(bm_session_s *session);
+
+int bm_mem_read(bm_session_s *session, uint32_t addr, void *buf, size_t len);
+int bm_mem_write(bm_session_s *session, uint32_t addr, const void *buf, size_t len);
+
+/* Flash is erased, written and then completed with bm_flash_done() */
+int bm_flash_erase(bm_session_s *session, uint32_t addr, size_t len);
+int bm_flash_write(bm_session_s *session, uint32_t addr, const void *buf, size_t len);
+int bm_flash_done(bm_session_s *session);
+
+int bm_reset(bm_session_s *session);
+int bm_halt(bm_session_s *session);
+int bm_resume(bm_session_s *session);
+/* 1 if halted, 0 if running, or an error */
+int bm_halted(bm_session_s *session);
+
+/* Runs a monitor command as GDB's "monitor", its output goes to the output function */
+int bm_monitor(bm_session_s *session, const char *command);
+/*
+ * Runs the background tasks once: RTT, the variable sampler and the like,
+ * set up with bm_monitor(). Returns the ms until they want to run again.
+ */
+uint32_t bm_poll(bm_session_s *session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBBLACKMAGIC_H */
@@ -49,6 +49,8 @@ int libftdi_jtagtap_init(jtag_proc_t *jtag_proc)
 	jtag_proc->jtagtap_tms_seq = jtagtap_tms_seq;
 	jtag_proc->jtagtap_tdi_tdo_seq = libftdi_jtagtap_tdi_tdo_seq;
 	jtag_proc->jtagtap_tdi_seq = jtagtap_tdi_seq;
+	jtag_proc->jtagtap_tdi_tdo_seq_deferred = libftdi_jtagtap_tdi_tdo_seq_deferred;
+	jtag_proc->jtagtap_flush = libftdi_jtagtap_flush;
 
 	active_state.data_low  |=   active_cable->jtag.set_data_low |
 		MPSSE_CS | MPSSE_DI | MPSSE_DO;
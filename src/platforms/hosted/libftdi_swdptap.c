@@ -124,6 +124,9 @@ static bool swdptap_seq_in_parity(uint32_t *res, size_t clock_cycles);
 static uint32_t swdptap_seq_in(size_t clock_cycles);
 static void swdptap_seq_out(uint32_t tms_states, size_t clock_cycles);
 static void swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles);
+static void libftdi_swd_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value);
+static void libftdi_swd_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value);
+static bool libftdi_swd_flush(ADIv5_DP_t *dp);
 
 bool libftdi_swd_possible(bool *do_mpsse, bool *direct_bb_swd)
 {
@@ -212,6 +215,12 @@ int libftdi_swdptap_init(ADIv5_DP_t *dp)
 	dp->error = firmware_swdp_error;
 	dp->low_access = firmware_swdp_low_access;
 	dp->abort = firmware_swdp_abort;
+	/* Only MPSSE can clock in SWDIO without stopping to look at it */
+	if (do_mpsse) {
+		dp->queue_write = libftdi_swd_queue_write;
+		dp->queue_read = libftdi_swd_queue_read;
+		dp->flush = libftdi_swd_flush;
+	}
 	return 0;
 }
 
@@ -410,3 +419,94 @@ static void swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles)
 		libftdi_buffer_write(cmd, index);
 	}
 }
+
+/*
+ * With overrun detection on, every SWD transfer has a data phase whatever
+ * its ACK, so a whole run of queued transfers can be encoded into outbuf
+ * without looking at anything in between. The ACKs and read data come back
+ * in one libftdi_buffer_read() and are checked afterwards. Each write
+ * returns one ACK byte, each read an ACK byte and five data/parity bytes.
+ * Keep the replies well inside the FT2232H's 4KiB receive FIFO.
+ */
+#define SWD_QUEUE_REPLY_MAX 2048U
+
+static uint32_t *swd_queue_dest[SWD_QUEUE_REPLY_MAX];
+static bool swd_queue_is_read[SWD_QUEUE_REPLY_MAX];
+static size_t swd_queue_count;
+static size_t swd_queue_reply_len;
+
+static void libftdi_swd_queue_collect(ADIv5_DP_t *dp)
+{
+	if (!swd_queue_count)
+		return;
+	uint8_t reply[SWD_QUEUE_REPLY_MAX];
+	libftdi_buffer_read(reply, swd_queue_reply_len);
+	const uint8_t *data = reply;
+	for (size_t i = 0; i < swd_queue_count; ++i) {
+		/* Bit mode reads shift in from the top */
+		const uint8_t ack = *data++ >> 5U;
+		/* WAIT and FAULT end up in STICKYORUN, anything else is a lost line */
+		if (ack != SWDP_ACK_OK && ack != SWDP_ACK_WAIT && ack != SWDP_ACK_FAULT)
+			dp->fault = 1;
+		if (!swd_queue_is_read[i])
+			continue;
+		const uint32_t value = data[0] | (data[1] << 8U) | (data[2] << 16U) | ((uint32_t)data[3] << 24U);
+		const bool parity = data[4] >> 7U;
+		data += 5U;
+		*swd_queue_dest[i] = 0;
+		if (ack != SWDP_ACK_OK)
+			continue;
+		if ((__builtin_parity(value) & 1U) != parity)
+			dp->fault = 1;
+		*swd_queue_dest[i] = value;
+	}
+	swd_queue_count = 0;
+	swd_queue_reply_len = 0;
+}
+
+static void libftdi_swd_queue_request(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t *value)
+{
+	if (swd_queue_reply_len + 6U > SWD_QUEUE_REPLY_MAX)
+		libftdi_swd_queue_collect(dp);
+	swdptap_seq_out(make_packet_request(RnW, addr), 8);
+	swdptap_turnaround(SWDIO_STATUS_FLOAT);
+	const uint8_t cmd[2] = {MPSSE_DO_READ | MPSSE_LSB | MPSSE_BITMODE, 3 - 1};
+	libftdi_buffer_write(cmd, sizeof(cmd));
+	swd_queue_dest[swd_queue_count] = value;
+	swd_queue_is_read[swd_queue_count] = RnW == ADIV5_LOW_READ;
+	++swd_queue_count;
+	swd_queue_reply_len += RnW == ADIV5_LOW_READ ? 6U : 1U;
+}
+
+static void libftdi_swd_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
+{
+	if (!dp->overrun_detect) {
+		libftdi_swd_queue_collect(dp);
+		firmware_swdp_queue_write(dp, addr, value);
+		return;
+	}
+	libftdi_swd_queue_request(dp, ADIV5_LOW_WRITE, addr, NULL);
+	/* The turnaround back to driving SWDIO comes with the data */
+	swdptap_seq_out_parity(value, 32);
+}
+
+static void libftdi_swd_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value)
+{
+	if (!dp->overrun_detect) {
+		libftdi_swd_queue_collect(dp);
+		firmware_swdp_queue_read(dp, addr, value);
+		return;
+	}
+	libftdi_swd_queue_request(dp, ADIV5_LOW_READ, addr, value);
+	/* 32 data bits and the parity bit */
+	const uint8_t cmd[5] = {
+		MPSSE_DO_READ | MPSSE_LSB, 4 - 1, 0,
+		MPSSE_DO_READ | MPSSE_LSB | MPSSE_BITMODE, 1 - 1};
+	libftdi_buffer_write(cmd, sizeof(cmd));
+}
+
+static bool libftdi_swd_flush(ADIv5_DP_t *dp)
+{
+	libftdi_swd_queue_collect(dp);
+	return firmware_swdp_flush(dp);
+}
@@ -34,12 +34,21 @@
 #include "rtt_if.h"
 #endif
 
+#ifdef PLATFORM_HAS_TRACESWO
+#include "traceswo.h"
+#include "swo_if.h"
+#endif
+
 #include "bmp_remote.h"
 #include "bmp_hosted.h"
 #include "stlinkv2.h"
 #include "ftdi_bmp.h"
 #include "jlink.h"
 #include "cmsis_dap.h"
+#include "wiretrace.h"
+#include "sim.h"
+#include "aux_if.h"
+#include "stats.h"
 
 bmp_info_t info;
 
@@ -57,6 +66,11 @@ static void exit_function(void)
 	libusb_exit_function(&info);
 
 	switch (info.bmp_type) {
+#if HOSTED_BMP_ONLY != 1
+	case BMP_TYPE_BMP:
+		bmp_traceswo_stop();
+		break;
+#endif
 	case BMP_TYPE_CMSIS_DAP:
 		dap_exit_function();
 		break;
@@ -68,6 +82,12 @@ static void exit_function(void)
 #ifdef ENABLE_RTT
 	rtt_if_exit();
 #endif
+	aux_if_exit();
+#ifdef PLATFORM_HAS_TRACESWO
+	swo_if_exit();
+#endif
+	wiretrace_close();
+	latency_print(DEBUG_WARN);
 	fflush(stdout);
 }
 
@@ -78,67 +98,116 @@ static void sigterm_handler(int sig)
 	exit(0);
 }
 
-void platform_init(int argc, char **argv)
+/* Find the probe selected by cl_opts and open it, false if that fails */
+static bool platform_probe_open(void)
 {
-	cl_init(&cl_opts, argc, argv);
-	atexit(exit_function);
-	signal(SIGTERM, sigterm_handler);
-	signal(SIGINT, sigterm_handler);
+	if (cl_opts.opt_replay_file)
+		return wiretrace_replay_open(cl_opts.opt_replay_file, &info);
+
+	if (cl_opts.opt_sim)
+		return sim_init(&cl_opts, &info) == 0;
 
 	if (cl_opts.opt_device)
 		info.bmp_type = BMP_TYPE_BMP;
 	else if (find_debuggers(&cl_opts, &info))
-		exit(-1);
+		return false;
 
 	bmp_ident(&info);
 
 	switch (info.bmp_type) {
 	case BMP_TYPE_BMP:
+#if HOSTED_BMP_ONLY != 1
+		/* The tty stays the fallback for firmware without the vendor interface */
+		if (bmp_remote_usb_open(&info) == 0) {
+			remote_init();
+			return true;
+		}
+#endif
 		if (serial_open(&cl_opts, info.serial))
-			exit(-1);
+			return false;
 		remote_init();
-		break;
+		return true;
 
 	case BMP_TYPE_STLINKV2:
-		if (stlink_init(&info))
-			exit(-1);
-		break;
+		return stlink_init(&info) == 0;
 
 	case BMP_TYPE_CMSIS_DAP:
-		if (dap_init(&info))
-			exit(-1);
-		break;
+		return dap_init(&info) == 0;
 
 	case BMP_TYPE_LIBFTDI:
-		if (ftdi_bmp_init(&cl_opts, &info))
-			exit(-1);
-		break;
+		return ftdi_bmp_init(&cl_opts, &info) == 0;
 
 	case BMP_TYPE_JLINK:
-		if (jlink_init(&info))
-			exit(-1);
-		break;
+		return jlink_init(&info) == 0;
 
 	default:
-		exit(-1);
+		return false;
 	}
+}
+
+/* Find the probe selected by cl_opts and open it, exits if that fails */
+static void platform_probe_init(void)
+{
+	if (!platform_probe_open())
+		exit(-1);
+}
+
+void platform_init(int argc, char **argv)
+{
+	cl_init(&cl_opts, argc, argv);
+	atexit(exit_function);
+	signal(SIGTERM, sigterm_handler);
+	signal(SIGINT, sigterm_handler);
+
+	if (cl_opts.opt_gang)
+		exit(cl_gang_execute(&cl_opts, platform_probe_init));
+	platform_probe_init();
+	if (cl_opts.opt_record_file && !wiretrace_record_open(cl_opts.opt_record_file))
+		exit(-1);
 
 	if (cl_opts.opt_mode != BMP_MODE_DEBUG)
 		exit(cl_execute(&cl_opts));
 	else {
+		if (cl_opts.opt_gdb_ports > 1)
+			gdb_if_sessions_set(cl_opts.opt_gdb_ports);
 		gdb_if_init();
 
 #ifdef ENABLE_RTT
+		if (cl_opts.opt_rtt && !rtt_if_transport(cl_opts.opt_rtt)) {
+			DEBUG_WARN("RTT can't go to %s\n", cl_opts.opt_rtt);
+			exit(1);
+		}
 		rtt_if_init();
+#else
+		if (cl_opts.opt_rtt)
+			DEBUG_WARN("Built without RTT, --rtt is ignored\n");
 #endif
 		return;
 	}
 }
 
+/*
+ * For libblackmagic: select and open the probe with the command line
+ * options, without the GDB server or exiting when that fails.
+ */
+bool platform_lib_init(int argc, char **argv)
+{
+	cl_init(&cl_opts, argc, argv);
+	if (!platform_probe_open())
+		return false;
+	return !cl_opts.opt_record_file || wiretrace_record_open(cl_opts.opt_record_file);
+}
+
+void platform_lib_exit(void)
+{
+	exit_function();
+}
+
 uint32_t platform_adiv5_swdp_scan(uint32_t targetid)
 {
 	info.is_jtag = false;
 	platform_max_frequency_set(cl_opts.opt_max_swj_frequency);
+	platform_wait_policy_set();
 
 	switch (info.bmp_type) {
 	case BMP_TYPE_BMP:
@@ -153,6 +222,12 @@ uint32_t platform_adiv5_swdp_scan(uint32_t targetid)
 	case BMP_TYPE_JLINK:
 		return jlink_swdp_scan(&info);
 
+	case BMP_TYPE_REPLAY:
+		return wiretrace_replay_scan();
+
+	case BMP_TYPE_SIM:
+		return sim_swdp_scan(targetid);
+
 	default:
 		return 0;
 	}
@@ -169,11 +244,15 @@ int swdptap_init(ADIv5_DP_t *dp)
 
 	case BMP_TYPE_STLINKV2:
 	case BMP_TYPE_JLINK:
+	case BMP_TYPE_REPLAY:
 		return 0;
 
 	case BMP_TYPE_LIBFTDI:
 		return libftdi_swdptap_init(dp);
 
+	case BMP_TYPE_SIM:
+		return sim_swdptap_init(dp);
+
 	default:
 		return -1;
 	}
@@ -190,6 +269,7 @@ uint32_t platform_jtag_scan(const uint8_t *lrlens)
 	info.is_jtag = true;
 
 	platform_max_frequency_set(cl_opts.opt_max_swj_frequency);
+	platform_wait_policy_set();
 
 	switch (info.bmp_type) {
 	case BMP_TYPE_BMP:
@@ -201,11 +281,35 @@ uint32_t platform_jtag_scan(const uint8_t *lrlens)
 	case BMP_TYPE_STLINKV2:
 		return jtag_scan_stlinkv2(&info, lrlens);
 
+	case BMP_TYPE_REPLAY:
+		return wiretrace_replay_scan();
+
+	case BMP_TYPE_SIM:
+		DEBUG_WARN("The simulated target only has SWD\n");
+		return 0;
+
 	default:
 		return 0;
 	}
 }
 
+int platform_jtag_raw_init(void)
+{
+	info.is_jtag = true;
+	platform_max_frequency_set(cl_opts.opt_max_swj_frequency);
+
+	switch (info.bmp_type) {
+	case BMP_TYPE_BMP:
+	case BMP_TYPE_LIBFTDI:
+	case BMP_TYPE_JLINK:
+	case BMP_TYPE_CMSIS_DAP:
+		return platform_jtagtap_init();
+
+	default:
+		return -1;
+	}
+}
+
 int platform_jtagtap_init(void)
 {
 	switch (info.bmp_type) {
@@ -213,6 +317,7 @@ int platform_jtagtap_init(void)
 		return remote_jtagtap_init(&jtag_proc);
 
 	case BMP_TYPE_STLINKV2:
+	case BMP_TYPE_REPLAY:
 		return 0;
 
 	case BMP_TYPE_LIBFTDI:
@@ -252,6 +357,11 @@ void platform_adiv5_dp_defaults(ADIv5_DP_t *dp)
 	}
 }
 
+void platform_adiv5_dp_ready(ADIv5_DP_t *dp)
+{
+	wiretrace_dp_ready(dp);
+}
+
 int platform_jtag_dp_init(ADIv5_DP_t *dp)
 {
 	switch (info.bmp_type) {
@@ -292,6 +402,12 @@ char *platform_ident(void)
 	case BMP_TYPE_JLINK:
 		return "J-Link";
 
+	case BMP_TYPE_REPLAY:
+		return "Replay";
+
+	case BMP_TYPE_SIM:
+		return "Simulator";
+
 	default:
 		return NULL;
 	}
@@ -312,6 +428,9 @@ const char *platform_target_voltage(void)
 	case BMP_TYPE_JLINK:
 		return jlink_target_voltage(&info);
 
+	case BMP_TYPE_SIM:
+		return sim_target_voltage();
+
 	default:
 		return NULL;
 	}
@@ -335,6 +454,9 @@ void platform_nrst_set_val(bool assert)
 	case BMP_TYPE_CMSIS_DAP:
 		return dap_nrst_set_val(assert);
 
+	case BMP_TYPE_SIM:
+		return sim_nrst_set_val(assert);
+
 	default:
 		break;
 	}
@@ -355,11 +477,31 @@ bool platform_nrst_get_val(void)
 	case BMP_TYPE_LIBFTDI:
 		return libftdi_nrst_get_val();
 
+	case BMP_TYPE_SIM:
+		return sim_nrst_get_val();
+
 	default:
 		return false;
 	}
 }
 
+/* Hands adiv5_wait_policy to probes that run the DP transfers themselves */
+void platform_wait_policy_set(void)
+{
+	switch (info.bmp_type) {
+	case BMP_TYPE_BMP:
+		remote_wait_policy_set();
+		break;
+
+	case BMP_TYPE_CMSIS_DAP:
+		dap_wait_policy_set();
+		break;
+
+	default:
+		break;
+	}
+}
+
 void platform_max_frequency_set(uint32_t freq)
 {
 	if (!freq)
@@ -386,6 +528,10 @@ void platform_max_frequency_set(uint32_t freq)
 		jlink_max_frequency_set(&info, freq);
 		break;
 
+	case BMP_TYPE_REPLAY:
+	case BMP_TYPE_SIM:
+		break;
+
 	default:
 		DEBUG_WARN("Setting max SWJ frequency not yet implemented\n");
 		break;
@@ -417,6 +563,10 @@ uint32_t platform_max_frequency_get(void)
 	case BMP_TYPE_JLINK:
 		return jlink_max_frequency_get(&info);
 
+	case BMP_TYPE_REPLAY:
+	case BMP_TYPE_SIM:
+		return FREQ_FIXED;
+
 	default:
 		DEBUG_WARN("Reading max SWJ frequency not yet implemented\n");
 		return 0;
@@ -495,6 +645,91 @@ void platform_target_clk_output_enable(const bool enable)
 	}
 }
 
+#ifdef PLATFORM_HAS_TRACESWO
+bool traceswo_init(const uint32_t baudrate, const uint32_t swo_chan_bitmask)
+{
+	switch (info.bmp_type) {
+	case BMP_TYPE_BMP:
+		return bmp_traceswo_init(&info, baudrate, swo_chan_bitmask);
+
+	case BMP_TYPE_CMSIS_DAP:
+		return dap_swo_init(baudrate, swo_chan_bitmask);
+
+	case BMP_TYPE_STLINKV2:
+		return stlink_traceswo_init(baudrate, swo_chan_bitmask);
+
+	default:
+		return false;
+	}
+}
+
+void traceswo_poll(void)
+{
+	swo_if_poll();
+	switch (info.bmp_type) {
+	case BMP_TYPE_BMP:
+		bmp_traceswo_poll();
+		break;
+
+	case BMP_TYPE_CMSIS_DAP:
+		dap_swo_poll();
+		break;
+
+	case BMP_TYPE_STLINKV2:
+		stlink_traceswo_poll();
+		break;
+
+	default:
+		break;
+	}
+}
+#endif
+
+static bool platform_cache_path(char *const path, const size_t size, const char *const name)
+{
+	const char *dir = getenv("XDG_CACHE_HOME");
+	const char *subdir = "";
+	if (!dir) {
+		dir = getenv("LOCALAPPDATA");
+		if (!dir) {
+			dir = getenv("HOME");
+			subdir = "/.cache";
+		}
+	}
+	if (!dir)
+		return false;
+	const int len = snprintf(path, size, "%s%s/blackmagic-%s", dir, subdir, name);
+	return len > 0 && (size_t)len < size;
+}
+
+bool platform_cache_read(const char *const name, void *const data, const size_t len)
+{
+	char path[512];
+	if (!platform_cache_path(path, sizeof(path), name))
+		return false;
+	FILE *const file = fopen(path, "rb");
+	if (!file)
+		return false;
+	const bool result = fread(data, 1, len, file) == len && fgetc(file) == EOF;
+	fclose(file);
+	return result;
+}
+
+void platform_cache_write(const char *const name, const void *const data, const size_t len)
+{
+	char path[512];
+	if (!platform_cache_path(path, sizeof(path), name))
+		return;
+	FILE *const file = fopen(path, "wb");
+	if (!file) {
+		DEBUG_INFO("Can not write cache file %s\n", path);
+		return;
+	}
+	if (fwrite(data, 1, len, file) != len)
+		DEBUG_WARN("Writing cache file %s failed\n", path);
+	fclose(file);
+}
+
 static void ap_decode_access(uint16_t addr, uint8_t RnW)
 {
 	if (RnW)
@@ -600,6 +835,7 @@ uint32_t adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr)
 
 uint32_t adiv5_dp_error(ADIv5_DP_t *dp)
 {
+	adiv5_dp_barrier(dp);
 	uint32_t ret = dp->error(dp);
 	DEBUG_TARGET("DP Error 0x%08" PRIx32 "\n", ret);
 	return ret;
@@ -634,6 +870,14 @@ void adiv5_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 	return ap->dp->ap_write(ap, addr, value);
 }
 
+uint32_t adiv5_mem_wait32(ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t busy_value, uint32_t timeout_ms)
+{
+	const uint32_t ret = ap->dp->mem_wait32(ap, addr, mask, busy_value, timeout_ms);
+	DEBUG_TARGET("ap_mem_wait32 @ %" PRIx32 " mask %08" PRIx32 " busy %08" PRIx32 ": %08" PRIx32 "\n", addr, mask,
+		busy_value, ret);
+	return ret;
+}
+
 void adiv5_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 {
 	ap->dp->mem_read(ap, dest, src, len);
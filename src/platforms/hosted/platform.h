@@ -5,14 +5,29 @@
 
 char *platform_ident(void);
 void platform_buffer_flush(void);
+/* Probe set up and tear down for libblackmagic, in place of platform_init() */
+bool platform_lib_init(int argc, char **argv);
+void platform_lib_exit(void);
+/* JTAG to the chain as it is, without scanning it. Non-zero if the probe can't */
+int platform_jtag_raw_init(void);
 
 #define PLATFORM_IDENT     "(PC-Hosted) "
 #define SET_IDLE_STATE(x)
 #define SET_RUN_STATE(x)
 #define PLATFORM_HAS_POWER_SWITCH
+#if HOSTED_BMP_ONLY != 1
+/* SWO capture through native BMP, CMSIS-DAP and ST-Link probes, decoded on the host */
+#define PLATFORM_HAS_TRACESWO
+#define TRACESWO_PROTOCOL 2
+#endif
 
 #define SYSTICKHZ 1000
 
+#define GDB_PACKET_BUFFER_SIZE 16384U
+#define GDB_RX_BUF_SIZE 4096U
+#define TARGET_MEM_CACHE_LINES 32U
+#define TARGET_FLASH_DELTA_MAX_BLOCK 0x20000U
+
 #define VENDOR_ID_BMP            0x1d50
 #define PRODUCT_ID_BMP_BL        0x6017
 #define PRODUCT_ID_BMP           0x6018
@@ -37,7 +52,9 @@ typedef enum bmp_type_e {
 	BMP_TYPE_STLINKV2,
 	BMP_TYPE_LIBFTDI,
 	BMP_TYPE_CMSIS_DAP,
-	BMP_TYPE_JLINK
+	BMP_TYPE_JLINK,
+	BMP_TYPE_REPLAY,
+	BMP_TYPE_SIM
 } bmp_type_t;
 
 void gdb_ident(char *p, int count);
@@ -35,6 +35,7 @@
 #include "jtagtap.h"
 #include "bmp_hosted.h"
 #include "bmp_remote.h"
+#include "hex_utils.h"
 
 static void jtagtap_reset(void);
 static void jtagtap_tms_seq(uint32_t tms_states, size_t ticks);
@@ -42,6 +43,41 @@ static void jtagtap_tdi_tdo_seq(uint8_t *data_out, bool final_tms, const uint8_t
 static void jtagtap_tdi_seq(bool final_tms, const uint8_t *data_in, size_t clock_cycles);
 static bool jtagtap_next(bool tms, bool tdi);
 static void jtagtap_cycle(bool tms, bool tdi, size_t clock_cycles);
+static void jtagtap_tdi_tdo_seq_deferred(uint8_t *data_out, bool final_tms, const uint8_t *data_in, size_t clock_cycles);
+static void jtagtap_flush(void);
+static void jtagtap_batch_tms_seq(uint32_t tms_states, size_t clock_cycles);
+static void jtagtap_batch_tdi_tdo_seq(uint8_t *data_out, bool final_tms, const uint8_t *data_in, size_t clock_cycles);
+static void jtagtap_batch_tdi_seq(bool final_tms, const uint8_t *data_in, size_t clock_cycles);
+static void jtagtap_batch_tdi_tdo_seq_deferred(
+	uint8_t *data_out, bool final_tms, const uint8_t *data_in, size_t clock_cycles);
+
+/*
+ * Deferred scans send their requests without waiting for the replies, which
+ * are read back in order at flush. While any are outstanding, requests that
+ * return no data don't wait either. The limit keeps what the probe has to
+ * buffer on its side small.
+ */
+#define REMOTE_JTAG_DEFER_MAX 16U
+
+static uint8_t *deferred_data_out[REMOTE_JTAG_DEFER_MAX];
+static uint8_t deferred_bytes[REMOTE_JTAG_DEFER_MAX];
+static size_t deferred_count = 0;
+
+/*
+ * With HL version 8 on, sequences are queued up into one JB instead, sent
+ * once a capture is needed, the batch is full or anything else goes to the
+ * probe. A deferred capture doesn't send it, so a whole JTAG-DP transaction
+ * can be a single round trip.
+ */
+#define REMOTE_JTAG_BATCH_TDI_LEN  19U
+#define REMOTE_JTAG_BATCH_CAPTURES (REMOTE_BATCH_MAX_LEN / REMOTE_JTAG_BATCH_TDI_LEN)
+
+static char batch[REMOTE_BATCH_MAX_LEN + 1U];
+static size_t batch_len = 0;
+static size_t batch_captured = 0;
+static uint8_t *batch_data_out[REMOTE_JTAG_BATCH_CAPTURES];
+static uint8_t batch_bytes[REMOTE_JTAG_BATCH_CAPTURES];
+static size_t batch_captures = 0;
 
 static inline unsigned int bool_to_int(const bool value)
 {
@@ -64,21 +100,60 @@ int remote_jtagtap_init(jtag_proc_t *jtag_proc)
 	jtag_proc->jtagtap_tms_seq = jtagtap_tms_seq;
 	jtag_proc->jtagtap_tdi_tdo_seq = jtagtap_tdi_tdo_seq;
 	jtag_proc->jtagtap_tdi_seq = jtagtap_tdi_seq;
+	jtag_proc->jtagtap_tdi_tdo_seq_deferred = jtagtap_tdi_tdo_seq_deferred;
+	jtag_proc->jtagtap_flush = jtagtap_flush;
 
-	platform_buffer_write((uint8_t *)REMOTE_HL_CHECK_STR, sizeof(REMOTE_HL_CHECK_STR));
-	length = platform_buffer_read((uint8_t *)buffer, REMOTE_MAX_MSG_SIZE);
-	if (!length || buffer[0] == REMOTE_RESP_ERR || buffer[0] == 1)
+	const uint32_t version = remote_hl_version();
+	if (!version)
 		PRINT_INFO("Firmware does not support newer JTAG commands, please update it.");
 	else
 		jtag_proc->jtagtap_cycle = jtagtap_cycle;
+	if (version >= 8) {
+		jtag_proc->jtagtap_tms_seq = jtagtap_batch_tms_seq;
+		jtag_proc->jtagtap_tdi_tdo_seq = jtagtap_batch_tdi_tdo_seq;
+		jtag_proc->jtagtap_tdi_seq = jtagtap_batch_tdi_seq;
+		jtag_proc->jtagtap_tdi_tdo_seq_deferred = jtagtap_batch_tdi_tdo_seq_deferred;
+		jtag_proc->jtagtap_flush = remote_jtagtap_flush;
+	}
 
 	return 0;
 }
 
 /* See remote.c/.h for protocol information */
 
+static void jtagtap_read_reply(const char *const func, uint8_t *const data_out, const size_t bytes)
+{
+	char buffer[REMOTE_MAX_MSG_SIZE];
+	const int length = platform_buffer_read((uint8_t *)buffer, REMOTE_MAX_MSG_SIZE);
+	if (!length || buffer[0] == REMOTE_RESP_ERR) {
+		DEBUG_WARN("%s failed, error %s\n", func, length ? buffer + 1 : "unknown");
+		exit(-1);
+	}
+	if (data_out) {
+		const uint64_t data = remotehston(-1, buffer + 1);
+		for (size_t i = 0; i < bytes; ++i)
+			data_out[i] = (uint8_t)(data >> (i * 8U));
+	}
+}
+
+static void jtagtap_defer_reply(uint8_t *const data_out, const size_t bytes)
+{
+	if (deferred_count == REMOTE_JTAG_DEFER_MAX)
+		jtagtap_flush();
+	deferred_data_out[deferred_count] = data_out;
+	deferred_bytes[deferred_count++] = bytes;
+}
+
+static void jtagtap_flush(void)
+{
+	for (size_t i = 0; i < deferred_count; ++i)
+		jtagtap_read_reply("jtagtap_tdi_tdo_seq_deferred", deferred_data_out[i], deferred_bytes[i]);
+	deferred_count = 0;
+}
+
 static void jtagtap_reset(void)
 {
+	jtagtap_flush();
 	platform_buffer_write((uint8_t *)REMOTE_JTAG_RESET_STR, sizeof(REMOTE_JTAG_RESET_STR));
 	char buffer[REMOTE_MAX_MSG_SIZE];
 	const int length = platform_buffer_read((uint8_t *)buffer, REMOTE_MAX_MSG_SIZE);
@@ -91,14 +166,13 @@ static void jtagtap_reset(void)
 static void jtagtap_tms_seq(uint32_t tms_states, size_t clock_cycles)
 {
 	char buffer[REMOTE_MAX_MSG_SIZE];
-	int length = snprintf(buffer, REMOTE_MAX_MSG_SIZE, REMOTE_JTAG_TMS_STR, clock_cycles, tms_states);
+	const int length = snprintf(buffer, REMOTE_MAX_MSG_SIZE, REMOTE_JTAG_TMS_STR, clock_cycles, tms_states);
 	platform_buffer_write((uint8_t *)buffer, length);
 
-	length = platform_buffer_read((uint8_t *)buffer, REMOTE_MAX_MSG_SIZE);
-	if (!length || buffer[0] == REMOTE_RESP_ERR) {
-		DEBUG_WARN("jtagtap_tms_seq failed, error %s\n", length ? buffer + 1 : "unknown");
-		exit(-1);
-	}
+	if (deferred_count)
+		jtagtap_defer_reply(NULL, 0);
+	else
+		jtagtap_read_reply(__func__, NULL, 0);
 }
 
 /* At least up to v1.7.1-233, remote handles only up to 32 clock cycles in one
@@ -107,7 +181,8 @@ static void jtagtap_tms_seq(uint32_t tms_states, size_t clock_cycles)
  * FIXME: Provide and test faster call and keep fallback
  * for old firmware
  */
-static void jtagtap_tdi_tdo_seq(uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+static void jtagtap_tdi_tdo_chunks(uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in,
+	const size_t clock_cycles, const bool deferred)
 {
 	if (!clock_cycles || (!data_in && !data_out))
 		return;
@@ -127,26 +202,35 @@ static void jtagtap_tdi_tdo_seq(uint8_t *const data_out, const bool final_tms, c
 		const size_t bytes = (chunk + 7U) >> 3U;
 		if (data_in) {
 			for (size_t i = 0; i < bytes; ++i)
-				data |= data_in[in_offset++] << (i * 8U);
+				data |= (uint64_t)data_in[in_offset++] << (i * 8U);
 		}
 		/* PRIx64 differs with system. Use it explicit in the format string*/
-		int length = snprintf(buffer, REMOTE_MAX_MSG_SIZE, "!J%c%02zx%" PRIx64 "%c",
-			!clock_cycles && final_tms ? REMOTE_TDITDO_TMS : REMOTE_TDITDO_NOTMS, chunk, data, REMOTE_EOM);
+		const int length = snprintf(buffer, REMOTE_MAX_MSG_SIZE, "!J%c%02zx%" PRIx64 "%c",
+			cycle == clock_cycles && final_tms ? REMOTE_TDITDO_TMS : REMOTE_TDITDO_NOTMS, chunk, data, REMOTE_EOM);
 		platform_buffer_write((uint8_t *)buffer, length);
 
-		length = platform_buffer_read((uint8_t *)buffer, REMOTE_MAX_MSG_SIZE);
-		if (!length || buffer[0] == REMOTE_RESP_ERR) {
-			DEBUG_WARN("jtagtap_tdi_tdo_seq failed, error %s\n", length ? buffer + 1 : "unknown");
-			exit(-1);
-		}
-		if (data_out) {
-			const uint64_t data = remotehston(-1, buffer + 1);
-			for (size_t i = 0; i < bytes; ++i)
-				data_out[out_offset++] = (uint8_t)(data >> (i * 8U));
-		}
+		uint8_t *const chunk_out = data_out ? data_out + out_offset : NULL;
+		out_offset += bytes;
+		if (deferred)
+			jtagtap_defer_reply(chunk_out, bytes);
+		else
+			jtagtap_read_reply("jtagtap_tdi_tdo_seq", chunk_out, bytes);
 	}
 }
 
+static void jtagtap_tdi_tdo_seq(uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	/* Deferred replies come first, and without captures there's no need to wait for this one either */
+	if (data_out)
+		jtagtap_flush();
+	jtagtap_tdi_tdo_chunks(data_out, final_tms, data_in, clock_cycles, deferred_count != 0);
+}
+
+static void jtagtap_tdi_tdo_seq_deferred(uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	jtagtap_tdi_tdo_chunks(data_out, final_tms, data_in, clock_cycles, true);
+}
+
 static void jtagtap_tdi_seq(const bool final_tms, const uint8_t *data_in, size_t clock_cycles)
 {
 	return jtagtap_tdi_tdo_seq(NULL, final_tms, data_in, clock_cycles);
@@ -154,6 +238,7 @@ static void jtagtap_tdi_seq(const bool final_tms, const uint8_t *data_in, size_t
 
 static bool jtagtap_next(const bool tms, const bool tdi)
 {
+	jtagtap_flush();
 	char buffer[REMOTE_MAX_MSG_SIZE];
 	int length = snprintf((char *)buffer, REMOTE_MAX_MSG_SIZE, REMOTE_JTAG_NEXT, bool_to_int(tms), bool_to_int(tdi));
 	platform_buffer_write((uint8_t *)buffer, length);
@@ -169,6 +254,7 @@ static bool jtagtap_next(const bool tms, const bool tdi)
 
 static void jtagtap_cycle(const bool tms, const bool tdi, const size_t clock_cycles)
 {
+	jtagtap_flush();
 	char buffer[REMOTE_MAX_MSG_SIZE];
 	int length =
 		snprintf(buffer, REMOTE_MAX_MSG_SIZE, REMOTE_JTAG_CYCLE_STR, bool_to_int(tms), bool_to_int(tdi), clock_cycles);
@@ -180,3 +266,106 @@ static void jtagtap_cycle(const bool tms, const bool tdi, const size_t clock_cyc
 		exit(-1);
 	}
 }
+
+void remote_jtagtap_flush(void)
+{
+	if (!batch_len)
+		return;
+	/* Sending goes through here again, so start on an empty batch */
+	const size_t length = batch_len;
+	const size_t captured = batch_captured;
+	const size_t captures = batch_captures;
+	batch_len = 0;
+	batch_captured = 0;
+	batch_captures = 0;
+
+	char buffer[REMOTE_MAX_MSG_SIZE];
+	const int header = snprintf(buffer, REMOTE_MAX_MSG_SIZE, "%s", REMOTE_JTAG_BATCH_STR);
+	memcpy(buffer + header, batch, length);
+	buffer[header + length] = REMOTE_EOM;
+	buffer[header + length + 1U] = 0;
+	platform_buffer_write((uint8_t *)buffer, header + length + 1U);
+
+	const int reply = platform_buffer_read((uint8_t *)buffer, REMOTE_MAX_MSG_SIZE);
+	if (reply < 1 || buffer[0] != REMOTE_RESP_OK || (captured && reply < 1 + (int)captured * 2)) {
+		DEBUG_WARN("jtagtap_batch failed, error %s\n", reply ? buffer + 1 : "unknown");
+		exit(-1);
+	}
+	uint8_t tdo[REMOTE_BATCH_MAX_CAPTURE];
+	unhexify(tdo, buffer + 1, captured);
+	size_t offset = 0;
+	for (size_t i = 0; i < captures; ++i) {
+		if (batch_data_out[i])
+			memcpy(batch_data_out[i], tdo + offset, batch_bytes[i]);
+		offset += batch_bytes[i];
+	}
+}
+
+/* Makes room for a step of length characters capturing bytes of TDO */
+static void jtagtap_batch_reserve(const size_t length, const size_t bytes)
+{
+	if (batch_len + length > REMOTE_BATCH_MAX_LEN || batch_captured + bytes > REMOTE_BATCH_MAX_CAPTURE ||
+		(bytes && batch_captures == REMOTE_JTAG_BATCH_CAPTURES))
+		remote_jtagtap_flush();
+}
+
+static void jtagtap_batch_tms_seq(const uint32_t tms_states, const size_t clock_cycles)
+{
+	jtagtap_batch_reserve(11U, 0);
+	batch_len += snprintf(batch + batch_len, sizeof(batch) - batch_len, "%c%02zx%08" PRIx32, REMOTE_TMS,
+		clock_cycles, tms_states);
+}
+
+static void jtagtap_batch_tdi_tdo_chunks(
+	uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	if (!clock_cycles || (!data_in && !data_out))
+		return;
+
+	size_t offset = 0;
+	for (size_t cycle = 0; cycle < clock_cycles;) {
+		const size_t chunk = MIN(clock_cycles - cycle, 64U);
+		cycle += chunk;
+		const size_t bytes = (chunk + 7U) >> 3U;
+		uint64_t data = 0;
+		if (data_in) {
+			for (size_t i = 0; i < bytes; ++i)
+				data |= (uint64_t)data_in[offset + i] << (i * 8U);
+		}
+		const bool tms = cycle == clock_cycles && final_tms;
+		char step;
+		if (data_out)
+			step = tms ? REMOTE_TDITDO_TMS : REMOTE_TDITDO_NOTMS;
+		else
+			step = tms ? REMOTE_TDI_TMS : REMOTE_TDI_NOTMS;
+
+		jtagtap_batch_reserve(REMOTE_JTAG_BATCH_TDI_LEN, data_out ? bytes : 0);
+		batch_len += snprintf(
+			batch + batch_len, sizeof(batch) - batch_len, "%c%02zx%016" PRIx64, step, chunk, data);
+		if (data_out) {
+			batch_data_out[batch_captures] = data_out + offset;
+			batch_bytes[batch_captures++] = bytes;
+			batch_captured += bytes;
+		}
+		offset += bytes;
+	}
+}
+
+static void jtagtap_batch_tdi_tdo_seq(
+	uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	jtagtap_batch_tdi_tdo_chunks(data_out, final_tms, data_in, clock_cycles);
+	if (data_out)
+		remote_jtagtap_flush();
+}
+
+static void jtagtap_batch_tdi_seq(const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	jtagtap_batch_tdi_tdo_chunks(NULL, final_tms, data_in, clock_cycles);
+}
+
+static void jtagtap_batch_tdi_tdo_seq_deferred(
+	uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	jtagtap_batch_tdi_tdo_chunks(data_out, final_tms, data_in, clock_cycles);
+}
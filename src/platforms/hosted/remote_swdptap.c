@@ -29,11 +29,25 @@
 #include "general.h"
 #include "remote.h"
 #include "bmp_remote.h"
+#include "hex_utils.h"
 
 static bool swdptap_seq_in_parity(uint32_t *res, size_t clock_cycles);
 static uint32_t swdptap_seq_in(size_t clock_cycles);
 static void swdptap_seq_out(uint32_t tms_states, size_t clock_cycles);
 static void swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles);
+static bool swdptap_batch_seq_in_parity(uint32_t *res, size_t clock_cycles);
+static uint32_t swdptap_batch_seq_in(size_t clock_cycles);
+static void swdptap_batch_seq_out(uint32_t tms_states, size_t clock_cycles);
+static void swdptap_batch_seq_out_parity(uint32_t tms_states, size_t clock_cycles);
+
+/*
+ * With HL version 8 on, outputs are queued up into one SB instead, sent
+ * along with the next input or once anything else goes to the probe. A
+ * request and its ACK then take one round trip, as does a write's data
+ * with the request of the transaction after it.
+ */
+static char batch[REMOTE_BATCH_MAX_LEN + 1U];
+static size_t batch_len = 0;
 
 int remote_swdptap_init(ADIv5_DP_t *dp)
 {
@@ -56,6 +70,12 @@ int remote_swdptap_init(ADIv5_DP_t *dp)
 	dp->error = firmware_swdp_error;
 	dp->low_access = firmware_swdp_low_access;
 	dp->abort = firmware_swdp_abort;
+	if (remote_hl_version() >= 8) {
+		dp->seq_in = swdptap_batch_seq_in;
+		dp->seq_in_parity = swdptap_batch_seq_in_parity;
+		dp->seq_out = swdptap_batch_seq_out;
+		dp->seq_out_parity = swdptap_batch_seq_out_parity;
+	}
 	return 0;
 }
 
@@ -124,3 +144,74 @@ static void swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles)
 		exit(-1);
 	}
 }
+
+/* Sends the batch, returning whether the parity check of its read failed */
+static bool swdptap_batch_run(uint32_t *const res)
+{
+	/* Sending goes through remote_batch_flush() again, so start on an empty batch */
+	const size_t length = batch_len;
+	batch_len = 0;
+
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const int header = snprintf(construct, REMOTE_MAX_MSG_SIZE, "%s", REMOTE_SWDP_BATCH_STR);
+	memcpy(construct + header, batch, length);
+	construct[header + length] = REMOTE_EOM;
+	construct[header + length + 1U] = 0;
+	platform_buffer_write((uint8_t *)construct, header + length + 1U);
+
+	const int s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+	if (s < 1 || construct[0] == REMOTE_RESP_ERR || (res && s < 9)) {
+		DEBUG_WARN("swdptap_batch failed, error %s\n", s ? construct + 1 : "short response");
+		exit(-1);
+	}
+	if (res)
+		unhexify(res, construct + 1, sizeof(*res));
+	return construct[0] != REMOTE_RESP_OK;
+}
+
+void remote_swdptap_flush(void)
+{
+	if (batch_len)
+		swdptap_batch_run(NULL);
+}
+
+static void swdptap_batch_add(const char step, const uint32_t value, const size_t clock_cycles)
+{
+	if (batch_len + 11U > REMOTE_BATCH_MAX_LEN)
+		remote_swdptap_flush();
+	if (step == REMOTE_IN || step == REMOTE_IN_PAR)
+		batch_len += snprintf(batch + batch_len, sizeof(batch) - batch_len, "%c%02zx", step, clock_cycles);
+	else
+		batch_len += snprintf(
+			batch + batch_len, sizeof(batch) - batch_len, "%c%02zx%08" PRIx32, step, clock_cycles, value);
+}
+
+static bool swdptap_batch_seq_in_parity(uint32_t *const res, const size_t clock_cycles)
+{
+	swdptap_batch_add(REMOTE_IN_PAR, 0, clock_cycles);
+	const bool bad_parity = swdptap_batch_run(res);
+	DEBUG_PROBE("swdptap_seq_in_parity  %2d clock_cycles: %08" PRIx32 " %s\n", clock_cycles, *res,
+		bad_parity ? "ERR" : "OK");
+	return bad_parity;
+}
+
+static uint32_t swdptap_batch_seq_in(const size_t clock_cycles)
+{
+	swdptap_batch_add(REMOTE_IN, 0, clock_cycles);
+	uint32_t res = 0;
+	swdptap_batch_run(&res);
+	DEBUG_PROBE("swdptap_seq_in         %2d clock_cycles: %08" PRIx32 "\n", clock_cycles, res);
+	return res;
+}
+
+static void swdptap_batch_seq_out(const uint32_t tms_states, const size_t clock_cycles)
+{
+	DEBUG_PROBE("swdptap_seq_out        %2d clock_cycles: %08" PRIx32 "\n", clock_cycles, tms_states);
+	swdptap_batch_add(REMOTE_OUT, tms_states, clock_cycles);
+}
+
+static void swdptap_batch_seq_out_parity(const uint32_t tms_states, const size_t clock_cycles)
+{
+	DEBUG_PROBE("swdptap_seq_out_parity %2d clock_cycles: %08" PRIx32 "\n", clock_cycles, tms_states);
+	swdptap_batch_add(REMOTE_OUT_PAR, tms_states, clock_cycles);
+}
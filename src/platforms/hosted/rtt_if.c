@@ -27,12 +27,39 @@
 #include <general.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <rtt.h>
 #include <rtt_if.h>
 
-/* maybe rewrite this as tcp server */
-
 #ifndef WIN32
 #include <termios.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+/*
+ * With rtt mux on, each channel is served on its own tcp port, from
+ * rtt_mux_port up, or on its own unix socket, PATH.n, when a path was given
+ * with --rtt. A client gets up channel n and what it sends goes to down
+ * channel n. Nothing waits on a slow or missing client: the sockets
+ * are non-blocking, with what the kernel can't take yet held in a buffer
+ * per channel. That buffer also holds what comes before a client connects.
+ */
+#define RTT_MUX_BUF_SIZE (256U * 1024U)
+#define RTT_MUX_SNDBUF (1024 * 1024)
+
+typedef struct rtt_mux_chan {
+	int serv;	/* listening socket, -1 when not open yet */
+	int conn;	/* client, -1 when none */
+	bool failed;	/* port could not be opened, don't retry */
+	char *buf;
+	uint32_t start;
+	uint32_t len;
+} rtt_mux_chan_s;
+
+static rtt_mux_chan_s mux_chan[MAX_RTT_CHAN];
+/* unix socket path the channel number is appended to, NULL for tcp ports */
+static const char *mux_path;
 
 /* linux */
 static struct termios saved_ttystate;
@@ -42,6 +69,13 @@ static bool tty_saved = false;
 
 int rtt_if_init()
 {
+	for (size_t i = 0; i < MAX_RTT_CHAN; i++) {
+		mux_chan[i].serv = -1;
+		mux_chan[i].conn = -1;
+	}
+	/* the terminal is only taken over when rtt uses it */
+	if (mux_path || rtt_mux)
+		return 0;
 	struct termios ttystate;
 	tcgetattr(STDIN_FILENO, &saved_ttystate);
 	tty_saved = true;
@@ -59,26 +93,207 @@ int rtt_if_exit()
 {
 	if (tty_saved)
 		tcsetattr(STDIN_FILENO, TCSANOW, &saved_ttystate);
+	for (size_t i = 0; i < MAX_RTT_CHAN; i++) {
+		if (mux_chan[i].conn != -1)
+			close(mux_chan[i].conn);
+		if (mux_chan[i].serv != -1) {
+			close(mux_chan[i].serv);
+			if (mux_path) {
+				char path[sizeof(((struct sockaddr_un *)NULL)->sun_path)];
+				snprintf(path, sizeof(path), "%s.%zu", mux_path, i);
+				unlink(path);
+			}
+		}
+		free(mux_chan[i].buf);
+	}
 	return 0;
 }
 
-/* write buffer to terminal */
+bool rtt_if_transport(const char *const transport)
+{
+	if (!strcmp(transport, "stdout")) {
+		rtt_mux = false;
+		mux_path = NULL;
+	} else if (transport[0] >= '0' && transport[0] <= '9') {
+		rtt_mux = true;
+		rtt_mux_port = strtoul(transport, NULL, 0);
+		mux_path = NULL;
+	} else {
+		/* room for the channel number */
+		if (strlen(transport) + 4U > sizeof(((struct sockaddr_un *)NULL)->sun_path))
+			return false;
+		rtt_mux = true;
+		mux_path = transport;
+	}
+	return true;
+}
 
-uint32_t rtt_write(const char *buf, uint32_t len)
+/* the listening socket of a channel, bound to its tcp port or unix socket path, -1 on failure */
+static int rtt_mux_bind(const uint32_t channel)
 {
-	write(1, buf, len);
-	return len;
+	if (mux_path) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.%" PRIu32, mux_path, channel);
+		const int serv = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (serv == -1)
+			return -1;
+		/* left behind by an earlier run */
+		unlink(addr.sun_path);
+		if (bind(serv, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(serv, 1) == -1) {
+			DEBUG_WARN("rtt: can't serve channel %" PRIu32 " on %s: %s\n", channel, addr.sun_path, strerror(errno));
+			close(serv);
+			return -1;
+		}
+		DEBUG_INFO("rtt: channel %" PRIu32 " on %s\n", channel, addr.sun_path);
+		return serv;
+	}
+	const int serv = socket(PF_INET, SOCK_STREAM, 0);
+	if (serv == -1)
+		return -1;
+	const int opt = 1;
+	setsockopt(serv, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(rtt_mux_port + channel);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(serv, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(serv, 1) == -1) {
+		DEBUG_WARN("rtt: can't serve channel %" PRIu32 " on port %" PRIu32 ": %s\n", channel, rtt_mux_port + channel,
+			strerror(errno));
+		close(serv);
+		return -1;
+	}
+	DEBUG_INFO("rtt: channel %" PRIu32 " on TCP port %" PRIu32 "\n", channel, rtt_mux_port + channel);
+	return serv;
+}
+
+static bool rtt_mux_listen(rtt_mux_chan_s *const chan, const uint32_t channel)
+{
+	chan->failed = true;
+	chan->buf = malloc(RTT_MUX_BUF_SIZE);
+	if (!chan->buf) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	chan->serv = rtt_mux_bind(channel);
+	if (chan->serv == -1)
+		return false;
+	fcntl(chan->serv, F_SETFL, fcntl(chan->serv, F_GETFL, 0) | O_NONBLOCK);
+	chan->failed = false;
+	return true;
+}
+
+static void rtt_mux_drop_client(rtt_mux_chan_s *const chan)
+{
+	close(chan->conn);
+	chan->conn = -1;
+	chan->len = 0;
+}
+
+/* hand the kernel what it will take without waiting */
+static void rtt_mux_send(rtt_mux_chan_s *const chan)
+{
+	while (chan->conn != -1 && chan->len) {
+		const uint32_t run = MIN(chan->len, RTT_MUX_BUF_SIZE - chan->start);
+#ifdef MSG_NOSIGNAL
+		const ssize_t sent = send(chan->conn, chan->buf + chan->start, run, MSG_NOSIGNAL);
+#else
+		const ssize_t sent = send(chan->conn, chan->buf + chan->start, run, 0);
+#endif
+		if (sent < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				rtt_mux_drop_client(chan);
+			return;
+		}
+		chan->start = (chan->start + sent) % RTT_MUX_BUF_SIZE;
+		chan->len -= sent;
+	}
+}
+
+/* take a client if one is waiting and send it what is buffered */
+static void rtt_mux_service(rtt_mux_chan_s *const chan)
+{
+	if (chan->conn == -1) {
+		chan->conn = accept(chan->serv, NULL, NULL);
+		if (chan->conn == -1)
+			return;
+		fcntl(chan->conn, F_SETFL, fcntl(chan->conn, F_GETFL, 0) | O_NONBLOCK);
+		const int sndbuf = RTT_MUX_SNDBUF;
+		setsockopt(chan->conn, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	}
+	rtt_mux_send(chan);
+}
+
+void rtt_if_poll(void)
+{
+	for (size_t i = 0; i < MAX_RTT_CHAN; i++) {
+		if (mux_chan[i].serv != -1)
+			rtt_mux_service(&mux_chan[i]);
+	}
 }
 
-/* read character from terminal */
+static void rtt_mux_write(const uint32_t channel, const char *buf, const uint32_t len)
+{
+	if (channel >= MAX_RTT_CHAN)
+		return;
+	rtt_mux_chan_s *const chan = &mux_chan[channel];
+	if (chan->serv == -1 && (chan->failed || !rtt_mux_listen(chan, channel)))
+		return;
+	/* what doesn't fit behind the data still waiting is lost */
+	const uint32_t count = MIN(len, RTT_MUX_BUF_SIZE - chan->len);
+	for (uint32_t i = 0; i < count;) {
+		const uint32_t end = (chan->start + chan->len) % RTT_MUX_BUF_SIZE;
+		const uint32_t run = MIN(count - i, RTT_MUX_BUF_SIZE - end);
+		memcpy(chan->buf + end, buf + i, run);
+		chan->len += run;
+		i += run;
+	}
+	if (count < len)
+		DEBUG_WARN("rtt: channel %" PRIu32 " client too slow, %" PRIu32 " bytes dropped\n", channel, len - count);
+	rtt_mux_service(chan);
+}
+
+/* a client that can't keep up holds back the target, with none connected the data goes as before */
+static uint32_t rtt_write_room(const uint32_t channel)
+{
+	if (!rtt_mux || channel >= MAX_RTT_CHAN || mux_chan[channel].conn == -1)
+		return UINT32_MAX;
+	return RTT_MUX_BUF_SIZE - mux_chan[channel].len;
+}
+
+/* write buffer to terminal, or to the channel's own port */
+
+static void rtt_write(const uint32_t channel, const char *buf, uint32_t len)
+{
+	if (rtt_mux)
+		rtt_mux_write(channel, buf, len);
+	else
+		write(1, buf, len);
+}
 
-int32_t rtt_getchar()
+/* read what the terminal, or the channel's client, has sent, up to len bytes */
+
+uint32_t rtt_read_buf(const uint32_t channel, char *const buf, const uint32_t len)
 {
-	char ch;
-	int len;
-	len = read(0, &ch, 1);
-	if (len == 1) return ch;
-	return -1;
+	if (!rtt_mux) {
+		const ssize_t count = read(0, buf, len);
+		return count > 0 ? count : 0;
+	}
+	if (channel >= MAX_RTT_CHAN)
+		return 0;
+	rtt_mux_chan_s *const chan = &mux_chan[channel];
+	/* a channel that only goes down is served as soon as it is polled */
+	if (chan->serv == -1 && (chan->failed || !rtt_mux_listen(chan, channel)))
+		return 0;
+	rtt_mux_service(chan);
+	if (chan->conn == -1)
+		return 0;
+	const ssize_t count = recv(chan->conn, buf, len, 0);
+	if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		rtt_mux_drop_client(chan);
+	return count > 0 ? count : 0;
 }
 
 /* true if no characters available */
@@ -102,19 +317,37 @@ int rtt_if_exit()
 	return 0;
 }
 
+void rtt_if_poll(void)
+{
+}
+
+bool rtt_if_transport(const char *const transport)
+{
+	return !strcmp(transport, "stdout");
+}
+
+static uint32_t rtt_write_room(const uint32_t channel)
+{
+	(void)channel;
+	return UINT32_MAX;
+}
+
 /* write buffer to terminal */
 
-uint32_t rtt_write(const char *buf, uint32_t len)
+static void rtt_write(const uint32_t channel, const char *buf, uint32_t len)
 {
+	(void)channel;
 	write(1, buf, len);
-	return len;
 }
 
-/* read character from terminal */
+/* read from terminal */
 
-int32_t rtt_getchar()
+uint32_t rtt_read_buf(const uint32_t channel, char *const buf, const uint32_t len)
 {
-	return -1;
+	(void)channel;
+	(void)buf;
+	(void)len;
+	return 0;
 }
 
 /* true if no characters available */
@@ -125,3 +358,17 @@ bool rtt_nodata()
 }
 
 #endif
+
+/* up channel data is read into this, a target read costs a round trip so it is large */
+static char xmit_buf[RTT_UP_BUF_SIZE];
+
+char *rtt_write_buf(const uint32_t channel, uint32_t *const len)
+{
+	*len = MIN(sizeof(xmit_buf) - 8U, rtt_write_room(channel));
+	return *len ? xmit_buf : NULL;
+}
+
+void rtt_write_done(const uint32_t channel, const uint32_t len)
+{
+	rtt_write(channel, xmit_buf, len);
+}
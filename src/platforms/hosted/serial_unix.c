@@ -29,9 +29,20 @@
 #include "remote.h"
 #include "cli.h"
 #include "cortexm.h"
+#include "bmp_hosted.h"
+#include "bmp_remote.h"
 
 static int fd;  /* File descriptor for connection to GDB remote */
 
+/*
+ * Received data is pulled in as much at a time as the tty has, not a byte per
+ * read(), and handed out from here. select() says there is something first,
+ * so the reads never block.
+ */
+static uint8_t rx_buf[4096];
+static size_t rx_pos = 0;
+static size_t rx_len = 0;
+
 /* A nice routine grabbed from
  * https://stackoverflow.com/questions/6947413/how-to-open-read-and-write-from-serial-port-in-c
  */
@@ -169,13 +180,22 @@ int serial_open(BMP_CL_OPTIONS_t *cl_opts, char *serial)
 void serial_close(void)
 {
 	close(fd);
+	rx_pos = 0;
+	rx_len = 0;
 }
 
 int platform_buffer_write(const uint8_t *data, int size)
 {
+	/* Sequences queued up by the SWD and JTAG drivers go out first */
+	remote_batch_flush();
 	int s;
 
 	DEBUG_WIRE("%s\n", data);
+#if HOSTED_BMP_ONLY != 1
+	if (bmp_remote_usb_active())
+		s = bmp_remote_usb_write(data, size);
+	else
+#endif
 	s = write(fd, data, size);
 	if (s < 0) {
 		DEBUG_WARN("Failed to write\n");
@@ -185,62 +205,119 @@ int platform_buffer_write(const uint8_t *data, int size)
 	return size;
 }
 
-int platform_buffer_read(uint8_t *data, int maxsize)
+/* Refill the empty receive buffer, giving up once the remaining time in tv runs out */
+static int serial_fill(struct timeval *tv)
 {
-	uint8_t *c;
-	int s;
-	int ret;
-	fd_set  rset;
-	struct timeval tv;
+#if HOSTED_BMP_ONLY != 1
+	if (bmp_remote_usb_active()) {
+		const int count = bmp_remote_usb_read(rx_buf, sizeof(rx_buf), (tv->tv_sec * 1000U) + (tv->tv_usec / 1000U));
+		if (count <= 0) {
+			DEBUG_WARN("Timeout on read\n");
+			return -4;
+		}
+		rx_pos = 0;
+		rx_len = count;
+		return 0;
+	}
+#endif
+	fd_set rset;
+	FD_ZERO(&rset);
+	FD_SET(fd, &rset);
+	const int ret = select(fd + 1, &rset, NULL, NULL, tv);
+	if (ret < 0) {
+		DEBUG_WARN("Failed on select\n");
+		return -3;
+	}
+	if (ret == 0) {
+		DEBUG_WARN("Timeout on read\n");
+		return -4;
+	}
+	const ssize_t s = read(fd, rx_buf, sizeof(rx_buf));
+	if (s <= 0) {
+		DEBUG_WARN("Failed to read\n");
+		return -6;
+	}
+	rx_pos = 0;
+	rx_len = s;
+	return 0;
+}
 
-	c = data;
-	tv.tv_sec = 0;
+/* Read exactly size bytes, giving up once the remaining time in tv runs out */
+static int serial_read_exact(uint8_t *data, const int size, struct timeval *tv)
+{
+	for (size_t offset = 0; offset < (size_t)size;) {
+		if (rx_pos == rx_len) {
+			const int res = serial_fill(tv);
+			if (res < 0)
+				return res;
+		}
+		const size_t count = MIN(rx_len - rx_pos, (size_t)size - offset);
+		memcpy(data + offset, rx_buf + rx_pos, count);
+		rx_pos += count;
+		offset += count;
+	}
+	return size;
+}
 
-	tv.tv_sec = cortexm_wait_timeout / 1000 ;
+int platform_buffer_read(uint8_t *data, int maxsize)
+{
+	struct timeval tv;
+	tv.tv_sec = cortexm_wait_timeout / 1000;
 	tv.tv_usec = 1000 * (cortexm_wait_timeout % 1000);
 
 	/* Look for start of response */
+	uint8_t c = 0;
 	do {
-		FD_ZERO(&rset);
-		FD_SET(fd, &rset);
+		const int res = serial_read_exact(&c, 1, &tv);
+		if (res < 0)
+			return res;
+	} while (c != REMOTE_RESP);
 
-		ret = select(fd + 1, &rset, NULL, NULL, &tv);
-		if (ret < 0) {
-			DEBUG_WARN("Failed on select\n");
-			return(-3);
-		}
-		if(ret == 0) {
-			DEBUG_WARN("Timeout on read RESP\n");
-			return(-4);
+	/* Now collect the response up to the end of message marker, which isn't kept */
+	for (size_t offset = 0; offset < (size_t)maxsize;) {
+		if (rx_pos == rx_len && serial_fill(&tv) < 0)
+			return -5;
+		const uint8_t *const start = rx_buf + rx_pos;
+		const size_t avail = MIN(rx_len - rx_pos, (size_t)maxsize - offset);
+		const uint8_t *const eom = memchr(start, REMOTE_EOM, avail);
+		const size_t count = eom ? (size_t)(eom - start) : avail;
+		memcpy(data + offset, start, count);
+		rx_pos += count;
+		offset += count;
+		if (eom) {
+			++rx_pos;
+			data[offset] = 0;
+			DEBUG_WIRE("       %s\n", data);
+			return offset;
 		}
-
-		s = read(fd, c, 1);
-    }
-	while ((s > 0) && (*c != REMOTE_RESP));
-	/* Now collect the response */
-	do {
-		FD_ZERO(&rset);
-		FD_SET(fd, &rset);
-		ret = select(fd + 1, &rset, NULL, NULL, &tv);
-		if (ret < 0) {
-			DEBUG_WARN("Failed on select\n");
-			exit(-4);
-		}
-		if(ret == 0) {
-			DEBUG_WARN("Timeout on read\n");
-			return(-5);
-		}
-		s = read(fd, c, 1);
-		if (*c==REMOTE_EOM) {
-			*c = 0;
-			DEBUG_WIRE("       %s\n",data);
-			return (c - data);
-		} else {
-			c++;
-		}
-	}while ((s >= 0) && ((c - data) < maxsize));
+	}
 
 	DEBUG_WARN("Failed to read\n");
-	return(-6);
-	return 0;
+	return -6;
+}
+
+int platform_buffer_read_bin(uint8_t *data, int size)
+{
+	struct timeval tv;
+	tv.tv_sec = cortexm_wait_timeout / 1000;
+	tv.tv_usec = 1000 * (cortexm_wait_timeout % 1000);
+
+	/* Look for start of response */
+	uint8_t c = 0;
+	do {
+		if (serial_read_exact(&c, 1, &tv) < 0)
+			return -4;
+	} while (c != REMOTE_RESP);
+	uint8_t code = 0;
+	if (serial_read_exact(&code, 1, &tv) < 0)
+		return -5;
+	/* Only an OK response carries the binary payload, errors are plain text */
+	if (code == REMOTE_RESP_OK && serial_read_exact(data, size, &tv) < 0)
+		return -5;
+	do {
+		if (serial_read_exact(&c, 1, &tv) < 0)
+			return -5;
+	} while (c != REMOTE_EOM);
+	DEBUG_WIRE("       %c + %d bytes\n", code, code == REMOTE_RESP_OK ? size : 0);
+	return code == REMOTE_RESP_OK ? size : -1;
 }
@@ -21,9 +21,20 @@
 #include <windows.h>
 #include "remote.h"
 #include "cli.h"
+#include "bmp_hosted.h"
+#include "bmp_remote.h"
 
 static HANDLE hComm;
 
+/*
+ * Received data is pulled in as much at a time as the port has, not a byte
+ * per ReadFile(), and handed out from here. The read timeouts make ReadFile()
+ * return as soon as anything has arrived.
+ */
+static uint8_t rx_buf[4096];
+static size_t rx_pos = 0;
+static size_t rx_len = 0;
+
 static char *find_bmp_by_serial(const char *serial)
 {
 	char regpath[258];
@@ -105,9 +116,10 @@ int serial_open(BMP_CL_OPTIONS_t *cl_opts, char * serial)
 		return -1;
 	}
 	COMMTIMEOUTS timeouts = {0};
-	timeouts.ReadIntervalTimeout         = 10;
+	/* Return whatever is there once a byte arrives, or nothing after 10ms */
+	timeouts.ReadIntervalTimeout         = MAXDWORD;
 	timeouts.ReadTotalTimeoutConstant    = 10;
-	timeouts.ReadTotalTimeoutMultiplier  = 10;
+	timeouts.ReadTotalTimeoutMultiplier  = MAXDWORD;
 	timeouts.WriteTotalTimeoutConstant   = 10;
 	timeouts.WriteTotalTimeoutMultiplier = 10;
 	if (!SetCommTimeouts(hComm, &timeouts)) {
@@ -120,13 +132,21 @@ int serial_open(BMP_CL_OPTIONS_t *cl_opts, char * serial)
 void serial_close(void)
 {
 	CloseHandle(hComm);
+	rx_pos = 0;
+	rx_len = 0;
 }
 
 int platform_buffer_write(const uint8_t *data, int size)
 {
+	/* Sequences queued up by the SWD and JTAG drivers go out first */
+	remote_batch_flush();
 	DEBUG_WIRE("%s\n",data);
 	int s = 0;
 
+#if HOSTED_BMP_ONLY != 1
+	if (bmp_remote_usb_active())
+		return bmp_remote_usb_write(data, size);
+#endif
 	do {
 		DWORD written;
 		if (!WriteFile(hComm, data + s, size - s, &written, NULL)) {
@@ -138,41 +158,109 @@ int platform_buffer_write(const uint8_t *data, int size)
 	} while (s < size);
 	return 0;
 }
+/* Refill the empty receive buffer, giving up once endTime has passed */
+static int serial_fill(const uint32_t endTime)
+{
+#if HOSTED_BMP_ONLY != 1
+	if (bmp_remote_usb_active()) {
+		const uint32_t now = platform_time_ms();
+		const int count = bmp_remote_usb_read(rx_buf, sizeof(rx_buf), endTime > now ? endTime - now : 0);
+		if (count <= 0) {
+			DEBUG_WARN("Timeout on read\n");
+			return -4;
+		}
+		rx_pos = 0;
+		rx_len = count;
+		return 0;
+	}
+#endif
+	while (true) {
+		DWORD s;
+		if (!ReadFile(hComm, rx_buf, sizeof(rx_buf), &s, NULL)) {
+			DEBUG_WARN("Error on read\n");
+			return -3;
+		}
+		if (s > 0) {
+			rx_pos = 0;
+			rx_len = s;
+			return 0;
+		}
+		if (platform_time_ms() > endTime) {
+			DEBUG_WARN("Timeout on read\n");
+			return -4;
+		}
+	}
+}
+
+/* Read exactly size bytes, giving up once endTime has passed */
+static int serial_read_exact(uint8_t *data, const int size, const uint32_t endTime)
+{
+	for (size_t offset = 0; offset < (size_t)size;) {
+		if (rx_pos == rx_len) {
+			const int res = serial_fill(endTime);
+			if (res < 0)
+				return res;
+		}
+		const size_t count = MIN(rx_len - rx_pos, (size_t)size - offset);
+		memcpy(data + offset, rx_buf + rx_pos, count);
+		rx_pos += count;
+		offset += count;
+	}
+	return size;
+}
+
 int platform_buffer_read(uint8_t *data, int maxsize)
 {
-	DWORD s;
-	uint8_t response = 0;
 	uint32_t startTime = platform_time_ms();
 	uint32_t endTime = platform_time_ms() + cortexm_wait_timeout;
+	uint8_t response = 0;
 	do {
-		if (!ReadFile(hComm, &response, 1, &s, NULL)) {
-			DEBUG_WARN("ERROR on read RESP\n");
-			exit(-3);
-		}
-		if (platform_time_ms() > endTime) {
-			DEBUG_WARN("Timeout on read RESP\n");
-			exit(-4);
-		}
+		const int res = serial_read_exact(&response, 1, endTime);
+		if (res < 0)
+			exit(res);
 	} while (response != REMOTE_RESP);
-	uint8_t *c = data;
-	do {
-		if (!ReadFile(hComm, c, 1, &s, NULL)) {
-			DEBUG_WARN("Error on read\n");
-			exit(-3);
-		}
-		if (s > 0 ) {
-			DEBUG_WIRE("%c", *c);
-			if (*c == REMOTE_EOM) {
-				*c = 0;
-				DEBUG_WIRE("\n");
-				return (c - data);
-			} else {
-				c++;
-			}
+
+	/* Now collect the response up to the end of message marker, which isn't kept */
+	for (size_t offset = 0; offset < (size_t)maxsize;) {
+		if (rx_pos == rx_len && serial_fill(endTime) < 0)
+			break;
+		const uint8_t *const start = rx_buf + rx_pos;
+		const size_t avail = MIN(rx_len - rx_pos, (size_t)maxsize - offset);
+		const uint8_t *const eom = memchr(start, REMOTE_EOM, avail);
+		const size_t count = eom ? (size_t)(eom - start) : avail;
+		memcpy(data + offset, start, count);
+		rx_pos += count;
+		offset += count;
+		if (eom) {
+			++rx_pos;
+			data[offset] = 0;
+			DEBUG_WIRE("%s\n", data);
+			return offset;
 		}
-	} while (((c - data) < maxsize) && (platform_time_ms() < endTime));
+	}
 	DEBUG_WARN("Failed to read EOM at %d\n",
 			platform_time_ms() - startTime);
 	exit(-3);
 	return 0;
 }
+
+int platform_buffer_read_bin(uint8_t *data, int size)
+{
+	const uint32_t endTime = platform_time_ms() + cortexm_wait_timeout;
+	uint8_t c = 0;
+	do {
+		if (serial_read_exact(&c, 1, endTime) < 0)
+			return -4;
+	} while (c != REMOTE_RESP);
+	uint8_t code = 0;
+	if (serial_read_exact(&code, 1, endTime) < 0)
+		return -5;
+	/* Only an OK response carries the binary payload, errors are plain text */
+	if (code == REMOTE_RESP_OK && serial_read_exact(data, size, endTime) < 0)
+		return -5;
+	do {
+		if (serial_read_exact(&c, 1, endTime) < 0)
+			return -5;
+	} while (c != REMOTE_EOM);
+	return code == REMOTE_RESP_OK ? size : -1;
+}
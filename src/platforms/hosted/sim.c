@@ -0,0 +1,1112 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A simulated target for running the hosted stack without a probe.
+ *
+ * The simulation sits below the SWD sequence functions, so everything from
+ * firmware_swdp_low_access() and the queued transfers upwards runs as it
+ * would with a bit-banging probe. Behind the SW-DP is an AHB-AP with a
+ * Cortex-M3 STM32F103 or Cortex-M4 STM32F407: RAM, Flash behind the STM32
+ * Flash controller of the family, the debug registers of the core and a ROM
+ * table for the usual probe path to find it.
+ *
+ * The core doesn't execute code. Once resumed it stays running until halted,
+ * except that resuming into RAM halts straight away so that stubs fail
+ * quickly and their callers fall back to doing the work over the wire, and
+ * resuming onto a BKPT halts on it, which is enough to drive semihosting.
+ * While running, DWT_PCSR makes up samples around the PC it was resumed at.
+ * Every SWD transfer can be given a latency to stand in for a probe link.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "cortexm.h"
+#include "sim.h"
+
+#include <sys/time.h>
+
+#define SIM_PPB_BASE 0xe0000000U
+#define SIM_PPB_SIZE 0x00100000U
+
+#define SIM_ITM_BASE 0xe0000000U
+#define SIM_DWT_BASE 0xe0001000U
+#define SIM_FPB_BASE 0xe0002000U
+#define SIM_SCS_BASE 0xe000e000U
+#define SIM_ROM_BASE 0xe00ff000U
+
+#define SIM_DBGMCU_IDCODE 0xe0042000U
+
+#define SIM_PERIPH_BASE 0x40000000U
+#define SIM_PERIPH_END  0x60000000U
+
+/* The AHB-AP's CFG, BASE and IDR */
+#define SIM_AP_CFG  0x00000000U
+#define SIM_AP_BASE (SIM_ROM_BASE | ADIV5_AP_BASE_PRESENT)
+
+/* Bits of CSW that keep what is written to them, the rest read as the reset value */
+#define SIM_AP_CSW_RESET 0x23000040U
+#define SIM_AP_CSW_MASK  0x7f000037U
+
+#define SIM_CTRLSTAT_REQ_MASK                                                                               \
+	(ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGRSTREQ |   \
+		0x00ffff0cU | ADIV5_DP_CTRLSTAT_ORUNDETECT)
+#define SIM_CTRLSTAT_POWERED (ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ)
+
+#define SIM_FP_CODE_COMPARATORS 6U
+#define SIM_FP_LIT_COMPARATORS  2U
+#define SIM_DWT_COMPARATORS     4U
+
+/* Flash controllers */
+#define SIM_F1_FPEC_BASE 0x40022000U
+#define SIM_F1_ACR       0x00U
+#define SIM_F1_KEYR      0x04U
+#define SIM_F1_OPTKEYR   0x08U
+#define SIM_F1_SR        0x0cU
+#define SIM_F1_CR        0x10U
+#define SIM_F1_AR        0x14U
+#define SIM_F1_OBR       0x1cU
+#define SIM_F1_WRPR      0x20U
+
+#define SIM_F1_CR_PG     (1U << 0U)
+#define SIM_F1_CR_PER    (1U << 1U)
+#define SIM_F1_CR_MER    (1U << 2U)
+#define SIM_F1_CR_STRT   (1U << 6U)
+#define SIM_F1_CR_LOCK   (1U << 7U)
+#define SIM_F1_SR_PGERR  (1U << 2U)
+#define SIM_F1_SR_WRPERR (1U << 4U)
+#define SIM_F1_SR_EOP    (1U << 5U)
+
+#define SIM_F4_FPEC_BASE 0x40023c00U
+#define SIM_F4_ACR       0x00U
+#define SIM_F4_KEYR      0x04U
+#define SIM_F4_OPTKEYR   0x08U
+#define SIM_F4_SR        0x0cU
+#define SIM_F4_CR        0x10U
+#define SIM_F4_OPTCR     0x14U
+
+#define SIM_F4_CR_PG        (1U << 0U)
+#define SIM_F4_CR_SER       (1U << 1U)
+#define SIM_F4_CR_MER       (1U << 2U)
+#define SIM_F4_CR_SNB_SHIFT 3U
+#define SIM_F4_CR_SNB_MASK  (0x1fU << SIM_F4_CR_SNB_SHIFT)
+#define SIM_F4_CR_PSIZE(cr) (((cr) >> 8U) & 3U)
+#define SIM_F4_CR_MER1      (1U << 15U)
+#define SIM_F4_CR_STRT      (1U << 16U)
+#define SIM_F4_CR_LOCK      (1U << 31U)
+#define SIM_F4_SR_EOP       (1U << 0U)
+#define SIM_F4_SR_PGSERR    (1U << 7U)
+#define SIM_F4_SR_PGPERR    (1U << 6U)
+#define SIM_F4_OPTCR_LOCK   (1U << 0U)
+#define SIM_F4_OPTCR_STRT   (1U << 1U)
+#define SIM_F4_OPTCR_RESET  0x0fffaaedU
+
+#define SIM_FLASH_KEY1    0x45670123U
+#define SIM_FLASH_KEY2    0xcdef89abU
+#define SIM_FLASH_OPTKEY1 0x08192a3bU
+#define SIM_FLASH_OPTKEY2 0x4c5d6e7fU
+
+#define SIM_FLASH_BASE 0x08000000U
+#define SIM_RAM_BASE   0x20000000U
+#define SIM_CCM_BASE   0x10000000U
+
+#define SIM_CORE_REGS 0x60U
+
+typedef enum sim_fpec {
+	SIM_FPEC_F1,
+	SIM_FPEC_F4,
+} sim_fpec_e;
+
+typedef struct sim_model {
+	const char *name;
+	const char *description;
+	uint32_t dpidr;
+	uint32_t ap_idr;
+	uint32_t cpuid;
+	uint16_t scs_partno;
+	uint32_t idcode;
+	uint32_t flash_size;
+	uint32_t ram_size;
+	uint32_t ccm_size;
+	uint32_t sysmem_base;
+	uint32_t sysmem_size;
+	uint32_t flashsize_addr;
+	uint32_t uid_addr;
+	bool fpu;
+	sim_fpec_e fpec;
+} sim_model_s;
+
+static const sim_model_s sim_models[] = {
+	{
+		.name = "f1",
+		.description = "STM32F103xB",
+		.dpidr = 0x1ba01477U,
+		.ap_idr = 0x14770011U,
+		.cpuid = 0x411fc231U,
+		.scs_partno = 0x000U,
+		.idcode = 0x20036410U,
+		.flash_size = 0x20000U,
+		.ram_size = 0x5000U,
+		.sysmem_base = 0x1ffff000U,
+		.sysmem_size = 0x810U,
+		.flashsize_addr = 0x1ffff7e0U,
+		.uid_addr = 0x1ffff7e8U,
+		.fpec = SIM_FPEC_F1,
+	},
+	{
+		.name = "f4",
+		.description = "STM32F407xG",
+		.dpidr = 0x2ba01477U,
+		.ap_idr = 0x24770011U,
+		.cpuid = 0x410fc241U,
+		.scs_partno = 0x00cU,
+		.idcode = 0x10076413U,
+		.flash_size = 0x100000U,
+		.ram_size = 0x20000U,
+		.ccm_size = 0x10000U,
+		.sysmem_base = 0x1fff0000U,
+		.sysmem_size = 0x7a30U,
+		.flashsize_addr = 0x1fff7a22U,
+		.uid_addr = 0x1fff7a10U,
+		.fpu = true,
+		.fpec = SIM_FPEC_F4,
+	},
+};
+
+typedef enum sim_region_type {
+	SIM_REGION_RAM,
+	SIM_REGION_ROM,
+	SIM_REGION_FLASH,
+} sim_region_type_e;
+
+typedef struct sim_region {
+	uint32_t base;
+	uint32_t size;
+	sim_region_type_e type;
+	uint8_t *data;
+} sim_region_s;
+
+#define SIM_REGIONS 4U
+
+/* The ROM table points at the core's debug components, which all share ARM's JEP106 code */
+static const struct {
+	uint32_t base;
+	uint16_t partno;
+	uint8_t cid_class;
+} sim_components[] = {
+	{SIM_SCS_BASE, 0x000U, 0xeU}, /* Part number filled in from the model */
+	{SIM_DWT_BASE, 0x002U, 0xeU},
+	{SIM_FPB_BASE, 0x003U, 0xeU},
+	{SIM_ITM_BASE, 0x001U, 0xeU},
+};
+
+#define SIM_COMPONENTS (sizeof(sim_components) / sizeof(sim_components[0]))
+
+static struct {
+	const sim_model_s *model;
+	uint32_t latency_us;
+
+	/* SWD wire state, the request being answered and its ACK */
+	bool request_pending;
+	uint8_t request;
+	uint32_t ack;
+
+	/* SW-DP */
+	uint32_t ctrlstat;
+	uint32_t select;
+	uint32_t rdbuff;
+
+	/* AHB-AP */
+	uint32_t csw;
+	uint32_t tar;
+
+	/* Memory */
+	sim_region_s region[SIM_REGIONS];
+	size_t regions;
+	uint32_t *ppb;
+
+	/* Core debug */
+	uint32_t regs[SIM_CORE_REGS];
+	uint32_t dhcsr;
+	uint32_t dfsr;
+	uint32_t dcrdr;
+	uint32_t demcr;
+	uint32_t cpacr;
+	bool halted;
+	bool reset_seen;
+	bool nrst;
+	uint32_t fp_ctrl;
+
+	/* Flash controller */
+	uint32_t flash_cr;
+	uint32_t flash_sr;
+	uint32_t flash_ar;
+	uint32_t flash_optcr;
+	uint8_t key_state;
+	uint8_t optkey_state;
+	bool key_error;
+} sim;
+
+static void sim_delay_us(const uint32_t us)
+{
+	struct timeval start;
+	struct timeval now;
+	gettimeofday(&start, NULL);
+	do {
+		gettimeofday(&now, NULL);
+	} while ((uint32_t)((now.tv_sec - start.tv_sec) * 1000000 + (now.tv_usec - start.tv_usec)) < us);
+}
+
+static sim_region_s *sim_region_for(const uint32_t addr)
+{
+	for (size_t i = 0; i < sim.regions; ++i) {
+		sim_region_s *const region = &sim.region[i];
+		if (addr >= region->base && addr - region->base < region->size)
+			return region;
+	}
+	return NULL;
+}
+
+static bool sim_add_region(const uint32_t base, const uint32_t size, const sim_region_type_e type)
+{
+	if (!size)
+		return true;
+	uint8_t *const data = malloc(size);
+	if (!data) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	memset(data, type == SIM_REGION_FLASH ? 0xff : 0, size);
+	sim.region[sim.regions++] = (sim_region_s){base, size, type, data};
+	return true;
+}
+
+static uint32_t sim_load32(const uint8_t *const data)
+{
+	return data[0] | data[1] << 8U | data[2] << 16U | (uint32_t)data[3] << 24U;
+}
+
+static uint32_t sim_flash_read32(const uint32_t addr)
+{
+	const sim_region_s *const flash = sim_region_for(SIM_FLASH_BASE);
+	if (!flash || addr - flash->base > flash->size - 4U)
+		return 0xffffffffU;
+	return sim_load32(flash->data + (addr - flash->base));
+}
+
+/* Core */
+
+static void sim_core_halt(const uint32_t reason)
+{
+	sim.halted = true;
+	sim.dfsr |= reason;
+}
+
+/* Come out of reset, either from nRST or AIRCR.SYSRESETREQ */
+static void sim_core_reset(void)
+{
+	memset(sim.regs, 0, sizeof(sim.regs));
+	sim.regs[REG_MSP] = sim_flash_read32(SIM_FLASH_BASE);
+	sim.regs[REG_SP] = sim.regs[REG_MSP];
+	sim.regs[REG_PC] = sim_flash_read32(SIM_FLASH_BASE + 4U) & ~1U;
+	sim.regs[REG_LR] = 0xffffffffU;
+	sim.regs[REG_XPSR] = CORTEXM_XPSR_THUMB;
+	sim.halted = false;
+	sim.reset_seen = true;
+	sim.fp_ctrl &= ~1U;
+
+	sim.flash_cr = sim.model->fpec == SIM_FPEC_F1 ? SIM_F1_CR_LOCK : SIM_F4_CR_LOCK;
+	sim.flash_sr = 0;
+	sim.flash_optcr = SIM_F4_OPTCR_RESET;
+	sim.key_state = 0;
+	sim.optkey_state = 0;
+	sim.key_error = false;
+
+	if (sim.dhcsr & CORTEXM_DHCSR_C_DEBUGEN) {
+		if (sim.demcr & CORTEXM_DEMCR_VC_CORERESET)
+			sim_core_halt(CORTEXM_DFSR_VCATCH);
+		else if (sim.dhcsr & CORTEXM_DHCSR_C_HALT)
+			sim_core_halt(CORTEXM_DFSR_HALTED);
+	}
+}
+
+static void sim_core_resume(const bool step)
+{
+	if (!sim.halted)
+		return;
+	if (step) {
+		/* Pretend a 16 bit instruction was executed */
+		sim.regs[REG_PC] += 2U;
+		sim_core_halt(CORTEXM_DFSR_HALTED);
+		return;
+	}
+	sim.halted = false;
+	const uint32_t pc = sim.regs[REG_PC];
+	const sim_region_s *const region = sim_region_for(pc);
+	/* A BKPT at the PC, a semihosting call say, is hit at once */
+	if (region && pc - region->base <= region->size - 2U && region->data[pc - region->base + 1U] == 0xbeU)
+		sim_core_halt(CORTEXM_DFSR_BKPT);
+	/* Nothing runs a stub, have it give up at once rather than time out */
+	else if (region && region->type == SIM_REGION_RAM)
+		sim_core_halt(CORTEXM_DFSR_HALTED);
+}
+
+static uint32_t sim_dhcsr_read(const bool peek)
+{
+	uint32_t dhcsr = (sim.dhcsr & 0x3fU) | CORTEXM_DHCSR_S_REGRDY;
+	if (sim.halted)
+		dhcsr |= CORTEXM_DHCSR_S_HALT;
+	if (sim.nrst || sim.reset_seen)
+		dhcsr |= CORTEXM_DHCSR_S_RESET_ST;
+	if (!peek && !sim.nrst)
+		sim.reset_seen = false;
+	return dhcsr;
+}
+
+static void sim_dhcsr_write(const uint32_t value)
+{
+	if ((value & 0xffff0000U) != CORTEXM_DHCSR_DBGKEY)
+		return;
+	sim.dhcsr = value & 0x3fU;
+	if (!(value & CORTEXM_DHCSR_C_DEBUGEN) || sim.nrst)
+		return;
+	if (value & CORTEXM_DHCSR_C_HALT) {
+		if (!sim.halted)
+			sim_core_halt(CORTEXM_DFSR_HALTED);
+	} else
+		sim_core_resume(value & CORTEXM_DHCSR_C_STEP);
+}
+
+static void sim_dcrsr_write(const uint32_t value)
+{
+	const uint32_t regsel = value & 0x7fU;
+	if (regsel >= SIM_CORE_REGS)
+		return;
+	if (value & CORTEXM_DCRSR_REGWnR) {
+		sim.regs[regsel] = sim.dcrdr;
+		if (regsel == REG_SP)
+			sim.regs[REG_MSP] = sim.dcrdr;
+		else if (regsel == REG_MSP)
+			sim.regs[REG_SP] = sim.dcrdr;
+	} else
+		sim.dcrdr = sim.regs[regsel];
+}
+
+/* PIDR and CIDR of the ROM table and the debug components */
+static bool sim_component_id(const uint32_t addr, uint32_t *const value)
+{
+	const uint32_t offset = addr & 0xfffU;
+	if (offset < 0xfd0U)
+		return false;
+	const uint32_t base = addr & ~0xfffU;
+	uint16_t designer = JEP106_MANUFACTURER_ARM;
+	uint16_t partno;
+	uint8_t cid_class;
+	if (base == SIM_ROM_BASE) {
+		designer = JEP106_MANUFACTURER_STM;
+		partno = sim.model->idcode & 0xfffU;
+		cid_class = 0x1U;
+	} else {
+		size_t i = 0;
+		for (; i < SIM_COMPONENTS; ++i) {
+			if (sim_components[i].base == base)
+				break;
+		}
+		if (i == SIM_COMPONENTS)
+			return false;
+		partno = base == SIM_SCS_BASE ? sim.model->scs_partno : sim_components[i].partno;
+		cid_class = sim_components[i].cid_class;
+	}
+
+	const uint8_t jep106_code = designer & 0x7fU;
+	const uint8_t jep106_cont = (designer >> 8U) & 0xfU;
+	switch (offset) {
+	case 0xfd0U: /* PIDR4 */
+		*value = jep106_cont;
+		break;
+	case 0xfe0U: /* PIDR0 */
+		*value = partno & 0xffU;
+		break;
+	case 0xfe4U: /* PIDR1 */
+		*value = ((partno >> 8U) & 0xfU) | (jep106_code & 0xfU) << 4U;
+		break;
+	case 0xfe8U: /* PIDR2, JEDEC assigned designer */
+		*value = (jep106_code >> 4U) | 0x8U;
+		break;
+	case 0xff0U: /* CIDR0 */
+		*value = 0x0dU;
+		break;
+	case 0xff4U: /* CIDR1 */
+		*value = cid_class << 4U;
+		break;
+	case 0xff8U: /* CIDR2 */
+		*value = 0x05U;
+		break;
+	case 0xffcU: /* CIDR3 */
+		*value = 0xb1U;
+		break;
+	default:
+		*value = 0;
+		break;
+	}
+	return true;
+}
+
+/* Three quarters of the time in a tight loop at the PC, the rest in the code that follows */
+static uint32_t sim_pcsr_read(void)
+{
+	static uint32_t lfsr = 0xace1U;
+	if (sim.halted)
+		return UINT32_MAX;
+	lfsr = (lfsr >> 1U) ^ (-(lfsr & 1U) & 0xb400U);
+	const uint32_t offset = (lfsr & 3U) ? lfsr & 0xeU : lfsr & 0xfeU;
+	return (sim.regs[REG_PC] & ~1U) + offset;
+}
+
+static uint32_t sim_ppb_read(const uint32_t addr, const bool peek)
+{
+	uint32_t value;
+	if (sim_component_id(addr, &value))
+		return value;
+	if (addr >= SIM_ROM_BASE && addr < SIM_ROM_BASE + 0xfd0U) {
+		const size_t entry = (addr - SIM_ROM_BASE) / 4U;
+		if (entry < SIM_COMPONENTS)
+			return ((sim_components[entry].base - SIM_ROM_BASE) & ~0xfffU) | ADIV5_ROM_ROMENTRY_PRESENT | 2U;
+		if (addr == SIM_ROM_BASE + 0xfccU) /* MEMTYPE */
+			return 1U;
+		return 0;
+	}
+
+	switch (addr) {
+	case CORTEXM_CPUID:
+		return sim.model->cpuid;
+	case CORTEXM_DHCSR:
+		return sim_dhcsr_read(peek);
+	case CORTEXM_DCRSR:
+		return 0;
+	case CORTEXM_DCRDR:
+		return sim.dcrdr;
+	case CORTEXM_DEMCR:
+		return sim.demcr;
+	case CORTEXM_DFSR:
+		return sim.dfsr;
+	case CORTEXM_AIRCR:
+		return 0xfa050000U | (sim.ppb[(addr - SIM_PPB_BASE) / 4U] & 0x700U);
+	case CORTEXM_CPACR:
+		return sim.cpacr;
+	case CORTEXM_FPB_CTRL:
+		return ((SIM_FP_CODE_COMPARATORS & 0x70U) << 8U) | (SIM_FP_LIT_COMPARATORS << 8U) |
+		       ((SIM_FP_CODE_COMPARATORS & 0xfU) << 4U) | sim.fp_ctrl;
+	case CORTEXM_DWT_CTRL:
+		return (SIM_DWT_COMPARATORS << 28U) | (sim.ppb[(addr - SIM_PPB_BASE) / 4U] & 0x0fffffffU);
+	case CORTEXM_DWT_PCSR:
+		return peek ? 0 : sim_pcsr_read();
+	case SIM_DBGMCU_IDCODE:
+		return sim.model->idcode;
+	default:
+		return sim.ppb[(addr - SIM_PPB_BASE) / 4U];
+	}
+}
+
+static void sim_ppb_write(const uint32_t addr, const uint32_t value)
+{
+	switch (addr) {
+	case CORTEXM_CPUID:
+	case SIM_DBGMCU_IDCODE:
+		return;
+	case CORTEXM_DHCSR:
+		sim_dhcsr_write(value);
+		return;
+	case CORTEXM_DCRSR:
+		sim_dcrsr_write(value);
+		return;
+	case CORTEXM_DCRDR:
+		sim.dcrdr = value;
+		return;
+	case CORTEXM_DEMCR:
+		sim.demcr = value & 0x010f07f1U;
+		return;
+	case CORTEXM_DFSR:
+		sim.dfsr &= ~value;
+		return;
+	case CORTEXM_HFSR:
+	case CORTEXM_CFSR:
+		sim.ppb[(addr - SIM_PPB_BASE) / 4U] &= ~value;
+		return;
+	case CORTEXM_AIRCR:
+		if ((value & 0xffff0000U) != CORTEXM_AIRCR_VECTKEY)
+			return;
+		sim.ppb[(addr - SIM_PPB_BASE) / 4U] = value & 0x700U;
+		if (value & (CORTEXM_AIRCR_SYSRESETREQ | CORTEXM_AIRCR_VECTRESET))
+			sim_core_reset();
+		return;
+	case CORTEXM_CPACR:
+		if (sim.model->fpu)
+			sim.cpacr = value & 0x00f00000U;
+		return;
+	case CORTEXM_FPB_CTRL:
+		/* ENABLE only changes along with KEY */
+		if (value & 2U)
+			sim.fp_ctrl = value & 1U;
+		return;
+	default:
+		if (addr >= SIM_ROM_BASE)
+			return;
+		sim.ppb[(addr - SIM_PPB_BASE) / 4U] = value;
+		return;
+	}
+}
+
+/* Flash controller */
+
+static void sim_flash_erase(const uint32_t offset, const uint32_t len)
+{
+	sim_region_s *const flash = sim_region_for(SIM_FLASH_BASE);
+	if (flash && offset < flash->size)
+		memset(flash->data + offset, 0xff, MIN(len, flash->size - offset));
+}
+
+/* Program each halfword of an access, Flash bits only go from 1 to 0 */
+static void sim_f1_flash_program(uint8_t *const data, const uint32_t value, const size_t size)
+{
+	if (size == 1U) {
+		sim.flash_sr |= SIM_F1_SR_PGERR;
+		return;
+	}
+	for (size_t i = 0; i < size; i += 2U) {
+		const uint16_t old = data[i] | data[i + 1U] << 8U;
+		const uint16_t halfword = value >> (i * 8U);
+		if (old != 0xffffU && halfword != 0) {
+			sim.flash_sr |= SIM_F1_SR_PGERR;
+			continue;
+		}
+		data[i] = halfword & 0xffU;
+		data[i + 1U] = halfword >> 8U;
+	}
+	sim.flash_sr |= SIM_F1_SR_EOP;
+}
+
+static void sim_f4_flash_program(uint8_t *const data, const uint32_t value, const size_t size)
+{
+	/* x64 parallelism is written a word at a time */
+	if (size != 1U << MIN(SIM_F4_CR_PSIZE(sim.flash_cr), 2U)) {
+		sim.flash_sr |= SIM_F4_SR_PGPERR;
+		return;
+	}
+	for (size_t i = 0; i < size; ++i)
+		data[i] &= value >> (i * 8U);
+	sim.flash_sr |= SIM_F4_SR_EOP;
+}
+
+static void sim_flash_program(uint8_t *const data, const uint32_t value, const size_t size)
+{
+	if (sim.model->fpec == SIM_FPEC_F1) {
+		if ((sim.flash_cr & (SIM_F1_CR_PG | SIM_F1_CR_LOCK)) == SIM_F1_CR_PG)
+			sim_f1_flash_program(data, value, size);
+	} else if ((sim.flash_cr & (SIM_F4_CR_PG | SIM_F4_CR_LOCK)) == SIM_F4_CR_PG)
+		sim_f4_flash_program(data, value, size);
+}
+
+/* A broken key sequence locks the controller up to the next reset */
+static void sim_flash_key(const uint32_t key)
+{
+	if (sim.key_error)
+		return;
+	if (sim.key_state == 0 && key == SIM_FLASH_KEY1)
+		sim.key_state = 1;
+	else if (sim.key_state == 1 && key == SIM_FLASH_KEY2) {
+		sim.key_state = 0;
+		sim.flash_cr &= sim.model->fpec == SIM_FPEC_F1 ? ~SIM_F1_CR_LOCK : ~SIM_F4_CR_LOCK;
+	} else
+		sim.key_error = true;
+}
+
+static void sim_f1_fpec_write(const uint32_t reg, const uint32_t value)
+{
+	switch (reg) {
+	case SIM_F1_KEYR:
+		sim_flash_key(value);
+		break;
+	case SIM_F1_SR:
+		sim.flash_sr &= ~(value & (SIM_F1_SR_EOP | SIM_F1_SR_WRPERR | SIM_F1_SR_PGERR));
+		break;
+	case SIM_F1_CR:
+		if (sim.flash_cr & SIM_F1_CR_LOCK)
+			break;
+		sim.flash_cr = value & ~SIM_F1_CR_STRT;
+		if (!(value & SIM_F1_CR_STRT))
+			break;
+		if (value & SIM_F1_CR_MER)
+			sim_flash_erase(0, sim.model->flash_size);
+		else if (value & SIM_F1_CR_PER)
+			sim_flash_erase((sim.flash_ar - SIM_FLASH_BASE) & ~0x3ffU, 0x400U);
+		sim.flash_sr |= SIM_F1_SR_EOP;
+		break;
+	case SIM_F1_AR:
+		sim.flash_ar = value;
+		break;
+	default:
+		break;
+	}
+}
+
+static uint32_t sim_f1_fpec_read(const uint32_t reg)
+{
+	switch (reg) {
+	case SIM_F1_SR:
+		return sim.flash_sr;
+	case SIM_F1_CR:
+		return sim.flash_cr;
+	case SIM_F1_AR:
+		return sim.flash_ar;
+	case SIM_F1_OBR:
+		return 0x03fffffcU;
+	case SIM_F1_WRPR:
+		return 0xffffffffU;
+	default:
+		return 0;
+	}
+}
+
+/* Sectors of a single bank 1 MiB part: 4 of 16 KiB, one of 64 KiB and then 128 KiB */
+static void sim_f4_erase_sector(const uint32_t sector)
+{
+	uint32_t offset;
+	uint32_t len;
+	if (sector < 4U) {
+		offset = sector * 0x4000U;
+		len = 0x4000U;
+	} else if (sector == 4U) {
+		offset = 0x10000U;
+		len = 0x10000U;
+	} else {
+		offset = (sector - 4U) * 0x20000U;
+		len = 0x20000U;
+	}
+	if (offset >= sim.model->flash_size) {
+		sim.flash_sr |= SIM_F4_SR_PGSERR;
+		return;
+	}
+	sim_flash_erase(offset, len);
+}
+
+static void sim_f4_fpec_write(const uint32_t reg, const uint32_t value)
+{
+	switch (reg) {
+	case SIM_F4_KEYR:
+		sim_flash_key(value);
+		break;
+	case SIM_F4_OPTKEYR:
+		if (sim.optkey_state == 0 && value == SIM_FLASH_OPTKEY1)
+			sim.optkey_state = 1;
+		else if (sim.optkey_state == 1 && value == SIM_FLASH_OPTKEY2) {
+			sim.optkey_state = 0;
+			sim.flash_optcr &= ~SIM_F4_OPTCR_LOCK;
+		} else
+			sim.optkey_state = 0;
+		break;
+	case SIM_F4_SR:
+		sim.flash_sr &= ~(value & 0xf3U);
+		break;
+	case SIM_F4_CR:
+		if (sim.flash_cr & SIM_F4_CR_LOCK)
+			break;
+		sim.flash_cr = value & ~SIM_F4_CR_STRT;
+		if (!(value & SIM_F4_CR_STRT))
+			break;
+		if (value & (SIM_F4_CR_MER | SIM_F4_CR_MER1))
+			sim_flash_erase(0, sim.model->flash_size);
+		else if (value & SIM_F4_CR_SER)
+			sim_f4_erase_sector((value & SIM_F4_CR_SNB_MASK) >> SIM_F4_CR_SNB_SHIFT);
+		sim.flash_sr |= SIM_F4_SR_EOP;
+		break;
+	case SIM_F4_OPTCR:
+		/* The option bytes take the new value straight away, there is no reset to reload them */
+		if (!(sim.flash_optcr & SIM_F4_OPTCR_LOCK))
+			sim.flash_optcr = value & ~SIM_F4_OPTCR_STRT;
+		break;
+	default:
+		break;
+	}
+}
+
+static uint32_t sim_f4_fpec_read(const uint32_t reg)
+{
+	switch (reg) {
+	case SIM_F4_SR:
+		return sim.flash_sr;
+	case SIM_F4_CR:
+		return sim.flash_cr;
+	case SIM_F4_OPTCR:
+		return sim.flash_optcr;
+	default:
+		return 0;
+	}
+}
+
+static uint32_t sim_fpec_base(void)
+{
+	return sim.model->fpec == SIM_FPEC_F1 ? SIM_F1_FPEC_BASE : SIM_F4_FPEC_BASE;
+}
+
+/* Bus */
+
+/*
+ * Read or write an access of size bytes at addr, with the data in its byte
+ * lanes as on the AHB. Returns false on a bus error.
+ */
+static bool sim_bus_access(const uint32_t addr, uint32_t *const value, const size_t size, const bool write)
+{
+	const uint32_t lane = (addr & 3U) * 8U;
+	const uint32_t mask = size == 4U ? 0xffffffffU : ((1U << (size * 8U)) - 1U) << lane;
+
+	sim_region_s *const region = sim_region_for(addr);
+	if (region) {
+		uint8_t *const data = region->data + (addr - region->base);
+		if (addr - region->base > region->size - size)
+			return false;
+		if (!write) {
+			*value = 0;
+			for (size_t i = 0; i < size; ++i)
+				*value |= (uint32_t)data[i] << (lane + i * 8U);
+		} else if (region->type == SIM_REGION_RAM) {
+			for (size_t i = 0; i < size; ++i)
+				data[i] = *value >> (lane + i * 8U);
+		} else if (region->type == SIM_REGION_FLASH)
+			sim_flash_program(data, *value >> lane, size);
+		return true;
+	}
+
+	const uint32_t word_addr = addr & ~3U;
+	if (word_addr - SIM_PPB_BASE < SIM_PPB_SIZE) {
+		if (!write)
+			*value = sim_ppb_read(word_addr, false) & mask;
+		else
+			sim_ppb_write(word_addr, (*value & mask) | (sim_ppb_read(word_addr, true) & ~mask));
+		return true;
+	}
+
+	if (word_addr - sim_fpec_base() < 0x400U) {
+		const uint32_t reg = word_addr - sim_fpec_base();
+		if (write && sim.model->fpec == SIM_FPEC_F1)
+			sim_f1_fpec_write(reg, *value);
+		else if (write)
+			sim_f4_fpec_write(reg, *value);
+		else
+			*value = (sim.model->fpec == SIM_FPEC_F1 ? sim_f1_fpec_read(reg) : sim_f4_fpec_read(reg)) & mask;
+		/* A broken key sequence faults the access, both families have KEYR at the same offset */
+		return !(write && sim.key_error && reg == SIM_F1_KEYR);
+	}
+
+	/* The rest of the peripherals read as zero and ignore writes */
+	if (addr >= SIM_PERIPH_BASE && addr < SIM_PERIPH_END) {
+		if (!write)
+			*value = 0;
+		return true;
+	}
+	return false;
+}
+
+/* AHB-AP */
+
+static uint32_t sim_ap_size(void)
+{
+	switch (sim.csw & ADIV5_AP_CSW_SIZE_MASK) {
+	case ADIV5_AP_CSW_SIZE_BYTE:
+		return 1U;
+	case ADIV5_AP_CSW_SIZE_HALFWORD:
+		return 2U;
+	default:
+		return 4U;
+	}
+}
+
+/* Auto-increment only carries within the bottom 10 bits of TAR */
+static void sim_ap_tar_increment(const uint32_t by)
+{
+	sim.tar = (sim.tar & ~0x3ffU) | ((sim.tar + by) & 0x3ffU);
+}
+
+static bool sim_ap_drw(uint32_t *const value, const bool write)
+{
+	const uint32_t size = sim_ap_size();
+	const uint32_t addrinc = sim.csw & ADIV5_AP_CSW_ADDRINC_MASK;
+	bool ok = true;
+	if (addrinc == ADIV5_AP_CSW_ADDRINC_PACKED && size < 4U) {
+		/* A packed transfer is a whole word of accesses at the current size */
+		uint32_t word = 0;
+		for (uint32_t offset = 0; offset < 4U && ok; offset += size) {
+			uint32_t data = *value;
+			ok = sim_bus_access(sim.tar + offset, &data, size, write);
+			if (!write)
+				word |= data;
+		}
+		if (!write)
+			*value = word;
+		sim_ap_tar_increment(4U);
+		return ok;
+	}
+	ok = sim_bus_access(sim.tar, value, size, write);
+	if (addrinc != ADIV5_AP_CSW_ADDRINC_NONE)
+		sim_ap_tar_increment(size);
+	return ok;
+}
+
+static uint32_t sim_ap_access(const uint8_t reg, const uint32_t value, const bool write)
+{
+	/* Only AP 0 is implemented, the other slots read their IDR as zero */
+	if (sim.select >> 24U)
+		return 0;
+	const uint32_t addr = (sim.select & 0xf0U) | reg;
+	if (addr >= 0x0cU && addr <= 0x1cU && (sim.ctrlstat & SIM_CTRLSTAT_POWERED) != SIM_CTRLSTAT_POWERED) {
+		sim.ctrlstat |= ADIV5_DP_CTRLSTAT_STICKYERR;
+		return 0;
+	}
+
+	uint32_t data = value;
+	bool ok = true;
+	switch (addr) {
+	case 0x00U: /* CSW */
+		if (write)
+			sim.csw = (value & SIM_AP_CSW_MASK) | (SIM_AP_CSW_RESET & ~SIM_AP_CSW_MASK);
+		return sim.csw;
+	case 0x04U: /* TAR */
+		if (write)
+			sim.tar = value;
+		return sim.tar;
+	case 0x0cU: /* DRW */
+		ok = sim_ap_drw(&data, write);
+		break;
+	case 0x10U: /* DB0 to DB3 */
+	case 0x14U:
+	case 0x18U:
+	case 0x1cU:
+		ok = sim_bus_access((sim.tar & ~0xfU) | (addr & 0xcU), &data, 4U, write);
+		break;
+	case 0xf4U:
+		return SIM_AP_CFG;
+	case 0xf8U:
+		return SIM_AP_BASE;
+	case 0xfcU:
+		return sim.model->ap_idr;
+	default:
+		return 0;
+	}
+	if (!ok) {
+		sim.ctrlstat |= ADIV5_DP_CTRLSTAT_STICKYERR;
+		return 0;
+	}
+	if (!write)
+		sim.ctrlstat |= ADIV5_DP_CTRLSTAT_READOK;
+	return data;
+}
+
+/* SW-DP */
+
+static uint32_t sim_dp_read(const uint8_t reg)
+{
+	switch (reg) {
+	case ADIV5_DP_DPIDR:
+		return sim.model->dpidr;
+	case ADIV5_DP_CTRLSTAT:
+		/* Only bank 0 is implemented on a DPv1 */
+		if (sim.select & 0xfU)
+			return 0;
+		/* Power-up and reset requests are acknowledged straight away */
+		return sim.ctrlstat | (sim.ctrlstat & 0x54000000U) << 1U;
+	case ADIV5_DP_RDBUFF:
+	default:
+		return sim.rdbuff;
+	}
+}
+
+static void sim_dp_write(const uint8_t reg, const uint32_t value)
+{
+	switch (reg) {
+	case ADIV5_DP_ABORT:
+		if (value & ADIV5_DP_ABORT_STKCMPCLR)
+			sim.ctrlstat &= ~ADIV5_DP_CTRLSTAT_STICKYCMP;
+		if (value & ADIV5_DP_ABORT_STKERRCLR)
+			sim.ctrlstat &= ~ADIV5_DP_CTRLSTAT_STICKYERR;
+		if (value & ADIV5_DP_ABORT_WDERRCLR)
+			sim.ctrlstat &= ~ADIV5_DP_CTRLSTAT_WDATAERR;
+		if (value & ADIV5_DP_ABORT_ORUNERRCLR)
+			sim.ctrlstat &= ~ADIV5_DP_CTRLSTAT_STICKYORUN;
+		break;
+	case ADIV5_DP_CTRLSTAT:
+		if (!(sim.select & 0xfU))
+			sim.ctrlstat = (sim.ctrlstat & ~SIM_CTRLSTAT_REQ_MASK) | (value & SIM_CTRLSTAT_REQ_MASK);
+		break;
+	case ADIV5_DP_SELECT:
+		sim.select = value;
+		break;
+	default: /* TARGETSEL, a DPv1 has no use for it */
+		break;
+	}
+}
+
+/* SWD sequences */
+
+static bool sim_request_valid(const uint32_t request)
+{
+	/* Start, stop and park bits, and even parity over APnDP, RnW and A[3:2] */
+	if ((request & 0xc1U) != 0x81U)
+		return false;
+	return !__builtin_parity((request >> 1U) & 0x1fU);
+}
+
+static void sim_seq_out(const uint32_t tms_states, const size_t clock_cycles)
+{
+	/* Anything other than a request is a line reset, a selection sequence or idle cycles */
+	sim.request_pending = clock_cycles == 8U && sim_request_valid(tms_states);
+	if (!sim.request_pending)
+		return;
+	sim.request = tms_states;
+	if (sim.latency_us)
+		sim_delay_us(sim.latency_us);
+}
+
+static uint32_t sim_seq_in(const size_t clock_cycles)
+{
+	if (clock_cycles != 3U)
+		return 0;
+	/* Nothing drives the lines without a request, they read as pulled up */
+	if (!sim.request_pending)
+		return 7U;
+	const bool ap = sim.request & 0x02U;
+	sim.ack = ap && (sim.ctrlstat & ADIV5_DP_CTRLSTAT_STICKYERR) ? SWDP_ACK_FAULT : SWDP_ACK_OK;
+	return sim.ack;
+}
+
+static bool sim_seq_in_parity(uint32_t *const ret, const size_t clock_cycles)
+{
+	(void)clock_cycles;
+	*ret = 0;
+	const bool read = sim.request & 0x04U;
+	if (!sim.request_pending || !read || sim.ack != SWDP_ACK_OK)
+		return false;
+	sim.request_pending = false;
+	const uint8_t reg = (sim.request >> 1U) & 0xcU;
+	if (sim.request & 0x02U) {
+		/* AP reads are posted, the data comes back with the next AP or RDBUFF read */
+		*ret = sim.rdbuff;
+		sim.rdbuff = sim_ap_access(reg, 0, false);
+	} else
+		*ret = sim_dp_read(reg);
+	return false;
+}
+
+static void sim_seq_out_parity(const uint32_t tms_states, const size_t clock_cycles)
+{
+	(void)clock_cycles;
+	const bool read = sim.request & 0x04U;
+	if (!sim.request_pending || read || sim.ack != SWDP_ACK_OK)
+		return;
+	sim.request_pending = false;
+	const uint8_t reg = (sim.request >> 1U) & 0xcU;
+	if (sim.request & 0x02U)
+		sim_ap_access(reg, tms_states, true);
+	else
+		sim_dp_write(reg, tms_states);
+}
+
+/* Platform interface */
+
+int sim_init(BMP_CL_OPTIONS_t *cl_opts, bmp_info_t *info)
+{
+	const char *const name = cl_opts->opt_sim_model ? cl_opts->opt_sim_model : sim_models[0].name;
+	for (size_t i = 0; i < sizeof(sim_models) / sizeof(sim_models[0]) && !sim.model; ++i) {
+		if (!strcmp(sim_models[i].name, name))
+			sim.model = &sim_models[i];
+	}
+	if (!sim.model) {
+		DEBUG_WARN("Unknown simulated target \"%s\"\n", name);
+		return -1;
+	}
+	sim.latency_us = cl_opts->opt_sim_latency_us;
+
+	sim.ppb = calloc(SIM_PPB_SIZE / 4U, sizeof(*sim.ppb));
+	if (!sim.ppb) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return -1;
+	}
+	if (!sim_add_region(SIM_FLASH_BASE, sim.model->flash_size, SIM_REGION_FLASH) ||
+		!sim_add_region(SIM_RAM_BASE, sim.model->ram_size, SIM_REGION_RAM) ||
+		!sim_add_region(SIM_CCM_BASE, sim.model->ccm_size, SIM_REGION_RAM) ||
+		!sim_add_region(sim.model->sysmem_base, sim.model->sysmem_size, SIM_REGION_ROM))
+		return -1;
+
+	/* Flash size in KiB and a unique ID in system memory */
+	uint8_t *const sysmem = sim_region_for(sim.model->sysmem_base)->data;
+	const uint16_t flash_kib = sim.model->flash_size >> 10U;
+	sysmem[sim.model->flashsize_addr - sim.model->sysmem_base] = flash_kib & 0xffU;
+	sysmem[sim.model->flashsize_addr - sim.model->sysmem_base + 1U] = flash_kib >> 8U;
+	memcpy(sysmem + (sim.model->uid_addr - sim.model->sysmem_base), "BMP-SIMULATE", 12U);
+
+	sim.csw = SIM_AP_CSW_RESET | ADIV5_AP_CSW_SIZE_WORD;
+	sim_core_reset();
+
+	info->bmp_type = BMP_TYPE_SIM;
+	snprintf(info->manufacturer, sizeof(info->manufacturer), "Black Magic Debug");
+	snprintf(info->product, sizeof(info->product), "Simulated %s", sim.model->description);
+	snprintf(info->version, sizeof(info->version), "%" PRIu32 " us per transfer", sim.latency_us);
+	DEBUG_INFO("Simulating %s, %" PRIu32 " us per SWD transfer\n", sim.model->description, sim.latency_us);
+	return 0;
+}
+
+/* The Flash loader needs code to run on the target, so leave it out */
+uint32_t sim_swdp_scan(const uint32_t targetid)
+{
+	const uint32_t devices = adiv5_swdp_scan(targetid);
+	for (target *t = target_list; t; t = t->next)
+		t->flash_loader_disabled = true;
+	return devices;
+}
+
+int sim_swdptap_init(ADIv5_DP_t *dp)
+{
+	dp->seq_in = sim_seq_in;
+	dp->seq_in_parity = sim_seq_in_parity;
+	dp->seq_out = sim_seq_out;
+	dp->seq_out_parity = sim_seq_out_parity;
+	dp->dp_read = firmware_swdp_read;
+	dp->error = firmware_swdp_error;
+	dp->low_access = firmware_swdp_low_access;
+	dp->abort = firmware_swdp_abort;
+	return 0;
+}
+
+const char *sim_target_voltage(void)
+{
+	return "3.3V";
+}
+
+void sim_nrst_set_val(const bool assert)
+{
+	if (sim.nrst && !assert)
+		sim_core_reset();
+	sim.nrst = assert;
+	if (assert)
+		sim.halted = false;
+}
+
+bool sim_nrst_get_val(void)
+{
+	return sim.nrst;
+}
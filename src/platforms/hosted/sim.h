@@ -0,0 +1,35 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Simulated SW-DP with a Cortex-M STM32 behind it, to run the hosted
+ * stack without a probe.
+ */
+#ifndef __SIM_H
+#define __SIM_H
+
+#include "adiv5.h"
+#include "bmp_hosted.h"
+#include "cli.h"
+
+int sim_init(BMP_CL_OPTIONS_t *cl_opts, bmp_info_t *info);
+uint32_t sim_swdp_scan(uint32_t targetid);
+int sim_swdptap_init(ADIv5_DP_t *dp);
+const char *sim_target_voltage(void);
+void sim_nrst_set_val(bool assert);
+bool sim_nrst_get_val(void);
+
+#endif /* __SIM_H */
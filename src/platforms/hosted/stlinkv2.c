@@ -42,6 +42,7 @@
 #include <sys/time.h>
 
 #include "cli.h"
+#include "traceswo.h"
 
 #define STLINK_SWIM_ERR_OK             0x00
 #define STLINK_SWIM_BUSY               0x01
@@ -169,6 +170,7 @@
 
 #define STLINK_TRACE_SIZE               4096
 #define STLINK_TRACE_MAX_HZ             2000000
+#define STLINKV3_TRACE_MAX_HZ           24000000
 
 #define STLINK_V3_MAX_FREQ_NB               10
 
@@ -194,6 +196,7 @@ typedef struct {
 	bool         nrst;
 	uint8_t      dap_select;
 	uint8_t      ep_tx;
+	uint8_t      ep_trace;
 	uint8_t      ver_hw;     /* 20, 21 or 31 deciphered from USB PID.*/
 	uint8_t      ver_stlink; /* 2 or 3  from API.*/
 	uint8_t      ver_api;
@@ -202,7 +205,9 @@ typedef struct {
 	uint8_t      ver_swim;
 	uint8_t      ver_bridge;
 	uint16_t     block_size;
+	uint16_t     block_size32; /* Largest 16/32-bit memory read in one command */
 	bool         ap_error;
+	bool         trace_active;
 } stlink_t;
 
 stlink_t stlink;
@@ -360,26 +365,6 @@ static int stlink_send_recv_retry(uint8_t *txbuf, size_t txsize,
 	return res;
 }
 
-static int read_retry(uint8_t *txbuf, size_t txsize,
-					 uint8_t *rxbuf, size_t rxsize)
-{
-	uint32_t start = platform_time_ms();
-	int res;
-	while(1) {
-		send_recv(info.usb_link, txbuf, txsize, rxbuf, rxsize);
-		res = stlink_usb_get_rw_status(false);
-		if (res == STLINK_ERROR_OK)
-			return res;
-		uint32_t now = platform_time_ms();
-		if (((now -start) > 1000) || (res != STLINK_ERROR_WAIT)) {
-			DEBUG_WARN("read_retry failed.\n");
-			stlink_usb_get_rw_status(true);
-			return res;
-		}
-	}
-	return res;
-}
-
 static int write_retry(uint8_t *cmdbuf, size_t cmdsize,
 					 uint8_t *txbuf, size_t txsize)
 {
@@ -419,6 +404,7 @@ static void stlink_version(bmp_info_t *info)
 		stlink.ver_mass  =  data[3];
 		stlink.ver_bridge = data[4];
 		stlink.block_size = 512;
+		stlink.block_size32 = 6144;
 		stlink.vid = data[3] <<  9 | data[8];
 		stlink.pid = data[5] << 11 | data[10];
 	} else {
@@ -432,6 +418,7 @@ static void stlink_version(bmp_info_t *info)
 		stlink.pid = data[5] << 8 | data[4];
 		int  version = data[0] << 8 | data[1]; /* Big endian here!*/
 		stlink.block_size = 64;
+		stlink.block_size32 = 4096;
 		stlink.ver_stlink = (version >> 12) & 0x0f;
 		stlink.ver_jtag   = (version >>  6) & 0x3f;
 		if ((stlink.pid == PRODUCT_ID_STLINKV21_MSD) ||
@@ -570,12 +557,14 @@ int stlink_init(bmp_info_t *info)
 		stlink.ver_hw = 20;
 		info->usb_link->ep_tx = 2;
 		stlink.ep_tx = 2;
+		stlink.ep_trace = 3 | LIBUSB_ENDPOINT_IN;
 		break;
 	case PRODUCT_ID_STLINKV21 :
 	case PRODUCT_ID_STLINKV21_MSD:
 		stlink.ver_hw = 21;
 		info->usb_link->ep_tx = 1;
 		stlink.ep_tx = 1;
+		stlink.ep_trace = 2 | LIBUSB_ENDPOINT_IN;
 		break;
 	case PRODUCT_ID_STLINKV3_BL:
 	case PRODUCT_ID_STLINKV3:
@@ -584,6 +573,7 @@ int stlink_init(bmp_info_t *info)
 		stlink.ver_hw = 30;
 		info->usb_link->ep_tx = 1;
 		stlink.ep_tx = 1;
+		stlink.ep_trace = 2 | LIBUSB_ENDPOINT_IN;
 		break;
 	default:
 		DEBUG_INFO("Unhandled STM32 device\n");
@@ -854,32 +844,74 @@ static int stlink_usb_get_rw_status(bool verbose)
 	return stlink_usb_error_check(data, verbose);
 }
 
-static void stlink_readmem(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+/* Read one piece of memory, using the widest access its address and length allow */
+static void stlink_readmem_piece(ADIv5_AP_t *ap, uint8_t *dest, uint32_t src, size_t len)
 {
-	if (len == 0)
-		return;
-	size_t read_len = len;
 	uint8_t type;
-	if (src & 1 || len & 1) {
+	if (src & 1 || len & 1)
 		type = STLINK_DEBUG_READMEM_8BIT;
-		if (len > stlink.block_size) {
-			DEBUG_WARN("Too large!\n");
-			return;
-		}
-		if (len == 1)
-			read_len ++; /* Fix read length as in openocd*/
-	} else if (src & 3 || len & 3) {
+	else if (src & 3 || len & 3)
 		type = STLINK_DEBUG_APIV2_READMEM_16BIT;
-	} else {
+	else
 		type = STLINK_DEBUG_READMEM_32BIT;
-	}
 	uint8_t cmd[16] = {
 		STLINK_DEBUG_COMMAND,
 		type,
 		src & 0xff, (src >>  8) & 0xff, (src >> 16) & 0xff,
 		(src >> 24) & 0xff,
 		len & 0xff, len >> 8, ap->apsel};
-	int res = read_retry(cmd, 16, dest, read_len);
+	if (len == 1) {
+		/* Fix read length as in openocd, without overrunning dest */
+		uint8_t data[2];
+		send_recv(info.usb_link, cmd, 16, data, 2);
+		dest[0] = data[0];
+	} else
+		send_recv(info.usb_link, cmd, 16, dest, len);
+}
+
+/*
+ * Split the read into an unaligned head, a word aligned body in blocks as
+ * large as the ST-Link takes and a tail. The pieces go out back to back and
+ * the caller checks the rw status once for all of them.
+ */
+static void stlink_readmem_split(ADIv5_AP_t *ap, uint8_t *dest, uint32_t src, size_t len)
+{
+	const size_t head = MIN((4U - (src & 3U)) & 3U, len);
+	if (head) {
+		stlink_readmem_piece(ap, dest, src, head);
+		dest += head;
+		src += head;
+		len -= head;
+	}
+	while (len >= 4U) {
+		const size_t block = MIN(len & ~3U, stlink.block_size32);
+		stlink_readmem_piece(ap, dest, src, block);
+		dest += block;
+		src += block;
+		len -= block;
+	}
+	if (len)
+		stlink_readmem_piece(ap, dest, src, len);
+}
+
+static void stlink_readmem(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	if (len == 0)
+		return;
+	uint32_t start = platform_time_ms();
+	int res;
+	while (1) {
+		stlink_readmem_split(ap, dest, src, len);
+		res = stlink_usb_get_rw_status(false);
+		if (res == STLINK_ERROR_OK)
+			break;
+		uint32_t now = platform_time_ms();
+		if (((now - start) > 1000) || (res != STLINK_ERROR_WAIT)) {
+			DEBUG_WARN("stlink_readmem retry failed.\n");
+			stlink_usb_get_rw_status(true);
+			break;
+		}
+	}
 	if (res != STLINK_ERROR_OK) {
 		/* FIXME: What is the right measure when failing?
 		 *
@@ -895,57 +927,65 @@ static void stlink_readmem(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 				"\n", src, dest, (uint32_t) len);
 }
 
-static void stlink_writemem8(usb_link_t *link, ADIv5_AP_t *ap, uint32_t addr,
-							 size_t len, uint8_t *buffer)
+static void stlink_writemem_block(ADIv5_AP_t *ap, uint8_t type, uint32_t addr,
+								  const uint8_t *buffer, size_t len)
 {
-	(void)link;
-	while (len) {
-		size_t length;
-		/* OpenOCD has some note about writemem8*/
-		if (len > stlink.block_size)
-			length = stlink.block_size;
-		else
-			length = len;
+	uint8_t cmd[16] = {
+		STLINK_DEBUG_COMMAND,
+		type,
+		addr & 0xff, (addr >>  8) & 0xff, (addr >> 16) & 0xff,
+		(addr >> 24) & 0xff,
+		len & 0xff, len >> 8, ap->apsel};
+	send_recv(info.usb_link, cmd, 16, NULL, 0);
+	send_recv(info.usb_link, (void *)buffer, len, NULL, 0);
+}
+
+/*
+ * Send all the blocks of a write back to back and check GETLASTRWSTATUS2 once
+ * for the batch. Only when that reports a problem is the write redone one
+ * block at a time, each with its own status check and retries.
+ */
+static void stlink_writemem_batch(ADIv5_AP_t *ap, uint8_t type, size_t block_size,
+								  uint32_t addr, const uint8_t *buffer, size_t len)
+{
+	for (size_t offset = 0; offset < len; offset += block_size)
+		stlink_writemem_block(ap, type, addr + offset, buffer + offset, MIN(block_size, len - offset));
+	if (stlink_usb_get_rw_status(false) == STLINK_ERROR_OK)
+		return;
+	for (size_t offset = 0; offset < len; offset += block_size) {
+		const size_t length = MIN(block_size, len - offset);
+		const uint32_t block_addr = addr + offset;
 		uint8_t cmd[16] = {
 			STLINK_DEBUG_COMMAND,
-			STLINK_DEBUG_WRITEMEM_8BIT,
-			addr & 0xff, (addr >>  8) & 0xff, (addr >> 16) & 0xff,
-			(addr >> 24) & 0xff,
+			type,
+			block_addr & 0xff, (block_addr >>  8) & 0xff, (block_addr >> 16) & 0xff,
+			(block_addr >> 24) & 0xff,
 			length & 0xff, length >> 8, ap->apsel};
-		send_recv(link, cmd, 16, NULL, 0);
-		send_recv(link, (void*)buffer, length, NULL, 0);
-		stlink_usb_get_rw_status(true);
-		len -= length;
-		addr += length;
+		if (write_retry(cmd, 16, (uint8_t *)buffer + offset, length) != STLINK_ERROR_OK) {
+			DEBUG_WARN("stlink_writemem to %" PRIx32 ", len %" PRIx32 " failed\n",
+				block_addr, (uint32_t)length);
+			return;
+		}
 	}
 }
 
-static void stlink_writemem16(usb_link_t *link, ADIv5_AP_t *ap, uint32_t addr,
-							  size_t len, uint16_t *buffer)
+static void stlink_writemem8(ADIv5_AP_t *ap, uint32_t addr,
+							 size_t len, const uint8_t *buffer)
 {
-	(void)link;
-	uint8_t cmd[16] = {
-		STLINK_DEBUG_COMMAND,
-		STLINK_DEBUG_APIV2_WRITEMEM_16BIT,
-		addr & 0xff, (addr >>  8) & 0xff, (addr >> 16) & 0xff,
-		(addr >> 24) & 0xff,
-		len & 0xff, len >> 8, ap->apsel};
-	send_recv(link, cmd, 16, NULL, 0);
-	send_recv(link, (void*)buffer, len, NULL, 0);
-	stlink_usb_get_rw_status(true);
+	/* OpenOCD has some note about writemem8*/
+	stlink_writemem_batch(ap, STLINK_DEBUG_WRITEMEM_8BIT, stlink.block_size, addr, buffer, len);
 }
 
-static void stlink_writemem32(usb_link_t * link, ADIv5_AP_t *ap, uint32_t addr,
-							  size_t len, uint32_t *buffer)
+static void stlink_writemem16(ADIv5_AP_t *ap, uint32_t addr,
+							  size_t len, const uint8_t *buffer)
 {
-	(void)link;
-	uint8_t cmd[16] = {
-		STLINK_DEBUG_COMMAND,
-		STLINK_DEBUG_WRITEMEM_32BIT,
-		addr & 0xff, (addr >>  8) & 0xff, (addr >> 16) & 0xff,
-		(addr >> 24) & 0xff,
-		len & 0xff, len >> 8, ap->apsel};
-	write_retry(cmd, 16, (void*)buffer, len);
+	stlink_writemem_batch(ap, STLINK_DEBUG_APIV2_WRITEMEM_16BIT, stlink.block_size32, addr, buffer, len);
+}
+
+static void stlink_writemem32(ADIv5_AP_t *ap, uint32_t addr,
+							  size_t len, const uint8_t *buffer)
+{
+	stlink_writemem_batch(ap, STLINK_DEBUG_WRITEMEM_32BIT, stlink.block_size32, addr, buffer, len);
 }
 
 static void stlink_regs_read(ADIv5_AP_t *ap, void *data)
@@ -991,17 +1031,16 @@ static void stlink_mem_write_sized(	ADIv5_AP_t *ap, uint32_t dest,
 {
 	if (len == 0)
 		return;
-	usb_link_t *link = info.usb_link;
 	switch(align) {
 	case ALIGN_BYTE:
-		stlink_writemem8(link, ap, dest, len, (uint8_t *) src);
+		stlink_writemem8(ap, dest, len, src);
 		break;
 	case ALIGN_HALFWORD:
-		stlink_writemem16(link,ap, dest, len, (uint16_t *) src);
+		stlink_writemem16(ap, dest, len, src);
 		break;
 	case ALIGN_WORD:
 	case ALIGN_DWORD:
-		stlink_writemem32(link, ap, dest, len, (uint32_t *) src);
+		stlink_writemem32(ap, dest, len, src);
 		break;
 	}
 }
@@ -1209,3 +1248,68 @@ uint32_t stlink_max_frequency_get(bmp_info_t *info)
 	}
 	return ret;
 }
+
+void stlink_traceswo_stop(void)
+{
+	if (!stlink.trace_active)
+		return;
+	uint8_t cmd[16] = {STLINK_DEBUG_COMMAND, STLINK_DEBUG_APIV2_STOP_TRACE_RX};
+	uint8_t data[2];
+	send_recv(info.usb_link, cmd, 16, data, 2);
+	stlink_usb_error_check(data, true);
+	stlink.trace_active = false;
+}
+
+/* The ST-Link captures SWO in NRZ mode into its own buffer of STLINK_TRACE_SIZE bytes */
+bool stlink_traceswo_init(const uint32_t baudrate, const uint32_t swo_chan_bitmask)
+{
+	stlink_traceswo_stop();
+	const uint32_t max_baudrate = stlink.ver_hw == 30 ? STLINKV3_TRACE_MAX_HZ : STLINK_TRACE_MAX_HZ;
+	if (baudrate > max_baudrate) {
+		DEBUG_WARN("SWO baudrate %" PRIu32 " above the ST-Link maximum of %" PRIu32 "\n",
+			baudrate, max_baudrate);
+		return false;
+	}
+	uint8_t cmd[16] = {
+		STLINK_DEBUG_COMMAND, STLINK_DEBUG_APIV2_START_TRACE_RX,
+		STLINK_TRACE_SIZE & 0xff, STLINK_TRACE_SIZE >> 8,
+		baudrate & 0xff, (baudrate >> 8) & 0xff, (baudrate >> 16) & 0xff,
+		(baudrate >> 24) & 0xff};
+	uint8_t data[2];
+	send_recv(info.usb_link, cmd, 16, data, 2);
+	if (stlink_usb_error_check(data, true) != STLINK_ERROR_OK)
+		return false;
+	traceswo_setmask(swo_chan_bitmask);
+	stlink.trace_active = true;
+	DEBUG_INFO("SWO capture at %" PRIu32 " baud\n", baudrate);
+	return true;
+}
+
+/*
+ * Fetch what the ST-Link has buffered. This runs at the halt poll rate, so
+ * it backs off while the target is quiet. While the buffer is filling up
+ * faster than that, keep draining before it overflows.
+ */
+void stlink_traceswo_poll(void)
+{
+	for (size_t i = 0; stlink.trace_active && i < 8U; ++i) {
+		uint8_t cmd[16] = {STLINK_DEBUG_COMMAND, STLINK_DEBUG_APIV2_GET_TRACE_NB};
+		uint8_t data[2];
+		send_recv(info.usb_link, cmd, 16, data, 2);
+		const size_t count = MIN((size_t)(data[0] | (data[1] << 8)), STLINK_TRACE_SIZE);
+		if (!count)
+			return;
+		uint8_t buf[STLINK_TRACE_SIZE];
+		int transferred = 0;
+		const int res = libusb_bulk_transfer(info.usb_link->ul_libusb_device_handle, stlink.ep_trace,
+			buf, count, &transferred, 100);
+		if (res < 0) {
+			DEBUG_WARN("SWO trace read failed: %s\n", libusb_strerror(res));
+			return;
+		}
+		if (transferred > 0)
+			traceswo_decode(buf, transferred);
+		if (count < STLINK_TRACE_SIZE / 2U)
+			return;
+	}
+}
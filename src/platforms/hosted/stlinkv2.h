@@ -53,5 +53,8 @@ uint32_t jtag_scan_stlinkv2(bmp_info_t *info, const uint8_t *irlens);
 void stlink_exit_function(bmp_info_t *info);
 void stlink_max_frequency_set(bmp_info_t *info, uint32_t freq);
 uint32_t stlink_max_frequency_get(bmp_info_t *info);
+bool stlink_traceswo_init(uint32_t baudrate, uint32_t swo_chan_bitmask);
+void stlink_traceswo_stop(void);
+void stlink_traceswo_poll(void);
 #endif
 #endif
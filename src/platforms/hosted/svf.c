@@ -0,0 +1,944 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* SVF and XSVF player.
+ *
+ * Both describe the programming of a JTAG chain as scans with the TDO
+ * expected back and the TAP states to go through, and both are played
+ * here through jtag_proc. The TAP state is tracked on the host and moved
+ * along the shortest TMS path, starting from a Test-Logic-Reset.
+ *
+ * Checking TDO needs the scan read back, which costs a round trip for
+ * each one on most adaptors. Checked scans go through the deferred
+ * tdi_tdo_seq where the adaptor has it and are compared once the
+ * captures come in, at the end, before the host sleeps for a wait, or
+ * once about SVF_CHECK_BYTES_MAX of them are outstanding. Only the scans
+ * that mismatch are reported, and playing stops at the first of them.
+ * XSVF scans that may be repeated on a mismatch are checked at once.
+ *
+ * SVF parameters and persistence follow the Serial Vector Format
+ * specification, except that TRST, PIO and PIOMAP are not supported as
+ * jtag_proc has no TRST or parallel pins. Of XSVF, the XSDRB/C/E, XSDRTDOB/C/E,
+ * XSETSDRMASKS and XSDRINC commands are not supported, the Xilinx tools
+ * don't emit them by default.
+ */
+
+#include "general.h"
+#include "jtagtap.h"
+#include "jtag_scan.h"
+#include "svf.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <strings.h>
+
+/* Captures held back for the comparison before it is done */
+#define SVF_CHECK_BYTES_MAX (1024U * 1024U)
+/* Waits up to this long are clocked out where the TCK frequency is known */
+#define SVF_CLOCKED_WAIT_MAX_US 10000U
+
+/* The TAP states in the order XSVF numbers them */
+typedef enum svf_tap_state_e {
+	TAP_RESET,
+	TAP_IDLE,
+	TAP_DRSELECT,
+	TAP_DRCAPTURE,
+	TAP_DRSHIFT,
+	TAP_DREXIT1,
+	TAP_DRPAUSE,
+	TAP_DREXIT2,
+	TAP_DRUPDATE,
+	TAP_IRSELECT,
+	TAP_IRCAPTURE,
+	TAP_IRSHIFT,
+	TAP_IREXIT1,
+	TAP_IRPAUSE,
+	TAP_IREXIT2,
+	TAP_IRUPDATE,
+	TAP_STATE_COUNT,
+} svf_tap_state_t;
+
+/* The state each one moves to with TMS low and high */
+static const uint8_t svf_tap_next[TAP_STATE_COUNT][2] = {
+	[TAP_RESET] = {TAP_IDLE, TAP_RESET},
+	[TAP_IDLE] = {TAP_IDLE, TAP_DRSELECT},
+	[TAP_DRSELECT] = {TAP_DRCAPTURE, TAP_IRSELECT},
+	[TAP_DRCAPTURE] = {TAP_DRSHIFT, TAP_DREXIT1},
+	[TAP_DRSHIFT] = {TAP_DRSHIFT, TAP_DREXIT1},
+	[TAP_DREXIT1] = {TAP_DRPAUSE, TAP_DRUPDATE},
+	[TAP_DRPAUSE] = {TAP_DRPAUSE, TAP_DREXIT2},
+	[TAP_DREXIT2] = {TAP_DRSHIFT, TAP_DRUPDATE},
+	[TAP_DRUPDATE] = {TAP_IDLE, TAP_DRSELECT},
+	[TAP_IRSELECT] = {TAP_IRCAPTURE, TAP_RESET},
+	[TAP_IRCAPTURE] = {TAP_IRSHIFT, TAP_IREXIT1},
+	[TAP_IRSHIFT] = {TAP_IRSHIFT, TAP_IREXIT1},
+	[TAP_IREXIT1] = {TAP_IRPAUSE, TAP_IRUPDATE},
+	[TAP_IRPAUSE] = {TAP_IRPAUSE, TAP_IREXIT2},
+	[TAP_IREXIT2] = {TAP_IRSHIFT, TAP_IRUPDATE},
+	[TAP_IRUPDATE] = {TAP_IDLE, TAP_DRSELECT},
+};
+
+static const char *const svf_tap_state_names[TAP_STATE_COUNT] = {
+	"RESET",
+	"IDLE",
+	"DRSELECT",
+	"DRCAPTURE",
+	"DRSHIFT",
+	"DREXIT1",
+	"DRPAUSE",
+	"DREXIT2",
+	"DRUPDATE",
+	"IRSELECT",
+	"IRCAPTURE",
+	"IRSHIFT",
+	"IREXIT1",
+	"IRPAUSE",
+	"IREXIT2",
+	"IRUPDATE",
+};
+
+/* A scan whose captured TDO is still to be compared, the three buffers are one allocation */
+typedef struct svf_check_s {
+	/* SVF line or XSVF offset of the command */
+	uint32_t where;
+	size_t bits;
+	uint8_t *captured;
+	uint8_t *expected;
+	uint8_t *mask;
+} svf_check_t;
+
+static bool svf_xsvf;
+static svf_tap_state_t svf_state;
+static svf_check_t *svf_checks;
+static size_t svf_check_count;
+static size_t svf_check_alloc;
+static size_t svf_check_bytes;
+static bool svf_check_failed;
+/* Scratch for the TDI of a whole scan */
+static uint8_t *svf_tdi;
+static size_t svf_tdi_size;
+
+static bool svf_tdi_reserve(const size_t bytes)
+{
+	if (bytes <= svf_tdi_size)
+		return true;
+	uint8_t *const tdi = realloc(svf_tdi, bytes);
+	if (!tdi)
+		return false;
+	svf_tdi = tdi;
+	svf_tdi_size = bytes;
+	return true;
+}
+
+static void svf_bits_copy(uint8_t *const dest, const size_t offset, const uint8_t *const src, const size_t bits)
+{
+	size_t bit = 0;
+	if (!(offset & 7U)) {
+		memcpy(dest + (offset >> 3U), src, bits >> 3U);
+		bit = bits & ~7U;
+	}
+	for (; bit < bits; ++bit) {
+		const size_t to = offset + bit;
+		if (src[bit >> 3U] & (1U << (bit & 7U)))
+			dest[to >> 3U] |= 1U << (to & 7U);
+		else
+			dest[to >> 3U] &= ~(1U << (to & 7U));
+	}
+}
+
+/* Moves the TAP along the shortest path to state, always resetting for TAP_RESET */
+static void svf_goto(const svf_tap_state_t state)
+{
+	if (state == TAP_RESET) {
+		jtag_proc.jtagtap_tms_seq(0x1fU, 5U);
+		svf_state = TAP_RESET;
+		return;
+	}
+
+	int8_t from[TAP_STATE_COUNT];
+	memset(from, -1, sizeof(from));
+	svf_tap_state_t queue[TAP_STATE_COUNT];
+	size_t head = 0;
+	size_t tail = 0;
+	queue[tail++] = svf_state;
+	from[svf_state] = svf_state;
+	while (head < tail && from[state] < 0) {
+		const svf_tap_state_t current = queue[head++];
+		for (size_t tms = 0; tms < 2U; ++tms) {
+			const svf_tap_state_t next = svf_tap_next[current][tms];
+			if (from[next] < 0) {
+				from[next] = current;
+				queue[tail++] = next;
+			}
+		}
+	}
+
+	uint32_t tms_states = 0;
+	size_t cycles = 0;
+	for (svf_tap_state_t current = state; current != svf_state; current = from[current]) {
+		tms_states = (tms_states << 1U) | (svf_tap_next[from[current]][1] == current ? 1U : 0U);
+		++cycles;
+	}
+	if (cycles)
+		jtag_proc.jtagtap_tms_seq(tms_states, cycles);
+	svf_state = state;
+}
+
+/* Clocks TCK staying in the current state, which has to be a stable one */
+static void svf_clock(size_t cycles)
+{
+	const bool tms = svf_state == TAP_RESET;
+	if (jtag_proc.jtagtap_cycle) {
+		if (cycles)
+			jtag_proc.jtagtap_cycle(tms, false, cycles);
+		return;
+	}
+	while (cycles) {
+		const size_t chunk = MIN(cycles, 32U);
+		jtag_proc.jtagtap_tms_seq(tms ? UINT32_MAX : 0U, chunk);
+		cycles -= chunk;
+	}
+}
+
+/* Waits in the current state, clocking or sleeping. Sleeps are only good to the millisecond */
+static void svf_wait(const uint32_t us)
+{
+	if (!us)
+		return;
+	const uint32_t frequency = platform_max_frequency_get();
+	if (jtag_proc.jtagtap_cycle && frequency && frequency != FREQ_FIXED && us <= SVF_CLOCKED_WAIT_MAX_US) {
+		svf_clock(((uint64_t)us * frequency + 999999U) / 1000000U);
+		return;
+	}
+	/* What is queued has to be out before the wait starts */
+	jtag_flush(&jtag_proc);
+	platform_delay((us + 999U) / 1000U);
+}
+
+static bool svf_check_match(const svf_check_t *const check, const bool report)
+{
+	const size_t bytes = (check->bits + 7U) >> 3U;
+	size_t mismatches = 0;
+	size_t first = 0;
+	for (size_t i = 0; i < bytes; ++i) {
+		uint8_t diff = (check->captured[i] ^ check->expected[i]) & check->mask[i];
+		if (i == bytes - 1U && (check->bits & 7U))
+			diff &= (1U << (check->bits & 7U)) - 1U;
+		if (!diff)
+			continue;
+		if (!mismatches)
+			first = i * 8U + __builtin_ctz(diff);
+		mismatches += __builtin_popcount(diff);
+	}
+	if (mismatches && report) {
+		const bool expected = check->expected[first >> 3U] & (1U << (first & 7U));
+		if (svf_xsvf)
+			DEBUG_WARN("Offset 0x%" PRIx32 ": ", check->where);
+		else
+			DEBUG_WARN("Line %" PRIu32 ": ", check->where);
+		DEBUG_WARN("TDO mismatch in %zu of %zu bits, the first is bit %zu, expected %u\n", mismatches, check->bits,
+			first, expected ? 1U : 0U);
+	}
+	return !mismatches;
+}
+
+/* Brings in the outstanding captures and compares them, false on a mismatch */
+static bool svf_checks_run(const bool report)
+{
+	jtag_flush(&jtag_proc);
+	bool result = true;
+	for (size_t i = 0; i < svf_check_count; ++i) {
+		if (result && !svf_check_match(&svf_checks[i], report))
+			result = false;
+		free(svf_checks[i].captured);
+	}
+	svf_check_count = 0;
+	svf_check_bytes = 0;
+	if (!result)
+		svf_check_failed = true;
+	return result;
+}
+
+/* A check for a scan of bits, capturing nothing until the caller fills in expected and mask */
+static svf_check_t *svf_check_new(const size_t bits, const uint32_t where)
+{
+	if (svf_check_count == svf_check_alloc) {
+		const size_t alloc = svf_check_alloc ? svf_check_alloc * 2U : 64U;
+		svf_check_t *const checks = realloc(svf_checks, alloc * sizeof(*checks));
+		if (!checks)
+			return NULL;
+		svf_checks = checks;
+		svf_check_alloc = alloc;
+	}
+	const size_t bytes = (bits + 7U) >> 3U;
+	uint8_t *const buffer = calloc(3U, bytes);
+	if (!buffer)
+		return NULL;
+	svf_check_t *const check = &svf_checks[svf_check_count++];
+	check->where = where;
+	check->bits = bits;
+	check->captured = buffer;
+	check->expected = buffer + bytes;
+	check->mask = buffer + 2U * bytes;
+	svf_check_bytes += 3U * bytes;
+	return check;
+}
+
+/*
+ * Shifts bits from Shift-IR or Shift-DR on to Exit1, capturing for check if
+ * there is one. False if that ran the outstanding checks and one mismatched.
+ */
+static bool svf_shift(svf_check_t *const check, const uint8_t *const tdi, const size_t bits)
+{
+	uint8_t *const captured = check ? check->captured : NULL;
+	if (jtag_proc.jtagtap_tdi_tdo_seq_deferred)
+		jtag_proc.jtagtap_tdi_tdo_seq_deferred(captured, true, tdi, bits);
+	else
+		jtag_proc.jtagtap_tdi_tdo_seq(captured, true, tdi, bits);
+	svf_state = svf_state == TAP_IRSHIFT ? TAP_IREXIT1 : TAP_DREXIT1;
+	return svf_check_bytes < SVF_CHECK_BYTES_MAX || svf_checks_run(true);
+}
+
+/* SVF */
+
+/* Header, data and trailer of a scan, in the order they are shifted */
+typedef enum svf_part_e {
+	SVF_HEADER,
+	SVF_DATA,
+	SVF_TRAILER,
+	SVF_PARTS,
+} svf_part_t;
+
+typedef struct svf_data_s {
+	size_t bits;
+	/* One allocation, each of the three (bits + 7) / 8 bytes */
+	uint8_t *tdi;
+	uint8_t *tdo;
+	uint8_t *mask;
+	/* TDO was given with the last command, only then it is compared */
+	bool check;
+} svf_data_t;
+
+static svf_data_t svf_ir[SVF_PARTS];
+static svf_data_t svf_dr[SVF_PARTS];
+static svf_tap_state_t svf_end_ir;
+static svf_tap_state_t svf_end_dr;
+static svf_tap_state_t svf_run_state;
+static svf_tap_state_t svf_run_end_state;
+static uint32_t svf_max_frequency;
+
+/* The next word of a statement or what's in the next parenthesis, NULL at the end */
+static char *svf_token(char **const pos, char *const end, size_t *const len)
+{
+	char *token = *pos;
+	while (token < end && isspace((unsigned char)*token))
+		++token;
+	if (token == end) {
+		*pos = end;
+		return NULL;
+	}
+	char *next = token;
+	if (*token == '(') {
+		++token;
+		next = memchr(token, ')', end - token);
+		if (!next)
+			next = end;
+		*len = next - token;
+		*pos = next < end ? next + 1 : end;
+		return token;
+	}
+	while (next < end && !isspace((unsigned char)*next) && *next != '(')
+		++next;
+	*len = next - token;
+	*pos = next;
+	return token;
+}
+
+static bool svf_token_is(const char *const token, const size_t len, const char *const keyword)
+{
+	return strlen(keyword) == len && !strncasecmp(token, keyword, len);
+}
+
+/* Counts and times can be given as real numbers, 1.0E-3 and the like */
+static bool svf_token_number(const char *const token, const size_t len, double *const value)
+{
+	char *number_end;
+	*value = strtod(token, &number_end);
+	return number_end == token + len && *value >= 0;
+}
+
+static bool svf_token_state(const char *const token, const size_t len, svf_tap_state_t *const state)
+{
+	for (size_t i = 0; i < TAP_STATE_COUNT; ++i) {
+		if (svf_token_is(token, len, svf_tap_state_names[i])) {
+			*state = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool svf_state_stable(const svf_tap_state_t state)
+{
+	return state == TAP_RESET || state == TAP_IDLE || state == TAP_DRPAUSE || state == TAP_IRPAUSE;
+}
+
+/* Hex digits to bits, the last digit holding bits 0 to 3. Digits beyond bits are dropped */
+static bool svf_hex(const char *const hex, const size_t len, uint8_t *const data, const size_t bits)
+{
+	memset(data, 0, (bits + 7U) >> 3U);
+	size_t bit = 0;
+	for (size_t i = len; i-- > 0;) {
+		const char digit = hex[i];
+		if (isspace((unsigned char)digit))
+			continue;
+		if (!isxdigit((unsigned char)digit))
+			return false;
+		if (bit < bits) {
+			uint8_t value = isdigit((unsigned char)digit) ? digit - '0' : tolower((unsigned char)digit) - 'a' + 10;
+			if (bits - bit < 4U)
+				value &= (1U << (bits - bit)) - 1U;
+			data[bit >> 3U] |= value << (bit & 7U);
+		}
+		bit += 4U;
+	}
+	return true;
+}
+
+/* The parameters of HIR, SIR, TIR, HDR, SDR and TDR. What isn't given stays as it was while the length doesn't change */
+static bool svf_parse_scan(svf_data_t *const data, char *pos, char *const end)
+{
+	size_t len;
+	char *token = svf_token(&pos, end, &len);
+	double length;
+	if (!token || !svf_token_number(token, len, &length))
+		return false;
+	const size_t bits = length;
+	const size_t bytes = (bits + 7U) >> 3U;
+	if (bits != data->bits || !data->tdi) {
+		free(data->tdi);
+		data->tdi = calloc(3U * bytes + 1U, 1U);
+		if (!data->tdi) {
+			data->bits = 0;
+			return false;
+		}
+		data->tdo = data->tdi + bytes;
+		data->mask = data->tdo + bytes;
+		memset(data->mask, 0xff, bytes);
+		data->bits = bits;
+	}
+	data->check = false;
+
+	while ((token = svf_token(&pos, end, &len))) {
+		size_t hex_len;
+		const char *const hex = svf_token(&pos, end, &hex_len);
+		uint8_t *dest = NULL;
+		if (svf_token_is(token, len, "TDI"))
+			dest = data->tdi;
+		else if (svf_token_is(token, len, "TDO")) {
+			dest = data->tdo;
+			data->check = true;
+		} else if (svf_token_is(token, len, "MASK"))
+			dest = data->mask;
+		else if (!svf_token_is(token, len, "SMASK"))
+			return false;
+		/* SMASK only says which TDI bits matter, they are all shifted anyway */
+		if (!hex || (dest && !svf_hex(hex, hex_len, dest, bits)))
+			return false;
+	}
+	return true;
+}
+
+static bool svf_scan(const bool ir, const uint32_t line)
+{
+	const svf_data_t *const parts = ir ? svf_ir : svf_dr;
+	size_t bits = 0;
+	bool check = false;
+	for (size_t i = 0; i < SVF_PARTS; ++i) {
+		bits += parts[i].bits;
+		check |= parts[i].check;
+	}
+	if (!bits)
+		return true;
+	if (!svf_tdi_reserve((bits + 7U) >> 3U))
+		return false;
+	svf_check_t *const scan_check = check ? svf_check_new(bits, line) : NULL;
+	if (check && !scan_check)
+		return false;
+
+	for (size_t i = 0, offset = 0; i < SVF_PARTS; offset += parts[i++].bits) {
+		svf_bits_copy(svf_tdi, offset, parts[i].tdi, parts[i].bits);
+		if (scan_check && parts[i].check) {
+			svf_bits_copy(scan_check->expected, offset, parts[i].tdo, parts[i].bits);
+			svf_bits_copy(scan_check->mask, offset, parts[i].mask, parts[i].bits);
+		}
+	}
+	svf_goto(ir ? TAP_IRSHIFT : TAP_DRSHIFT);
+	if (!svf_shift(scan_check, svf_tdi, bits))
+		return false;
+	svf_goto(ir ? svf_end_ir : svf_end_dr);
+	return true;
+}
+
+/* RUNTEST [run_state] [run_count TCK|SCK] [min_time SEC [MAXIMUM max_time SEC]] [ENDSTATE end_state] */
+static bool svf_runtest(char *pos, char *const end)
+{
+	size_t len;
+	char *token = svf_token(&pos, end, &len);
+	svf_tap_state_t state;
+	if (token && svf_token_state(token, len, &state)) {
+		if (!svf_state_stable(state))
+			return false;
+		svf_run_state = state;
+		svf_run_end_state = state;
+		token = svf_token(&pos, end, &len);
+	}
+
+	double count = 0;
+	double min_time = 0;
+	for (; token; token = svf_token(&pos, end, &len)) {
+		double value;
+		if (svf_token_is(token, len, "ENDSTATE")) {
+			token = svf_token(&pos, end, &len);
+			if (!token || !svf_token_state(token, len, &state) || !svf_state_stable(state))
+				return false;
+			svf_run_end_state = state;
+		} else if (svf_token_is(token, len, "MAXIMUM")) {
+			/* Nothing here waits any longer than asked to */
+			svf_token(&pos, end, &len);
+			svf_token(&pos, end, &len);
+		} else if (svf_token_number(token, len, &value)) {
+			token = svf_token(&pos, end, &len);
+			/* The system clock is not ours to count, TCK has to stand in for it */
+			if (token && (svf_token_is(token, len, "TCK") || svf_token_is(token, len, "SCK")))
+				count = value;
+			else if (token && svf_token_is(token, len, "SEC"))
+				min_time = value;
+			else
+				return false;
+		} else
+			return false;
+	}
+
+	svf_goto(svf_run_state);
+	svf_clock((size_t)count);
+	/* The clocks count towards the minimum time where their frequency is known */
+	double wait_us = min_time * 1000000.0;
+	const uint32_t frequency = platform_max_frequency_get();
+	if (frequency && frequency != FREQ_FIXED)
+		wait_us -= count * 1000000.0 / frequency;
+	if (wait_us > 0)
+		svf_wait((uint32_t)(wait_us + 0.5));
+	svf_goto(svf_run_end_state);
+	return true;
+}
+
+static bool svf_frequency(char *pos, char *const end)
+{
+	size_t len;
+	const char *const token = svf_token(&pos, end, &len);
+	double frequency = svf_max_frequency;
+	if (token && !svf_token_number(token, len, &frequency))
+		return false;
+	/* Never faster than the probe was set up for */
+	if (svf_max_frequency != FREQ_FIXED && frequency >= 1.0)
+		platform_max_frequency_set((uint32_t)MIN(frequency, svf_max_frequency));
+	return true;
+}
+
+static bool svf_statement(char *pos, char *const end, const uint32_t line)
+{
+	size_t len;
+	const char *const command = svf_token(&pos, end, &len);
+	if (!command)
+		return true;
+
+	if (svf_token_is(command, len, "SIR"))
+		return svf_parse_scan(&svf_ir[SVF_DATA], pos, end) && svf_scan(true, line);
+	if (svf_token_is(command, len, "SDR"))
+		return svf_parse_scan(&svf_dr[SVF_DATA], pos, end) && svf_scan(false, line);
+	if (svf_token_is(command, len, "HIR"))
+		return svf_parse_scan(&svf_ir[SVF_HEADER], pos, end);
+	if (svf_token_is(command, len, "TIR"))
+		return svf_parse_scan(&svf_ir[SVF_TRAILER], pos, end);
+	if (svf_token_is(command, len, "HDR"))
+		return svf_parse_scan(&svf_dr[SVF_HEADER], pos, end);
+	if (svf_token_is(command, len, "TDR"))
+		return svf_parse_scan(&svf_dr[SVF_TRAILER], pos, end);
+	if (svf_token_is(command, len, "RUNTEST"))
+		return svf_runtest(pos, end);
+	if (svf_token_is(command, len, "FREQUENCY"))
+		return svf_frequency(pos, end);
+
+	if (svf_token_is(command, len, "ENDIR") || svf_token_is(command, len, "ENDDR")) {
+		const bool ir = svf_token_is(command, len, "ENDIR");
+		const char *const token = svf_token(&pos, end, &len);
+		svf_tap_state_t state;
+		if (!token || !svf_token_state(token, len, &state) || !svf_state_stable(state))
+			return false;
+		*(ir ? &svf_end_ir : &svf_end_dr) = state;
+		return true;
+	}
+
+	if (svf_token_is(command, len, "STATE")) {
+		/* The path states are each next to the one before, the last one is stable */
+		svf_tap_state_t state = svf_state;
+		for (const char *token; (token = svf_token(&pos, end, &len));) {
+			if (!svf_token_state(token, len, &state))
+				return false;
+			svf_goto(state);
+		}
+		return svf_state_stable(state);
+	}
+
+	if (svf_token_is(command, len, "TRST")) {
+		const char *const token = svf_token(&pos, end, &len);
+		if (token && (svf_token_is(token, len, "OFF") || svf_token_is(token, len, "Z") ||
+						 svf_token_is(token, len, "ABSENT")))
+			return true;
+		return false;
+	}
+	return false;
+}
+
+static int svf_play_svf(char *const text, const size_t size)
+{
+	char *const end = text + size;
+	/* Blank out the comments, so a ';' in one ends nothing */
+	for (char *pos = text; pos < end; ++pos) {
+		if (*pos != '!' && (*pos != '/' || pos + 1 == end || pos[1] != '/'))
+			continue;
+		while (pos < end && *pos != '\n')
+			*pos++ = ' ';
+	}
+
+	svf_end_ir = TAP_IDLE;
+	svf_end_dr = TAP_IDLE;
+	svf_run_state = TAP_IDLE;
+	svf_run_end_state = TAP_IDLE;
+	svf_max_frequency = platform_max_frequency_get();
+
+	uint32_t line = 1;
+	for (char *pos = text; pos < end;) {
+		while (pos < end && isspace((unsigned char)*pos)) {
+			if (*pos++ == '\n')
+				++line;
+		}
+		if (pos == end)
+			break;
+		char *const statement_end = memchr(pos, ';', end - pos);
+		if (!statement_end) {
+			DEBUG_WARN("Line %" PRIu32 ": statement without the ';' ending it\n", line);
+			return -1;
+		}
+		const uint32_t statement_line = line;
+		for (const char *c = pos; c < statement_end; ++c) {
+			if (*c == '\n')
+				++line;
+		}
+		if (!svf_statement(pos, statement_end, statement_line)) {
+			if (!svf_check_failed) {
+				const int len = (int)MIN(statement_end - pos, 60);
+				DEBUG_WARN("Line %" PRIu32 ": can not play \"%.*s\"\n", statement_line, len, pos);
+			}
+			return -1;
+		}
+		pos = statement_end + 1;
+	}
+	return svf_checks_run(true) ? 0 : -1;
+}
+
+/* XSVF */
+
+enum {
+	XCOMPLETE = 0x00,
+	XTDOMASK = 0x01,
+	XSIR = 0x02,
+	XSDR = 0x03,
+	XRUNTEST = 0x04,
+	XREPEAT = 0x07,
+	XSDRSIZE = 0x08,
+	XSDRTDO = 0x09,
+	XSTATE = 0x12,
+	XENDIR = 0x13,
+	XENDDR = 0x14,
+	XSIR2 = 0x15,
+	XCOMMENT = 0x16,
+	XWAIT = 0x17,
+};
+
+/* The Xilinx player's default */
+#define XSVF_REPEAT_DEFAULT 32U
+
+typedef struct xsvf_s {
+	const uint8_t *pos;
+	const uint8_t *end;
+	size_t sdr_bits;
+	/* One allocation, each of the three (sdr_bits + 7) / 8 bytes */
+	uint8_t *sdr_tdi;
+	uint8_t *tdo_expected;
+	uint8_t *tdo_mask;
+	uint32_t runtest_us;
+	uint8_t repeat;
+	svf_tap_state_t end_ir;
+	svf_tap_state_t end_dr;
+} xsvf_t;
+
+static bool xsvf_read(xsvf_t *const xsvf, const size_t bytes, uint32_t *const value)
+{
+	if ((size_t)(xsvf->end - xsvf->pos) < bytes)
+		return false;
+	*value = 0;
+	for (size_t i = 0; i < bytes; ++i)
+		*value = (*value << 8U) | *xsvf->pos++;
+	return true;
+}
+
+/* Vectors come MSB first, turn them around for jtag_proc's LSB first */
+static bool xsvf_read_bits(xsvf_t *const xsvf, uint8_t *const data, const size_t bits)
+{
+	const size_t bytes = (bits + 7U) >> 3U;
+	if ((size_t)(xsvf->end - xsvf->pos) < bytes)
+		return false;
+	for (size_t i = 0; i < bytes; ++i)
+		data[i] = xsvf->pos[bytes - 1U - i];
+	xsvf->pos += bytes;
+	return true;
+}
+
+static bool xsvf_sdr_size(xsvf_t *const xsvf, const size_t bits)
+{
+	const size_t bytes = (bits + 7U) >> 3U;
+	free(xsvf->sdr_tdi);
+	xsvf->sdr_tdi = calloc(3U * bytes + 1U, 1U);
+	xsvf->sdr_bits = xsvf->sdr_tdi ? bits : 0;
+	xsvf->tdo_expected = xsvf->sdr_tdi + bytes;
+	xsvf->tdo_mask = xsvf->tdo_expected + bytes;
+	return xsvf->sdr_tdi;
+}
+
+/* After a scan, the end state or Run-Test/Idle for the XRUNTEST wait */
+static void xsvf_scan_end(const svf_tap_state_t end_state, const uint32_t runtest_us)
+{
+	svf_goto(end_state);
+	if (runtest_us) {
+		svf_goto(TAP_IDLE);
+		svf_wait(runtest_us);
+	}
+}
+
+/*
+ * As the Xilinx player does, a mismatch with an XRUNTEST wait is retried
+ * XREPEAT times from Pause-DR, each time waiting a quarter longer. Only
+ * those scans need their result right away.
+ */
+static bool xsvf_sdr(xsvf_t *const xsvf, const uint32_t offset)
+{
+	const size_t bits = xsvf->sdr_bits;
+	const size_t bytes = (bits + 7U) >> 3U;
+	bool check = false;
+	for (size_t i = 0; i < bytes; ++i)
+		check |= xsvf->tdo_mask[i] != 0;
+	uint32_t runtest_us = xsvf->runtest_us;
+
+	for (size_t attempt = 0;; ++attempt) {
+		const bool retry = check && runtest_us && attempt < xsvf->repeat;
+		/* A mismatch from before must not pass for this one's */
+		if (retry && svf_check_count && !svf_checks_run(true))
+			return false;
+		svf_goto(TAP_DRSHIFT);
+		svf_check_t *const scan_check = check ? svf_check_new(bits, offset) : NULL;
+		if (check) {
+			if (!scan_check)
+				return false;
+			memcpy(scan_check->expected, xsvf->tdo_expected, bytes);
+			memcpy(scan_check->mask, xsvf->tdo_mask, bytes);
+		}
+		if (!svf_shift(scan_check, xsvf->sdr_tdi, bits))
+			return false;
+		if (!retry || svf_checks_run(false)) {
+			xsvf_scan_end(xsvf->end_dr, runtest_us);
+			return true;
+		}
+		DEBUG_INFO("Offset 0x%" PRIx32 ": TDO mismatch, retrying\n", offset);
+		svf_goto(TAP_DRPAUSE);
+		svf_goto(TAP_DRSHIFT);
+		runtest_us += runtest_us >> 2U;
+		xsvf_scan_end(TAP_IDLE, runtest_us);
+		svf_check_failed = false;
+	}
+}
+
+static bool xsvf_command(xsvf_t *const xsvf, const uint8_t command, const uint32_t offset)
+{
+	uint32_t value;
+	switch (command) {
+	case XTDOMASK:
+		return xsvf_read_bits(xsvf, xsvf->tdo_mask, xsvf->sdr_bits);
+
+	case XSIR:
+	case XSIR2: {
+		if (!xsvf_read(xsvf, command == XSIR ? 1U : 2U, &value) || !svf_tdi_reserve((value + 7U) >> 3U) ||
+			!xsvf_read_bits(xsvf, svf_tdi, value))
+			return false;
+		if (!value)
+			return true;
+		svf_goto(TAP_IRSHIFT);
+		if (!svf_shift(NULL, svf_tdi, value))
+			return false;
+		xsvf_scan_end(xsvf->end_ir, xsvf->runtest_us);
+		return true;
+	}
+
+	case XSDR:
+		return xsvf_read_bits(xsvf, xsvf->sdr_tdi, xsvf->sdr_bits) && xsvf_sdr(xsvf, offset);
+
+	case XSDRTDO:
+		return xsvf_read_bits(xsvf, xsvf->sdr_tdi, xsvf->sdr_bits) &&
+			xsvf_read_bits(xsvf, xsvf->tdo_expected, xsvf->sdr_bits) && xsvf_sdr(xsvf, offset);
+
+	case XRUNTEST:
+		return xsvf_read(xsvf, 4U, &xsvf->runtest_us);
+
+	case XREPEAT:
+		if (!xsvf_read(xsvf, 1U, &value))
+			return false;
+		xsvf->repeat = value;
+		return true;
+
+	case XSDRSIZE:
+		return xsvf_read(xsvf, 4U, &value) && xsvf_sdr_size(xsvf, value);
+
+	case XSTATE:
+		if (!xsvf_read(xsvf, 1U, &value) || value >= TAP_STATE_COUNT)
+			return false;
+		svf_goto(value);
+		return true;
+
+	case XENDIR:
+	case XENDDR:
+		if (!xsvf_read(xsvf, 1U, &value) || value > 1U)
+			return false;
+		if (command == XENDIR)
+			xsvf->end_ir = value ? TAP_IRPAUSE : TAP_IDLE;
+		else
+			xsvf->end_dr = value ? TAP_DRPAUSE : TAP_IDLE;
+		return true;
+
+	case XCOMMENT: {
+		const uint8_t *const comment_end = memchr(xsvf->pos, '\0', xsvf->end - xsvf->pos);
+		if (!comment_end)
+			return false;
+		DEBUG_INFO("%s\n", (const char *)xsvf->pos);
+		xsvf->pos = comment_end + 1;
+		return true;
+	}
+
+	case XWAIT: {
+		uint32_t wait_state;
+		uint32_t end_state;
+		if (!xsvf_read(xsvf, 1U, &wait_state) || !xsvf_read(xsvf, 1U, &end_state) || !xsvf_read(xsvf, 4U, &value) ||
+			wait_state >= TAP_STATE_COUNT || end_state >= TAP_STATE_COUNT)
+			return false;
+		svf_goto(wait_state);
+		svf_wait(value);
+		svf_goto(end_state);
+		return true;
+	}
+
+	default:
+		return false;
+	}
+}
+
+static int svf_play_xsvf(const uint8_t *const data, const size_t size)
+{
+	xsvf_t xsvf = {
+		.pos = data,
+		.end = data + size,
+		.repeat = XSVF_REPEAT_DEFAULT,
+		.end_ir = TAP_IDLE,
+		.end_dr = TAP_IDLE,
+	};
+	if (!xsvf_sdr_size(&xsvf, 0))
+		return -1;
+	int result = -1;
+	while (xsvf.pos < xsvf.end) {
+		const uint32_t offset = xsvf.pos - data;
+		const uint8_t command = *xsvf.pos++;
+		if (command == XCOMPLETE) {
+			result = svf_checks_run(true) ? 0 : -1;
+			break;
+		}
+		if (!xsvf_command(&xsvf, command, offset)) {
+			if (!svf_check_failed)
+				DEBUG_WARN("Offset 0x%" PRIx32 ": can not play command 0x%02x\n", offset, command);
+			break;
+		}
+		if (xsvf.pos == xsvf.end)
+			DEBUG_WARN("XSVF ends without XCOMPLETE\n");
+	}
+	free(xsvf.sdr_tdi);
+	return result;
+}
+
+int svf_play(const char *const path)
+{
+	FILE *const file = fopen(path, "rb");
+	if (!file) {
+		DEBUG_WARN("Can not open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	fseek(file, 0, SEEK_END);
+	const long size = ftell(file);
+	rewind(file);
+	char *const data = size >= 0 ? malloc(size + 1U) : NULL;
+	if (!data || fread(data, 1, size, file) != (size_t)size) {
+		DEBUG_WARN("Can not read %s\n", path);
+		free(data);
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+
+	const size_t path_len = strlen(path);
+	svf_xsvf = path_len > 5U && !strcasecmp(path + path_len - 5U, ".xsvf");
+	const uint32_t start = platform_time_ms();
+	/* Nothing is known about the TAPs' state before */
+	svf_check_failed = false;
+	svf_goto(TAP_RESET);
+	const int result = svf_xsvf ? svf_play_xsvf((const uint8_t *)data, size) : svf_play_svf(data, size);
+	/* Drop whatever was left outstanding by an error */
+	svf_checks_run(false);
+	if (!result)
+		DEBUG_INFO("Played %s in %" PRIu32 " ms\n", path, platform_time_ms() - start);
+
+	free(data);
+	free(svf_checks);
+	svf_checks = NULL;
+	svf_check_alloc = 0;
+	free(svf_tdi);
+	svf_tdi = NULL;
+	svf_tdi_size = 0;
+	for (size_t i = 0; i < SVF_PARTS; ++i) {
+		free(svf_ir[i].tdi);
+		free(svf_dr[i].tdi);
+	}
+	memset(svf_ir, 0, sizeof(svf_ir));
+	memset(svf_dr, 0, sizeof(svf_dr));
+	return result;
+}
@@ -0,0 +1,27 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Player for SVF and Xilinx XSVF files, programming CPLDs and FPGAs and
+ * the like through jtag_proc without anything knowing about the devices.
+ */
+#ifndef __SVF_H
+#define __SVF_H
+
+/* Plays path to the chain, as XSVF if it ends in .xsvf. 0 on success */
+int svf_play(const char *path);
+
+#endif /* __SVF_H */
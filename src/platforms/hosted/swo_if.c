@@ -0,0 +1,258 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements where hosted BMP puts decoded SWO. The text of each
+ * software channel goes to stdout unless "monitor swo sink" sent it to a
+ * file, to the client of a TCP port of its own, or nowhere. Records and the
+ * raw stream stay on stdout. Nothing waits on a slow or missing client:
+ * what a sink can't take right away is dropped and counted, as is what the
+ * capture itself had no room for, and "monitor swo status" shows both.
+ */
+
+#include "general.h"
+#include "traceswo.h"
+#include "swo_if.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#define SWO_CHANNELS      32U
+#define SWO_SINK_BUF_SIZE 256U
+
+typedef enum swo_sink_type {
+	SWO_SINK_STDOUT = 0,
+	SWO_SINK_OFF,
+	SWO_SINK_FILE,
+	SWO_SINK_TCP,
+} swo_sink_type_e;
+
+typedef struct swo_sink {
+	swo_sink_type_e type;
+	int fd;   /* the file or the TCP client, -1 when there is none */
+	int serv; /* listening socket of a TCP sink */
+	uint16_t port;
+	size_t len;
+	uint8_t buf[SWO_SINK_BUF_SIZE];
+	uint64_t written;
+	uint64_t dropped;
+} swo_sink_s;
+
+static swo_sink_s swo_sinks[SWO_CHANNELS];
+static atomic_size_t swo_capture_lost;
+
+static void swo_sink_close(swo_sink_s *const sink)
+{
+	if (sink->type == SWO_SINK_FILE || sink->type == SWO_SINK_TCP) {
+		if (sink->fd != -1)
+			close(sink->fd);
+		if (sink->type == SWO_SINK_TCP)
+			close(sink->serv);
+	}
+	sink->type = SWO_SINK_STDOUT;
+	sink->len = 0;
+}
+
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+static int swo_sink_listen(const uint16_t port)
+{
+	const int serv = socket(PF_INET, SOCK_STREAM, 0);
+	if (serv == -1)
+		return -1;
+	const int opt = 1;
+	setsockopt(serv, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(serv, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(serv, 1) == -1) {
+		close(serv);
+		return -1;
+	}
+	fcntl(serv, F_SETFL, fcntl(serv, F_GETFL, 0) | O_NONBLOCK);
+	return serv;
+}
+
+static void swo_sink_accept(swo_sink_s *const sink)
+{
+	if (sink->fd != -1)
+		return;
+	sink->fd = accept(sink->serv, NULL, NULL);
+	if (sink->fd != -1)
+		fcntl(sink->fd, F_SETFL, fcntl(sink->fd, F_GETFL, 0) | O_NONBLOCK);
+}
+#endif
+
+bool traceswo_sink(const uint8_t channel, const char *const where)
+{
+	if (channel >= SWO_CHANNELS)
+		return false;
+	swo_sink_s *const sink = &swo_sinks[channel];
+	swo_sink_close(sink);
+	if (!strcmp(where, "stdout"))
+		return true;
+	if (!strcmp(where, "off")) {
+		sink->type = SWO_SINK_OFF;
+		return true;
+	}
+	if (!strncmp(where, "tcp:", 4U)) {
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+		const uint16_t port = strtoul(where + 4U, NULL, 0);
+		sink->serv = swo_sink_listen(port);
+		if (sink->serv == -1) {
+			DEBUG_WARN("swo: can't serve channel %u on port %u: %s\n", channel, port, strerror(errno));
+			return false;
+		}
+		sink->type = SWO_SINK_TCP;
+		sink->port = port;
+		sink->fd = -1;
+		return true;
+#else
+		DEBUG_WARN("swo: no TCP sinks on windows\n");
+		return false;
+#endif
+	}
+	sink->fd = open(where, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (sink->fd == -1) {
+		DEBUG_WARN("swo: can't open %s: %s\n", where, strerror(errno));
+		return false;
+	}
+	sink->type = SWO_SINK_FILE;
+	return true;
+}
+
+static void swo_sink_flush(swo_sink_s *const sink)
+{
+	if (!sink->len)
+		return;
+	ssize_t sent = -1;
+	switch (sink->type) {
+	case SWO_SINK_STDOUT:
+		sent = write(STDOUT_FILENO, sink->buf, sink->len);
+		break;
+	case SWO_SINK_FILE:
+		sent = write(sink->fd, sink->buf, sink->len);
+		break;
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+	case SWO_SINK_TCP:
+		swo_sink_accept(sink);
+		if (sink->fd == -1)
+			break;
+#ifdef MSG_NOSIGNAL
+		sent = send(sink->fd, sink->buf, sink->len, MSG_NOSIGNAL);
+#else
+		sent = send(sink->fd, sink->buf, sink->len, 0);
+#endif
+		if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			close(sink->fd);
+			sink->fd = -1;
+		}
+		break;
+#endif
+	default:
+		break;
+	}
+	if (sent < 0)
+		sent = 0;
+	sink->written += sent;
+	sink->dropped += sink->len - sent;
+	sink->len = 0;
+}
+
+void swo_if_write(const uint8_t channel, const void *const buf, const size_t len)
+{
+	if (channel >= SWO_CHANNELS)
+		return;
+	swo_sink_s *const sink = &swo_sinks[channel];
+	if (sink->type == SWO_SINK_OFF)
+		return;
+	const uint8_t *const data = (const uint8_t *)buf;
+	for (size_t i = 0; i < len;) {
+		if (sink->len == SWO_SINK_BUF_SIZE)
+			swo_sink_flush(sink);
+		const size_t count = MIN(len - i, SWO_SINK_BUF_SIZE - sink->len);
+		memcpy(sink->buf + sink->len, data + i, count);
+		sink->len += count;
+		i += count;
+	}
+}
+
+void swo_if_write_stream(const void *const buf, const size_t len)
+{
+	if (write(STDOUT_FILENO, buf, len) < 0)
+		DEBUG_WARN("SWO output failed\n");
+}
+
+void swo_if_flush(void)
+{
+	for (size_t i = 0; i < SWO_CHANNELS; ++i)
+		swo_sink_flush(&swo_sinks[i]);
+}
+
+void swo_if_poll(void)
+{
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+	for (size_t i = 0; i < SWO_CHANNELS; ++i) {
+		if (swo_sinks[i].type == SWO_SINK_TCP)
+			swo_sink_accept(&swo_sinks[i]);
+	}
+#endif
+}
+
+void swo_if_capture_dropped(const size_t len)
+{
+	atomic_fetch_add_explicit(&swo_capture_lost, len, memory_order_relaxed);
+}
+
+void traceswo_status(void (*const print)(const char *fmt, ...))
+{
+	print("Capture dropped: %zu bytes\n", atomic_load_explicit(&swo_capture_lost, memory_order_relaxed));
+	for (size_t i = 0; i < SWO_CHANNELS; ++i) {
+		const swo_sink_s *const sink = &swo_sinks[i];
+		if (sink->type == SWO_SINK_STDOUT && !sink->written && !sink->dropped)
+			continue;
+		print("Channel %2zu: ", i);
+		switch (sink->type) {
+		case SWO_SINK_STDOUT:
+			print("stdout");
+			break;
+		case SWO_SINK_OFF:
+			print("off");
+			break;
+		case SWO_SINK_FILE:
+			print("file");
+			break;
+		case SWO_SINK_TCP:
+			print("tcp:%u, %s", sink->port, sink->fd == -1 ? "no client" : "client connected");
+			break;
+		}
+		print(", %" PRIu64 " bytes written, %" PRIu64 " dropped\n", sink->written, sink->dropped);
+	}
+}
+
+void swo_if_exit(void)
+{
+	swo_if_flush();
+	for (size_t i = 0; i < SWO_CHANNELS; ++i)
+		swo_sink_close(&swo_sinks[i]);
+}
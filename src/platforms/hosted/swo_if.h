@@ -0,0 +1,35 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SWO_IF_H
+#define __SWO_IF_H
+
+#include "general.h"
+
+/* The text of software channel packets, to the channel's sink */
+void swo_if_write(uint8_t channel, const void *buf, size_t len);
+/* Records and the raw stream, which always go to stdout */
+void swo_if_write_stream(const void *buf, size_t len);
+/* Hand the sinks what is buffered for them, after each chunk of the stream */
+void swo_if_flush(void);
+/* Take clients waiting on the TCP sinks */
+void swo_if_poll(void);
+/* Bytes the probe sent that the capture had no room for, safe from any thread */
+void swo_if_capture_dropped(size_t len);
+void swo_if_exit(void);
+
+#endif /* __SWO_IF_H */
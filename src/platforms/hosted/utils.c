@@ -28,6 +28,9 @@
 #include <unistd.h>
 #include <sys/time.h>
 
+#include "general.h"
+#include "bmp_remote.h"
+
 #if defined(_WIN32) && !defined(__MINGW32__)
 #warning "This vasprintf() is dubious!"
 int vasprintf(char **strp, const char *fmt, va_list ap)
@@ -44,6 +47,8 @@ int vasprintf(char **strp, const char *fmt, va_list ap)
 
 void platform_delay(uint32_t ms)
 {
+	/* Whatever was queued for the probe has to happen before the delay, not after it */
+	remote_batch_flush();
 #if defined(_WIN32) && !defined(__MINGW32__)
 	Sleep(ms);
 #else
@@ -60,3 +65,10 @@ uint32_t platform_time_ms(void)
 	gettimeofday(&tv, NULL);
 	return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
 }
+
+uint32_t platform_time_us(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return ((uint32_t)tv.tv_sec * 1000000U) + (uint32_t)tv.tv_usec;
+}
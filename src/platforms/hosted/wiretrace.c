@@ -0,0 +1,1127 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Wire trace recorder and replay back end.
+ *
+ * While recording, the accessors of each DP are wrapped so every access
+ * the target code makes is written to the trace together with its result,
+ * the DP fault state and any exception it raised. Accesses nested in
+ * another one, like the low_access calls of firmware_mem_read(), are part
+ * of the outer access and are not recorded.
+ *
+ * While replaying, the DPs are created from the trace and their accessors
+ * serve the recorded results, checking that the arguments still match.
+ * This runs gdb_main, the target and Flash drivers with the same responses
+ * as on the hardware, but without a probe and without the link latency.
+ *
+ * The trace starts with the magic, a version byte and the probe's
+ * manufacturer, product and version strings. Each record is an opcode, the
+ * DP index, the DP fault state and the exception type after the access,
+ * the opcode specific arguments and results, then the exception message
+ * if there was one. Everything is little endian, strings and messages are
+ * prefixed with a length byte.
+ */
+
+#include "general.h"
+#include "exception.h"
+#include "target.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "wiretrace.h"
+
+#include <errno.h>
+
+#define WIRETRACE_MAGIC   "BMWT"
+#define WIRETRACE_VERSION 1U
+
+/* Words cortexm_regs_read_raw() has ap_regs_read() fill in */
+#define WIRETRACE_AP_REGS 21U
+
+typedef enum wiretrace_op_e {
+	WT_DP = 1,
+	WT_DP_READ,
+	WT_LOW_ACCESS,
+	WT_ERROR,
+	WT_ABORT,
+	WT_QUEUE_WRITE,
+	WT_QUEUE_READ,
+	WT_FLUSH,
+	WT_AP_READ,
+	WT_AP_WRITE,
+	WT_MEM_READ,
+	WT_MEM_WRITE,
+	WT_MEM_WAIT32,
+	WT_MEM_CRC32,
+	WT_SEQUENCE,
+	WT_AP_SETUP,
+	WT_AP_CLEANUP,
+	WT_AP_REGS_READ,
+	WT_AP_REG_READ,
+	WT_AP_REG_WRITE,
+	WT_OP_COUNT,
+} wiretrace_op_t;
+
+static const char *const wiretrace_op_names[WT_OP_COUNT] = {
+	[WT_DP] = "DP",
+	[WT_DP_READ] = "dp_read",
+	[WT_LOW_ACCESS] = "low_access",
+	[WT_ERROR] = "error",
+	[WT_ABORT] = "abort",
+	[WT_QUEUE_WRITE] = "queue_write",
+	[WT_QUEUE_READ] = "queue_read",
+	[WT_FLUSH] = "flush",
+	[WT_AP_READ] = "ap_read",
+	[WT_AP_WRITE] = "ap_write",
+	[WT_MEM_READ] = "mem_read",
+	[WT_MEM_WRITE] = "mem_write_sized",
+	[WT_MEM_WAIT32] = "mem_wait32",
+	[WT_MEM_CRC32] = "mem_crc32",
+	[WT_SEQUENCE] = "sequence",
+	[WT_AP_SETUP] = "ap_setup",
+	[WT_AP_CLEANUP] = "ap_cleanup",
+	[WT_AP_REGS_READ] = "ap_regs_read",
+	[WT_AP_REG_READ] = "ap_reg_read",
+	[WT_AP_REG_WRITE] = "ap_reg_write",
+};
+
+/* Which of the optional accessors a DP had, so the replay takes the same paths */
+#define WT_DP_DPIDR        (1U << 0U)
+#define WT_DP_QUEUE        (1U << 1U)
+#define WT_DP_MEM_CRC32    (1U << 2U)
+#define WT_DP_AP_SETUP     (1U << 3U)
+#define WT_DP_AP_CLEANUP   (1U << 4U)
+#define WT_DP_AP_REGS_READ (1U << 5U)
+#define WT_DP_AP_REG_READ  (1U << 6U)
+#define WT_DP_AP_REG_WRITE (1U << 7U)
+
+typedef struct wiretrace_dp_s {
+	ADIv5_DP_t *dp;
+	uint8_t index;
+	/* The accessors as the probe back end set them up, recording only */
+	ADIv5_DP_t probe;
+	/* Results of the queued reads since the last flush */
+	uint32_t **queued;
+	size_t queued_count;
+	size_t queued_size;
+} wiretrace_dp_t;
+
+static wiretrace_dp_t *wiretrace_dps;
+static size_t wiretrace_dp_count;
+static uint32_t wiretrace_records;
+static uint32_t wiretrace_start;
+
+static FILE *record_file;
+/* Nesting of the accesses being recorded, only the outermost is written */
+static unsigned int record_depth;
+
+static uint8_t *replay_data;
+static size_t replay_size;
+static size_t replay_pos;
+static uint8_t replay_fault;
+static uint8_t replay_exception;
+static char replay_message[256];
+
+static wiretrace_dp_t *wiretrace_slot(const ADIv5_DP_t *const dp)
+{
+	for (size_t i = 0; i < wiretrace_dp_count; ++i) {
+		if (wiretrace_dps[i].dp == dp)
+			return &wiretrace_dps[i];
+	}
+	return NULL;
+}
+
+/* The AP setup and cleanup calls do not name their DP, they belong to the one being scanned */
+static wiretrace_dp_t *wiretrace_last_slot(void)
+{
+	return &wiretrace_dps[wiretrace_dp_count - 1U];
+}
+
+static wiretrace_dp_t *wiretrace_add_slot(ADIv5_DP_t *const dp, const uint8_t index)
+{
+	/* A DP freed since may have left its slot to one allocated at the same address */
+	wiretrace_dp_t *slot = wiretrace_slot(dp);
+	if (!slot) {
+		wiretrace_dp_t *const dps = realloc(wiretrace_dps, (wiretrace_dp_count + 1U) * sizeof(*dps));
+		if (!dps) { /* realloc failed: heap exhaustion */
+			DEBUG_WARN("realloc: failed in %s\n", __func__);
+			exit(-1);
+		}
+		wiretrace_dps = dps;
+		slot = &wiretrace_dps[wiretrace_dp_count++];
+		slot->queued = NULL;
+		slot->queued_size = 0;
+	}
+	slot->dp = dp;
+	slot->index = index;
+	slot->queued_count = 0;
+	return slot;
+}
+
+static void wiretrace_queue_result(wiretrace_dp_t *const slot, uint32_t *const value)
+{
+	if (slot->queued_count == slot->queued_size) {
+		const size_t size = slot->queued_size ? slot->queued_size * 2U : 64U;
+		uint32_t **const queued = realloc(slot->queued, size * sizeof(*queued));
+		if (!queued) { /* realloc failed: heap exhaustion */
+			DEBUG_WARN("realloc: failed in %s\n", __func__);
+			exit(-1);
+		}
+		slot->queued = queued;
+		slot->queued_size = size;
+	}
+	slot->queued[slot->queued_count++] = value;
+}
+
+static void record_bytes(const void *const data, const size_t len)
+{
+	if (len && fwrite(data, 1, len, record_file) != len) {
+		DEBUG_WARN("Writing the wire trace failed\n");
+		exit(-1);
+	}
+}
+
+static void record_u8(const uint8_t value)
+{
+	record_bytes(&value, 1);
+}
+
+static void record_u16(const uint16_t value)
+{
+	const uint8_t data[2] = {value & 0xffU, value >> 8U};
+	record_bytes(data, sizeof(data));
+}
+
+static void record_u32(const uint32_t value)
+{
+	const uint8_t data[4] = {value & 0xffU, (value >> 8U) & 0xffU, (value >> 16U) & 0xffU, value >> 24U};
+	record_bytes(data, sizeof(data));
+}
+
+static void record_string(const char *const str)
+{
+	const size_t len = str ? MIN(strlen(str), 255U) : 0U;
+	record_u8(len);
+	record_bytes(str, len);
+}
+
+static void record_begin(const wiretrace_op_t op, const wiretrace_dp_t *const slot, const uint32_t exception)
+{
+	record_u8(op);
+	record_u8(slot->index);
+	record_u8(slot->dp->fault);
+	record_u8(exception);
+	++wiretrace_records;
+}
+
+/* Writes the message of the exception the access raised, if any, and passes it on */
+static void record_end(volatile struct exception *const e)
+{
+	if (!e->type)
+		return;
+	record_string(e->msg);
+	raise_exception(e->type, e->msg);
+}
+
+static uint32_t record_dp_read(ADIv5_DP_t *dp, uint16_t addr)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(dp);
+	if (record_depth)
+		return slot->probe.dp_read(dp, addr);
+	volatile uint32_t value = 0;
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		value = slot->probe.dp_read(dp, addr);
+	}
+	--record_depth;
+	record_begin(WT_DP_READ, slot, e.type);
+	record_u16(addr);
+	record_u32(value);
+	record_end(&e);
+	return value;
+}
+
+static uint32_t record_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(dp);
+	if (record_depth)
+		return slot->probe.low_access(dp, RnW, addr, value);
+	volatile uint32_t result = 0;
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = slot->probe.low_access(dp, RnW, addr, value);
+	}
+	--record_depth;
+	record_begin(WT_LOW_ACCESS, slot, e.type);
+	record_u8(RnW);
+	record_u16(addr);
+	record_u32(value);
+	record_u32(result);
+	record_end(&e);
+	return result;
+}
+
+static uint32_t record_error(ADIv5_DP_t *dp)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(dp);
+	if (record_depth)
+		return slot->probe.error(dp);
+	volatile uint32_t result = 0;
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = slot->probe.error(dp);
+	}
+	--record_depth;
+	record_begin(WT_ERROR, slot, e.type);
+	record_u32(result);
+	record_end(&e);
+	return result;
+}
+
+static void record_abort(ADIv5_DP_t *dp, uint32_t abort)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(dp);
+	if (record_depth) {
+		slot->probe.abort(dp, abort);
+		return;
+	}
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		slot->probe.abort(dp, abort);
+	}
+	--record_depth;
+	record_begin(WT_ABORT, slot, e.type);
+	record_u32(abort);
+	record_end(&e);
+}
+
+static void record_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(dp);
+	if (record_depth) {
+		slot->probe.queue_write(dp, addr, value);
+		return;
+	}
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		slot->probe.queue_write(dp, addr, value);
+	}
+	--record_depth;
+	record_begin(WT_QUEUE_WRITE, slot, e.type);
+	record_u16(addr);
+	record_u32(value);
+	record_end(&e);
+}
+
+static void record_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value)
+{
+	wiretrace_dp_t *const slot = wiretrace_slot(dp);
+	if (record_depth) {
+		slot->probe.queue_read(dp, addr, value);
+		return;
+	}
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		slot->probe.queue_read(dp, addr, value);
+	}
+	--record_depth;
+	/* The value is only known after the flush, which records it */
+	if (!e.type)
+		wiretrace_queue_result(slot, value);
+	record_begin(WT_QUEUE_READ, slot, e.type);
+	record_u16(addr);
+	record_end(&e);
+}
+
+static bool record_flush(ADIv5_DP_t *dp)
+{
+	wiretrace_dp_t *const slot = wiretrace_slot(dp);
+	if (record_depth)
+		return slot->probe.flush(dp);
+	volatile bool result = false;
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = slot->probe.flush(dp);
+	}
+	--record_depth;
+	record_begin(WT_FLUSH, slot, e.type);
+	record_u8(result);
+	record_u32(slot->queued_count);
+	for (size_t i = 0; i < slot->queued_count; ++i)
+		record_u32(*slot->queued[i]);
+	slot->queued_count = 0;
+	record_end(&e);
+	return result;
+}
+
+static uint32_t record_ap_read(ADIv5_AP_t *ap, uint16_t addr)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(ap->dp);
+	if (record_depth)
+		return slot->probe.ap_read(ap, addr);
+	volatile uint32_t value = 0;
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		value = slot->probe.ap_read(ap, addr);
+	}
+	--record_depth;
+	record_begin(WT_AP_READ, slot, e.type);
+	record_u8(ap->apsel);
+	record_u16(addr);
+	record_u32(value);
+	record_end(&e);
+	return value;
+}
+
+static void record_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(ap->dp);
+	if (record_depth) {
+		slot->probe.ap_write(ap, addr, value);
+		return;
+	}
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		slot->probe.ap_write(ap, addr, value);
+	}
+	--record_depth;
+	record_begin(WT_AP_WRITE, slot, e.type);
+	record_u8(ap->apsel);
+	record_u16(addr);
+	record_u32(value);
+	record_end(&e);
+}
+
+static void record_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(ap->dp);
+	if (record_depth) {
+		slot->probe.mem_read(ap, dest, src, len);
+		return;
+	}
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		slot->probe.mem_read(ap, dest, src, len);
+	}
+	--record_depth;
+	record_begin(WT_MEM_READ, slot, e.type);
+	record_u8(ap->apsel);
+	record_u32(src);
+	record_u32(len);
+	record_bytes(dest, len);
+	record_end(&e);
+}
+
+static void record_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(ap->dp);
+	if (record_depth) {
+		slot->probe.mem_write_sized(ap, dest, src, len, align);
+		return;
+	}
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		slot->probe.mem_write_sized(ap, dest, src, len, align);
+	}
+	--record_depth;
+	record_begin(WT_MEM_WRITE, slot, e.type);
+	record_u8(ap->apsel);
+	record_u8(align);
+	record_u32(dest);
+	record_u32(len);
+	record_bytes(src, len);
+	record_end(&e);
+}
+
+static uint32_t record_mem_wait32(
+	ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t busy_value, uint32_t timeout_ms)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(ap->dp);
+	if (record_depth)
+		return slot->probe.mem_wait32(ap, addr, mask, busy_value, timeout_ms);
+	volatile uint32_t value = 0;
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		value = slot->probe.mem_wait32(ap, addr, mask, busy_value, timeout_ms);
+	}
+	--record_depth;
+	record_begin(WT_MEM_WAIT32, slot, e.type);
+	record_u8(ap->apsel);
+	record_u32(addr);
+	record_u32(mask);
+	record_u32(busy_value);
+	record_u32(timeout_ms);
+	record_u32(value);
+	record_end(&e);
+	return value;
+}
+
+static int record_mem_crc32(ADIv5_AP_t *ap, uint32_t *crc, uint32_t addr, size_t len)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(ap->dp);
+	if (record_depth)
+		return slot->probe.mem_crc32(ap, crc, addr, len);
+	volatile int result = -1;
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = slot->probe.mem_crc32(ap, crc, addr, len);
+	}
+	--record_depth;
+	record_begin(WT_MEM_CRC32, slot, e.type);
+	record_u8(ap->apsel);
+	record_u32(addr);
+	record_u32(len);
+	record_u32(result);
+	record_u32(*crc);
+	record_end(&e);
+	return result;
+}
+
+static bool record_sequence(ADIv5_AP_t *ap, adiv5_seq_op_t *ops, size_t count)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(ap->dp);
+	if (record_depth)
+		return slot->probe.sequence(ap, ops, count);
+	volatile bool result = false;
+	volatile struct exception e;
+	/* The steps are recorded as they were asked for, the values they end up with follow */
+	record_begin(WT_SEQUENCE, slot, 0);
+	record_u8(ap->apsel);
+	record_u32(count);
+	for (size_t i = 0; i < count; ++i) {
+		record_u8(ops[i].type);
+		record_u32(ops[i].addr);
+		record_u32(ops[i].value);
+		record_u32(ops[i].mask);
+		record_u32(ops[i].busy_value);
+		record_u32(ops[i].timeout_ms);
+	}
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = slot->probe.sequence(ap, ops, count);
+	}
+	--record_depth;
+	record_u8(slot->dp->fault);
+	record_u8(e.type);
+	record_u8(result);
+	for (size_t i = 0; i < count; ++i)
+		record_u32(ops[i].value);
+	record_end(&e);
+	return result;
+}
+
+static bool record_ap_setup(int i)
+{
+	const wiretrace_dp_t *const slot = wiretrace_last_slot();
+	if (record_depth)
+		return slot->probe.ap_setup(i);
+	volatile bool result = false;
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		result = slot->probe.ap_setup(i);
+	}
+	--record_depth;
+	record_begin(WT_AP_SETUP, slot, e.type);
+	record_u8(i);
+	record_u8(result);
+	record_end(&e);
+	return result;
+}
+
+static void record_ap_cleanup(int i)
+{
+	const wiretrace_dp_t *const slot = wiretrace_last_slot();
+	if (record_depth) {
+		slot->probe.ap_cleanup(i);
+		return;
+	}
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		slot->probe.ap_cleanup(i);
+	}
+	--record_depth;
+	record_begin(WT_AP_CLEANUP, slot, e.type);
+	record_u8(i);
+	record_end(&e);
+}
+
+static void record_ap_regs_read(ADIv5_AP_t *ap, void *data)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(ap->dp);
+	if (record_depth) {
+		slot->probe.ap_regs_read(ap, data);
+		return;
+	}
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		slot->probe.ap_regs_read(ap, data);
+	}
+	--record_depth;
+	record_begin(WT_AP_REGS_READ, slot, e.type);
+	record_u8(ap->apsel);
+	const uint32_t *const regs = data;
+	for (size_t i = 0; i < WIRETRACE_AP_REGS; ++i)
+		record_u32(regs[i]);
+	record_end(&e);
+}
+
+static uint32_t record_ap_reg_read(ADIv5_AP_t *ap, int num)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(ap->dp);
+	if (record_depth)
+		return slot->probe.ap_reg_read(ap, num);
+	volatile uint32_t value = 0;
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		value = slot->probe.ap_reg_read(ap, num);
+	}
+	--record_depth;
+	record_begin(WT_AP_REG_READ, slot, e.type);
+	record_u8(ap->apsel);
+	record_u8(num);
+	record_u32(value);
+	record_end(&e);
+	return value;
+}
+
+static void record_ap_reg_write(ADIv5_AP_t *ap, int num, uint32_t value)
+{
+	const wiretrace_dp_t *const slot = wiretrace_slot(ap->dp);
+	if (record_depth) {
+		slot->probe.ap_reg_write(ap, num, value);
+		return;
+	}
+	volatile struct exception e;
+	++record_depth;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		slot->probe.ap_reg_write(ap, num, value);
+	}
+	--record_depth;
+	record_begin(WT_AP_REG_WRITE, slot, e.type);
+	record_u8(ap->apsel);
+	record_u8(num);
+	record_u32(value);
+	record_end(&e);
+}
+
+static void record_dp(ADIv5_DP_t *const dp)
+{
+	wiretrace_dp_t *const slot = wiretrace_add_slot(dp, wiretrace_dp_count);
+	slot->probe = *dp;
+
+	uint8_t flags = dp->dpidr ? WT_DP_DPIDR : 0U;
+	if (dp->queue_write && dp->queue_read && dp->flush) {
+		flags |= WT_DP_QUEUE;
+		dp->queue_write = record_queue_write;
+		dp->queue_read = record_queue_read;
+		dp->flush = record_flush;
+	}
+	if (dp->mem_crc32) {
+		flags |= WT_DP_MEM_CRC32;
+		dp->mem_crc32 = record_mem_crc32;
+	}
+	if (dp->ap_setup) {
+		flags |= WT_DP_AP_SETUP;
+		dp->ap_setup = record_ap_setup;
+	}
+	if (dp->ap_cleanup) {
+		flags |= WT_DP_AP_CLEANUP;
+		dp->ap_cleanup = record_ap_cleanup;
+	}
+	if (dp->ap_regs_read) {
+		flags |= WT_DP_AP_REGS_READ;
+		dp->ap_regs_read = record_ap_regs_read;
+	}
+	if (dp->ap_reg_read) {
+		flags |= WT_DP_AP_REG_READ;
+		dp->ap_reg_read = record_ap_reg_read;
+	}
+	if (dp->ap_reg_write) {
+		flags |= WT_DP_AP_REG_WRITE;
+		dp->ap_reg_write = record_ap_reg_write;
+	}
+	dp->dp_read = record_dp_read;
+	dp->low_access = record_low_access;
+	dp->error = record_error;
+	dp->abort = record_abort;
+	dp->ap_read = record_ap_read;
+	dp->ap_write = record_ap_write;
+	dp->mem_read = record_mem_read;
+	dp->mem_write_sized = record_mem_write_sized;
+	dp->mem_wait32 = record_mem_wait32;
+	dp->sequence = record_sequence;
+
+	record_begin(WT_DP, slot, 0);
+	record_u8(flags);
+	record_u8(dp->instance);
+	record_u8(dp->dp_jd_index);
+
+	/*
+	 * adiv5_dp_init() identified the DP before it got here, put those
+	 * accesses in the trace for the replay to make them again. TARGETID
+	 * is rebuilt from targetsel, which lacks its revision.
+	 */
+	if (dp->dpidr) {
+		record_begin(WT_DP_READ, slot, 0);
+		record_u16(ADIV5_DP_DPIDR);
+		record_u32(dp->dpidr);
+	}
+	if (dp->version >= 2) {
+		record_begin(WT_LOW_ACCESS, slot, 0);
+		record_u8(ADIV5_LOW_WRITE);
+		record_u16(ADIV5_DP_SELECT);
+		record_u32(2);
+		record_u32(0);
+		record_begin(WT_DP_READ, slot, 0);
+		record_u16(ADIV5_DP_TARGETID);
+		record_u32((dp->targetsel & (ADIV5_DP_TARGETID_TDESIGNER_MASK | ADIV5_DP_TARGETID_TPARTNO_MASK)) | 1U);
+		record_begin(WT_LOW_ACCESS, slot, 0);
+		record_u8(ADIV5_LOW_WRITE);
+		record_u16(ADIV5_DP_SELECT);
+		record_u32(0);
+		record_u32(0);
+	}
+}
+
+bool wiretrace_record_open(const char *const path)
+{
+	record_file = fopen(path, "wb");
+	if (!record_file) {
+		DEBUG_WARN("Can not create wire trace %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	setvbuf(record_file, NULL, _IOFBF, 1U << 20U);
+	record_bytes(WIRETRACE_MAGIC, 4);
+	record_u8(WIRETRACE_VERSION);
+	record_string(info.manufacturer);
+	record_string(info.product);
+	record_string(info.version);
+	wiretrace_start = platform_time_ms();
+	DEBUG_INFO("Recording wire trace to %s\n", path);
+	return true;
+}
+
+static void replay_diverged(const char *const what)
+{
+	DEBUG_WARN("Wire trace diverges at record %" PRIu32 ": %s\n", wiretrace_records, what);
+	exit(-1);
+}
+
+static const uint8_t *replay_bytes(const size_t len)
+{
+	if (replay_size - replay_pos < len) {
+		DEBUG_WARN("Wire trace truncated in record %" PRIu32 "\n", wiretrace_records);
+		exit(-1);
+	}
+	const uint8_t *const data = replay_data + replay_pos;
+	replay_pos += len;
+	return data;
+}
+
+static uint8_t replay_u8(void)
+{
+	return *replay_bytes(1);
+}
+
+static uint16_t replay_u16(void)
+{
+	const uint8_t *const data = replay_bytes(2);
+	return data[0] | data[1] << 8U;
+}
+
+static uint32_t replay_u32(void)
+{
+	const uint8_t *const data = replay_bytes(4);
+	return data[0] | data[1] << 8U | data[2] << 16U | (uint32_t)data[3] << 24U;
+}
+
+static void replay_string(char *const str, const size_t size)
+{
+	const size_t len = replay_u8();
+	const uint8_t *const data = replay_bytes(len);
+	const size_t copy = MIN(len, size - 1U);
+	memcpy(str, data, copy);
+	str[copy] = '\0';
+}
+
+static void replay_check(const bool match, const char *const what)
+{
+	if (!match)
+		replay_diverged(what);
+}
+
+static void replay_begin(const wiretrace_op_t op, const wiretrace_dp_t *const slot)
+{
+	if (replay_pos == replay_size) {
+		DEBUG_WARN("End of wire trace after %" PRIu32 " records\n", wiretrace_records);
+		exit(0);
+	}
+	const uint8_t recorded = replay_u8();
+	if (recorded != op) {
+		char what[64];
+		snprintf(what, sizeof(what), "%s instead of %s", wiretrace_op_names[op],
+			recorded < WT_OP_COUNT && wiretrace_op_names[recorded] ? wiretrace_op_names[recorded] : "garbage");
+		replay_diverged(what);
+	}
+	const uint8_t index = replay_u8();
+	replay_check(!slot || index == slot->index, "access to another DP");
+	replay_fault = replay_u8();
+	replay_exception = replay_u8();
+	++wiretrace_records;
+}
+
+static void replay_end(ADIv5_DP_t *const dp)
+{
+	dp->fault = replay_fault;
+	if (!replay_exception)
+		return;
+	replay_string(replay_message, sizeof(replay_message));
+	raise_exception(replay_exception, replay_message);
+}
+
+static uint32_t replay_dp_read(ADIv5_DP_t *dp, uint16_t addr)
+{
+	replay_begin(WT_DP_READ, wiretrace_slot(dp));
+	replay_check(replay_u16() == addr, "DP read address");
+	const uint32_t value = replay_u32();
+	replay_end(dp);
+	return value;
+}
+
+static uint32_t replay_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value)
+{
+	replay_begin(WT_LOW_ACCESS, wiretrace_slot(dp));
+	replay_check(replay_u8() == RnW, "low access direction");
+	replay_check(replay_u16() == addr, "low access address");
+	const uint32_t recorded = replay_u32();
+	replay_check(RnW == ADIV5_LOW_READ || recorded == value, "low access write value");
+	const uint32_t result = replay_u32();
+	replay_end(dp);
+	return result;
+}
+
+static uint32_t replay_error(ADIv5_DP_t *dp)
+{
+	replay_begin(WT_ERROR, wiretrace_slot(dp));
+	const uint32_t result = replay_u32();
+	replay_end(dp);
+	return result;
+}
+
+static void replay_abort(ADIv5_DP_t *dp, uint32_t abort)
+{
+	replay_begin(WT_ABORT, wiretrace_slot(dp));
+	replay_check(replay_u32() == abort, "abort value");
+	replay_end(dp);
+}
+
+static void replay_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
+{
+	replay_begin(WT_QUEUE_WRITE, wiretrace_slot(dp));
+	replay_check(replay_u16() == addr, "queued write address");
+	replay_check(replay_u32() == value, "queued write value");
+	replay_end(dp);
+}
+
+static void replay_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value)
+{
+	wiretrace_dp_t *const slot = wiretrace_slot(dp);
+	replay_begin(WT_QUEUE_READ, slot);
+	replay_check(replay_u16() == addr, "queued read address");
+	if (!replay_exception)
+		wiretrace_queue_result(slot, value);
+	replay_end(dp);
+}
+
+static bool replay_flush(ADIv5_DP_t *dp)
+{
+	wiretrace_dp_t *const slot = wiretrace_slot(dp);
+	replay_begin(WT_FLUSH, slot);
+	const bool result = replay_u8();
+	replay_check(replay_u32() == slot->queued_count, "number of queued reads");
+	for (size_t i = 0; i < slot->queued_count; ++i)
+		*slot->queued[i] = replay_u32();
+	slot->queued_count = 0;
+	replay_end(dp);
+	return result;
+}
+
+static uint32_t replay_ap_read(ADIv5_AP_t *ap, uint16_t addr)
+{
+	replay_begin(WT_AP_READ, wiretrace_slot(ap->dp));
+	replay_check(replay_u8() == ap->apsel, "AP");
+	replay_check(replay_u16() == addr, "AP read address");
+	const uint32_t value = replay_u32();
+	replay_end(ap->dp);
+	return value;
+}
+
+static void replay_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
+{
+	replay_begin(WT_AP_WRITE, wiretrace_slot(ap->dp));
+	replay_check(replay_u8() == ap->apsel, "AP");
+	replay_check(replay_u16() == addr, "AP write address");
+	replay_check(replay_u32() == value, "AP write value");
+	replay_end(ap->dp);
+}
+
+static void replay_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	replay_begin(WT_MEM_READ, wiretrace_slot(ap->dp));
+	replay_check(replay_u8() == ap->apsel, "AP");
+	replay_check(replay_u32() == src, "memory read address");
+	replay_check(replay_u32() == len, "memory read length");
+	memcpy(dest, replay_bytes(len), len);
+	replay_end(ap->dp);
+}
+
+static void replay_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align)
+{
+	replay_begin(WT_MEM_WRITE, wiretrace_slot(ap->dp));
+	replay_check(replay_u8() == ap->apsel, "AP");
+	replay_check(replay_u8() == align, "memory write alignment");
+	replay_check(replay_u32() == dest, "memory write address");
+	replay_check(replay_u32() == len, "memory write length");
+	replay_check(!memcmp(replay_bytes(len), src, len), "memory write data");
+	replay_end(ap->dp);
+}
+
+static uint32_t replay_mem_wait32(
+	ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t busy_value, uint32_t timeout_ms)
+{
+	replay_begin(WT_MEM_WAIT32, wiretrace_slot(ap->dp));
+	replay_check(replay_u8() == ap->apsel, "AP");
+	replay_check(replay_u32() == addr, "memory wait address");
+	replay_check(replay_u32() == mask, "memory wait mask");
+	replay_check(replay_u32() == busy_value, "memory wait busy value");
+	replay_check(replay_u32() == timeout_ms, "memory wait timeout");
+	const uint32_t value = replay_u32();
+	replay_end(ap->dp);
+	return value;
+}
+
+static int replay_mem_crc32(ADIv5_AP_t *ap, uint32_t *crc, uint32_t addr, size_t len)
+{
+	replay_begin(WT_MEM_CRC32, wiretrace_slot(ap->dp));
+	replay_check(replay_u8() == ap->apsel, "AP");
+	replay_check(replay_u32() == addr, "CRC address");
+	replay_check(replay_u32() == len, "CRC length");
+	const int result = (int)replay_u32();
+	*crc = replay_u32();
+	replay_end(ap->dp);
+	return result;
+}
+
+static bool replay_sequence(ADIv5_AP_t *ap, adiv5_seq_op_t *ops, size_t count)
+{
+	replay_begin(WT_SEQUENCE, wiretrace_slot(ap->dp));
+	replay_check(replay_u8() == ap->apsel, "AP");
+	replay_check(replay_u32() == count, "sequence length");
+	for (size_t i = 0; i < count; ++i) {
+		const adiv5_seq_op_t *const op = &ops[i];
+		replay_check(replay_u8() == op->type, "sequence step type");
+		replay_check(replay_u32() == op->addr, "sequence step address");
+		const uint32_t value = replay_u32();
+		/* Only the writes' values are inputs */
+		replay_check(value == op->value ||
+				(op->type != ADIV5_SEQ_DP_WRITE && op->type != ADIV5_SEQ_AP_WRITE && op->type != ADIV5_SEQ_MEM_WRITE),
+			"sequence step value");
+		replay_check(replay_u32() == op->mask, "sequence step mask");
+		replay_check(replay_u32() == op->busy_value, "sequence step busy value");
+		replay_check(replay_u32() == op->timeout_ms, "sequence step timeout");
+	}
+	replay_fault = replay_u8();
+	replay_exception = replay_u8();
+	const bool result = replay_u8();
+	for (size_t i = 0; i < count; ++i)
+		ops[i].value = replay_u32();
+	replay_end(ap->dp);
+	return result;
+}
+
+static bool replay_ap_setup(int i)
+{
+	const wiretrace_dp_t *const slot = wiretrace_last_slot();
+	replay_begin(WT_AP_SETUP, slot);
+	replay_check(replay_u8() == (uint8_t)i, "AP setup index");
+	const bool result = replay_u8();
+	replay_end(slot->dp);
+	return result;
+}
+
+static void replay_ap_cleanup(int i)
+{
+	const wiretrace_dp_t *const slot = wiretrace_last_slot();
+	replay_begin(WT_AP_CLEANUP, slot);
+	replay_check(replay_u8() == (uint8_t)i, "AP cleanup index");
+	replay_end(slot->dp);
+}
+
+static void replay_ap_regs_read(ADIv5_AP_t *ap, void *data)
+{
+	replay_begin(WT_AP_REGS_READ, wiretrace_slot(ap->dp));
+	replay_check(replay_u8() == ap->apsel, "AP");
+	uint32_t *const regs = data;
+	for (size_t i = 0; i < WIRETRACE_AP_REGS; ++i)
+		regs[i] = replay_u32();
+	replay_end(ap->dp);
+}
+
+static uint32_t replay_ap_reg_read(ADIv5_AP_t *ap, int num)
+{
+	replay_begin(WT_AP_REG_READ, wiretrace_slot(ap->dp));
+	replay_check(replay_u8() == ap->apsel, "AP");
+	replay_check(replay_u8() == (uint8_t)num, "register number");
+	const uint32_t value = replay_u32();
+	replay_end(ap->dp);
+	return value;
+}
+
+static void replay_ap_reg_write(ADIv5_AP_t *ap, int num, uint32_t value)
+{
+	replay_begin(WT_AP_REG_WRITE, wiretrace_slot(ap->dp));
+	replay_check(replay_u8() == ap->apsel, "AP");
+	replay_check(replay_u8() == (uint8_t)num, "register number");
+	replay_check(replay_u32() == value, "register value");
+	replay_end(ap->dp);
+}
+
+bool wiretrace_replay_open(const char *const path, bmp_info_t *const info)
+{
+	FILE *const file = fopen(path, "rb");
+	if (!file) {
+		DEBUG_WARN("Can not open wire trace %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	/* The whole trace is read up front, so replaying does no file I/O */
+	bool result = false;
+	long size = -1;
+	if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+		replay_size = size;
+		replay_data = malloc(replay_size ? replay_size : 1U);
+		result = replay_data && fread(replay_data, 1, replay_size, file) == replay_size;
+	}
+	fclose(file);
+	if (!result) {
+		DEBUG_WARN("Can not read wire trace %s\n", path);
+		return false;
+	}
+
+	if (replay_size < 5U || memcmp(replay_data, WIRETRACE_MAGIC, 4) || replay_data[4] != WIRETRACE_VERSION) {
+		DEBUG_WARN("%s is not a version %u wire trace\n", path, WIRETRACE_VERSION);
+		return false;
+	}
+	replay_pos = 5U;
+	replay_string(info->manufacturer, sizeof(info->manufacturer));
+	replay_string(info->product, sizeof(info->product));
+	replay_string(info->version, sizeof(info->version));
+	info->bmp_type = BMP_TYPE_REPLAY;
+	wiretrace_start = platform_time_ms();
+	DEBUG_INFO("Replaying wire trace of %s %s, %s\n", info->manufacturer, info->product, info->version);
+	return true;
+}
+
+uint32_t wiretrace_replay_scan(void)
+{
+	target_list_free();
+	/* adiv5_dp_init() on one DP uses up its records, up to the next DP's */
+	while (replay_pos < replay_size && replay_data[replay_pos] == WT_DP) {
+		/* The DP record is never faulted and raises nothing */
+		replay_bytes(1);
+		const uint8_t index = replay_u8();
+		replay_bytes(2);
+		++wiretrace_records;
+		const uint8_t flags = replay_u8();
+
+		ADIv5_DP_t *dp = calloc(1, sizeof(*dp));
+		if (!dp) { /* calloc failed: heap exhaustion */
+			DEBUG_WARN("calloc: failed in %s\n", __func__);
+			break;
+		}
+		dp->instance = replay_u8();
+		dp->dp_jd_index = replay_u8();
+		dp->dp_read = replay_dp_read;
+		dp->low_access = replay_low_access;
+		dp->error = replay_error;
+		dp->abort = replay_abort;
+		dp->ap_read = replay_ap_read;
+		dp->ap_write = replay_ap_write;
+		dp->mem_read = replay_mem_read;
+		dp->mem_write_sized = replay_mem_write_sized;
+		dp->mem_wait32 = replay_mem_wait32;
+		dp->sequence = replay_sequence;
+		if (flags & WT_DP_QUEUE) {
+			dp->queue_write = replay_queue_write;
+			dp->queue_read = replay_queue_read;
+			dp->flush = replay_flush;
+		}
+		if (flags & WT_DP_MEM_CRC32)
+			dp->mem_crc32 = replay_mem_crc32;
+		if (flags & WT_DP_AP_SETUP)
+			dp->ap_setup = replay_ap_setup;
+		if (flags & WT_DP_AP_CLEANUP)
+			dp->ap_cleanup = replay_ap_cleanup;
+		if (flags & WT_DP_AP_REGS_READ)
+			dp->ap_regs_read = replay_ap_regs_read;
+		if (flags & WT_DP_AP_REG_READ)
+			dp->ap_reg_read = replay_ap_reg_read;
+		if (flags & WT_DP_AP_REG_WRITE)
+			dp->ap_reg_write = replay_ap_reg_write;
+		wiretrace_add_slot(dp, index);
+
+		/* Without the DPIDR read the recording DP was a JTAG DPv0 */
+		adiv5_dp_init(dp, (flags & WT_DP_DPIDR) ? 0U : JTAG_IDCODE_ARM_DPv0);
+	}
+	return target_list ? 1U : 0U;
+}
+
+void wiretrace_dp_ready(ADIv5_DP_t *const dp)
+{
+	if (record_file)
+		record_dp(dp);
+}
+
+void wiretrace_close(void)
+{
+	const uint32_t elapsed = platform_time_ms() - wiretrace_start;
+	if (record_file) {
+		DEBUG_INFO("Recorded %" PRIu32 " wire trace records in %" PRIu32 " ms\n", wiretrace_records, elapsed);
+		fclose(record_file);
+		record_file = NULL;
+	}
+	if (replay_data) {
+		DEBUG_INFO("Replayed %" PRIu32 " wire trace records in %" PRIu32 " ms\n", wiretrace_records, elapsed);
+		free(replay_data);
+		replay_data = NULL;
+	}
+}
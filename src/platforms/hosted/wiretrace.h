@@ -0,0 +1,36 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Binary trace of the accesses made through the ADIv5 DP accessors, and
+ * a replay back end serving the recorded responses without a probe.
+ */
+#ifndef __WIRETRACE_H
+#define __WIRETRACE_H
+
+#include "adiv5.h"
+#include "bmp_hosted.h"
+
+bool wiretrace_record_open(const char *path);
+bool wiretrace_replay_open(const char *path, bmp_info_t *info);
+void wiretrace_close(void);
+
+/* Called once adiv5_dp_init() has settled on a DP's accessors */
+void wiretrace_dp_ready(ADIv5_DP_t *dp);
+/* Stands in for the SWD and JTAG scans while replaying */
+uint32_t wiretrace_replay_scan(void);
+
+#endif /* __WIRETRACE_H */
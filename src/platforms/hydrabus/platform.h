@@ -35,6 +35,9 @@
 #define PLATFORM_HAS_TRACESWO
 #define PLATFORM_IDENT        " (HydraBus))"
 
+/* The F4 has plenty of RAM to spare, so use a larger GDB packet buffer */
+#define GDB_PACKET_BUFFER_SIZE 4096U
+
 /* Important pin mappings for STM32 implementation:
  *
  * LED0 = 	PA4	(Green LED : Running)
@@ -23,6 +23,8 @@
 #include <libopencm3/lm4f/nvic.h>
 #include <libopencm3/lm4f/uart.h>
 #include <libopencm3/cm3/systick.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/cortex.h>
 #include <libopencm3/lm4f/usb.h>
 
 #define PLL_DIV_80MHZ	5
@@ -48,6 +50,20 @@ uint32_t platform_time_ms(void)
 	return time_ms;
 }
 
+/* As on the STM32 probes, the tick count plus how far SysTick is into the next tick */
+uint32_t platform_time_us(void)
+{
+	CM_ATOMIC_CONTEXT();
+	uint32_t ms = time_ms;
+	uint32_t count = systick_get_value();
+	if (SCB_ICSR & SCB_ICSR_PENDSTSET) {
+		ms += SYSTICKMS;
+		count = systick_get_value();
+	}
+	const uint32_t elapsed = systick_get_reload() - count;
+	return ms * 1000U + (elapsed * 8U) / (rcc_get_system_clock_frequency() / 1000000U);
+}
+
 void platform_init(void)
 {
 	for (int i = 0; i < 1000000; ++i)
@@ -28,6 +28,12 @@
 extern uint8_t running_status;
 extern uint32_t swd_delay_cnt;
 
+static inline void platform_clock_delay(void)
+{
+	for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
+		continue;
+}
+
 #define TMS_PORT	GPIOA_BASE
 #define TMS_PIN		GPIO3
 
@@ -31,6 +31,12 @@
 #define PLATFORM_HAS_TRACESWO
 #define PLATFORM_HAS_POWER_SWITCH
 #define PLATFORM_HAS_USBUART
+#define PLATFORM_HAS_REMOTE_IF
+#define PLATFORM_HAS_CACHE
+
+/* The last Flash page is kept out of the firmware for platform_cache_write(), see blackmagic.ld */
+#define PLATFORM_CACHE_PAGE      0x0801fc00U
+#define PLATFORM_CACHE_PAGE_SIZE 1024U
 
 #ifdef ENABLE_DEBUG
 # define PLATFORM_HAS_DEBUG
@@ -125,6 +131,10 @@ extern bool debug_bmp;
 #define SWDIO_DIR_PIN	TMS_DIR_PIN
 #define SWDIO_PIN	TMS_PIN
 #define SWCLK_PIN	TCK_PIN
+/* SWDIO and SWCLK share a port, swdptap.c can update both in one BSRR write */
+#define SWDPTAP_SINGLE_PORT
+/* Likewise TDI and TCK for jtagtap.c */
+#define JTAGTAP_SINGLE_PORT
 
 #define TRST_PORT	GPIOB
 #define TRST_PIN	GPIO1
@@ -272,6 +282,16 @@ extern bool debug_bmp;
 #define TRACE_TIM_CLK_EN() rcc_periph_clock_enable(RCC_TIM3)
 #define TRACE_IRQ   NVIC_TIM3_IRQ
 #define TRACE_ISR(x)  tim3_isr(x)
+/* TIM3_CH1 requests DMA1 channel 6, which the second UART takes from hardware 6 on */
+#define TRACE_DMA_BUS DMA1
+#define TRACE_DMA_CLK RCC_DMA1
+#define TRACE_DMA_CHAN DMA_CHANNEL6
+#define TRACE_DMA_USABLE() (platform_hwversion() < 6)
+
+/* Memory to memory DMA feeding the CRC unit in generic_crc32() */
+#define CRC_DMA_BUS  DMA1
+#define CRC_DMA_CLK  RCC_DMA1
+#define CRC_DMA_CHAN DMA_CHANNEL1
 
 #define SET_RUN_STATE(state)	{running_status = (state);}
 #define SET_IDLE_STATE(state)	{gpio_set_val(LED_PORT, LED_IDLE_RUN, state);}
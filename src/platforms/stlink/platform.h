@@ -66,7 +66,6 @@ extern bool debug_bmp;
 #define LED_UART	GPIO9
 
 #define PLATFORM_HAS_TRACESWO	1
-#define NUM_TRACE_PACKETS		(128)		/* This is an 8K buffer */
 #define TRACESWO_PROTOCOL		2			/* 1 = Manchester, 2 = NRZ / async */
 
 # define SWD_CR   GPIO_CRH(SWDIO_PORT)
@@ -147,6 +146,20 @@ extern bool debug_bmp;
 #define SWO_DMA_IRQ				NVIC_DMA1_CHANNEL5_IRQ
 #define SWO_DMA_ISR(x)			dma1_channel5_isr(x)
 
+/* Memory to memory DMA feeding the CRC unit in generic_crc32() */
+#define CRC_DMA_BUS  DMA1
+#define CRC_DMA_CLK  RCC_DMA1
+#define CRC_DMA_CHAN DMA_CHANNEL1
+
+/* PA10 is TIM1_CH3 too, its captures time the line to measure the baud rate */
+#define SWO_TIM					TIM1
+#define SWO_TIM_CLK_EN()		rcc_periph_clock_enable(RCC_TIM1)
+#define SWO_TIM_IC				TIM_IC3
+#define SWO_TIM_IC_IN			TIM_IC_IN_TI3
+#define SWO_TIM_CCR				TIM_CCR3(TIM1)
+#define SWO_TIM_SR_CCIF			TIM_SR_CC3IF
+#define SWO_TIM_SR_CCOF			TIM_SR_CC3OF
+
 extern uint16_t led_idle_run;
 #define LED_IDLE_RUN            led_idle_run
 #define SET_RUN_STATE(state)	{running_status = (state);}
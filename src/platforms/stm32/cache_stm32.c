@@ -0,0 +1,78 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file keeps the platform_cache_*() blobs in the last Flash page on
+ * STM32F1 platforms. The page holds one blob, which is all the firmware
+ * has a use for, so writing a blob of another name replaces it.
+ */
+
+#include "general.h"
+
+#ifdef PLATFORM_HAS_CACHE
+#include <libopencm3/stm32/flash.h>
+
+typedef struct cache_header {
+	uint32_t name_hash;
+	uint32_t len;
+} cache_header_s;
+
+#define CACHE_MAX_LEN (PLATFORM_CACHE_PAGE_SIZE - sizeof(cache_header_s))
+
+/* FNV-1a, an erased page doesn't match any name in use */
+static uint32_t cache_name_hash(const char *name)
+{
+	uint32_t hash = 2166136261U;
+	for (; *name; ++name)
+		hash = (hash ^ (uint8_t)*name) * 16777619U;
+	return hash;
+}
+
+bool platform_cache_read(const char *const name, void *const data, const size_t len)
+{
+	const cache_header_s *const header = (const cache_header_s *)PLATFORM_CACHE_PAGE;
+	if (len > CACHE_MAX_LEN || header->name_hash != cache_name_hash(name) || header->len != len)
+		return false;
+	memcpy(data, header + 1, len);
+	return true;
+}
+
+static void cache_program(const uint32_t addr, const void *const data, const size_t len)
+{
+	const uint8_t *const bytes = (const uint8_t *)data;
+	for (size_t i = 0; i < len; i += 2U) {
+		uint16_t half_word = bytes[i];
+		half_word |= i + 1U < len ? bytes[i + 1U] << 8U : 0xff00U;
+		flash_program_half_word(addr + i, half_word);
+	}
+}
+
+void platform_cache_write(const char *const name, const void *const data, const size_t len)
+{
+	if (len > CACHE_MAX_LEN)
+		return;
+	/* Spare the page an erase cycle when nothing changed */
+	const cache_header_s header = {cache_name_hash(name), len};
+	if (!memcmp((const void *)PLATFORM_CACHE_PAGE, &header, sizeof(header)) &&
+		!memcmp((const cache_header_s *)PLATFORM_CACHE_PAGE + 1, data, len))
+		return;
+	flash_unlock();
+	flash_erase_page(PLATFORM_CACHE_PAGE);
+	cache_program(PLATFORM_CACHE_PAGE, &header, sizeof(header));
+	cache_program(PLATFORM_CACHE_PAGE + sizeof(header), data, len);
+	flash_lock();
+}
+#endif
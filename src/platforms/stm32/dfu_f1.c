@@ -54,12 +54,18 @@ void dfu_flash_program_buffer(uint32_t baseaddr, void *buf, int len)
 	dfu_event();
 }
 
-uint32_t dfu_poll_timeout(uint8_t cmd, uint32_t addr, uint16_t blocknum)
+/* Typical page erase and half word programming times, RM0008 and the datasheets */
+#define FLASH_ERASE_MS      20U
+#define FLASH_HALF_WORD_US  52U
+
+uint32_t dfu_poll_timeout(uint8_t cmd, uint32_t addr, uint16_t blocknum, uint16_t len)
 {
-	(void)cmd;
 	(void)addr;
-	(void)blocknum;
-	return 100;
+	/* A host that asks early is held off until the flash is done, so
+	 * short is fine while too long costs each block the difference */
+	if (blocknum == 0)
+		return cmd == CMD_ERASE ? FLASH_ERASE_MS : 0;
+	return (len / 2U * FLASH_HALF_WORD_US + 999U) / 1000U;
 }
 
 void dfu_protect(bool enable)
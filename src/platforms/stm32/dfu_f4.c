@@ -29,10 +29,11 @@ static uint32_t sector_addr[] = {
 	0x8080000, 0x80a0000, 0x80c0000, 0x80e0000,
 	0x8100000, 0
 };
+/* Typical sector erase times at x32 parallelism, the maximum is twice that */
 static uint16_t sector_erase_time[12]= {
-	500, 500, 500, 500,
-	1100, 2600, 2600, 2600,
-	2600, 2600, 2600, 2600
+	250, 250, 250, 250,
+	550, 1000, 1000, 1000,
+	1000, 1000, 1000, 1000
 };
 static uint8_t sector_num = 0xff;
 
@@ -63,18 +64,24 @@ void dfu_flash_program_buffer(uint32_t baseaddr, void *buf, int len)
 		flash_program_word(baseaddr + i, *(uint32_t*)(buf+i));
 }
 
-uint32_t dfu_poll_timeout(uint8_t cmd, uint32_t addr, uint16_t blocknum)
+/* Typical word programming time at x32 parallelism */
+#define FLASH_WORD_US 16U
+
+uint32_t dfu_poll_timeout(uint8_t cmd, uint32_t addr, uint16_t blocknum, uint16_t len)
 {
 	/* Erase for big pages on STM2/4 needs "long" time
-	   Try not to hit USB timeouts*/
+	   Try not to hit USB timeouts. A host that asks early is
+	   held off until the flash is done, so typical times do */
 	if ((blocknum == 0) && (cmd == CMD_ERASE)) {
 		get_sector_num(addr);
 		if(addr == sector_addr[sector_num])
 			return sector_erase_time[sector_num];
 	}
+	if (blocknum == 0)
+		return 0;
 
-	/* Programming 256 word with 100 us(max) per word*/
-	return 26;
+	/* Words are programmed one at a time, x64 would need an external Vpp */
+	return (len / 4U * FLASH_WORD_US + 999U) / 1000U;
 }
 
 void dfu_protect(bool enable)
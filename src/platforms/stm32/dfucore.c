@@ -45,9 +45,20 @@
 
 #include "usbdfu.h"
 
+/*
+ * Blocks are as large as the control buffer, which takes a whole block: the
+ * fewer of them, the fewer status round trips an upgrade costs. The F1s have
+ * less RAM to spare.
+ */
+#if defined(STM32F4) || defined(STM32F7)
+#define DFU_TRANSFER_SIZE 4096U
+#else
+#define DFU_TRANSFER_SIZE 2048U
+#endif
+
 usbd_device *usbdev;
 /* We need a special large control buffer for this device: */
-uint8_t usbd_control_buffer[1024];
+uint8_t usbd_control_buffer[DFU_TRANSFER_SIZE];
 
 static uint32_t max_address;
 
@@ -60,6 +71,8 @@ static struct {
 	uint16_t len;
 	uint32_t addr;
 	uint16_t blocknum;
+	/* The last download was a set address only, as DfuSe sends before leaving */
+	bool leave;
 } prog;
 static uint8_t current_error;
 
@@ -83,9 +96,9 @@ const struct usb_device_descriptor dev_desc = {
 const struct usb_dfu_descriptor dfu_function = {
 	.bLength = sizeof(struct usb_dfu_descriptor),
 	.bDescriptorType = DFU_FUNCTIONAL,
-	.bmAttributes = USB_DFU_CAN_DOWNLOAD | USB_DFU_CAN_UPLOAD | USB_DFU_WILL_DETACH,
+	.bmAttributes = USB_DFU_CAN_DOWNLOAD | USB_DFU_CAN_UPLOAD | USB_DFU_WILL_DETACH | USB_DFU_MANIFEST_TOLERANT,
 	.wDetachTimeout = 255,
-	.wTransferSize = 1024,
+	.wTransferSize = DFU_TRANSFER_SIZE,
 	.bcdDFUVersion = 0x011A,
 };
 
@@ -149,12 +162,18 @@ static uint8_t usbdfu_getstatus(uint32_t *bwPollTimeout)
 		usbdfu_state = STATE_DFU_DNBUSY;
 		*bwPollTimeout = dfu_poll_timeout(prog.buf[0],
 					get_le32(prog.buf + 1),
-					prog.blocknum);
+					prog.blocknum, prog.len);
 		return DFU_STATUS_OK;
 
 	case STATE_DFU_MANIFEST_SYNC:
-		/* Device will reset when read is complete */
-		usbdfu_state = STATE_DFU_MANIFEST;
+		if (prog.leave) {
+			/* Device will reset when read is complete */
+			usbdfu_state = STATE_DFU_MANIFEST;
+		} else {
+			/* Manifestation tolerant: the image is in place already,
+			 * the host may go on or detach us when it is done */
+			usbdfu_state = STATE_DFU_IDLE;
+		}
 		return DFU_STATUS_OK;
 	case STATE_DFU_ERROR:
 		return current_error;
@@ -206,6 +225,13 @@ usbdfu_getstatus_complete(usbd_device *dev, struct usb_setup_data *req)
 	}
 }
 
+static void usbdfu_detach_complete(usbd_device *dev, struct usb_setup_data *req)
+{
+	(void)req;
+	(void)dev;
+	dfu_detach();
+}
+
 static enum usbd_request_return_codes usbdfu_control_request(usbd_device *dev,
 		struct usb_setup_data *req, uint8_t **buf, uint16_t *len,
 		void (**complete)(usbd_device *dev, struct usb_setup_data *req))
@@ -225,6 +251,7 @@ static enum usbd_request_return_codes usbdfu_control_request(usbd_device *dev,
 			prog.blocknum = req->wValue;
 			prog.len = *len;
 			memcpy(prog.buf, *buf, *len);
+			prog.leave = (req->wValue == 0) && (prog.buf[0] == CMD_SETADDR);
 			if ((req->wValue == 0) && (prog.buf[0] == CMD_SETADDR)) {
 				uint32_t addr = get_le32(prog.buf + 1);
 				if ((addr < app_address) || (addr >= max_address)) {
@@ -237,6 +264,10 @@ static enum usbd_request_return_codes usbdfu_control_request(usbd_device *dev,
 			usbdfu_state = STATE_DFU_DNLOAD_SYNC;
 			return USBD_REQ_HANDLED;
 		}
+	case DFU_DETACH:
+		/* Being manifestation tolerant, hosts may leave DFU mode with a detach */
+		*complete = usbdfu_detach_complete;
+		return USBD_REQ_HANDLED;
 	case DFU_CLRSTATUS:
 		/* Clear error and return to dfuIDLE */
 		if(usbdfu_state == STATE_DFU_ERROR)
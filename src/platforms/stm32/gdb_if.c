@@ -24,24 +24,78 @@
  */
 
 #include <libopencmsis/core_cm3.h>
+#include <libopencm3/cm3/nvic.h>
 
 #include "general.h"
 #include "usb_serial.h"
 #include "gdb_if.h"
+#ifdef PLATFORM_HAS_REMOTE_IF
+#include "usb_remote.h"
+#endif
+
+/* Number of IN packets that can be queued behind the one on the wire */
+#ifndef GDB_IN_PACKETS
+#define GDB_IN_PACKETS 4U
+#endif
 
 static uint32_t count_out;
-static uint32_t count_in;
 static uint32_t out_ptr;
 static uint8_t buffer_out[CDCACM_PACKET_SIZE];
-static uint8_t buffer_in[CDCACM_PACKET_SIZE];
 #ifdef STM32F4
 static volatile uint32_t count_new;
 static uint8_t double_buffer_out[CDCACM_PACKET_SIZE];
 #endif
 
+/*
+ * IN data is queued as whole USB packets. gdb_if_putchar() fills the slot at
+ * in_head, the USB interrupt transmits from in_tail as each transfer completes.
+ */
+static uint8_t buffer_in[GDB_IN_PACKETS][CDCACM_PACKET_SIZE];
+static uint8_t length_in[GDB_IN_PACKETS];
+static uint32_t count_in;
+static volatile uint32_t in_head;
+static volatile uint32_t in_tail;
+
+/* Must be called from the USB interrupt or with it masked */
+static void gdb_if_send_next(void)
+{
+	if (in_tail == in_head)
+		return;
+	/* usbd_ep_write_packet() refuses while the previous transfer is in flight */
+	if (usbd_ep_write_packet(usbdev, CDCACM_GDB_ENDPOINT,
+	                         buffer_in[in_tail], length_in[in_tail]) > 0)
+		in_tail = (in_tail + 1U) % GDB_IN_PACKETS;
+}
+
+void gdb_usb_in_cb(usbd_device *dev, uint8_t ep)
+{
+	(void)dev;
+	(void)ep;
+	gdb_if_send_next();
+}
+
+static void gdb_if_queue_packet(uint32_t len)
+{
+	const uint32_t next = (in_head + 1U) % GDB_IN_PACKETS;
+	/* Wait for the interrupt to free up a slot */
+	while (next == in_tail) {
+		nvic_disable_irq(USB_IRQ);
+		gdb_if_send_next();
+		nvic_enable_irq(USB_IRQ);
+		/* Drop the data if the host went away while we were waiting */
+		if (usb_get_config() != 1 || !gdb_uart_get_dtr())
+			return;
+	}
+	length_in[in_head] = len;
+	nvic_disable_irq(USB_IRQ);
+	in_head = next;
+	gdb_if_send_next();
+	nvic_enable_irq(USB_IRQ);
+}
+
 void gdb_if_putchar(unsigned char c, int flush)
 {
-	buffer_in[count_in++] = c;
+	buffer_in[in_head][count_in++] = c;
 	if (flush || (count_in == CDCACM_PACKET_SIZE)) {
 		/* Refuse to send if USB isn't configured, and
 		 * don't bother if nobody's listening */
@@ -49,21 +103,20 @@ void gdb_if_putchar(unsigned char c, int flush)
 			count_in = 0;
 			return;
 		}
-		while (usbd_ep_write_packet(usbdev, CDCACM_GDB_ENDPOINT, buffer_in, count_in) <= 0)
-			continue;
+		const uint32_t len = count_in;
+		count_in = 0;
+		gdb_if_queue_packet(len);
 
-		if (flush && (count_in == CDCACM_PACKET_SIZE)) {
+		if (flush && (len == CDCACM_PACKET_SIZE)) {
 			/* We need to send an empty packet for some hosts
 			 * to accept this as a complete transfer. */
 			/* libopencm3 needs a change for us to confirm when
 			 * that transfer is complete, so we just send a packet
 			 * containing a null byte for now.
 			 */
-			while (usbd_ep_write_packet(usbdev, CDCACM_GDB_ENDPOINT, "\0", 1) <= 0)
-				continue;
+			buffer_in[in_head][0] = '\0';
+			gdb_if_queue_packet(1);
 		}
-
-		count_in = 0;
 	}
 }
 
@@ -106,6 +159,9 @@ unsigned char gdb_if_getchar(void)
 {
 
 	while (!(out_ptr < count_out)) {
+#ifdef PLATFORM_HAS_REMOTE_IF
+		usb_remote_poll();
+#endif
 		/* Detach if port closed */
 		if (!gdb_uart_get_dtr()) {
 			__WFI();
@@ -118,6 +174,30 @@ unsigned char gdb_if_getchar(void)
 	return buffer_out[out_ptr++];
 }
 
+size_t gdb_if_read_buf(void *const buf, const size_t max)
+{
+	while (!(out_ptr < count_out)) {
+#ifdef PLATFORM_HAS_REMOTE_IF
+		/* Serve the hosted app on the vendor interface while GDB is idle */
+		usb_remote_poll();
+#endif
+		/* Detach if port closed */
+		if (!gdb_uart_get_dtr()) {
+			__WFI();
+			*(uint8_t *)buf = 0x04;
+			return 1;
+		}
+
+		gdb_if_update_buf();
+	}
+
+	/* Hand out whatever is left of the current USB packet in one go */
+	const size_t count = MIN(max, count_out - out_ptr);
+	memcpy(buf, buffer_out + out_ptr, count);
+	out_ptr += count;
+	return count;
+}
+
 unsigned char gdb_if_getchar_to(int timeout)
 {
 	platform_timeout t;
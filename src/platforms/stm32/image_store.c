@@ -0,0 +1,201 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements the image store of STM32F4 probes: flash sectors
+ * the firmware doesn't use hold one target image, which the probe then
+ * programs into targets on its own, from "monitor program" or the button.
+ * The linker script keeps the firmware below IMAGE_STORE_BASE.
+ *
+ * The store starts with a header giving where the image goes in the target,
+ * its length and CRC, followed by the image. The header is written last, so
+ * a store that was interrupted holds no image. The CRC is the one
+ * target_mem_crc32() works out, so the target can be verified against it
+ * without reading the image back.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "gdb_main.h"
+#include "morse.h"
+#include "crc32.h"
+#include "image_store.h"
+
+#include <libopencm3/stm32/flash.h>
+
+#define IMAGE_MAGIC      0x474d4942U /* "BIMG" */
+#define IMAGE_STORE_SIZE (IMAGE_STORE_SECTORS * IMAGE_STORE_SECTOR_SIZE)
+/* Target memory is read this much at a time while storing */
+#define IMAGE_CHUNK 1024U
+
+typedef struct image_header {
+	uint32_t magic;
+	uint32_t addr;
+	uint32_t len;
+	uint32_t crc;
+} image_header_s;
+
+#define IMAGE_HEADER    ((const image_header_s *)IMAGE_STORE_BASE)
+#define IMAGE_DATA_BASE (IMAGE_STORE_BASE + sizeof(image_header_s))
+#define IMAGE_DATA      ((const uint8_t *)IMAGE_DATA_BASE)
+#define IMAGE_MAX       (IMAGE_STORE_SIZE - sizeof(image_header_s))
+
+static bool image_button_pressed;
+
+static void image_flash_done(void)
+{
+	flash_lock();
+	/* What was just written may still be cached as it was before */
+	flash_dcache_disable();
+	flash_dcache_reset();
+	flash_dcache_enable();
+}
+
+/* Erases the sectors that len bytes of image need, header included */
+static void image_flash_erase(const uint32_t len)
+{
+	const uint32_t sectors = MIN(
+		(len + sizeof(image_header_s) + IMAGE_STORE_SECTOR_SIZE - 1U) / IMAGE_STORE_SECTOR_SIZE, IMAGE_STORE_SECTORS);
+	for (uint32_t i = 0; i < sectors; ++i)
+		flash_erase_sector(IMAGE_STORE_FIRST_SECTOR + i, FLASH_CR_PROGRAM_X32);
+}
+
+bool image_store_erase(void)
+{
+	flash_unlock();
+	image_flash_erase(IMAGE_MAX);
+	image_flash_done();
+	return IMAGE_HEADER->magic == UINT32_MAX;
+}
+
+bool image_store_save(target *const t, const uint32_t addr, const uint32_t len)
+{
+	if (!len || len > IMAGE_MAX) {
+		DEBUG_WARN("Image of %" PRIu32 " bytes doesn't fit the %u byte store\n", len, (unsigned)IMAGE_MAX);
+		return false;
+	}
+	flash_unlock();
+	image_flash_erase(len);
+	uint32_t buf[IMAGE_CHUNK / 4U];
+	uint32_t crc = UINT32_MAX;
+	bool ok = true;
+	for (uint32_t offset = 0; ok && offset < len; offset += IMAGE_CHUNK) {
+		const uint32_t chunk = MIN(len - offset, IMAGE_CHUNK);
+		/* The last word is padded out as erased flash */
+		buf[(chunk - 1U) / 4U] = UINT32_MAX;
+		ok = !target_mem_read(t, buf, addr + offset, chunk);
+		crc = crc32_buf(crc, buf, chunk);
+		for (uint32_t i = 0; ok && i < chunk; i += 4U)
+			flash_program_word(IMAGE_DATA_BASE + offset + i, buf[i / 4U]);
+	}
+	image_flash_done();
+	if (!ok) {
+		DEBUG_WARN("Reading the image from the target failed\n");
+		return false;
+	}
+	if (crc32_buf(UINT32_MAX, IMAGE_DATA, len) != crc) {
+		DEBUG_WARN("Image store verify failed\n");
+		return false;
+	}
+	flash_unlock();
+	flash_program_word(IMAGE_STORE_BASE + offsetof(image_header_s, addr), addr);
+	flash_program_word(IMAGE_STORE_BASE + offsetof(image_header_s, len), len);
+	flash_program_word(IMAGE_STORE_BASE + offsetof(image_header_s, crc), crc);
+	flash_program_word(IMAGE_STORE_BASE + offsetof(image_header_s, magic), IMAGE_MAGIC);
+	image_flash_done();
+	return true;
+}
+
+bool image_store_info(uint32_t *const addr, uint32_t *const len, uint32_t *const crc)
+{
+	const image_header_s *const header = IMAGE_HEADER;
+	if (header->magic != IMAGE_MAGIC || header->len > IMAGE_MAX ||
+		crc32_buf(UINT32_MAX, IMAGE_DATA, header->len) != header->crc)
+		return false;
+	*addr = header->addr;
+	*len = header->len;
+	*crc = header->crc;
+	return true;
+}
+
+bool image_store_program(target *const t)
+{
+	uint32_t addr;
+	uint32_t len;
+	uint32_t crc;
+	if (!image_store_info(&addr, &len, &crc)) {
+		DEBUG_WARN("No valid image stored\n");
+		return false;
+	}
+	/* Straight from the store, the probe's flash is memory mapped */
+	if (target_flash_erase(t, addr, len) || target_flash_write(t, addr, IMAGE_DATA, len) || target_flash_done(t)) {
+		DEBUG_WARN("Programming the image failed\n");
+		return false;
+	}
+	uint32_t target_crc;
+	if (target_mem_crc32(t, &target_crc, addr, len) || target_crc != crc) {
+		DEBUG_WARN("Image verify failed\n");
+		return false;
+	}
+	return true;
+}
+
+static void image_target_printf(struct target_controller *tc, const char *fmt, va_list ap)
+{
+	(void)tc;
+	(void)fmt;
+	(void)ap;
+}
+
+static void image_target_destroyed(struct target_controller *tc, target *t)
+{
+	(void)tc;
+	(void)t;
+}
+
+static struct target_controller image_controller = {
+	.destroy_callback = image_target_destroyed,
+	.printf = image_target_printf,
+};
+
+void image_store_button_poll(target *const t)
+{
+	(void)t;
+	const bool pressed = gpio_get(IMAGE_BUTTON_PORT, IMAGE_BUTTON_PIN);
+	const bool press = pressed && !image_button_pressed;
+	image_button_pressed = pressed;
+	if (!press || gdb_target_attached())
+		return;
+
+	/* Whatever the background tasks were working on goes, as with a scan from GDB */
+	gdb_background_lost();
+	SET_RUN_STATE(1);
+	bool ok = false;
+	if (adiv5_swdp_scan(0)) {
+		target *const programmed = target_attach_n(1, &image_controller);
+		if (programmed) {
+			ok = image_store_program(programmed);
+			target_reset(programmed);
+			target_detach(programmed);
+		}
+	}
+	platform_target_clk_output_enable(false);
+	SET_RUN_STATE(0);
+	if (ok)
+		morse(NULL, false);
+	else
+		morse("PROG FAIL.", true);
+}
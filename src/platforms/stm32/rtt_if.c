@@ -95,21 +95,24 @@ void usbuart_usb_out_cb(usbd_device *dev, uint8_t ep)
 	return;
 }
 
-/* rtt host to target: read one character */
-int32_t rtt_getchar()
+/* rtt host to target: read up to len bytes, at most two copies as the buffer wraps */
+uint32_t rtt_read_buf(const uint32_t channel, char *const buf, const uint32_t len)
 {
-	int retval;
-
-	if (recv_head == recv_tail)
-		return -1;
-	retval = recv_buf[recv_tail];
-	recv_tail = (recv_tail + 1) % sizeof(recv_buf);
+	(void)channel;
+	uint32_t count = 0;
+	while (count < len && recv_head != recv_tail) {
+		const uint32_t run_end = recv_head > recv_tail ? recv_head : sizeof(recv_buf);
+		const uint32_t run = MIN(run_end - recv_tail, len - count);
+		memcpy(buf + count, recv_buf + recv_tail, run);
+		recv_tail = (recv_tail + run) % sizeof(recv_buf);
+		count += run;
+	}
 
 	/* open flow control if enough free buffer space */
-	if (!recv_set_nak())
+	if (count && !recv_set_nak())
 		usbd_ep_nak_set(usbdev, CDCACM_UART_ENDPOINT, 0);
 
-	return retval;
+	return count;
 }
 
 /* rtt host to target: true if no characters available for reading */
@@ -118,17 +121,50 @@ bool rtt_nodata()
 	return recv_head == recv_tail;
 }
 
-/* rtt target to host: write string */
-uint32_t rtt_write(const char *buf, uint32_t len)
+/*
+ * rtt target to host: up channel data is read straight into a usb packet. Like the usb uart,
+ * a packet is never full, so no zero length packet is needed. With rtt mux on a packet holds
+ * one channel's data after a byte each of channel and length. A packet the endpoint did not
+ * take yet is retried before another one is handed out, so a slow host holds back the target.
+ */
+#define RTT_MUX_HEADER 2U
+
+static char xmit_pkt[CDCACM_PACKET_SIZE - 1U + 8U];
+static uint32_t xmit_len = 0;
+
+static bool rtt_usb_connected(void)
+{
+	return usbdev && usb_get_config() && gdb_uart_get_dtr();
+}
+
+char *rtt_write_buf(const uint32_t channel, uint32_t *const len)
 {
-	if (len != 0 && usbdev && usb_get_config() && gdb_uart_get_dtr()) {
-		for (uint32_t p = 0; p < len; p += CDCACM_PACKET_SIZE) {
-			uint32_t plen = MIN(CDCACM_PACKET_SIZE, len - p);
-			while(usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, buf + p, plen) <= 0);
-		}
-		/* flush 64-byte packet on full-speed */
-		if (CDCACM_PACKET_SIZE == 64 && (len % CDCACM_PACKET_SIZE) == 0)
-			while(usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, NULL, 0) <= 0);
+	(void)channel;
+	/* with nobody listening the data goes, as it would to a closed port */
+	if (!rtt_usb_connected())
+		xmit_len = 0;
+	else if (xmit_len && usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, xmit_pkt, xmit_len))
+		xmit_len = 0;
+	if (xmit_len) {
+		*len = 0;
+		return NULL;
+	}
+	const uint32_t header = rtt_mux ? RTT_MUX_HEADER : 0U;
+	*len = CDCACM_PACKET_SIZE - 1U - header;
+	return xmit_pkt + header;
+}
+
+void rtt_write_done(const uint32_t channel, const uint32_t len)
+{
+	if (!len || !rtt_usb_connected())
+		return;
+	uint32_t header = 0;
+	if (rtt_mux) {
+		xmit_pkt[0] = channel;
+		xmit_pkt[1] = len;
+		header = RTT_MUX_HEADER;
 	}
-	return len;
+	xmit_len = len + header;
+	if (usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, xmit_pkt, xmit_len))
+		xmit_len = 0;
 }
@@ -21,11 +21,24 @@
 
 #include <libopencm3/cm3/systick.h>
 #include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/cortex.h>
 #include <libopencm3/stm32/rcc.h>
 
 uint8_t running_status;
 static volatile uint32_t time_ms;
 uint32_t swd_delay_cnt = 0;
+/* Half clock period in core cycles, 0 when the delay loop is used instead */
+uint32_t swd_delay_cycles = 0;
+uint32_t swd_clock_edge = 0;
+#ifdef PLATFORM_HAS_SWD_CRITICAL
+/* Below this SWCLK a transaction takes long enough that USB is better served than held off */
+#define SWD_CRITICAL_FREQ_MIN 100000U
+static bool swd_critical_slow = false;
+#endif
+#ifdef PLATFORM_HAS_CYCLE_COUNTER
+static bool cycle_counter_ok = false;
+#endif
 
 static int morse_tick;
 
@@ -39,6 +52,10 @@ void platform_timing_init(void)
 	nvic_set_priority(NVIC_SYSTICK_IRQ, 14 << 4);
 	systick_interrupt_enable();
 	systick_counter_enable();
+#ifdef PLATFORM_HAS_CYCLE_COUNTER
+	/* Some F103 clones don't implement CYCCNT, those keep the calibrated loops */
+	cycle_counter_ok = dwt_enable_cycle_counter();
+#endif
 }
 
 void platform_delay(uint32_t ms)
@@ -67,6 +84,21 @@ uint32_t platform_time_ms(void)
 	return time_ms;
 }
 
+/* The tick count plus how far SysTick is into the next tick, wraps after 71 minutes */
+uint32_t platform_time_us(void)
+{
+	CM_ATOMIC_CONTEXT();
+	uint32_t ms = time_ms;
+	uint32_t count = systick_get_value();
+	/* Called above the SysTick priority, the counter may have wrapped with time_ms yet to move */
+	if (SCB_ICSR & SCB_ICSR_PENDSTSET) {
+		ms += SYSTICKMS;
+		count = systick_get_value();
+	}
+	const uint32_t elapsed = systick_get_reload() - count;
+	return ms * 1000U + (elapsed * 8U) / (rcc_ahb_frequency / 1000000U);
+}
+
 /* Assume some USED_SWD_CYCLES per clock
  * and  CYCLES_PER_CNT Cycles per delay loop cnt with 2 delay loops per clock
  */
@@ -76,6 +108,10 @@ uint32_t platform_time_ms(void)
 #define CYCLES_PER_CNT 10
 void platform_max_frequency_set(uint32_t freq)
 {
+	swd_delay_cycles = 0;
+#ifdef PLATFORM_HAS_SWD_CRITICAL
+	swd_critical_slow = freq < SWD_CRITICAL_FREQ_MIN;
+#endif
 	int divisor = rcc_ahb_frequency - USED_SWD_CYCLES * freq;
 	if (divisor < 0) {
 		swd_delay_cnt = 0;
@@ -85,11 +121,47 @@ void platform_max_frequency_set(uint32_t freq)
 	swd_delay_cnt = divisor/(CYCLES_PER_CNT * freq);
 	if ((swd_delay_cnt * (CYCLES_PER_CNT * freq)) < (unsigned int)divisor)
 		swd_delay_cnt++;
+#ifdef PLATFORM_HAS_CYCLE_COUNTER
+	if (cycle_counter_ok && swd_delay_cnt) {
+		/* Round the half period up so we never run faster than asked */
+		swd_delay_cycles = (rcc_ahb_frequency + 2U * freq - 1U) / (2U * freq);
+		if (swd_delay_cycles * 2U <= USED_SWD_CYCLES) {
+			swd_delay_cycles = 0;
+			swd_delay_cnt = 0;
+		}
+	}
+#endif
 }
 
 uint32_t platform_max_frequency_get(void)
 {
+#ifdef PLATFORM_HAS_CYCLE_COUNTER
+	if (swd_delay_cycles)
+		return rcc_ahb_frequency / (2U * swd_delay_cycles);
+#endif
 	uint32_t ret = rcc_ahb_frequency;
 	ret /= USED_SWD_CYCLES + CYCLES_PER_CNT * swd_delay_cnt;
 	return ret;
 }
+
+#ifdef PLATFORM_HAS_SWD_CRITICAL
+/*
+ * Masks USB, the USB UART and SysTick, all at IRQ_PRI_USB or below, so none
+ * of them lands between the bits of a transaction. The trace capture, above
+ * them, still runs as it must keep up with SWO. At 4 MHz a transaction is
+ * held to some 15 us, well inside what USB and the UART DMA tolerate.
+ */
+uint32_t platform_swd_critical_enter(void)
+{
+	uint32_t basepri;
+	__asm__ volatile("mrs %0, basepri" : "=r"(basepri));
+	if (!swd_critical_slow)
+		__asm__ volatile("msr basepri_max, %0" : : "r"(IRQ_PRI_USB) : "memory");
+	return basepri;
+}
+
+void platform_swd_critical_exit(const uint32_t basepri)
+{
+	__asm__ volatile("msr basepri, %0" : : "r"(basepri) : "memory");
+}
+#endif
@@ -19,10 +19,41 @@
 #ifndef __TIMING_STM32_H
 #define __TIMING_STM32_H
 
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+#include <libopencm3/cm3/dwt.h>
+#define PLATFORM_HAS_CYCLE_COUNTER
+/* BASEPRI can hold off USB and the UART while trace capture still runs */
+#define PLATFORM_HAS_SWD_CRITICAL
+#endif
+
 extern uint32_t swd_delay_cnt;
+extern uint32_t swd_delay_cycles;
+extern uint32_t swd_clock_edge;
 extern uint8_t running_status;
 
 void platform_timing_init(void);
 
+/* usbuart.c can prefix the USB UART data with timestamps */
+#define PLATFORM_HAS_USBUART_FRAMED
+
+/*
+ * Wait out half a SWCLK/TCK period. When the DWT cycle counter is usable the
+ * wait runs from the end of the previous one, so the time spent driving the
+ * pins counts towards the period and the requested frequency is met exactly.
+ */
+static inline void platform_clock_delay(void)
+{
+#ifdef PLATFORM_HAS_CYCLE_COUNTER
+	if (swd_delay_cycles) {
+		while (DWT_CYCCNT - swd_clock_edge < swd_delay_cycles)
+			continue;
+		swd_clock_edge = DWT_CYCCNT;
+		return;
+	}
+#endif
+	for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
+		continue;
+}
+
 #endif
 
@@ -28,19 +28,36 @@
 /* TDO/TRACESWO signal comes into pin PA6/TIM3_CH1
  * Manchester coding is assumed on TRACESWO, so bit timing can be detected.
  * The idea is to use TIM3 input capture modes to capture pulse timings.
- * These can be capture directly to RAM by DMA.
- * The core can then process the buffer to extract the frame.
+ * Where the platform gives a DMA channel for the capture, each rising edge
+ * has the timer burst both captures into a circular buffer by DMA and the
+ * buffer is decoded in batches on USB start of frame, once a millisecond.
+ * Otherwise every rising edge interrupts and is decoded there and then.
  */
 #include "general.h"
 #include "usb.h"
 #include "traceswo.h"
+#include "stats.h"
 
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/timer.h>
 #include <libopencm3/stm32/rcc.h>
+#ifdef TRACE_DMA_CHAN
+#include <libopencm3/stm32/dma.h>
+
+/* Captures buffered, enough for a millisecond of edges at 1MBaud */
+#define TRACE_DMA_PAIRS 1024U
+/* DMA burst: DBA at CCR1 (register 13), DBL of 2 transfers, so CCR1 then CCR2 */
+#define TRACE_DMA_BURST ((1U << 8U) | 13U)
+
+static uint16_t trace_dma_buf[TRACE_DMA_PAIRS * 2U];
+static uint16_t trace_dma_read;
+static void traceswo_dma_drain(void);
+#endif
 
 /* SWO decoding */
 static bool decoding = false;
+/* Captures come by DMA rather than by interrupt */
+static bool trace_dma = false;
 
 void traceswo_init(uint32_t swo_chan_bitmask)
 {
@@ -66,10 +83,46 @@ void traceswo_init(uint32_t swo_chan_bitmask)
 	/* Slave reset mode: reset counter on trigger */
 	timer_slave_set_mode(TRACE_TIM, TIM_SMCR_SMS_RM);
 
-	/* Enable capture interrupt */
-	nvic_set_priority(TRACE_IRQ, IRQ_PRI_TRACE);
-	nvic_enable_irq(TRACE_IRQ);
-	timer_enable_irq(TRACE_TIM, TIM_DIER_CC1IE);
+#ifdef TRACE_DMA_CHAN
+	trace_dma = TRACE_DMA_USABLE();
+#endif
+	if (trace_dma) {
+#ifdef TRACE_DMA_CHAN
+		rcc_periph_clock_enable(TRACE_DMA_CLK);
+		dma_channel_reset(TRACE_DMA_BUS, TRACE_DMA_CHAN);
+		dma_set_peripheral_address(TRACE_DMA_BUS, TRACE_DMA_CHAN, (uint32_t)&TIM_DMAR(TRACE_TIM));
+		dma_set_memory_address(TRACE_DMA_BUS, TRACE_DMA_CHAN, (uint32_t)trace_dma_buf);
+		dma_set_number_of_data(TRACE_DMA_BUS, TRACE_DMA_CHAN, TRACE_DMA_PAIRS * 2U);
+		dma_set_read_from_peripheral(TRACE_DMA_BUS, TRACE_DMA_CHAN);
+		dma_enable_memory_increment_mode(TRACE_DMA_BUS, TRACE_DMA_CHAN);
+		dma_enable_circular_mode(TRACE_DMA_BUS, TRACE_DMA_CHAN);
+		dma_set_peripheral_size(TRACE_DMA_BUS, TRACE_DMA_CHAN, DMA_CCR_PSIZE_16BIT);
+		dma_set_memory_size(TRACE_DMA_BUS, TRACE_DMA_CHAN, DMA_CCR_MSIZE_16BIT);
+		dma_set_priority(TRACE_DMA_BUS, TRACE_DMA_CHAN, DMA_CCR_PL_VERY_HIGH);
+		dma_enable_channel(TRACE_DMA_BUS, TRACE_DMA_CHAN);
+		trace_dma_read = 0;
+
+		/* Each rising edge reads out CCR1 and CCR2 through DMAR */
+		TIM_DCR(TRACE_TIM) = TRACE_DMA_BURST;
+		timer_enable_irq(TRACE_TIM, TIM_DIER_CC1DE);
+
+		/*
+		 * The timer interrupt is left to find the end of a frame, the
+		 * counter overflowing when no edge came for a while. It runs at the
+		 * priority of the USB interrupt so it never cuts into a drain.
+		 */
+		usbd_register_sof_callback(usbdev, traceswo_dma_drain);
+		nvic_set_priority(TRACE_IRQ, IRQ_PRI_USB);
+		nvic_enable_irq(TRACE_IRQ);
+		timer_clear_flag(TRACE_TIM, TIM_SR_UIF);
+		timer_enable_irq(TRACE_TIM, TIM_DIER_UIE);
+#endif
+	} else {
+		/* Enable capture interrupt */
+		nvic_set_priority(TRACE_IRQ, IRQ_PRI_TRACE);
+		nvic_enable_irq(TRACE_IRQ);
+		timer_enable_irq(TRACE_TIM, TIM_DIER_CC1IE);
+	}
 
 	/* Enable the capture channels */
 	timer_ic_enable(TRACE_TIM, TIM_IC1);
@@ -78,19 +131,21 @@ void traceswo_init(uint32_t swo_chan_bitmask)
 	timer_enable_counter(TRACE_TIM);
 
 	traceswo_setmask(swo_chan_bitmask);
-	decoding = (swo_chan_bitmask != 0);
+	decoding = traceswo_decoding();
 }
 
-static uint8_t trace_usb_buf[64];
-static uint8_t trace_usb_buf_size;
+static uint8_t trace_usb_buf[TRACE_PACKET_SIZE];
+static uint16_t trace_usb_buf_size;
 
 void trace_buf_push(uint8_t *buf, int len)
 {
+	STATS_ADD(swo_bytes, len);
 	if (decoding)
 		traceswo_decode(usbdev, CDCACM_UART_ENDPOINT, buf, len);
 	else if (usbd_ep_write_packet(usbdev, USB_REQ_TYPE_IN | TRACE_ENDPOINT, buf, len) != len) {
-		if (trace_usb_buf_size + len > 64) {
+		if (trace_usb_buf_size + len > TRACE_PACKET_SIZE) {
 			/* Stall if upstream to too slow. */
+			STATS_INC(swo_drops);
 			usbd_ep_stall_set(usbdev, USB_REQ_TYPE_IN | TRACE_ENDPOINT, 1);
 			trace_usb_buf_size = 0;
 			return;
@@ -114,10 +169,13 @@ void trace_buf_drain(usbd_device *dev, uint8_t ep)
 
 #define ALLOWED_DUTY_ERROR 5
 
-void TRACE_ISR(void)
+/*
+ * Decodes one capture, the cycle from CCR1 and the high time from CCR2, with
+ * the timer status flags that came with it. A capture with no CC1IF ends the
+ * frame on its high time and one with no high time just flushes the frame.
+ */
+static void traceswo_capture(const uint16_t sr, uint16_t cycle, uint16_t duty)
 {
-	uint16_t sr = TIM_SR(TRACE_TIM);
-	uint16_t duty, cycle;
 	static uint16_t bt;
 	static uint8_t lastbit;
 	static uint8_t decbuf[17];
@@ -125,16 +183,6 @@ void TRACE_ISR(void)
 	static uint8_t halfbit;
 	static uint8_t notstart;
 
-	/* Reset decoder state if capture overflowed */
-	if (sr & (TIM_SR_CC1OF | TIM_SR_UIF)) {
-		timer_clear_flag(TRACE_TIM, TIM_SR_CC1OF | TIM_SR_UIF);
-		if (!(sr & (TIM_SR_CC2IF | TIM_SR_CC1IF)))
-			goto flush_and_reset;
-	}
-
-	cycle = TIM_CCR1(TRACE_TIM);
-	duty = TIM_CCR2(TRACE_TIM);
-
 	/* Reset decoder state if crazy shit happened */
 	if ((bt && (((duty / bt) > 2) || ((duty / bt) == 0))) || (duty == 0))
 		goto flush_and_reset;
@@ -154,9 +202,12 @@ void TRACE_ISR(void)
 		bt = duty;
 		lastbit = 1;
 		halfbit = 0;
-		timer_set_period(TRACE_TIM, duty * 6);
-		timer_clear_flag(TRACE_TIM, TIM_SR_UIF);
-		timer_enable_irq(TRACE_TIM, TIM_DIER_UIE);
+		/* With DMA the decoder runs behind the capture, the timeout stays put */
+		if (!trace_dma) {
+			timer_set_period(TRACE_TIM, duty * 6);
+			timer_clear_flag(TRACE_TIM, TIM_SR_UIF);
+			timer_enable_irq(TRACE_TIM, TIM_DIER_UIE);
+		}
 	} else {
 		/* If high time is extended we need to flip the bit */
 		if ((duty / bt) > 1) {
@@ -186,10 +237,78 @@ void TRACE_ISR(void)
 		return;
 
 flush_and_reset:
-	timer_set_period(TRACE_TIM, -1);
-	timer_disable_irq(TRACE_TIM, TIM_DIER_UIE);
-	trace_buf_push(decbuf, decbuf_pos >> 3);
+	if (!trace_dma) {
+		timer_set_period(TRACE_TIM, -1);
+		timer_disable_irq(TRACE_TIM, TIM_DIER_UIE);
+	}
+	if (decbuf_pos >> 3)
+		trace_buf_push(decbuf, decbuf_pos >> 3);
 	bt = 0;
 	decbuf_pos = 0;
 	memset(decbuf, 0, sizeof(decbuf));
 }
+
+#ifdef TRACE_DMA_CHAN
+/*
+ * Decodes the captures the DMA wrote since the last drain. The transfer
+ * complete flag says the DMA wrapped around the buffer, if it also got back
+ * past where the last drain stopped then captures were overwritten before
+ * they were decoded. That loses the frame, so it is flushed and decoding
+ * picks up again from the newest capture.
+ */
+static void traceswo_dma_drain(void)
+{
+	const bool wrapped = dma_get_interrupt_flag(TRACE_DMA_BUS, TRACE_DMA_CHAN, DMA_TCIF);
+	const uint16_t write =
+		((TRACE_DMA_PAIRS * 2U - dma_get_number_of_data(TRACE_DMA_BUS, TRACE_DMA_CHAN)) / 2U) % TRACE_DMA_PAIRS;
+	if (wrapped) {
+		dma_clear_interrupt_flags(TRACE_DMA_BUS, TRACE_DMA_CHAN, DMA_TCIF);
+		if (write >= trace_dma_read) {
+			STATS_INC(swo_overruns);
+			traceswo_capture(0, 0, 0);
+			trace_dma_read = write;
+			return;
+		}
+	} else if (write < trace_dma_read)
+		/* Wrapped after the flag was looked at, it is accounted for here */
+		dma_clear_interrupt_flags(TRACE_DMA_BUS, TRACE_DMA_CHAN, DMA_TCIF);
+
+	while (trace_dma_read != write) {
+		const uint16_t *const capture = &trace_dma_buf[trace_dma_read * 2U];
+		traceswo_capture(TIM_SR_CC1IF, capture[0], capture[1]);
+		trace_dma_read = (trace_dma_read + 1U) % TRACE_DMA_PAIRS;
+	}
+}
+#endif
+
+void TRACE_ISR(void)
+{
+	uint16_t sr = TIM_SR(TRACE_TIM);
+
+	/* Reset decoder state if capture overflowed */
+	if (sr & (TIM_SR_CC1OF | TIM_SR_UIF)) {
+		timer_clear_flag(TRACE_TIM, TIM_SR_CC1OF | TIM_SR_UIF);
+#ifdef TRACE_DMA_CHAN
+		/*
+		 * The line went idle: decode what the DMA holds, then the last
+		 * pulse, which has no rising edge after it to be burst out with.
+		 */
+		if (trace_dma) {
+			if (sr & TIM_SR_CC1OF)
+				STATS_INC(swo_overruns);
+			traceswo_dma_drain();
+			if (sr & TIM_SR_CC2IF)
+				traceswo_capture(TIM_SR_CC2IF, 0, TIM_CCR2(TRACE_TIM));
+			else
+				traceswo_capture(0, 0, 0);
+			return;
+		}
+#endif
+		if (!(sr & (TIM_SR_CC2IF | TIM_SR_CC1IF))) {
+			traceswo_capture(0, 0, 0);
+			return;
+		}
+	}
+
+	traceswo_capture(sr, TIM_CCR1(TRACE_TIM), TIM_CCR2(TRACE_TIM));
+}
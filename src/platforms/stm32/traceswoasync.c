@@ -26,11 +26,20 @@
  */
 
 /* TDO/TRACESWO signal comes into the SWOUSART RX pin.
+ *
+ * The UART's DMA writes straight into a ring of USB sized packets, with the
+ * half and full transfer interrupts keeping count of the laps. Packets are
+ * handed to USB as they fill up, from the endpoint callback and on every USB
+ * start of frame, so the ring only needs to cover the USB host's hiccups.
+ *
+ * Where the platform routes the RX pin to a timer channel too, the baud rate
+ * can be measured from the timing of the falling edges on the line.
  */
 
 #include "general.h"
 #include "usb.h"
 #include "traceswo.h"
+#include "stats.h"
 
 #include <libopencmsis/core_cm3.h>
 #include <libopencm3/cm3/nvic.h>
@@ -40,17 +49,43 @@
 #include <libopencm3/stm32/dma.h>
 
 /* For speed this is set to the USB transfer size */
-#define FULL_SWO_PACKET	(64)
-
-static volatile uint32_t w;	/* Packet currently received via UART */
-static volatile uint32_t r;	/* Packet currently waiting to transmit to USB */
-/* Packets arrived from the SWO interface */
-static uint8_t trace_rx_buf[NUM_TRACE_PACKETS * FULL_SWO_PACKET];
-/* Packet pingpong buffer used for receiving packets */
-static uint8_t pingpong_buf[2 * FULL_SWO_PACKET];
+#define FULL_SWO_PACKET	TRACE_PACKET_SIZE
+#define TRACE_RX_SIZE (NUM_TRACE_PACKETS * FULL_SWO_PACKET)
+
+/* The UART samples each bit 16 times */
+#define SWO_UART_OVERSAMPLING 16U
+
+/* Gaps between falling edges timed to measure the baud rate from */
+#define SWO_BAUD_GAPS 128U
+/* Bytes received without a framing error that confirm a measured rate */
+#define SWO_BAUD_CHECK_BYTES 32U
+#define SWO_BAUD_TIMEOUT_MS 250U
+
+/* Half ring transfers completed by the DMA */
+static volatile uint32_t halves;
+/* Packets handed on to USB so far */
+static uint32_t read_packets;
+/* Packets arrived from the SWO interface, written by DMA */
+static uint8_t trace_rx_buf[TRACE_RX_SIZE];
 /* SWO decoding */
 static bool decoding = false;
 
+/* Packets the DMA filled so far, counted in the same way as read_packets */
+static uint32_t traceswo_written(void)
+{
+	uint32_t half;
+	uint32_t pos;
+	do {
+		half = halves;
+		pos = TRACE_RX_SIZE - dma_get_number_of_data(SWO_DMA_BUS, SWO_DMA_CHAN);
+	} while (half != halves);
+	/* The DMA may have wrapped around before its interrupt got to run */
+	uint32_t laps = half / 2U;
+	if ((half & 1U) && pos < TRACE_RX_SIZE / 2U)
+		++laps;
+	return laps * NUM_TRACE_PACKETS + pos / FULL_SWO_PACKET;
+}
+
 void trace_buf_drain(usbd_device *dev, uint8_t ep)
 {
 	static volatile char inBufDrain;
@@ -58,27 +93,42 @@ void trace_buf_drain(usbd_device *dev, uint8_t ep)
 	/* If we are already in this routine then we don't need to come in again */
 	if (__atomic_test_and_set (&inBufDrain, __ATOMIC_RELAXED))
 		return;
+	const uint32_t written = traceswo_written();
+	/* The DMA caught up with the reader and overwrote what was not sent yet */
+	if (written - read_packets >= NUM_TRACE_PACKETS) {
+		STATS_INC(swo_overruns);
+		read_packets = written - NUM_TRACE_PACKETS / 2U;
+	}
 	/* Attempt to write everything we buffered */
-	if (w != r) {
+	if (written != read_packets) {
+		const uint8_t *const packet = &trace_rx_buf[(read_packets % NUM_TRACE_PACKETS) * FULL_SWO_PACKET];
 		uint16_t rc;
 		if (decoding)
 			/* write decoded swo packets to the uart port */
-			rc = traceswo_decode(dev, CDCACM_UART_ENDPOINT,
-										  &trace_rx_buf[r * FULL_SWO_PACKET],
-										  FULL_SWO_PACKET);
+			rc = traceswo_decode(dev, CDCACM_UART_ENDPOINT, packet, FULL_SWO_PACKET);
 		else
 			/* write raw swo packets to the trace port */
-			rc = usbd_ep_write_packet(dev, ep,
-										  &trace_rx_buf[r * FULL_SWO_PACKET],
-										  FULL_SWO_PACKET);
-		if (rc) r = (r + 1) % NUM_TRACE_PACKETS;
+			rc = usbd_ep_write_packet(dev, ep, packet, FULL_SWO_PACKET);
+		if (rc)
+			++read_packets;
 	}
 	__atomic_clear (&inBufDrain, __ATOMIC_RELAXED);
 }
 
-void traceswo_setspeed(uint32_t baudrate)
+static void traceswo_sof(void)
+{
+	trace_buf_drain(usbdev, USB_REQ_TYPE_IN | TRACE_ENDPOINT);
+}
+
+/* The UART needs at least 16 clocks per bit */
+static uint32_t traceswo_max_baud(void)
+{
+	const uint32_t clock = SWO_UART == USART1 ? rcc_apb2_frequency : rcc_apb1_frequency;
+	return clock / SWO_UART_OVERSAMPLING;
+}
+
+static void traceswo_uart_setup(const uint32_t baudrate)
 {
-	dma_disable_channel(SWO_DMA_BUS, SWO_DMA_CHAN);
 	usart_disable(SWO_UART);
 	usart_set_baudrate(SWO_UART, baudrate);
 	usart_set_databits(SWO_UART, 8);
@@ -86,6 +136,12 @@ void traceswo_setspeed(uint32_t baudrate)
 	usart_set_mode(SWO_UART, USART_MODE_RX);
 	usart_set_parity(SWO_UART, USART_PARITY_NONE);
 	usart_set_flow_control(SWO_UART, USART_FLOWCONTROL_NONE);
+}
+
+void traceswo_setspeed(uint32_t baudrate)
+{
+	dma_disable_channel(SWO_DMA_BUS, SWO_DMA_CHAN);
+	traceswo_uart_setup(baudrate);
 
 	/* Set up DMA channel*/
 	dma_channel_reset(SWO_DMA_BUS, SWO_DMA_CHAN);
@@ -102,9 +158,10 @@ void traceswo_setspeed(uint32_t baudrate)
 
 	usart_enable(SWO_UART);
 	nvic_enable_irq(SWO_DMA_IRQ);
-	w = r = 0;
-	dma_set_memory_address(SWO_DMA_BUS, SWO_DMA_CHAN, (uint32_t)pingpong_buf);
-	dma_set_number_of_data(SWO_DMA_BUS, SWO_DMA_CHAN, 2 * FULL_SWO_PACKET);
+	halves = 0;
+	read_packets = 0;
+	dma_set_memory_address(SWO_DMA_BUS, SWO_DMA_CHAN, (uint32_t)trace_rx_buf);
+	dma_set_number_of_data(SWO_DMA_BUS, SWO_DMA_CHAN, TRACE_RX_SIZE);
 	dma_enable_channel(SWO_DMA_BUS, SWO_DMA_CHAN);
 	usart_enable_rx_dma(SWO_UART);
 }
@@ -113,23 +170,147 @@ void SWO_DMA_ISR(void)
 {
 	if (DMA_ISR(SWO_DMA_BUS) & DMA_ISR_HTIF(SWO_DMA_CHAN)) {
 		DMA_IFCR(SWO_DMA_BUS) |= DMA_ISR_HTIF(SWO_DMA_CHAN);
-		memcpy(&trace_rx_buf[w * FULL_SWO_PACKET], pingpong_buf,
-			   FULL_SWO_PACKET);
+		++halves;
+		STATS_ADD(swo_bytes, TRACE_RX_SIZE / 2U);
 	}
 	if (DMA_ISR(SWO_DMA_BUS) & DMA_ISR_TCIF(SWO_DMA_CHAN)) {
 		DMA_IFCR(SWO_DMA_BUS) |= DMA_ISR_TCIF(SWO_DMA_CHAN);
-		memcpy(&trace_rx_buf[w * FULL_SWO_PACKET],
-			   &pingpong_buf[FULL_SWO_PACKET], FULL_SWO_PACKET);
+		++halves;
+		STATS_ADD(swo_bytes, TRACE_RX_SIZE / 2U);
 	}
-	w = (w + 1) % NUM_TRACE_PACKETS;
-	trace_buf_drain(usbdev, 0x85);
+	trace_buf_drain(usbdev, USB_REQ_TYPE_IN | TRACE_ENDPOINT);
 }
 
-void traceswo_init(uint32_t baudrate, uint32_t swo_chan_bitmask)
+#ifdef SWO_TIM
+/*
+ * Times the gaps between falling edges on the line. The capture is polled,
+ * an edge missed to an interrupt shows as an overcapture or a timer
+ * overflow and the gap it spans is left out.
+ */
+static size_t traceswo_time_gaps(uint16_t *const gaps)
 {
-	if (!baudrate)
-		baudrate = SWO_DEFAULT_BAUD;
+	SWO_TIM_CLK_EN();
+	timer_disable_counter(SWO_TIM);
+	timer_set_prescaler(SWO_TIM, 0);
+	timer_set_period(SWO_TIM, UINT16_MAX);
+	timer_ic_set_input(SWO_TIM, SWO_TIM_IC, SWO_TIM_IC_IN);
+	timer_ic_set_polarity(SWO_TIM, SWO_TIM_IC, TIM_IC_FALLING);
+	timer_ic_enable(SWO_TIM, SWO_TIM_IC);
+	timer_clear_flag(SWO_TIM, SWO_TIM_SR_CCIF | SWO_TIM_SR_CCOF | TIM_SR_UIF);
+	timer_enable_counter(SWO_TIM);
 
+	size_t count = 0;
+	bool valid = false;
+	uint16_t last = 0;
+	const uint32_t start = platform_time_ms();
+	while (count < SWO_BAUD_GAPS && platform_time_ms() - start < SWO_BAUD_TIMEOUT_MS) {
+		const uint16_t sr = TIM_SR(SWO_TIM);
+		if (!(sr & SWO_TIM_SR_CCIF))
+			continue;
+		const uint16_t edge = SWO_TIM_CCR;
+		if (sr & (SWO_TIM_SR_CCOF | TIM_SR_UIF)) {
+			timer_clear_flag(SWO_TIM, SWO_TIM_SR_CCOF | TIM_SR_UIF);
+			valid = false;
+		}
+		if (valid)
+			gaps[count++] = edge - last;
+		last = edge;
+		valid = true;
+	}
+	timer_disable_counter(SWO_TIM);
+	timer_ic_disable(SWO_TIM, SWO_TIM_IC);
+	return count;
+}
+
+/*
+ * Falling edges come at the start bits and where a 1 is followed by a 0,
+ * so within a frame, and across back to back frames, they are whole bits
+ * apart. The shortest gap is 2 bits or more, the bit time is tried as each
+ * fraction of it from the largest down. A bit time fits when nearly all the
+ * gaps up to 10 bits long are within a quarter bit of a multiple of it, the
+ * rest have idle time in them. Returns the bit time in 1/16th timer ticks.
+ */
+static uint32_t traceswo_bit_time(const uint16_t *const gaps, const size_t count, uint32_t divisor,
+	uint32_t *const bits, uint32_t *const ticks)
+{
+	uint16_t shortest = UINT16_MAX;
+	for (size_t i = 0; i < count; ++i)
+		shortest = MIN(shortest, gaps[i]);
+	for (; divisor <= 10U; ++divisor) {
+		const uint32_t bit = ((uint32_t)shortest * 16U + divisor / 2U) / divisor;
+		/* Faster than the UART can go */
+		if (bit < SWO_UART_OVERSAMPLING * 16U)
+			break;
+		size_t used = 0;
+		size_t misfits = 0;
+		*bits = 0;
+		*ticks = 0;
+		for (size_t i = 0; i < count; ++i) {
+			const uint32_t gap = gaps[i] * 16U;
+			const uint32_t multiple = (gap + bit / 2U) / bit;
+			if (multiple > 10U)
+				continue;
+			const uint32_t error = gap > multiple * bit ? gap - multiple * bit : multiple * bit - gap;
+			if (error > bit / 4U) {
+				++misfits;
+				continue;
+			}
+			++used;
+			*bits += multiple;
+			*ticks += gaps[i];
+		}
+		if (used >= SWO_BAUD_GAPS / 4U && misfits * 8U <= used)
+			return divisor;
+	}
+	return 0;
+}
+
+/* Framing errors say the rate is off, a run of clean bytes that it is right */
+static bool traceswo_baud_check(const uint32_t baudrate)
+{
+	traceswo_uart_setup(baudrate);
+	usart_enable(SWO_UART);
+	size_t good = 0;
+	const uint32_t start = platform_time_ms();
+	while (good < SWO_BAUD_CHECK_BYTES && platform_time_ms() - start < SWO_BAUD_TIMEOUT_MS) {
+		const uint32_t sr = USART_SR(SWO_UART);
+		if (!(sr & USART_SR_RXNE))
+			continue;
+		/* Reading the data after the status clears the error flags */
+		(void)usart_recv(SWO_UART);
+		if (sr & (USART_SR_FE | USART_SR_NE))
+			break;
+		++good;
+	}
+	usart_disable(SWO_UART);
+	return good == SWO_BAUD_CHECK_BYTES;
+}
+
+/* Returns 0 when the line had too little on it to measure */
+static uint32_t traceswo_measure_baud(void)
+{
+	static uint16_t gaps[SWO_BAUD_GAPS];
+	const size_t count = traceswo_time_gaps(gaps);
+	/* The timers run at the core clock, the APB prescalers being 1 or 2 */
+	const uint32_t clock = rcc_ahb_frequency;
+	uint32_t divisor = 2;
+	while (true) {
+		uint32_t bits;
+		uint32_t ticks;
+		divisor = traceswo_bit_time(gaps, count, divisor, &bits, &ticks);
+		if (!divisor)
+			return 0;
+		/* Averaged over all the gaps that fit, better than any one of them */
+		const uint32_t baudrate = (uint32_t)(((uint64_t)clock * bits + ticks / 2U) / ticks);
+		if (baudrate <= traceswo_max_baud() && traceswo_baud_check(baudrate))
+			return baudrate;
+		++divisor;
+	}
+}
+#endif
+
+uint32_t traceswo_init(uint32_t baudrate, uint32_t swo_chan_bitmask)
+{
 	rcc_periph_clock_enable(SWO_UART_CLK);
 	rcc_periph_clock_enable(SWO_DMA_CLK);
 
@@ -137,9 +318,25 @@ void traceswo_init(uint32_t baudrate, uint32_t swo_chan_bitmask)
 				  GPIO_CNF_INPUT_PULL_UPDOWN, SWO_UART_RX_PIN);
 	/* Pull SWO pin high to keep open SWO line ind uart idle state!*/
 	gpio_set(SWO_UART_PORT, SWO_UART_RX_PIN);
+
+	if (baudrate == SWO_AUTO_BAUD) {
+		dma_disable_channel(SWO_DMA_BUS, SWO_DMA_CHAN);
+		usart_disable_rx_dma(SWO_UART);
+#ifdef SWO_TIM
+		baudrate = traceswo_measure_baud();
+#else
+		baudrate = 0;
+#endif
+		if (!baudrate)
+			return 0;
+	}
+	baudrate = MIN(baudrate, traceswo_max_baud());
+
 	nvic_set_priority(SWO_DMA_IRQ, IRQ_PRI_SWO_DMA);
 	nvic_enable_irq(SWO_DMA_IRQ);
+	usbd_register_sof_callback(usbdev, traceswo_sof);
 	traceswo_setspeed(baudrate);
 	traceswo_setmask(swo_chan_bitmask);
-	decoding = (swo_chan_bitmask != 0);
+	decoding = traceswo_decoding();
+	return baudrate;
 }
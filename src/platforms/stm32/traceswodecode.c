@@ -16,54 +16,254 @@
  * along with this program.	 If not, see <http://www.gnu.org/licenses/>.
  */
 
-/* Print decoded swo stream on the usb serial */
+/* Print decoded swo stream on the usb serial, or stdout when hosted */
 
 #include "general.h"
+#if PC_HOSTED == 0
 #include "usb_serial.h"
+#define SWO_BUF_SIZE CDCACM_PACKET_SIZE
+#else
+#define SWO_BUF_SIZE 256U
+#endif
 #include "traceswo.h"
+#if PC_HOSTED == 1
+#include "swo_if.h"
+#endif
+
+#include "profile.h"
+
+/* Hardware source packet discriminators */
+#define SWO_HW_EXCEPTION_TRACE 1U
+#define SWO_HW_PC_SAMPLE       2U
+/* Data value packets are 0b10, the comparator in 2 bits, then set for a write */
+#define SWO_HW_DATA_VALUE_MASK 0x18U
+#define SWO_HW_DATA_VALUE      0x10U
+
+/* Global timestamp packet headers, they look like extension packets otherwise */
+#define SWO_GTS1_HEADER 0x94U
+#define SWO_GTS2_HEADER 0xb4U
+#define SWO_OVERFLOW    0x70U
+/* A sync packet is at least 47 zero bits followed by a one */
+#define SWO_SYNC_ZEROS 5U
+/* Longest payload a packet with continuation bits can have */
+#define SWO_MAX_CONTINUATION 5U
+
+typedef enum swo_state {
+	SWO_STATE_HEADER,
+	SWO_STATE_PAYLOAD,      /* source packets, a known number of bytes */
+	SWO_STATE_CONTINUATION, /* timestamps and extensions, until a byte without continuation bit */
+} swo_state_e;
 
 /* SWO decoding */
 /* data is static in case swo packet is astride two buffers */
-static uint8_t swo_buf[CDCACM_PACKET_SIZE];
-static int swo_buf_len = 0;
+static uint8_t swo_buf[SWO_BUF_SIZE];
+static size_t swo_buf_len = 0;
 static uint32_t swo_decode = 0; /* bitmask of channels to print */
-static int swo_pkt_len = 0; /* decoder state */
-static bool swo_print = false;
+static bool swo_profile = false; /* hardware packets go to the profiler */
+static bool swo_records = false; /* all packets go out as records rather than text */
+static bool swo_data_trace = false; /* only data value packets go out, as records */
+/* decoder state */
+static swo_state_e swo_state = SWO_STATE_HEADER;
+static uint8_t swo_zeros = 0;
+static traceswo_record_e swo_pkt_kind;
+static uint8_t swo_pkt_id;
+static uint8_t swo_pkt_size;
+static uint8_t swo_pkt_got;
+static uint32_t swo_pkt_value;
+
+/* A complete hardware source packet */
+static void traceswo_decode_hw(void)
+{
+	if (swo_pkt_id == SWO_HW_PC_SAMPLE) {
+		/* A single byte sample says the core was sleeping */
+		if (swo_pkt_size == 4U)
+			profile_sample(swo_pkt_value);
+		else
+			profile_sleep_sample();
+	} else if (swo_pkt_id == SWO_HW_EXCEPTION_TRACE && swo_pkt_size == 2U)
+		profile_exception(swo_pkt_value & 0x1ffU, (profile_exception_event_e)((swo_pkt_value >> 12U) & 3U));
+}
+
+/* A complete packet of any kind, in swo_pkt_*, goes wherever it is wanted */
+static void traceswo_decode_packet(void)
+{
+	swo_state = SWO_STATE_HEADER;
+	if (swo_pkt_kind == TRACESWO_RECORD_HARDWARE && swo_profile)
+		traceswo_decode_hw();
+	if (swo_data_trace) {
+		/* Only the data value packets go out, the id becomes comparator and direction */
+		if (swo_pkt_kind != TRACESWO_RECORD_HARDWARE || (swo_pkt_id & SWO_HW_DATA_VALUE_MASK) != SWO_HW_DATA_VALUE)
+			return;
+		swo_pkt_kind = TRACESWO_RECORD_DATA_VALUE;
+		swo_pkt_id = ((swo_pkt_id & 1U) << 2U) | ((swo_pkt_id >> 1U) & 3U);
+	} else if (swo_pkt_kind == TRACESWO_RECORD_SOFTWARE && !(swo_decode & (1UL << swo_pkt_id)))
+		return;
+	if (swo_records || swo_data_trace) {
+		swo_buf[swo_buf_len++] = (swo_pkt_kind << TRACESWO_RECORD_KIND_SHIFT) | swo_pkt_id;
+		swo_buf[swo_buf_len++] = swo_pkt_got;
+	} else if (swo_pkt_kind != TRACESWO_RECORD_SOFTWARE)
+		return;
+#if PC_HOSTED == 1
+	else {
+		/* Text goes to the sink of its channel rather than along with the rest */
+		uint8_t text[4];
+		for (size_t i = 0; i < swo_pkt_got; ++i)
+			text[i] = (swo_pkt_value >> (8U * i)) & 0xffU;
+		swo_if_write(swo_pkt_id, text, swo_pkt_got);
+		return;
+	}
+#endif
+	for (size_t i = 0; i < swo_pkt_got; ++i)
+		swo_buf[swo_buf_len++] = (swo_pkt_value >> (8U * i)) & 0xffU;
+}
 
+static void traceswo_decode_start(const traceswo_record_e kind, const uint8_t id, const uint8_t size)
+{
+	swo_pkt_kind = kind;
+	swo_pkt_id = id;
+	swo_pkt_size = size;
+	swo_pkt_got = 0;
+	swo_pkt_value = 0;
+}
+
+static void traceswo_decode_header(const uint8_t ch)
+{
+	/* Zeros are the start of a sync packet, a one after enough of them ends it */
+	if (ch == 0U) {
+		if (swo_zeros < SWO_SYNC_ZEROS)
+			++swo_zeros;
+		return;
+	}
+	const bool sync = ch == 0x80U && swo_zeros == SWO_SYNC_ZEROS;
+	swo_zeros = 0;
+	if (sync) {
+		traceswo_decode_start(TRACESWO_RECORD_SYNC, 0, 0);
+		traceswo_decode_packet();
+	} else if (ch & 0x3U) { /* Source packet, the size code is 1, 2 or 4 bytes */
+		const bool hardware = ch & 0x4U;
+		traceswo_decode_start(hardware ? TRACESWO_RECORD_HARDWARE : TRACESWO_RECORD_SOFTWARE, ch >> 3U,
+			(ch & 0x3U) == 3U ? 4U : ch & 0x3U);
+		swo_state = SWO_STATE_PAYLOAD;
+	} else if (ch == SWO_OVERFLOW) {
+		traceswo_decode_start(TRACESWO_RECORD_OVERFLOW, 0, 0);
+		traceswo_decode_packet();
+	} else if ((ch & 0x0fU) == 0U) {
+		if (ch & 0x80U) {
+			/* Local timestamp format 1, the id is its relation to the packets around it */
+			traceswo_decode_start(TRACESWO_RECORD_LOCAL_TIMESTAMP, (ch >> 4U) & 0x3U, 0);
+			swo_state = SWO_STATE_CONTINUATION;
+		} else {
+			/* Local timestamp format 2, the time in the header and in sync with the packet */
+			traceswo_decode_start(TRACESWO_RECORD_LOCAL_TIMESTAMP, 0, 0);
+			swo_pkt_value = (ch >> 4U) & 0x7U;
+			swo_pkt_got = 1;
+			traceswo_decode_packet();
+		}
+	} else if (ch == SWO_GTS1_HEADER || ch == SWO_GTS2_HEADER) {
+		traceswo_decode_start(TRACESWO_RECORD_GLOBAL_TIMESTAMP, ch == SWO_GTS1_HEADER ? 1U : 2U, 0);
+		swo_state = SWO_STATE_CONTINUATION;
+	} else if ((ch & 0x7U) == 0x4U) {
+		/* Extension, the id is the SH bit and the first 3 bits of the value are in the header */
+		traceswo_decode_start(TRACESWO_RECORD_EXTENSION, (ch >> 3U) & 1U, 0);
+		swo_pkt_value = (ch >> 4U) & 0x7U;
+		swo_pkt_got = 1;
+		if (ch & 0x80U)
+			swo_state = SWO_STATE_CONTINUATION;
+		else
+			traceswo_decode_packet();
+	}
+	/* Anything else is reserved, and dropped */
+}
+
+/* Feed one byte of the swo stream to the decoder, true once swo_buf has no room for another record */
+static bool traceswo_decode_char(const uint8_t ch)
+{
+	switch (swo_state) {
+	case SWO_STATE_HEADER:
+		traceswo_decode_header(ch);
+		break;
+	case SWO_STATE_PAYLOAD:
+		swo_pkt_value |= (uint32_t)ch << (8U * swo_pkt_got);
+		if (++swo_pkt_got == swo_pkt_size)
+			traceswo_decode_packet();
+		break;
+	case SWO_STATE_CONTINUATION: {
+		/* 7 bits a byte, after the bits that came in the header if any */
+		const uint32_t shift = swo_pkt_kind == TRACESWO_RECORD_EXTENSION ? 7U * swo_pkt_got - 4U : 7U * swo_pkt_got;
+		if (shift < 32U)
+			swo_pkt_value |= (uint32_t)(ch & 0x7fU) << shift;
+		++swo_pkt_got;
+		if (!(ch & 0x80U) || swo_pkt_got == SWO_MAX_CONTINUATION) {
+			swo_pkt_got = MIN(swo_pkt_got, 4U);
+			traceswo_decode_packet();
+		}
+		break;
+	}
+	}
+	return swo_buf_len + TRACESWO_RECORD_MAX > sizeof(swo_buf);
+}
+
+#if PC_HOSTED == 0
 /* print decoded swo packet on usb serial */
 uint16_t traceswo_decode(usbd_device *usbd_dev, uint8_t addr,
 				const void *buf, uint16_t len) {
 	if (usbd_dev == NULL) return 0;
 	for (int i = 0; i<len; i++) {
-		uint8_t ch=((uint8_t*)buf)[i];
-		if (swo_pkt_len == 0) { /* header */
-			uint32_t channel = (uint32_t)ch >> 3; /* channel number */
-			uint32_t size = ch & 0x7; /* drop channel number */
-			if (size == 0x01) swo_pkt_len = 1;      /* SWO packet 0x01XX */
-			else if (size == 0x02) swo_pkt_len = 2; /* SWO packet 0x02XXXX */
-			else if (size == 0x03) swo_pkt_len = 4; /* SWO packet 0x03XXXXXXXX */
-			swo_print = (swo_pkt_len != 0) && ((swo_decode & (1UL << channel)) != 0UL);
-		} else if (swo_pkt_len <= 4) { /* data */
-			if (swo_print) {
-				swo_buf[swo_buf_len++]=ch;
-				if (swo_buf_len == sizeof(swo_buf)) {
-					if (usb_get_config() && gdb_uart_get_dtr()) /* silently drop if usb not ready */
-						usbd_ep_write_packet(usbd_dev, addr, swo_buf, swo_buf_len);
-					swo_buf_len=0;
-				}
-			}
-			--swo_pkt_len;
-		} else { /* recover */
+		if (traceswo_decode_char(((uint8_t*)buf)[i])) {
+			if (usb_get_config() && gdb_uart_get_dtr()) /* silently drop if usb not ready */
+				usbd_ep_write_packet(usbd_dev, addr, swo_buf, swo_buf_len);
 			swo_buf_len=0;
-			swo_pkt_len=0;
 		}
 	}
 	return len;
 }
+#else
+/* print decoded swo packets on the channels' sinks, without a channel mask the raw stream on stdout */
+void traceswo_decode(const void *buf, size_t len)
+{
+	if (!traceswo_decoding()) {
+		swo_if_write_stream(buf, len);
+		return;
+	}
+	for (size_t i = 0; i < len; ++i) {
+		if (traceswo_decode_char(((const uint8_t *)buf)[i]) || i + 1U == len) {
+			/* Nothing waits for the buffer to fill up here, so flush each chunk */
+			if (swo_buf_len)
+				swo_if_write_stream(swo_buf, swo_buf_len);
+			swo_buf_len = 0;
+		}
+	}
+	swo_if_flush();
+}
+#endif
 
 /* set bitmask of swo channels to be decoded */
 void traceswo_setmask(uint32_t mask) {
 	swo_decode = mask;
 }
 
+/* hand the hardware source packets to the profiler, or drop them */
+void traceswo_setprofile(bool enable)
+{
+	swo_profile = enable;
+}
+
+/* send every packet on the decoded channels as a record, rather than just their text */
+void traceswo_setrecords(bool enable)
+{
+	swo_records = enable;
+}
+
+/* send the data value packets as records and nothing else */
+void traceswo_setdatatrace(bool enable)
+{
+	swo_data_trace = enable;
+}
+
+/* false when the stream should be passed on raw */
+bool traceswo_decoding(void)
+{
+	return swo_decode || swo_profile || swo_records || swo_data_trace;
+}
+
 /* not truncated */
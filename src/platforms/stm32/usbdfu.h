@@ -34,7 +34,8 @@ void dfu_main(void);
 /* Device specific functions */
 void dfu_check_and_do_sector_erase(uint32_t sector);
 void dfu_flash_program_buffer(uint32_t baseaddr, void *buf, int len);
-uint32_t dfu_poll_timeout(uint8_t cmd, uint32_t addr, uint16_t blocknum);
+/* How long the erase or programming of a block takes, for the host to wait before asking */
+uint32_t dfu_poll_timeout(uint8_t cmd, uint32_t addr, uint16_t blocknum, uint16_t len);
 void dfu_protect(bool enable);
 void dfu_jump_app_if_valid(void);
 void dfu_event(void);
@@ -30,6 +30,7 @@
 
 #include "general.h"
 #include "usb.h"
+#include "stats.h"
 
 #ifdef DMA_STREAM0
 #define dma_channel_reset(dma, channel) dma_stream_reset(dma, channel)
@@ -50,35 +51,74 @@
 #define TX_LED_ACT (1 << 0)
 #define RX_LED_ACT (1 << 1)
 
-/* F072 with st_usbfs_v2_usb_drive drops characters at the 64 byte boundary!*/
-#if !defined(USART_DMA_BUF_SIZE)
-# define USART_DMA_BUF_SIZE 128
+/* USART_DMA_BUF_SIZE is set in ram_budget.h, F072 sets its own */
+/* The platform may size the directions apart, up to 64k each */
+#if !defined(USART_DMA_RX_BUF_SIZE)
+# define USART_DMA_RX_BUF_SIZE USART_DMA_BUF_SIZE
+#endif
+#if !defined(USART_DMA_TX_BUF_SIZE)
+# define USART_DMA_TX_BUF_SIZE USART_DMA_BUF_SIZE
+#endif
+#define RX_FIFO_SIZE (USART_DMA_RX_BUF_SIZE)
+#define TX_BUF_SIZE (USART_DMA_TX_BUF_SIZE)
+#if TX_BUF_SIZE < CDCACM_PACKET_SIZE
+#error "The USBUART TX buffer must hold a full USB packet"
 #endif
-#define RX_FIFO_SIZE (USART_DMA_BUF_SIZE)
-#define TX_BUF_SIZE (USART_DMA_BUF_SIZE)
 
 /* TX double buffer */
 static uint8_t buf_tx[TX_BUF_SIZE * 2];
 /* Active buffer part idx */
 static uint8_t buf_tx_act_idx;
 /* Active buffer part used capacity */
-static uint8_t buf_tx_act_sz;
+static uint16_t buf_tx_act_sz;
 /* TX transfer complete */
 static bool tx_trfr_cplt = true;
 /* RX Fifo buffer with space for copy fn overrun */
 static uint8_t buf_rx[RX_FIFO_SIZE + sizeof(uint64_t)];
 /* RX Fifo out pointer, writes assumed to be atomic */
-static uint8_t buf_rx_out;
+static uint16_t buf_rx_out;
 /* RX usb transfer complete */
 static bool rx_usb_trfr_cplt = true;
+/* Last RX packet was full size, the host needs a ZLP to end the transfer */
+static bool rx_zlp_pending;
+
+/*
+ * In framed mode every USB packet is one frame: a header of flags, data
+ * length and the 32 bit microsecond time the data was seen (little endian),
+ * then the data. The data is picked up from the FIFO on the IDLE and DMA
+ * half and full transfer interrupts, each of which leaves a mark with the
+ * time, so the stamps are late by at most the time to fill half the FIFO.
+ * Line errors are reported on the first frame of the data they came with.
+ */
+#define USBUART_FRAME_OVERRUN (1U << 0U)
+#define USBUART_FRAME_FRAMING (1U << 1U)
+#define USBUART_FRAME_PARITY  (1U << 2U)
+/* Probe debug output, see debug_bmp */
+#define USBUART_FRAME_DEBUG   (1U << 7U)
+#define USBUART_FRAME_HEADER  6U
+#define USBUART_MARKS         8U
+
+typedef struct usbuart_mark {
+	uint16_t pos;
+	uint8_t flags;
+	uint32_t time_us;
+} usbuart_mark_s;
+
+static bool usbuart_framed;
+/* FIFO positions the data up to arrived by a time, in and out run freely */
+static usbuart_mark_s rx_marks[USBUART_MARKS];
+static uint8_t rx_marks_in;
+static uint8_t rx_marks_out;
+/* Line errors seen by the USART ISR since the last mark */
+static uint8_t rx_line_errors;
 
 #ifdef USBUART_DEBUG
 /* Debug Fifo buffer with space for copy fn overrun */
 static uint8_t usb_dbg_buf[RX_FIFO_SIZE + sizeof(uint64_t)];
 /* Debug Fifo in pointer */
-static uint8_t usb_dbg_in;
+static uint16_t usb_dbg_in;
 /* Debug Fifo out pointer */
-static uint8_t usb_dbg_out;
+static uint16_t usb_dbg_out;
 #endif
 
 static void usbuart_run(void);
@@ -105,6 +145,30 @@ static void usbuart_set_led_state(uint8_t ledn, bool state)
 	}
 }
 
+#if defined(STM32F4)
+/*
+ * Sampling 8 times per bit instead of 16 doubles the top rate, e.g. to
+ * 5.25 Mbaud on the 42 MHz APB1. It tolerates less clock error and noise,
+ * so it is only used for rates out of reach of the default.
+ */
+static void usbuart_set_baudrate(const uint32_t baud)
+{
+	const bool apb2 = USBUSART == USART1 || USBUSART == USART6;
+	const uint32_t clock = apb2 ? rcc_apb2_frequency : rcc_apb1_frequency;
+	if (baud <= clock / 16U) {
+		USART_CR1(USBUSART) &= ~USART_CR1_OVER8;
+		usart_set_baudrate(USBUSART, baud);
+		return;
+	}
+	/* Divider in eighths, BRR keeps the fraction in its low three bits */
+	const uint32_t div = (clock + baud / 2U) / baud;
+	USART_CR1(USBUSART) |= USART_CR1_OVER8;
+	USART_BRR(USBUSART) = ((div >> 3U) << 4U) | (div & 7U);
+}
+#else
+#define usbuart_set_baudrate(baud) usart_set_baudrate(USBUSART, baud)
+#endif
+
 void usbuart_init(void)
 {
 	/* Enable clocks */
@@ -113,7 +177,7 @@ void usbuart_init(void)
 
 	/* Setup UART parameters */
 	UART_PIN_SETUP();
-	usart_set_baudrate(USBUSART, 38400);
+	usbuart_set_baudrate(38400);
 	usart_set_databits(USBUSART, 8);
 	usart_set_stopbits(USBUSART, USART_STOPBITS_1);
 	usart_set_mode(USBUSART, USART_MODE_TX_RX);
@@ -194,8 +258,12 @@ void usbuart_init(void)
 
 void usbuart_send_stdout(const uint8_t *data, uint32_t len)
 {
+	/* With no host to take the data, drop it rather than wait forever */
+	if (usb_get_config() != 1)
+		return;
 	while (len) {
-		uint32_t cnt = CDCACM_PACKET_SIZE;
+		/* Packets short of full size need no ZLP to be seen by the host */
+		uint32_t cnt = CDCACM_PACKET_SIZE - 1U;
 		if (cnt > len)
 			cnt = len;
 		nvic_disable_irq(USB_IRQ);
@@ -208,7 +276,7 @@ void usbuart_send_stdout(const uint8_t *data, uint32_t len)
 
 void usbuart_set_line_coding(struct usb_cdc_line_coding *coding)
 {
-	usart_set_baudrate(USBUSART, coding->dwDTERate);
+	usbuart_set_baudrate(coding->dwDTERate);
 
 	if (coding->bParityType)
 		usart_set_databits(USBUSART, (coding->bDataBits + 1 <= 8 ? 8 : 9));
@@ -346,6 +414,85 @@ size_t usbuart_debug_write(const char *buf, const size_t len)
 }
 #endif
 
+void usbuart_set_framed(const bool framed)
+{
+	nvic_disable_irq(USB_IRQ);
+	usbuart_framed = framed;
+	rx_marks_out = rx_marks_in;
+	nvic_enable_irq(USB_IRQ);
+}
+
+/* Called from the ISRs with the USB IRQ disabled */
+static void usbuart_mark_rx(void)
+{
+	const uint16_t pos = (RX_FIFO_SIZE - dma_get_number_of_data(USBUSART_DMA_BUS, USBUSART_DMA_RX_CHAN)) % RX_FIFO_SIZE;
+	const uint8_t flags = rx_line_errors;
+	rx_line_errors = 0;
+	const uint8_t used = rx_marks_in - rx_marks_out;
+	usbuart_mark_s *const last = &rx_marks[(uint8_t)(rx_marks_in - 1U) % USBUART_MARKS];
+	if (used && last->pos == pos) {
+		last->flags |= flags;
+		return;
+	}
+	if (!used && pos == buf_rx_out && !flags)
+		return;
+	/* Out of marks, the newest one takes the new data too */
+	if (used == USBUART_MARKS) {
+		last->pos = pos;
+		last->flags |= flags;
+		last->time_us = platform_time_us();
+		return;
+	}
+	usbuart_mark_s *const mark = &rx_marks[rx_marks_in % USBUART_MARKS];
+	mark->pos = pos;
+	mark->flags = flags;
+	mark->time_us = platform_time_us();
+	++rx_marks_in;
+}
+
+/*
+ * Send the FIFO data from start to end that fits in a packet as one frame.
+ * Returns false if the endpoint was busy, else sets len to the data sent.
+ */
+static bool usbuart_send_frame(const uint8_t flags, const uint32_t time_us, const uint8_t *const fifo,
+	const uint32_t start, const uint32_t end, uint32_t *const len)
+{
+	/* Reserve space for copy function overrun */
+	uint8_t packet_buf[CDCACM_PACKET_SIZE + sizeof(uint64_t)];
+	*len = copy_from_fifo(packet_buf + USBUART_FRAME_HEADER, fifo, start, end,
+		CDCACM_PACKET_SIZE - USBUART_FRAME_HEADER, RX_FIFO_SIZE);
+	packet_buf[0] = flags;
+	packet_buf[1] = *len;
+	memcpy(packet_buf + 2U, &time_us, sizeof(time_us));
+	const uint16_t written =
+		usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, packet_buf, USBUART_FRAME_HEADER + *len);
+	if (!written)
+		return false;
+	rx_zlp_pending = written == CDCACM_PACKET_SIZE;
+	return true;
+}
+
+/* The framed counterpart of the raw copy in usbuart_send_rx_packet() */
+static void usbuart_send_rx_frame(void)
+{
+	uint32_t len;
+#ifdef USBUART_DEBUG
+	if (usb_dbg_in != usb_dbg_out) {
+		if (usbuart_send_frame(USBUART_FRAME_DEBUG, platform_time_us(), usb_dbg_buf, usb_dbg_out, usb_dbg_in, &len))
+			usb_dbg_out = (usb_dbg_out + len) % RX_FIFO_SIZE;
+		return;
+	}
+#endif
+	/* Data past the newest mark waits for the next one */
+	usbuart_mark_s *const mark = &rx_marks[rx_marks_out % USBUART_MARKS];
+	if (!usbuart_send_frame(mark->flags, mark->time_us, buf_rx, buf_rx_out, mark->pos, &len))
+		return;
+	mark->flags = 0;
+	buf_rx_out = (buf_rx_out + len) % RX_FIFO_SIZE;
+	if (buf_rx_out == mark->pos)
+		++rx_marks_out;
+}
+
 /*
  * Runs deferred processing for USBUSART RX, draining RX FIFO by sending
  * characters to host PC via CDCACM. Allowed to write to FIFO OUT pointer.
@@ -358,46 +505,56 @@ static void usbuart_send_rx_packet(void)
 
 	/* Forcibly empty fifo if no USB endpoint.
 	 * If fifo empty, nothing further to do. */
-	if (usb_get_config() != 1 || (buf_rx_in == buf_rx_out
+	if (usb_get_config() != 1 || ((usbuart_framed ? rx_marks_in == rx_marks_out : buf_rx_in == buf_rx_out)
 #ifdef USBUART_DEBUG
 		&& usb_dbg_in == usb_dbg_out
 #endif
 	))
 	{
+		/* A full packet doesn't end the transfer, end it with a ZLP once drained */
+		if (rx_zlp_pending && usb_get_config() == 1) {
+			rx_zlp_pending = false;
+			usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, NULL, 0);
+			return;
+		}
+		rx_zlp_pending = false;
 #ifdef USBUART_DEBUG
 		usb_dbg_out = usb_dbg_in;
 #endif
 		buf_rx_out = buf_rx_in;
+		rx_marks_out = rx_marks_in;
 		/* Turn off LED */
 		usbuart_set_led_state(RX_LED_ACT, false);
 		rx_usb_trfr_cplt = true;
 	}
+	else if (usbuart_framed)
+		usbuart_send_rx_frame();
 	else
 	{
-		/* To avoid the need of sending ZLP don't transmit full packet.
-		 * Also reserve space for copy function overrun.
-		 */
-		uint8_t packet_buf[CDCACM_PACKET_SIZE - 1 + sizeof(uint64_t)];
+		/* Full packets, with space reserved for copy function overrun */
+		uint8_t packet_buf[CDCACM_PACKET_SIZE + sizeof(uint64_t)];
 		uint32_t packet_size;
 
 #ifdef USBUART_DEBUG
 		/* Copy data from DEBUG FIFO into local usb packet buffer */
-		packet_size = copy_from_fifo(packet_buf, usb_dbg_buf, usb_dbg_out, usb_dbg_in, CDCACM_PACKET_SIZE - 1, RX_FIFO_SIZE);
+		packet_size = copy_from_fifo(packet_buf, usb_dbg_buf, usb_dbg_out, usb_dbg_in, CDCACM_PACKET_SIZE, RX_FIFO_SIZE);
 		/* Send if buffer not empty */
 		if (packet_size)
 		{
 			const uint16_t written = usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, packet_buf, packet_size);
 			usb_dbg_out = (usb_dbg_out + written) % RX_FIFO_SIZE;
+			rx_zlp_pending = written == CDCACM_PACKET_SIZE;
 			return;
 		}
 #endif
 
 		/* Copy data from uart RX FIFO into local usb packet buffer */
-		packet_size = copy_from_fifo(packet_buf, buf_rx, buf_rx_out, buf_rx_in, CDCACM_PACKET_SIZE - 1, RX_FIFO_SIZE);
+		packet_size = copy_from_fifo(packet_buf, buf_rx, buf_rx_out, buf_rx_in, CDCACM_PACKET_SIZE, RX_FIFO_SIZE);
 
 		/* Advance fifo out pointer by amount written */
 		const uint16_t written = usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, packet_buf, packet_size);
 		buf_rx_out = (buf_rx_out + written) % RX_FIFO_SIZE;
+		rx_zlp_pending = written == CDCACM_PACKET_SIZE;
 	}
 }
 
@@ -413,6 +570,9 @@ static void usbuart_run(void)
 {
 	nvic_disable_irq(USB_IRQ);
 
+	if (usbuart_framed)
+		usbuart_mark_rx();
+
 	/* Enable LED */
 	usbuart_set_led_state(RX_LED_ACT, true);
 
@@ -429,6 +589,19 @@ static void usbuart_run(void)
 									\
 	/* Get IDLE flag and reset interrupt flags */ 			\
 	const bool isIdle = usart_get_flag(USART, USART_FLAG_IDLE);	\
+	if (usart_get_flag(USART, USART_FLAG_ORE)) {			\
+		STATS_INC(uart_overruns);				\
+		rx_line_errors |= USBUART_FRAME_OVERRUN;		\
+		USART_ICR(USART) = USART_ICR_ORECF;			\
+	}								\
+	if (usart_get_flag(USART, USART_FLAG_FE)) {			\
+		rx_line_errors |= USBUART_FRAME_FRAMING;		\
+		USART_ICR(USART) = USART_ICR_FECF;			\
+	}								\
+	if (usart_get_flag(USART, USART_FLAG_PE)) {			\
+		rx_line_errors |= USBUART_FRAME_PARITY;			\
+		USART_ICR(USART) = USART_ICR_PECF;			\
+	}								\
 	usart_recv(USART);						\
 									\
 	/* If line is now idle, then transmit a packet */		\
@@ -445,6 +618,15 @@ static void usbuart_run(void)
 									\
 	/* Get IDLE flag and reset interrupt flags */ 			\
 	const bool isIdle = usart_get_flag(USART, USART_FLAG_IDLE);	\
+	/* Cleared along with the others by reading DR below */		\
+	if (usart_get_flag(USART, USART_FLAG_ORE)) {			\
+		STATS_INC(uart_overruns);				\
+		rx_line_errors |= USBUART_FRAME_OVERRUN;		\
+	}								\
+	if (usart_get_flag(USART, USART_FLAG_FE))			\
+		rx_line_errors |= USBUART_FRAME_FRAMING;		\
+	if (usart_get_flag(USART, USART_FLAG_PE))			\
+		rx_line_errors |= USBUART_FRAME_PARITY;			\
 	usart_recv(USART);						\
 									\
 	/* If line is now idle, then transmit a packet */		\
@@ -60,7 +60,6 @@ extern bool debug_bmp;
 #define LED_UART	GPIO14
 
 #define PLATFORM_HAS_TRACESWO	1
-#define NUM_TRACE_PACKETS		(128)		/* This is an 8K buffer */
 #define TRACESWO_PROTOCOL		2			/* 1 = Manchester, 2 = NRZ / async */
 
 # define SWD_CR   GPIO_CRH(SWDIO_PORT)
@@ -146,6 +145,20 @@ extern bool debug_bmp;
 #define SWO_DMA_IRQ				NVIC_DMA1_CHANNEL6_IRQ
 #define SWO_DMA_ISR(x)			dma1_channel6_isr(x)
 
+/* Memory to memory DMA feeding the CRC unit in generic_crc32() */
+#define CRC_DMA_BUS  DMA1
+#define CRC_DMA_CLK  RCC_DMA1
+#define CRC_DMA_CHAN DMA_CHANNEL1
+
+/* PA3 is TIM2_CH4 too, its captures time the line to measure the baud rate */
+#define SWO_TIM					TIM2
+#define SWO_TIM_CLK_EN()		rcc_periph_clock_enable(RCC_TIM2)
+#define SWO_TIM_IC				TIM_IC4
+#define SWO_TIM_IC_IN			TIM_IC_IN_TI4
+#define SWO_TIM_CCR				TIM_CCR4(TIM2)
+#define SWO_TIM_SR_CCIF			TIM_SR_CC4IF
+#define SWO_TIM_SR_CCOF			TIM_SR_CC4OF
+
 #define LED_PORT GPIOC
 #define LED_IDLE_RUN GPIO15
 #define SET_RUN_STATE(state)
@@ -78,6 +78,26 @@ unsigned char gdb_if_getchar(void)
 	return buffer_out[tail_out++ % sizeof(buffer_out)];
 }
 
+size_t gdb_if_read_buf(void *const buf, const size_t max)
+{
+	uint8_t *const data = buf;
+	while (tail_out == head_out) {
+		/* Detach if port closed */
+		if (!gdb_uart_get_dtr()) {
+			data[0] = 0x04;
+			return 1;
+		}
+
+		while (usb_get_config() != 1)
+			continue;
+	}
+
+	size_t count = 0;
+	while (count < max && tail_out != head_out)
+		data[count++] = buffer_out[tail_out++ % sizeof(buffer_out)];
+	return count;
+}
+
 unsigned char gdb_if_getchar_to(int timeout)
 {
 	platform_timeout t;
@@ -76,8 +76,12 @@ void usbuart_init(void)
 
 void usbuart_send_stdout(const uint8_t *data, uint32_t len)
 {
+	/* With no host to take the data, drop it rather than wait forever */
+	if (usb_get_config() != 1)
+		return;
 	while (len) {
-		uint32_t cnt = CDCACM_PACKET_SIZE;
+		/* Packets short of full size need no ZLP to be seen by the host */
+		uint32_t cnt = CDCACM_PACKET_SIZE - 1U;
 		if (cnt > len)
 			cnt = len;
 		nvic_disable_irq(USBUART_IRQ);
@@ -0,0 +1,300 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements the PC sampling profiler behind "monitor profile"
+ * and "monitor traceswo profile". Samples are either taken from the GDB
+ * server's halt poll loop while the target runs, using the target's
+ * pc_sample hook (DWT_PCSR on Cortex-M), or arrive as the DWT's periodic
+ * PC sample packets over SWO. Either way the firmware being profiled needs
+ * no instrumentation.
+ *
+ * The histogram is a small open addressed hash table keyed by PC. When a PC
+ * finds no free bucket within a few probes its sample is counted as dropped,
+ * so a full table costs accuracy on the cold addresses only.
+ *
+ * With SWO the exception trace packets say which exception the core is in,
+ * so each sample is also counted against that exception. The samples being
+ * periodic, that is the share of time spent in each handler. The counters
+ * are bumped from the trace capture interrupt, a dump racing with it may be
+ * off by a sample, which is fine for what they are used for.
+ */
+
+#include "general.h"
+#include "profile.h"
+
+#if PC_HOSTED == 1
+#include <errno.h>
+
+#define PROFILE_BUCKETS 16384U
+#else
+#define PROFILE_BUCKETS 256U
+#endif
+#define PROFILE_PROBES 8U
+/* Samples taken per poll, they go out in one sequence where the probe can do that */
+#define PROFILE_BURST 16U
+/* Samples further apart than this mean the target was halted in between */
+#define PROFILE_GAP_MS 100U
+/* Distinct exceptions whose time is kept, thread mode included */
+#define PROFILE_EXCEPTIONS 32U
+
+typedef struct profile_bucket {
+	uint32_t pc;
+	uint32_t count;
+} profile_bucket_s;
+
+typedef struct profile_exception {
+	uint16_t number;
+	uint32_t entries;
+	uint32_t samples;
+} profile_exception_s;
+
+static struct {
+	bool active;
+	profile_source_e source;
+	uint32_t samples;
+	uint32_t dropped;
+	uint32_t sleeping;
+	uint32_t used;
+	uint32_t sampling_ms;
+	uint32_t last_sample;
+	profile_bucket_s bucket[PROFILE_BUCKETS];
+	/* Exception the core is in according to the exception trace, 0 for thread mode */
+	uint16_t current_exception;
+	size_t exceptions;
+	profile_exception_s exception[PROFILE_EXCEPTIONS];
+} profile;
+
+void profile_start(const profile_source_e source)
+{
+	memset(&profile, 0, sizeof(profile));
+	profile.source = source;
+	profile.active = true;
+	profile.last_sample = platform_time_ms();
+}
+
+void profile_stop(void)
+{
+	profile.active = false;
+}
+
+bool profile_polling(void)
+{
+	return profile.active && profile.source == PROFILE_SOURCE_PCSR;
+}
+
+/* Sampling time is only counted while samples keep coming */
+static void profile_tick(void)
+{
+	const uint32_t now = platform_time_ms();
+	if (now - profile.last_sample < PROFILE_GAP_MS)
+		profile.sampling_ms += now - profile.last_sample;
+	profile.last_sample = now;
+}
+
+static profile_exception_s *profile_exception_entry(const uint16_t number)
+{
+	for (size_t i = 0; i < profile.exceptions; ++i) {
+		if (profile.exception[i].number == number)
+			return &profile.exception[i];
+	}
+	if (profile.exceptions == PROFILE_EXCEPTIONS)
+		return NULL;
+	profile_exception_s *const entry = &profile.exception[profile.exceptions++];
+	entry->number = number;
+	return entry;
+}
+
+static void profile_count(const uint32_t pc)
+{
+	/* Fibonacci hashing, Thumb code has bit 0 clear so it carries nothing */
+	const uint32_t hash = ((pc >> 1U) * 2654435761U) % PROFILE_BUCKETS;
+	for (size_t i = 0; i < PROFILE_PROBES; ++i) {
+		profile_bucket_s *const bucket = &profile.bucket[(hash + i) % PROFILE_BUCKETS];
+		if (bucket->count && bucket->pc != pc)
+			continue;
+		if (!bucket->count) {
+			bucket->pc = pc;
+			++profile.used;
+		}
+		++bucket->count;
+		++profile.samples;
+		return;
+	}
+	++profile.dropped;
+}
+
+void profile_poll(target *const t)
+{
+	if (!profile_polling() || !t)
+		return;
+	profile_tick();
+
+	uint32_t pcs[PROFILE_BURST];
+	const size_t count = target_pc_sample(t, pcs, PROFILE_BURST);
+	for (size_t i = 0; i < count; ++i)
+		profile_count(pcs[i]);
+}
+
+/* A PC sample packet from the trace */
+void profile_sample(const uint32_t pc)
+{
+	if (!profile.active || profile.source != PROFILE_SOURCE_SWO)
+		return;
+	profile_tick();
+	profile_count(pc);
+	profile_exception_s *const exception = profile_exception_entry(profile.current_exception);
+	if (exception)
+		++exception->samples;
+}
+
+/* A PC sample packet taken while the core was sleeping, it carries no PC */
+void profile_sleep_sample(void)
+{
+	if (!profile.active || profile.source != PROFILE_SOURCE_SWO)
+		return;
+	profile_tick();
+	++profile.sleeping;
+}
+
+void profile_exception(const uint16_t number, const profile_exception_event_e event)
+{
+	if (!profile.active || profile.source != PROFILE_SOURCE_SWO)
+		return;
+	if (event == PROFILE_EXCEPTION_ENTERED) {
+		profile_exception_s *const exception = profile_exception_entry(number);
+		if (exception)
+			++exception->entries;
+	}
+	/* On exit the next packet says where the core returned to */
+	if (event != PROFILE_EXCEPTION_EXITED)
+		profile.current_exception = number;
+}
+
+static uint32_t profile_rate(void)
+{
+	return profile.sampling_ms ? (uint32_t)(((uint64_t)profile.samples * 1000U) / profile.sampling_ms) : 0;
+}
+
+void profile_print(void (*const print)(const char *fmt, ...), const bool counts)
+{
+	print("Profiling:        %s\n", profile.active ? "running" : "stopped");
+	print("Samples:          %" PRIu32 " in %" PRIu32 " ms (%" PRIu32 "/s), %" PRIu32 " dropped\n", profile.samples,
+		profile.sampling_ms, profile_rate(), profile.dropped);
+	print("Addresses:        %" PRIu32 " of %u buckets\n", profile.used, PROFILE_BUCKETS);
+	if (profile.source == PROFILE_SOURCE_SWO) {
+		print("Sleeping:         %" PRIu32 " samples\n", profile.sleeping);
+		for (size_t i = 0; i < profile.exceptions; ++i) {
+			const profile_exception_s *const exception = &profile.exception[i];
+			if (exception->number)
+				print("Exception %3u:    %" PRIu32 " entries, %" PRIu32 " samples\n", (unsigned)exception->number,
+					exception->entries, exception->samples);
+			else
+				print("Thread mode:      %" PRIu32 " samples\n", exception->samples);
+		}
+	}
+	if (!counts)
+		return;
+	for (size_t i = 0; i < PROFILE_BUCKETS; ++i) {
+		if (profile.bucket[i].count)
+			print("0x%08" PRIx32 " %" PRIu32 "\n", profile.bucket[i].pc, profile.bucket[i].count);
+	}
+}
+
+#if PC_HOSTED == 1
+/* gprof has no use for a histogram much bigger than this */
+#define PROFILE_GMON_MAX_BINS (1U << 20U)
+
+#define GMON_TAG_TIME_HIST 0U
+
+static void profile_put32(uint8_t *const data, const uint32_t value)
+{
+	data[0] = value & 0xffU;
+	data[1] = (value >> 8U) & 0xffU;
+	data[2] = (value >> 16U) & 0xffU;
+	data[3] = value >> 24U;
+}
+
+/*
+ * Writes the histogram as a gmon.out holding just a time histogram record,
+ * little endian with 32 bit addresses as gprof expects for an ARM ELF.
+ * The bins are a halfword each, or wider if the sampled range is too large.
+ */
+bool profile_write_gmon(const char *const filename)
+{
+	uint32_t low_pc = UINT32_MAX;
+	uint64_t high_pc = 0;
+	for (size_t i = 0; i < PROFILE_BUCKETS; ++i) {
+		if (!profile.bucket[i].count)
+			continue;
+		low_pc = MIN(low_pc, profile.bucket[i].pc & ~1U);
+		high_pc = MAX(high_pc, (uint64_t)(profile.bucket[i].pc & ~1U) + 2U);
+	}
+	if (!profile.used) {
+		low_pc = 0;
+		high_pc = 2;
+	}
+	uint32_t bin_size = 2;
+	while ((high_pc - low_pc + bin_size - 1U) / bin_size > PROFILE_GMON_MAX_BINS)
+		bin_size <<= 1U;
+	const uint32_t bins = (high_pc - low_pc + bin_size - 1U) / bin_size;
+	/* The end of the address space can't be represented, lose the last bin's worth */
+	high_pc = MIN((uint64_t)low_pc + (uint64_t)bins * bin_size, UINT32_MAX);
+
+	uint32_t *const hist = calloc(bins, sizeof(*hist));
+	if (!hist) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return false;
+	}
+	uint32_t max_count = 0;
+	for (size_t i = 0; i < PROFILE_BUCKETS; ++i) {
+		if (!profile.bucket[i].count)
+			continue;
+		uint32_t *const bin = &hist[((profile.bucket[i].pc & ~1U) - low_pc) / bin_size];
+		*bin += profile.bucket[i].count;
+		max_count = MAX(max_count, *bin);
+	}
+	/* gprof counts are 16 bit, scale them down along with the rate so the times stay right */
+	const uint32_t scale = max_count / (UINT16_MAX + 1U) + 1U;
+
+	FILE *const file = fopen(filename, "wb");
+	if (!file) {
+		DEBUG_WARN("Can not open %s: %s\n", filename, strerror(errno));
+		free(hist);
+		return false;
+	}
+	uint8_t header[20] = {'g', 'm', 'o', 'n'};
+	profile_put32(header + 4, 1);
+	uint8_t record[1 + 16 + 16] = {GMON_TAG_TIME_HIST};
+	profile_put32(record + 1, low_pc);
+	profile_put32(record + 5, (uint32_t)high_pc);
+	profile_put32(record + 9, bins);
+	profile_put32(record + 13, MAX(profile_rate() / scale, 1U));
+	memcpy(record + 17, "seconds", 7);
+	record[32] = 's';
+	bool ok = fwrite(header, sizeof(header), 1, file) == 1 && fwrite(record, sizeof(record), 1, file) == 1;
+	for (size_t i = 0; ok && i < bins; ++i) {
+		const uint32_t scaled = hist[i] / scale;
+		const uint8_t count[2] = {scaled & 0xffU, scaled >> 8U};
+		ok = fwrite(count, sizeof(count), 1, file) == 1;
+	}
+	ok = fclose(file) == 0 && ok;
+	free(hist);
+	if (!ok)
+		DEBUG_WARN("Writing %s failed\n", filename);
+	return ok;
+}
+#endif
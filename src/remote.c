@@ -30,6 +30,10 @@
 #include "target/adiv5.h"
 #include "target.h"
 #include "hex_utils.h"
+#include "crc32.h"
+#if PC_HOSTED == 0 && defined(PLATFORM_HAS_TRACESWO)
+#include "traceswo.h"
+#endif
 
 #define NTOH(x)    (((x) <= 9) ? (x) + '0' : 'a' + (x) - 10)
 #define HTON(x)    (((x) <= '9') ? (x) - '0' : ((TOUPPER(x)) - 'A' + 10))
@@ -50,27 +54,44 @@ uint64_t remotehston(const uint32_t max, const char *const str)
 }
 
 #if PC_HOSTED == 0
+/* Both the GDB port and the remote interface take frames of REMOTE_PACKET_BUFFER_SIZE */
+#define REMOTE_PROBE_BIN_MAX_LEN REMOTE_BIN_MAX_LEN(REMOTE_PACKET_BUFFER_SIZE)
+
+/* Replies go back, and binary payloads come in, over whichever channel carried the request */
+static void (*remote_putchar)(unsigned char c, int flush) = gdb_if_putchar;
+static void (*remote_getraw)(void *buf, size_t len) = gdb_getraw;
+
 static void remote_send_buf(uint8_t *buffer, size_t len)
 {
 	uint8_t *p = buffer;
-	char hex[2];
+	char hex[3];
 	do {
 		hexify(hex, (const void *)p++, 1);
 
-		gdb_if_putchar(hex[0], 0);
-		gdb_if_putchar(hex[1], 0);
+		remote_putchar(hex[0], 0);
+		remote_putchar(hex[1], 0);
 
 	} while (p < (buffer + len));
 }
 
 static void remote_respond_buf(char respCode, uint8_t *buffer, size_t len)
 {
-	gdb_if_putchar(REMOTE_RESP, 0);
-	gdb_if_putchar(respCode, 0);
+	remote_putchar(REMOTE_RESP, 0);
+	remote_putchar(respCode, 0);
 
 	remote_send_buf(buffer, len);
 
-	gdb_if_putchar(REMOTE_EOM, 1);
+	remote_putchar(REMOTE_EOM, 1);
+}
+
+/* Send a binary response, the far end knows how many bytes to expect */
+static void remote_respond_raw(const uint8_t *const buffer, const size_t len)
+{
+	remote_putchar(REMOTE_RESP, 0);
+	remote_putchar(REMOTE_RESP_OK, 0);
+	for (size_t i = 0; i < len; ++i)
+		remote_putchar(buffer[i], 0);
+	remote_putchar(REMOTE_EOM, 1);
 }
 
 /* Send response to far end */
@@ -79,8 +100,8 @@ static void remote_respond(char respCode, uint64_t param)
 	char buf[35]; /*Response, code, EOM and 2*16 hex nibbles*/
 	char *p = buf;
 
-	gdb_if_putchar(REMOTE_RESP, 0);
-	gdb_if_putchar(respCode, 0);
+	remote_putchar(REMOTE_RESP, 0);
+	remote_putchar(respCode, 0);
 
 	do {
 		*p++ = NTOH((param & 0x0f));
@@ -89,25 +110,25 @@ static void remote_respond(char respCode, uint64_t param)
 
 	/* At this point the number to print is the buf, but backwards, so spool it out */
 	do {
-		gdb_if_putchar(*--p, 0);
+		remote_putchar(*--p, 0);
 	} while (p > buf);
-	gdb_if_putchar(REMOTE_EOM, 1);
+	remote_putchar(REMOTE_EOM, 1);
 }
 
 static void remote_respond_string(char respCode, const char *s)
 /* Send response to far end */
 {
-	gdb_if_putchar(REMOTE_RESP, 0);
-	gdb_if_putchar(respCode, 0);
+	remote_putchar(REMOTE_RESP, 0);
+	remote_putchar(respCode, 0);
 	while (*s) {
 		/* Just clobber illegal characters so they don't disturb the protocol */
 		if ((*s == '$') || (*s == REMOTE_SOM) || (*s == REMOTE_EOM))
-			gdb_if_putchar(' ', 0);
+			remote_putchar(' ', 0);
 		else
-			gdb_if_putchar(*s, 0);
+			remote_putchar(*s, 0);
 		s++;
 	}
-	gdb_if_putchar(REMOTE_EOM, 1);
+	remote_putchar(REMOTE_EOM, 1);
 }
 
 static ADIv5_DP_t remote_dp = {
@@ -115,8 +136,129 @@ static ADIv5_DP_t remote_dp = {
 	.ap_write = firmware_ap_write,
 	.mem_read = firmware_mem_read,
 	.mem_write_sized = firmware_mem_write_sized,
+	.mem_wait32 = firmware_mem_wait32,
+	.sequence = firmware_sequence,
 };
 
+/* Characters an SB or JB step takes up, 0 if it isn't one */
+static size_t remote_batch_step_len(const char step)
+{
+	switch (step) {
+	case REMOTE_IN:
+	case REMOTE_IN_PAR:
+		return 3U;
+	case REMOTE_OUT:
+	case REMOTE_OUT_PAR:
+	case REMOTE_TMS:
+		return 11U;
+	case REMOTE_TDITDO_TMS:
+	case REMOTE_TDITDO_NOTMS:
+	case REMOTE_TDI_TMS:
+	case REMOTE_TDI_NOTMS:
+		return 19U;
+	default:
+		return 0;
+	}
+}
+
+/* Bytes of reply an SB or JB step adds */
+static size_t remote_batch_step_reply(const char step, const size_t ticks)
+{
+	switch (step) {
+	case REMOTE_IN:
+	case REMOTE_IN_PAR:
+		return sizeof(uint32_t);
+	case REMOTE_TDITDO_TMS:
+	case REMOTE_TDITDO_NOTMS:
+		return (ticks + 7U) >> 3U;
+	default:
+		return 0;
+	}
+}
+
+/* Checks the steps of an SB or JB as a whole before any of them run */
+static bool remote_batch_check(const char *step, const char *const end, const bool jtag)
+{
+	size_t reply = 0;
+	while (step < end) {
+		const size_t len = remote_batch_step_len(*step);
+		if (!len || len > (size_t)(end - step))
+			return false;
+		const bool swd_step = len == 3U || *step == REMOTE_OUT || *step == REMOTE_OUT_PAR;
+		const size_t ticks = remotehston(2, step + 1);
+		if (swd_step == jtag || ticks > (len == 19U ? 64U : 32U))
+			return false;
+		reply += remote_batch_step_reply(*step, ticks);
+		if (reply > REMOTE_BATCH_MAX_CAPTURE)
+			return false;
+		step += len;
+	}
+	return true;
+}
+
+/* SB = Run a list of SWD sequences, replying with what the reads returned */
+static void remote_swd_batch(const char *packet, const char *const end)
+{
+	if (!remote_batch_check(packet, end, false)) {
+		remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+		return;
+	}
+	uint32_t results[REMOTE_BATCH_MAX_CAPTURE / sizeof(uint32_t)];
+	size_t count = 0;
+	bool bad_parity = false;
+	for (; packet < end; packet += remote_batch_step_len(*packet)) {
+		const size_t ticks = remotehston(2, packet + 1);
+		switch (*packet) {
+		case REMOTE_IN:
+			results[count++] = remote_dp.seq_in(ticks);
+			break;
+		case REMOTE_IN_PAR:
+			bad_parity |= remote_dp.seq_in_parity(&results[count++], ticks);
+			break;
+		case REMOTE_OUT:
+			remote_dp.seq_out(remotehston(8, packet + 3), ticks);
+			break;
+		default:
+			remote_dp.seq_out_parity(remotehston(8, packet + 3), ticks);
+			break;
+		}
+	}
+	const char response = bad_parity ? REMOTE_RESP_PARERR : REMOTE_RESP_OK;
+	if (count)
+		remote_respond_buf(response, (uint8_t *)results, count * sizeof(results[0]));
+	else
+		remote_respond(response, 0);
+}
+
+/* JB = Run a list of TMS and TDI sequences, replying with all the TDO they captured */
+static void remote_jtag_batch(const char *packet, const char *const end)
+{
+	if (!remote_batch_check(packet, end, true)) {
+		remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+		return;
+	}
+	uint8_t tdo[REMOTE_BATCH_MAX_CAPTURE];
+	size_t captured = 0;
+	for (; packet < end; packet += remote_batch_step_len(*packet)) {
+		const size_t ticks = remotehston(2, packet + 1);
+		if (*packet == REMOTE_TMS) {
+			jtag_proc.jtagtap_tms_seq(remotehston(8, packet + 3), ticks);
+			continue;
+		}
+		const uint64_t data_in = remotehston(16, packet + 3);
+		const bool final_tms = *packet == REMOTE_TDITDO_TMS || *packet == REMOTE_TDI_TMS;
+		if (*packet == REMOTE_TDITDO_TMS || *packet == REMOTE_TDITDO_NOTMS) {
+			jtag_proc.jtagtap_tdi_tdo_seq(tdo + captured, final_tms, (const uint8_t *)&data_in, ticks);
+			captured += remote_batch_step_reply(*packet, ticks);
+		} else
+			jtag_proc.jtagtap_tdi_seq(final_tms, (const uint8_t *)&data_in, ticks);
+	}
+	if (captured)
+		remote_respond_buf(REMOTE_RESP_OK, tdo, captured);
+	else
+		remote_respond(REMOTE_RESP_OK, 0);
+}
+
 static void remote_packet_process_swd(unsigned i, char *packet)
 {
 	uint8_t ticks;
@@ -162,6 +304,10 @@ static void remote_packet_process_swd(unsigned i, char *packet)
 		remote_respond(REMOTE_RESP_OK, 0);
 		break;
 
+	case REMOTE_BATCH: /* SB = Batch of SWD sequences ================= */
+		remote_swd_batch(packet + 2, packet + i);
+		break;
+
 	default:
 		remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_UNRECOGNISED);
 		break;
@@ -252,6 +398,10 @@ static void remote_packet_process_jtag(unsigned i, char *packet)
 		}
 		break;
 
+	case REMOTE_BATCH: /* JB = Batch of TMS and TDI/TDO sequences ====== */
+		remote_jtag_batch(packet + 2, packet + i);
+		break;
+
 	default:
 		remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_UNRECOGNISED);
 		break;
@@ -322,16 +472,136 @@ static void remotePacketProcessGEN(unsigned i, char *packet)
 		remote_respond(REMOTE_RESP_OK, 0);
 		break;
 
+	case REMOTE_WAIT_POLICY:
+		adiv5_wait_policy.idle_cycles = remotehston(2, packet + 2);
+		adiv5_wait_policy.backoff_max = remotehston(2, packet + 4);
+		adiv5_wait_policy.adaptive = packet[6] == '1';
+		adiv5_wait_policy.timeout_ms = remotehston(8, packet + 7);
+		remote_respond(REMOTE_RESP_OK, 0);
+		break;
+
+	case REMOTE_TRACESWO: {
+#if PC_HOSTED == 0 && defined(PLATFORM_HAS_TRACESWO)
+		/* Nothing decoded here, the host does that with the stream from the trace endpoint */
+		traceswo_setprofile(false);
+		traceswo_setrecords(false);
+		traceswo_setdatatrace(false);
+#if defined TRACESWO_PROTOCOL && TRACESWO_PROTOCOL == 2
+		const uint32_t baudrate = traceswo_init(remotehston(8, packet + 2), 0);
+		remote_respond(baudrate ? REMOTE_RESP_OK : REMOTE_RESP_ERR, baudrate);
+#else
+		traceswo_init(0);
+		remote_respond(REMOTE_RESP_OK, 0);
+#endif
+#else
+		remote_respond(REMOTE_RESP_NOTSUP, 0);
+#endif
+		break;
+	}
+
     default:
 		remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_UNRECOGNISED);
 		break;
     }
 }
 
+static int remote_crc32_read(void *priv, void *dest, uint32_t src, size_t len)
+{
+	ADIv5_AP_t *ap = (ADIv5_AP_t *)priv;
+	adiv5_mem_read(ap, dest, src, len);
+	return ap->dp->fault;
+}
+
+/* Decode one HQ step, returns the number of characters it took up or 0 if it is malformed */
+static size_t remote_seq_decode(const char *const packet, const size_t len, adiv5_seq_op_t *const op)
+{
+	size_t addr_len = 8;
+	size_t fields = 0;
+	switch (packet[0]) {
+	case REMOTE_SEQ_DP_READ:
+		op->type = ADIV5_SEQ_DP_READ;
+		addr_len = 4;
+		break;
+	case REMOTE_SEQ_DP_WRITE:
+		op->type = ADIV5_SEQ_DP_WRITE;
+		addr_len = 4;
+		fields = 1;
+		break;
+	case REMOTE_SEQ_AP_READ:
+		op->type = ADIV5_SEQ_AP_READ;
+		addr_len = 4;
+		break;
+	case REMOTE_SEQ_AP_WRITE:
+		op->type = ADIV5_SEQ_AP_WRITE;
+		addr_len = 4;
+		fields = 1;
+		break;
+	case REMOTE_SEQ_MEM_READ:
+		op->type = ADIV5_SEQ_MEM_READ;
+		break;
+	case REMOTE_SEQ_MEM_WRITE:
+		op->type = ADIV5_SEQ_MEM_WRITE;
+		fields = 1;
+		break;
+	case REMOTE_SEQ_MEM_WAIT:
+		op->type = ADIV5_SEQ_MEM_WAIT;
+		fields = 3;
+		break;
+	case REMOTE_SEQ_DELAY:
+		op->type = ADIV5_SEQ_DELAY;
+		break;
+	default:
+		return 0;
+	}
+	const size_t op_len = 1U + addr_len + fields * 8U;
+	if (op_len > len)
+		return 0;
+	op->addr = remotehston(addr_len, packet + 1);
+	uint32_t field[3] = {0};
+	for (size_t i = 0; i < fields; ++i)
+		field[i] = remotehston(8, packet + 1 + addr_len + i * 8U);
+	if (op->type == ADIV5_SEQ_MEM_WAIT) {
+		op->value = 0;
+		op->mask = field[0];
+		op->busy_value = field[1];
+		op->timeout_ms = field[2];
+	} else
+		op->value = field[0];
+	return op_len;
+}
+
+/* HQ = Run a list of steps, checked as a whole before the first of them runs */
+static void remote_sequence(ADIv5_AP_t *const ap, const char *packet, const char *const end)
+{
+	adiv5_seq_op_t op;
+	size_t steps = 0;
+	for (const char *step = packet; step < end; ++steps) {
+		const size_t op_len = steps < REMOTE_SEQ_MAX_OPS ? remote_seq_decode(step, end - step, &op) : 0;
+		if (!op_len) {
+			remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+			return;
+		}
+		step += op_len;
+	}
+
+	uint32_t results[REMOTE_SEQ_MAX_OPS];
+	for (size_t i = 0; i < steps; ++i) {
+		packet += remote_seq_decode(packet, end - packet, &op);
+		if (!adiv5_sequence(ap, &op, 1)) {
+			remote_respond(REMOTE_RESP_ERR, 0);
+			ap->dp->fault = 0;
+			adiv5_dp_invalidate_cache(ap->dp);
+			return;
+		}
+		results[i] = op.value;
+	}
+	remote_respond_buf(REMOTE_RESP_OK, (uint8_t *)results, steps * sizeof(results[0]));
+}
+
 static void remotePacketProcessHL(unsigned i, char *packet)
 
 {
-	(void)i;
+	const char *const end = packet + i;
 	SET_IDLE_STATE(0);
 
 	ADIv5_AP_t remote_ap;
@@ -342,10 +612,19 @@ static void remotePacketProcessHL(unsigned i, char *packet)
 		remote_respond(REMOTE_RESP_OK, REMOTE_HL_VERSION);
 		return;
 	}
+	if (index == REMOTE_HL_FRAME_SIZE) {
+		remote_respond(REMOTE_RESP_OK, REMOTE_PACKET_BUFFER_SIZE);
+		return;
+	}
 	packet += 2;
-	remote_dp.dp_jd_index = remotehston(2, packet);
+	const uint8_t jd_index = remotehston(2, packet);
 	packet += 2;
-	remote_ap.apsel = remotehston(2, packet);
+	const uint8_t apsel = remotehston(2, packet);
+	/* remote_dp and remote_ap stand in for whichever DP and AP the host addresses */
+	if (jd_index != remote_dp.dp_jd_index || apsel != remote_ap.apsel)
+		adiv5_dp_invalidate_cache(&remote_dp);
+	remote_dp.dp_jd_index = jd_index;
+	remote_ap.apsel = apsel;
 	remote_ap.dp = &remote_dp;
 	switch (index) {
 	case REMOTE_DP_READ:  /* Hd = Read from DP register */
@@ -360,6 +639,8 @@ static void remotePacketProcessHL(unsigned i, char *packet)
 		packet += 4;
 		uint32_t value = remotehston(8, packet);
 		data = remote_dp.low_access(&remote_dp, remote_ap.apsel, addr16, value);
+		/* The host may have changed SELECT, CSW or TAR behind our back */
+		adiv5_dp_invalidate_cache(&remote_dp);
 		remote_respond_buf(REMOTE_RESP_OK, (uint8_t*)&data, 4);
 		break;
 	case REMOTE_AP_READ: /* Ha = Read from AP register*/
@@ -394,6 +675,7 @@ static void remotePacketProcessHL(unsigned i, char *packet)
 		}
 		remote_respond(REMOTE_RESP_ERR, 0);
 		remote_ap.dp->fault = 0;
+		adiv5_dp_invalidate_cache(remote_ap.dp);
 		break;
 	case REMOTE_AP_MEM_WRITE_SIZED: /* Hm = Write to memory and set csw */
 		packet += 2;
@@ -413,6 +695,8 @@ static void remotePacketProcessHL(unsigned i, char *packet)
 			remote_respond(REMOTE_RESP_ERR, 0);
 			break;
 		}
+		/* Only worth reading CFG for when double words are asked for */
+		remote_ap.large_data = align == ALIGN_DWORD && (adiv5_ap_read(&remote_ap, ADIV5_AP_CFG) & ADIV5_AP_CFG_LD);
 		/* Read as stream of hexified bytes*/
 		unhexify(src, packet, len);
 		adiv5_mem_write_sized(&remote_ap, dest, src, len, align);
@@ -420,10 +704,103 @@ static void remotePacketProcessHL(unsigned i, char *packet)
 			/* Errors handles on hosted side.*/
 			remote_respond(REMOTE_RESP_ERR, 0);
 			remote_ap.dp->fault = 0;
+			adiv5_dp_invalidate_cache(remote_ap.dp);
 			break;
 		}
 		remote_respond(REMOTE_RESP_OK, 0);
 		break;
+	case REMOTE_AP_MEM_READ_BIN: /* HB = Read from Mem, set csw, reply in binary */
+		packet += 2;
+		remote_ap.csw = remotehston(8, packet);
+		packet += 8;
+		address = remotehston(8, packet);
+		packet += 8;
+		count = remotehston(8, packet);
+		if (count > REMOTE_PROBE_BIN_MAX_LEN) {
+			remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+			break;
+		}
+		adiv5_mem_read(&remote_ap, src, address, count);
+		if (remote_ap.dp->fault == 0) {
+			remote_respond_raw(src, count);
+			break;
+		}
+		remote_respond(REMOTE_RESP_ERR, 0);
+		remote_ap.dp->fault = 0;
+		adiv5_dp_invalidate_cache(remote_ap.dp);
+		break;
+	case REMOTE_AP_MEM_WRITE_BIN: /* HW = Write to memory, set csw, binary payload follows */
+		packet += 2;
+		remote_ap.csw = remotehston(8, packet);
+		packet += 8;
+		align = remotehston(2, packet);
+		packet += 2;
+		dest = remotehston(8, packet);
+		packet += 8;
+		len = remotehston(8, packet);
+		/* The payload has to be consumed even if it is going to be refused */
+		if (len > REMOTE_PROBE_BIN_MAX_LEN) {
+			for (size_t offset = 0; offset < len; offset += REMOTE_PROBE_BIN_MAX_LEN)
+				remote_getraw(src, MIN(len - offset, REMOTE_PROBE_BIN_MAX_LEN));
+			remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+			break;
+		}
+		remote_getraw(src, len);
+		if (len & ((1 << align) - 1)) {
+			remote_respond(REMOTE_RESP_ERR, 0);
+			break;
+		}
+		remote_ap.large_data = align == ALIGN_DWORD && (adiv5_ap_read(&remote_ap, ADIV5_AP_CFG) & ADIV5_AP_CFG_LD);
+		adiv5_mem_write_sized(&remote_ap, dest, src, len, align);
+		if (remote_ap.dp->fault) {
+			remote_respond(REMOTE_RESP_ERR, 0);
+			remote_ap.dp->fault = 0;
+			adiv5_dp_invalidate_cache(remote_ap.dp);
+			break;
+		}
+		remote_respond(REMOTE_RESP_OK, 0);
+		break;
+	case REMOTE_AP_MEM_WAIT: /* HP = Poll a word while it reads as busy, set csw */
+		packet += 2;
+		remote_ap.csw = remotehston(8, packet);
+		packet += 8;
+		address = remotehston(8, packet);
+		packet += 8;
+		value = remotehston(8, packet);
+		packet += 8;
+		const uint32_t busy_value = remotehston(8, packet);
+		packet += 8;
+		const uint32_t timeout_ms = remotehston(8, packet);
+		data = adiv5_mem_wait32(&remote_ap, address, value, busy_value, timeout_ms);
+		if (remote_ap.dp->fault == 0) {
+			remote_respond_buf(REMOTE_RESP_OK, (uint8_t *)&data, 4);
+			break;
+		}
+		remote_respond(REMOTE_RESP_ERR, 0);
+		remote_ap.dp->fault = 0;
+		adiv5_dp_invalidate_cache(remote_ap.dp);
+		break;
+	case REMOTE_AP_MEM_CRC32: /* Hc = CRC32 of a memory range, set csw */
+		packet += 2;
+		remote_ap.csw = remotehston(8, packet);
+		packet += 8;
+		address = remotehston(8, packet);
+		packet += 8;
+		count = remotehston(8, packet);
+		if (crc32_range(remote_crc32_read, &remote_ap, &data, address, count) == 0) {
+			remote_respond(REMOTE_RESP_OK, data);
+			break;
+		}
+		remote_respond(REMOTE_RESP_ERR, 0);
+		remote_ap.dp->fault = 0;
+		adiv5_dp_invalidate_cache(remote_ap.dp);
+		break;
+	case REMOTE_AP_SEQUENCE: /* HQ = Run a list of DP, AP and memory steps, set csw */
+		packet += 2;
+		remote_ap.csw = remotehston(8, packet);
+		packet += 8;
+		remote_sequence(&remote_ap, packet, end);
+		break;
 	default:
 		remote_respond(REMOTE_RESP_ERR,REMOTE_ERROR_UNRECOGNISED);
 		break;
@@ -436,10 +813,13 @@ void remotePacketProcess(unsigned i, char *packet)
 {
 	switch (packet[0]) {
     case REMOTE_SWDP_PACKET:
+		/* Raw SWD and JTAG traffic from the host bypasses the high level shadows */
+		adiv5_dp_invalidate_cache(&remote_dp);
 		remote_packet_process_swd(i,packet);
 		break;
 
     case REMOTE_JTAG_PACKET:
+		adiv5_dp_invalidate_cache(&remote_dp);
 		remote_packet_process_jtag(i,packet);
 		break;
 
@@ -456,4 +836,14 @@ void remotePacketProcess(unsigned i, char *packet)
 		break;
     }
 }
+
+void remote_packet_process_via(void (*putchar_fn)(unsigned char c, int flush),
+	void (*getraw_fn)(void *buf, size_t len), unsigned i, char *packet)
+{
+	remote_putchar = putchar_fn;
+	remote_getraw = getraw_fn;
+	remotePacketProcess(i, packet);
+	remote_putchar = gdb_if_putchar;
+	remote_getraw = gdb_getraw;
+}
 #endif
@@ -24,7 +24,7 @@
 #include <inttypes.h>
 #include "general.h"
 
-#define REMOTE_HL_VERSION 2
+#define REMOTE_HL_VERSION 9
 
 /*
  * Commands to remote end, and responses
@@ -46,6 +46,37 @@
  *       resp: F<PARAM> - hex value returned, bad parity.
  *             X<err>   - error occured
  *
+ * From HL version 3 on, memory data can also travel as raw binary. The
+ * binary read and write commands carry the payload length in their header,
+ * the payload itself follows the command's '#' (write) or the response
+ * code (read) as exactly that many raw bytes, so it is never scanned for
+ * the framing characters.
+ *
+ * From HL version 7 on, HQ carries a list of DP, AP and memory steps that
+ * the probe runs back to back. Each step is its REMOTE_SEQ_* type followed
+ * by its fields as hex: a 4 digit register or 8 digit memory address, then
+ * any value (writes) or mask, busy value and timeout (waits). Delays only
+ * carry their length in ms. The response holds the value of every step,
+ * hexified like HM data, or an error if a step faulted, in which case none
+ * of the steps after it have run.
+ *
+ * From HL version 8 on, SB and JB likewise carry a list of bit level SWD
+ * and JTAG operations, each its command letter followed by its tick count
+ * as 2 hex digits. SWD outputs ('o', 'O') then have their 8 digit value,
+ * JTAG TMS sequences ('T') their 8 digit states and TDI sequences 16 digits
+ * of data, sent with TMS set on the last tick for the upper case letters.
+ * 'D'/'d' capture TDO, 'X'/'x' don't. The response holds what the SWD reads
+ * ('i', 'I') returned as 32 bit values, or the captured TDO as whole bytes
+ * per step, hexified like HM data. SB responds P if any parity check failed.
+ *
+ * From HL version 9 on, HF reports the probe's frame size: the longest
+ * request it takes, binary payload included, and the longest response the
+ * host has to expect. Older probes have REMOTE_FRAME_SIZE_MIN.
+ *
+ * GY starts the probe's SWO capture at the given baud rate, undecoded, for
+ * the host to read from the probe's trace endpoint. The response holds the
+ * baud rate the probe set up, or 0 for Manchester capture.
+ *
  * The whole protocol is defined in this header file. Parameters have
  * to be marshalled in remote.c, swdptap.c and jtagtap.c, so be
  * careful to ensure the parameter handling matches the protocol
@@ -83,6 +114,11 @@
 #define REMOTE_NRST_SET      'Z'
 #define REMOTE_NRST_GET      'z'
 #define REMOTE_ADD_JTAG_DEV  'J'
+#define REMOTE_WAIT_POLICY   'W'
+#define REMOTE_TRACESWO      'Y'
+#define REMOTE_BATCH         'B'
+#define REMOTE_TDI_TMS       'X'
+#define REMOTE_TDI_NOTMS     'x'
 
 /* Protocol response options */
 #define REMOTE_RESP_OK     'K'
@@ -101,6 +137,36 @@
 #define REMOTE_MEM_READ           'h'
 #define REMOTE_MEM_WRITE_SIZED    'H'
 #define REMOTE_AP_MEM_WRITE_SIZED 'm'
+#define REMOTE_AP_MEM_READ_BIN    'B'
+#define REMOTE_AP_MEM_WRITE_BIN   'W'
+#define REMOTE_AP_MEM_WAIT        'P'
+#define REMOTE_AP_MEM_CRC32       'c'
+#define REMOTE_AP_SEQUENCE        'Q'
+#define REMOTE_HL_FRAME_SIZE      'F'
+
+/* HQ step types */
+#define REMOTE_SEQ_DP_READ   'r'
+#define REMOTE_SEQ_DP_WRITE  'w'
+#define REMOTE_SEQ_AP_READ   'a'
+#define REMOTE_SEQ_AP_WRITE  'A'
+#define REMOTE_SEQ_MEM_READ  'm'
+#define REMOTE_SEQ_MEM_WRITE 'M'
+#define REMOTE_SEQ_MEM_WAIT  'p'
+#define REMOTE_SEQ_DELAY     'D'
+
+/* Most steps in one HQ, and most characters their encoding may take up */
+#define REMOTE_SEQ_MAX_OPS 32U
+#define REMOTE_SEQ_MAX_LEN 0x3c0U
+
+/* Most characters the steps of one SB or JB take up, and most bytes they may return */
+#define REMOTE_BATCH_MAX_LEN     0x3c0U
+#define REMOTE_BATCH_MAX_CAPTURE 0x100U
+
+/* Frame size of a probe that doesn't know HF, the smallest there is */
+#define REMOTE_FRAME_SIZE_MIN 1024U
+
+/* Largest binary payload in a frame of the given size, the probe keeps it in the frame's buffer */
+#define REMOTE_BIN_MAX_LEN(frame_size) ((frame_size) - 0x20U)
 
 /* Generic protocol elements */
 #define REMOTE_GEN_PACKET  'G'
@@ -149,6 +215,20 @@
 	{                                                                                \
 		REMOTE_SOM, REMOTE_GEN_PACKET, REMOTE_TARGET_CLK_OE, '%', 'c', REMOTE_EOM, 0 \
 	}
+/* GW: idle cycles, backoff_max, adaptive ('0' or '1') and timeout_ms of adiv5_wait_policy */
+#define REMOTE_WAIT_POLICY_STR                                                                                  \
+	(char[])                                                                                                    \
+	{                                                                                                           \
+		REMOTE_SOM, REMOTE_GEN_PACKET, REMOTE_WAIT_POLICY, '%', '0', '2', 'x', '%', '0', '2', 'x', '%', 'c', '%', \
+			'0', '8', 'x', REMOTE_EOM, 0                                                                        \
+	}
+
+/* GY: baud rate of the SWO capture */
+#define REMOTE_TRACESWO_STR                                                               \
+	(char[])                                                                              \
+	{                                                                                     \
+		REMOTE_SOM, REMOTE_GEN_PACKET, REMOTE_TRACESWO, '%', '0', '8', 'x', REMOTE_EOM, 0 \
+	}
 
 /* SWDP protocol elements */
 #define REMOTE_SWDP_PACKET 'S'
@@ -182,6 +262,12 @@
 		REMOTE_SOM, REMOTE_SWDP_PACKET, REMOTE_OUT_PAR, '%', '0', '2', 'x', '%', 'x', REMOTE_EOM, 0 \
 	}
 
+#define REMOTE_SWDP_BATCH_STR                           \
+	(char[])                                            \
+	{                                                   \
+		REMOTE_SOM, REMOTE_SWDP_PACKET, REMOTE_BATCH, 0 \
+	}
+
 /* JTAG protocol elements */
 #define REMOTE_JTAG_PACKET 'J'
 #define REMOTE_JTAG_INIT_STR                                                        \
@@ -220,6 +306,12 @@
 		REMOTE_SOM, REMOTE_JTAG_PACKET, REMOTE_NEXT, '%', 'u', '%', 'u', REMOTE_EOM, 0 \
 	}
 
+#define REMOTE_JTAG_BATCH_STR                           \
+	(char[])                                            \
+	{                                                   \
+		REMOTE_SOM, REMOTE_JTAG_PACKET, REMOTE_BATCH, 0 \
+	}
+
 /* HL protocol elements */
 #define HEX '%', '0', '2', 'x'
 #define HEX_U32(x) '%', '0', '8', 'x'
@@ -241,6 +333,11 @@
 	{                                                                \
 		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_HL_CHECK, REMOTE_EOM, 0 \
 	}
+#define REMOTE_HL_FRAME_SIZE_STR                                          \
+	(char[])                                                              \
+	{                                                                     \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_HL_FRAME_SIZE, REMOTE_EOM, 0 \
+	}
 #define REMOTE_DP_READ_STR                                                                                            \
 	(char[])                                                                                                          \
 	{                                                                                                                 \
@@ -276,6 +373,36 @@
 		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_WRITE_SIZED, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
 			'%', '0', '2', 'x', HEX_U32(address), HEX_U32(count), 0                                                    \
 	}
+#define REMOTE_AP_MEM_READ_BIN_STR                                                                                  \
+	(char[])                                                                                                        \
+	{                                                                                                               \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_READ_BIN, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
+			HEX_U32(address), HEX_U32(count), REMOTE_EOM, 0                                                         \
+	}
+#define REMOTE_AP_MEM_WRITE_BIN_STR                                                                                  \
+	(char[])                                                                                                         \
+	{                                                                                                                \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_WRITE_BIN, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
+			'%', '0', '2', 'x', HEX_U32(address), HEX_U32(count), REMOTE_EOM, 0                                      \
+	}
+#define REMOTE_AP_MEM_WAIT_STR                                                                                  \
+	(char[])                                                                                                    \
+	{                                                                                                           \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_WAIT, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
+			HEX_U32(address), HEX_U32(mask), HEX_U32(busy_value), HEX_U32(timeout), REMOTE_EOM, 0               \
+	}
+#define REMOTE_AP_MEM_CRC32_STR                                                                                  \
+	(char[])                                                                                                     \
+	{                                                                                                            \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_CRC32, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
+			HEX_U32(address), HEX_U32(count), REMOTE_EOM, 0                                                      \
+	}
+#define REMOTE_AP_SEQUENCE_STR                                                                                  \
+	(char[])                                                                                                    \
+	{                                                                                                           \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_SEQUENCE, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
+			0                                                                                                   \
+	}
 #define REMOTE_MEM_WRITE_SIZED_STR                                                                       \
 	(char[])                                                                                             \
 	{                                                                                                    \
@@ -285,5 +412,8 @@
 
 uint64_t remotehston(uint32_t limit, const char *s);
 void remotePacketProcess(unsigned int i, char *packet);
+/* As remotePacketProcess(), but over a channel other than the GDB port */
+void remote_packet_process_via(void (*putchar_fn)(unsigned char c, int flush),
+	void (*getraw_fn)(void *buf, size_t len), unsigned i, char *packet);
 
 #endif
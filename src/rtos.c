@@ -0,0 +1,611 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements the RTOS awareness behind GDB's thread packets.
+ * GDB looks up the kernel's lists for us with qSymbol. On the first thread
+ * query after a halt every thread is read, its control block and the
+ * registers it stacked when it was switched out, and kept until the target
+ * runs again. GDB going through "info threads" and "thread apply all bt"
+ * then costs no target accesses beyond the frames it unwinds.
+ *
+ * Only Cortex-M is handled. FreeRTOS is read as built without MPU wrappers
+ * and with the GCC ARM_CM0/CM3/CM4F ports, Zephyr through the offsets table
+ * it exports with CONFIG_DEBUG_THREAD_INFO and CONFIG_THREAD_MONITOR.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "rtos.h"
+
+typedef enum rtos_symbol {
+	FREERTOS_CURRENT_TCB,
+	FREERTOS_READY_LISTS,
+	FREERTOS_DELAYED_LIST1,
+	FREERTOS_DELAYED_LIST2,
+	FREERTOS_PENDING_READY_LIST,
+	FREERTOS_SUSPENDED_LIST,
+	FREERTOS_TERMINATION_LIST,
+	FREERTOS_TOP_USED_PRIORITY,
+	FREERTOS_SCHEDULER_RUNNING,
+	ZEPHYR_KERNEL,
+	ZEPHYR_OFFSETS,
+	ZEPHYR_NUM_OFFSETS,
+	RTOS_SYMBOLS,
+} rtos_symbol_e;
+
+/* The first symbol of each RTOS is the one that says it's there */
+#define FREERTOS_FIRST FREERTOS_CURRENT_TCB
+#define ZEPHYR_FIRST   ZEPHYR_KERNEL
+
+static const char *const rtos_symbol_names[RTOS_SYMBOLS] = {
+	[FREERTOS_CURRENT_TCB] = "pxCurrentTCB",
+	[FREERTOS_READY_LISTS] = "pxReadyTasksLists",
+	[FREERTOS_DELAYED_LIST1] = "xDelayedTaskList1",
+	[FREERTOS_DELAYED_LIST2] = "xDelayedTaskList2",
+	[FREERTOS_PENDING_READY_LIST] = "xPendingReadyList",
+	[FREERTOS_SUSPENDED_LIST] = "xSuspendedTaskList",
+	[FREERTOS_TERMINATION_LIST] = "xTasksWaitingTermination",
+	[FREERTOS_TOP_USED_PRIORITY] = "uxTopUsedPriority",
+	[FREERTOS_SCHEDULER_RUNNING] = "xSchedulerRunning",
+	[ZEPHYR_KERNEL] = "_kernel",
+	[ZEPHYR_OFFSETS] = "_kernel_thread_info_offsets",
+	[ZEPHYR_NUM_OFFSETS] = "_kernel_thread_info_num_offsets",
+};
+
+static target_addr rtos_symbol_addr[RTOS_SYMBOLS];
+static uint32_t rtos_symbol_found; /* One bit per rtos_symbol_e */
+static size_t rtos_symbol_asked;
+
+typedef enum rtos_state {
+	RTOS_RUNNING,
+	RTOS_READY,
+	RTOS_BLOCKED,
+	RTOS_SUSPENDED,
+	RTOS_DELETED,
+	RTOS_PENDING,
+	RTOS_PRESTART,
+} rtos_state_e;
+
+static const char *const rtos_state_names[] = {
+	[RTOS_RUNNING] = "Running",
+	[RTOS_READY] = "Ready",
+	[RTOS_BLOCKED] = "Blocked",
+	[RTOS_SUSPENDED] = "Suspended",
+	[RTOS_DELETED] = "Deleted",
+	[RTOS_PENDING] = "Pending",
+	[RTOS_PRESTART] = "Not started",
+};
+
+#define RTOS_NAME_LEN 16U
+
+typedef struct rtos_thread {
+	uint32_t id;
+	int32_t priority;
+	rtos_state_e state;
+	char name[RTOS_NAME_LEN + 1U];
+	/* Not read for the thread on the core */
+	uint32_t regs[RTOS_STACKED_REGS];
+} rtos_thread_s;
+
+/* What was read at this halt */
+static struct {
+	target *t;
+	bool current_valid;
+	uint32_t current;
+	bool valid;
+	rtos_thread_s *threads;
+	size_t count;
+} rtos_cache;
+
+/* Cortex-M registers in GDB's order, and what the exception entry stacks */
+#define CORTEXM_REG_R12  12U
+#define CORTEXM_REG_SP   13U
+#define CORTEXM_REG_LR   14U
+#define CORTEXM_REG_PC   15U
+#define CORTEXM_REG_XPSR 16U
+
+#define CORTEXM_FRAME_WORDS          8U
+#define CORTEXM_FRAME_SIZE           0x20U
+#define CORTEXM_FRAME_EXTENDED_SIZE  0x68U
+#define CORTEXM_XPSR_STACK_ALIGN     (1U << 9U)
+#define CORTEXM_EXC_RETURN_MASK      0xffffff00U
+#define CORTEXM_EXC_RETURN_BASIC     (1U << 4U)
+
+/* List_t and ListItem_t, 32-bit and without the integrity check bytes */
+#define FREERTOS_LIST_WORDS       5U
+#define FREERTOS_LIST_ITEMS       0U
+#define FREERTOS_LIST_END         8U
+#define FREERTOS_LIST_END_NEXT    3U
+#define FREERTOS_LIST_SIZE        (FREERTOS_LIST_WORDS * 4U)
+#define FREERTOS_ITEM_NEXT        1U
+#define FREERTOS_ITEM_OWNER       3U
+/* TCB_t: pxTopOfStack, xStateListItem, xEventListItem, uxPriority, pxStack, pcTaskName */
+#define FREERTOS_TCB_PRIORITY     44U
+#define FREERTOS_TCB_NAME         52U
+#define FREERTOS_MAX_PRIORITIES   64U
+/* Ready list headers read at a time */
+#define FREERTOS_READY_CHUNK      8U
+/* r4-r11 stacked by PendSV, and EXC_RETURN after them by the CM4F port */
+#define FREERTOS_SWITCH_WORDS     8U
+#define FREERTOS_FP_WORDS         16U
+
+/* Indexes into _kernel_thread_info_offsets, unimplemented ones are all ones */
+#define ZEPHYR_OFFSET_VERSION        0U
+#define ZEPHYR_OFFSET_K_CURR_THREAD  1U
+#define ZEPHYR_OFFSET_K_THREADS      2U
+#define ZEPHYR_OFFSET_T_ENTRY        3U
+#define ZEPHYR_OFFSET_T_NEXT_THREAD  4U
+#define ZEPHYR_OFFSET_T_STATE        5U
+#define ZEPHYR_OFFSET_T_USER_OPTIONS 6U
+#define ZEPHYR_OFFSET_T_PRIO         7U
+#define ZEPHYR_OFFSET_T_STACK_PTR    8U
+#define ZEPHYR_OFFSET_T_NAME         9U
+#define ZEPHYR_OFFSET_T_ARCH         10U
+#define ZEPHYR_OFFSET_T_PREEMPT_FLT  11U
+#define ZEPHYR_OFFSET_T_COOP_FLT     12U
+#define ZEPHYR_OFFSET_T_EXC_RETURN   13U
+#define ZEPHYR_OFFSETS_USED          14U
+#define ZEPHYR_UNIMPLEMENTED         UINT32_MAX
+/* struct _callee_saved: v1-v8 (r4-r11) right before psp */
+#define ZEPHYR_CALLEE_SIZE           32U
+/* The most of a struct k_thread read per thread */
+#define ZEPHYR_THREAD_SPAN           512U
+/* _thread_base.thread_state bits */
+#define ZEPHYR_THREAD_PENDING        (1U << 1U)
+#define ZEPHYR_THREAD_PRESTART       (1U << 2U)
+#define ZEPHYR_THREAD_DEAD           (1U << 3U)
+#define ZEPHYR_THREAD_SUSPENDED      (1U << 4U)
+#define ZEPHYR_THREAD_QUEUED         (1U << 7U)
+
+static uint32_t zephyr_offsets[ZEPHYR_OFFSETS_USED];
+static bool zephyr_offsets_valid;
+
+static bool rtos_symbol_has(const rtos_symbol_e symbol)
+{
+	return rtos_symbol_found & (1U << symbol);
+}
+
+void rtos_symbols_reset(void)
+{
+	rtos_symbol_found = 0;
+	rtos_symbol_asked = 0;
+	zephyr_offsets_valid = false;
+	rtos_invalidate();
+}
+
+const char *rtos_symbol_next(void)
+{
+	/* Not worth asking for the rest of an RTOS that isn't there */
+	if (rtos_symbol_asked == FREERTOS_FIRST + 1U && !rtos_symbol_has(FREERTOS_FIRST))
+		rtos_symbol_asked = ZEPHYR_FIRST;
+	/* Nor for another RTOS once one was found */
+	else if (rtos_symbol_asked == ZEPHYR_FIRST && rtos_symbol_has(FREERTOS_FIRST))
+		rtos_symbol_asked = RTOS_SYMBOLS;
+	else if (rtos_symbol_asked == ZEPHYR_FIRST + 1U && !rtos_symbol_has(ZEPHYR_FIRST))
+		rtos_symbol_asked = RTOS_SYMBOLS;
+	if (rtos_symbol_asked >= RTOS_SYMBOLS)
+		return NULL;
+	return rtos_symbol_names[rtos_symbol_asked++];
+}
+
+void rtos_symbol_set(const char *const name, const bool found, const target_addr value)
+{
+	for (size_t i = 0; i < RTOS_SYMBOLS; ++i) {
+		if (strcmp(name, rtos_symbol_names[i]))
+			continue;
+		if (found) {
+			rtos_symbol_found |= 1U << i;
+			rtos_symbol_addr[i] = value;
+		} else
+			rtos_symbol_found &= ~(1U << i);
+		zephyr_offsets_valid = false;
+		rtos_invalidate();
+		return;
+	}
+}
+
+void rtos_invalidate(void)
+{
+	free(rtos_cache.threads);
+	rtos_cache.threads = NULL;
+	rtos_cache.count = 0;
+	rtos_cache.valid = false;
+	rtos_cache.current_valid = false;
+}
+
+static uint32_t rtos_word(const void *const data, const size_t offset)
+{
+	uint32_t value;
+	memcpy(&value, (const uint8_t *)data + offset, sizeof(value));
+	return value;
+}
+
+static bool rtos_read32(target *const t, uint32_t *const value, const target_addr addr)
+{
+	return !target_mem_read(t, value, addr, sizeof(*value));
+}
+
+/* NULL once there's no room for more, which isn't worth failing over */
+static rtos_thread_s *rtos_thread_add(const uint32_t id, const rtos_state_e state)
+{
+	if (rtos_cache.count == RTOS_MAX_THREADS) {
+		DEBUG_WARN("RTOS: more than %u threads, the rest are left out\n", (unsigned)RTOS_MAX_THREADS);
+		return NULL;
+	}
+	rtos_thread_s *const thread = &rtos_cache.threads[rtos_cache.count++];
+	memset(thread, 0, sizeof(*thread));
+	thread->id = id;
+	thread->state = id == rtos_cache.current ? RTOS_RUNNING : state;
+	return thread;
+}
+
+/* r0-r3, r12, lr, pc, xpsr from the exception frame, and sp from before it was stacked */
+static void rtos_frame_regs(uint32_t *const regs, const uint32_t *const frame, const target_addr frame_addr,
+	const bool extended)
+{
+	memcpy(regs, frame, 4U * sizeof(uint32_t));
+	regs[CORTEXM_REG_R12] = frame[4];
+	regs[CORTEXM_REG_LR] = frame[5];
+	regs[CORTEXM_REG_PC] = frame[6];
+	regs[CORTEXM_REG_XPSR] = frame[7];
+	regs[CORTEXM_REG_SP] = frame_addr + (extended ? CORTEXM_FRAME_EXTENDED_SIZE : CORTEXM_FRAME_SIZE) +
+		((frame[7] & CORTEXM_XPSR_STACK_ALIGN) ? 4U : 0U);
+}
+
+static bool freertos_current(target *const t, uint32_t *const current)
+{
+	uint32_t running = 1;
+	*current = 0;
+	if (rtos_symbol_has(FREERTOS_SCHEDULER_RUNNING) &&
+		!rtos_read32(t, &running, rtos_symbol_addr[FREERTOS_SCHEDULER_RUNNING]))
+		return false;
+	/* Tasks created before the scheduler started aren't running yet, main() is */
+	return !running || rtos_read32(t, current, rtos_symbol_addr[FREERTOS_CURRENT_TCB]);
+}
+
+/*
+ * The context PendSV saved: r4-r11, on CM4F EXC_RETURN and s16-s31 if the
+ * task used the FPU, then the exception frame. One read covers all but the
+ * FPU case.
+ */
+static bool freertos_stacked_regs(target *const t, uint32_t *const regs, const target_addr top, const bool fpu)
+{
+	uint32_t stack[FREERTOS_SWITCH_WORDS + 1U + CORTEXM_FRAME_WORDS];
+	if (target_mem_read(t, stack, top, sizeof(stack)))
+		return false;
+	memcpy(&regs[4], stack, FREERTOS_SWITCH_WORDS * sizeof(uint32_t));
+	const uint32_t exc_return = stack[FREERTOS_SWITCH_WORDS];
+	/* The CM3 port doesn't save EXC_RETURN, the frame follows r11 there */
+	if (!fpu || (exc_return & CORTEXM_EXC_RETURN_MASK) != CORTEXM_EXC_RETURN_MASK) {
+		const target_addr frame = top + FREERTOS_SWITCH_WORDS * 4U;
+		rtos_frame_regs(regs, &stack[FREERTOS_SWITCH_WORDS], frame, false);
+		return true;
+	}
+	if (exc_return & CORTEXM_EXC_RETURN_BASIC) {
+		const target_addr frame = top + (FREERTOS_SWITCH_WORDS + 1U) * 4U;
+		rtos_frame_regs(regs, &stack[FREERTOS_SWITCH_WORDS + 1U], frame, false);
+		return true;
+	}
+	const target_addr frame = top + (FREERTOS_SWITCH_WORDS + 1U + FREERTOS_FP_WORDS) * 4U;
+	if (target_mem_read(t, stack, frame, CORTEXM_FRAME_SIZE))
+		return false;
+	rtos_frame_regs(regs, stack, frame, true);
+	return true;
+}
+
+static bool freertos_thread_load(target *const t, const target_addr tcb, const rtos_state_e state, const bool fpu)
+{
+	uint8_t data[FREERTOS_TCB_NAME + RTOS_NAME_LEN];
+	if (target_mem_read(t, data, tcb, sizeof(data)))
+		return false;
+	rtos_thread_s *const thread = rtos_thread_add(tcb, state);
+	if (!thread)
+		return true;
+	thread->priority = (int32_t)rtos_word(data, FREERTOS_TCB_PRIORITY);
+	memcpy(thread->name, data + FREERTOS_TCB_NAME, RTOS_NAME_LEN);
+	if (thread->state == RTOS_RUNNING)
+		return true;
+	return freertos_stacked_regs(t, thread->regs, rtos_word(data, 0), fpu);
+}
+
+/* Walks a List_t whose header was already read, following xListEnd round */
+static bool freertos_list_walk(
+	target *const t, const target_addr list, const uint32_t *const header, const rtos_state_e state, const bool fpu)
+{
+	target_addr item = header[FREERTOS_LIST_END_NEXT];
+	for (uint32_t i = 0; i < header[FREERTOS_LIST_ITEMS] && item != list + FREERTOS_LIST_END; ++i) {
+		uint32_t list_item[FREERTOS_LIST_WORDS];
+		if (target_mem_read(t, list_item, item, sizeof(list_item)) ||
+			!freertos_thread_load(t, list_item[FREERTOS_ITEM_OWNER], state, fpu))
+			return false;
+		if (rtos_cache.count == RTOS_MAX_THREADS)
+			break;
+		item = list_item[FREERTOS_ITEM_NEXT];
+	}
+	return true;
+}
+
+static bool freertos_list_load(target *const t, const rtos_symbol_e symbol, const rtos_state_e state, const bool fpu)
+{
+	/* Lists that depend on the configuration may not be there */
+	if (!rtos_symbol_has(symbol))
+		return true;
+	uint32_t header[FREERTOS_LIST_WORDS];
+	const target_addr list = rtos_symbol_addr[symbol];
+	return !target_mem_read(t, header, list, sizeof(header)) && freertos_list_walk(t, list, header, state, fpu);
+}
+
+static size_t freertos_priorities(target *const t)
+{
+	uint32_t top_priority;
+	if (rtos_symbol_has(FREERTOS_TOP_USED_PRIORITY)) {
+		if (!rtos_read32(t, &top_priority, rtos_symbol_addr[FREERTOS_TOP_USED_PRIORITY]))
+			return 0;
+		return MIN(top_priority + 1U, FREERTOS_MAX_PRIORITIES);
+	}
+	/* Without it, tasks.c puts the first delayed list right after the ready lists */
+	const target_addr ready = rtos_symbol_addr[FREERTOS_READY_LISTS];
+	const target_addr delayed = rtos_symbol_addr[FREERTOS_DELAYED_LIST1];
+	if (rtos_symbol_has(FREERTOS_DELAYED_LIST1) && delayed > ready &&
+		delayed - ready <= FREERTOS_MAX_PRIORITIES * FREERTOS_LIST_SIZE && !((delayed - ready) % FREERTOS_LIST_SIZE))
+		return (delayed - ready) / FREERTOS_LIST_SIZE;
+	DEBUG_WARN("FreeRTOS: no uxTopUsedPriority, keep it from being discarded to see threads\n");
+	return 0;
+}
+
+static bool freertos_load(target *const t, const bool fpu)
+{
+	if (!rtos_symbol_has(FREERTOS_READY_LISTS))
+		return false;
+	const size_t priorities = freertos_priorities(t);
+	if (!priorities)
+		return false;
+	/* The ready lists are one array, read a few headers at a time */
+	const target_addr ready = rtos_symbol_addr[FREERTOS_READY_LISTS];
+	for (size_t base = 0; base < priorities; base += FREERTOS_READY_CHUNK) {
+		uint32_t headers[FREERTOS_READY_CHUNK][FREERTOS_LIST_WORDS];
+		const size_t lists = MIN(priorities - base, FREERTOS_READY_CHUNK);
+		if (target_mem_read(t, headers, ready + base * FREERTOS_LIST_SIZE, lists * FREERTOS_LIST_SIZE))
+			return false;
+		for (size_t i = 0; i < lists; ++i) {
+			if (headers[i][FREERTOS_LIST_ITEMS] &&
+				!freertos_list_walk(t, ready + (base + i) * FREERTOS_LIST_SIZE, headers[i], RTOS_READY, fpu))
+				return false;
+		}
+	}
+	return freertos_list_load(t, FREERTOS_DELAYED_LIST1, RTOS_BLOCKED, fpu) &&
+		freertos_list_load(t, FREERTOS_DELAYED_LIST2, RTOS_BLOCKED, fpu) &&
+		freertos_list_load(t, FREERTOS_PENDING_READY_LIST, RTOS_READY, fpu) &&
+		freertos_list_load(t, FREERTOS_SUSPENDED_LIST, RTOS_SUSPENDED, fpu) &&
+		freertos_list_load(t, FREERTOS_TERMINATION_LIST, RTOS_DELETED, fpu);
+}
+
+/* The offsets don't change with the ELF, so they're read once */
+static bool zephyr_offsets_load(target *const t)
+{
+	if (zephyr_offsets_valid)
+		return true;
+	if (!rtos_symbol_has(ZEPHYR_OFFSETS))
+		return false;
+	uint32_t count = ZEPHYR_OFFSETS_USED;
+	if (rtos_symbol_has(ZEPHYR_NUM_OFFSETS) && !rtos_read32(t, &count, rtos_symbol_addr[ZEPHYR_NUM_OFFSETS]))
+		return false;
+	count = MIN(count, ZEPHYR_OFFSETS_USED);
+	memset(zephyr_offsets, 0xff, sizeof(zephyr_offsets));
+	if (count <= ZEPHYR_OFFSET_T_NAME ||
+		target_mem_read(t, zephyr_offsets, rtos_symbol_addr[ZEPHYR_OFFSETS], count * sizeof(uint32_t)))
+		return false;
+	if (zephyr_offsets[ZEPHYR_OFFSET_K_THREADS] == ZEPHYR_UNIMPLEMENTED ||
+		zephyr_offsets[ZEPHYR_OFFSET_T_STACK_PTR] < ZEPHYR_CALLEE_SIZE) {
+		DEBUG_WARN("Zephyr: no thread list, build with CONFIG_THREAD_MONITOR to see threads\n");
+		return false;
+	}
+	zephyr_offsets_valid = true;
+	return true;
+}
+
+static bool zephyr_current(target *const t, uint32_t *const current)
+{
+	*current = 0;
+	return zephyr_offsets_load(t) &&
+		rtos_read32(t, current, rtos_symbol_addr[ZEPHYR_KERNEL] + zephyr_offsets[ZEPHYR_OFFSET_K_CURR_THREAD]);
+}
+
+static rtos_state_e zephyr_state(const uint8_t state)
+{
+	if (state & ZEPHYR_THREAD_DEAD)
+		return RTOS_DELETED;
+	if (state & ZEPHYR_THREAD_SUSPENDED)
+		return RTOS_SUSPENDED;
+	if (state & ZEPHYR_THREAD_PRESTART)
+		return RTOS_PRESTART;
+	if (state & ZEPHYR_THREAD_PENDING)
+		return RTOS_PENDING;
+	if (state & ZEPHYR_THREAD_QUEUED)
+		return RTOS_READY;
+	return RTOS_BLOCKED;
+}
+
+/* r4-r11 and psp are in the thread, the exception frame on its stack */
+static bool zephyr_stacked_regs(target *const t, uint32_t *const regs, const uint8_t *const callee, uint8_t exc_return)
+{
+	memcpy(&regs[4], callee, ZEPHYR_CALLEE_SIZE);
+	const target_addr psp = rtos_word(callee, ZEPHYR_CALLEE_SIZE);
+	uint32_t frame[CORTEXM_FRAME_WORDS];
+	if (target_mem_read(t, frame, psp, sizeof(frame)))
+		return false;
+	rtos_frame_regs(regs, frame, psp, !(exc_return & CORTEXM_EXC_RETURN_BASIC));
+	return true;
+}
+
+static bool zephyr_load(target *const t)
+{
+	if (!zephyr_offsets_load(t))
+		return false;
+	/* The part of struct k_thread that holds everything needed, read in one go per thread */
+	const uint32_t *const offsets = zephyr_offsets;
+	const uint32_t start = offsets[ZEPHYR_OFFSET_T_STACK_PTR] - ZEPHYR_CALLEE_SIZE;
+	uint32_t lo = MIN(MIN(start, offsets[ZEPHYR_OFFSET_T_NEXT_THREAD]), offsets[ZEPHYR_OFFSET_T_STATE]);
+	uint32_t hi = MAX(offsets[ZEPHYR_OFFSET_T_STACK_PTR], offsets[ZEPHYR_OFFSET_T_NEXT_THREAD]) + 4U;
+	hi = MAX(hi, offsets[ZEPHYR_OFFSET_T_STATE] + 1U);
+	const bool has_prio = offsets[ZEPHYR_OFFSET_T_PRIO] != ZEPHYR_UNIMPLEMENTED;
+	const bool has_name = offsets[ZEPHYR_OFFSET_T_NAME] != ZEPHYR_UNIMPLEMENTED;
+	const bool has_exc_return = offsets[ZEPHYR_OFFSET_T_EXC_RETURN] != ZEPHYR_UNIMPLEMENTED;
+	if (has_prio) {
+		lo = MIN(lo, offsets[ZEPHYR_OFFSET_T_PRIO]);
+		hi = MAX(hi, offsets[ZEPHYR_OFFSET_T_PRIO] + 1U);
+	}
+	if (has_name) {
+		lo = MIN(lo, offsets[ZEPHYR_OFFSET_T_NAME]);
+		hi = MAX(hi, offsets[ZEPHYR_OFFSET_T_NAME] + RTOS_NAME_LEN);
+	}
+	if (has_exc_return) {
+		lo = MIN(lo, offsets[ZEPHYR_OFFSET_T_EXC_RETURN]);
+		hi = MAX(hi, offsets[ZEPHYR_OFFSET_T_EXC_RETURN] + 1U);
+	}
+	if (hi - lo > ZEPHYR_THREAD_SPAN) {
+		DEBUG_WARN("Zephyr: thread offsets span %" PRIu32 " bytes, too many to read\n", hi - lo);
+		return false;
+	}
+	uint8_t *const data = malloc(hi - lo);
+	if (!data) {
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+
+	uint32_t addr;
+	bool ok = rtos_read32(t, &addr, rtos_symbol_addr[ZEPHYR_KERNEL] + offsets[ZEPHYR_OFFSET_K_THREADS]);
+	/* Bounded, in case the list was caught being changed */
+	for (size_t i = 0; ok && addr && i < RTOS_MAX_THREADS; ++i) {
+		ok = !target_mem_read(t, data, addr + lo, hi - lo);
+		if (!ok)
+			break;
+		rtos_thread_s *const thread = rtos_thread_add(addr, zephyr_state(data[offsets[ZEPHYR_OFFSET_T_STATE] - lo]));
+		if (!thread)
+			break;
+		if (has_prio)
+			thread->priority = (int8_t)data[offsets[ZEPHYR_OFFSET_T_PRIO] - lo];
+		if (has_name)
+			memcpy(thread->name, data + offsets[ZEPHYR_OFFSET_T_NAME] - lo, RTOS_NAME_LEN);
+		if (thread->state != RTOS_RUNNING) {
+			/* Without the EXC_RETURN kept, assume the frame has no FPU state */
+			const uint8_t exc_return =
+				has_exc_return ? data[offsets[ZEPHYR_OFFSET_T_EXC_RETURN] - lo] : CORTEXM_EXC_RETURN_BASIC;
+			ok = zephyr_stacked_regs(t, thread->regs, data + start - lo, exc_return);
+		}
+		addr = rtos_word(data, offsets[ZEPHYR_OFFSET_T_NEXT_THREAD] - lo);
+	}
+	free(data);
+	return ok;
+}
+
+static bool rtos_current_load(target *const t)
+{
+	if (rtos_cache.t != t)
+		rtos_invalidate();
+	rtos_cache.t = t;
+	if (rtos_cache.current_valid)
+		return rtos_cache.current != 0;
+	rtos_cache.current_valid = true;
+	const char *const tdesc = target_tdesc(t);
+	bool ok = false;
+	if (tdesc && strstr(tdesc, "org.gnu.gdb.arm.m-profile")) {
+		if (rtos_symbol_has(FREERTOS_FIRST))
+			ok = freertos_current(t, &rtos_cache.current);
+		else if (rtos_symbol_has(ZEPHYR_FIRST))
+			ok = zephyr_current(t, &rtos_cache.current);
+	}
+	if (!ok)
+		rtos_cache.current = 0;
+	return rtos_cache.current != 0;
+}
+
+static bool rtos_load(target *const t)
+{
+	if (!rtos_current_load(t))
+		return false;
+	if (rtos_cache.valid)
+		return rtos_cache.count != 0;
+	rtos_cache.valid = true;
+	rtos_cache.threads = malloc(sizeof(*rtos_cache.threads) * RTOS_MAX_THREADS);
+	if (!rtos_cache.threads) {
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	const char *const tdesc = target_tdesc(t);
+	const bool ok = rtos_symbol_has(FREERTOS_FIRST) ? freertos_load(t, strstr(tdesc, "org.gnu.gdb.arm.vfp") != NULL) :
+	                                                  zephyr_load(t);
+	if (!ok) {
+		DEBUG_WARN("RTOS: reading the threads failed\n");
+		rtos_cache.count = 0;
+	}
+	if (!rtos_cache.count) {
+		free(rtos_cache.threads);
+		rtos_cache.threads = NULL;
+	}
+	return rtos_cache.count != 0;
+}
+
+static const rtos_thread_s *rtos_thread(target *const t, const uint32_t id)
+{
+	if (!rtos_load(t))
+		return NULL;
+	for (size_t i = 0; i < rtos_cache.count; ++i) {
+		if (rtos_cache.threads[i].id == id)
+			return &rtos_cache.threads[i];
+	}
+	return NULL;
+}
+
+size_t rtos_thread_count(target *const t)
+{
+	return rtos_load(t) ? rtos_cache.count : 0;
+}
+
+uint32_t rtos_thread_id(target *const t, const size_t index)
+{
+	return rtos_load(t) && index < rtos_cache.count ? rtos_cache.threads[index].id : 0;
+}
+
+uint32_t rtos_current_thread(target *const t)
+{
+	/* Only the current pointer, so stop replies don't cost reading every thread */
+	return rtos_current_load(t) ? rtos_cache.current : 0;
+}
+
+bool rtos_thread_known(target *const t, const uint32_t id)
+{
+	return rtos_thread(t, id) != NULL;
+}
+
+bool rtos_thread_info(target *const t, const uint32_t id, char *const buf, const size_t len)
+{
+	const rtos_thread_s *const thread = rtos_thread(t, id);
+	if (!thread)
+		return false;
+	snprintf(buf, len, "Name: %s, State: %s, Priority: %" PRId32, thread->name, rtos_state_names[thread->state],
+		thread->priority);
+	return true;
+}
+
+const uint32_t *rtos_thread_regs(target *const t, const uint32_t id)
+{
+	const rtos_thread_s *const thread = rtos_thread(t, id);
+	if (!thread || thread->state == RTOS_RUNNING)
+		return NULL;
+	return thread->regs;
+}
@@ -31,13 +31,23 @@
 #include "target/target_internal.h"
 #include "rtt.h"
 #include "rtt_if.h"
+#include "stats.h"
+#include "command.h"
 
 bool rtt_enabled = false;
 bool rtt_found = false;
 static bool rtt_halt = false; // true if rtt needs to halt target to access memory
 uint32_t rtt_cbaddr = 0;
+uint32_t rtt_cbaddr_hint = 0;
 bool rtt_auto_channel = true;
+bool rtt_mux = false;
+#if PC_HOSTED == 1
+/* SEGGER's tools serve RTT from here */
+uint32_t rtt_mux_port = 19021;
+#endif
 struct rtt_channel_struct rtt_channel[MAX_RTT_CHAN];
+/* the up channels come first in rtt_channel, down channel n follows at rtt_num_up + n */
+static uint32_t rtt_num_up;
 
 uint32_t rtt_min_poll_ms = 8;    /* 8 ms */
 uint32_t rtt_max_poll_ms = 256;  /* 0.256 s */
@@ -45,9 +55,12 @@ uint32_t rtt_max_poll_errs = 10;
 static uint32_t poll_ms;
 static uint32_t poll_errs;
 static uint32_t last_poll_ms;
+/* bytes that came up from the target since the last poll */
+static uint32_t up_bytes;
 /* flags for data from host to target */
 bool rtt_flag_skip = false;
 bool rtt_flag_block = false;
+bool rtt_auto = false;
 
 typedef enum rtt_retval {
 	RTT_OK,
@@ -63,8 +76,11 @@ char rtt_ident[16] = QUOTE(RTT_IDENT);
 char rtt_ident[16] = {0};
 #endif
 
-/* usb uart transmit buffer */
-static char xmit_buf[RTT_UP_BUF_SIZE];
+/* longest a halt for rtt i/o may go on draining the buffers, in ms */
+#define RTT_BURST_MS 2U
+
+/* unread bytes either side of a gap this small are read together */
+#define RTT_COALESCE_GAP 64U
 
 /*********************************************************************
 *
@@ -73,74 +89,67 @@ static char xmit_buf[RTT_UP_BUF_SIZE];
 **********************************************************************
 */
 
-uint32_t fastsrch(target *cur_target)
-{
-	const uint32_t m = 16;
-	const uint64_t q = 0x797a9691; /* prime */
-	const uint64_t rm = 0x73b07d01;
-	const uint64_t p = 0x444110cd;
-	const uint32_t stride = 128;
-	uint64_t t = 0;
-	uint8_t srch_buf[m+stride];
-
-	for (struct target_ram *r = cur_target->ram; r; r = r->next) {
-		const uint32_t ram_start = r->start;
-		const uint32_t ram_end = r->start + r->length;
+/* The control block starts with a 16 byte identifier */
+#define RTT_ID_LEN 16U
+/* RAM is searched in blocks this large, a match may straddle two */
+#if PC_HOSTED == 1
+#define RTT_SEARCH_BLOCK 4096U
+#else
+#define RTT_SEARCH_BLOCK 1024U
+#endif
 
-		t = 0;
-		memset(srch_buf, 0, sizeof(srch_buf));
+/* The identifier SEGGER's code puts in, zero padded */
+static const uint8_t rtt_default_id[RTT_ID_LEN] = "SEGGER RTT";
 
-		for (uint32_t addr = ram_start; addr < ram_end; addr += stride) {
-			uint32_t buf_siz = MIN(stride, ram_end - addr);
-			memcpy(srch_buf, srch_buf + stride, m);
-			if (target_mem_read(cur_target, srch_buf + m, addr, buf_siz)) {
-				gdb_outf("rtt: read fail at 0x%" PRIx32 "\r\n", addr);
-				return 0;
-			}
-			for (uint32_t i = 0; i < buf_siz; i++) {
-				t = (t + q - rm * srch_buf[i] % q) % q;
-				t = ((t << 8) + srch_buf[i + m]) % q;
-				if (p == t) {
-					uint32_t offset =  i - m + 1;
-					return addr + offset;
-				}
-			}
-		}
-	}
-	/* no match */
-	return 0;
+/* true if the identifier is at addr */
+static bool rtt_id_at(target *cur_target, uint32_t addr, const uint8_t *id, size_t id_len)
+{
+	uint8_t buf[RTT_ID_LEN];
+	return addr && !target_mem_read(cur_target, buf, addr, id_len) && memcmp(buf, id, id_len) == 0;
 }
 
-uint32_t memsrch(target *cur_target)
+/*
+ * Boyer-Moore-Horspool over each RAM region. Where the last byte under the
+ * pattern doesn't match, that byte says how far the pattern can move on,
+ * which for an identifier of mostly letters is usually its whole length.
+ */
+static uint32_t rtt_search(target *cur_target, const uint8_t *id, size_t id_len)
 {
-	char *srch_str = rtt_ident;
-	uint32_t srch_str_len = strlen(srch_str);
-	uint8_t srch_buf[128];
-
-	if (srch_str_len == 0 || srch_str_len > sizeof(srch_buf) / 2)
-		return 0;
+	static uint8_t srch_buf[RTT_SEARCH_BLOCK];
+	uint8_t skip[256];
 
-	if (rtt_cbaddr && !target_mem_read(cur_target, srch_buf, rtt_cbaddr, srch_str_len)
-		&& strncmp((const char *)(srch_buf), srch_str, srch_str_len) == 0)
-		/* still at same place */
-		return rtt_cbaddr;
+	for (size_t i = 0; i < 256; i++)
+		skip[i] = (uint8_t)id_len;
+	for (size_t i = 0; i + 1 < id_len; i++)
+		skip[id[i]] = (uint8_t)(id_len - 1 - i);
 
 	for (struct target_ram *r = cur_target->ram; r; r = r->next) {
-		uint32_t ram_end = r->start + r->length;
-		for (uint32_t addr = r->start; addr < ram_end; addr += sizeof(srch_buf) - srch_str_len - 1) {
-			uint32_t buf_siz = MIN(ram_end - addr, sizeof(srch_buf));
-			if (target_mem_read(cur_target, srch_buf, addr, buf_siz)) {
+		const uint32_t ram_end = r->start + r->length;
+		/* Tail of the previous block a match could still start in */
+		size_t kept = 0;
+		for (uint32_t addr = r->start; addr < ram_end;) {
+			const size_t count = MIN(ram_end - addr, sizeof(srch_buf) - kept);
+			if (target_mem_read(cur_target, srch_buf + kept, addr, count)) {
 				gdb_outf("rtt: read fail at 0x%" PRIx32 "\r\n", addr);
+				kept = 0;
+				addr += count;
 				continue;
 			}
-			for (uint32_t offset = 0; offset + srch_str_len + 1 < buf_siz; offset++) {
-				if (strncmp((const char *)(srch_buf + offset), srch_str, srch_str_len) == 0) {
-					uint32_t cb_addr = addr + offset;
-					return cb_addr;
-				}
+			const size_t size = kept + count;
+			const uint32_t base = addr - kept;
+			size_t pos = 0;
+			while (pos + id_len <= size) {
+				const uint8_t last = srch_buf[pos + id_len - 1];
+				if (last == id[id_len - 1] && memcmp(srch_buf + pos, id, id_len - 1) == 0)
+					return base + pos;
+				pos += skip[last];
 			}
+			kept = size - pos;
+			memmove(srch_buf, srch_buf + pos, kept);
+			addr += count;
 		}
 	}
+	/* no match */
 	return 0;
 }
 
@@ -154,10 +163,18 @@ static void find_rtt(target *cur_target)
 	if (!cur_target || !rtt_enabled)
 		return;
 
-	if (rtt_ident[0] == 0)
-		rtt_cbaddr = fastsrch(cur_target);
-	else
-		rtt_cbaddr = memsrch(cur_target);
+	const uint8_t *id = rtt_default_id;
+	size_t id_len = RTT_ID_LEN;
+	if (rtt_ident[0]) {
+		id = (const uint8_t *)rtt_ident;
+		id_len = strlen(rtt_ident);
+	}
+
+	/* Try where the user says it is, then where it was before a reset, before searching */
+	if (rtt_id_at(cur_target, rtt_cbaddr_hint, id, id_len))
+		rtt_cbaddr = rtt_cbaddr_hint;
+	else if (!rtt_id_at(cur_target, rtt_cbaddr, id, id_len))
+		rtt_cbaddr = rtt_search(cur_target, id, id_len);
 	DEBUG_INFO("rtt: match at 0x%" PRIx32 "\r\n", rtt_cbaddr);
 
 	if (rtt_cbaddr) {
@@ -168,6 +185,7 @@ static void find_rtt(target *cur_target)
 			return;
 		num_up_buf = num_buf[0];
 		num_down_buf = num_buf[1];
+		rtt_num_up = num_up_buf;
 
 		if (num_up_buf > 255 || num_down_buf > 255) {
 			gdb_out("rtt: bad cblock\r\n");
@@ -233,14 +251,10 @@ static void find_rtt(target *cur_target)
 **********************************************************************
 */
 
-/* poll if host has new data for target */
-static rtt_retval read_rtt(target *cur_target, uint32_t i)
+/* poll if host has new data for target, head and tail as read from the control block */
+static rtt_retval read_rtt(target *cur_target, uint32_t i, uint32_t buf_head, uint32_t buf_tail)
 {
-	uint32_t head_tail[2];
-	uint32_t buf_head;
-	uint32_t buf_tail;
-	uint32_t next_head;
-	int ch;
+	static char chunk[RTT_DOWN_BUF_SIZE];
 
 	/* copy data from recv_buf to target rtt 'down' buffer */
 	if (rtt_nodata())
@@ -249,24 +263,23 @@ static rtt_retval read_rtt(target *cur_target, uint32_t i)
 	if (cur_target == NULL || rtt_channel[i].is_output || rtt_channel[i].buf_addr == 0 || rtt_channel[i].buf_size == 0)
 		return RTT_IDLE;
 
-	/* read down buffer head and tail from target */
-	if (target_mem_read(cur_target, head_tail, rtt_channel[i].head_addr, sizeof(head_tail)))
-		return RTT_ERR;
-
-	buf_head = head_tail[0];
-	buf_tail = head_tail[1];
-
 	if (buf_head >= rtt_channel[i].buf_size || buf_tail >= rtt_channel[i].buf_size)
 		return RTT_ERR;
 
-	/* write recv_buf to target rtt 'down' buf */
-	while ((next_head = ((buf_head + 1) % rtt_channel[i].buf_size)) != buf_tail && (ch = rtt_getchar()) != -1) {
-		if (target_mem_write(cur_target, rtt_channel[i].buf_addr + buf_head, &ch, 1))
-			return RTT_ERR;
+	/* one slot stays free to tell a full buffer from an empty one */
+	const uint32_t buf_size = rtt_channel[i].buf_size;
+	const uint32_t room = (buf_tail + buf_size - buf_head - 1U) % buf_size;
+	const uint32_t len = rtt_read_buf(i - rtt_num_up, chunk, MIN(room, sizeof(chunk)));
+	if (!len)
+		return RTT_IDLE;
 
-		/* advance pointers */
-		buf_head = next_head;
-	}
+	/* write to target rtt 'down' buf, in two block writes where the free space wraps */
+	const uint32_t first = MIN(len, buf_size - buf_head);
+	if (target_mem_write(cur_target, rtt_channel[i].buf_addr + buf_head, chunk, first) ||
+		(len > first && target_mem_write(cur_target, rtt_channel[i].buf_addr, chunk + first, len - first)))
+		return RTT_ERR;
+	buf_head = (buf_head + len) % buf_size;
+	STATS_ADD(rtt_down_bytes[i], len);
 
 	/* update head of target 'down' buffer */
 	if (target_mem_write(cur_target, rtt_channel[i].head_addr, &buf_head, sizeof(buf_head)))
@@ -304,58 +317,71 @@ int target_aligned_mem_read(target *t, void *dest, target_addr src, size_t len)
 	}
 }
 
-/* poll if target has new data for host */
-static rtt_retval print_rtt(target *cur_target, uint32_t i)
+/* rotate buf left by count bytes */
+static void rtt_rotate(char *buf, uint32_t len, uint32_t count)
 {
-	uint32_t head;
-	uint32_t tail;
+	const uint32_t spans[3][2] = {{0, count}, {count, len}, {0, len}};
+	for (size_t i = 0; i < 3; i++) {
+		for (uint32_t lo = spans[i][0], hi = spans[i][1]; lo + 1 < hi; lo++, hi--) {
+			const char c = buf[lo];
+			buf[lo] = buf[hi - 1];
+			buf[hi - 1] = c;
+		}
+	}
+}
 
+/*
+ * poll if target has new data for host, head and tail as read from the control block.
+ * Data is read straight into the buffer the host side hands out, no more than it can
+ * take, so what the host is not ready for stays in the target's buffer.
+ */
+static rtt_retval print_rtt(target *cur_target, uint32_t i, uint32_t head, uint32_t tail)
+{
 	if (!cur_target || !rtt_channel[i].is_output || rtt_channel[i].buf_addr == 0 || rtt_channel[i].head_addr == 0)
 		return RTT_IDLE;
 
-	uint32_t head_tail[2];
-	if (target_mem_read(cur_target, head_tail, rtt_channel[i].head_addr, sizeof(head_tail)))
-		return RTT_ERR;
-	head = head_tail[0];
-	tail = head_tail[1];
-
 	if (head >= rtt_channel[i].buf_size || tail >= rtt_channel[i].buf_size)
 		return RTT_ERR;
-	else if (head == tail)
-		return RTT_IDLE;
 
-	uint32_t bytes_free = sizeof(xmit_buf) - 8; /* need 8 bytes for alignment and padding */
-	uint32_t bytes_read = 0;
-
-	if (tail > head) {
-		uint32_t len = rtt_channel[i].buf_size - tail;
-		if (len > bytes_free)
-			len = bytes_free;
-		if (target_aligned_mem_read(cur_target, xmit_buf + bytes_read, rtt_channel[i].buf_addr + tail, len))
-			return RTT_ERR;
-		bytes_free -= len;
-		bytes_read += len;
+	const uint32_t tail0 = tail;
+	rtt_retval retval = RTT_OK;
+	while (head != tail) {
+		uint32_t room;
+		char *const buf = rtt_write_buf(i, &room);
+		if (!buf)
+			break;
+		uint32_t len;
+		/*
+		 * Data wrapping around the end of a small buffer that is nearly full
+		 * comes in one read of the whole buffer rather than two.
+		 */
+		if (tail > head && tail - head <= RTT_COALESCE_GAP && rtt_channel[i].buf_size <= room) {
+			if (target_aligned_mem_read(cur_target, buf, rtt_channel[i].buf_addr, rtt_channel[i].buf_size)) {
+				retval = RTT_ERR;
+				break;
+			}
+			rtt_rotate(buf, rtt_channel[i].buf_size, tail);
+			len = rtt_channel[i].buf_size - tail + head;
+		} else {
+			len = MIN((tail > head ? rtt_channel[i].buf_size : head) - tail, room);
+			if (target_aligned_mem_read(cur_target, buf, rtt_channel[i].buf_addr + tail, len)) {
+				retval = RTT_ERR;
+				break;
+			}
+		}
+		rtt_write_done(i, len);
+		STATS_ADD(rtt_up_bytes[i], len);
+		up_bytes += len;
 		tail = (tail + len) % rtt_channel[i].buf_size;
 	}
 
-	if (head > tail && bytes_free > 0) {
-		uint32_t len = head - tail;
-		if (len > bytes_free)
-			len = bytes_free;
-		if (target_aligned_mem_read(cur_target, xmit_buf + bytes_read, rtt_channel[i].buf_addr + tail, len))
-			return RTT_ERR;
-		bytes_read += len;
-		tail = (tail + len) % rtt_channel[i].buf_size;
-	}
+	if (tail == tail0)
+		return retval == RTT_OK ? RTT_IDLE : retval;
 
 	/* update tail on target */
 	if (target_mem_write(cur_target, rtt_channel[i].tail_addr, &tail, sizeof(tail)))
 		return RTT_ERR;
-
-	/* write buffer to usb */
-	rtt_write(xmit_buf, bytes_read);
-
-	return RTT_OK;
+	return retval;
 }
 
 
@@ -369,14 +395,6 @@ static rtt_retval print_rtt(target *cur_target, uint32_t i)
 /* target_no_background_memory_access() is true if the target needs to be halted during jtag memory access
    target_no_background_memory_access() is false if the target allows jtag memory access while running */
 
-bool target_no_background_memory_access(target *cur_target)
-{
-	/* if error message is 'rtt: read fail at' add target to expression below.
-	   As a first approximation, assume all arm processors allow memory access while running, and no riscv does. */
-	bool riscv_core = cur_target && target_core_name(cur_target) && strstr(target_core_name(cur_target), "RVDBG");
-	return riscv_core;
-}
-
 /*********************************************************************
 *
 *       rtt top level
@@ -384,13 +402,65 @@ bool target_no_background_memory_access(target *cur_target)
 **********************************************************************
 */
 
+/* do i/o on all channels in use once, RTT_OK if any moved data */
+static rtt_retval poll_channels(target *cur_target)
+{
+	/* the descriptors of all the channels in use come in one read */
+	static uint32_t buf_desc[MAX_RTT_CHAN][6];
+	uint32_t first = MAX_RTT_CHAN;
+	uint32_t last = 0;
+	for (uint32_t i = 0; i < MAX_RTT_CHAN; i++) {
+		if (rtt_channel[i].is_enabled && rtt_channel[i].is_configured) {
+			first = MIN(first, i);
+			last = i;
+		}
+	}
+	if (first > last)
+		return RTT_IDLE;
+	if (target_mem_read(cur_target, buf_desc[first], rtt_cbaddr + 24 + first * 24, (last - first + 1) * 24))
+		return RTT_ERR;
+
+	bool rtt_busy = false;
+	bool rtt_err = false;
+	for (uint32_t i = first; i <= last; i++) {
+		rtt_retval v;
+		if (rtt_channel[i].is_enabled && rtt_channel[i].is_configured) {
+			if (rtt_channel[i].is_output)
+				v = print_rtt(cur_target, i, buf_desc[i][3], buf_desc[i][4]);
+			else
+				v = read_rtt(cur_target, i, buf_desc[i][3], buf_desc[i][4]);
+			if (v == RTT_OK) rtt_busy = true;
+			else if (v == RTT_ERR) rtt_err = true;
+		}
+	}
+	if (rtt_err)
+		return RTT_ERR;
+	return rtt_busy ? RTT_OK : RTT_IDLE;
+}
+
+/* size of the smallest output buffer being shown */
+static uint32_t smallest_up_buf(void)
+{
+	uint32_t size = UINT32_MAX;
+	for (uint32_t i = 0; i < MAX_RTT_CHAN; i++) {
+		if (rtt_channel[i].is_enabled && rtt_channel[i].is_configured && rtt_channel[i].is_output)
+			size = MIN(size, rtt_channel[i].buf_size);
+	}
+	return size;
+}
+
 void poll_rtt(target *cur_target)
 {
 	/* rtt off */
 	if (!cur_target || !rtt_enabled)
 		return;
+#if PC_HOSTED == 1
+	if (rtt_mux)
+		rtt_if_poll();
+#endif
 	/* target present and rtt enabled */
 	uint32_t now = platform_time_ms();
+	const uint32_t start_us = platform_time_us();
 	bool rtt_err = false;
 	bool rtt_busy = false;
 
@@ -412,32 +482,38 @@ void poll_rtt(target *cur_target)
 			/* find rtt control block in target memory */
 			find_rtt(cur_target);
 		/* do rtt i/o if control block found */
+		up_bytes = 0;
 		if (rtt_found) {
-			for (uint32_t i = 0; i < MAX_RTT_CHAN; i++) {
-				rtt_retval v;
-				if (rtt_channel[i].is_enabled && rtt_channel[i].is_configured) {
-					if (rtt_channel[i].is_output)
-						v = print_rtt(cur_target, i);
-					else
-						v = read_rtt(cur_target, i);
-					if (v == RTT_OK) rtt_busy = true;
-					else if (v == RTT_ERR) rtt_err = true;
-				}
-			}
+			/* a halt is costly, drain the buffers fully while it lasts */
+			rtt_retval v;
+			do {
+				v = poll_channels(cur_target);
+				rtt_busy |= v == RTT_OK;
+			} while (resume_target && v == RTT_OK && platform_time_ms() - now < RTT_BURST_MS);
+			rtt_err = v == RTT_ERR;
 		}
 		/* continue target if halted */
-		if (resume_target)
+		if (resume_target) {
 			target_halt_resume(cur_target, false);
-
-		/* update last poll time */
-		last_poll_ms = now;
+			const uint32_t halt_us = platform_time_us() - start_us;
+			STATS_INC(rtt_halts);
+			STATS_ADD(rtt_halt_us, halt_us);
+			bmp_stats.rtt_halt_max_us = MAX(bmp_stats.rtt_halt_max_us, halt_us);
+		}
 
 		/* rtt polling frequency goes up and down with rtt activity */
-		if (rtt_busy && !rtt_err)
+		if (rtt_halt && up_bytes && !rtt_err && last_poll_ms) {
+			/* halting, come back by when the smallest up buffer is half full at the rate it just filled */
+			const uint32_t half_buf = smallest_up_buf() / 2U;
+			poll_ms = (uint32_t)(((uint64_t)half_buf * (now - last_poll_ms)) / up_bytes);
+		} else if (rtt_busy && !rtt_err)
 			poll_ms /= 2;
 		else
 			poll_ms *= 2;
 
+		/* update last poll time */
+		last_poll_ms = now;
+
 		if (poll_ms > rtt_max_poll_ms)
 			poll_ms = rtt_max_poll_ms;
 		else if (poll_ms < rtt_min_poll_ms)
@@ -446,7 +522,10 @@ void poll_rtt(target *cur_target)
 		if (rtt_err) {
 			gdb_out("rtt: err\r\n");
 			poll_errs++;
-			if (rtt_max_poll_errs != 0 && poll_errs > rtt_max_poll_errs) {
+			/* with nobody to enable it again, look for the control block anew, the target may have reset */
+			if (rtt_auto)
+				rtt_found = false;
+			else if (rtt_max_poll_errs != 0 && poll_errs > rtt_max_poll_errs) {
 				gdb_out("\r\nrtt lost\r\n");
 				rtt_enabled = false;
 			}
@@ -454,3 +533,136 @@ void poll_rtt(target *cur_target)
 	}
 	return;
 }
+
+/*********************************************************************
+*
+*       rtt capture without gdb
+*
+**********************************************************************
+*/
+
+/*
+ * With "monitor rtt auto enable" the probe scans for a target on its own
+ * whenever GDB has none, and streams RTT from it without attaching, so the
+ * target is never halted. The settings are kept across power cycles where
+ * the platform can, so a probe on a test rack captures from power up.
+ */
+
+/* wait this long between scans that find nothing */
+#define RTT_AUTO_RESCAN_MS 250U
+
+#if PC_HOSTED == 1 || defined(PLATFORM_HAS_CACHE)
+#define RTT_AUTO_MAGIC 0x52545431U /* "RTT1" */
+
+typedef struct rtt_auto_settings {
+	uint32_t magic;
+	uint32_t cbaddr_hint;
+	/* bit per channel shown, 0 for automatic selection */
+	uint32_t channels;
+	char ident[16];
+	bool enabled;
+} rtt_auto_settings_s;
+#endif
+
+static target *auto_target;
+static bool auto_loaded = false;
+static bool auto_rescan = true;
+static uint32_t auto_scan_ms;
+
+#if PC_HOSTED == 1 || defined(PLATFORM_HAS_CACHE)
+static void rtt_auto_load(void)
+{
+	rtt_auto_settings_s settings;
+	if (!platform_cache_read("rtt_auto", &settings, sizeof(settings)) || settings.magic != RTT_AUTO_MAGIC ||
+		!settings.enabled)
+		return;
+	memcpy(rtt_ident, settings.ident, sizeof(rtt_ident));
+	rtt_ident[sizeof(rtt_ident) - 1U] = '\0';
+	rtt_cbaddr_hint = settings.cbaddr_hint;
+	rtt_auto_channel = !settings.channels;
+	for (size_t i = 0; i < MAX_RTT_CHAN; i++)
+		rtt_channel[i].is_enabled = settings.channels & (1U << i);
+	rtt_auto = true;
+}
+
+static void rtt_auto_save(void)
+{
+	rtt_auto_settings_s settings;
+	memset(&settings, 0, sizeof(settings));
+	settings.magic = RTT_AUTO_MAGIC;
+	settings.cbaddr_hint = rtt_cbaddr_hint;
+	for (size_t i = 0; !rtt_auto_channel && i < MAX_RTT_CHAN; i++) {
+		if (rtt_channel[i].is_enabled)
+			settings.channels |= 1U << i;
+	}
+	memcpy(settings.ident, rtt_ident, sizeof(settings.ident));
+	settings.enabled = rtt_auto;
+	platform_cache_write("rtt_auto", &settings, sizeof(settings));
+}
+#endif
+
+void rtt_auto_set(const bool enable)
+{
+	rtt_auto = enable;
+	auto_loaded = true;
+	auto_rescan = true;
+	if (!enable)
+		auto_target = NULL;
+#if PC_HOSTED == 1 || defined(PLATFORM_HAS_CACHE)
+	rtt_auto_save();
+#endif
+}
+
+/* the scanned target may have been freed by a scan from gdb since */
+static bool rtt_auto_listed(const target *const t)
+{
+	for (const target *listed = target_list; listed; listed = listed->next) {
+		if (listed == t)
+			return true;
+	}
+	return false;
+}
+
+target *rtt_auto_target(void)
+{
+	if (!auto_loaded) {
+		auto_loaded = true;
+#if PC_HOSTED == 1 || defined(PLATFORM_HAS_CACHE)
+		rtt_auto_load();
+#endif
+	}
+	if (!rtt_auto)
+		return NULL;
+	if (auto_target && rtt_auto_listed(auto_target))
+		return auto_target;
+	auto_target = NULL;
+
+	const uint32_t now = platform_time_ms();
+	if (!auto_rescan && now - auto_scan_ms < RTT_AUTO_RESCAN_MS)
+		return NULL;
+	auto_rescan = false;
+	auto_scan_ms = now;
+	if (!cmd_auto_scan(NULL, 0, NULL))
+		return NULL;
+	/* the target is not attached, so nothing else releases the reset */
+	platform_nrst_set_val(false);
+	for (target *t = target_list; t; t = t->next) {
+		if (!target_no_background_memory_access(t)) {
+			auto_target = t;
+			break;
+		}
+	}
+	if (auto_target) {
+		DEBUG_INFO("rtt: capturing from %s\n", auto_target->driver);
+		rtt_enabled = true;
+		rtt_found = false;
+	}
+	return auto_target;
+}
+
+void rtt_auto_lost(void)
+{
+	auto_target = NULL;
+	/* scan again at once, a reset target is usually back by then */
+	auto_rescan = true;
+}
@@ -0,0 +1,247 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements the live variable sampler behind "monitor sample".
+ * It reads a handful of variables while the target runs, without halting
+ * it, so only targets that allow memory access while running are sampled.
+ *
+ * The variables are kept sorted by address and those close together are
+ * read as one span, so a sample costs a target_mem_read() per span rather
+ * than one per variable. Samples are due on a fixed grid of the probe's
+ * microsecond timer; one taken late does not move the grid, and whole
+ * periods missed are counted rather than caught up on.
+ *
+ * Each sample goes out on an RTT up channel's output in one write, which
+ * is a single USB packet on the second vcom, or the channel's TCP port on
+ * hosted with "monitor rtt mux enable". The record is, little endian:
+ *   0xa5, data length, sequence number, 32 bit timestamp in us, then the
+ *   values in the order they were added.
+ * The sequence number counts every sample due, so a gap in it shows where
+ * records were missed, dropped by a slow host or lost to a read error.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "rtt.h"
+#include "rtt_if.h"
+#include "sample.h"
+
+#define SAMPLE_VARIABLES 8U
+/* A record must fit a full speed USB packet with the rtt mux header */
+#define SAMPLE_DATA_MAX    48U
+#define SAMPLE_HEADER      7U
+#define SAMPLE_RECORD_SYNC 0xa5U
+/* Variables this close are read along with the bytes between them */
+#define SAMPLE_SPAN_GAP 16U
+#define SAMPLE_SPAN_MAX 64U
+
+typedef struct sample_variable {
+	target_addr addr;
+	uint8_t size;
+	/* Where the value lands in the span buffer */
+	uint16_t offset;
+} sample_variable_s;
+
+typedef struct sample_span {
+	target_addr addr;
+	uint16_t len;
+	uint16_t offset;
+} sample_span_s;
+
+static struct {
+	bool active;
+	uint32_t channel;
+	uint32_t period_us;
+	uint32_t next_us;
+	uint32_t wait_ms;
+	uint8_t sequence;
+	size_t variables;
+	size_t data_len;
+	sample_variable_s variable[SAMPLE_VARIABLES];
+	size_t spans;
+	sample_span_s span[SAMPLE_VARIABLES];
+	uint8_t span_buf[SAMPLE_VARIABLES * SAMPLE_SPAN_MAX];
+	uint32_t samples;
+	uint32_t missed;
+	uint32_t dropped;
+	uint32_t errors;
+} sample;
+
+/* Groups the variables into spans, in address order */
+static void sample_plan(void)
+{
+	size_t order[SAMPLE_VARIABLES];
+	for (size_t i = 0; i < sample.variables; ++i) {
+		size_t j = i;
+		for (; j && sample.variable[order[j - 1U]].addr > sample.variable[i].addr; --j)
+			order[j] = order[j - 1U];
+		order[j] = i;
+	}
+	sample.spans = 0;
+	uint16_t offset = 0;
+	for (size_t i = 0; i < sample.variables; ++i) {
+		sample_variable_s *const variable = &sample.variable[order[i]];
+		sample_span_s *span = sample.spans ? &sample.span[sample.spans - 1U] : NULL;
+		const target_addr end = variable->addr + variable->size;
+		if (span && variable->addr <= span->addr + span->len + SAMPLE_SPAN_GAP &&
+			end - span->addr <= SAMPLE_SPAN_MAX) {
+			/* Overlapping variables are allowed, the span only ever grows */
+			const uint16_t len = MAX(span->len, end - span->addr);
+			offset += len - span->len;
+			span->len = len;
+		} else {
+			span = &sample.span[sample.spans++];
+			span->addr = variable->addr;
+			span->len = variable->size;
+			span->offset = offset;
+			offset += variable->size;
+		}
+		variable->offset = span->offset + (variable->addr - span->addr);
+	}
+}
+
+bool sample_add(const target_addr addr, const size_t size)
+{
+	if (sample.variables == SAMPLE_VARIABLES || sample.data_len + size > SAMPLE_DATA_MAX)
+		return false;
+	if (size != 1U && size != 2U && size != 4U && size != 8U)
+		return false;
+	sample_variable_s *const variable = &sample.variable[sample.variables++];
+	variable->addr = addr;
+	variable->size = size;
+	sample.data_len += size;
+	sample_plan();
+	return true;
+}
+
+void sample_clear(void)
+{
+	sample.active = false;
+	sample.variables = 0;
+	sample.spans = 0;
+	sample.data_len = 0;
+}
+
+bool sample_start(const uint32_t rate_hz, const uint32_t channel)
+{
+	if (!sample.variables || !rate_hz || rate_hz > 1000000U || channel >= MAX_RTT_CHAN)
+		return false;
+	sample.channel = channel;
+	sample.period_us = 1000000U / rate_hz;
+	sample.next_us = platform_time_us();
+	sample.wait_ms = 0;
+	sample.sequence = 0;
+	sample.samples = 0;
+	sample.missed = 0;
+	sample.dropped = 0;
+	sample.errors = 0;
+	sample.active = true;
+	return true;
+}
+
+void sample_stop(void)
+{
+	sample.active = false;
+}
+
+bool sample_polling(void)
+{
+	return sample.active;
+}
+
+uint32_t sample_period_ms(void)
+{
+	return sample.wait_ms;
+}
+
+/*
+ * The poll loop counts whole ms from the last poll, so the next poll is set
+ * for the ms before the next sample is due and the rest is polled out.
+ */
+static void sample_poll_next(void)
+{
+	const int32_t wait_us = (int32_t)(sample.next_us - platform_time_us());
+	sample.wait_ms = wait_us > 0 ? (uint32_t)wait_us / 1000U : 0U;
+}
+
+static void sample_take(target *t);
+
+void sample_poll(target *const t)
+{
+	if (!sample.active)
+		return;
+	if ((int32_t)(platform_time_us() - sample.next_us) >= 0)
+		sample_take(t);
+	sample_poll_next();
+}
+
+static void sample_take(target *const t)
+{
+	const uint32_t now = platform_time_us();
+	const int32_t late = (int32_t)(now - sample.next_us);
+	/* Keep to the grid, unless whole periods went by without a sample */
+	if ((uint32_t)late >= sample.period_us) {
+		const uint32_t periods = (uint32_t)late / sample.period_us;
+		sample.missed += periods;
+		sample.sequence += periods;
+		sample.next_us += periods * sample.period_us;
+	}
+	sample.next_us += sample.period_us;
+	const uint8_t sequence = sample.sequence++;
+
+	uint32_t room = 0;
+	uint8_t *const record = (uint8_t *)rtt_write_buf(sample.channel, &room);
+	if (!record || room < SAMPLE_HEADER + sample.data_len) {
+		++sample.dropped;
+		return;
+	}
+	for (size_t i = 0; i < sample.spans; ++i) {
+		const sample_span_s *const span = &sample.span[i];
+		if (target_mem_read(t, sample.span_buf + span->offset, span->addr, span->len)) {
+			++sample.errors;
+			return;
+		}
+	}
+	record[0] = SAMPLE_RECORD_SYNC;
+	record[1] = sample.data_len;
+	record[2] = sequence;
+	record[3] = now & 0xffU;
+	record[4] = (now >> 8U) & 0xffU;
+	record[5] = (now >> 16U) & 0xffU;
+	record[6] = now >> 24U;
+	uint8_t *data = record + SAMPLE_HEADER;
+	for (size_t i = 0; i < sample.variables; ++i) {
+		const sample_variable_s *const variable = &sample.variable[i];
+		memcpy(data, sample.span_buf + variable->offset, variable->size);
+		data += variable->size;
+	}
+	rtt_write_done(sample.channel, SAMPLE_HEADER + sample.data_len);
+	++sample.samples;
+}
+
+void sample_print(void (*const print)(const char *fmt, ...))
+{
+	print("Sampling:   %s", sample.active ? "running" : "stopped");
+	if (sample.period_us)
+		print(", every %" PRIu32 " us on channel %" PRIu32, sample.period_us, sample.channel);
+	print("\nSamples:    %" PRIu32 " sent, %" PRIu32 " missed, %" PRIu32 " dropped, %" PRIu32 " read errors\n",
+		sample.samples, sample.missed, sample.dropped, sample.errors);
+	for (size_t i = 0; i < sample.variables; ++i)
+		print("Variable %u: 0x%08" PRIx32 ", %u bytes\n", (unsigned)i, sample.variable[i].addr,
+			(unsigned)sample.variable[i].size);
+	print("Reads:      %u per sample\n", (unsigned)sample.spans);
+}
@@ -0,0 +1,204 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements the background tasks run between GDB packets: RTT,
+ * SWO capture, stats and auxiliary clients on hosted probes, the PC
+ * sampling profiler, the live variable sampler and the image store's
+ * programming button. They are cooperative, each does a bounded amount of
+ * work and returns. GDB runs them while it waits on the target to halt and
+ * while it waits for the next packet, so RTT keeps streaming after GDB has
+ * detached and left the target running.
+ */
+
+#include "general.h"
+#include "sched_tasks.h"
+#include "gdb_main.h"
+#include "profile.h"
+#include "stats.h"
+#include "exception.h"
+#include "gdb_packet.h"
+
+#ifdef ENABLE_RTT
+#include "rtt.h"
+#include "sample.h"
+#endif
+
+#if PC_HOSTED == 1 && defined(PLATFORM_HAS_TRACESWO)
+#include "traceswo.h"
+#endif
+
+#if PC_HOSTED == 1
+#include "aux_if.h"
+#endif
+
+#ifdef PLATFORM_HAS_IMAGE_STORE
+#include "image_store.h"
+#endif
+
+typedef struct sched_task {
+	/* Whether there is work with this running target, which may be NULL */
+	bool (*active)(target *t);
+	void (*run)(target *t);
+	/* Least time between runs, SCHED_IDLE to run along with the others only */
+	uint32_t (*period_ms)(void);
+	uint32_t last_run;
+} sched_task_s;
+
+#if PC_HOSTED == 1
+static bool sched_target_running(target *t)
+{
+	return t != NULL;
+}
+
+static uint32_t sched_along(void)
+{
+	return SCHED_IDLE;
+}
+#endif
+
+static uint32_t sched_always(void)
+{
+	return 0;
+}
+
+#ifdef ENABLE_RTT
+static bool sched_rtt_active(target *t)
+{
+	return t && rtt_enabled;
+}
+
+static uint32_t sched_rtt_period(void)
+{
+	/* poll_rtt() works out on its own which of these slots it uses */
+	return rtt_min_poll_ms;
+}
+
+static bool sched_sample_active(target *t)
+{
+	return t && sample_polling() && !target_no_background_memory_access(t);
+}
+#endif
+
+#if PC_HOSTED == 1 && defined(PLATFORM_HAS_TRACESWO)
+static void sched_traceswo(target *t)
+{
+	(void)t;
+	traceswo_poll();
+}
+#endif
+
+#if PC_HOSTED == 1
+static void sched_stats(target *t)
+{
+	(void)t;
+	stats_poll();
+}
+
+static bool sched_aux_active(target *t)
+{
+	(void)t;
+	return aux_if_listening();
+}
+#endif
+
+#ifdef PLATFORM_HAS_IMAGE_STORE
+static bool sched_image_button_active(target *t)
+{
+	(void)t;
+	return true;
+}
+
+static uint32_t sched_image_button_period(void)
+{
+	return IMAGE_BUTTON_POLL_MS;
+}
+#endif
+
+static bool sched_profile_active(target *t)
+{
+	return t && profile_polling();
+}
+
+static sched_task_s sched_tasks[] = {
+#ifdef ENABLE_RTT
+	{sched_rtt_active, poll_rtt, sched_rtt_period, 0},
+#endif
+#if PC_HOSTED == 1 && defined(PLATFORM_HAS_TRACESWO)
+	{sched_target_running, sched_traceswo, sched_along, 0},
+#endif
+#if PC_HOSTED == 1
+	{sched_target_running, sched_stats, sched_along, 0},
+	/* Auxiliary clients work on GDB's target rather than the one passed in */
+	{sched_aux_active, aux_if_poll, aux_if_period, 0},
+#endif
+#ifdef ENABLE_RTT
+	/* The sampler sets each period to land just before its next sample */
+	{sched_sample_active, sample_poll, sample_period_ms, 0},
+#endif
+	/* The profiler samples as fast as the link allows */
+	{sched_profile_active, profile_poll, sched_always, 0},
+#ifdef PLATFORM_HAS_IMAGE_STORE
+	{sched_image_button_active, image_store_button_poll, sched_image_button_period, 0},
+#endif
+};
+
+uint32_t sched_poll(target *const t)
+{
+	uint32_t wait = SCHED_IDLE;
+	for (size_t i = 0; i < sizeof(sched_tasks) / sizeof(sched_tasks[0]); ++i) {
+		sched_task_s *const task = &sched_tasks[i];
+		if (!task->active(t))
+			continue;
+		uint32_t period = task->period_ms();
+		if (period == SCHED_IDLE) {
+			task->run(t);
+			continue;
+		}
+		uint32_t now = platform_time_ms();
+		if (now - task->last_run >= period) {
+			task->run(t);
+			task->last_run = now;
+			now = platform_time_ms();
+			/* A task may set its next period as it runs */
+			period = task->period_ms();
+		}
+		const uint32_t since = now - task->last_run;
+		wait = MIN(wait, since < period ? period - since : 0);
+	}
+	return wait;
+}
+
+/*
+ * Nobody is there to see the output or a lost target, so the output is
+ * dropped and a target that goes away is let go until found again.
+ */
+uint32_t sched_idle_poll(void)
+{
+	volatile uint32_t wait = SCHED_IDLE;
+	gdb_out_mute(true);
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		wait = sched_poll(gdb_background_target());
+	}
+	gdb_out_mute(false);
+	if (e.type) {
+		DEBUG_WARN("Background target lost: %s\n", e.msg ? e.msg : "");
+		gdb_background_lost();
+		wait = 0;
+	}
+	return wait;
+}
@@ -0,0 +1,171 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file keeps the performance counters shown by "monitor stats" and,
+ * in the hosted build, dumped to the log every now and then, and the GDB
+ * packet latency histograms shown by "monitor latency".
+ */
+
+#include "general.h"
+#include "stats.h"
+
+bmp_stats_t bmp_stats;
+
+void stats_reset(void)
+{
+	memset(&bmp_stats, 0, sizeof(bmp_stats));
+}
+
+void stats_print(void (*const print)(const char *fmt, ...))
+{
+	print("SWD transactions: %" PRIu32 ", WAIT: %" PRIu32 ", FAULT: %" PRIu32 ", retries: %" PRIu32 "\n",
+		bmp_stats.swd_transactions, bmp_stats.swd_waits, bmp_stats.swd_faults, bmp_stats.swd_retries);
+	print("TAR writes:       %" PRIu32 "\n", bmp_stats.tar_writes);
+	print("GDB in:           %" PRIu32 " packets, %" PRIu32 " bytes\n", bmp_stats.gdb_packets_in,
+		bmp_stats.gdb_bytes_in);
+	print("GDB out:          %" PRIu32 " packets, %" PRIu32 " bytes\n", bmp_stats.gdb_packets_out,
+		bmp_stats.gdb_bytes_out);
+	print("Halt polls:       %" PRIu32 "\n", bmp_stats.halt_polls);
+#ifdef ENABLE_RTT
+	for (size_t i = 0; i < MAX_RTT_CHAN; ++i) {
+		if (bmp_stats.rtt_up_bytes[i] || bmp_stats.rtt_down_bytes[i])
+			print("RTT channel %2u:   %" PRIu32 " bytes up, %" PRIu32 " bytes down\n", (unsigned)i,
+				bmp_stats.rtt_up_bytes[i], bmp_stats.rtt_down_bytes[i]);
+	}
+	if (bmp_stats.rtt_halts)
+		print("RTT halts:        %" PRIu32 ", %" PRIu32 " us halted, longest %" PRIu32 " us\n", bmp_stats.rtt_halts,
+			bmp_stats.rtt_halt_us, bmp_stats.rtt_halt_max_us);
+#endif
+#if defined(PLATFORM_HAS_TRACESWO) && PC_HOSTED == 0
+	print("SWO:              %" PRIu32 " bytes, %" PRIu32 " drops, %" PRIu32 " capture overruns\n", bmp_stats.swo_bytes,
+		bmp_stats.swo_drops, bmp_stats.swo_overruns);
+#endif
+#if PC_HOSTED == 0
+	print("UART overruns:    %" PRIu32 "\n", bmp_stats.uart_overruns);
+#endif
+}
+
+#if PC_HOSTED == 1
+/* How often the counters end up in the log, they need -v 1 to be seen */
+#define STATS_DUMP_MS 10000U
+
+void stats_poll(void)
+{
+	static uint32_t last_dump;
+	const uint32_t now = platform_time_ms();
+	if (now - last_dump < STATS_DUMP_MS)
+		return;
+	last_dump = now;
+	if (cl_debuglevel & BMP_DEBUG_INFO)
+		stats_print(DEBUG_INFO);
+}
+#endif
+
+typedef struct latency_hist {
+	char name[LATENCY_NAME_LEN];
+	uint32_t count;
+	uint32_t max_us;
+	uint64_t total_us;
+	/* Bucket n counts times from 2^n up to 2^(n+1) us, the last one everything above */
+	uint16_t buckets[LATENCY_BUCKETS];
+} latency_hist_s;
+
+/* After the host wait comes the catch all, the rest are taken as types are seen */
+#define LATENCY_OTHER 1U
+
+static latency_hist_s latency[LATENCY_KINDS] = {{.name = "(host)"}, {.name = "(other)"}};
+static uint8_t latency_kinds = LATENCY_OTHER + 1U;
+
+static void latency_name(char *const name, const char *const packet, const size_t len)
+{
+	size_t n = 1;
+	if (packet[0] == 'q' || packet[0] == 'Q' || packet[0] == 'v') {
+		while (n < len && n < LATENCY_NAME_LEN - 1U && packet[n] != ':' && packet[n] != ',' && packet[n] != ';' &&
+			packet[n] != '?')
+			++n;
+		/* qXfer is told apart by its object */
+		if (n == 5U && !strncmp(packet, "qXfer", 5U)) {
+			++n;
+			while (n < len && n < LATENCY_NAME_LEN - 1U && packet[n] != ':')
+				++n;
+		}
+	}
+	memcpy(name, packet, n);
+	name[n] = '\0';
+}
+
+uint8_t latency_kind(const char *const packet, const size_t len)
+{
+	if (!len)
+		return LATENCY_OTHER;
+	char name[LATENCY_NAME_LEN];
+	latency_name(name, packet, len);
+	for (uint8_t i = LATENCY_OTHER + 1U; i < latency_kinds; ++i) {
+		if (!strcmp(latency[i].name, name))
+			return i;
+	}
+	if (latency_kinds == LATENCY_KINDS)
+		return LATENCY_OTHER;
+	strcpy(latency[latency_kinds].name, name);
+	return latency_kinds++;
+}
+
+void latency_add(const uint8_t kind, const uint32_t us)
+{
+	latency_hist_s *const hist = &latency[kind];
+	uint8_t bucket = 0;
+	while (bucket < LATENCY_BUCKETS - 1U && us >> (bucket + 1U))
+		++bucket;
+	if (hist->buckets[bucket] != UINT16_MAX)
+		++hist->buckets[bucket];
+	++hist->count;
+	hist->total_us += us;
+	hist->max_us = MAX(hist->max_us, us);
+}
+
+void latency_reset(void)
+{
+	memset(latency, 0, sizeof(latency));
+	strcpy(latency[LATENCY_HOST].name, "(host)");
+	strcpy(latency[LATENCY_OTHER].name, "(other)");
+	latency_kinds = LATENCY_OTHER + 1U;
+}
+
+bool latency_print(void (*const print)(const char *fmt, ...))
+{
+	bool any = false;
+	for (uint8_t i = 0; i < latency_kinds; ++i) {
+		const latency_hist_s *const hist = &latency[i];
+		if (!hist->count)
+			continue;
+		if (!any)
+			print("GDB packet times, counted by bucket from 1 us up in powers of 2:\n");
+		any = true;
+		/* One line per type, so each goes out to GDB in one packet */
+		char line[64U + LATENCY_BUCKETS * 12U];
+		size_t pos = snprintf(line, sizeof(line), "%-16s %7" PRIu32 " avg %8" PRIu32 " us, max %8" PRIu32 " us:",
+			hist->name, hist->count, (uint32_t)(hist->total_us / hist->count), hist->max_us);
+		for (uint8_t bucket = 0; bucket < LATENCY_BUCKETS && pos < sizeof(line); ++bucket) {
+			if (hist->buckets[bucket])
+				pos += snprintf(line + pos, sizeof(line) - pos, " %s%u%s:%u", bucket == LATENCY_BUCKETS - 1U ? ">" : "",
+					bucket < 10U ? 1U << bucket : 1U << (bucket - 10U), bucket < 10U ? "" : "k",
+					(unsigned)hist->buckets[bucket]);
+		}
+		print("%s\n", line);
+	}
+	return any;
+}
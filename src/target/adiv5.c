@@ -31,19 +31,16 @@
 #include "target_probe.h"
 #include "adiv5.h"
 #include "cortexm.h"
+#include "cti.h"
+#include "mtb.h"
+#include "etm.h"
 #include "exception.h"
+#include "stats.h"
 
 /* All this should probably be defined in a dedicated ADIV5 header, so that they
  * are consistently named and accessible when needed in the codebase.
  */
 
-/* Values from ST RM0436 (STM32MP157), 66.9 APx_IDR
- * and ST RM0438 (STM32L5) 52.3.1, AP_IDR */
-#define ARM_AP_TYPE_AHB  1
-#define ARM_AP_TYPE_APB  3
-#define ARM_AP_TYPE_AXI  4
-#define ARM_AP_TYPE_AHB5 5
-
 /* ROM table CIDR values */
 #define CIDR0_OFFSET 0xFF0 /* DBGCID0 */
 #define CIDR1_OFFSET 0xFF4 /* DBGCID1 */
@@ -132,6 +129,11 @@ enum arm_arch {
 	aa_nosupport,
 	aa_cortexm,
 	aa_cortexa,
+	aa_cti,
+	aa_mtb,
+	aa_etm,
+	aa_etm_sink,
+	aa_funnel,
 	aa_end
 };
 
@@ -209,9 +211,9 @@ static const struct {
 	{0x4c7, 0x00, 0, aa_nosupport, cidc_unknown,
 		ARM_COMPONENT_STR("Cortex-M7 PPB", "(Cortex-M7 Private Peripheral Bus ROM Table)")},
 	{0x4c8, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M7 ROM", "(Cortex-M7 ROM)")},
-	{0x906, 0x14, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight CTI", "(Cross Trigger)")},
-	{0x907, 0x21, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight ETB", "(Trace Buffer)")},
-	{0x908, 0x12, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight CSTF", "(Trace Funnel)")},
+	{0x906, 0x14, 0, aa_cti, cidc_unknown, ARM_COMPONENT_STR("CoreSight CTI", "(Cross Trigger)")},
+	{0x907, 0x21, 0, aa_etm_sink, cidc_unknown, ARM_COMPONENT_STR("CoreSight ETB", "(Trace Buffer)")},
+	{0x908, 0x12, 0, aa_funnel, cidc_unknown, ARM_COMPONENT_STR("CoreSight CSTF", "(Trace Funnel)")},
 	{0x910, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight ETM9", "(Embedded Trace)")},
 	{0x912, 0x11, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight TPIU", "(Trace Port Interface Unit)")},
 	{0x913, 0x00, 0, aa_nosupport, cidc_unknown,
@@ -219,13 +221,13 @@ static const struct {
 	{0x914, 0x11, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight SWO", "(Single Wire Output)")},
 	{0x917, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight HTM", "(AHB Trace Macrocell)")},
 	{0x920, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight ETM11", "(Embedded Trace)")},
-	{0x921, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A8 ETM", "(Embedded Trace)")},
-	{0x922, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A8 CTI", "(Cross Trigger)")},
+	{0x921, 0x00, 0, aa_etm, cidc_unknown, ARM_COMPONENT_STR("Cortex-A8 ETM", "(Embedded Trace)")},
+	{0x922, 0x00, 0, aa_cti, cidc_unknown, ARM_COMPONENT_STR("Cortex-A8 CTI", "(Cross Trigger)")},
 	{0x923, 0x11, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M3 TPIU", "(Trace Port Interface Unit)")},
-	{0x924, 0x13, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M3 ETM", "(Embedded Trace)")},
-	{0x925, 0x13, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M4 ETM", "(Embedded Trace)")},
+	{0x924, 0x13, 0, aa_etm, cidc_unknown, ARM_COMPONENT_STR("Cortex-M3 ETM", "(Embedded Trace)")},
+	{0x925, 0x13, 0, aa_etm, cidc_unknown, ARM_COMPONENT_STR("Cortex-M4 ETM", "(Embedded Trace)")},
 	{0x930, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-R4 ETM", "(Embedded Trace)")},
-	{0x932, 0x31, 0x0a31, aa_nosupport, cidc_unknown,
+	{0x932, 0x31, 0x0a31, aa_mtb, cidc_unknown,
 		ARM_COMPONENT_STR("CoreSight MTB-M0+", "(Simple Execution Trace)")},
 	{0x941, 0x00, 0, aa_nosupport, cidc_unknown,
 		ARM_COMPONENT_STR("CoreSight TPIU-Lite", "(Trace Port Interface Unit)")},
@@ -233,17 +235,18 @@ static const struct {
 		ARM_COMPONENT_STR("CoreSight Component", "(unidentified Cortex-A9 component)")},
 	{0x955, 0x00, 0, aa_nosupport, cidc_unknown,
 		ARM_COMPONENT_STR("CoreSight Component", "(unidentified Cortex-A5 component)")},
-	{0x956, 0x13, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A7 ETM", "(Embedded Trace)")},
+	{0x956, 0x13, 0, aa_etm, cidc_unknown, ARM_COMPONENT_STR("Cortex-A7 ETM", "(Embedded Trace)")},
 	{0x95f, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A15 PTM", "(Program Trace Macrocell)")},
-	{0x961, 0x32, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight TMC", "(Trace Memory Controller)")},
+	{0x961, 0x32, 0, aa_etm_sink, cidc_unknown, ARM_COMPONENT_STR("CoreSight TMC", "(Trace Memory Controller)")},
+	{0x961, 0x21, 0, aa_etm_sink, cidc_unknown, ARM_COMPONENT_STR("CoreSight TMC", "(Trace Memory Controller, ETB/ETR)")},
 	{0x962, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight STM", "(System Trace Macrocell)")},
 	{0x963, 0x63, 0x0a63, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight STM", "(System Trace Macrocell)")},
-	{0x975, 0x13, 0x4a13, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M7 ETM", "(Embedded Trace)")},
+	{0x975, 0x13, 0x4a13, aa_etm, cidc_unknown, ARM_COMPONENT_STR("Cortex-M7 ETM", "(Embedded Trace)")},
 	{0x9a0, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight PMU", "(Performance Monitoring Unit)")},
 	{0x9a1, 0x11, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M4 TPIU", "(Trace Port Interface Unit)")},
-	{0x9a6, 0x14, 0x1a14, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M0+ CTI", "(Cross Trigger Interface)")},
+	{0x9a6, 0x14, 0x1a14, aa_cti, cidc_dc, ARM_COMPONENT_STR("Cortex-M0+ CTI", "(Cross Trigger Interface)")},
 	{0x9a9, 0x11, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M7 TPIU", "(Trace Port Interface Unit)")},
-	{0x9a5, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A5 ETM", "(Embedded Trace)")},
+	{0x9a5, 0x00, 0, aa_etm, cidc_unknown, ARM_COMPONENT_STR("Cortex-A5 ETM", "(Embedded Trace)")},
 	{0x9a7, 0x16, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A7 PMU", "(Performance Monitor Unit)")},
 	{0x9af, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A15 PMU", "(Performance Monitor Unit)")},
 	{0xc05, 0x00, 0, aa_cortexa, cidc_dc, ARM_COMPONENT_STR("Cortex-A5 Debug", "(Debug Unit)")},
@@ -266,7 +269,7 @@ static const struct {
 	{0xd21, 0x00, 0x1a02, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Data Watchpoint and Trace)")},
 	{0xd21, 0x00, 0x1a03, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Breakpoint Unit)")},
 	{0xd21, 0x14, 0x1a14, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Cross Trigger)")},
-	{0xd21, 0x13, 0x4a13, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Embedded Trace)")},
+	{0xd21, 0x13, 0x4a13, aa_etm, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Embedded Trace)")},
 	{0xd21, 0x11, 0, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Trace Port Interface Unit)")},
 	{0xfff, 0x00, 0, aa_end, cidc_unknown, ARM_COMPONENT_STR("end", "end")},
 };
@@ -341,6 +344,7 @@ static uint32_t cortexm_initial_halt(ADIv5_AP_t *ap)
 		/* ap_mem_access_setup() sets ADIV5_AP_CSW_ADDRINC_SINGLE -> unusable!*/
 		adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
 		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
+		adiv5_ap_invalidate_cache(ap);
 	}
 
 	/* Workaround for CMSIS-DAP Bulk orbtrace
@@ -442,6 +446,63 @@ static bool cortexm_prepare(ADIv5_AP_t *ap)
 	return true;
 }
 
+/*
+ * Cores found by previous ROM table walks, so that scanning the same part again
+ * can skip the walk. An entry is keyed by DPIDR, TARGETSEL and the AP's IDR and
+ * BASE, and is revalidated by re-reading the PIDRs of the ROM table and cores.
+ * Hosted builds keep the cache on disk between runs.
+ */
+#if PC_HOSTED == 1
+#define COMPONENT_CACHE_ENTRIES 8U
+#else
+/* Probe RAM is tight, a couple of entries cover rescanning the same board */
+#define COMPONENT_CACHE_ENTRIES 2U
+#endif
+/* Cores and their CTIs, MTBs, ETMs and the trace buffer with its funnels */
+#define COMPONENT_CACHE_CORES   10U
+#define COMPONENT_CACHE_MAGIC   0x45433541U /* "A5CE" */
+
+typedef struct component_cache_core {
+	uint64_t pidr;
+	uint32_t addr;
+	uint8_t arch;
+} component_cache_core_s;
+
+typedef struct component_cache_entry {
+	uint32_t dpidr;
+	uint32_t targetsel;
+	uint32_t ap_idr;
+	uint32_t ap_base;
+	uint64_t rom_pidr;
+	uint16_t designer_code;
+	uint16_t partno;
+	uint8_t apsel;
+	uint8_t cores;
+	bool valid;
+	component_cache_core_s core[COMPONENT_CACHE_CORES];
+} component_cache_entry_s;
+
+static struct {
+	uint32_t magic;
+	uint32_t next;
+	component_cache_entry_s entry[COMPONENT_CACHE_ENTRIES];
+} component_cache;
+
+/* The entry being filled in by the current ROM table walk, if it can be cached */
+static component_cache_entry_s *component_cache_record;
+
+static void component_cache_add_core(const enum arm_arch arch, const uint32_t addr, const uint64_t pidr)
+{
+	component_cache_entry_s *const entry = component_cache_record;
+	if (!entry)
+		return;
+	if (entry->cores == COMPONENT_CACHE_CORES) {
+		component_cache_record = NULL;
+		return;
+	}
+	entry->core[entry->cores++] = (component_cache_core_s){pidr, addr, arch};
+}
+
 /* Return true if we find a debuggable device.*/
 static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t recursion, const uint32_t num_entry)
 {
@@ -519,6 +580,7 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t re
 					 * Handle it here, as access only to limited memory region
 					 * is allowed
 					 */
+					component_cache_record = NULL;
 					cortexm_probe(ap);
 					return;
 				}
@@ -600,12 +662,39 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t re
 			switch (arm_component_lut[i].arch) {
 			case aa_cortexm:
 				DEBUG_INFO("%s-> cortexm_probe\n", indent + 1);
+				component_cache_add_core(aa_cortexm, addr, pidr);
 				cortexm_probe(ap);
 				break;
 			case aa_cortexa:
 				DEBUG_INFO("%s-> cortexa_probe\n", indent + 1);
+				component_cache_add_core(aa_cortexa, addr, pidr);
 				cortexa_probe(ap, addr);
 				break;
+			case aa_cti:
+				DEBUG_INFO("%s-> cti_probe\n", indent + 1);
+				component_cache_add_core(aa_cti, addr, pidr);
+				cti_probe(addr);
+				break;
+			case aa_mtb:
+				DEBUG_INFO("%s-> mtb_probe\n", indent + 1);
+				component_cache_add_core(aa_mtb, addr, pidr);
+				mtb_probe(addr);
+				break;
+			case aa_etm:
+				DEBUG_INFO("%s-> etm_probe\n", indent + 1);
+				component_cache_add_core(aa_etm, addr, pidr);
+				etm_probe(addr, part_number);
+				break;
+			case aa_etm_sink:
+				DEBUG_INFO("%s-> etm_sink_probe\n", indent + 1);
+				component_cache_add_core(aa_etm_sink, addr, pidr);
+				etm_sink_probe(ap, addr, part_number);
+				break;
+			case aa_funnel:
+				DEBUG_INFO("%s-> etm_funnel_probe\n", indent + 1);
+				component_cache_add_core(aa_funnel, addr, pidr);
+				etm_funnel_probe(ap, addr);
+				break;
 			default:
 				break;
 			}
@@ -621,6 +710,103 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, const size_t re
 	}
 }
 
+static bool component_cache_key_matches(
+	const component_cache_entry_s *const entry, const ADIv5_AP_t *const ap)
+{
+	return entry->valid && entry->dpidr == ap->dp->dpidr && entry->targetsel == ap->dp->targetsel &&
+	       entry->apsel == ap->apsel && entry->ap_idr == ap->idr && entry->ap_base == ap->base;
+}
+
+static void component_cache_load(void)
+{
+#if PC_HOSTED == 1
+	if (component_cache.magic == COMPONENT_CACHE_MAGIC)
+		return;
+	if (!platform_cache_read("adiv5_components", &component_cache, sizeof(component_cache)) ||
+		component_cache.magic != COMPONENT_CACHE_MAGIC || component_cache.next >= COMPONENT_CACHE_ENTRIES)
+		memset(&component_cache, 0, sizeof(component_cache));
+	component_cache.magic = COMPONENT_CACHE_MAGIC;
+#endif
+}
+
+/* Probe the cores of a cached entry if the part still looks the same, returns false to walk the ROM table */
+static bool adiv5_component_cache_probe(ADIv5_AP_t *ap)
+{
+	component_cache_load();
+	const component_cache_entry_s *entry = NULL;
+	for (size_t i = 0; i < COMPONENT_CACHE_ENTRIES && !entry; ++i) {
+		if (component_cache_key_matches(&component_cache.entry[i], ap))
+			entry = &component_cache.entry[i];
+	}
+	if (!entry)
+		return false;
+
+	if (adiv5_ap_read_pidr(ap, ap->base & 0xfffff000U) != entry->rom_pidr || adiv5_dp_error(ap->dp))
+		return false;
+	for (size_t i = 0; i < entry->cores; ++i) {
+		if (adiv5_ap_read_pidr(ap, entry->core[i].addr) != entry->core[i].pidr || adiv5_dp_error(ap->dp))
+			return false;
+	}
+
+	DEBUG_INFO("AP %d: Using cached ROM table, %u cores\n", ap->apsel, entry->cores);
+	ap->designer_code = entry->designer_code;
+	ap->partno = entry->partno;
+	for (size_t i = 0; i < entry->cores; ++i) {
+		if (entry->core[i].arch == aa_cortexm)
+			cortexm_probe(ap);
+		else if (entry->core[i].arch == aa_cortexa)
+			cortexa_probe(ap, entry->core[i].addr);
+		else if (entry->core[i].arch == aa_cti)
+			cti_probe(entry->core[i].addr);
+		else if (entry->core[i].arch == aa_mtb)
+			mtb_probe(entry->core[i].addr);
+		else if (entry->core[i].arch == aa_etm)
+			etm_probe(entry->core[i].addr, entry->core[i].pidr & PIDR_PN_MASK);
+		else if (entry->core[i].arch == aa_etm_sink)
+			etm_sink_probe(ap, entry->core[i].addr, entry->core[i].pidr & PIDR_PN_MASK);
+		else if (entry->core[i].arch == aa_funnel)
+			etm_funnel_probe(ap, entry->core[i].addr);
+	}
+	return true;
+}
+
+/* Walk the ROM table of the AP and remember what was found on it */
+static void adiv5_component_walk(ADIv5_AP_t *ap)
+{
+	const uint32_t base = ap->base & 0xfffff000U;
+	component_cache_entry_s record = {
+		.dpidr = ap->dp->dpidr,
+		.targetsel = ap->dp->targetsel,
+		.ap_idr = ap->idr,
+		.ap_base = ap->base,
+		.apsel = ap->apsel,
+	};
+	component_cache_record = base ? &record : NULL;
+	if (base)
+		record.rom_pidr = adiv5_ap_read_pidr(ap, base);
+	adiv5_component_probe(ap, ap->base, 0, 0);
+	if (!component_cache_record || ap->dp->fault)
+		return;
+	component_cache_record = NULL;
+
+	record.designer_code = ap->designer_code;
+	record.partno = ap->partno;
+	record.valid = true;
+	size_t slot = component_cache.next;
+	for (size_t i = 0; i < COMPONENT_CACHE_ENTRIES; ++i) {
+		if (component_cache_key_matches(&component_cache.entry[i], ap)) {
+			slot = i;
+			break;
+		}
+	}
+	if (slot == component_cache.next)
+		component_cache.next = (component_cache.next + 1U) % COMPONENT_CACHE_ENTRIES;
+	component_cache.entry[slot] = record;
+#if PC_HOSTED == 1
+	platform_cache_write("adiv5_components", &component_cache, sizeof(component_cache));
+#endif
+}
+
 ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 {
 	ADIv5_AP_t *ap, tmpap;
@@ -629,6 +815,9 @@ ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 	tmpap.dp = dp;
 	tmpap.apsel = apsel;
 	tmpap.idr = adiv5_ap_read(&tmpap, ADIV5_AP_IDR);
+	/* Empty AP slots read an IDR of 0, don't bother with BASE then */
+	if (!tmpap.idr) /* IDR Invalid */
+		return NULL;
 	tmpap.base = adiv5_ap_read(&tmpap, ADIV5_AP_BASE);
 	/* Check the Debug Base Address register. See ADIv5
 		 * Specification C2.6.1 */
@@ -638,9 +827,6 @@ ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 		/* AP0 on STM32MP157C reads 0x00000002 */
 		return NULL;
 	}
-
-	if (!tmpap.idr) /* IDR Invalid */
-		return NULL;
 	tmpap.csw = adiv5_ap_read(&tmpap, ADIV5_AP_CSW) & ~(ADIV5_AP_CSW_SIZE_MASK | ADIV5_AP_CSW_ADDRINC_MASK);
 
 	if (tmpap.csw & ADIV5_AP_CSW_TRINPROG) {
@@ -648,6 +834,19 @@ ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 		return NULL;
 	}
 
+	/*
+	 * Packed transfers are optional, a MEM-AP without them reads the ADDRINC
+	 * field back as something else. Probe with a byte size so that nothing
+	 * is transferred, and leave CSW as it was.
+	 */
+	if ((tmpap.idr & ADIV5_AP_IDR_CLASS_MASK) == ADIV5_AP_IDR_CLASS_MEM) {
+		adiv5_ap_write(&tmpap, ADIV5_AP_CSW, tmpap.csw | ADIV5_AP_CSW_ADDRINC_PACKED | ADIV5_AP_CSW_SIZE_BYTE);
+		const uint32_t csw = adiv5_ap_read(&tmpap, ADIV5_AP_CSW);
+		tmpap.packed_transfers = (csw & ADIV5_AP_CSW_ADDRINC_MASK) == ADIV5_AP_CSW_ADDRINC_PACKED;
+		adiv5_ap_write(&tmpap, ADIV5_AP_CSW, tmpap.csw | ADIV5_AP_CSW_SIZE_WORD);
+		tmpap.large_data = adiv5_ap_read(&tmpap, ADIV5_AP_CFG) & ADIV5_AP_CFG_LD;
+	}
+
 	/* It's valid to so create a heap copy */
 	ap = malloc(sizeof(*ap));
 	if (!ap) { /* malloc failed: heap exhaustion */
@@ -661,7 +860,8 @@ ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 	uint32_t cfg = adiv5_ap_read(ap, ADIV5_AP_CFG);
 	DEBUG_INFO("AP %3d: IDR=%08" PRIx32 " CFG=%08" PRIx32 " BASE=%08" PRIx32 " CSW=%08" PRIx32, apsel, ap->idr, cfg,
 		ap->base, ap->csw);
-	DEBUG_INFO(" (AHB-AP var%" PRIx32 " rev%" PRIx32 ")\n", (ap->idr >> 4) & 0xf, ap->idr >> 28);
+	DEBUG_INFO(" (AHB-AP var%" PRIx32 " rev%" PRIx32 "%s%s)\n", (ap->idr >> 4) & 0xf, ap->idr >> 28,
+		ap->packed_transfers ? ", packed" : "", ap->large_data ? ", 64-bit" : "");
 #endif
 	adiv5_ap_ref(ap);
 	return ap;
@@ -681,6 +881,50 @@ static void rp_rescue_setup(ADIv5_DP_t *dp)
 	return;
 }
 
+/*
+ * APs are numbered from 0 and in practice sit next to each other, so the
+ * scan stops after a few empty slots in a row. Parts identified by their
+ * DPv2 TARGETID can instead give how many APs they have at most.
+ */
+#define ADIV5_AP_SCAN_MAX_EMPTY 4U
+
+static const struct {
+	uint16_t designer_code;
+	uint16_t partno;
+	uint8_t ap_count;
+} adiv5_ap_quirks[] = {
+	{JEP106_MANUFACTURER_RASPBERRY, 0x1002U, 1U}, /* RP2040 core DPs */
+	{JEP106_MANUFACTURER_STM, 0x460U, 1U},        /* STM32G07x/G08x */
+	{JEP106_MANUFACTURER_STM, 0x466U, 1U},        /* STM32G03x/G04x */
+	{JEP106_MANUFACTURER_STM, 0x467U, 1U},        /* STM32G0Bx/G0Cx */
+};
+
+static size_t adiv5_ap_scan_limit(const ADIv5_DP_t *dp)
+{
+	if (dp->version >= 2) {
+		for (size_t i = 0; i < sizeof(adiv5_ap_quirks) / sizeof(adiv5_ap_quirks[0]); ++i) {
+			if (adiv5_ap_quirks[i].designer_code == dp->target_designer_code &&
+				adiv5_ap_quirks[i].partno == dp->target_partno)
+				return adiv5_ap_quirks[i].ap_count;
+		}
+	}
+	return 256U;
+}
+
+/* Write request for system and debug power up and wait for the acknowledge */
+static bool adiv5_dp_power_up(ADIv5_DP_t *dp, uint32_t *ctrlstat, platform_timeout *timeout)
+{
+	adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, *ctrlstat |= ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ);
+	while (1) {
+		*ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
+		uint32_t check = *ctrlstat & (ADIV5_DP_CTRLSTAT_CSYSPWRUPACK | ADIV5_DP_CTRLSTAT_CDBGPWRUPACK);
+		if (check == (ADIV5_DP_CTRLSTAT_CSYSPWRUPACK | ADIV5_DP_CTRLSTAT_CDBGPWRUPACK))
+			return true;
+		if (platform_timeout_is_expired(timeout))
+			return false;
+	}
+}
+
 void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 {
 	/*
@@ -703,6 +947,7 @@ void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 		return;
 	}
 
+	dp->dpidr = dpidr;
 	dp->version = (dpidr & ADIV5_DP_DPIDR_VERSION_MASK) >> ADIV5_DP_DPIDR_VERSION_OFFSET;
 	if (dp->version > 0 && (dpidr & 1U)) {
 		/*
@@ -773,38 +1018,45 @@ void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 		dp->mem_read = firmware_mem_read;
 	if (!dp->mem_write_sized)
 		dp->mem_write_sized = firmware_mem_write_sized;
+	if (!dp->mem_wait32)
+		dp->mem_wait32 = firmware_mem_wait32;
+	if (!dp->sequence)
+		dp->sequence = firmware_sequence;
 #else
 	dp->ap_write = firmware_ap_write;
 	dp->ap_read = firmware_ap_read;
 	dp->mem_read = firmware_mem_read;
 	dp->mem_write_sized = firmware_mem_write_sized;
+	dp->mem_wait32 = firmware_mem_wait32;
+	dp->sequence = firmware_sequence;
+#endif
+	/* The queued accesses drive the SWD lines directly, so only go with the bit-banged low_access */
+	if (dp->low_access == firmware_swdp_low_access && !dp->queue_write) {
+		dp->queue_write = firmware_swdp_queue_write;
+		dp->queue_read = firmware_swdp_queue_read;
+		dp->flush = firmware_swdp_flush;
+	}
+#if PC_HOSTED == 1
+	platform_adiv5_dp_ready(dp);
 #endif
 
-	volatile uint32_t ctrlstat = 0;
+	volatile uint32_t dp_ctrlstat = 0;
 	TRY_CATCH (e, EXCEPTION_TIMEOUT) {
-		ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
+		dp_ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
 	}
 	if (e.type) {
 		DEBUG_WARN("DP not responding!  Trying abort sequence...\n");
 		adiv5_dp_abort(dp, ADIV5_DP_ABORT_DAPABORT);
-		ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
+		dp_ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
 	}
 
+	uint32_t ctrlstat = dp_ctrlstat;
 	platform_timeout timeout;
 	platform_timeout_set(&timeout, 201);
-	/* Write request for system and debug power up */
-	adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, ctrlstat |= ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ);
-	/* Wait for acknowledge */
-	while (1) {
-		ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
-		uint32_t check = ctrlstat & (ADIV5_DP_CTRLSTAT_CSYSPWRUPACK | ADIV5_DP_CTRLSTAT_CDBGPWRUPACK);
-		if (check == (ADIV5_DP_CTRLSTAT_CSYSPWRUPACK | ADIV5_DP_CTRLSTAT_CDBGPWRUPACK))
-			break;
-		if (platform_timeout_is_expired(&timeout)) {
-			DEBUG_INFO("DEBUG Power-Up failed\n");
-			free(dp); /* No AP that referenced this DP so long*/
-			return;
-		}
+	if (!adiv5_dp_power_up(dp, &ctrlstat, &timeout)) {
+		DEBUG_INFO("DEBUG Power-Up failed\n");
+		free(dp); /* No AP that referenced this DP so long*/
+		return;
 	}
 	/* This AP reset logic is described in ADIv5, but fails to work
 	 * correctly on STM32.	CDBGRSTACK is never asserted, and we
@@ -833,8 +1085,13 @@ void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 	/* Probe for APs on this DP */
 	uint32_t last_base = 0;
 	size_t invalid_aps = 0;
+	/* The cores found on this DP are added after the current last target */
+	target *dp_last = target_list;
+	while (dp_last && dp_last->next)
+		dp_last = dp_last->next;
+	const size_t ap_limit = adiv5_ap_scan_limit(dp);
 	dp->refcnt++;
-	for (size_t i = 0; i < 256 && invalid_aps < 8; ++i) {
+	for (size_t i = 0; i < ap_limit && invalid_aps < ADIV5_AP_SCAN_MAX_EMPTY; ++i) {
 		ADIv5_AP_t *ap = NULL;
 #if PC_HOSTED == 1
 		if ((!dp->ap_setup) || dp->ap_setup(i))
@@ -847,12 +1104,10 @@ void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 			if (dp->ap_cleanup)
 				dp->ap_cleanup(i);
 #endif
-			if (++invalid_aps == 8) {
-				adiv5_dp_unref(dp);
-				return;
-			}
+			++invalid_aps;
 			continue;
 		}
+		invalid_aps = 0;
 		if (ap->base == last_base) {
 			DEBUG_WARN("AP %d: Duplicate base\n", i);
 #if PC_HOSTED == 1
@@ -860,6 +1115,7 @@ void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 				dp->ap_cleanup(i);
 #endif
 			adiv5_ap_unref(ap);
+			etm_assign_sink(dp_last ? dp_last->next : target_list);
 			adiv5_dp_unref(dp);
 			/* FIXME: Should we expect valid APs behind duplicate ones? */
 			return;
@@ -877,10 +1133,19 @@ void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 		 * AP should be unref'd if not valid.
 		 */
 
+		/* The cores found on this AP are added after the current last target */
+		target *last = target_list;
+		while (last && last->next)
+			last = last->next;
 		/* The rest should only be added after checking ROM table */
-		adiv5_component_probe(ap, ap->base, 0, 0);
+		if (!adiv5_component_cache_probe(ap))
+			adiv5_component_walk(ap);
+		cti_assign(ap, last ? last->next : target_list);
+		mtb_assign(ap, last ? last->next : target_list);
+		etm_assign(ap, last ? last->next : target_list);
 		adiv5_ap_unref(ap);
 	}
+	etm_assign_sink(dp_last ? dp_last->next : target_list);
 	/* We halted at least CortexM for Romtable scan.
 	 * With connect under reset, keep the devices halted.
 	 * Otherwise, release the devices now.
@@ -896,10 +1161,40 @@ void adiv5_dp_init(ADIv5_DP_t *dp, const uint32_t idcode)
 
 #define ALIGNOF(x) (((x)&3) == 0 ? ALIGN_WORD : (((x)&1) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
 
-/* Program the CSW and TAR for sequencial access at a given width */
-static void ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align)
+/* Address bits that TAR auto-increment isn't guaranteed to carry into */
+static inline uint32_t ap_tar_wrap_mask(const ADIv5_AP_t *ap)
 {
-	uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE;
+	return ~((ap->tar_wrap ? ap->tar_wrap : 1024U) - 1U);
+}
+
+/* Bring the AP's CSW and TAR shadows up to date with the DP's epoch */
+static void ap_cache_sync(ADIv5_AP_t *ap)
+{
+	if (ap->cache_epoch != ap->dp->cache_epoch) {
+		ap->cache_epoch = ap->dp->cache_epoch;
+		adiv5_ap_invalidate_cache(ap);
+	}
+}
+
+static void ap_select(ADIv5_AP_t *ap, uint16_t addr)
+{
+	ADIv5_DP_t *dp = ap->dp;
+	const uint32_t select = ((uint32_t)ap->apsel << 24) | (addr & 0xF0);
+	if (dp->select_valid && dp->select == select)
+		return;
+	adiv5_dp_write(dp, ADIV5_DP_SELECT, select);
+	dp->select = select;
+	dp->select_valid = !dp->fault;
+}
+
+/*
+ * Program the CSW and TAR for sequencial access at a given width, skipping
+ * either if it already holds the right value. The TAR shadow stays invalid
+ * until the access is finished with ap_mem_access_done().
+ */
+static void ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align, uint32_t addrinc)
+{
+	uint32_t csw = ap->csw | addrinc;
 
 	switch (align) {
 	case ALIGN_BYTE:
@@ -908,16 +1203,60 @@ static void ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align)
 	case ALIGN_HALFWORD:
 		csw |= ADIV5_AP_CSW_SIZE_HALFWORD;
 		break;
-	case ALIGN_DWORD:
 	case ALIGN_WORD:
 		csw |= ADIV5_AP_CSW_SIZE_WORD;
 		break;
+	case ALIGN_DWORD:
+		csw |= ADIV5_AP_CSW_SIZE_DWORD;
+		break;
+	}
+	ap_cache_sync(ap);
+	ap->dp->idle_cycles = ap->idle_cycles;
+	ap->dp->transfers = 0;
+	ap->dp->waits = 0;
+	if (!ap->csw_valid || ap->csw_shadow != csw)
+		adiv5_ap_write(ap, ADIV5_AP_CSW, csw);
+	else
+		ap_select(ap, ADIV5_AP_TAR);
+	if (!ap->tar_valid || ap->tar_shadow != addr) {
+		STATS_INC(tar_writes);
+		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, addr);
 	}
-	adiv5_ap_write(ap, ADIV5_AP_CSW, csw);
-	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, addr);
+	ap->tar_valid = false;
 }
 
-/* Extract read data from data lane based on align and src address */
+/*
+ * Double the AP's idle cycles while more than one in eight of its transfers
+ * WAIT, and step them back down after an access of 32 or more without any.
+ */
+static void ap_idle_cycles_learn(ADIv5_AP_t *ap)
+{
+	const ADIv5_DP_t *const dp = ap->dp;
+	if (!adiv5_wait_policy.adaptive)
+		return;
+	if (dp->waits * 8U > dp->transfers)
+		ap->idle_cycles = MIN(ap->idle_cycles * 2U + 1U, ADIV5_IDLE_CYCLES_MAX);
+	else if (!dp->waits && dp->transfers >= 32U && ap->idle_cycles)
+		--ap->idle_cycles;
+}
+
+/*
+ * Record where TAR ended up. Auto-increment past the end of its window is
+ * implementation defined, and anything that went wrong on the way leaves it unknown.
+ */
+static void ap_mem_access_done(ADIv5_AP_t *ap, uint32_t tar)
+{
+	ap_idle_cycles_learn(ap);
+	if (ap->dp->fault || ap->cache_epoch != ap->dp->cache_epoch)
+		return;
+	ap->tar_shadow = tar;
+	ap->tar_valid = true;
+}
+
+/*
+ * Extract read data from data lane based on align and src address. A double
+ * word comes as two DRW beats, each of which is extracted as a word.
+ */
 void *extract(void *dest, uint32_t src, uint32_t val, enum align align)
 {
 	switch (align) {
@@ -932,43 +1271,145 @@ void *extract(void *dest, uint32_t src, uint32_t val, enum align align)
 		*(uint32_t *)dest = val;
 		break;
 	}
-	return (uint8_t *)dest + (1 << align);
+	return (uint8_t *)dest + (1U << MIN(align, ALIGN_WORD));
 }
 
-void firmware_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+static void ap_mem_read_sized(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len, const enum align align)
 {
 	uint32_t tmp;
 	uint32_t osrc = src;
-	const enum align align = MIN(ALIGNOF(src), ALIGNOF(len));
-
-	if (len == 0)
-		return;
 
 	len >>= align;
-	ap_mem_access_setup(ap, src, align);
+	/* Single accesses leave TAR alone, so polling a register needs no TAR writes */
+	const uint32_t addrinc = len == 1U ? ADIV5_AP_CSW_ADDRINC_NONE : ADIV5_AP_CSW_ADDRINC_SINGLE;
+	ap_mem_access_setup(ap, src, align, addrinc);
 	adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
 	while (--len) {
 		tmp = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
 		dest = extract(dest, src, tmp, align);
 
 		src += (1U << align);
-		/* Check for 10 bit address overflow */
-		if ((src ^ osrc) & 0xfffffc00U) {
+		/* Check for address overflow of the auto-increment window */
+		if ((src ^ osrc) & ap_tar_wrap_mask(ap)) {
 			osrc = src;
+			STATS_INC(tar_writes);
 			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, src);
 			adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
 		}
 	}
 	tmp = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
 	extract(dest, src, tmp, align);
+	if (addrinc == ADIV5_AP_CSW_ADDRINC_NONE)
+		ap_mem_access_done(ap, src);
+	else if ((src + (1U << align)) & ~ap_tar_wrap_mask(ap))
+		ap_mem_access_done(ap, src + (1U << align));
 }
 
-void firmware_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align)
+/*
+ * Bulk word reads stream with CTRL/STAT.ORUNDETECT set: the queued transfers
+ * don't stop on WAIT, and an overrun shows up in STICKYORUN when a chunk is
+ * flushed, when it is cleared and the chunk read again. Chunks never cross the
+ * TAR auto-increment window, so TAR is only written after a failed attempt.
+ */
+#define AP_STREAM_MIN_LEN 256U
+#define AP_STREAM_CHUNK   256U
+#define AP_STREAM_RETRIES 3U
+
+static bool ap_mem_stream_flush(ADIv5_DP_t *dp)
+{
+	if (!adiv5_dp_flush(dp))
+		return false;
+	const uint32_t ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
+	if (ctrlstat & ADIV5_DP_CTRLSTAT_STICKYORUN)
+		adiv5_dp_write(dp, ADIV5_DP_ABORT, ADIV5_DP_ABORT_ORUNERRCLR);
+	if (ctrlstat & ADIV5_DP_CTRLSTAT_STICKYERR)
+		dp->fault = 1;
+	return !(ctrlstat & (ADIV5_DP_CTRLSTAT_STICKYORUN | ADIV5_DP_CTRLSTAT_STICKYERR));
+}
+
+/* Returns how many bytes were read, the caller reads the rest the usual way */
+static size_t ap_mem_read_stream(ADIv5_AP_t *ap, void *dest, uint32_t src, const size_t len)
+{
+	ADIv5_DP_t *dp = ap->dp;
+	const uint32_t window = ~ap_tar_wrap_mask(ap) + 1U;
+	ap_mem_access_setup(ap, src, ALIGN_WORD, ADIV5_AP_CSW_ADDRINC_SINGLE);
+	const uint32_t ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
+	adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, ctrlstat | ADIV5_DP_CTRLSTAT_ORUNDETECT);
+	dp->overrun_detect = true;
+
+	size_t offset = 0;
+	bool tar_valid = true;
+	while (offset < len && !dp->fault) {
+		uint32_t data[AP_STREAM_CHUNK / 4U];
+		const size_t chunk = MIN(MIN(len - offset, sizeof(data)), window - (src & (window - 1U)));
+		const size_t words = chunk >> 2U;
+		bool ok = false;
+		for (size_t tries = 0; tries < AP_STREAM_RETRIES && !ok && !dp->fault; ++tries) {
+			if (!tar_valid) {
+				STATS_INC(tar_writes);
+				adiv5_dp_queue_write(dp, ADIV5_AP_TAR, src);
+			}
+			/* The first DRW read only starts the pipeline, RDBUFF returns the last word */
+			adiv5_dp_queue_read(dp, ADIV5_AP_DRW, &data[0]);
+			for (size_t i = 0; i + 1U < words; ++i)
+				adiv5_dp_queue_read(dp, ADIV5_AP_DRW, &data[i]);
+			adiv5_dp_queue_read(dp, ADIV5_DP_RDBUFF, &data[words - 1U]);
+			ok = ap_mem_stream_flush(dp);
+			tar_valid = ok;
+		}
+		if (!ok)
+			break;
+		memcpy((uint8_t *)dest + offset, data, chunk);
+		offset += chunk;
+		src += chunk;
+		/* At the end of the window the next chunk needs TAR written again */
+		tar_valid = (src & (window - 1U)) != 0;
+	}
+
+	dp->overrun_detect = false;
+	adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, ctrlstat);
+	if (tar_valid)
+		ap_mem_access_done(ap, src);
+	return offset;
+}
+
+/*
+ * An unaligned start or length only affects the first and last few bytes, so
+ * those are read at a narrower width and everything in between a word at a time.
+ */
+void firmware_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	if (len == 0)
+		return;
+	/* Reads wait for the writes before them, a failed one faults them */
+	ap->dp->write_posted = false;
+
+	const size_t head = MIN((4U - (src & 3U)) & 3U, len);
+	if (len - head < 4U) {
+		ap_mem_read_sized(ap, dest, src, len, MIN(ALIGNOF(src), ALIGNOF(len)));
+		return;
+	}
+	if (head)
+		ap_mem_read_sized(ap, dest, src, head, MIN(ALIGNOF(src), ALIGNOF(head)));
+	const size_t words = (len - head) & ~3U;
+	size_t streamed = 0;
+	if (words >= AP_STREAM_MIN_LEN && ap->dp->queue_read && !ap->dp->mindp)
+		streamed = ap_mem_read_stream(ap, (uint8_t *)dest + head, src + head, words);
+	if (streamed < words && !ap->dp->fault)
+		ap_mem_read_sized(ap, (uint8_t *)dest + head + streamed, src + head + streamed, words - streamed, ALIGN_WORD);
+	const size_t tail = len - head - words;
+	if (tail)
+		ap_mem_read_sized(ap, (uint8_t *)dest + head + words, src + head + words, tail, ALIGNOF(tail));
+}
+
+static void ap_mem_write_single(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align)
 {
 	uint32_t odest = dest;
 
 	len >>= align;
-	ap_mem_access_setup(ap, dest, align);
+	const uint32_t addrinc = len == 1U ? ADIV5_AP_CSW_ADDRINC_NONE : ADIV5_AP_CSW_ADDRINC_SINGLE;
+	ap_mem_access_setup(ap, dest, align, addrinc);
+	const uint32_t start = dest;
 	while (len--) {
 		uint32_t tmp = 0;
 		/* Pack data into correct data lane */
@@ -986,32 +1427,321 @@ void firmware_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src, si
 		}
 		src = (uint8_t *)src + (1 << align);
 		dest += (1 << align);
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, tmp);
+		adiv5_dp_queue_write(ap->dp, ADIV5_AP_DRW, tmp);
 
-		/* Check for 10 bit address overflow */
-		if ((dest ^ odest) & 0xfffffc00U) {
+		/* Check for address overflow of the auto-increment window */
+		if ((dest ^ odest) & ap_tar_wrap_mask(ap)) {
 			odest = dest;
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, dest);
+			adiv5_dp_queue_write(ap->dp, ADIV5_AP_TAR, dest);
 		}
 	}
+	/* The window boundary check above rewrote TAR if the last write crossed one */
+	ap_mem_access_done(ap, addrinc == ADIV5_AP_CSW_ADDRINC_NONE ? start : dest);
+}
+
+/*
+ * Write whole words of data at a narrower access size, len must be a multiple of 4.
+ * Double words are written the same way, two words to each access.
+ */
+static void ap_mem_write_packed(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align)
+{
+	uint32_t odest = dest;
+
+	ap_mem_access_setup(
+		ap, dest, align, align == ALIGN_DWORD ? ADIV5_AP_CSW_ADDRINC_SINGLE : ADIV5_AP_CSW_ADDRINC_PACKED);
+	for (size_t offset = 0; offset < len; offset += 4U) {
+		uint32_t tmp;
+		memcpy(&tmp, (const uint8_t *)src + offset, sizeof(tmp));
+		adiv5_dp_queue_write(ap->dp, ADIV5_AP_DRW, tmp);
+		dest += 4U;
+
+		/* Check for address overflow of the auto-increment window */
+		if ((dest ^ odest) & ap_tar_wrap_mask(ap)) {
+			odest = dest;
+			adiv5_dp_queue_write(ap->dp, ADIV5_AP_TAR, dest);
+		}
+	}
+	ap_mem_access_done(ap, dest);
+}
+
+void firmware_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align)
+{
+	/*
+	 * For byte and halfword writes, a MEM-AP with packed transfers does a whole word
+	 * of them per DRW write. Only the unaligned head and tail need single transfers.
+	 * Double words take two DRW writes each, the access happening with the second.
+	 */
+	align = adiv5_ap_align(ap, dest, len, align);
+	const size_t head = MIN((4U - (dest & 3U)) & 3U, len);
+	if (align == ALIGN_DWORD)
+		ap_mem_write_packed(ap, dest, src, len, align);
+	else if (align < ALIGN_WORD && ap->packed_transfers && len - head >= 8U) {
+		if (head)
+			ap_mem_write_single(ap, dest, src, head, align);
+		const size_t words = (len - head) & ~3U;
+		ap_mem_write_packed(ap, dest + head, (const uint8_t *)src + head, words, align);
+		const size_t tail = len - head - words;
+		if (tail)
+			ap_mem_write_single(ap, dest + head + words, (const uint8_t *)src + head + words, tail, align);
+	} else
+		ap_mem_write_single(ap, dest, src, len, align);
+	if (ap->posted_writes) {
+		/* The next read or adiv5_dp_barrier() confirms it instead */
+		ap->dp->write_posted = true;
+		adiv5_dp_flush(ap->dp);
+		return;
+	}
 	/* Make sure this write is complete by doing a dummy read */
-	adiv5_dp_read(ap->dp, ADIV5_DP_RDBUFF);
+	uint32_t dummy;
+	adiv5_dp_queue_read(ap->dp, ADIV5_DP_RDBUFF, &dummy);
+	/* Any failure is left in dp->fault for the caller's error check */
+	adiv5_dp_flush(ap->dp);
+}
+
+/*
+ * Wait for posted memory writes to complete with a read of RDBUFF, which
+ * stalls until the AP is done. A failed write faults the read, leaving
+ * dp->fault and STICKYERR for the caller's error check. Returns false then.
+ */
+bool adiv5_dp_barrier(ADIv5_DP_t *dp)
+{
+	if (!dp->write_posted)
+		return !dp->fault;
+	dp->write_posted = false;
+	uint32_t dummy;
+	adiv5_dp_queue_read(dp, ADIV5_DP_RDBUFF, &dummy);
+	return adiv5_dp_flush(dp);
+}
+
+/*
+ * Busy-wait on a status register from the probe side. Through the remote
+ * protocol this costs one round trip per call instead of one per read.
+ */
+uint32_t firmware_mem_wait32(
+	ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t busy_value, uint32_t timeout_ms)
+{
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, timeout_ms);
+	uint32_t value;
+	do {
+		ap->dp->mem_read(ap, &value, addr, sizeof(value));
+	} while ((value & mask) == busy_value && !ap->dp->fault && !platform_timeout_is_expired(&timeout));
+	return value;
+}
+
+bool firmware_sequence(ADIv5_AP_t *ap, adiv5_seq_op_t *ops, size_t count)
+{
+	for (size_t i = 0; i < count && !ap->dp->fault; ++i) {
+		adiv5_seq_op_t *const op = &ops[i];
+		switch (op->type) {
+		case ADIV5_SEQ_DP_READ:
+			op->value = adiv5_dp_read(ap->dp, op->addr);
+			break;
+		case ADIV5_SEQ_DP_WRITE:
+			adiv5_dp_write(ap->dp, op->addr, op->value);
+			break;
+		case ADIV5_SEQ_AP_READ:
+			op->value = adiv5_ap_read(ap, op->addr);
+			break;
+		case ADIV5_SEQ_AP_WRITE:
+			adiv5_ap_write(ap, op->addr, op->value);
+			break;
+		case ADIV5_SEQ_MEM_READ:
+			adiv5_mem_read(ap, &op->value, op->addr, sizeof(op->value));
+			break;
+		case ADIV5_SEQ_MEM_WRITE:
+			adiv5_mem_write_sized(ap, op->addr, &op->value, sizeof(op->value), ALIGN_WORD);
+			break;
+		case ADIV5_SEQ_MEM_WAIT:
+			op->value = adiv5_mem_wait32(ap, op->addr, op->mask, op->busy_value, op->timeout_ms);
+			break;
+		case ADIV5_SEQ_DELAY:
+			platform_delay(op->addr);
+			break;
+		}
+		/* AP registers reached around ap_read and ap_write may have moved CSW or TAR */
+		if ((op->type == ADIV5_SEQ_DP_READ || op->type == ADIV5_SEQ_DP_WRITE) && (op->addr & ADIV5_APnDP))
+			adiv5_ap_invalidate_cache(ap);
+	}
+	return !ap->dp->fault;
 }
 
 void firmware_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 {
-	adiv5_dp_write(ap->dp, ADIV5_DP_SELECT, ((uint32_t)ap->apsel << 24) | (addr & 0xF0));
+	ap_select(ap, addr);
 	adiv5_dp_write(ap->dp, addr, value);
+
+	ap_cache_sync(ap);
+	if (addr == ADIV5_AP_CSW) {
+		ap->csw_shadow = value;
+		ap->csw_valid = !ap->dp->fault;
+	} else if (addr == ADIV5_AP_TAR) {
+		ap->tar_shadow = value;
+		ap->tar_valid = !ap->dp->fault;
+	} else if (addr == ADIV5_AP_DRW)
+		ap->tar_valid = false;
 }
 
 uint32_t firmware_ap_read(ADIv5_AP_t *ap, uint16_t addr)
 {
 	uint32_t ret;
-	adiv5_dp_write(ap->dp, ADIV5_DP_SELECT, ((uint32_t)ap->apsel << 24) | (addr & 0xF0));
+	ap_select(ap, addr);
 	ret = adiv5_dp_read(ap->dp, addr);
+	if (addr == ADIV5_AP_DRW)
+		ap->tar_valid = false;
 	return ret;
 }
 
+void adiv5_dp_protocol_error(ADIv5_DP_t *dp, const char *msg)
+{
+	if (!dp->defer_errors)
+		raise_exception(EXCEPTION_ERROR, msg);
+	dp->protocol_error = true;
+	dp->fault = 1;
+}
+
+/*
+ * Run an access with its errors returned instead of thrown. The firmware
+ * low_access defers them on request, anything else gets a TRY_CATCH.
+ */
+adiv5_status_e adiv5_dp_deferred(ADIv5_DP_t *dp, void (*access)(void *context), void *context)
+{
+	if (dp->low_access == firmware_swdp_low_access || dp->low_access == fw_adiv5_jtagdp_low_access) {
+		dp->defer_errors = true;
+		dp->protocol_error = false;
+		access(context);
+		dp->defer_errors = false;
+		if (dp->protocol_error)
+			return ADIV5_STATUS_ERROR;
+		return dp->fault ? ADIV5_STATUS_FAULT : ADIV5_STATUS_OK;
+	}
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		access(context);
+	}
+	if (e.type == EXCEPTION_ERROR)
+		return ADIV5_STATUS_ERROR;
+	if (e.type == EXCEPTION_TIMEOUT)
+		return ADIV5_STATUS_TIMEOUT;
+	return dp->fault ? ADIV5_STATUS_FAULT : ADIV5_STATUS_OK;
+}
+
+typedef struct adiv5_low_access_args {
+	ADIv5_DP_t *dp;
+	uint8_t RnW;
+	uint16_t addr;
+	uint32_t value;
+	uint32_t result;
+} adiv5_low_access_args_s;
+
+static void adiv5_low_access_deferred(void *const context)
+{
+	adiv5_low_access_args_s *const args = (adiv5_low_access_args_s *)context;
+	args->result = adiv5_dp_low_access(args->dp, args->RnW, args->addr, args->value);
+}
+
+adiv5_status_e adiv5_dp_low_access_status(
+	ADIv5_DP_t *dp, const uint8_t RnW, const uint16_t addr, const uint32_t value, uint32_t *const result)
+{
+	adiv5_low_access_args_s args = {dp, RnW, addr, value, 0};
+	const adiv5_status_e status = adiv5_dp_deferred(dp, adiv5_low_access_deferred, &args);
+	if (result)
+		*result = args.result;
+	return status;
+}
+
+typedef struct adiv5_mem_read_args {
+	ADIv5_AP_t *ap;
+	void *dest;
+	uint32_t src;
+	size_t len;
+} adiv5_mem_read_args_s;
+
+static void adiv5_mem_read_deferred(void *const context)
+{
+	const adiv5_mem_read_args_s *const args = (const adiv5_mem_read_args_s *)context;
+	adiv5_mem_read(args->ap, args->dest, args->src, args->len);
+}
+
+adiv5_wait_policy_s adiv5_wait_policy = {
+	.idle_cycles = 0,
+	.backoff_max = 0,
+	.adaptive = false,
+	.timeout_ms = ADIV5_WAIT_TIMEOUT_MS,
+};
+
+/* WAIT retry budget while halt polling, see adiv5_wait_timeout_ms() */
+uint32_t adiv5_poll_wait_ms = 5U;
+
+adiv5_status_e adiv5_mem_read_status(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	adiv5_mem_read_args_s args = {ap, dest, src, len};
+	return adiv5_dp_deferred(ap->dp, adiv5_mem_read_deferred, &args);
+}
+
+/*
+ * For reattaching without a scan. Over SWD the DP gets woken up and selected
+ * again, over JTAG only the DPIDR is checked. Errors left over from before are
+ * cleared and the debug power is requested again, as a reset or power cycle
+ * of the target drops it.
+ */
+bool adiv5_dp_reconnect(ADIv5_DP_t *dp)
+{
+	volatile bool ok = false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		adiv5_dp_invalidate_cache(dp);
+		if (dp->seq_out)
+			ok = adiv5_swdp_reconnect(dp);
+		else
+			ok = adiv5_dp_read(dp, ADIV5_DP_DPIDR) == dp->dpidr;
+		if (ok) {
+			adiv5_dp_error(dp);
+			uint32_t ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
+			platform_timeout timeout;
+			platform_timeout_set(&timeout, 201);
+			ok = adiv5_dp_power_up(dp, &ctrlstat, &timeout);
+		}
+	}
+	if (e.type) {
+		DEBUG_WARN("DP reconnect failed: %s\n", e.msg);
+		return false;
+	}
+	return ok;
+}
+
+/*
+ * Exercise the link at the current clock rate without side effects on the target.
+ * The DPIDR must read back as found during the scan, TAR has to echo a set of
+ * data patterns and the ROM table CIDR preamble must read back intact.
+ */
+bool adiv5_link_test(ADIv5_AP_t *ap)
+{
+	static const uint32_t patterns[] = {0x00000000U, 0xfffffffcU, 0xaaaaaaa8U, 0x55555554U, 0x12345678U};
+	ADIv5_DP_t *dp = ap->dp;
+	volatile bool ok = true;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		if (dp->dpidr && adiv5_dp_read(dp, ADIV5_DP_DPIDR) != dp->dpidr)
+			ok = false;
+		for (size_t i = 0; ok && i < sizeof(patterns) / sizeof(patterns[0]); ++i) {
+			adiv5_ap_write(ap, ADIV5_AP_TAR, patterns[i]);
+			if (adiv5_ap_read(ap, ADIV5_AP_TAR) != patterns[i])
+				ok = false;
+		}
+		adiv5_ap_invalidate_cache(ap);
+		if (ok && (ap->base & 1U) && (adiv5_ap_read_id(ap, (ap->base & 0xfffff000U) + CIDR0_OFFSET) & ~CID_CLASS_MASK) != CID_PREAMBLE)
+			ok = false;
+		if (adiv5_dp_error(dp))
+			ok = false;
+	}
+	if (e.type) {
+		adiv5_ap_invalidate_cache(ap);
+		return false;
+	}
+	return ok;
+}
+
 void adiv5_mem_write(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len)
 {
 	enum align align = MIN(ALIGNOF(dest), ALIGNOF(len));
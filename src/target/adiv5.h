@@ -124,6 +124,21 @@
 #define ADIV5_AP_BASE ADIV5_AP_REG(0xF8U)
 #define ADIV5_AP_IDR  ADIV5_AP_REG(0xFCU)
 
+/* AP Configuration Register (CFG) */
+#define ADIV5_AP_CFG_LD (1U << 2U) /* Large data extension, 64-bit accesses */
+
+/* AP Identification Register (IDR) */
+#define ADIV5_AP_IDR_CLASS_OFFSET 13U
+#define ADIV5_AP_IDR_CLASS_MASK   (0xfU << ADIV5_AP_IDR_CLASS_OFFSET)
+#define ADIV5_AP_IDR_CLASS_MEM    (8U << ADIV5_AP_IDR_CLASS_OFFSET)
+
+/* Values from ST RM0436 (STM32MP157), 66.9 APx_IDR
+ * and ST RM0438 (STM32L5) 52.3.1, AP_IDR */
+#define ARM_AP_TYPE_AHB  1
+#define ARM_AP_TYPE_APB  3
+#define ARM_AP_TYPE_AXI  4
+#define ARM_AP_TYPE_AHB5 5
+
 /* AP Control and Status Word (CSW) */
 #define ADIV5_AP_CSW_DBGSWENABLE (1U << 31U)
 /* Bits 30:24 - Prot, Implementation defined, for Cortex-M3: */
@@ -142,6 +157,7 @@
 #define ADIV5_AP_CSW_SIZE_BYTE     (0U << 0U)
 #define ADIV5_AP_CSW_SIZE_HALFWORD (1U << 0U)
 #define ADIV5_AP_CSW_SIZE_WORD     (2U << 0U)
+#define ADIV5_AP_CSW_SIZE_DWORD    (3U << 0U)
 #define ADIV5_AP_CSW_SIZE_MASK     (7U << 0U)
 
 /* AP Debug Base Address Register (BASE) */
@@ -233,6 +249,37 @@ enum align {
 
 typedef struct ADIv5_AP_s ADIv5_AP_t;
 
+/* Step types of a DP/AP access sequence, see adiv5_sequence() */
+enum adiv5_seq_type {
+	ADIV5_SEQ_DP_READ,   /* DP register, or banked AP register with APnDP, read */
+	ADIV5_SEQ_DP_WRITE,  /* DP register, or banked AP register with APnDP, write */
+	ADIV5_SEQ_AP_READ,   /* AP register read, selecting the AP and bank */
+	ADIV5_SEQ_AP_WRITE,  /* AP register write, selecting the AP and bank */
+	ADIV5_SEQ_MEM_READ,  /* 32-bit memory read */
+	ADIV5_SEQ_MEM_WRITE, /* 32-bit memory write */
+	ADIV5_SEQ_MEM_WAIT,  /* 32-bit memory poll, as adiv5_mem_wait32() */
+	ADIV5_SEQ_DELAY,     /* Wait for addr ms */
+};
+
+/* Outcome of an access made through the *_status() variants below */
+typedef enum adiv5_status {
+	ADIV5_STATUS_OK,
+	ADIV5_STATUS_FAULT,   /* FAULT ACK, or WAIT for too long, the DP is left faulted */
+	ADIV5_STATUS_TIMEOUT, /* The probe timed out on the target */
+	ADIV5_STATUS_ERROR,   /* Protocol error, the link to the target is lost */
+} adiv5_status_e;
+
+typedef struct adiv5_seq_op_s {
+	enum adiv5_seq_type type;
+	uint32_t addr;
+	/* Value to write, holds the result of reads and waits once the step has run */
+	uint32_t value;
+	/* Waits only */
+	uint32_t mask;
+	uint32_t busy_value;
+	uint32_t timeout_ms;
+} adiv5_seq_op_t;
+
 /* Try to keep this somewhat absract for later adding SW-DP */
 typedef struct ADIv5_DP_s {
 	int refcnt;
@@ -247,6 +294,16 @@ typedef struct ADIv5_DP_s {
 	uint32_t (*error)(struct ADIv5_DP_s *dp);
 	uint32_t (*low_access)(struct ADIv5_DP_s *dp, uint8_t RnW, uint16_t addr, uint32_t value);
 	void (*abort)(struct ADIv5_DP_s *dp, uint32_t abort);
+	/*
+	 * Queued accesses skip the per transfer error handling of low_access. Read
+	 * data is only valid and errors are only known after flush, which returns
+	 * false if any of the queued transfers failed. Optional, see the
+	 * adiv5_dp_queue_*() wrappers for the fallback. Implementations have
+	 * to honour overrun_detect, which is only set while queueing.
+	 */
+	void (*queue_write)(struct ADIv5_DP_s *dp, uint16_t addr, uint32_t value);
+	void (*queue_read)(struct ADIv5_DP_s *dp, uint16_t addr, uint32_t *value);
+	bool (*flush)(struct ADIv5_DP_s *dp);
 
 #if PC_HOSTED == 1
 	bmp_type_t dp_bmp_type;
@@ -263,14 +320,45 @@ typedef struct ADIv5_DP_s {
 
 	void (*mem_read)(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len);
 	void (*mem_write_sized)(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align);
+	/*
+	 * Poll a word for as long as (value & mask) == busy_value or until timeout_ms
+	 * passes, returns the last value read
+	 */
+	uint32_t (*mem_wait32)(ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t busy_value, uint32_t timeout_ms);
+	/* Optional, checksum a memory range where the data is instead of transferring it */
+	int (*mem_crc32)(ADIv5_AP_t *ap, uint32_t *crc, uint32_t addr, size_t len);
+	/* Run the steps in order, stopping at the first fault. Returns false if one faulted */
+	bool (*sequence)(ADIv5_AP_t *ap, adiv5_seq_op_t *ops, size_t count);
 	uint8_t dp_jd_index;
 	uint8_t fault;
+	/* CTRL/STAT.ORUNDETECT is set, queued transfers leave WAITs to STICKYORUN */
+	bool overrun_detect;
+	/*
+	 * Set by adiv5_dp_deferred(), protocol errors then fault the DP and set
+	 * protocol_error instead of throwing. Only the firmware low_access honours it.
+	 */
+	bool defer_errors;
+	bool protocol_error;
+	/* A posted memory write hasn't been confirmed by a read since */
+	bool write_posted;
+	/* A halt poll is in progress, WAITs give up after adiv5_poll_wait_ms, see adiv5_wait_timeout_ms() */
+	bool polling;
+	/* Idle cycles of the AP last set up for memory access, and the transfers and WAITs since */
+	uint8_t idle_cycles;
+	uint32_t transfers;
+	uint32_t waits;
+
+	/* Shadow of SELECT, and the epoch the APs' CSW and TAR shadows belong to */
+	bool select_valid;
+	uint32_t select;
+	uint32_t cache_epoch;
 
 	/* targetsel DPv2 */
 	uint8_t instance;
 	uint32_t targetsel;
 
 	uint8_t version;
+	uint32_t dpidr;
 
 	bool mindp;
 
@@ -292,6 +380,20 @@ struct ADIv5_AP_s {
 	uint32_t idr;
 	uint32_t base;
 	uint32_t csw;
+	bool packed_transfers;     /* Supports ADIV5_AP_CSW_ADDRINC_PACKED */
+	bool large_data;           /* Supports ADIV5_AP_CSW_SIZE_DWORD, two DRW beats per access */
+	uint32_t tar_wrap;         /* TAR auto-increment window if known, otherwise 0 for the guaranteed 1KiB */
+	/* Memory writes skip the RDBUFF read that confirms them, see adiv5_dp_barrier() */
+	bool posted_writes;
+	/* Idle cycles learned from the WAITs seen, see adiv5_wait_policy */
+	uint8_t idle_cycles;
+
+	/* Shadows of CSW and TAR, only valid while cache_epoch matches the DP's */
+	uint32_t cache_epoch;
+	bool csw_valid;
+	bool tar_valid;
+	uint32_t csw_shadow;
+	uint32_t tar_shadow;
 	uint32_t ap_cortexm_demcr; /* Copy of demcr when starting */
 	uint32_t ap_storage;       /* E.g to hold STM32F7 initial DBGMCU_CR value.*/
 
@@ -301,6 +403,46 @@ struct ADIv5_AP_s {
 };
 
 uint8_t make_packet_request(uint8_t RnW, uint16_t addr);
+bool adiv5_dp_barrier(ADIv5_DP_t *dp);
+
+/*
+ * How WAIT responses are handled, set with "monitor swd_wait". idle_cycles are
+ * clocked after every transfer to give a slow AP time before the next request.
+ * WAITs are retried with backoff idle cycles in between, doubling from 1 up to
+ * backoff_max, until timeout_ms passes and the transfer is aborted. With
+ * adaptive set, each AP raises its own idle cycles above idle_cycles while its
+ * memory accesses WAIT often, and lowers them again once they stop.
+ */
+#define ADIV5_WAIT_TIMEOUT_MS 250U
+#define ADIV5_IDLE_CYCLES_MAX 64U
+
+typedef struct adiv5_wait_policy {
+	uint8_t idle_cycles;
+	uint8_t backoff_max;
+	bool adaptive;
+	uint32_t timeout_ms;
+} adiv5_wait_policy_s;
+
+extern adiv5_wait_policy_s adiv5_wait_policy;
+
+/*
+ * A core in a low power mode without debug kept running WAITs every access,
+ * so a halt poll gives up sooner and reports the target as running.
+ */
+extern uint32_t adiv5_poll_wait_ms;
+
+static inline uint32_t adiv5_wait_timeout_ms(const ADIv5_DP_t *dp)
+{
+	return dp->polling ? adiv5_poll_wait_ms : adiv5_wait_policy.timeout_ms;
+}
+
+/* Idle cycles after each transfer, those learned for the AP being accessed if adaptive */
+static inline uint8_t adiv5_idle_cycles(const ADIv5_DP_t *dp)
+{
+	return adiv5_wait_policy.adaptive && dp->idle_cycles > adiv5_wait_policy.idle_cycles ?
+		dp->idle_cycles :
+		adiv5_wait_policy.idle_cycles;
+}
 
 #if PC_HOSTED == 0
 static inline uint32_t adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr)
@@ -308,8 +450,10 @@ static inline uint32_t adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr)
 	return dp->dp_read(dp, addr);
 }
 
+/* Posted writes are confirmed first, so their errors are among those reported */
 static inline uint32_t adiv5_dp_error(ADIv5_DP_t *dp)
 {
+	adiv5_dp_barrier(dp);
 	return dp->error(dp);
 }
 
@@ -348,6 +492,12 @@ static inline void adiv5_dp_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
 	dp->low_access(dp, ADIV5_LOW_WRITE, addr, value);
 }
 
+static inline uint32_t adiv5_mem_wait32(
+	ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t busy_value, uint32_t timeout_ms)
+{
+	return ap->dp->mem_wait32(ap, addr, mask, busy_value, timeout_ms);
+}
+
 #else
 uint32_t adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr);
 uint32_t adiv5_dp_error(ADIv5_DP_t *dp);
@@ -358,14 +508,66 @@ void adiv5_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value);
 void adiv5_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len);
 void adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align);
 void adiv5_dp_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value);
+uint32_t adiv5_mem_wait32(ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t busy_value, uint32_t timeout_ms);
 #endif
 
+/*
+ * Drop the shadows of SELECT and the CSW and TAR of every AP on this DP. Needed
+ * whenever their contents can't be trusted any more: on line reset, fault and abort.
+ */
+static inline void adiv5_dp_invalidate_cache(ADIv5_DP_t *dp)
+{
+	dp->select_valid = false;
+	++dp->cache_epoch;
+}
+
+/* For code that moves TAR or changes CSW through low_access */
+static inline void adiv5_ap_invalidate_cache(ADIv5_AP_t *ap)
+{
+	ap->csw_valid = false;
+	ap->tar_valid = false;
+}
+
+static inline void adiv5_dp_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
+{
+	if (dp->queue_write)
+		dp->queue_write(dp, addr, value);
+	else
+		adiv5_dp_low_access(dp, ADIV5_LOW_WRITE, addr, value);
+}
+
+static inline void adiv5_dp_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value)
+{
+	if (dp->queue_read)
+		dp->queue_read(dp, addr, value);
+	else
+		*value = adiv5_dp_low_access(dp, ADIV5_LOW_READ, addr, 0);
+}
+
+static inline bool adiv5_dp_flush(ADIv5_DP_t *dp)
+{
+	if (dp->flush)
+		return dp->flush(dp);
+	return !dp->fault;
+}
+
+/* Through the remote protocol a whole sequence costs a single round trip */
+static inline bool adiv5_sequence(ADIv5_AP_t *ap, adiv5_seq_op_t *ops, size_t count)
+{
+	return ap->dp->sequence(ap, ops, count);
+}
+
 void adiv5_dp_init(ADIv5_DP_t *dp, uint32_t idcode);
+/* Bring back the link to a DP of an earlier scan, false if a different DP or none answers */
+bool adiv5_dp_reconnect(ADIv5_DP_t *dp);
+bool adiv5_swdp_reconnect(ADIv5_DP_t *dp);
 void platform_adiv5_dp_defaults(ADIv5_DP_t *dp);
+void platform_adiv5_dp_ready(ADIv5_DP_t *dp);
 ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel);
 void remote_jtag_dev(const jtag_dev_t *jtag_dev);
 void adiv5_ap_ref(ADIv5_AP_t *ap);
 void adiv5_ap_unref(ADIv5_AP_t *ap);
+bool adiv5_link_test(ADIv5_AP_t *ap);
 void platform_add_jtag_dev(uint32_t dev_index, const jtag_dev_t *jtag_dev);
 
 void adiv5_jtag_dp_handler(uint8_t jd_index);
@@ -373,11 +575,32 @@ int platform_jtag_dp_init(ADIv5_DP_t *dp);
 int swdptap_init(ADIv5_DP_t *dp);
 
 void adiv5_mem_write(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len);
+
+/*
+ * Exception free variants for the polling loops, where a setjmp per access
+ * costs more than the access itself on the firmware. Errors come back as a
+ * status, the DP is left as the throwing variants leave it.
+ */
+adiv5_status_e adiv5_dp_deferred(ADIv5_DP_t *dp, void (*access)(void *context), void *context);
+adiv5_status_e adiv5_dp_low_access_status(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value, uint32_t *result);
+adiv5_status_e adiv5_mem_read_status(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len);
+/* Called by low_access implementations on a protocol error */
+void adiv5_dp_protocol_error(ADIv5_DP_t *dp, const char *msg);
 uint64_t adiv5_ap_read_pidr(ADIv5_AP_t *ap, uint32_t addr);
 void *extract(void *dest, uint32_t src, uint32_t val, enum align align);
 
+/* Double words need the large data extension and whole ones of them, otherwise they go as words */
+static inline enum align adiv5_ap_align(const ADIv5_AP_t *ap, uint32_t addr, size_t len, enum align align)
+{
+	if (align == ALIGN_DWORD && (!ap->large_data || ((addr | len) & 7U)))
+		return ALIGN_WORD;
+	return align;
+}
+
 void firmware_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len, enum align align);
 void firmware_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len);
+uint32_t firmware_mem_wait32(ADIv5_AP_t *ap, uint32_t addr, uint32_t mask, uint32_t busy_value, uint32_t timeout_ms);
+bool firmware_sequence(ADIv5_AP_t *ap, adiv5_seq_op_t *ops, size_t count);
 void firmware_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value);
 uint32_t firmware_ap_read(ADIv5_AP_t *ap, uint16_t addr);
 uint32_t firmware_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value);
@@ -386,6 +609,9 @@ uint32_t firmware_swdp_read(ADIv5_DP_t *dp, uint16_t addr);
 uint32_t fw_adiv5_jtagdp_read(ADIv5_DP_t *dp, uint16_t addr);
 
 uint32_t firmware_swdp_error(ADIv5_DP_t *dp);
+void firmware_swdp_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value);
+void firmware_swdp_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value);
+bool firmware_swdp_flush(ADIv5_DP_t *dp);
 
 void firmware_swdp_abort(ADIv5_DP_t *dp, uint32_t abort);
 void adiv5_jtagdp_abort(ADIv5_DP_t *dp, uint32_t abort);
@@ -38,6 +38,9 @@
 #define IR_APACC 0xBU
 
 static uint32_t adiv5_jtagdp_error(ADIv5_DP_t *dp);
+static void adiv5_jtagdp_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value);
+static void adiv5_jtagdp_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value);
+static bool adiv5_jtagdp_flush(ADIv5_DP_t *dp);
 
 void adiv5_jtag_dp_handler(uint8_t jd_index)
 {
@@ -54,6 +57,9 @@ void adiv5_jtag_dp_handler(uint8_t jd_index)
 		dp->error = adiv5_jtagdp_error;
 		dp->low_access = fw_adiv5_jtagdp_low_access;
 		dp->abort = adiv5_jtagdp_abort;
+		dp->queue_write = adiv5_jtagdp_queue_write;
+		dp->queue_read = adiv5_jtagdp_queue_read;
+		dp->flush = adiv5_jtagdp_flush;
 	}
 
 	adiv5_dp_init(dp, jtag_devs[jd_index].jd_idcode);
@@ -67,6 +73,7 @@ uint32_t fw_adiv5_jtagdp_read(ADIv5_DP_t *dp, uint16_t addr)
 
 static uint32_t adiv5_jtagdp_error(ADIv5_DP_t *dp)
 {
+	adiv5_dp_invalidate_cache(dp);
 	fw_adiv5_jtagdp_low_access(dp, ADIV5_LOW_READ, ADIV5_DP_CTRLSTAT, 0);
 	return fw_adiv5_jtagdp_low_access(dp, ADIV5_LOW_WRITE, ADIV5_DP_CTRLSTAT, 0xf0000032U) & 0x32U;
 }
@@ -84,10 +91,20 @@ uint32_t fw_adiv5_jtagdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr,
 	jtag_dev_write_ir(&jtag_proc, dp->dp_jd_index, APnDP ? IR_APACC : IR_DPACC);
 
 	platform_timeout timeout;
-	platform_timeout_set(&timeout, 250);
+	platform_timeout_set(&timeout, adiv5_wait_timeout_ms(dp));
+	++dp->transfers;
+	uint32_t backoff = 1;
 	do {
 		jtag_dev_shift_dr(&jtag_proc, dp->dp_jd_index, (uint8_t *)&response, (uint8_t *)&request, 35);
 		ack = response & 0x07;
+		if (ack == JTAGDP_ACK_WAIT) {
+			++dp->waits;
+			/* Backoff as Run-Test/Idle cycles, where the TAP provides for clocking them */
+			if (adiv5_wait_policy.backoff_max && jtag_proc.jtagtap_cycle) {
+				jtag_proc.jtagtap_cycle(false, false, backoff);
+				backoff = MIN(backoff * 2U, adiv5_wait_policy.backoff_max);
+			}
+		}
 	} while (!platform_timeout_is_expired(&timeout) && ack == JTAGDP_ACK_WAIT);
 
 	if (ack == JTAGDP_ACK_WAIT) {
@@ -95,15 +112,105 @@ uint32_t fw_adiv5_jtagdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr,
 		dp->fault = 1;
 		return 0;
 	}
-	if (ack != JTAGDP_ACK_OK)
-		raise_exception(EXCEPTION_ERROR, "JTAG-DP invalid ACK");
+	if (ack != JTAGDP_ACK_OK) {
+		adiv5_dp_protocol_error(dp, "JTAG-DP invalid ACK");
+		return 0;
+	}
 
+	const uint8_t idle_cycles = adiv5_idle_cycles(dp);
+	if (idle_cycles && jtag_proc.jtagtap_cycle)
+		jtag_proc.jtagtap_cycle(false, false, idle_cycles);
 	return (uint32_t)(response >> 3);
 }
 
 void adiv5_jtagdp_abort(ADIv5_DP_t *dp, uint32_t abort)
 {
+	adiv5_dp_invalidate_cache(dp);
 	uint64_t request = (uint64_t)abort << 3;
 	jtag_dev_write_ir(&jtag_proc, dp->dp_jd_index, IR_ABORT);
 	jtag_dev_shift_dr(&jtag_proc, dp->dp_jd_index, NULL, (const uint8_t *)&request, 35);
 }
+
+/*
+ * Queued accesses are pipelined: the data captured by each APACC or DPACC
+ * scan is the result of the access before it, with RDBUFF returning the last
+ * one, so a block read costs one scan per word. Their ACKs are only checked
+ * for the fault to show at flush, there's no retrying a WAIT, so accesses are
+ * only queued while overrun detection leaves WAITs to STICKYORUN, and are
+ * otherwise done one by one as low_access does them.
+ *
+ * Where the adaptor can defer captures, the scans go out as deferred ones so
+ * it can run a whole batch in one round trip, and are only looked at on flush.
+ */
+#if PC_HOSTED == 1
+#define JTAGDP_QUEUE_MAX 64U
+
+static uint64_t jtagdp_queue_response[JTAGDP_QUEUE_MAX];
+static uint32_t *jtagdp_queue_dest[JTAGDP_QUEUE_MAX];
+static size_t jtagdp_queue_count;
+#endif
+
+static void adiv5_jtagdp_queue_result(ADIv5_DP_t *dp, const uint64_t response, uint32_t *const dest)
+{
+	const uint8_t ack = response & 0x07U;
+	if (ack != JTAGDP_ACK_OK && ack != JTAGDP_ACK_WAIT)
+		dp->fault = 1;
+	if (dest)
+		*dest = (uint32_t)(response >> 3U);
+}
+
+static bool adiv5_jtagdp_flush(ADIv5_DP_t *dp)
+{
+#if PC_HOSTED == 1
+	jtag_flush(&jtag_proc);
+	for (size_t i = 0; i < jtagdp_queue_count; ++i)
+		adiv5_jtagdp_queue_result(dp, jtagdp_queue_response[i], jtagdp_queue_dest[i]);
+	jtagdp_queue_count = 0;
+#endif
+	return !dp->fault;
+}
+
+static void adiv5_jtagdp_queue_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value, uint32_t *dest)
+{
+	if (!dp->overrun_detect) {
+#if PC_HOSTED == 1
+		if (jtagdp_queue_count)
+			adiv5_jtagdp_flush(dp);
+#endif
+		const uint32_t result = fw_adiv5_jtagdp_low_access(dp, RnW, addr, value);
+		if (dest)
+			*dest = result;
+		return;
+	}
+
+	const bool APnDP = addr & ADIV5_APnDP;
+	addr &= 0xff;
+	const uint64_t request = ((uint64_t)value << 3U) | ((addr >> 1U) & 0x06U) | (RnW ? 1U : 0U);
+
+	jtag_dev_write_ir(&jtag_proc, dp->dp_jd_index, APnDP ? IR_APACC : IR_DPACC);
+#if PC_HOSTED == 1
+	if (jtag_proc.jtagtap_tdi_tdo_seq_deferred) {
+		if (jtagdp_queue_count == JTAGDP_QUEUE_MAX)
+			adiv5_jtagdp_flush(dp);
+		uint64_t *const response = &jtagdp_queue_response[jtagdp_queue_count];
+		*response = 0;
+		jtagdp_queue_dest[jtagdp_queue_count++] = dest;
+		jtag_dev_shift_dr_deferred(&jtag_proc, dp->dp_jd_index, (uint8_t *)response, (const uint8_t *)&request, 35);
+		return;
+	}
+#endif
+	uint64_t response = 0;
+	jtag_dev_shift_dr(&jtag_proc, dp->dp_jd_index, (uint8_t *)&response, (const uint8_t *)&request, 35);
+	adiv5_jtagdp_queue_result(dp, response, dest);
+}
+
+static void adiv5_jtagdp_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
+{
+	adiv5_jtagdp_queue_access(dp, ADIV5_LOW_WRITE, addr, value, NULL);
+}
+
+static void adiv5_jtagdp_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value)
+{
+	*value = 0;
+	adiv5_jtagdp_queue_access(dp, ADIV5_LOW_READ, addr, 0, value);
+}
@@ -28,6 +28,7 @@
 #include "adiv5.h"
 #include "target.h"
 #include "target_internal.h"
+#include "stats.h"
 
 uint8_t make_packet_request(uint8_t RnW, uint16_t addr)
 {
@@ -50,12 +51,42 @@ uint8_t make_packet_request(uint8_t RnW, uint16_t addr)
 	return request;
 }
 
+/*
+ * TARGETSEL of the DP last selected on a multi-drop bus, 0 when unknown.
+ * Only that DP responds, the others keep their state while deselected.
+ */
+static uint32_t swdp_selected_targetsel;
+
 /* Provide bare DP access functions without timeout and exception */
 
 static void dp_line_reset(ADIv5_DP_t *dp)
 {
+	adiv5_dp_invalidate_cache(dp);
+	swdp_selected_targetsel = 0;
+	dp->seq_out(0xFFFFFFFFU, 32U);
+	dp->seq_out(0x0FFFFFFFU, 32U);
+}
+
+static void dp_select(ADIv5_DP_t *dp, const uint32_t targetsel)
+{
+	dp->dp_low_write(dp, ADIV5_DP_TARGETSEL, targetsel);
+	swdp_selected_targetsel = targetsel;
+}
+
+/*
+ * Switching to another DP on a multi-drop bus takes a line reset, TARGETSEL
+ * and the DPIDR read that completes the selection. SELECT, CTRL/STAT and the
+ * AP state survive deselection, so the DP's caches stay valid.
+ */
+static void firmware_swdp_reselect(ADIv5_DP_t *dp)
+{
+	if (!dp->targetsel || dp->targetsel == swdp_selected_targetsel || !dp->dp_low_write)
+		return;
+	DEBUG_INFO("Selecting DP 0x%08" PRIx32 "\n", dp->targetsel);
 	dp->seq_out(0xFFFFFFFFU, 32U);
 	dp->seq_out(0x0FFFFFFFU, 32U);
+	dp_select(dp, dp->targetsel);
+	firmware_swdp_low_access(dp, ADIV5_LOW_READ, ADIV5_DP_DPIDR, 0);
 }
 
 bool firmware_dp_low_write(ADIv5_DP_t *dp, uint16_t addr, const uint32_t data)
@@ -67,6 +98,22 @@ bool firmware_dp_low_write(ADIv5_DP_t *dp, uint16_t addr, const uint32_t data)
 	return (res != 1);
 }
 
+static void swdp_wakeup(ADIv5_DP_t *dp)
+{
+	/* DORMANT-> SWD sequence*/
+	dp->seq_out(0xFFFFFFFF, 32);
+	dp->seq_out(0xFFFFFFFF, 32);
+	/* 128 bit selection alert sequence for SW-DP-V2 */
+	dp->seq_out(0x6209f392, 32);
+	dp->seq_out(0x86852d95, 32);
+	dp->seq_out(0xe3ddafe9, 32);
+	dp->seq_out(0x19bc0ea2, 32);
+	/* 4 cycle low,
+	 * 0x1a Arm CoreSight SW-DP activation sequence
+	 * 20 bits start of reset another reset sequence*/
+	dp->seq_out(0x1a0, 12);
+}
+
 /* Try first the dormant to SWD procedure.
  * If target id given, scan DPs 0 .. 15 on that device and return.
  * Otherwise
@@ -90,18 +137,7 @@ uint32_t adiv5_swdp_scan(uint32_t targetid)
 		return 0;
 
 	platform_target_clk_output_enable(true);
-	/* DORMANT-> SWD sequence*/
-	initial_dp->seq_out(0xFFFFFFFF, 32);
-	initial_dp->seq_out(0xFFFFFFFF, 32);
-	/* 128 bit selection alert sequence for SW-DP-V2 */
-	initial_dp->seq_out(0x6209f392, 32);
-	initial_dp->seq_out(0x86852d95, 32);
-	initial_dp->seq_out(0xe3ddafe9, 32);
-	initial_dp->seq_out(0x19bc0ea2, 32);
-	/* 4 cycle low,
-	 * 0x1a Arm CoreSight SW-DP activation sequence
-	 * 20 bits start of reset another reset sequence*/
-	initial_dp->seq_out(0x1a0, 12);
+	swdp_wakeup(initial_dp);
 
 	bool scan_multidrop = true;
 	volatile uint32_t dp_targetid = targetid;
@@ -174,7 +210,7 @@ uint32_t adiv5_swdp_scan(uint32_t targetid)
 		if (scan_multidrop) {
 			dp_line_reset(initial_dp);
 
-			initial_dp->dp_low_write(initial_dp, ADIV5_DP_TARGETSEL,
+			dp_select(initial_dp,
 				(i << ADIV5_DP_TARGETSEL_TINSTANCE_OFFSET) |
 					(dp_targetid & (ADIV5_DP_TARGETSEL_TPARTNO_MASK | ADIV5_DP_TARGETSEL_TDESIGNER_MASK | 1U)));
 
@@ -199,6 +235,50 @@ uint32_t adiv5_swdp_scan(uint32_t targetid)
 	return target_list ? 1U : 0U;
 }
 
+static bool swdp_read_dpidr(ADIv5_DP_t *dp, uint32_t *dpidr)
+{
+	volatile uint32_t value = 0;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		value = dp->dp_read(dp, ADIV5_DP_DPIDR);
+	}
+	if (e.type || dp->fault) {
+		dp->fault = 0;
+		return false;
+	}
+	*dpidr = value;
+	return true;
+}
+
+/*
+ * Wake the DP up again the way the scan found it, a reset or power cycle of
+ * the target may have left it dormant or in JTAG mode, reselect it on a
+ * multi-drop bus and check the same DP answers.
+ */
+bool adiv5_swdp_reconnect(ADIv5_DP_t *dp)
+{
+	swdp_wakeup(dp);
+	dp_line_reset(dp);
+	if (dp->targetsel && dp->dp_low_write)
+		dp_select(dp, dp->targetsel);
+	uint32_t dpidr = 0;
+	if (!swdp_read_dpidr(dp, &dpidr)) {
+		dp->seq_out(0xFFFFFFFF, 32);
+		dp->seq_out(0xFFFFFFFF, 32);
+		dp->seq_out(0xE79E, 16); /* 0b0111100111100111 */
+		dp_line_reset(dp);
+		if (dp->targetsel && dp->dp_low_write)
+			dp_select(dp, dp->targetsel);
+		if (!swdp_read_dpidr(dp, &dpidr))
+			return false;
+	}
+	if (dpidr != dp->dpidr) {
+		DEBUG_WARN("DP DPIDR 0x%08" PRIx32 ", expected 0x%08" PRIx32 "\n", dpidr, dp->dpidr);
+		return false;
+	}
+	return true;
+}
+
 uint32_t firmware_swdp_read(ADIv5_DP_t *dp, uint16_t addr)
 {
 	if (addr & ADIV5_APnDP) {
@@ -215,7 +295,7 @@ uint32_t firmware_swdp_error(ADIv5_DP_t *dp)
 		 * With DP Change, another target needs selection.
 		 * => Reselect with right target! */
 		dp_line_reset(dp);
-		dp->dp_low_write(dp, ADIV5_DP_TARGETSEL, dp->targetsel);
+		dp_select(dp, dp->targetsel);
 		dp->dp_read(dp, ADIV5_DP_DPIDR);
 		/* Exception here is unexpected, so do not catch */
 	}
@@ -234,10 +314,29 @@ uint32_t firmware_swdp_error(ADIv5_DP_t *dp)
 
 	adiv5_dp_write(dp, ADIV5_DP_ABORT, clr);
 	dp->fault = 0;
+	adiv5_dp_invalidate_cache(dp);
 
 	return err;
 }
 
+/* seq_out clocks at most 32 cycles at a time */
+static void firmware_swdp_idle(ADIv5_DP_t *dp, uint32_t cycles)
+{
+	for (; cycles > 32U; cycles -= 32U)
+		dp->seq_out(0, 32);
+	if (cycles)
+		dp->seq_out(0, cycles);
+}
+
+/* Idle cycles before retrying a WAIT, doubling up to the policy's backoff_max */
+static uint32_t firmware_swdp_backoff(ADIv5_DP_t *dp, uint32_t backoff)
+{
+	if (!adiv5_wait_policy.backoff_max)
+		return 0;
+	firmware_swdp_idle(dp, backoff);
+	return MIN(backoff * 2U, adiv5_wait_policy.backoff_max);
+}
+
 uint32_t firmware_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t value)
 {
 	uint8_t request = make_packet_request(RnW, addr);
@@ -248,14 +347,36 @@ uint32_t firmware_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, ui
 	if ((addr & ADIV5_APnDP) && dp->fault)
 		return 0;
 
-	platform_timeout_set(&timeout, 250);
+	firmware_swdp_reselect(dp);
+	STATS_INC(swd_transactions);
+	platform_timeout_set(&timeout, adiv5_wait_timeout_ms(dp));
+	++dp->transfers;
+	bool retry = false;
+	uint32_t backoff = 1;
+	/*
+	 * Each attempt runs with the interrupts that would stretch SWCLK held off,
+	 * through to the end of the data phase if it is ACKed. Backoff and the
+	 * timeout checks between attempts run with them on.
+	 */
+	uint32_t critical;
 	do {
+		if (retry)
+			STATS_INC(swd_retries);
+		critical = platform_swd_critical_enter();
 		dp->seq_out(request, 8);
 		ack = dp->seq_in(3);
-		if (ack == SWDP_ACK_FAULT) {
+		if (ack != SWDP_ACK_OK)
+			platform_swd_critical_exit(critical);
+		if (ack == SWDP_ACK_WAIT) {
+			STATS_INC(swd_waits);
+			++dp->waits;
+			backoff = firmware_swdp_backoff(dp, backoff);
+		} else if (ack == SWDP_ACK_FAULT) {
+			STATS_INC(swd_faults);
 			/* On fault, abort the request and repeat */
 			dp->error(dp);
 		}
+		retry = true;
 	} while ((ack == SWDP_ACK_WAIT || ack == SWDP_ACK_FAULT) && !platform_timeout_is_expired(&timeout));
 
 	if (ack == SWDP_ACK_WAIT) {
@@ -269,13 +390,18 @@ uint32_t firmware_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, ui
 		return 0;
 	}
 
-	if (ack != SWDP_ACK_OK)
-		raise_exception(EXCEPTION_ERROR, "SWDP invalid ACK");
+	if (ack != SWDP_ACK_OK) {
+		adiv5_dp_protocol_error(dp, "SWDP invalid ACK");
+		return 0;
+	}
 
 	if (RnW) {
-		if (dp->seq_in_parity(&response, 32)) { /* Give up on parity error */
+		const bool parity_error = dp->seq_in_parity(&response, 32);
+		platform_swd_critical_exit(critical);
+		if (parity_error) { /* Give up on parity error */
 			dp->fault = 1;
-			raise_exception(EXCEPTION_ERROR, "SWDP Parity error");
+			adiv5_dp_protocol_error(dp, "SWDP Parity error");
+			return 0;
 		}
 	} else {
 		dp->seq_out_parity(value, 32);
@@ -289,11 +415,107 @@ uint32_t firmware_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, ui
 		 *   slight speed decrease
 		 */
 		dp->seq_out(0, 8);
+		platform_swd_critical_exit(critical);
 	}
+	firmware_swdp_idle(dp, adiv5_idle_cycles(dp));
 	return response;
 }
 
 void firmware_swdp_abort(ADIv5_DP_t *dp, uint32_t abort)
 {
+	adiv5_dp_invalidate_cache(dp);
 	adiv5_dp_write(dp, ADIV5_DP_ABORT, abort);
 }
+
+/*
+ * Send the request of a queued transfer and return whether its data phase
+ * follows. WAITs are retried as usual, but anything else that isn't OK just
+ * marks the DP as faulted so the rest of the queue is skipped and flush
+ * reports it. Sticky errors from the AP turn into FAULT ACKs on the
+ * following AP accesses, so they end up there too and are cleared by the
+ * caller's adiv5_dp_error() as before.
+ *
+ * With overrun detection on, WAIT and FAULT are followed by a data phase
+ * like OK is, and STICKYORUN reports them at the end instead.
+ *
+ * When a data phase follows, the transaction's critical section is still
+ * held and the caller ends it with what is left in critical.
+ */
+static bool firmware_swdp_queue_request(ADIv5_DP_t *dp, uint8_t RnW, uint16_t addr, uint32_t *ack, uint32_t *critical)
+{
+	if ((addr & ADIV5_APnDP) && dp->fault)
+		return false;
+
+	firmware_swdp_reselect(dp);
+	const uint8_t request = make_packet_request(RnW, addr);
+	*critical = platform_swd_critical_enter();
+	dp->seq_out(request, 8);
+	*ack = dp->seq_in(3);
+	if (dp->overrun_detect) {
+		if (*ack != SWDP_ACK_OK && *ack != SWDP_ACK_WAIT && *ack != SWDP_ACK_FAULT)
+			dp->fault = 1;
+		return true;
+	}
+	++dp->transfers;
+	if (*ack == SWDP_ACK_WAIT) {
+		platform_swd_critical_exit(*critical);
+		++dp->waits;
+		platform_timeout timeout;
+		platform_timeout_set(&timeout, adiv5_wait_timeout_ms(dp));
+		uint32_t backoff = 1;
+		while (*ack == SWDP_ACK_WAIT && !platform_timeout_is_expired(&timeout)) {
+			backoff = firmware_swdp_backoff(dp, backoff);
+			*critical = platform_swd_critical_enter();
+			dp->seq_out(request, 8);
+			*ack = dp->seq_in(3);
+			if (*ack == SWDP_ACK_WAIT)
+				platform_swd_critical_exit(*critical);
+		}
+		if (*ack == SWDP_ACK_WAIT)
+			dp->abort(dp, ADIV5_DP_ABORT_DAPABORT);
+	}
+	if (*ack != SWDP_ACK_OK) {
+		if (*ack != SWDP_ACK_WAIT)
+			platform_swd_critical_exit(*critical);
+		dp->fault = 1;
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Unlike low_access, the 8 idle cycles don't follow the data as another transfer
+ * or flush does, only those of the wait policy
+ */
+void firmware_swdp_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
+{
+	uint32_t ack;
+	uint32_t critical;
+	if (firmware_swdp_queue_request(dp, ADIV5_LOW_WRITE, addr, &ack, &critical)) {
+		dp->seq_out_parity(value, 32);
+		platform_swd_critical_exit(critical);
+		firmware_swdp_idle(dp, adiv5_idle_cycles(dp));
+	}
+}
+
+void firmware_swdp_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *value)
+{
+	uint32_t ack;
+	*value = 0;
+	/* Nothing drives the data of a WAITed or FAULTed read, so only check parity on OK */
+	uint32_t critical;
+	if (!firmware_swdp_queue_request(dp, ADIV5_LOW_READ, addr, &ack, &critical))
+		return;
+	const bool parity_error = dp->seq_in_parity(value, 32);
+	platform_swd_critical_exit(critical);
+	if (parity_error && ack == SWDP_ACK_OK)
+		dp->fault = 1;
+	firmware_swdp_idle(dp, adiv5_idle_cycles(dp));
+}
+
+bool firmware_swdp_flush(ADIv5_DP_t *dp)
+{
+	/* Clock the last write through the SW-DP */
+	dp->seq_out(0, 8);
+	return !dp->fault;
+}
@@ -48,6 +48,7 @@ static int ch32f1_flash_write(struct target_flash *f,
 #define FLASH_AR						(FPEC_BASE + 0x14)
 #define FLASH_CR_LOCK					(1 << 7)
 #define FLASH_CR_STRT					(1 << 6)
+#define FLASH_CR_PER					(1 << 1)
 #define FLASH_SR_BSY					(1 << 0)
 #define KEY1 							0x45670123
 #define KEY2 							0xCDEF89AB
@@ -66,6 +67,7 @@ static int ch32f1_flash_write(struct target_flash *f,
 #define FLASH_CR_BUF_RESET_CH32   		(1 << 19) // Buffer reset
 #define FLASH_SR_EOP			  		(1 << 5)  // End of programming
 #define FLASH_BEGIN_ADDRESS_CH32  		0x8000000
+#define FLASH_PAGE_SIZE					1024U // standard page erase
 
 /**
 		\fn ch32f1_add_flash
@@ -84,46 +86,19 @@ static void ch32f1_add_flash(target *t, uint32_t addr, size_t length, size_t era
 	f->blocksize = erasesize;
 	f->erase = ch32f1_flash_erase;
 	f->write = ch32f1_flash_write;
-	f->buf_size = erasesize;
+	f->buf_size = FLASH_PAGE_SIZE; // 8 fast pages written per unlock
 	f->erased = 0xff;
 	target_add_flash(t, f);
 }
 
-#define WAIT_BUSY() do { \
-	sr = target_mem_read32(t, FLASH_SR); \
-	if (target_check_error(t)) { \
-		DEBUG_WARN("ch32f1 flash write: comm error\n"); \
-		return -1; \
-	} \
-} while (sr & FLASH_SR_BSY);
-
-#define WAIT_EOP() do { \
-	sr = target_mem_read32(t, FLASH_SR); \
-	if (target_check_error(t)) { \
-		DEBUG_WARN("ch32f1 flash write: comm error\n"); \
-		return -1; \
-	} \
-} while (!(sr & FLASH_SR_EOP));
-
-#define CLEAR_EOP()	target_mem_write32(t, FLASH_SR,FLASH_SR_EOP)
-
 #define SET_CR(bit) do { \
 	const uint32_t cr = target_mem_read32(t, FLASH_CR) | (bit); \
 	target_mem_write32(t, FLASH_CR, cr); \
 } while(0)
 
-#define CLEAR_CR(bit) do { \
-	const uint32_t cr = target_mem_read32(t, FLASH_CR) & (~(bit)); \
-	target_mem_write32(t, FLASH_CR, cr); \
-} while(0)
-
 // Which one is the right value ?
 #define MAGIC_WORD 0x100
 // #define MAGIC_WORD 0x1000
-#define MAGIC(addr) do { \
-	magic = target_mem_read32(t, (addr) ^ MAGIC_WORD); \
-	target_mem_write32(t, FLASH_MAGIC , magic); \
-} while(0)
 
 /**
   \fn ch32f1_flash_unlock
@@ -189,13 +164,114 @@ bool ch32f1_probe(target *t)
 	return true;
 }
 
+/*
+ * The flash operations are queued as ADIv5 access sequences, which the remote
+ * protocol runs in a single round trip and which poll SR on the probe, instead
+ * of one round trip per access and per poll.
+ */
+#define CH32_SEQ_OPS 16U
+
+struct ch32f1_seq {
+	target *t;
+	adiv5_seq_op_t ops[CH32_SEQ_OPS];
+	size_t count;
+	bool ok;
+	/* A MAGIC value is being read by ops[magic_read] */
+	bool magic;
+	size_t magic_read;
+};
+
+static void ch32f1_seq_run(struct ch32f1_seq *seq)
+{
+	if (!seq->count)
+		return;
+	if (!adiv5_sequence(cortexm_ap(seq->t), seq->ops, seq->count) || target_check_error(seq->t)) {
+		DEBUG_WARN("ch32f1 flash: comm error\n");
+		seq->ok = false;
+	}
+	for (size_t i = 0; i < seq->count; ++i) {
+		const adiv5_seq_op_t *const op = &seq->ops[i];
+		if (op->type == ADIV5_SEQ_MEM_WAIT && (op->value & op->mask) == op->busy_value) {
+			DEBUG_WARN("ch32f1 flash: timeout, sr: 0x%08" PRIx32 "\n", op->value);
+			seq->ok = false;
+		}
+	}
+	const bool magic = seq->magic;
+	const uint32_t magic_value = seq->ops[seq->magic_read].value;
+	seq->count = 0;
+	seq->magic = false;
+	/* The value read goes to FLASH_MAGIC right away, at the start of the next sequence */
+	if (magic) {
+		seq->ops[seq->count++] =
+			(adiv5_seq_op_t){.type = ADIV5_SEQ_MEM_WRITE, .addr = FLASH_MAGIC, .value = magic_value};
+	}
+}
+
+static adiv5_seq_op_t *ch32f1_seq_op(struct ch32f1_seq *seq, enum adiv5_seq_type type, uint32_t addr)
+{
+	if (seq->count == CH32_SEQ_OPS)
+		ch32f1_seq_run(seq);
+	adiv5_seq_op_t *const op = &seq->ops[seq->count++];
+	*op = (adiv5_seq_op_t){.type = type, .addr = addr};
+	return op;
+}
+
+static void ch32f1_seq_write(struct ch32f1_seq *seq, uint32_t addr, uint32_t value)
+{
+	ch32f1_seq_op(seq, ADIV5_SEQ_MEM_WRITE, addr)->value = value;
+}
+
+static void ch32f1_seq_read(struct ch32f1_seq *seq, uint32_t addr)
+{
+	ch32f1_seq_op(seq, ADIV5_SEQ_MEM_READ, addr);
+}
+
+/* Poll SR until (SR & mask) != busy_value */
+static void ch32f1_seq_wait(struct ch32f1_seq *seq, uint32_t mask, uint32_t busy_value)
+{
+	adiv5_seq_op_t *const op = ch32f1_seq_op(seq, ADIV5_SEQ_MEM_WAIT, FLASH_SR);
+	op->mask = mask;
+	op->busy_value = busy_value;
+	op->timeout_ms = 500;
+}
+
+/* Wait for EOP and clear it, then leave CR with cr */
+static void ch32f1_seq_wait_eop(struct ch32f1_seq *seq, uint32_t cr)
+{
+	ch32f1_seq_wait(seq, FLASH_SR_EOP, 0);
+	ch32f1_seq_write(seq, FLASH_SR, FLASH_SR_EOP);
+	ch32f1_seq_write(seq, FLASH_CR, cr);
+}
+
+/* Copy the flash word at addr ^ MAGIC_WORD to FLASH_MAGIC, as the WCH library does after each operation */
+static void ch32f1_seq_magic(struct ch32f1_seq *seq, uint32_t addr)
+{
+	ch32f1_seq_read(seq, addr ^ MAGIC_WORD);
+	seq->magic = true;
+	seq->magic_read = seq->count - 1U;
+}
+
+/* Run what is left and check SR for errors */
+static bool ch32f1_seq_finish(struct ch32f1_seq *seq, const char *what)
+{
+	ch32f1_seq_read(seq, FLASH_SR);
+	const size_t sr_read = seq->count - 1U;
+	ch32f1_seq_run(seq);
+	const uint32_t sr = seq->ops[sr_read].value;
+	if (sr & SR_ERROR_MASK) {
+		DEBUG_WARN("ch32f1 flash %s error 0x%" PRIx32 "\n", what, sr);
+		return false;
+	}
+	return seq->ok;
+}
+
 /**
   \fn ch32f1_flash_erase
   \brief fast erase of CH32
+		Whole 1 KB pages go with one standard page erase, the rest 128 bytes at a time with the fast page erase
 */
 int ch32f1_flash_erase(struct target_flash *f, target_addr addr, size_t len)
 {
-	volatile uint32_t sr, magic;
 	target *t = f->t;
 	DEBUG_INFO("CH32: flash erase \n");
 
@@ -203,31 +279,36 @@ int ch32f1_flash_erase(struct target_flash *f, target_addr addr, size_t len)
 		DEBUG_WARN("CH32: Unlock failed\n");
 		return -1;
 	}
-	// Fast Erase 128 bytes pages (ch32 mode)
+	struct ch32f1_seq seq = {.t = t, .ok = true};
 	while (len) {
-		SET_CR(FLASH_CR_FTER_CH32);// CH32 PAGE_ER
+		if (!(addr & (FLASH_PAGE_SIZE - 1U)) && len >= FLASH_PAGE_SIZE) {
+			ch32f1_seq_write(&seq, FLASH_CR, FLASH_CR_PER);
+			ch32f1_seq_write(&seq, FLASH_AR, addr);
+			ch32f1_seq_write(&seq, FLASH_CR, FLASH_CR_PER | FLASH_CR_STRT);
+			ch32f1_seq_wait(&seq, FLASH_SR_BSY, FLASH_SR_BSY);
+			ch32f1_seq_write(&seq, FLASH_SR, FLASH_SR_EOP);
+			ch32f1_seq_write(&seq, FLASH_CR, 0);
+			addr += FLASH_PAGE_SIZE;
+			len -= FLASH_PAGE_SIZE;
+			continue;
+		}
+		// Fast Erase 128 bytes pages (ch32 mode)
+		ch32f1_seq_write(&seq, FLASH_CR, FLASH_CR_FTER_CH32); // CH32 PAGE_ER
 		/* write address to FMA */
-		target_mem_write32(t, FLASH_AR, addr);
+		ch32f1_seq_write(&seq, FLASH_AR, addr);
 		/* Flash page erase start instruction */
-		SET_CR(FLASH_CR_STRT);
-		WAIT_EOP();
-		CLEAR_EOP();
-		CLEAR_CR(FLASH_CR_STRT);
-		// Magic
-		MAGIC(addr);
+		ch32f1_seq_write(&seq, FLASH_CR, FLASH_CR_FTER_CH32 | FLASH_CR_STRT);
+		ch32f1_seq_wait_eop(&seq, 0);
+		ch32f1_seq_magic(&seq, addr);
 		if (len > 128)
 			len -= 128;
 		else
 			len = 0;
 		addr += 128;
 	}
-	sr = target_mem_read32(t, FLASH_SR);
+	const bool ok = ch32f1_seq_finish(&seq, "erase");
 	ch32f1_flash_lock(t);
-	if (sr & SR_ERROR_MASK) {
-		DEBUG_WARN("ch32f1 flash erase error 0x%" PRIx32 "\n", sr);
-		return -1;
-	}
-	return 0;
+	return ok ? 0 : -1;
 }
 
 /**
@@ -237,63 +318,58 @@ int ch32f1_flash_erase(struct target_flash *f, target_addr addr, size_t len)
 			We do 32 to have a bit of headroom, then we check we read ffff (erased flash)
 			NB: Just reading fff is not enough as it could be a transient previous operation value
 */
-
-static bool ch32f1_wait_flash_ready(target *t, uint32_t addr)
+static bool ch32f1_wait_flash_ready(struct ch32f1_seq *seq, uint32_t addr)
 {
-	uint32_t ff = 0;
 	for (size_t i = 0; i < 32; i++)
-		ff = target_mem_read32(t, addr);
+		ch32f1_seq_read(seq, addr);
+	const size_t last_read = seq->count - 1U;
+	ch32f1_seq_run(seq);
+	const uint32_t ff = seq->ops[last_read].value;
 	if (ff != 0xffffffffUL) {
 		DEBUG_WARN("ch32f1 Not erased properly at %" PRIx32 " or flash access issue\n", addr);
 		return false;
 	}
-	return true;
+	return seq->ok;
 }
+
 /**
-  \fn ch32f1_flash_write
-  \brief fast flash for ch32. Load 128 bytes chunk and then flash them
+  \fn ch32f1_upload
+  \brief load 16 bytes at offset into the write buffer
 */
-
-static int ch32f1_upload(target *t, uint32_t dest, const void *src, uint32_t offset)
+static void ch32f1_upload(struct ch32f1_seq *seq, uint32_t dest, const void *src, uint32_t offset)
 {
-	volatile uint32_t sr, magic;
-	const uint32_t *ss = (const uint32_t *)(src+offset);
-	uint32_t dd = dest + offset;
-
-	SET_CR(FLASH_CR_FTPG_CH32);
-	target_mem_write32(t, dd + 0, ss[0]);
-	target_mem_write32(t, dd + 4, ss[1]);
-	target_mem_write32(t, dd + 8, ss[2]);
-	target_mem_write32(t, dd + 12, ss[3]);
-	SET_CR(FLASH_CR_BUF_LOAD_CH32); /* BUF LOAD */
-	WAIT_EOP();
-	CLEAR_EOP();
-	CLEAR_CR(FLASH_CR_FTPG_CH32);
-	MAGIC(dest + offset);
-	return 0;
+	uint32_t ss[4];
+	memcpy(ss, (const uint8_t *)src + offset, sizeof(ss));
+	const uint32_t dd = dest + offset;
+
+	ch32f1_seq_write(seq, FLASH_CR, FLASH_CR_FTPG_CH32);
+	for (size_t i = 0; i < 4; i++)
+		ch32f1_seq_write(seq, dd + i * 4U, ss[i]);
+	ch32f1_seq_write(seq, FLASH_CR, FLASH_CR_FTPG_CH32 | FLASH_CR_BUF_LOAD_CH32); /* BUF LOAD */
+	ch32f1_seq_wait_eop(seq, 0);
+	ch32f1_seq_magic(seq, dd);
 }
+
 /**
 	\fn ch32f1_buffer_clear
 	\brief clear the write buffer
 */
-static int ch32f1_buffer_clear(target *t)
+static void ch32f1_buffer_clear(struct ch32f1_seq *seq)
 {
-	volatile uint32_t sr;
-	SET_CR(FLASH_CR_FTPG_CH32); // Fast page program 4-
-	SET_CR(FLASH_CR_BUF_RESET_CH32); // BUF_RESET 5-
-	WAIT_BUSY(); // 6-
-	CLEAR_CR(FLASH_CR_FTPG_CH32); // Fast page program 4-
-	return 0;
+	ch32f1_seq_write(seq, FLASH_CR, FLASH_CR_FTPG_CH32); // Fast page program 4-
+	ch32f1_seq_write(seq, FLASH_CR, FLASH_CR_FTPG_CH32 | FLASH_CR_BUF_RESET_CH32); // BUF_RESET 5-
+	ch32f1_seq_wait(seq, FLASH_SR_BSY, FLASH_SR_BSY); // 6-
+	ch32f1_seq_write(seq, FLASH_CR, 0); // Fast page program 4-
 }
 //#define CH32_VERIFY
 
 /**
-
+  \fn ch32f1_flash_write
+  \brief fast flash for ch32. Load 128 bytes chunks and then flash them, unlocking once for the whole buffer
 */
 static int ch32f1_flash_write(struct target_flash *f,
 	target_addr dest, const void *src, size_t len)
 {
-	volatile uint32_t sr, magic;
 	target *t = f->t;
 	size_t length = len;
 #ifdef CH32_VERIFY
@@ -302,35 +378,28 @@ static int ch32f1_flash_write(struct target_flash *f,
 #endif
 	DEBUG_INFO("CH32: flash write 0x%" PRIx32 " ,size=%zu\n", dest, len);
 
-	while (length > 0)
-	{
-		if (ch32f1_flash_unlock(t)) {
-			DEBUG_WARN("ch32f1 cannot fast unlock\n");
-			return -1;
-		}
-		WAIT_BUSY();
+	if (ch32f1_flash_unlock(t)) {
+		DEBUG_WARN("ch32f1 cannot fast unlock\n");
+		return -1;
+	}
+	struct ch32f1_seq seq = {.t = t, .ok = true};
+	ch32f1_seq_wait(&seq, FLASH_SR_BSY, FLASH_SR_BSY);
 
+	while (length > 0 && seq.ok) {
 		// Buffer reset...
-		ch32f1_buffer_clear(t);
+		ch32f1_buffer_clear(&seq);
 		// Load 128 bytes to buffer
-		if (!ch32f1_wait_flash_ready(t,dest))
-			return -1;
+		if (!ch32f1_wait_flash_ready(&seq, dest))
+			break;
 
-		for (size_t i = 0; i < 8; i++) {
-			if (ch32f1_upload(t, dest, src, i * 16U)) {
-	  			DEBUG_WARN("Cannot upload to buffer\n");
-				return -1;
-			}
-		}
+		for (size_t i = 0; i < 8; i++)
+			ch32f1_upload(&seq, dest, src, i * 16U);
 		// write buffer
-		SET_CR(FLASH_CR_FTPG_CH32);
-		target_mem_write32(t, FLASH_AR, dest); // 10
-		SET_CR(FLASH_CR_STRT); // 11 Start
-		WAIT_EOP(); // 12
-		CLEAR_EOP();
-		CLEAR_CR(FLASH_CR_FTPG_CH32);
-
-		MAGIC(dest);
+		ch32f1_seq_write(&seq, FLASH_CR, FLASH_CR_FTPG_CH32);
+		ch32f1_seq_write(&seq, FLASH_AR, dest); // 10
+		ch32f1_seq_write(&seq, FLASH_CR, FLASH_CR_FTPG_CH32 | FLASH_CR_STRT); // 11 Start
+		ch32f1_seq_wait_eop(&seq, 0); // 12
+		ch32f1_seq_magic(&seq, dest);
 
 		// next
 		if (length > 128)
@@ -339,15 +408,13 @@ static int ch32f1_flash_write(struct target_flash *f,
 			length = 0;
 		dest += 128;
 		src += 128;
-
-		sr = target_mem_read32(t, FLASH_SR); // 13
-		ch32f1_flash_lock(t);
-		if (sr & SR_ERROR_MASK) {
-			DEBUG_WARN("ch32f1 flash write error 0x%" PRIx32 "\n", sr);
-			return -1;
-		}
 	}
 
+	const bool ok = ch32f1_seq_finish(&seq, "write") && !length; // 13
+	ch32f1_flash_lock(t);
+	if (!ok)
+		return -1;
+
 #ifdef CH32_VERIFY
 	DEBUG_INFO("Verifying\n");
 	for (size_t i = 0; i < len; i += 4)
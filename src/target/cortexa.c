@@ -60,6 +60,9 @@ static uint32_t apb_read(target *t, uint16_t reg);
 static void write_gpreg(target *t, uint8_t regno, uint32_t val);
 static uint32_t read_gpreg(target *t, uint8_t regno);
 
+/* Page translations remembered between resumes */
+#define CORTEXA_TLB_ENTRIES      4U
+
 struct cortexa_priv {
 	uint32_t base;
 	ADIv5_AP_t *apb;
@@ -76,11 +79,27 @@ struct cortexa_priv {
 	unsigned hw_watchpoint_max;
 	uint16_t hw_watchpoint_mask;
 	bool mmu_fault;
+	/* System MEM-AP for memory access by physical address, NULL to go through the core */
+	ADIv5_AP_t *mem_ap;
+	uint32_t dcache_line;
+	/* Recent VA to PA page translations, only good until the core runs again */
+	struct {
+		uint32_t va;
+		uint32_t pa;
+	} tlb[CORTEXA_TLB_ENTRIES];
+	uint8_t tlb_used;
+	uint8_t tlb_next;
 };
 
-/* This may be specific to Cortex-A9 */
+/* This may be specific to Cortex-A9, CTR gives the real one on attach */
 #define CACHE_LINE_LENGTH        (8*4)
 
+/* The MMU maps memory in pages no smaller than this */
+#define MMU_PAGE_SIZE            0x1000U
+
+/* APs looked at for a system MEM-AP */
+#define CORTEXA_MEM_AP_SCAN      8U
+
 /* Debug APB registers */
 #define DBGDIDR                  0
 
@@ -131,6 +150,16 @@ struct cortexa_priv {
 #define DBGWCR_PAC_ANY           (0b11 << 1)
 #define DBGWCR_EN                (1 << 0)
 
+/* Banked data registers once TAR points at DBGDTRRX */
+enum {
+	DB_DTRRX,
+	DB_ITR,
+	DB_DSCR,
+	DB_DTRTX,
+};
+
+#define CORTEXA_ITR_PER_SEQUENCE 8U
+
 /* Instruction encodings for accessing the coprocessor interface */
 #define MCR 0xee000010
 #define MRC 0xee100010
@@ -142,6 +171,13 @@ struct cortexa_priv {
 #define DBGDTRRXint CPREG(14, 0, 0, 0, 5, 0)
 #define DBGDTRTXint CPREG(14, 0, 0, 0, 5, 0)
 
+/* Moves rt to the host through DBGDTRTX */
+#define DCC_READ(rt) (MCR | DBGDTRTXint | ((rt) << 12))
+#define DCC_IS_READ(instr) ((instr) == DCC_READ(((instr) >> 12U) & 0xfU))
+
+/* Identification registers CP15 */
+#define CTR         CPREG(15, 0, 0, 0, 0, 1)
+
 /* Address translation registers CP15 */
 #define PAR         CPREG(15, 0, 0, 7, 4, 0)
 #define ATS1CPR     CPREG(15, 0, 0, 7, 8, 0)
@@ -219,9 +255,23 @@ static uint32_t apb_read(target *t, uint16_t reg)
 	return adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
 }
 
+/* The translation tables can only change while the core runs */
+static void cortexa_tlb_flush(target *t)
+{
+	struct cortexa_priv *priv = t->priv;
+	priv->tlb_used = 0;
+	priv->tlb_next = 0;
+}
+
 static uint32_t va_to_pa(target *t, uint32_t va)
 {
 	struct cortexa_priv *priv = t->priv;
+	const uint32_t page = va & ~(MMU_PAGE_SIZE - 1U);
+	for (size_t i = 0; i < priv->tlb_used; i++) {
+		if (priv->tlb[i].va == page)
+			return priv->tlb[i].pa | (va & (MMU_PAGE_SIZE - 1U));
+	}
+
 	write_gpreg(t, 0, va);
 	apb_write(t, DBGITR, MCR | ATS1CPR);
 	apb_write(t, DBGITR, MRC | PAR);
@@ -231,6 +281,15 @@ static uint32_t va_to_pa(target *t, uint32_t va)
 	uint32_t pa = (par & ~0xfff) | (va & 0xfff);
 	DEBUG_INFO("%s: VA = 0x%08"PRIx32", PAR = 0x%08"PRIx32", PA = 0x%08"PRIX32"\n",
               __func__, va, par, pa);
+	if (par & 1)
+		return pa;
+
+	/* Replace round robin, the pages in use are few and short lived */
+	priv->tlb[priv->tlb_next].va = page;
+	priv->tlb[priv->tlb_next].pa = pa & ~(MMU_PAGE_SIZE - 1U);
+	priv->tlb_next = (priv->tlb_next + 1U) % CORTEXA_TLB_ENTRIES;
+	if (priv->tlb_used < CORTEXA_TLB_ENTRIES)
+		priv->tlb_used++;
 	return pa;
 }
 
@@ -273,38 +332,22 @@ static void cortexa_slow_mem_read(target *t, void *dest, target_addr src, size_t
 	}
 }
 
+/* Byte stores for the unaligned ends of a write, aborts are checked by the caller */
 static void cortexa_slow_mem_write_bytes(target *t, target_addr dest, const uint8_t *src, size_t len)
 {
-	struct cortexa_priv *priv = t->priv;
-
 	/* Set r13 to dest address */
 	write_gpreg(t, 13, dest);
 
 	while (len--) {
 		write_gpreg(t, 0, *src++);
 		apb_write(t, DBGITR, 0xe4cd0001); /* strb r0, [sp], #1 */
-		if (apb_read(t, DBGDSCR) & DBGDSCR_SDABORT_L) {
-			/* Memory access aborted, flag a fault */
-			apb_write(t, DBGDRCR, DBGDRCR_CSE);
-			priv->mmu_fault = true;
-			return;
-		}
 	}
 }
 
-static void cortexa_slow_mem_write(target *t, target_addr dest, const void *src, size_t len)
+/* Words streamed through DCC fast mode, one stc issued for all of them */
+static void cortexa_slow_mem_write_words(target *t, target_addr dest, const uint8_t *src, size_t words)
 {
-	struct cortexa_priv *priv = t->priv;
-	if (len == 0)
-		return;
-
-	if ((dest & 3) || (len & 3)) {
-		cortexa_slow_mem_write_bytes(t, dest, src, len);
-		return;
-	}
-
 	write_gpreg(t, 0, dest);
-	const uint32_t *src32 = src;
 
 	/* Switch to fast DCC mode */
 	uint32_t dbgdscr = apb_read(t, DBGDSCR);
@@ -313,12 +356,38 @@ static void cortexa_slow_mem_write(target *t, target_addr dest, const void *src,
 
 	apb_write(t, DBGITR, 0xeca05e01); /* stc 14, cr5, [r0], #4 */
 
-	for (; len; len -= 4)
-		apb_write(t, DBGDTRRX, *src32++);
+	/* With TAR not incrementing, it stays on DBGDTRRX for all the words */
+	struct cortexa_priv *priv = t->priv;
+	adiv5_ap_write(priv->apb, ADIV5_AP_CSW, priv->apb->csw | ADIV5_AP_CSW_SIZE_WORD);
+	adiv5_ap_write(priv->apb, ADIV5_AP_TAR, priv->base + 4U * DBGDTRRX);
+	for (size_t i = 0; i < words; i++) {
+		uint32_t word;
+		memcpy(&word, src + i * 4U, sizeof(word));
+		adiv5_dp_low_access(priv->apb->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, word);
+	}
 
 	/* Switch back to stalling DCC mode */
 	dbgdscr = (dbgdscr & ~DBGDSCR_EXTDCCMODE_MASK) | DBGDSCR_EXTDCCMODE_STALL;
 	apb_write(t, DBGDSCR, dbgdscr);
+}
+
+static void cortexa_slow_mem_write(target *t, target_addr dest, const void *src, size_t len)
+{
+	struct cortexa_priv *priv = t->priv;
+	if (len == 0)
+		return;
+
+	/* Only the unaligned head and tail are stored a byte at a time */
+	const uint8_t *data = src;
+	const size_t head = MIN((4U - (dest & 3U)) & 3U, len);
+	const size_t words = (len - head) / 4U;
+	const size_t tail = len - head - words * 4U;
+	if (head)
+		cortexa_slow_mem_write_bytes(t, dest, data, head);
+	if (words)
+		cortexa_slow_mem_write_words(t, dest + head, data + head, words);
+	if (tail)
+		cortexa_slow_mem_write_bytes(t, dest + head + words * 4U, data + head + words * 4U, tail);
 
 	if (apb_read(t, DBGDSCR) & DBGDSCR_SDABORT_L) {
 		/* Memory access aborted, flag a fault */
@@ -327,6 +396,108 @@ static void cortexa_slow_mem_write(target *t, target_addr dest, const void *src,
 	}
 }
 
+/*
+ * Memory through the system MEM-AP. It sees physical memory behind the
+ * core's data cache, so the lines covering the range are cleaned before a
+ * read and cleaned and invalidated before a write, and every MMU page is
+ * translated on its own. If the MEM-AP faults, the core has a go.
+ */
+static void cortexa_dcache_maintain(target *t, target_addr addr, size_t len, uint32_t op)
+{
+	struct cortexa_priv *priv = t->priv;
+	const uint32_t first = addr & ~(priv->dcache_line - 1U);
+	const size_t lines = (addr - first + len + priv->dcache_line - 1U) / priv->dcache_line;
+	for (size_t i = 0; i < lines; ++i) {
+		write_gpreg(t, 0, first + i * priv->dcache_line);
+		apb_write(t, DBGITR, MCR | op);
+	}
+}
+
+static void cortexa_mem_read(target *t, void *dest, target_addr src, size_t len)
+{
+	struct cortexa_priv *priv = t->priv;
+	cortexa_dcache_maintain(t, src, len, DCCMVAC);
+	uint8_t *data = dest;
+	for (size_t done = 0; done < len && !priv->mmu_fault;) {
+		const size_t chunk = MIN(len - done, MMU_PAGE_SIZE - ((src + done) & (MMU_PAGE_SIZE - 1U)));
+		const uint32_t pa = va_to_pa(t, src + done);
+		if (priv->mmu_fault)
+			return;
+		adiv5_mem_read(priv->mem_ap, data + done, pa, chunk);
+		if (adiv5_dp_error(priv->mem_ap->dp)) {
+			cortexa_slow_mem_read(t, data + done, src + done, chunk);
+			if (priv->mmu_fault)
+				return;
+		}
+		done += chunk;
+	}
+}
+
+static void cortexa_mem_write(target *t, target_addr dest, const void *src, size_t len)
+{
+	struct cortexa_priv *priv = t->priv;
+	cortexa_dcache_maintain(t, dest, len, DCCIMVAC);
+	const uint8_t *data = src;
+	for (size_t done = 0; done < len && !priv->mmu_fault;) {
+		const size_t chunk = MIN(len - done, MMU_PAGE_SIZE - ((dest + done) & (MMU_PAGE_SIZE - 1U)));
+		const uint32_t pa = va_to_pa(t, dest + done);
+		if (priv->mmu_fault)
+			return;
+		adiv5_mem_write(priv->mem_ap, pa, data + done, chunk);
+		if (adiv5_dp_error(priv->mem_ap->dp))
+			cortexa_slow_mem_write(t, dest + done, data + done, chunk);
+		done += chunk;
+	}
+}
+
+/*
+ * The system MEM-AP is an AXI-AP, or failing that an AHB-AP in slot 0 as
+ * on Zynq and i.MX. Other AHB-APs are usually a Cortex-M's own bus.
+ */
+static ADIv5_AP_t *cortexa_find_mem_ap(ADIv5_AP_t *apb)
+{
+	ADIv5_DP_t *dp = apb->dp;
+	ADIv5_AP_t *found = NULL;
+	for (uint8_t i = 0; i < CORTEXA_MEM_AP_SCAN; ++i) {
+		if (i == apb->apsel)
+			continue;
+		ADIv5_AP_t *ap = NULL;
+#if PC_HOSTED == 1
+		if ((!dp->ap_setup) || dp->ap_setup(i))
+			ap = adiv5_new_ap(dp, i);
+#else
+		ap = adiv5_new_ap(dp, i);
+#endif
+		const uint32_t type = ap ? ap->idr & 0xfU : 0;
+		const bool mem = ap && (ap->idr & ADIV5_AP_IDR_CLASS_MASK) == ADIV5_AP_IDR_CLASS_MEM;
+		if (mem && (type == ARM_AP_TYPE_AXI || (!found && i == 0 && type == ARM_AP_TYPE_AHB))) {
+			if (found)
+				adiv5_ap_unref(found);
+			found = ap;
+			if (type == ARM_AP_TYPE_AXI)
+				break;
+			continue;
+		}
+		if (ap)
+			adiv5_ap_unref(ap);
+#if PC_HOSTED == 1
+		else if (dp->ap_cleanup)
+			dp->ap_cleanup(i);
+#endif
+	}
+	if (found)
+		DEBUG_INFO("cortexa: memory access through AP %d\n", found->apsel);
+	return found;
+}
+
+static void cortexa_priv_free(void *priv)
+{
+	struct cortexa_priv *const cortexa = priv;
+	if (cortexa->mem_ap)
+		adiv5_ap_unref(cortexa->mem_ap);
+	free(cortexa);
+}
+
 static bool cortexa_check_error(target *t)
 {
 	struct cortexa_priv *priv = t->priv;
@@ -353,10 +524,17 @@ bool cortexa_probe(ADIv5_AP_t *apb, uint32_t debug_base)
 	}
 
 	t->priv = priv;
-	t->priv_free = free;
+	t->priv_free = cortexa_priv_free;
 	priv->apb = apb;
-	t->mem_read = cortexa_slow_mem_read;
-	t->mem_write = cortexa_slow_mem_write;
+	priv->dcache_line = CACHE_LINE_LENGTH;
+	priv->mem_ap = cortexa_find_mem_ap(apb);
+	if (priv->mem_ap) {
+		t->mem_read = cortexa_mem_read;
+		t->mem_write = cortexa_mem_write;
+	} else {
+		t->mem_read = cortexa_slow_mem_read;
+		t->mem_write = cortexa_slow_mem_write;
+	}
 
 	priv->base = debug_base;
 	/* Set up APB CSW, we won't touch this again */
@@ -419,6 +597,11 @@ bool cortexa_attach(target *t)
 	}
 	priv->hw_breakpoint_mask = 0;
 	priv->bcr0 = 0;
+	cortexa_tlb_flush(t);
+
+	/* Smallest data cache line, for maintenance by MVA */
+	apb_write(t, DBGITR, MRC | CTR);
+	priv->dcache_line = 4U << ((read_gpreg(t, 0) >> 16U) & 0xfU);
 
 	platform_nrst_set_val(false);
 
@@ -477,6 +660,66 @@ static void write_gpreg(target *t, uint8_t regno, uint32_t val)
 	apb_write(t, DBGITR, instr);
 }
 
+/*
+ * Run each instruction through DBGITR, picking up the value after each
+ * DCC_READ() from DBGDTRTX. TAR stays on the banked data registers for the
+ * whole batch, so a register costs one write and one read on the link
+ * instead of re-addressing both registers every time. Stalling DCC mode
+ * holds off each access until the core is done with the one before.
+ */
+static void cortexa_itr_read(target *t, const uint32_t *instrs, size_t count, uint32_t *values)
+{
+	struct cortexa_priv *priv = t->priv;
+	ADIv5_AP_t *ap = priv->apb;
+	ADIv5_DP_t *dp = ap->dp;
+
+	adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
+	adiv5_dp_low_access(dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, priv->base + 4U * DBGDTRRX);
+	adiv5_ap_invalidate_cache(ap);
+	/* Required to switch banks */
+	adiv5_ap_write(ap, ADIV5_AP_DB(DB_ITR), instrs[0]);
+	if (DCC_IS_READ(instrs[0]))
+		*values++ = adiv5_dp_read(dp, ADIV5_AP_DB(DB_DTRTX));
+	++instrs;
+	--count;
+
+	if (dp->sequence == firmware_sequence) {
+		for (size_t i = 0; i < count; ++i) {
+			adiv5_dp_queue_write(dp, ADIV5_AP_DB(DB_ITR), instrs[i]);
+			if (DCC_IS_READ(instrs[i])) {
+				uint32_t posted;
+				adiv5_dp_queue_read(dp, ADIV5_AP_DB(DB_DTRTX), &posted);
+				adiv5_dp_queue_read(dp, ADIV5_DP_RDBUFF, values++);
+			}
+		}
+		/* Faults are left for the caller's target_check_error() */
+		adiv5_dp_flush(dp);
+		return;
+	}
+
+	adiv5_seq_op_t ops[CORTEXA_ITR_PER_SEQUENCE * 2U] = {{0}};
+	for (size_t base = 0; base < count; base += CORTEXA_ITR_PER_SEQUENCE) {
+		const size_t batch = MIN(count - base, CORTEXA_ITR_PER_SEQUENCE);
+		size_t n = 0;
+		for (size_t i = 0; i < batch; ++i) {
+			const uint32_t instr = instrs[base + i];
+			ops[n].type = ADIV5_SEQ_DP_WRITE;
+			ops[n].addr = ADIV5_AP_DB(DB_ITR);
+			ops[n++].value = instr;
+			if (DCC_IS_READ(instr)) {
+				ops[n].type = ADIV5_SEQ_DP_READ;
+				ops[n++].addr = ADIV5_AP_DB(DB_DTRTX);
+			}
+		}
+		if (!adiv5_sequence(ap, ops, n))
+			return;
+		for (size_t i = 0; i < n; ++i) {
+			if (ops[i].type == ADIV5_SEQ_DP_READ)
+				*values++ = ops[i].value;
+		}
+	}
+}
+
 static void cortexa_regs_read(target *t, void *data)
 {
 	struct cortexa_priv *priv = (struct cortexa_priv *)t->priv;
@@ -533,25 +776,31 @@ static ssize_t cortexa_reg_write(target *t, int reg, const void *data, size_t ma
 static void cortexa_regs_read_internal(target *t)
 {
 	struct cortexa_priv *priv = (struct cortexa_priv *)t->priv;
-	/* Read general purpose registers */
-	for (int i = 0; i < 15; i++) {
-		priv->reg_cache.r[i] = read_gpreg(t, i);
-	}
-	/* Read PC, via r0.  MCR is UNPREDICTABLE for Rt = r15. */
-	apb_write(t, DBGITR, 0xe1a0000f); /* mov r0, pc */
-	priv->reg_cache.r[15] = read_gpreg(t, 0);
-	/* Read CPSR */
-	apb_write(t, DBGITR, 0xE10F0000); /* mrs r0, CPSR */
-	priv->reg_cache.cpsr = read_gpreg(t, 0);
-	/* Read FPSCR */
-	apb_write(t, DBGITR, 0xeef10a10); /* vmrs r0, fpscr */
-	priv->reg_cache.fpscr = read_gpreg(t, 0);
-	/* Read out VFP registers */
-	for (int i = 0; i < 16; i++) {
-		/* Read D[i] to R0/R1 */
-		apb_write(t, DBGITR, 0xEC510B10 | i); /* vmov r0, r1, d0 */
-		priv->reg_cache.d[i] = ((uint64_t)read_gpreg(t, 1) << 32) | read_gpreg(t, 0);
+	/* r0-r14, then PC, CPSR and FPSCR by way of r0, then D[i] through r0 and r1 */
+	uint32_t instrs[15 + 3 * 2 + 16 * 3];
+	uint32_t values[15 + 3 + 16 * 2];
+	size_t count = 0;
+	for (uint32_t i = 0; i < 15; i++)
+		instrs[count++] = DCC_READ(i);
+	/* MCR is UNPREDICTABLE for Rt = r15 */
+	instrs[count++] = 0xe1a0000f; /* mov r0, pc */
+	instrs[count++] = DCC_READ(0);
+	instrs[count++] = 0xE10F0000; /* mrs r0, CPSR */
+	instrs[count++] = DCC_READ(0);
+	instrs[count++] = 0xeef10a10; /* vmrs r0, fpscr */
+	instrs[count++] = DCC_READ(0);
+	for (uint32_t i = 0; i < 16; i++) {
+		instrs[count++] = 0xEC510B10 | i; /* vmov r0, r1, d[i] */
+		instrs[count++] = DCC_READ(0);
+		instrs[count++] = DCC_READ(1);
 	}
+	cortexa_itr_read(t, instrs, count, values);
+
+	memcpy(priv->reg_cache.r, values, 16 * sizeof(uint32_t));
+	priv->reg_cache.cpsr = values[16];
+	priv->reg_cache.fpscr = values[17];
+	for (size_t i = 0; i < 16; i++)
+		priv->reg_cache.d[i] = ((uint64_t)values[18 + i * 2 + 1] << 32) | values[18 + i * 2];
 	priv->reg_cache.r[15] -= (priv->reg_cache.cpsr & CPSR_THUMB) ? 4 : 8;
 }
 
@@ -622,24 +871,34 @@ static void cortexa_halt_request(target *t)
 	}
 }
 
+typedef struct apb_read_args {
+	target *t;
+	uint16_t reg;
+	uint32_t value;
+} apb_read_args_s;
+
+static void apb_read_deferred(void *context)
+{
+	apb_read_args_s *args = context;
+	args->value = apb_read(args->t, args->reg);
+}
+
 static enum target_halt_reason cortexa_halt_poll(target *t, target_addr *watch)
 {
-	volatile uint32_t dbgdscr = 0;
-	volatile struct exception e;
-	TRY_CATCH (e, EXCEPTION_ALL) {
-		/* If this times out because the target is in WFI then
-		 * the target is still running. */
-		dbgdscr = apb_read(t, DBGDSCR);
-	}
-	switch (e.type) {
-	case EXCEPTION_ERROR:
+	struct cortexa_priv *priv = t->priv;
+	apb_read_args_s args = {t, DBGDSCR, 0};
+	switch (adiv5_dp_deferred(priv->apb->dp, apb_read_deferred, &args)) {
+	case ADIV5_STATUS_ERROR:
 		/* Oh crap, there's no recovery from this... */
 		target_list_free();
 		return TARGET_HALT_ERROR;
-	case EXCEPTION_TIMEOUT:
+	case ADIV5_STATUS_TIMEOUT:
 		/* Timeout isn't a problem, target could be in WFI */
 		return TARGET_HALT_RUNNING;
+	default:
+		break;
 	}
+	uint32_t dbgdscr = args.value;
 
 	if (!(dbgdscr & DBGDSCR_HALTED)) /* Not halted */
 		return TARGET_HALT_RUNNING;
@@ -702,6 +961,7 @@ void cortexa_halt_resume(target *t, bool step)
 
 	/* Write back register cache */
 	cortexa_regs_write_internal(t);
+	cortexa_tlb_flush(t);
 
 	apb_write(t, DBGITR, MCR | ICIALLU); /* invalidate cache */
 
@@ -36,6 +36,7 @@
 #include "cortexm.h"
 #include "command.h"
 #include "gdb_packet.h"
+#include "gdb_if.h"
 #include "semihosting.h"
 
 #include <unistd.h>
@@ -55,6 +56,21 @@
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+
+/*
+ * Semihosted file reads and writes move through target memory in chunks of
+ * this size, so the probe's per transfer overhead is paid rarely. The host
+ * side overlaps by itself: the kernel reads ahead for sequential reads and
+ * write() returns once the data is in the page cache.
+ */
+#define SEMIHOSTING_CHUNK 0x10000U
+
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+#include <sys/mman.h>
+#define SEMIHOSTING_HAS_MMAP
+/* Regular files are mapped and transferred in place, not copied through a buffer */
+static bool semihosting_mmap;
+#endif
 #endif
 
 static const char cortexm_driver_str[] = "ARM Cortex-M";
@@ -63,11 +79,18 @@ static bool cortexm_vector_catch(target *t, int argc, char *argv[]);
 #ifdef PLATFORM_HAS_USBUART
 static bool cortexm_redirect_stdout(target *t, int argc, const char **argv);
 #endif
+#ifdef SEMIHOSTING_HAS_MMAP
+static bool cortexm_semihosting_mmap(target *t, int argc, const char **argv);
+#endif
 
 const struct command_s cortexm_cmd_list[] = {
 	{"vector_catch", (cmd_handler)cortexm_vector_catch, "Catch exception vectors"},
 #ifdef PLATFORM_HAS_USBUART
 	{"redirect_stdout", (cmd_handler)cortexm_redirect_stdout, "Redirect semihosting stdout to USB UART"},
+#endif
+#ifdef SEMIHOSTING_HAS_MMAP
+	{"semihosting_mmap", (cmd_handler)cortexm_semihosting_mmap,
+		"Memory map host files for semihosted reads and writes: (enable|disable)"},
 #endif
 	{NULL, NULL, NULL},
 };
@@ -77,23 +100,36 @@ const struct command_s cortexm_cmd_list[] = {
 #define TOPT_FLAVOUR_V7MF (1U << 1U) /* if set, floating-point enabled. */
 
 static void cortexm_regs_read(target *t, void *data);
+static void cortexm_regs_read_core(target *t, void *data);
 static void cortexm_regs_write(target *t, const void *data);
 static uint32_t cortexm_pc_read(target *t);
 static ssize_t cortexm_reg_read(target *t, int reg, void *data, size_t max);
 static ssize_t cortexm_reg_write(target *t, int reg, const void *data, size_t max);
+static void cortexm_reg_cache_flush(target *t);
+static void cortexm_reg_cache_invalidate(target *t);
+static int cortexm_mem_crc32(target *t, uint32_t *crc, target_addr addr, size_t len);
+static int cortexm_mem_fill(target *t, target_addr addr, size_t len, uint32_t pattern);
+static int cortexm_mem_find(target *t, target_addr *found, target_addr addr, size_t len, uint32_t pattern,
+	size_t size, bool mismatch);
 
 static void cortexm_reset(target *t);
 static enum target_halt_reason cortexm_halt_poll(target *t, target_addr *watch);
 static void cortexm_halt_resume(target *t, bool step);
+static void cortexm_halt_resume_range(target *t, target_addr start, target_addr end);
 static void cortexm_halt_request(target *t);
+static bool cortexm_halt_wait(target *t, uint32_t timeout_ms);
+static size_t cortexm_pc_sample(target *t, uint32_t *pcs, size_t count);
 static int cortexm_fault_unwind(target *t);
 
 static int cortexm_breakwatch_set(target *t, struct breakwatch *);
 static int cortexm_breakwatch_clear(target *t, struct breakwatch *);
 static target_addr cortexm_check_watch(target *t);
+static uint32_t dwt_mask(size_t len);
 
 #define CORTEXM_MAX_WATCHPOINTS 4U /* architecture says up to 15, no implementation has > 4 */
 #define CORTEXM_MAX_BREAKPOINTS 8U /* architecture says up to 127, no implementation has > 8 */
+/* How long a range step keeps stepping before giving the caller a chance to interrupt it */
+#define CORTEXM_RANGE_STEP_SLICE_MS 50U
 
 static int cortexm_hostio_request(target *t);
 
@@ -103,18 +139,55 @@ struct cortexm_priv {
 	ADIv5_AP_t *ap;
 	bool stepping;
 	bool on_bkpt;
+	/* Range being stepped through, step_range_end is 0 when not range stepping */
+	target_addr step_range_start;
+	target_addr step_range_end;
 	/* Watchpoint unit status */
 	bool hw_watchpoint[CORTEXM_MAX_WATCHPOINTS];
+	/* Comparators taken for data trace, they stay set up across attach and detach */
+	bool trace_var[CORTEXM_MAX_WATCHPOINTS];
+	target_addr trace_var_addr[CORTEXM_MAX_WATCHPOINTS];
+	uint8_t trace_var_size[CORTEXM_MAX_WATCHPOINTS];
 	unsigned flash_patch_revision;
 	unsigned hw_watchpoint_max;
 	/* Breakpoint unit status */
 	bool hw_breakpoint[CORTEXM_MAX_BREAKPOINTS];
 	unsigned hw_breakpoint_max;
+	/*
+	 * Comparator values as GDB's break- and watchpoints want them, and as last
+	 * written to the target where the bit in *_written is set. GDB takes them
+	 * all out on every stop and puts them back before resuming, so only the
+	 * differences are written, on resume or straight away while the core runs,
+	 * see cortexm_breakwatch_flush().
+	 */
+	uint32_t fpb_comp[CORTEXM_MAX_BREAKPOINTS];
+	uint32_t fpb_comp_target[CORTEXM_MAX_BREAKPOINTS];
+	uint32_t fpb_written;
+	struct cortexm_dwt_comp {
+		uint32_t comp;
+		uint32_t mask;
+		uint32_t func;
+	} dwt_comp[CORTEXM_MAX_WATCHPOINTS], dwt_comp_target[CORTEXM_MAX_WATCHPOINTS];
+	uint32_t dwt_written;
 	/* Copy of DEMCR for vector-catch */
 	uint32_t demcr;
 	/* Cache parameters */
 	bool has_cache;
 	uint32_t dcache_minline;
+	/* L1 D-cache geometry from CCSIDR, for maintenance by set/way */
+	uint32_t dcache_sets;
+	uint32_t dcache_ways;
+	uint8_t dcache_line_shift;
+	uint8_t dcache_way_shift;
+	/* Set by halt_poll, cleared when the core is resumed or reset */
+	bool halted;
+	/* What's known about the D-cache since the core halted */
+	enum {
+		CORTEXM_DCACHE_UNKNOWN,
+		CORTEXM_DCACHE_OFF,
+		CORTEXM_DCACHE_ON,
+		CORTEXM_DCACHE_CLEAN, /* Cleaned and invalidated, it stays empty until the core runs */
+	} dcache_state;
 };
 
 /* Register number tables */
@@ -224,29 +297,182 @@ ADIv5_AP_t *cortexm_ap(target *t)
 	return ((struct cortexm_priv *)t->priv)->ap;
 }
 
+#define CORTEXM_CACHE_OPS_PER_SEQUENCE 16U
+
+struct cortexm_cache_ops {
+	adiv5_seq_op_t ops[CORTEXM_CACHE_OPS_PER_SEQUENCE];
+	size_t count;
+};
+
+static void cortexm_cache_ops_flush(ADIv5_AP_t *ap, struct cortexm_cache_ops *batch)
+{
+	/* Faults are left for the caller's target_check_error() */
+	if (batch->count)
+		adiv5_sequence(ap, batch->ops, batch->count);
+	batch->count = 0;
+}
+
+/* Maintenance operations are writes to a single register, several of them per sequence */
+static void cortexm_cache_op(ADIv5_AP_t *ap, struct cortexm_cache_ops *batch, uint32_t reg, uint32_t value)
+{
+	batch->ops[batch->count++] = (adiv5_seq_op_t){.type = ADIV5_SEQ_MEM_WRITE, .addr = reg, .value = value};
+	if (batch->count == CORTEXM_CACHE_OPS_PER_SEQUENCE)
+		cortexm_cache_ops_flush(ap, batch);
+}
+
+/* Sets a DWT comparator straight away, for those not left to cortexm_breakwatch_flush() */
+static void cortexm_dwt_write(target *t, size_t i, const struct cortexm_dwt_comp *value)
+{
+	struct cortexm_priv *priv = t->priv;
+	if (value->func) {
+		target_mem_write32(t, CORTEXM_DWT_COMP(i), value->comp);
+		target_mem_write32(t, CORTEXM_DWT_MASK(i), value->mask);
+	}
+	target_mem_write32(t, CORTEXM_DWT_FUNC(i), value->func);
+	priv->dwt_comp[i] = *value;
+	priv->dwt_comp_target[i] = *value;
+	priv->dwt_written |= 1U << i;
+}
+
+static size_t cortexm_seq_write(adiv5_seq_op_t *ops, size_t count, uint32_t addr, uint32_t value)
+{
+	ops[count] = (adiv5_seq_op_t){.type = ADIV5_SEQ_MEM_WRITE, .addr = addr, .value = value};
+	return count + 1U;
+}
+
+/* Writes the FPB and DWT comparators that differ from what the target has, in one sequence */
+static void cortexm_breakwatch_flush(target *t)
+{
+	struct cortexm_priv *priv = t->priv;
+	adiv5_seq_op_t ops[CORTEXM_MAX_BREAKPOINTS + CORTEXM_MAX_WATCHPOINTS * 3U];
+	size_t count = 0;
+	for (size_t i = 0; i < priv->hw_breakpoint_max; ++i) {
+		const bool written = priv->fpb_written & (1U << i);
+		if (written && priv->fpb_comp_target[i] == priv->fpb_comp[i])
+			continue;
+		count = cortexm_seq_write(ops, count, CORTEXM_FPB_COMP(i), priv->fpb_comp[i]);
+		priv->fpb_comp_target[i] = priv->fpb_comp[i];
+		priv->fpb_written |= 1U << i;
+	}
+	for (size_t i = 0; i < priv->hw_watchpoint_max; ++i) {
+		const struct cortexm_dwt_comp *const want = &priv->dwt_comp[i];
+		struct cortexm_dwt_comp *const have = &priv->dwt_comp_target[i];
+		const bool written = priv->dwt_written & (1U << i);
+		/* Address and mask only matter to an enabled comparator */
+		if (want->func && (!written || have->comp != want->comp))
+			count = cortexm_seq_write(ops, count, CORTEXM_DWT_COMP(i), want->comp);
+		if (want->func && (!written || have->mask != want->mask))
+			count = cortexm_seq_write(ops, count, CORTEXM_DWT_MASK(i), want->mask);
+		if (!written || have->func != want->func)
+			count = cortexm_seq_write(ops, count, CORTEXM_DWT_FUNC(i), want->func);
+		if (want->func)
+			*have = *want;
+		else
+			have->func = 0;
+		priv->dwt_written |= 1U << i;
+	}
+	/* Faults are left for the caller's target_check_error() */
+	if (count)
+		adiv5_sequence(cortexm_ap(t), ops, count);
+}
+
+/* A reset may have cleared comparators along with the core, have those in use written again */
+static void cortexm_breakwatch_forget(target *t)
+{
+	struct cortexm_priv *priv = t->priv;
+	for (size_t i = 0; i < priv->hw_breakpoint_max; ++i) {
+		if (priv->fpb_comp_target[i])
+			priv->fpb_written &= ~(1U << i);
+	}
+	for (size_t i = 0; i < priv->hw_watchpoint_max; ++i) {
+		if (priv->dwt_comp_target[i].func)
+			priv->dwt_written &= ~(1U << i);
+	}
+}
+
+/* Number of D-cache lines covering the part of [addr, addr + len) that is RAM */
+static size_t cortexm_cache_lines(target *t, target_addr addr, size_t len)
+{
+	struct cortexm_priv *priv = t->priv;
+	const target_addr minline = priv->dcache_minline;
+	const target_addr mem_end = addr + len; /* following code is NOP if wraparound */
+	size_t lines = 0;
+	for (struct target_ram *r = t->ram; r; r = r->next) {
+		const target_addr ram = MAX(addr, r->start) & ~(minline - 1U);
+		const target_addr ram_end = MIN(mem_end, r->start + r->length);
+		if (ram < ram_end)
+			lines += (ram_end - ram + minline - 1U) / minline;
+	}
+	return lines;
+}
+
+/*
+ * Make the debugger's view of RAM coherent with the D-cache: dirty lines are
+ * written back before a read, and also invalidated before a write so the
+ * core doesn't go on using stale ones.
+ *
+ * Nothing refills the cache while the core is halted, so then it is seen to
+ * at most once: CCR.DC is read once per halt, and once a range is bigger
+ * than the whole cache it is cleaned and invalidated by set/way, after which
+ * nothing more is needed until the core runs again. Small ranges, and any
+ * range while the core runs, are seen to line by line.
+ */
 static void cortexm_cache_clean(target *t, target_addr addr, size_t len, bool invalidate)
 {
 	struct cortexm_priv *priv = t->priv;
 	if (!priv->has_cache || (priv->dcache_minline == 0))
 		return;
-	uint32_t cache_reg = invalidate ? CORTEXM_DCCIMVAC : CORTEXM_DCCMVAC;
-	size_t minline = priv->dcache_minline;
+	if (!priv->halted)
+		priv->dcache_state = CORTEXM_DCACHE_UNKNOWN;
+	if (priv->dcache_state == CORTEXM_DCACHE_OFF || priv->dcache_state == CORTEXM_DCACHE_CLEAN)
+		return;
+	const size_t lines = cortexm_cache_lines(t, addr, len);
+	if (!lines)
+		return;
 
-	/* flush data cache for RAM regions that intersect requested region */
-	target_addr mem_end = addr + len; /* following code is NOP if wraparound */
-	/* requested region is [src, src_end) */
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	const size_t set_way_ops = priv->dcache_sets * priv->dcache_ways;
+	const bool by_set_way = set_way_ops && lines >= set_way_ops;
+	/* Worth a CCR read when it saves a lot of maintenance, or when it lasts the halt */
+	if (priv->dcache_state == CORTEXM_DCACHE_UNKNOWN && (priv->halted || by_set_way)) {
+		uint32_t ccr = 0;
+		adiv5_mem_read(ap, &ccr, CORTEXM_CCR, sizeof(ccr));
+		priv->dcache_state = (ccr & CORTEXM_CCR_DC) ? CORTEXM_DCACHE_ON : CORTEXM_DCACHE_OFF;
+		if (priv->dcache_state == CORTEXM_DCACHE_OFF)
+			return;
+	}
+
+	struct cortexm_cache_ops batch = {.count = 0};
+	if (by_set_way) {
+		for (uint32_t way = 0; way < priv->dcache_ways; ++way) {
+			for (uint32_t set = 0; set < priv->dcache_sets; ++set) {
+				const uint32_t way_bits = priv->dcache_way_shift < 32U ? way << priv->dcache_way_shift : 0U;
+				cortexm_cache_op(ap, &batch, CORTEXM_DCCISW, way_bits | (set << priv->dcache_line_shift));
+			}
+		}
+		cortexm_cache_ops_flush(ap, &batch);
+		if (priv->halted)
+			priv->dcache_state = CORTEXM_DCACHE_CLEAN;
+		return;
+	}
+
+	const uint32_t cache_reg = invalidate ? CORTEXM_DCCIMVAC : CORTEXM_DCCMVAC;
+	const target_addr minline = priv->dcache_minline;
+	const target_addr mem_end = addr + len;
 	for (struct target_ram *r = t->ram; r; r = r->next) {
-		target_addr ram = r->start;
-		target_addr ram_end = r->start + r->length;
-		/* RAM region is [ram, ram_end) */
-		if (addr > ram)
-			ram = addr;
-		if (mem_end < ram_end)
-			ram_end = mem_end;
-		/* intersection is [ram, ram_end) */
-		for (ram &= ~(minline - 1); ram < ram_end; ram += minline)
-			adiv5_mem_write(cortexm_ap(t), cache_reg, &ram, 4);
+		const target_addr ram_end = MIN(mem_end, r->start + r->length);
+		for (target_addr ram = MAX(addr, r->start) & ~(minline - 1U); ram < ram_end; ram += minline)
+			cortexm_cache_op(ap, &batch, cache_reg, ram);
 	}
+	cortexm_cache_ops_flush(ap, &batch);
+}
+
+/* The core is about to run or has been reset, so what is known about its caches no longer holds */
+static void cortexm_cache_forget(target *t)
+{
+	struct cortexm_priv *priv = t->priv;
+	priv->halted = false;
+	priv->dcache_state = CORTEXM_DCACHE_UNKNOWN;
 }
 
 static void cortexm_mem_read(target *t, void *dest, target_addr src, size_t len)
@@ -267,12 +493,196 @@ static bool cortexm_check_error(target *t)
 	return adiv5_dp_error(ap->dp) != 0;
 }
 
+/* The DP and the core have to answer as found by the scan, then the driver checks the part */
+static bool cortexm_revalidate(target *t)
+{
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	if (!adiv5_dp_reconnect(ap->dp))
+		return false;
+	/* A reset of the target also resets what the AP holds */
+	adiv5_ap_invalidate_cache(ap);
+	volatile bool valid = false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		uint32_t cpuid = 0;
+		adiv5_mem_read(ap, &cpuid, CORTEXM_CPUID, sizeof(cpuid));
+		valid = !adiv5_dp_error(ap->dp) && cpuid == t->cpuid &&
+		        (!t->check_id || (t->check_id(t) && !adiv5_dp_error(ap->dp)));
+	}
+	return valid && !e.type;
+}
+
 static void cortexm_priv_free(void *priv)
 {
 	adiv5_ap_unref(((struct cortexm_priv *)priv)->ap);
 	free(priv);
 }
 
+/*
+ * Poll addr until busy_bit clears, or CORTEXM_MEM_WAIT_MS passes,
+ * returning the last value read. Callers loop on the result like they would
+ * on target_mem_read32(), but the polling itself happens on the probe.
+ */
+uint32_t cortexm_mem_wait32(target *t, target_addr addr, uint32_t busy_bit)
+{
+	const uint32_t start = platform_time_us();
+	const uint32_t value = adiv5_mem_wait32(cortexm_ap(t), addr, busy_bit, busy_bit, CORTEXM_MEM_WAIT_MS);
+	target_flash_stats_poll(t, 1U, platform_time_us() - start);
+	return value;
+}
+
+/* As cortexm_mem_wait32(), for controllers with a ready flag that sets when idle */
+uint32_t cortexm_mem_wait_ready32(target *t, target_addr addr, uint32_t ready_bit)
+{
+	const uint32_t start = platform_time_us();
+	const uint32_t value = adiv5_mem_wait32(cortexm_ap(t), addr, ready_bit, 0, CORTEXM_MEM_WAIT_MS);
+	target_flash_stats_poll(t, 1U, platform_time_us() - start);
+	return value;
+}
+
+bool target_is_cortexm(const target *t)
+{
+	return t->priv_free == cortexm_priv_free;
+}
+
+/*
+ * The drivers to try for a part, in order, by the designer and the part
+ * number found for it. Only the entries matching the part are tried.
+ */
+#define CORTEXM_PROBE_ANY_PART 0xffffU
+
+typedef struct cortexm_probe_entry {
+	uint16_t designer_code;
+	uint16_t part_id;
+	bool (*probe)(target *t);
+#if PC_HOSTED == 1
+	const char *name;
+#endif
+} cortexm_probe_entry_s;
+
+#if PC_HOSTED == 1
+#define CORTEXM_PROBE(designer, part, x) {(designer), (part), (x), #x}
+#else
+#define CORTEXM_PROBE(designer, part, x) {(designer), (part), (x)}
+#endif
+
+static const cortexm_probe_entry_s cortexm_probe_table[] = {
+	CORTEXM_PROBE(JEP106_MANUFACTURER_FREESCALE, CORTEXM_PROBE_ANY_PART, kinetis_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_GIGADEVICE, CORTEXM_PROBE_ANY_PART, gd32f1_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_STM, CORTEXM_PROBE_ANY_PART, stm32f1_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_STM, CORTEXM_PROBE_ANY_PART, stm32f4_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_STM, CORTEXM_PROBE_ANY_PART, stm32h7_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_STM, CORTEXM_PROBE_ANY_PART, stm32l0_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_STM, CORTEXM_PROBE_ANY_PART, stm32l4_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_STM, CORTEXM_PROBE_ANY_PART, stm32g0_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_NORDIC, CORTEXM_PROBE_ANY_PART, nrf51_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ATMEL, CORTEXM_PROBE_ANY_PART, samx7x_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ATMEL, CORTEXM_PROBE_ANY_PART, sam4l_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ATMEL, CORTEXM_PROBE_ANY_PART, samd_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ATMEL, CORTEXM_PROBE_ANY_PART, samx5x_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ENERGY_MICRO, CORTEXM_PROBE_ANY_PART, efm32_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_TEXAS, CORTEXM_PROBE_ANY_PART, msp432_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_SPECULAR, CORTEXM_PROBE_ANY_PART, lpc11xx_probe), /* LPC845 */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_RASPBERRY, CORTEXM_PROBE_ANY_PART, rp_probe),
+	/* Cortex-M0+ ROM */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c0U, lpc11xx_probe), /* LPC8 */
+	/* Cortex-M3 ROM */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c3U, lmi_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c3U, ch32f1_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c3U, stm32f1_probe), /* Care for other STM32F1 clones (?) */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c3U, lpc15xx_probe), /* Thanks to JojoS for testing */
+	/* Cortex-M0 ROM */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x471U, lpc11xx_probe), /* LPC24C11 */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x471U, lpc43xx_probe),
+	/* Cortex-M4 ROM */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c4U, lmi_probe),
+	/* The LPC546xx and LPC43xx parts present with the same AP ROM Part
+	Number, so we need to probe both. Unfortunately, when probing for
+	the LPC43xx when the target is actually an LPC546xx, the memory
+	location checked is illegal for the LPC546xx and puts the chip into
+	Lockup, requiring a RST pulse to recover. Instead, make sure to
+	probe for the LPC546xx first, which experimentally doesn't harm
+	LPC43xx detection. */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c4U, lpc546xx_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c4U, lpc43xx_probe),
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c4U, kinetis_probe), /* Older K-series */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4c4U, at32fxx_probe),
+	/* Cortex-M23 ROM */
+	CORTEXM_PROBE(JEP106_MANUFACTURER_ARM, 0x4cbU, gd32f1_probe), /* GD32E23x uses GD32F1 peripherals */
+	/*
+	 * These devices enumerate an AP with an empty ascii code,
+	 * and have no available designer code elsewhere
+	 */
+	CORTEXM_PROBE(ASCII_CODE_FLAG, CORTEXM_PROBE_ANY_PART, sam3x_probe),
+	CORTEXM_PROBE(ASCII_CODE_FLAG, CORTEXM_PROBE_ANY_PART, ke04_probe),
+	CORTEXM_PROBE(ASCII_CODE_FLAG, CORTEXM_PROBE_ANY_PART, lpc17xx_probe),
+	CORTEXM_PROBE(ASCII_CODE_FLAG, CORTEXM_PROBE_ANY_PART, lpc11xx_probe), /* LPC1343 */
+};
+
+#undef CORTEXM_PROBE
+
+/*
+ * ID registers read by more than one of the probes for a part. While the
+ * drivers are probed, the first read of one is kept and served to the
+ * others, once the error check after the probe that read it found no fault.
+ */
+static const uint32_t cortexm_probe_id_regs[] = {
+	0xe0042000U, /* DBGMCU_IDCODE of the STM32 and their clones */
+	0x40015800U, /* DBGMCU_IDCODE of the STM32F0 */
+	0x41002018U, /* DSU DID of the SAMD and SAMx5x */
+};
+
+#define CORTEXM_PROBE_ID_REGS (sizeof(cortexm_probe_id_regs) / sizeof(cortexm_probe_id_regs[0]))
+
+static struct {
+	uint32_t value[CORTEXM_PROBE_ID_REGS];
+	/* Bit per register, read fault free or read since the last error check */
+	uint8_t valid;
+	uint8_t pending;
+} cortexm_probe_ids;
+
+static void cortexm_probe_mem_read(target *t, void *dest, target_addr src, size_t len)
+{
+	for (size_t i = 0; len == sizeof(uint32_t) && i < CORTEXM_PROBE_ID_REGS; ++i) {
+		if (src != cortexm_probe_id_regs[i])
+			continue;
+		const uint8_t reg = 1U << i;
+		if (!((cortexm_probe_ids.valid | cortexm_probe_ids.pending) & reg)) {
+			cortexm_mem_read(t, &cortexm_probe_ids.value[i], src, len);
+			cortexm_probe_ids.pending |= reg;
+		}
+		memcpy(dest, &cortexm_probe_ids.value[i], len);
+		return;
+	}
+	cortexm_mem_read(t, dest, src, len);
+}
+
+static bool cortexm_probe_drivers(target *t)
+{
+	memset(&cortexm_probe_ids, 0, sizeof(cortexm_probe_ids));
+	t->mem_read = cortexm_probe_mem_read;
+	bool found = false;
+	for (size_t i = 0; !found && i < sizeof(cortexm_probe_table) / sizeof(cortexm_probe_table[0]); ++i) {
+		const cortexm_probe_entry_s *const entry = &cortexm_probe_table[i];
+		if (entry->designer_code != t->designer_code ||
+			(entry->part_id != CORTEXM_PROBE_ANY_PART && entry->part_id != t->part_id))
+			continue;
+#if PC_HOSTED == 1
+		DEBUG_INFO("Calling %s\n", entry->name);
+#endif
+		found = entry->probe(t);
+		if (!found) {
+			if (!target_check_error(t))
+				cortexm_probe_ids.valid |= cortexm_probe_ids.pending;
+			cortexm_probe_ids.pending = 0;
+		}
+	}
+	/* Unless the driver found put its own in place */
+	if (t->mem_read == cortexm_probe_mem_read)
+		t->mem_read = cortexm_mem_read;
+	return found;
+}
+
 bool cortexm_probe(ADIv5_AP_t *ap)
 {
 	target *t;
@@ -282,6 +692,9 @@ bool cortexm_probe(ADIv5_AP_t *ap)
 		return false;
 
 	adiv5_ap_ref(ap);
+	/* Runs of register writes, as from Flash drivers and stub setup, don't wait
+	 * for each one to complete. The next read or cortexm_check_error() does */
+	ap->posted_writes = true;
 	if (ap->dp->version >= 2 && ap->dp->target_designer_code != 0) {
 		/* Use TARGETID register to identify target */
 		t->designer_code = ap->dp->target_designer_code;
@@ -303,8 +716,12 @@ bool cortexm_probe(ADIv5_AP_t *ap)
 	priv->ap = ap;
 
 	t->check_error = cortexm_check_error;
+	t->revalidate = cortexm_revalidate;
 	t->mem_read = cortexm_mem_read;
 	t->mem_write = cortexm_mem_write;
+	t->mem_crc32 = cortexm_mem_crc32;
+	t->mem_fill = cortexm_mem_fill;
+	t->mem_find = cortexm_mem_find;
 
 	t->driver = cortexm_driver_str;
 
@@ -318,6 +735,8 @@ bool cortexm_probe(ADIv5_AP_t *ap)
 	switch (cpuid_partno) {
 	case CORTEX_M33:
 		t->core = "M33";
+		/* The M33 and M7 AHB-APs auto-increment TAR across a 4KiB window */
+		ap->tar_wrap = 4096U;
 		break;
 	case CORTEX_M23:
 		t->core = "M23";
@@ -330,6 +749,7 @@ bool cortexm_probe(ADIv5_AP_t *ap)
 		break;
 	case CORTEX_M7:
 		t->core = "M7";
+		ap->tar_wrap = 4096U;
 		if (((t->cpuid & CPUID_REVISION_MASK) == 0) && (t->cpuid & CPUID_PATCH_MASK) < 2) {
 			DEBUG_WARN("Silicon bug: Single stepping will enter pending "
 					   "exception handler with this M7 core revision!\n");
@@ -354,6 +774,7 @@ bool cortexm_probe(ADIv5_AP_t *ap)
 	/* Should probe here to make sure it's Cortex-M3 */
 	t->tdesc = tdesc_cortex_m;
 	t->regs_read = cortexm_regs_read;
+	t->regs_read_core = cortexm_regs_read_core;
 	t->regs_write = cortexm_regs_write;
 	t->reg_read = cortexm_reg_read;
 	t->reg_write = cortexm_reg_write;
@@ -361,7 +782,10 @@ bool cortexm_probe(ADIv5_AP_t *ap)
 	t->reset = cortexm_reset;
 	t->halt_request = cortexm_halt_request;
 	t->halt_poll = cortexm_halt_poll;
+	t->halt_wait = cortexm_halt_wait;
 	t->halt_resume = cortexm_halt_resume;
+	t->halt_resume_range = cortexm_halt_resume_range;
+	t->pc_sample = cortexm_pc_sample;
 	t->regs_size = sizeof(regnum_cortex_m);
 
 	t->breakwatch_set = cortexm_breakwatch_set;
@@ -376,8 +800,12 @@ bool cortexm_probe(ADIv5_AP_t *ap)
 	if (target_mem_read32(t, CORTEXM_CPACR) == cpacr) {
 		t->target_options |= TOPT_FLAVOUR_V7MF;
 		t->regs_size += sizeof(regnum_cortex_mf);
+		t->regs_size_core = sizeof(regnum_cortex_m);
 		t->tdesc = tdesc_cortex_mf;
 	}
+	t->reg_cache = calloc(1, t->regs_size);
+	if (!t->reg_cache) /* calloc failed: run without the register cache */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
 
 	/* Default vectors to catch */
 	priv->demcr = CORTEXM_DEMCR_TRCENA | CORTEXM_DEMCR_VC_HARDERR | CORTEXM_DEMCR_VC_CORERESET;
@@ -387,118 +815,33 @@ bool cortexm_probe(ADIv5_AP_t *ap)
 	if ((ctr >> 29) == 4) {
 		priv->has_cache = true;
 		priv->dcache_minline = 4 << (ctr & 0xf);
+		/* Select the L1 data cache and read its geometry */
+		target_mem_write32(t, CORTEXM_CSSELR, 0);
+		const uint32_t ccsidr = target_mem_read32(t, CORTEXM_CCSIDR);
+		priv->dcache_line_shift = (ccsidr & 7U) + 4U;
+		priv->dcache_ways = ((ccsidr >> 3U) & 0x3ffU) + 1U;
+		priv->dcache_sets = ((ccsidr >> 13U) & 0x7fffU) + 1U;
+		/* The way number sits in the top bits of the set/way operand */
+		priv->dcache_way_shift = priv->dcache_ways > 1U ? __builtin_clz(priv->dcache_ways - 1U) : 32U;
 	} else {
 		target_check_error(t);
 	}
-#if PC_HOSTED
-#define STRINGIFY(x) #x
-#define PROBE(x)                                  \
-	do {                                          \
-		DEBUG_INFO("Calling " STRINGIFY(x) "\n"); \
-		if ((x)(t))                               \
-			return true;                          \
-		target_check_error(t);                    \
-	} while (0)
-#else
-#define PROBE(x)               \
-	do {                       \
-		if ((x)(t))            \
-			return true;       \
-		target_check_error(t); \
-	} while (0)
-#endif
 
-	switch (t->designer_code) {
-	case JEP106_MANUFACTURER_FREESCALE:
-		PROBE(kinetis_probe);
-		if (t->part_id == 0x88c) {
-			t->driver = "MIMXRT10xx(no flash)";
-			target_halt_resume(t, 0);
-		}
-		break;
-	case JEP106_MANUFACTURER_GIGADEVICE:
-		PROBE(gd32f1_probe);
-		break;
-	case JEP106_MANUFACTURER_STM:
-		PROBE(stm32f1_probe);
-		PROBE(stm32f4_probe);
-		PROBE(stm32h7_probe);
-		PROBE(stm32l0_probe);
-		PROBE(stm32l4_probe);
-		PROBE(stm32g0_probe);
-		break;
-	case JEP106_MANUFACTURER_CYPRESS:
+	if (cortexm_probe_drivers(t))
+		return true;
+
+	if (t->designer_code == JEP106_MANUFACTURER_FREESCALE && t->part_id == 0x88c) {
+		t->driver = "MIMXRT10xx(no flash)";
+		target_halt_resume(t, 0);
+	} else if (t->designer_code == JEP106_MANUFACTURER_CYPRESS)
 		DEBUG_WARN("Unhandled Cypress device\n");
-		break;
-	case JEP106_MANUFACTURER_INFINEON:
+	else if (t->designer_code == JEP106_MANUFACTURER_INFINEON)
 		DEBUG_WARN("Unhandled Infineon device\n");
-		break;
-	case JEP106_MANUFACTURER_NORDIC:
-		PROBE(nrf51_probe);
-		break;
-	case JEP106_MANUFACTURER_ATMEL:
-		PROBE(samx7x_probe);
-		PROBE(sam4l_probe);
-		PROBE(samd_probe);
-		PROBE(samx5x_probe);
-		break;
-	case JEP106_MANUFACTURER_ENERGY_MICRO:
-		PROBE(efm32_probe);
-		break;
-	case JEP106_MANUFACTURER_TEXAS:
-		PROBE(msp432_probe);
-		break;
-	case JEP106_MANUFACTURER_SPECULAR:
-		PROBE(lpc11xx_probe); /* LPC845 */
-		break;
-	case JEP106_MANUFACTURER_RASPBERRY:
-		PROBE(rp_probe);
-		break;
-	case JEP106_MANUFACTURER_ARM:
-		if (t->part_id == 0x4c0) {        /* Cortex-M0+ ROM */
-			PROBE(lpc11xx_probe);         /* LPC8 */
-		} else if (t->part_id == 0x4c3) { /* Cortex-M3 ROM */
-			PROBE(lmi_probe);
-			PROBE(ch32f1_probe);
-			PROBE(stm32f1_probe);         /* Care for other STM32F1 clones (?) */
-			PROBE(lpc15xx_probe);         /* Thanks to JojoS for testing */
-		} else if (t->part_id == 0x471) { /* Cortex-M0 ROM */
-			PROBE(lpc11xx_probe);         /* LPC24C11 */
-			PROBE(lpc43xx_probe);
-		} else if (t->part_id == 0x4c4) { /* Cortex-M4 ROM */
-			PROBE(lmi_probe);
-			/* The LPC546xx and LPC43xx parts present with the same AP ROM Part
-			Number, so we need to probe both. Unfortunately, when probing for
-			the LPC43xx when the target is actually an LPC546xx, the memory
-			location checked is illegal for the LPC546xx and puts the chip into
-			Lockup, requiring a RST pulse to recover. Instead, make sure to
-			probe for the LPC546xx first, which experimentally doesn't harm
-			LPC43xx detection. */
-			PROBE(lpc546xx_probe);
-			PROBE(lpc43xx_probe);
-			PROBE(kinetis_probe);         /* Older K-series */
-			PROBE(at32fxx_probe);
-		} else if (t->part_id == 0x4cb) { /* Cortex-M23 ROM */
-			PROBE(gd32f1_probe);          /* GD32E23x uses GD32F1 peripherals */
-		}
-		break;
-	case ASCII_CODE_FLAG:
-		/*
-		 * these devices enumerate an AP with an empty ascii code,
-		 * and have no available designer code elsewhere
-		 */
-		PROBE(sam3x_probe);
-		PROBE(ke04_probe);
-		PROBE(lpc17xx_probe);
-		PROBE(lpc11xx_probe); /* LPC1343 */
-		break;
-	}
 #if PC_HOSTED == 0
 	gdb_outf("Please report unknown device with Designer 0x%x Part ID 0x%x\n", t->designer_code, t->part_id);
 #else
 	DEBUG_WARN("Please report unknown device with Designer 0x%x Part ID 0x%x\n", t->designer_code, t->part_id);
 #endif
-#undef PROBE
 	return true;
 }
 
@@ -510,6 +853,7 @@ bool cortexm_attach(target *t)
 
 	/* Clear any pending fault condition */
 	target_check_error(t);
+	cortexm_reg_cache_invalidate(t);
 
 	target_halt_request(t);
 	/* Request halt on reset */
@@ -535,11 +879,16 @@ bool cortexm_attach(target *t)
 	for (size_t i = 0; i < priv->hw_breakpoint_max; i++) {
 		target_mem_write32(t, CORTEXM_FPB_COMP(i), 0);
 		priv->hw_breakpoint[i] = 0;
+		priv->fpb_comp[i] = 0;
+		priv->fpb_comp_target[i] = 0;
 	}
+	priv->fpb_written = (1U << priv->hw_breakpoint_max) - 1U;
 
 	/* Clear any stale watchpoints */
 	for (size_t i = 0; i < priv->hw_watchpoint_max; i++) {
-		target_mem_write32(t, CORTEXM_DWT_FUNC(i), 0);
+		if (priv->trace_var[i])
+			continue;
+		cortexm_dwt_write(t, i, &(struct cortexm_dwt_comp){0});
 		priv->hw_watchpoint[i] = 0;
 	}
 
@@ -569,17 +918,29 @@ void cortexm_detach(target *t)
 	struct cortexm_priv *priv = t->priv;
 	unsigned i;
 
+	/* The core is about to run free, so write back any register changes */
+	cortexm_reg_cache_flush(t);
+	cortexm_reg_cache_invalidate(t);
+
 	/* Clear any stale breakpoints */
-	for (i = 0; i < priv->hw_breakpoint_max; i++)
+	for (i = 0; i < priv->hw_breakpoint_max; i++) {
 		target_mem_write32(t, CORTEXM_FPB_COMP(i), 0);
+		priv->fpb_comp[i] = 0;
+		priv->fpb_comp_target[i] = 0;
+	}
 
-	/* Clear any stale watchpoints */
-	for (i = 0; i < priv->hw_watchpoint_max; i++)
-		target_mem_write32(t, CORTEXM_DWT_FUNC(i), 0);
+	/* Clear any stale watchpoints, data trace goes on while the core runs free */
+	bool tracing = false;
+	for (i = 0; i < priv->hw_watchpoint_max; i++) {
+		if (priv->trace_var[i])
+			tracing = true;
+		else
+			cortexm_dwt_write(t, i, &(struct cortexm_dwt_comp){0});
+	}
 
 	/* Restort DEMCR*/
 	ADIv5_AP_t *ap = cortexm_ap(t);
-	target_mem_write32(t, CORTEXM_DEMCR, ap->ap_cortexm_demcr);
+	target_mem_write32(t, CORTEXM_DEMCR, ap->ap_cortexm_demcr | (tracing ? CORTEXM_DEMCR_TRCENA : 0U));
 	/* Disable debug */
 	target_mem_write32(t, CORTEXM_DHCSR, CORTEXM_DHCSR_DBGKEY);
 }
@@ -591,19 +952,78 @@ enum {
 	DB_DEMCR
 };
 
-static void cortexm_regs_read(target *t, void *data)
+#define CORTEXM_REGS_PER_SEQUENCE 8U
+
+/*
+ * Read core registers into regs, or write them from values, through DCRSR
+ * and DCRDR once the banked data registers have been mapped onto the debug
+ * registers. S_REGRDY isn't polled: the core has moved the value long before
+ * the next transfer is on the wire, and failures show up as faults when the
+ * batch completes.
+ *
+ * A probe side sequence is one round trip already. Otherwise the transfers
+ * go through the DP queue, the AP read being posted each value is picked
+ * up from RDBUFF, and the link is only waited on at the flush.
+ */
+static void cortexm_regs_transfer(
+	ADIv5_AP_t *ap, const uint32_t *regnums, size_t count, const uint32_t *values, uint32_t *regs)
+{
+	ADIv5_DP_t *const dp = ap->dp;
+	const bool write = values != NULL;
+	if (dp->sequence == firmware_sequence) {
+		for (size_t i = 0; i < count; ++i) {
+			if (write) {
+				adiv5_dp_queue_write(dp, ADIV5_AP_DB(DB_DCRDR), values[i]);
+				adiv5_dp_queue_write(dp, ADIV5_AP_DB(DB_DCRSR), CORTEXM_DCRSR_REGWnR | regnums[i]);
+			} else {
+				uint32_t posted;
+				adiv5_dp_queue_write(dp, ADIV5_AP_DB(DB_DCRSR), regnums[i]);
+				adiv5_dp_queue_read(dp, ADIV5_AP_DB(DB_DCRDR), &posted);
+				adiv5_dp_queue_read(dp, ADIV5_DP_RDBUFF, &regs[i]);
+			}
+		}
+		/* Faults are left for the caller's target_check_error() */
+		adiv5_dp_flush(dp);
+		return;
+	}
+
+	adiv5_seq_op_t ops[CORTEXM_REGS_PER_SEQUENCE * 2U] = {{0}};
+	for (size_t base = 0; base < count; base += CORTEXM_REGS_PER_SEQUENCE) {
+		const size_t batch = MIN(count - base, CORTEXM_REGS_PER_SEQUENCE);
+		for (size_t i = 0; i < batch; ++i) {
+			adiv5_seq_op_t *const op = &ops[i * 2U];
+			op[0].type = ADIV5_SEQ_DP_WRITE;
+			op[1].type = write ? ADIV5_SEQ_DP_WRITE : ADIV5_SEQ_DP_READ;
+			if (write) {
+				op[0].addr = ADIV5_AP_DB(DB_DCRDR);
+				op[0].value = values[base + i];
+				op[1].addr = ADIV5_AP_DB(DB_DCRSR);
+				op[1].value = CORTEXM_DCRSR_REGWnR | regnums[base + i];
+			} else {
+				op[0].addr = ADIV5_AP_DB(DB_DCRSR);
+				op[0].value = regnums[base + i];
+				op[1].addr = ADIV5_AP_DB(DB_DCRDR);
+			}
+		}
+		if (!adiv5_sequence(ap, ops, batch * 2U))
+			return;
+		for (size_t i = 0; i < batch && !write; ++i)
+			regs[base + i] = ops[i * 2U + 1U].value;
+	}
+}
+
+static void cortexm_regs_read_raw(target *t, void *data)
 {
 	uint32_t *regs = data;
 	ADIv5_AP_t *ap = cortexm_ap(t);
-	size_t i;
 #if PC_HOSTED == 1
 	if ((ap->dp->ap_reg_read) && (ap->dp->ap_regs_read)) {
 		uint32_t base_regs[21];
 		ap->dp->ap_regs_read(ap, base_regs);
-		for (i = 0; i < sizeof(regnum_cortex_m) / 4; i++)
+		for (size_t i = 0; i < sizeof(regnum_cortex_m) / 4; i++)
 			*regs++ = base_regs[regnum_cortex_m[i]];
 		if (t->target_options & TOPT_FLAVOUR_V7MF)
-			for (i = 0; i < sizeof(regnum_cortex_mf) / 4; i++)
+			for (size_t i = 0; i < sizeof(regnum_cortex_mf) / 4; i++)
 				*regs++ = ap->dp->ap_reg_read(ap, regnum_cortex_mf[i]);
 	} else
 #endif
@@ -614,25 +1034,21 @@ static void cortexm_regs_read(target *t, void *data)
 		/* Map the banked data registers (0x10-0x1c) to the
 		 * debug registers DHCSR, DCRSR, DCRDR and DEMCR respectively */
 		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
+		adiv5_ap_invalidate_cache(ap);
 
 		/* Walk the regnum_cortex_m array, reading the registers it
 		 * calls out. */
 		adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_m[0]);
 		/* Required to switch banks */
 		*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
-		for (i = 1; i < sizeof(regnum_cortex_m) / 4; i++) {
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_m[i]);
-			*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
-		}
+		cortexm_regs_transfer(ap, regnum_cortex_m + 1, sizeof(regnum_cortex_m) / 4 - 1, NULL, regs);
+		regs += sizeof(regnum_cortex_m) / 4 - 1;
 		if (t->target_options & TOPT_FLAVOUR_V7MF)
-			for (i = 0; i < sizeof(regnum_cortex_mf) / 4; i++) {
-				adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_mf[i]);
-				*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
-			}
+			cortexm_regs_transfer(ap, regnum_cortex_mf, sizeof(regnum_cortex_mf) / 4, NULL, regs);
 	}
 }
 
-static void cortexm_regs_write(target *t, const void *data)
+static void cortexm_regs_write_raw(target *t, const void *data)
 {
 	const uint32_t *regs = data;
 	ADIv5_AP_t *ap = cortexm_ap(t);
@@ -650,28 +1066,22 @@ static void cortexm_regs_write(target *t, const void *data)
 	} else
 #endif
 	{
-		size_t i;
-
 		/* FIXME: Describe what's really going on here */
 		adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
 
 		/* Map the banked data registers (0x10-0x1c) to the
 		 * debug registers DHCSR, DCRSR, DCRDR and DEMCR respectively */
 		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
+		adiv5_ap_invalidate_cache(ap);
 		/* Walk the regnum_cortex_m array, writing the registers it
 		 * calls out. */
 		adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRDR), *regs++);
 		/* Required to switch banks */
 		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), 0x10000 | regnum_cortex_m[0]);
-		for (i = 1; i < sizeof(regnum_cortex_m) / 4; i++) {
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRDR), *regs++);
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), 0x10000 | regnum_cortex_m[i]);
-		}
+		cortexm_regs_transfer(ap, regnum_cortex_m + 1, sizeof(regnum_cortex_m) / 4 - 1, regs, NULL);
+		regs += sizeof(regnum_cortex_m) / 4 - 1;
 		if (t->target_options & TOPT_FLAVOUR_V7MF)
-			for (i = 0; i < sizeof(regnum_cortex_mf) / 4; i++) {
-				adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRDR), *regs++);
-				adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), 0x10000 | regnum_cortex_mf[i]);
-			}
+			cortexm_regs_transfer(ap, regnum_cortex_mf, sizeof(regnum_cortex_mf) / 4, regs, NULL);
 	}
 }
 
@@ -693,42 +1103,322 @@ static int dcrsr_regnum(target *t, unsigned reg)
 		return -1;
 	}
 }
+static uint32_t cortexm_reg_read_raw(target *t, unsigned reg)
+{
+	target_mem_write32(t, CORTEXM_DCRSR, dcrsr_regnum(t, reg));
+	return target_mem_read32(t, CORTEXM_DCRDR);
+}
+
+static void cortexm_reg_write_raw(target *t, unsigned reg, const uint32_t val)
+{
+	target_mem_write32(t, CORTEXM_DCRDR, val);
+	target_mem_write32(t, CORTEXM_DCRSR, CORTEXM_DCRSR_REGWnR | dcrsr_regnum(t, reg));
+}
+
+/*
+ * The register cache is filled on demand while the core is halted and any
+ * modified registers are written back just before the core is resumed.
+ * If the cache could not be allocated, everything goes straight to the core.
+ */
+static uint64_t cortexm_reg_cache_all(target *t)
+{
+	return (UINT64_C(1) << (t->regs_size / 4U)) - 1U;
+}
+
+static void cortexm_reg_cache_flush(target *t)
+{
+	if (!t->reg_cache_dirty)
+		return;
+	if (t->reg_cache_dirty == cortexm_reg_cache_all(t))
+		cortexm_regs_write_raw(t, t->reg_cache);
+	else {
+		for (size_t i = 0; i < t->regs_size / 4U; ++i) {
+			if (t->reg_cache_dirty & (UINT64_C(1) << i))
+				cortexm_reg_write_raw(t, i, t->reg_cache[i]);
+		}
+	}
+	t->reg_cache_dirty = 0;
+}
+
+static void cortexm_reg_cache_invalidate(target *t)
+{
+	t->reg_cache_valid = 0;
+	t->reg_cache_dirty = 0;
+}
+
+static uint64_t cortexm_reg_cache_core(void)
+{
+	return (UINT64_C(1) << (sizeof(regnum_cortex_m) / 4U)) - 1U;
+}
+
+/* The FPU's registers read as nothing useful while CPACR has it disabled */
+static bool cortexm_fpu_enabled(target *t)
+{
+	return target_mem_read32(t, CORTEXM_CPACR) & CORTEXM_CPACR_CP10_MASK;
+}
+
+/*
+ * Brings the registers in mask into the cache, reading those not there yet
+ * in one go rather than one round trip each. The FPU's are zeros without
+ * being read while it's disabled.
+ */
+static void cortexm_reg_cache_fetch(target *t, uint64_t mask)
+{
+	if (!t->reg_cache)
+		return;
+	mask &= ~t->reg_cache_valid & cortexm_reg_cache_all(t);
+	const uint64_t fp_mask = mask & ~cortexm_reg_cache_core();
+	if (fp_mask && !cortexm_fpu_enabled(t)) {
+		for (size_t i = REG_FPSCR; i < t->regs_size / 4U; ++i) {
+			if (fp_mask & (UINT64_C(1) << i))
+				t->reg_cache[i] = 0;
+		}
+		t->reg_cache_valid |= fp_mask;
+		mask &= ~fp_mask;
+	}
+	if (!mask)
+		return;
+	ADIv5_AP_t *ap = cortexm_ap(t);
+#if PC_HOSTED == 1
+	/* The probe hands over the core registers in one request, take those */
+	if ((ap->dp->ap_reg_read) && (ap->dp->ap_regs_read)) {
+		if (mask & cortexm_reg_cache_core()) {
+			uint32_t base_regs[21];
+			ap->dp->ap_regs_read(ap, base_regs);
+			for (size_t i = 0; i < sizeof(regnum_cortex_m) / 4U; ++i) {
+				if (mask & (UINT64_C(1) << i))
+					t->reg_cache[i] = base_regs[regnum_cortex_m[i]];
+			}
+		}
+		for (size_t i = REG_FPSCR; i < t->regs_size / 4U; ++i) {
+			if (mask & (UINT64_C(1) << i))
+				t->reg_cache[i] = ap->dp->ap_reg_read(ap, regnum_cortex_mf[i - REG_FPSCR]);
+		}
+		t->reg_cache_valid |= mask;
+		return;
+	}
+#endif
+	const size_t words = t->regs_size / 4U;
+	uint32_t regnums[words];
+	uint32_t values[words];
+	size_t count = 0;
+	for (size_t i = 0; i < words; ++i) {
+		if (mask & (UINT64_C(1) << i))
+			regnums[count++] = dcrsr_regnum(t, i);
+	}
+
+	/* Same banked access to DCRSR and DCRDR as cortexm_regs_read_raw() */
+	adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
+	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
+	adiv5_ap_invalidate_cache(ap);
+	adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRSR), regnums[0]);
+	/* Required to switch banks */
+	values[0] = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
+	cortexm_regs_transfer(ap, regnums + 1, count - 1U, NULL, values + 1);
+	if (target_check_error(t))
+		return;
+
+	for (size_t i = 0, j = 0; i < words; ++i) {
+		if (mask & (UINT64_C(1) << i))
+			t->reg_cache[i] = values[j++];
+	}
+	t->reg_cache_valid |= mask;
+}
+
+static void cortexm_regs_read(target *t, void *data)
+{
+	if (!t->reg_cache) {
+		cortexm_regs_read_raw(t, data);
+		return;
+	}
+	cortexm_reg_cache_fetch(t, cortexm_reg_cache_all(t));
+	memcpy(data, t->reg_cache, t->regs_size);
+}
+
+/* What 'g' covers on FPU parts, GDB reads the FPU's registers with 'p' when it wants them */
+static void cortexm_regs_read_core(target *t, void *data)
+{
+	if (!t->reg_cache) {
+		uint32_t regs[t->regs_size / 4U];
+		cortexm_regs_read_raw(t, regs);
+		memcpy(data, regs, sizeof(regnum_cortex_m));
+		return;
+	}
+	cortexm_reg_cache_fetch(t, cortexm_reg_cache_core());
+	memcpy(data, t->reg_cache, sizeof(regnum_cortex_m));
+}
+
+/* Only what differs from the cache is written back, so restoring saved registers costs little */
+static void cortexm_regs_write(target *t, const void *data)
+{
+	if (!t->reg_cache) {
+		cortexm_regs_write_raw(t, data);
+		return;
+	}
+	const uint32_t *const regs = data;
+	for (size_t i = 0; i < t->regs_size / 4U; ++i) {
+		const uint64_t mask = UINT64_C(1) << i;
+		if (!(t->reg_cache_valid & mask) || t->reg_cache[i] != regs[i])
+			t->reg_cache_dirty |= mask;
+	}
+	memcpy(t->reg_cache, data, t->regs_size);
+	t->reg_cache_valid = cortexm_reg_cache_all(t);
+}
+
+static uint32_t cortexm_reg_get(target *t, unsigned reg)
+{
+	if (!t->reg_cache)
+		return cortexm_reg_read_raw(t, reg);
+	const uint64_t mask = UINT64_C(1) << reg;
+	if (!(t->reg_cache_valid & mask)) {
+		/* Whoever wants one of the FPU's registers wants the rest of them shortly */
+		if (reg >= REG_FPSCR)
+			cortexm_reg_cache_fetch(t, cortexm_reg_cache_all(t) & ~cortexm_reg_cache_core());
+		else {
+			t->reg_cache[reg] = cortexm_reg_read_raw(t, reg);
+			t->reg_cache_valid |= mask;
+		}
+	}
+	return t->reg_cache[reg];
+}
+
+static void cortexm_reg_set(target *t, unsigned reg, const uint32_t val)
+{
+	if (!t->reg_cache) {
+		cortexm_reg_write_raw(t, reg, val);
+		return;
+	}
+	const uint64_t mask = UINT64_C(1) << reg;
+	t->reg_cache[reg] = val;
+	t->reg_cache_valid |= mask;
+	t->reg_cache_dirty |= mask;
+}
+
+/*
+ * reg_read() and reg_write() take GDB's register numbers, from the target
+ * description: the special word is four 8-bit registers, primask to control,
+ * and the FPU's registers follow as fpscr and d0-d15, each d a pair of s.
+ */
+#define CORTEXM_GDB_REG_PRIMASK 19U
+#define CORTEXM_GDB_REG_FPSCR   23U
+#define CORTEXM_GDB_REG_D0      24U
+#define CORTEXM_GDB_REG_D_COUNT 16U
+
+/* The cache word a GDB register starts in and where in it, returns its size or -1 if there's no such register */
+static ssize_t cortexm_reg_locate(target *t, const int reg, size_t *word, size_t *offset)
+{
+	*offset = 0;
+	if (reg < 0)
+		return -1;
+	const size_t regnum = reg;
+	if (regnum < CORTEXM_GDB_REG_PRIMASK) {
+		*word = regnum;
+		return 4;
+	}
+	if (regnum < CORTEXM_GDB_REG_FPSCR) {
+		*word = REG_SPECIAL;
+		*offset = regnum - CORTEXM_GDB_REG_PRIMASK;
+		return 1;
+	}
+	if (!(t->target_options & TOPT_FLAVOUR_V7MF))
+		return -1;
+	if (regnum == CORTEXM_GDB_REG_FPSCR) {
+		*word = REG_FPSCR;
+		return 4;
+	}
+	if (regnum < CORTEXM_GDB_REG_D0 + CORTEXM_GDB_REG_D_COUNT) {
+		*word = REG_FPSCR + 1U + (regnum - CORTEXM_GDB_REG_D0) * 2U;
+		return 8;
+	}
+	return -1;
+}
+
 static ssize_t cortexm_reg_read(target *t, int reg, void *data, size_t max)
 {
-	if (max < 4)
+	size_t word;
+	size_t offset;
+	const ssize_t size = cortexm_reg_locate(t, reg, &word, &offset);
+	if (size < 0 || max < (size_t)size)
 		return -1;
-	uint32_t *r = data;
-	target_mem_write32(t, CORTEXM_DCRSR, dcrsr_regnum(t, reg));
-	*r = target_mem_read32(t, CORTEXM_DCRDR);
-	return 4;
+	uint32_t value[2];
+	value[0] = cortexm_reg_get(t, word);
+	if (size > 4)
+		value[1] = cortexm_reg_get(t, word + 1U);
+	memcpy(data, (const uint8_t *)value + offset, size);
+	return size;
 }
 
 static ssize_t cortexm_reg_write(target *t, int reg, const void *data, size_t max)
 {
-	if (max < 4)
+	size_t word;
+	size_t offset;
+	const ssize_t size = cortexm_reg_locate(t, reg, &word, &offset);
+	if (size < 0 || max < (size_t)size)
 		return -1;
-	const uint32_t *r = data;
-	target_mem_write32(t, CORTEXM_DCRDR, *r);
-	target_mem_write32(t, CORTEXM_DCRSR, CORTEXM_DCRSR_REGWnR | dcrsr_regnum(t, reg));
-	return 4;
+	uint32_t value[2];
+	/* The 8-bit special registers share their word */
+	if (size < 4)
+		value[0] = cortexm_reg_get(t, word);
+	memcpy((uint8_t *)value + offset, data, size);
+	cortexm_reg_set(t, word, value[0]);
+	if (size > 4)
+		cortexm_reg_set(t, word + 1U, value[1]);
+	return size;
 }
 
 static uint32_t cortexm_pc_read(target *t)
 {
-	target_mem_write32(t, CORTEXM_DCRSR, 0x0F);
-	return target_mem_read32(t, CORTEXM_DCRDR);
+	return cortexm_reg_get(t, REG_PC);
 }
 
 static void cortexm_pc_write(target *t, const uint32_t val)
 {
-	target_mem_write32(t, CORTEXM_DCRDR, val);
-	target_mem_write32(t, CORTEXM_DCRSR, CORTEXM_DCRSR_REGWnR | 0x0F);
+	cortexm_reg_set(t, REG_PC, val);
+}
+
+/*
+ * With reset vector catch armed, as it is from attach unless turned off with
+ * vector_catch, the core halts on the first instruction after reset. Wait
+ * for that with the poll running on the probe, one round trip for hosted.
+ * The core only halts once reset is released and its clock runs, so neither
+ * the wait for S_RESET_ST nor the settling delay are needed after it.
+ * Returns false to leave the reset to the slow path, if the catch isn't armed
+ * or the core didn't halt in time.
+ */
+static bool cortexm_reset_halt_wait(target *t, const bool reset_seen)
+{
+	const struct cortexm_priv *priv = t->priv;
+	if (!(priv->demcr & CORTEXM_DEMCR_VC_CORERESET))
+		return false;
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	volatile uint32_t dhcsr = 0;
+	volatile bool taken = reset_seen;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		/* S_HALT still reads as before until the reset has been taken, S_RESET_ST says it has */
+		if (!taken) {
+			dhcsr = adiv5_mem_wait32(ap, CORTEXM_DHCSR, CORTEXM_DHCSR_S_RESET_ST, 0, 1000);
+			taken = dhcsr & CORTEXM_DHCSR_S_RESET_ST;
+		}
+		if (taken && !(dhcsr & CORTEXM_DHCSR_S_HALT))
+			dhcsr = adiv5_mem_wait32(ap, CORTEXM_DHCSR, CORTEXM_DHCSR_S_HALT, 0, 1000);
+	}
+	/* A DP fault on the way, as some parts drop the AP during reset */
+	const bool faulted = target_check_error(t);
+	if (e.type || faulted || !taken || !(dhcsr & CORTEXM_DHCSR_S_HALT))
+		return false;
+	target_mem_write32(t, CORTEXM_DFSR, CORTEXM_DFSR_RESETALL);
+	return true;
 }
 
 /* The following three routines implement target halt/resume
  * using the core debug registers in the NVIC. */
 static void cortexm_reset(target *t)
 {
+	/* Any cached or pending register values are meaningless after reset */
+	cortexm_reg_cache_invalidate(t);
+	cortexm_cache_forget(t);
+	cortexm_breakwatch_forget(t);
 	/* Read DHCSR here to clear S_RESET_ST bit before reset */
 	target_mem_read32(t, CORTEXM_DHCSR);
 	platform_timeout reset_timeout;
@@ -750,6 +1440,8 @@ static void cortexm_reset(target *t)
 	if (t->extended_reset != NULL) {
 		t->extended_reset(t);
 	}
+	if (cortexm_reset_halt_wait(t, dhcsr & CORTEXM_DHCSR_S_RESET_ST))
+		return;
 	/* Wait for CORTEXM_DHCSR_S_RESET_ST to read 0, meaning reset released.*/
 	platform_timeout_set(&reset_timeout, 1000);
 	while ((target_mem_read32(t, CORTEXM_DHCSR) & CORTEXM_DHCSR_S_RESET_ST) &&
@@ -770,6 +1462,9 @@ static void cortexm_reset(target *t)
 
 static void cortexm_halt_request(target *t)
 {
+	struct cortexm_priv *priv = t->priv;
+	/* The halt ends a range step, rather than being taken for the end of one step */
+	priv->step_range_end = 0;
 	volatile struct exception e;
 	TRY_CATCH (e, EXCEPTION_TIMEOUT) {
 		target_mem_write32(t, CORTEXM_DHCSR, CORTEXM_DHCSR_DBGKEY | CORTEXM_DHCSR_C_HALT | CORTEXM_DHCSR_C_DEBUGEN);
@@ -779,29 +1474,185 @@ static void cortexm_halt_request(target *t)
 	}
 }
 
-static enum target_halt_reason cortexm_halt_poll(target *t, target_addr *watch)
+/*
+ * Wait for S_HALT with the poll loop running on the probe, so a running target
+ * costs one round trip per wait rather than one per halt_poll. Waiting locally
+ * gains nothing, so in that case leave the caller to sleep instead.
+ */
+static bool cortexm_halt_wait(target *t, uint32_t timeout_ms)
 {
-	struct cortexm_priv *priv = t->priv;
-
-	volatile uint32_t dhcsr = 0;
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	if (ap->dp->mem_wait32 == firmware_mem_wait32)
+		return false;
 	volatile struct exception e;
 	TRY_CATCH (e, EXCEPTION_ALL) {
-		/* If this times out because the target is in WFI then
-		 * the target is still running. */
-		dhcsr = target_mem_read32(t, CORTEXM_DHCSR);
+		adiv5_mem_wait32(ap, CORTEXM_DHCSR, CORTEXM_DHCSR_S_HALT, 0, timeout_ms);
+	}
+	/* Errors are picked up by the halt_poll that follows */
+	return !e.type;
+}
+
+/*
+ * DWT_PCSR reads the address of a recently executed instruction while the
+ * core runs, all ones while it is halted or when PC sampling isn't
+ * implemented. Those reads are left out, as are all of them on a fault.
+ */
+#define CORTEXM_PC_SAMPLES_PER_SEQUENCE 16U
+
+static size_t cortexm_pc_sample(target *t, uint32_t *pcs, size_t count)
+{
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	adiv5_seq_op_t ops[CORTEXM_PC_SAMPLES_PER_SEQUENCE];
+	size_t valid = 0;
+	for (size_t base = 0; base < count; base += CORTEXM_PC_SAMPLES_PER_SEQUENCE) {
+		const size_t batch = MIN(count - base, CORTEXM_PC_SAMPLES_PER_SEQUENCE);
+		for (size_t i = 0; i < batch; ++i)
+			ops[i] = (adiv5_seq_op_t){.type = ADIV5_SEQ_MEM_READ, .addr = CORTEXM_DWT_PCSR};
+		if (!adiv5_sequence(ap, ops, batch)) {
+			target_check_error(t);
+			return 0;
+		}
+		for (size_t i = 0; i < batch; ++i) {
+			if (ops[i].value != UINT32_MAX)
+				pcs[valid++] = ops[i].value;
+		}
+	}
+	return valid;
+}
+
+/* CYCCNT bit 10 reloading the 4 bit POSTCNT at 15 gives a sample every 16384 cycles */
+#define CORTEXM_TRACE_PROFILE_POSTPRESET 15U
+
+/*
+ * Have the DWT send periodic PC samples and exception trace over SWO,
+ * through ITM and a TPIU set up for the given protocol. The TPIU prescaler
+ * is only set when the trace clock is known, otherwise it is left as the
+ * firmware on the target set it up. None of this is affected by a system
+ * reset, so it holds until the target is power cycled.
+ */
+static void cortexm_trace_port_setup(target *t, bool manchester, uint32_t traceclk_hz, uint32_t baudrate)
+{
+	struct cortexm_priv *priv = t->priv;
+	priv->demcr |= CORTEXM_DEMCR_TRCENA;
+	target_mem_write32(t, CORTEXM_DEMCR, priv->demcr);
+
+	target_mem_write32(t, CORTEXM_TPIU_SPPR, manchester ? CORTEXM_TPIU_SPPR_MANCHESTER : CORTEXM_TPIU_SPPR_NRZ);
+	if (traceclk_hz && baudrate)
+		target_mem_write32(t, CORTEXM_TPIU_ACPR, (traceclk_hz / (manchester ? 2U * baudrate : baudrate)) - 1U);
+	target_mem_write32(t, CORTEXM_TPIU_FFCR, CORTEXM_TPIU_FFCR_TRIGIN);
+
+	target_mem_write32(t, CORTEXM_ITM_LAR, CORTEXM_ITM_LAR_KEY);
+	target_mem_write32(t, CORTEXM_ITM_TCR,
+		(1U << CORTEXM_ITM_TCR_TRACEBUSID_SHIFT) | CORTEXM_ITM_TCR_TXENA | CORTEXM_ITM_TCR_SYNCENA |
+			CORTEXM_ITM_TCR_ITMENA);
+}
+
+bool cortexm_trace_profile_setup(target *t, bool manchester, uint32_t traceclk_hz, uint32_t baudrate)
+{
+	const uint32_t dwt_ctrl = target_mem_read32(t, CORTEXM_DWT_CTRL);
+	if (target_check_error(t) || (dwt_ctrl & (CORTEXM_DWT_CTRL_NOTRCPKT | CORTEXM_DWT_CTRL_NOCYCCNT)))
+		return false;
+
+	cortexm_trace_port_setup(t, manchester, traceclk_hz, baudrate);
+
+	/* Keep the event counters as they are, the sampling fields are ours */
+	target_mem_write32(t, CORTEXM_DWT_CTRL,
+		(dwt_ctrl & CORTEXM_DWT_CTRL_EVTENA_MASK) | CORTEXM_DWT_CTRL_EXCTRCENA |
+			CORTEXM_DWT_CTRL_PCSAMPLENA | CORTEXM_DWT_CTRL_SYNCTAP_24 | CORTEXM_DWT_CTRL_CYCTAP |
+			(CORTEXM_TRACE_PROFILE_POSTPRESET << CORTEXM_DWT_CTRL_POSTPRESET_SHIFT) | CORTEXM_DWT_CTRL_CYCCNTENA);
+	return !target_check_error(t);
+}
+
+/*
+ * Have a DWT comparator send the value of every write to addr as a data
+ * trace packet, the core carrying on without a halt. The comparator is
+ * kept from GDB's watchpoints, and left running on detach, until cleared.
+ * Data value packets only have room for comparators 0 to 3. Returns the
+ * comparator, which the packets carry, or -1.
+ */
+int cortexm_trace_var(
+	target *t, target_addr addr, size_t size, bool manchester, uint32_t traceclk_hz, uint32_t baudrate)
+{
+	struct cortexm_priv *priv = t->priv;
+	/* ARMv6-M comparators can only halt the core */
+	if ((t->target_options & TOPT_FLAVOUR_V6M) || (size != 1U && size != 2U && size != 4U) || (addr & (size - 1U)))
+		return -1;
+	const uint32_t dwt_ctrl = target_mem_read32(t, CORTEXM_DWT_CTRL);
+	if (target_check_error(t) || (dwt_ctrl & CORTEXM_DWT_CTRL_NOTRCPKT))
+		return -1;
+
+	size_t i = 0;
+	while (i < priv->hw_watchpoint_max && priv->hw_watchpoint[i])
+		++i;
+	if (i == priv->hw_watchpoint_max)
+		return -1;
+
+	cortexm_trace_port_setup(t, manchester, traceclk_hz, baudrate);
+	cortexm_dwt_write(t, i,
+		&(struct cortexm_dwt_comp){
+			.comp = addr,
+			.mask = dwt_mask(size),
+			.func = CORTEXM_DWT_FUNC_FUNC_TRACE_WRITE | ((size >> 1U) << CORTEXM_DWT_FUNC_DATAVSIZE_SHIFT),
+		});
+	if (target_check_error(t)) {
+		cortexm_dwt_write(t, i, &(struct cortexm_dwt_comp){0});
+		return -1;
+	}
+	priv->hw_watchpoint[i] = true;
+	priv->trace_var[i] = true;
+	priv->trace_var_addr[i] = addr;
+	priv->trace_var_size[i] = size;
+	return i;
+}
+
+void cortexm_trace_var_clear(target *t)
+{
+	struct cortexm_priv *priv = t->priv;
+	for (size_t i = 0; i < priv->hw_watchpoint_max; i++) {
+		if (!priv->trace_var[i])
+			continue;
+		cortexm_dwt_write(t, i, &(struct cortexm_dwt_comp){0});
+		priv->hw_watchpoint[i] = false;
+		priv->trace_var[i] = false;
+	}
+}
+
+void cortexm_trace_var_print(target *t, void (*print)(const char *fmt, ...))
+{
+	struct cortexm_priv *priv = t->priv;
+	for (size_t i = 0; i < priv->hw_watchpoint_max; i++) {
+		if (priv->trace_var[i])
+			print("Comparator %u: writes to 0x%08" PRIx32 ", %u bytes\n", (unsigned)i, priv->trace_var_addr[i],
+				(unsigned)priv->trace_var_size[i]);
 	}
-	switch (e.type) {
-	case EXCEPTION_ERROR:
+}
+
+static enum target_halt_reason cortexm_halt_poll_once(target *t, target_addr *watch)
+{
+	struct cortexm_priv *priv = t->priv;
+
+	uint32_t dhcsr = 0;
+	ADIv5_DP_t *const dp = cortexm_ap(t)->dp;
+	dp->polling = true;
+	const adiv5_status_e status = adiv5_mem_read_status(cortexm_ap(t), &dhcsr, CORTEXM_DHCSR, sizeof(dhcsr));
+	dp->polling = false;
+	switch (status) {
+	case ADIV5_STATUS_ERROR:
 		/* Oh crap, there's no recovery from this... */
 		target_list_free();
 		return TARGET_HALT_ERROR;
-	case EXCEPTION_TIMEOUT:
+	case ADIV5_STATUS_TIMEOUT:
 		/* Timeout isn't a problem, target could be in WFI */
 		return TARGET_HALT_RUNNING;
+	default:
+		break;
 	}
 
-	if (!(dhcsr & CORTEXM_DHCSR_S_HALT))
+	if (!(dhcsr & CORTEXM_DHCSR_S_HALT)) {
+		/* Don't let register reads made while running linger in the cache */
+		cortexm_reg_cache_invalidate(t);
 		return TARGET_HALT_RUNNING;
+	}
 
 	/* We've halted.  Let's find out why. */
 	uint32_t dfsr = target_mem_read32(t, CORTEXM_DFSR);
@@ -814,7 +1665,8 @@ static enum target_halt_reason cortexm_halt_poll(target *t, target_addr *watch)
 	priv->on_bkpt = dfsr & (CORTEXM_DFSR_BKPT);
 	if (priv->on_bkpt) {
 		/* If we've hit a programmed breakpoint, check for semihosting
-		 * call. */
+		 * call. The registers that takes come along with the PC. */
+		cortexm_reg_cache_fetch(t, (1U << 0U) | (1U << 1U) | (1U << REG_PC));
 		uint32_t pc = cortexm_pc_read(t);
 		uint16_t bkpt_instr;
 		bkpt_instr = target_mem_read16(t, pc);
@@ -842,7 +1694,7 @@ static enum target_halt_reason cortexm_halt_poll(target *t, target_addr *watch)
 	return TARGET_HALT_BREAKPOINT;
 }
 
-static void cortexm_halt_resume(target *t, bool step)
+static void cortexm_resume(target *t, bool step)
 {
 	struct cortexm_priv *priv = t->priv;
 	uint32_t dhcsr = CORTEXM_DHCSR_DBGKEY | CORTEXM_DHCSR_C_DEBUGEN;
@@ -865,7 +1717,55 @@ static void cortexm_halt_resume(target *t, bool step)
 	if (priv->has_cache)
 		target_mem_write32(t, CORTEXM_ICIALLU, 0);
 
+	cortexm_breakwatch_flush(t);
+	cortexm_reg_cache_flush(t);
+	cortexm_cache_forget(t);
 	target_mem_write32(t, CORTEXM_DHCSR, dhcsr);
+	cortexm_reg_cache_invalidate(t);
+}
+
+/*
+ * While range stepping, each step that leaves PC inside the range is followed
+ * by the next one straight away, so only the step that leaves it (or stops for
+ * another reason) is reported. After a time slice the step is left running and
+ * reported as such, the next poll carries on from there.
+ */
+static enum target_halt_reason cortexm_halt_poll(target *t, target_addr *watch)
+{
+	struct cortexm_priv *priv = t->priv;
+	enum target_halt_reason reason = cortexm_halt_poll_once(t, watch);
+	const uint32_t start_time = platform_time_ms();
+	while (reason == TARGET_HALT_STEPPING && priv->step_range_end) {
+		const uint32_t pc = cortexm_pc_read(t);
+		if (pc < priv->step_range_start || pc >= priv->step_range_end)
+			break;
+		cortexm_resume(t, true);
+		if (platform_time_ms() - start_time >= CORTEXM_RANGE_STEP_SLICE_MS)
+			return TARGET_HALT_RUNNING;
+		reason = cortexm_halt_poll_once(t, watch);
+	}
+	/* On error the target has been freed along with the list */
+	if (reason != TARGET_HALT_RUNNING && reason != TARGET_HALT_ERROR) {
+		priv->step_range_end = 0;
+		priv->halted = true;
+	}
+	return reason;
+}
+
+static void cortexm_halt_resume(target *t, bool step)
+{
+	struct cortexm_priv *priv = t->priv;
+	priv->step_range_end = 0;
+	cortexm_resume(t, step);
+}
+
+/* Step until PC leaves [start, end), see cortexm_halt_poll() */
+static void cortexm_halt_resume_range(target *t, target_addr start, target_addr end)
+{
+	struct cortexm_priv *priv = t->priv;
+	cortexm_resume(t, true);
+	priv->step_range_start = start;
+	priv->step_range_end = end;
 }
 
 static int cortexm_fault_unwind(target *t)
@@ -926,7 +1826,8 @@ static int cortexm_fault_unwind(target *t)
 	return 0;
 }
 
-int cortexm_run_stub(target *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+/* Load the registers for a stub and set it running, it must end with a bkpt */
+int cortexm_start_stub(target *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
 {
 	uint32_t regs[t->regs_size / 4U];
 
@@ -945,15 +1846,20 @@ int cortexm_run_stub(target *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uin
 		return -1;
 
 	/* Execute the stub */
-	enum target_halt_reason reason;
-#if defined(PLATFORM_HAS_DEBUG)
-	uint32_t arm_regs_start[t->regs_size];
-	target_regs_read(t, arm_regs_start);
-#endif
 	cortexm_halt_resume(t, 0);
+	return 0;
+}
+
+/* Wait for a stub started by cortexm_start_stub() and return its bkpt number */
+int cortexm_wait_stub(target *t, uint32_t timeout_ms)
+{
+	enum target_halt_reason reason;
 	platform_timeout timeout;
-	platform_timeout_set(&timeout, 5000);
+	platform_timeout_set(&timeout, timeout_ms);
+	const uint32_t start = platform_time_us();
+	uint32_t polls = 0;
 	do {
+		++polls;
 		if (platform_timeout_is_expired(&timeout)) {
 			cortexm_halt_request(t);
 #if defined(PLATFORM_HAS_DEBUG)
@@ -961,12 +1867,13 @@ int cortexm_run_stub(target *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uin
 			uint32_t arm_regs[t->regs_size];
 			target_regs_read(t, arm_regs);
 			for (size_t i = 0; i < 20; i++) {
-				DEBUG_WARN("%2d: %08" PRIx32 ", %08" PRIx32 "\n", i, arm_regs_start[i], arm_regs[i]);
+				DEBUG_WARN("%2d: %08" PRIx32 "\n", i, arm_regs[i]);
 			}
 #endif
 			return -3;
 		}
 	} while ((reason = cortexm_halt_poll(t, NULL)) == TARGET_HALT_RUNNING);
+	target_flash_stats_poll(t, polls, platform_time_us() - start);
 
 	if (reason == TARGET_HALT_ERROR)
 		raise_exception(EXCEPTION_ERROR, "Target lost in stub");
@@ -983,6 +1890,168 @@ int cortexm_run_stub(target *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uin
 	return bkpt_instr & 0xffU;
 }
 
+int cortexm_run_stub(target *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+{
+	if (cortexm_start_stub(t, loadaddr, r0, r1, r2, r3))
+		return -1;
+	return cortexm_wait_stub(t, 5000);
+}
+
+static const uint16_t cortexm_crc32_stub[] = {
+#include "flashstub/crc32.stub"
+};
+
+/* Ranges shorter than this are quicker to go through the probe than to load a stub for */
+#define MEM_STUB_MIN_LEN   1024U
+/* Keep each stub run well inside cortexm_run_stub()'s timeout, even at reset clocks */
+#define MEM_STUB_CHUNK_LEN 0x10000U
+
+/*
+ * Compute a qCRC checksum by running a small stub from the start of target RAM.
+ * The RAM it uses and the core registers are saved and put back afterwards so the
+ * program being debugged is unaffected. Returns non-zero if the caller should fall
+ * back to reading the memory back.
+ */
+static int cortexm_crc32_stub_run(target *t, uint32_t *crc, target_addr addr, size_t len)
+{
+	const size_t stub_len = sizeof(cortexm_crc32_stub) + 4U;
+	if (len < MEM_STUB_MIN_LEN || !t->ram || t->ram->length < stub_len)
+		return -1;
+	const target_addr stub_addr = t->ram->start;
+	const target_addr result_addr = stub_addr + sizeof(cortexm_crc32_stub);
+	/* The stub can't checksum memory it is overwriting */
+	if (addr < stub_addr + stub_len && stub_addr < addr + len)
+		return -1;
+
+	uint32_t regs[t->regs_size / 4U];
+	uint8_t saved_ram[sizeof(cortexm_crc32_stub) + 4U];
+	target_regs_read(t, regs);
+	if (target_mem_read(t, saved_ram, stub_addr, stub_len))
+		return -1;
+
+	/* The stub changes memory behind the cache's back */
+	const bool cache_halted = target_mem_cache_suspend(t);
+	int ret = target_mem_write(t, stub_addr, cortexm_crc32_stub, sizeof(cortexm_crc32_stub));
+	uint32_t result = 0xffffffffU;
+	uint32_t last_time = platform_time_ms();
+	while (!ret && len) {
+		const uint32_t actual_time = platform_time_ms();
+		if (actual_time > last_time + 1000U) {
+			last_time = actual_time;
+			gdb_if_putchar(0, true);
+		}
+		const size_t chunk_len = MIN(len, MEM_STUB_CHUNK_LEN);
+		ret = cortexm_run_stub(t, stub_addr, addr, chunk_len, result, result_addr);
+		if (!ret)
+			result = target_mem_read32(t, result_addr);
+		addr += chunk_len;
+		len -= chunk_len;
+	}
+
+	target_mem_write(t, stub_addr, saved_ram, stub_len);
+	target_regs_write(t, regs);
+	target_mem_cache_resume(t, cache_halted);
+	if (ret || target_check_error(t)) {
+		DEBUG_WARN("CRC32 stub failed (%d), reading back instead\n", ret);
+		return -1;
+	}
+	*crc = result;
+	return 0;
+}
+
+static int cortexm_mem_crc32(target *t, uint32_t *crc, target_addr addr, size_t len)
+{
+	if (cortexm_crc32_stub_run(t, crc, addr, len) == 0)
+		return 0;
+	/* Without a stub, a remote probe can still checksum the range next to the target */
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	if (ap->dp->mem_crc32)
+		return ap->dp->mem_crc32(ap, crc, addr, len);
+	return -1;
+}
+
+static const uint16_t cortexm_memfill_stub[] = {
+#include "flashstub/memfill.stub"
+};
+
+static const uint16_t cortexm_memfind_stub[] = {
+#include "flashstub/memfind.stub"
+};
+
+/*
+ * Run the fill or find stub over a range from the start of target RAM, saving
+ * and restoring as for the CRC32 one. Both take the range in r0 and r1 and
+ * leave r0 where they stopped, which is the chunk's end unless they found
+ * something. Returns 0 with *stop set, non-zero to go through the probe instead.
+ */
+static int cortexm_mem_stub_run(target *t, const uint16_t *stub, size_t stub_size, target_addr addr, size_t len,
+	uint32_t r2, uint32_t r3, target_addr *stop)
+{
+	if (len < MEM_STUB_MIN_LEN || !t->ram || t->ram->length < stub_size)
+		return -1;
+	const target_addr stub_addr = t->ram->start;
+	if (addr < stub_addr + stub_size && stub_addr < addr + len)
+		return -1;
+
+	uint32_t regs[t->regs_size / 4U];
+	uint8_t saved_ram[stub_size];
+	target_regs_read(t, regs);
+	if (target_mem_read(t, saved_ram, stub_addr, stub_size))
+		return -1;
+
+	const bool cache_halted = target_mem_cache_suspend(t);
+	int ret = target_mem_write(t, stub_addr, stub, stub_size);
+	uint32_t last_time = platform_time_ms();
+	*stop = addr + len;
+	while (!ret && len) {
+		const uint32_t actual_time = platform_time_ms();
+		if (actual_time > last_time + 1000U) {
+			last_time = actual_time;
+			gdb_if_putchar(0, true);
+		}
+		/* A multiple of every pattern size, so each chunk starts on one */
+		const size_t chunk_len = MIN(len, MEM_STUB_CHUNK_LEN);
+		ret = cortexm_run_stub(t, stub_addr, addr, addr + chunk_len, r2, r3);
+		uint32_t r0 = 0;
+		if (!ret && target_reg_read(t, 0, &r0, sizeof(r0)) != sizeof(r0))
+			ret = -1;
+		if (!ret && r0 != addr + chunk_len) {
+			*stop = r0;
+			break;
+		}
+		addr += chunk_len;
+		len -= chunk_len;
+	}
+
+	target_mem_write(t, stub_addr, saved_ram, stub_size);
+	target_regs_write(t, regs);
+	target_mem_cache_resume(t, cache_halted);
+	if (ret || target_check_error(t)) {
+		DEBUG_WARN("Memory stub failed (%d), going through the probe instead\n", ret);
+		return -1;
+	}
+	return 0;
+}
+
+static int cortexm_mem_fill(target *t, target_addr addr, size_t len, uint32_t pattern)
+{
+	target_addr stop;
+	return cortexm_mem_stub_run(t, cortexm_memfill_stub, sizeof(cortexm_memfill_stub), addr, len, pattern, 0, &stop);
+}
+
+static int cortexm_mem_find(target *t, target_addr *found, target_addr addr, size_t len, uint32_t pattern,
+	size_t size, bool mismatch)
+{
+	target_addr stop;
+	if (cortexm_mem_stub_run(t, cortexm_memfind_stub, sizeof(cortexm_memfind_stub), addr, len, pattern,
+			size | (mismatch ? 0x100U : 0U), &stop))
+		return -1;
+	if (stop == addr + len)
+		return 1;
+	*found = stop;
+	return 0;
+}
+
 /* The following routines implement hardware breakpoints and watchpoints.
  * The Flash Patch and Breakpoint (FPB) and Data Watch and Trace (DWT)
  * systems are used. */
@@ -1020,6 +2089,14 @@ static uint32_t dwt_func(target *t, enum target_breakwatch type)
 	}
 }
 
+/* A core that runs, as in GDB's non-stop mode, won't be resumed to pick the change up */
+static int cortexm_breakwatch_changed(target *t)
+{
+	if (!t->mem_cache_halted)
+		cortexm_breakwatch_flush(t);
+	return 0;
+}
+
 static int cortexm_breakwatch_set(target *t, struct breakwatch *bw)
 {
 	struct cortexm_priv *priv = t->priv;
@@ -1042,9 +2119,9 @@ static int cortexm_breakwatch_set(target *t, struct breakwatch *bw)
 			return -1;
 
 		priv->hw_breakpoint[i] = true;
-		target_mem_write32(t, CORTEXM_FPB_COMP(i), val);
+		priv->fpb_comp[i] = val;
 		bw->reserved[0] = i;
-		return 0;
+		return cortexm_breakwatch_changed(t);
 
 	case TARGET_WATCH_WRITE:
 	case TARGET_WATCH_READ:
@@ -1057,13 +2134,14 @@ static int cortexm_breakwatch_set(target *t, struct breakwatch *bw)
 			return -1;
 
 		priv->hw_watchpoint[i] = true;
-
-		target_mem_write32(t, CORTEXM_DWT_COMP(i), val);
-		target_mem_write32(t, CORTEXM_DWT_MASK(i), dwt_mask(bw->size));
-		target_mem_write32(t, CORTEXM_DWT_FUNC(i), dwt_func(t, bw->type));
+		priv->dwt_comp[i] = (struct cortexm_dwt_comp){
+			.comp = val,
+			.mask = dwt_mask(bw->size),
+			.func = dwt_func(t, bw->type),
+		};
 
 		bw->reserved[0] = i;
-		return 0;
+		return cortexm_breakwatch_changed(t);
 	default:
 		return 1;
 	}
@@ -1076,14 +2154,14 @@ static int cortexm_breakwatch_clear(target *t, struct breakwatch *bw)
 	switch (bw->type) {
 	case TARGET_BREAK_HARD:
 		priv->hw_breakpoint[i] = false;
-		target_mem_write32(t, CORTEXM_FPB_COMP(i), 0);
-		return 0;
+		priv->fpb_comp[i] = 0;
+		return cortexm_breakwatch_changed(t);
 	case TARGET_WATCH_WRITE:
 	case TARGET_WATCH_READ:
 	case TARGET_WATCH_ACCESS:
 		priv->hw_watchpoint[i] = false;
-		target_mem_write32(t, CORTEXM_DWT_FUNC(i), 0);
-		return 0;
+		priv->dwt_comp[i].func = 0;
+		return cortexm_breakwatch_changed(t);
 	default:
 		return 1;
 	}
@@ -1095,8 +2173,8 @@ static target_addr cortexm_check_watch(target *t)
 	unsigned i;
 
 	for (i = 0; i < priv->hw_watchpoint_max; i++)
-		/* if SET and MATCHED then break */
-		if (priv->hw_watchpoint[i] && (target_mem_read32(t, CORTEXM_DWT_FUNC(i)) & CORTEXM_DWT_FUNC_MATCHED))
+		/* if SET and MATCHED then break, data trace matches never halt */
+		if (priv->hw_watchpoint[i] && !priv->trace_var[i] && (target_mem_read32(t, CORTEXM_DWT_FUNC(i)) & CORTEXM_DWT_FUNC_MATCHED))
 			break;
 
 	if (i == priv->hw_watchpoint_max)
@@ -1179,13 +2257,136 @@ static void probe_mem_write(
 }
 #endif
 
+#if PC_HOSTED == 1
+#ifdef SEMIHOSTING_HAS_MMAP
+static bool cortexm_semihosting_mmap(target *t, int argc, const char **argv)
+{
+	if (argc == 2 && !parse_enable_or_disable(argv[1], &semihosting_mmap))
+		return false;
+	tc_printf(t, "Semihosting file mapping: %s\n", semihosting_mmap ? "enabled" : "disabled");
+	return true;
+}
+
+/*
+ * Maps len bytes of the regular file fd from its file position, extending
+ * the file first if needed to write them. NULL if fd can't be mapped, the
+ * caller then copies through a buffer instead.
+ */
+static uint8_t *hostio_map(const int fd, uint32_t *const len, const bool write, off_t *const pos, size_t *const map_len)
+{
+	struct stat st;
+	if (!semihosting_mmap || fstat(fd, &st) || !S_ISREG(st.st_mode))
+		return NULL;
+	*pos = (fcntl(fd, F_GETFL) & O_APPEND) && write ? st.st_size : lseek(fd, 0, SEEK_CUR);
+	if (*pos < 0)
+		return NULL;
+	if (!write)
+		*len = MIN(*len, *pos < st.st_size ? st.st_size - *pos : 0);
+	if (!*len)
+		return NULL;
+	if (write && *pos + *len > st.st_size && ftruncate(fd, *pos + *len))
+		return NULL;
+	const off_t map_pos = *pos & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+	*map_len = *len + (*pos - map_pos);
+	uint8_t *const map =
+		mmap(NULL, *map_len, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, map_pos);
+	if (map == MAP_FAILED) {
+		/* Files opened write only can't be mapped, leave them as they were */
+		if (write && *pos + *len > st.st_size && ftruncate(fd, st.st_size))
+			DEBUG_WARN("semihosting: could not restore file size\n");
+		return NULL;
+	}
+	madvise(map, *map_len, MADV_SEQUENTIAL);
+	return map + (*pos - map_pos);
+}
+#endif
+
+/* SYS_READ, returns the number of bytes not read or -1 */
+static int32_t hostio_read(target *const t, const int fd, const target_addr buf_taddr, const uint32_t buf_len)
+{
+#ifdef SEMIHOSTING_HAS_MMAP
+	uint32_t map_len = buf_len;
+	off_t pos;
+	size_t mapped;
+	const uint8_t *const map = hostio_map(fd, &map_len, false, &pos, &mapped);
+	if (map) {
+		target_mem_write(t, buf_taddr, map, map_len);
+		munmap((void *)(map - (mapped - map_len)), mapped);
+		if (target_check_error(t))
+			return -1;
+		lseek(fd, pos + map_len, SEEK_SET);
+		return buf_len - map_len;
+	}
+#endif
+	uint8_t *const buf = malloc(MIN(buf_len, SEMIHOSTING_CHUNK));
+	if (!buf)
+		return -1;
+	int32_t result = -1;
+	for (uint32_t done = 0; done < buf_len;) {
+		const size_t len = MIN(buf_len - done, SEMIHOSTING_CHUNK);
+		const ssize_t rc = read(fd, buf, len);
+		if (rc < 0)
+			break;
+		if (rc)
+			target_mem_write(t, buf_taddr + done, buf, rc);
+		if (target_check_error(t))
+			break;
+		done += rc;
+		result = buf_len - done;
+		/* End of file, or all a terminal or pipe has for now */
+		if ((size_t)rc < len)
+			break;
+	}
+	free(buf);
+	return result;
+}
+
+/* SYS_WRITE, returns the number of bytes not written or -1 */
+static int32_t hostio_write(target *const t, const int fd, const target_addr buf_taddr, const uint32_t buf_len)
+{
+#ifdef SEMIHOSTING_HAS_MMAP
+	uint32_t map_len = buf_len;
+	off_t pos;
+	size_t mapped;
+	uint8_t *const map = hostio_map(fd, &map_len, true, &pos, &mapped);
+	if (map) {
+		target_mem_read(t, map, buf_taddr, map_len);
+		munmap(map - (mapped - map_len), mapped);
+		if (target_check_error(t))
+			return -1;
+		lseek(fd, pos + map_len, SEEK_SET);
+		return 0;
+	}
+#endif
+	uint8_t *const buf = malloc(MIN(buf_len, SEMIHOSTING_CHUNK));
+	if (!buf)
+		return -1;
+	int32_t result = -1;
+	for (uint32_t done = 0; done < buf_len;) {
+		const size_t len = MIN(buf_len - done, SEMIHOSTING_CHUNK);
+		target_mem_read(t, buf, buf_taddr + done, len);
+		if (target_check_error(t))
+			break;
+		const ssize_t rc = write(fd, buf, len);
+		if (rc < 0)
+			break;
+		done += rc;
+		result = buf_len - done;
+		if ((size_t)rc < len)
+			break;
+	}
+	free(buf);
+	return result;
+}
+#endif
+
 static int cortexm_hostio_request(target *t)
 {
-	uint32_t arm_regs[t->regs_size];
 	uint32_t params[4];
 
 	t->tc->interrupted = false;
-	target_regs_read(t, arm_regs);
+	/* Only r0 and r1 take part in the call, the result goes back in r0 alone */
+	const uint32_t arm_regs[2] = {cortexm_reg_get(t, 0), cortexm_reg_get(t, 1)};
 	uint32_t syscall = arm_regs[0];
 	if (syscall != SEMIHOSTING_SYS_EXIT)
 		target_mem_read(t, params, arm_regs[1], sizeof(params));
@@ -1242,6 +2443,11 @@ static int cortexm_hostio_request(target *t)
 		fnam[fnam_len] = '\0';
 		ret = open(fnam, pflag, 0644);
 		free(fnam);
+#ifdef POSIX_FADV_SEQUENTIAL
+		/* Read ahead further, files are almost always read front to back */
+		if (ret != -1)
+			posix_fadvise(ret, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 		if (ret != -1)
 			ret++;
 		break;
@@ -1257,21 +2463,7 @@ static int cortexm_hostio_request(target *t)
 		uint32_t buf_len = params[2];
 		if (buf_taddr == TARGET_NULL)
 			break;
-		if (buf_len == 0) {
-			ret = 0;
-			break;
-		}
-		uint8_t *buf = malloc(buf_len);
-		if (buf == NULL)
-			break;
-		ssize_t rc = read(params[0] - 1, buf, buf_len);
-		if (rc >= 0)
-			rc = buf_len - rc;
-		target_mem_write(t, buf_taddr, buf, buf_len);
-		free(buf);
-		if (target_check_error(t))
-			break;
-		ret = rc;
+		ret = buf_len ? hostio_read(t, params[0] - 1, buf_taddr, buf_len) : 0;
 		break;
 	}
 
@@ -1281,22 +2473,7 @@ static int cortexm_hostio_request(target *t)
 		uint32_t buf_len = params[2];
 		if (buf_taddr == TARGET_NULL)
 			break;
-		if (buf_len == 0) {
-			ret = 0;
-			break;
-		}
-		uint8_t *buf = malloc(buf_len);
-		if (buf == NULL)
-			break;
-		target_mem_read(t, buf, buf_taddr, buf_len);
-		if (target_check_error(t)) {
-			free(buf);
-			break;
-		}
-		ret = write(params[0] - 1, buf, buf_len);
-		free(buf);
-		if (ret >= 0)
-			ret = buf_len - ret;
+		ret = buf_len ? hostio_write(t, params[0] - 1, buf_taddr, buf_len) : 0;
 		break;
 	}
 
@@ -1316,14 +2493,20 @@ static int cortexm_hostio_request(target *t)
 
 	case SEMIHOSTING_SYS_WRITE0: { /* write0 */
 		ret = -1;
-		uint8_t ch;
 		target_addr str = arm_regs[1];
 		if (str == TARGET_NULL)
 			break;
-		while ((ch = target_mem_read8(t, str++)) != '\0') {
-			if (target_check_error(t))
+		/* a block at a time, blocks being aligned so none crosses into another region */
+		while (true) {
+			char block[32];
+			const size_t count = sizeof(block) - (str & (sizeof(block) - 1U));
+			if (target_mem_read(t, block, str, count))
+				break;
+			const char *const nul = memchr(block, '\0', count);
+			fwrite(block, 1, nul ? (size_t)(nul - block) : count, stderr);
+			if (nul)
 				break;
-			fputc(ch, stderr);
+			str += count;
 		}
 		ret = 0;
 		break;
@@ -1524,10 +2707,18 @@ static int cortexm_hostio_request(target *t)
 		ret = -1;
 		target_addr str_begin = arm_regs[1];
 		target_addr str_end = str_begin;
-		while (target_mem_read8(t, str_end) != 0) {
-			if (target_check_error(t))
+		/* look for the terminator a block at a time, blocks being aligned so none crosses into another region */
+		while (true) {
+			char block[32];
+			const size_t count = sizeof(block) - (str_end & (sizeof(block) - 1U));
+			if (target_mem_read(t, block, str_end, count))
 				break;
-			str_end++;
+			const char *const nul = memchr(block, '\0', count);
+			if (nul) {
+				str_end += nul - block;
+				break;
+			}
+			str_end += count;
 		}
 		int len = str_end - str_begin;
 		if (len != 0) {
@@ -1716,8 +2907,7 @@ static int cortexm_hostio_request(target *t)
 		break;
 	}
 
-	arm_regs[0] = ret;
-	target_regs_write(t, arm_regs);
+	cortexm_reg_set(t, 0, ret);
 
 	return t->tc->interrupted;
 }
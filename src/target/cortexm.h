@@ -30,10 +30,12 @@ extern unsigned cortexm_wait_timeout;
 
 #define CORTEXM_CPUID (CORTEXM_SCS_BASE + 0xd00U)
 #define CORTEXM_AIRCR (CORTEXM_SCS_BASE + 0xd0cU)
+#define CORTEXM_CCR   (CORTEXM_SCS_BASE + 0xd14U)
 #define CORTEXM_CFSR  (CORTEXM_SCS_BASE + 0xd28U)
 #define CORTEXM_HFSR  (CORTEXM_SCS_BASE + 0xd2cU)
 #define CORTEXM_DFSR  (CORTEXM_SCS_BASE + 0xd30U)
 #define CORTEXM_CPACR (CORTEXM_SCS_BASE + 0xd88U)
+#define CORTEXM_CPACR_CP10_MASK (3U << 20U)
 #define CORTEXM_DHCSR (CORTEXM_SCS_BASE + 0xdf0U)
 #define CORTEXM_DCRSR (CORTEXM_SCS_BASE + 0xdf4U)
 #define CORTEXM_DCRDR (CORTEXM_SCS_BASE + 0xdf8U)
@@ -49,6 +51,7 @@ extern unsigned cortexm_wait_timeout;
 #define CORTEXM_ICIALLU  (CORTEXM_SCS_BASE + 0xf50U)
 #define CORTEXM_DCCMVAC  (CORTEXM_SCS_BASE + 0xf68U)
 #define CORTEXM_DCCIMVAC (CORTEXM_SCS_BASE + 0xf70U)
+#define CORTEXM_DCCISW   (CORTEXM_SCS_BASE + 0xf74U)
 
 #define CORTEXM_FPB_BASE (CORTEXM_PPB_BASE + 0x2000U)
 
@@ -60,10 +63,23 @@ extern unsigned cortexm_wait_timeout;
 #define CORTEXM_DWT_BASE (CORTEXM_PPB_BASE + 0x1000U)
 
 #define CORTEXM_DWT_CTRL    (CORTEXM_DWT_BASE + 0x000U)
+#define CORTEXM_DWT_PCSR    (CORTEXM_DWT_BASE + 0x01cU)
 #define CORTEXM_DWT_COMP(i) (CORTEXM_DWT_BASE + 0x020U + (0x10U * (i)))
 #define CORTEXM_DWT_MASK(i) (CORTEXM_DWT_BASE + 0x024U + (0x10U * (i)))
 #define CORTEXM_DWT_FUNC(i) (CORTEXM_DWT_BASE + 0x028U + (0x10U * (i)))
 
+#define CORTEXM_ITM_BASE CORTEXM_PPB_BASE
+
+#define CORTEXM_ITM_TER (CORTEXM_ITM_BASE + 0xe00U)
+#define CORTEXM_ITM_TCR (CORTEXM_ITM_BASE + 0xe80U)
+#define CORTEXM_ITM_LAR (CORTEXM_ITM_BASE + 0xfb0U)
+
+#define CORTEXM_TPIU_BASE (CORTEXM_PPB_BASE + 0x40000U)
+
+#define CORTEXM_TPIU_ACPR (CORTEXM_TPIU_BASE + 0x010U)
+#define CORTEXM_TPIU_SPPR (CORTEXM_TPIU_BASE + 0x0f0U)
+#define CORTEXM_TPIU_FFCR (CORTEXM_TPIU_BASE + 0x304U)
+
 /* Application Interrupt and Reset Control Register (AIRCR) */
 #define CORTEXM_AIRCR_VECTKEY (0x05faU << 16U)
 /* Bits 31:16 - Read as VECTKETSTAT, 0xFA05 */
@@ -75,6 +91,9 @@ extern unsigned cortexm_wait_timeout;
 #define CORTEXM_AIRCR_VECTCLRACTIVE (1U << 1U)
 #define CORTEXM_AIRCR_VECTRESET     (1U << 0U)
 
+/* Configuration and Control Register (CCR) */
+#define CORTEXM_CCR_DC (1U << 16U)
+
 /* HardFault Status Register (HFSR) */
 #define CORTEXM_HFSR_DEBUGEVT (1U << 31U)
 #define CORTEXM_HFSR_FORCED   (1U << 30U)
@@ -145,6 +164,17 @@ extern unsigned cortexm_wait_timeout;
 #define CORTEXM_FPB_CTRL_KEY    (1U << 1U)
 #define CORTEXM_FPB_CTRL_ENABLE (1U << 0U)
 
+/* Data Watchpoint and Trace Control Register (DWT_CTRL) */
+#define CORTEXM_DWT_CTRL_NOTRCPKT         (1U << 27U)
+#define CORTEXM_DWT_CTRL_NOCYCCNT         (1U << 25U)
+#define CORTEXM_DWT_CTRL_EVTENA_MASK      (0x3fU << 17U)
+#define CORTEXM_DWT_CTRL_EXCTRCENA        (1U << 16U)
+#define CORTEXM_DWT_CTRL_PCSAMPLENA       (1U << 12U)
+#define CORTEXM_DWT_CTRL_SYNCTAP_24       (1U << 10U)
+#define CORTEXM_DWT_CTRL_CYCTAP           (1U << 9U) /* Tap CYCCNT bit 10 rather than bit 6 */
+#define CORTEXM_DWT_CTRL_POSTPRESET_SHIFT 1U
+#define CORTEXM_DWT_CTRL_CYCCNTENA        (1U << 0U)
+
 /* Data Watchpoint and Trace Mask Register (DWT_MASKx)
 *  The value here is the number of address bits we mask out */
 #define CORTEXM_DWT_MASK_BYTE     (0U)
@@ -153,11 +183,28 @@ extern unsigned cortexm_wait_timeout;
 #define CORTEXM_DWT_MASK_DWORD    (3U)
 
 /* Data Watchpoint and Trace Function Register (DWT_FUNCTIONx) */
-#define CORTEXM_DWT_FUNC_MATCHED        (1U << 24U)
-#define CORTEXM_DWT_FUNC_DATAVSIZE_WORD (2U << 10U) /* v7m only */
-#define CORTEXM_DWT_FUNC_FUNC_READ      (5U << 0U)
-#define CORTEXM_DWT_FUNC_FUNC_WRITE     (6U << 0U)
-#define CORTEXM_DWT_FUNC_FUNC_ACCESS    (7U << 0U)
+#define CORTEXM_DWT_FUNC_MATCHED          (1U << 24U)
+#define CORTEXM_DWT_FUNC_DATAVSIZE_SHIFT  10U
+#define CORTEXM_DWT_FUNC_DATAVSIZE_WORD   (2U << 10U) /* v7m only */
+#define CORTEXM_DWT_FUNC_FUNC_READ        (5U << 0U)
+#define CORTEXM_DWT_FUNC_FUNC_WRITE       (6U << 0U)
+#define CORTEXM_DWT_FUNC_FUNC_ACCESS      (7U << 0U)
+#define CORTEXM_DWT_FUNC_FUNC_TRACE_WRITE (0xdU << 0U) /* v7m only, data value of writes out over ITM */
+
+/* Instrumentation Trace Macrocell Trace Control Register (ITM_TCR) */
+#define CORTEXM_ITM_TCR_TRACEBUSID_SHIFT 16U
+#define CORTEXM_ITM_TCR_TXENA            (1U << 3U) /* Forward the DWT's hardware packets */
+#define CORTEXM_ITM_TCR_SYNCENA          (1U << 2U)
+#define CORTEXM_ITM_TCR_ITMENA           (1U << 0U)
+
+#define CORTEXM_ITM_LAR_KEY 0xc5acce55U
+
+/* Trace Port Interface Unit Selected Pin Protocol Register (TPIU_SPPR) */
+#define CORTEXM_TPIU_SPPR_MANCHESTER 1U
+#define CORTEXM_TPIU_SPPR_NRZ        2U
+
+/* Trace Port Interface Unit Formatter and Flush Control Register (TPIU_FFCR) */
+#define CORTEXM_TPIU_FFCR_TRIGIN (1U << 8U) /* With the formatter off, SWO carries plain ITM */
 
 #define REG_SP      13U
 #define REG_LR      14U
@@ -166,6 +213,7 @@ extern unsigned cortexm_wait_timeout;
 #define REG_MSP     17U
 #define REG_PSP     18U
 #define REG_SPECIAL 19U
+#define REG_FPSCR   20U /* The FPU's registers follow, s0-s31 */
 
 #define ARM_THUMB_BREAKPOINT 0xbe00U
 #define CORTEXM_XPSR_THUMB   (1U << 24U)
@@ -186,10 +234,22 @@ enum cortexm_types {
 #define CPUID_PATCH_MASK    0xfU
 
 ADIv5_AP_t *cortexm_ap(target *t);
+bool target_is_cortexm(const target *t);
+/* Longest a single probe side status poll runs before returning to the caller */
+#define CORTEXM_MEM_WAIT_MS 100U
+uint32_t cortexm_mem_wait32(target *t, target_addr addr, uint32_t busy_bit);
+uint32_t cortexm_mem_wait_ready32(target *t, target_addr addr, uint32_t ready_bit);
 
 bool cortexm_attach(target *t);
+bool cortexm_trace_profile_setup(target *t, bool manchester, uint32_t traceclk_hz, uint32_t baudrate);
+int cortexm_trace_var(
+	target *t, target_addr addr, size_t size, bool manchester, uint32_t traceclk_hz, uint32_t baudrate);
+void cortexm_trace_var_clear(target *t);
+void cortexm_trace_var_print(target *t, void (*print)(const char *fmt, ...));
 void cortexm_detach(target *t);
 int cortexm_run_stub(target *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3);
+int cortexm_start_stub(target *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3);
+int cortexm_wait_stub(target *t, uint32_t timeout_ms);
 int cortexm_mem_write_sized(target *t, target_addr dest, const void *src, size_t len, enum align align);
 
 #endif
@@ -0,0 +1,166 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements synchronised halting and restarting of the cores of
+ * a multi-core part through their CoreSight Cross Trigger Interfaces, ARM
+ * doc DDI0314H section 3.5.
+ *
+ * All CTIs talk to each other over the Cross Trigger Matrix. With
+ * "monitor cti_sync enable" each core's halted trigger drives channel 0,
+ * which drives every core's debug request, so a breakpoint or a halt request
+ * on one core stops them all within a few cycles. Resuming the attached core
+ * pulses channel 1, which drives every core's restart, so the others start
+ * again along with it in one write rather than one per core. GDB's all-stop
+ * mode then holds for all the cores, not only the one GDB is attached to.
+ *
+ * The trigger wiring used is the one the Cortex-M cores with a CTI and the
+ * ARMv7-A cores other than the Cortex-A9 share: input 0 is the core halting,
+ * output 0 its debug request and output 1 its restart.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "command.h"
+#include "gdb_packet.h"
+#include "cti.h"
+
+#define CTI_CONTROL  0x000U
+#define CTI_INTACK   0x010U
+#define CTI_APPPULSE 0x01cU
+#define CTI_INEN(n)  (0x020U + ((n) << 2U))
+#define CTI_OUTEN(n) (0x0a0U + ((n) << 2U))
+#define CTI_GATE     0x140U
+#define CTI_LAR      0xfb0U
+
+#define CTI_CONTROL_GLBEN (1U << 0U)
+#define CTI_LAR_KEY       0xc5acce55U
+
+#define CTI_TRIGIN_HALTED   0U
+#define CTI_TRIGOUT_DBGREQ  0U
+#define CTI_TRIGOUT_RESTART 1U
+
+#define CTI_CHANNEL_HALT    (1U << 0U)
+#define CTI_CHANNEL_RESTART (1U << 1U)
+
+/* CTIs found on the AP being walked, waiting for the cores to be found */
+#define CTI_PENDING_MAX 4U
+
+static uint32_t cti_pending[CTI_PENDING_MAX];
+static size_t cti_pending_count;
+static bool cti_synchronised;
+
+static bool cti_cmd_sync(target *t, int argc, const char **argv);
+
+static const struct command_s cti_cmd_list[] = {
+	{"cti_sync", cti_cmd_sync, "Halt and restart all cores together: (enable|disable)"},
+	{NULL, NULL, NULL},
+};
+
+void cti_probe(const uint32_t base)
+{
+	if (cti_pending_count < CTI_PENDING_MAX)
+		cti_pending[cti_pending_count++] = base;
+}
+
+void cti_assign(ADIv5_AP_t *const ap, target *first)
+{
+	/* A new scan, the CTIs are only set up once asked to */
+	cti_synchronised = false;
+	for (size_t i = 0; first && i < cti_pending_count; first = first->next, ++i) {
+		cti_s *const cti = calloc(1, sizeof(*cti));
+		if (!cti) { /* calloc failed: heap exhaustion */
+			DEBUG_WARN("calloc: failed in %s\n", __func__);
+			break;
+		}
+		cti->ap = ap;
+		cti->base = cti_pending[i];
+		first->cti = cti;
+		target_add_commands(first, cti_cmd_list, "Cross trigger");
+		DEBUG_INFO("CTI at 0x%08" PRIx32 " for %s\n", cti->base, first->driver);
+	}
+	cti_pending_count = 0;
+}
+
+static void cti_write(const cti_s *const cti, const uint32_t reg, const uint32_t value)
+{
+	adiv5_mem_write(cti->ap, cti->base + reg, &value, sizeof(value));
+}
+
+static uint32_t cti_read(const cti_s *const cti, const uint32_t reg)
+{
+	uint32_t value = 0;
+	adiv5_mem_read(cti->ap, &value, cti->base + reg, sizeof(value));
+	return value;
+}
+
+static void cti_setup(const cti_s *const cti, const bool sync)
+{
+	cti_write(cti, CTI_LAR, CTI_LAR_KEY);
+	cti_write(cti, CTI_CONTROL, CTI_CONTROL_GLBEN);
+	cti_write(cti, CTI_INEN(CTI_TRIGIN_HALTED), sync ? CTI_CHANNEL_HALT : 0U);
+	cti_write(cti, CTI_OUTEN(CTI_TRIGOUT_DBGREQ), sync ? CTI_CHANNEL_HALT : 0U);
+	cti_write(cti, CTI_OUTEN(CTI_TRIGOUT_RESTART), sync ? CTI_CHANNEL_RESTART : 0U);
+	if (sync)
+		cti_write(cti, CTI_GATE, cti_read(cti, CTI_GATE) | CTI_CHANNEL_HALT | CTI_CHANNEL_RESTART);
+	cti_write(cti, CTI_INTACK, (1U << CTI_TRIGOUT_DBGREQ) | (1U << CTI_TRIGOUT_RESTART));
+}
+
+static bool cti_cmd_sync(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1) {
+		bool enable = false;
+		if (!parse_enable_or_disable(argv[1], &enable))
+			return false;
+		size_t cores = 0;
+		for (target *core = target_list; core; core = core->next) {
+			if (!core->cti)
+				continue;
+			cti_setup(core->cti, enable);
+			++cores;
+		}
+		cti_synchronised = enable && cores;
+	}
+	gdb_outf("Cores halt and restart together: %s\n", cti_synchronised ? "enabled" : "disabled");
+	return true;
+}
+
+/* A halt that went round the matrix leaves every core's debug request asserted until acknowledged */
+void cti_resume_prepare(target *const t)
+{
+	if (!cti_synchronised || !t->cti)
+		return;
+	for (target *core = target_list; core; core = core->next) {
+		if (core->cti)
+			cti_write(core->cti, CTI_INTACK, (1U << CTI_TRIGOUT_DBGREQ) | (1U << CTI_TRIGOUT_RESTART));
+	}
+}
+
+/* Stepping leaves the other cores halted, otherwise they restart along with t */
+void cti_resume_finish(target *const t, const bool step)
+{
+	if (!cti_synchronised || !t->cti || step)
+		return;
+	cti_write(t->cti, CTI_APPPULSE, CTI_CHANNEL_RESTART);
+	/* The restart output stays asserted until acknowledged, which would restart the next halt straight away */
+	for (target *core = target_list; core; core = core->next) {
+		if (core->cti)
+			cti_write(core->cti, CTI_INTACK, 1U << CTI_TRIGOUT_RESTART);
+	}
+}
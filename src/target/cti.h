@@ -0,0 +1,39 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CTI_H
+#define __CTI_H
+
+#include "target.h"
+#include "adiv5.h"
+
+/* A core's CoreSight Cross Trigger Interface, reached through the AP the core holds a reference on */
+typedef struct cti {
+	ADIv5_AP_t *ap;
+	uint32_t base;
+} cti_s;
+
+/* Called from the ROM table walk for each CTI found on the AP being walked */
+void cti_probe(uint32_t base);
+/* Hands the CTIs found on the AP to its cores in order, first being the first core found on it */
+void cti_assign(ADIv5_AP_t *ap, target *first);
+
+/* Around target_halt_resume(), restarting the other cores along with t when halts are synchronised */
+void cti_resume_prepare(target *t);
+void cti_resume_finish(target *t, bool step);
+
+#endif /* __CTI_H */
@@ -41,9 +41,9 @@
 #include "target_internal.h"
 #include "cortexm.h"
 #include "adiv5.h"
+#include "flashloader.h"
 
 #define SRAM_BASE        0x20000000
-#define STUB_BUFFER_BASE ALIGN(SRAM_BASE + sizeof(efm32_flash_write_stub), 4)
 
 static int efm32_flash_erase(struct target_flash *t, target_addr addr, size_t len);
 static int efm32_flash_write(struct target_flash *f, target_addr dest, const void *src, size_t len);
@@ -93,6 +93,7 @@ const struct command_s efm32_cmd_list[] = {
 #define EFM32_MSC_STATUS_LOCKED     (1 << 1)
 #define EFM32_MSC_STATUS_INVADDR    (1 << 2)
 #define EFM32_MSC_STATUS_WDATAREADY (1 << 3)
+#define EFM32_MSC_STATUS_ERROR_MASK (EFM32_MSC_STATUS_LOCKED | EFM32_MSC_STATUS_INVADDR)
 
 /* -------------------------------------------------------------------------- */
 /* Flash Infomation Area                                                      */
@@ -638,24 +639,45 @@ static int efm32_flash_erase(struct target_flash *f, target_addr addr, size_t le
 /* Write flash page by page */
 static int efm32_flash_write(struct target_flash *f, target_addr dest, const void *src, size_t len)
 {
-	(void)len;
-
 	target *t = f->t;
 
 	struct efm32_priv_s *priv_storage = (struct efm32_priv_s *)t->target_storage;
 	if (!priv_storage || !priv_storage->device)
 		return false;
 
-	/* Write flashloader */
-	target_mem_write(t, SRAM_BASE, efm32_flash_write_stub, sizeof(efm32_flash_write_stub));
-	/* Write Buffer */
-	target_mem_write(t, STUB_BUFFER_BASE, src, len);
-	/* Run flashloader */
-	int ret = cortexm_run_stub(t, SRAM_BASE, dest, STUB_BUFFER_BASE, len, priv_storage->device->msc_addr);
+	const uint32_t msc = priv_storage->device->msc_addr;
+
+	/* Unlock and set WREN bit to enable MSC write and erase functionality */
+	target_mem_write32(t, EFM32_MSC_LOCK(msc), EFM32_MSC_LOCK_LOCKKEY);
+	target_mem_write32(t, EFM32_MSC_WRITECTRL(msc), 1);
+
+	/* Stream the page through the loader, which programs while the rest arrives */
+	const struct flashloader_params loader_params = {
+		.width = 4U,
+		.sr_addr = EFM32_MSC_STATUS(msc),
+		.busy_mask = EFM32_MSC_STATUS_BUSY,
+		.error_mask = EFM32_MSC_STATUS_ERROR_MASK,
+		.stub = efm32_flash_write_stub,
+		.stub_len = sizeof(efm32_flash_write_stub),
+	};
+	int ret = flashloader_write(t, &loader_params, dest, src, len);
+	if (ret > 0) {
+		/* Otherwise a word at a time through the debug port, as AN0062 describes */
+		const uint32_t *data = src;
+		ret = 0;
+		for (size_t offset = 0; !ret && offset < len; offset += 4U) {
+			target_mem_write32(t, EFM32_MSC_ADDRB(msc), dest + offset);
+			target_mem_write32(t, EFM32_MSC_WRITECMD(msc), EFM32_MSC_WRITECMD_LADDRIM);
+			target_mem_write32(t, EFM32_MSC_WDATA(msc), data[offset / 4U]);
+			target_mem_write32(t, EFM32_MSC_WRITECMD(msc), EFM32_MSC_WRITECMD_WRITEONCE);
+			const uint32_t status = cortexm_mem_wait32(t, EFM32_MSC_STATUS(msc), EFM32_MSC_STATUS_BUSY);
+			if ((status & EFM32_MSC_STATUS_ERROR_MASK) || target_check_error(t))
+				ret = -1;
+		}
+	}
 
 #ifdef ENABLE_DEBUG
 	/* Check the MSC_IF */
-	uint32_t msc = priv_storage->device->msc_addr;
 	uint32_t msc_if = target_mem_read32(t, EFM32_MSC_IF(msc));
 	DEBUG_INFO("EFM32: Flash write done MSC_IF=%08" PRIx32 "\n", msc_if);
 #endif
@@ -0,0 +1,983 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements instruction trace with a core's Embedded Trace
+ * Macrocell into an on-chip trace buffer, a CoreSight ETB or a TMC set up
+ * as ETB or ETF. The ETM traces at full core speed over the ATB, through any
+ * funnels on the way, into the buffer's RAM, so none of SWO's bandwidth
+ * limits apply. ETMv3 (Cortex-M3/M4, Cortex-A5/A7/A8) and ETMv4 (Cortex-M7,
+ * Cortex-M33) are supported, the PTMs of the Cortex-A9/A15 aren't.
+ *
+ * "monitor etm enable" sets the ETM up to trace every branch with its
+ * destination address, only within the ranges given with "monitor etm
+ * filter" if any, and starts the buffer capturing in circular mode. Once
+ * the core halts the buffer is stopped and read in one bulk read, kept until
+ * the core runs again, and capture restarts then. "monitor etm dump" takes
+ * the frames the formatter wrote apart, keeps the bytes of this core's trace
+ * ID and decodes them as they come into the history of addresses executed
+ * from, one per branch taken.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "command.h"
+#include "gdb_packet.h"
+#include "etm.h"
+
+#define CORESIGHT_LAR     0xfb0U
+#define CORESIGHT_LAR_KEY 0xc5acce55U
+
+/* ETMv3 */
+#define ETM3_CR       0x000U
+#define ETM3_CCR      0x004U
+#define ETM3_TRIGGER  0x008U
+#define ETM3_SR       0x010U
+#define ETM3_TSSCR    0x018U
+#define ETM3_TEEVR    0x020U
+#define ETM3_TECR1    0x024U
+#define ETM3_ACVR(n)  (0x040U + ((n) << 2U))
+#define ETM3_ACTR(n)  (0x080U + ((n) << 2U))
+#define ETM3_SYNCFR   0x1e0U
+#define ETM3_IDR      0x1e4U
+#define ETM3_TRACEIDR 0x200U
+#define ETM3_OSLAR    0x300U
+
+#define ETM3_CR_PORT_SIZE_MASK ((7U << 4U) | (1U << 21U))
+#define ETM3_CR_BRANCH_OUTPUT  (1U << 8U)
+#define ETM3_CR_PROGRAM        (1U << 10U)
+#define ETM3_CR_ENABLE         (1U << 11U)
+#define ETM3_SR_PROGRAM        (1U << 1U)
+#define ETM3_CCR_PAIRS_MASK    0xfU
+#define ETM3_IDR_ALT_BRANCH    (1U << 20U)
+#define ETM3_TECR1_EXCLUDE     (1U << 24U)
+#define ETM3_ACTR_EXECUTE      1U
+/* Resource 0x6f is always true, function 4 negates it */
+#define ETM3_EVENT_ALWAYS 0x6fU
+#define ETM3_EVENT_NEVER  0x406fU
+#define ETM3_SYNC_BYTES   1024U
+
+/* ETMv4 */
+#define ETM4_PRGCTLR    0x004U
+#define ETM4_STATR      0x00cU
+#define ETM4_CONFIGR    0x010U
+#define ETM4_EVENTCTL0R 0x020U
+#define ETM4_EVENTCTL1R 0x024U
+#define ETM4_STALLCTLR  0x02cU
+#define ETM4_TSCTLR     0x030U
+#define ETM4_SYNCPR     0x034U
+#define ETM4_CCCTLR     0x038U
+#define ETM4_BBCTLR     0x03cU
+#define ETM4_TRACEIDR   0x040U
+#define ETM4_VICTLR     0x080U
+#define ETM4_VIIECTLR   0x084U
+#define ETM4_VISSCTLR   0x088U
+#define ETM4_IDR0       0x1e0U
+#define ETM4_IDR4       0x1f0U
+#define ETM4_OSLAR      0x300U
+#define ETM4_PDCR       0x310U
+#define ETM4_ACVR(n)    (0x400U + ((n) << 3U))
+#define ETM4_ACATR(n)   (0x480U + ((n) << 3U))
+
+#define ETM4_PRGCTLR_EN     (1U << 0U)
+#define ETM4_STATR_IDLE     (1U << 0U)
+#define ETM4_CONFIGR_BB     (1U << 3U)
+#define ETM4_IDR0_TRCBB     (1U << 5U)
+#define ETM4_IDR4_PAIRS_MASK 0xfU
+#define ETM4_PDCR_PU        (1U << 3U)
+/* ViewInst on resource 1, always true, with the start/stop logic started */
+#define ETM4_VICTLR_ALWAYS ((1U << 9U) | 1U)
+/* 2^8 bytes between syncs */
+#define ETM4_SYNCPR_256 8U
+
+/* Parts whose ETM is an ETMv4, all others are taken for ETMv3 */
+#define ETM_PART_CORTEX_M7  0x975U
+#define ETM_PART_CORTEX_M33 0xd21U
+
+/* ETB, and the TMC, which has the same layout for what is used here */
+#define ETB_RDP  0x004U /* RSZ on the TMC, the RAM size in words */
+#define ETB_STS  0x00cU
+#define ETB_RRD  0x010U
+#define ETB_RRP  0x014U
+#define ETB_RWP  0x018U
+#define ETB_TRG  0x01cU
+#define ETB_CTL  0x020U
+#define TMC_MODE 0x028U
+#define ETB_FFSR 0x300U
+#define ETB_FFCR 0x304U
+#define TMC_DEVID 0xfc8U
+
+#define ETB_STS_FULL           (1U << 0U)
+#define TMC_STS_READY          (1U << 2U)
+#define ETB_CTL_CAPTURE        (1U << 0U)
+#define ETB_FFSR_STOPPED       (1U << 1U)
+#define ETB_FFCR_FORMAT        (1U << 0U)
+#define ETB_FFCR_FLUSH         (1U << 6U)
+#define ETB_FFCR_STOP_ON_FLUSH (1U << 12U)
+#define TMC_MODE_CIRCULAR      0U
+#define TMC_DEVID_TYPE(devid)  (((devid) >> 6U) & 3U)
+#define TMC_DEVID_TYPE_ETR     1U
+/* What the TMC's RRD reads once the buffer has been read out */
+#define TMC_EMPTY 0xffffffffU
+
+#define ETM_SINK_PART_TMC 0x961U
+
+#define FUNNEL_CTRL       0x000U
+#define FUNNEL_CTRL_PORTS 0xffU
+
+#define ETM_TIMEOUT_MS 100U
+#define ETM_READS_PER_SEQUENCE 32U
+/* Frames from the formatter, 15 bytes of trace and one of auxiliary bits */
+#define ETM_FRAME_SIZE 16U
+#define ETM_TRACE_ID_BASE 0x10U
+
+/* The most of the newest trace read from the buffer */
+#if PC_HOSTED == 1
+#define ETM_TRACE_MAX 65536U
+#else
+#define ETM_TRACE_MAX 2048U
+#endif
+
+/* ETMs found on the AP being walked, waiting for the cores to be found */
+#define ETM_PENDING_MAX 4U
+
+static uint32_t etm_pending[ETM_PENDING_MAX];
+static uint8_t etm_pending_version[ETM_PENDING_MAX];
+static size_t etm_pending_count;
+/* The trace buffer and funnels found on the DP being scanned, and the trace IDs handed out on it */
+static etm_sink_s etm_sink_found;
+static uint8_t etm_trace_ids;
+
+static bool etm_cmd(target *t, int argc, const char **argv);
+
+static const struct command_s etm_cmd_list[] = {
+	{"etm", etm_cmd,
+		"Instruction trace into the on-chip trace buffer: (enable|disable|filter (START END|clear)|dump (COUNT))"},
+	{NULL, NULL, NULL},
+};
+
+static void etm_ap_write(ADIv5_AP_t *const ap, const uint32_t addr, const uint32_t value)
+{
+	adiv5_mem_write(ap, addr, &value, sizeof(value));
+}
+
+static uint32_t etm_ap_read(ADIv5_AP_t *const ap, const uint32_t addr)
+{
+	uint32_t value = 0;
+	adiv5_mem_read(ap, &value, addr, sizeof(value));
+	return value;
+}
+
+/* Waits for the bits in mask to read other than busy_value */
+static bool etm_ap_wait(ADIv5_AP_t *const ap, const uint32_t addr, const uint32_t mask, const uint32_t busy_value)
+{
+	const uint32_t value = adiv5_mem_wait32(ap, addr, mask, busy_value, ETM_TIMEOUT_MS);
+	return (value & mask) != busy_value && !ap->dp->fault;
+}
+
+static void etm_write(const etm_s *const etm, const uint32_t reg, const uint32_t value)
+{
+	etm_ap_write(etm->ap, etm->base + reg, value);
+}
+
+static uint32_t etm_read(const etm_s *const etm, const uint32_t reg)
+{
+	return etm_ap_read(etm->ap, etm->base + reg);
+}
+
+static void etm_sink_write(const etm_sink_s *const sink, const uint32_t reg, const uint32_t value)
+{
+	etm_ap_write(sink->ap, sink->base + reg, value);
+}
+
+static uint32_t etm_sink_read(const etm_sink_s *const sink, const uint32_t reg)
+{
+	return etm_ap_read(sink->ap, sink->base + reg);
+}
+
+void etm_probe(const uint32_t base, const uint16_t part_number)
+{
+	if (etm_pending_count == ETM_PENDING_MAX)
+		return;
+	etm_pending[etm_pending_count] = base;
+	etm_pending_version[etm_pending_count++] =
+		part_number == ETM_PART_CORTEX_M7 || part_number == ETM_PART_CORTEX_M33 ? 4U : 3U;
+}
+
+void etm_sink_probe(ADIv5_AP_t *const ap, const uint32_t base, const uint16_t part_number)
+{
+	/* The first buffer found is used */
+	if (etm_sink_found.ap)
+		return;
+	const etm_sink_kind_e kind = part_number == ETM_SINK_PART_TMC ? ETM_SINK_TMC : ETM_SINK_ETB;
+	/* An ETR writes to system RAM, which would need a buffer given to it there */
+	if (kind == ETM_SINK_TMC && TMC_DEVID_TYPE(etm_ap_read(ap, base + TMC_DEVID)) == TMC_DEVID_TYPE_ETR) {
+		DEBUG_INFO("TMC at 0x%08" PRIx32 " is an ETR, not used\n", base);
+		return;
+	}
+	adiv5_ap_ref(ap);
+	etm_sink_found.ap = ap;
+	etm_sink_found.base = base;
+	etm_sink_found.kind = kind;
+}
+
+void etm_funnel_probe(ADIv5_AP_t *const ap, const uint32_t base)
+{
+	if (etm_sink_found.funnel_count == ETM_FUNNELS_MAX)
+		return;
+	adiv5_ap_ref(ap);
+	etm_sink_found.funnels[etm_sink_found.funnel_count++] = (etm_funnel_s){ap, base};
+}
+
+void etm_assign(ADIv5_AP_t *const ap, target *first)
+{
+	for (size_t i = 0; first && i < etm_pending_count; first = first->next, ++i) {
+		etm_s *const etm = calloc(1, sizeof(*etm));
+		if (!etm) { /* calloc failed: heap exhaustion */
+			DEBUG_WARN("calloc: failed in %s\n", __func__);
+			break;
+		}
+		etm->ap = ap;
+		etm->base = etm_pending[i];
+		etm->version = etm_pending_version[i];
+		etm->trace_id = ETM_TRACE_ID_BASE + etm_trace_ids++;
+		first->etm = etm;
+	}
+	etm_pending_count = 0;
+}
+
+static void etm_sink_release(etm_sink_s *const sink)
+{
+	if (sink->ap)
+		adiv5_ap_unref(sink->ap);
+	for (size_t i = 0; i < sink->funnel_count; ++i)
+		adiv5_ap_unref(sink->funnels[i].ap);
+	free(sink->trace);
+}
+
+void etm_assign_sink(target *const first)
+{
+	const etm_sink_s found = etm_sink_found;
+	memset(&etm_sink_found, 0, sizeof(etm_sink_found));
+	etm_trace_ids = 0;
+	etm_sink_s *sink = NULL;
+	for (target *t = first; t; t = t->next) {
+		if (!t->etm)
+			continue;
+		if (!sink && found.ap) {
+			sink = malloc(sizeof(*sink));
+			if (!sink) /* malloc failed: heap exhaustion */
+				DEBUG_WARN("malloc: failed in %s\n", __func__);
+			else {
+				*sink = found;
+				sink->words = etm_sink_read(sink, ETB_RDP);
+			}
+		}
+		/* Without a buffer to trace into the ETM is of no use */
+		if (!sink) {
+			free(t->etm);
+			t->etm = NULL;
+			continue;
+		}
+		t->etm->sink = sink;
+		++sink->refcnt;
+		target_add_commands(t, etm_cmd_list, "Embedded Trace");
+		DEBUG_INFO("ETMv%u at 0x%08" PRIx32 " for %s, trace ID 0x%02x, into the %s at 0x%08" PRIx32 "\n",
+			t->etm->version, t->etm->base, t->driver, t->etm->trace_id, sink->kind == ETM_SINK_TMC ? "TMC" : "ETB",
+			sink->base);
+	}
+	if (!sink) {
+		etm_sink_s unused = found;
+		etm_sink_release(&unused);
+	}
+}
+
+void etm_free(target *const t)
+{
+	etm_s *const etm = t->etm;
+	if (!etm)
+		return;
+	if (etm->sink && !--etm->sink->refcnt) {
+		etm_sink_release(etm->sink);
+		free(etm->sink);
+	}
+	free(etm);
+	t->etm = NULL;
+}
+
+/* Starts capturing into the buffer, circular so it holds the newest trace when stopped */
+static bool etm_sink_start(etm_sink_s *const sink)
+{
+	for (size_t i = 0; i < sink->funnel_count; ++i) {
+		const etm_funnel_s *const funnel = &sink->funnels[i];
+		etm_ap_write(funnel->ap, funnel->base + CORESIGHT_LAR, CORESIGHT_LAR_KEY);
+		const uint32_t ctrl = etm_ap_read(funnel->ap, funnel->base + FUNNEL_CTRL);
+		etm_ap_write(funnel->ap, funnel->base + FUNNEL_CTRL, ctrl | FUNNEL_CTRL_PORTS);
+	}
+	etm_sink_write(sink, CORESIGHT_LAR, CORESIGHT_LAR_KEY);
+	etm_sink_write(sink, ETB_CTL, 0);
+	if (sink->kind == ETM_SINK_ETB) {
+		etm_sink_write(sink, ETB_RWP, 0);
+		etm_sink_write(sink, ETB_TRG, 0);
+	} else
+		etm_sink_write(sink, TMC_MODE, TMC_MODE_CIRCULAR);
+	etm_sink_write(sink, ETB_FFCR, ETB_FFCR_FORMAT);
+	etm_sink_write(sink, ETB_CTL, ETB_CTL_CAPTURE);
+	sink->running = !sink->ap->dp->fault;
+	return sink->running;
+}
+
+/* Flushes what is still on the way to the buffer and stops the capture */
+static bool etm_sink_stop(const etm_sink_s *const sink)
+{
+	etm_sink_write(sink, ETB_FFCR, ETB_FFCR_FORMAT | ETB_FFCR_STOP_ON_FLUSH | ETB_FFCR_FLUSH);
+	const bool stopped = sink->kind == ETM_SINK_ETB ?
+		etm_ap_wait(sink->ap, sink->base + ETB_FFSR, ETB_FFSR_STOPPED, 0) :
+		etm_ap_wait(sink->ap, sink->base + ETB_STS, TMC_STS_READY, 0);
+	etm_sink_write(sink, ETB_CTL, 0);
+	return stopped;
+}
+
+/* Rotates the words of buf left by first, so the one at first comes first */
+static void etm_rotate(uint32_t *const buf, const size_t count, const size_t first)
+{
+	for (size_t start = 0, moved = 0; moved < count; ++start) {
+		size_t i = start;
+		const uint32_t value = buf[i];
+		while (true) {
+			const size_t next = (i + first) % count;
+			++moved;
+			if (next == start)
+				break;
+			buf[i] = buf[next];
+			i = next;
+		}
+		buf[i] = value;
+	}
+}
+
+/*
+ * Reads the buffer out through its RAM read data register, oldest first.
+ * The ETB is read from the write pointer on if it wrapped, only as much as
+ * is kept. The TMC hands out its trace in order until it reads empty, so all
+ * of it is read, keeping the newest in a ring.
+ */
+static bool etm_sink_read_trace(etm_sink_s *const sink)
+{
+	if (sink->trace)
+		return true;
+	if (!sink->running || !sink->words || !etm_sink_stop(sink))
+		return false;
+	sink->running = false;
+	const size_t max_words = ETM_TRACE_MAX / 4U;
+	uint32_t *const trace = malloc(ETM_TRACE_MAX);
+	if (!trace) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	size_t words = sink->words;
+	if (sink->kind == ETM_SINK_ETB) {
+		const uint32_t write_pointer = etm_sink_read(sink, ETB_RWP) % sink->words;
+		const bool wrapped = etm_sink_read(sink, ETB_STS) & ETB_STS_FULL;
+		words = wrapped ? sink->words : write_pointer;
+		const uint32_t oldest = wrapped ? write_pointer : 0U;
+		const size_t skip = words > max_words ? words - max_words : 0U;
+		etm_sink_write(sink, ETB_RRP, (oldest + skip) % sink->words);
+		words -= skip;
+	}
+
+	adiv5_seq_op_t ops[ETM_READS_PER_SEQUENCE];
+	size_t count = 0;
+	bool empty = false;
+	while (count < words && !empty) {
+		const size_t batch = MIN(words - count, ETM_READS_PER_SEQUENCE);
+		for (size_t i = 0; i < batch; ++i)
+			ops[i] = (adiv5_seq_op_t){.type = ADIV5_SEQ_MEM_READ, .addr = sink->base + ETB_RRD};
+		if (!adiv5_sequence(sink->ap, ops, batch)) {
+			free(trace);
+			return false;
+		}
+		for (size_t i = 0; i < batch && !empty; ++i) {
+			empty = sink->kind == ETM_SINK_TMC && ops[i].value == TMC_EMPTY;
+			if (!empty)
+				trace[count++ % max_words] = ops[i].value;
+		}
+	}
+	if (count > max_words) {
+		etm_rotate(trace, max_words, count % max_words);
+		count = max_words;
+	}
+	/* The formatter fills the words from their low byte up */
+	uint8_t *const bytes = (uint8_t *)trace;
+	for (size_t i = 0; i < count; ++i) {
+		const uint32_t value = trace[i];
+		for (size_t j = 0; j < 4U; ++j)
+			bytes[(i * 4U) + j] = value >> (j * 8U);
+	}
+	sink->trace = bytes;
+	sink->trace_len = count * 4U;
+	return true;
+}
+
+void etm_invalidate(target *const t)
+{
+	etm_s *const etm = t->etm;
+	if (!etm || !etm->sink->trace)
+		return;
+	etm_sink_s *const sink = etm->sink;
+	free(sink->trace);
+	sink->trace = NULL;
+	sink->trace_len = 0;
+	/* Reading stopped the capture, it starts over for the run to come */
+	etm_sink_start(sink);
+}
+
+/* What the ETM has, only readable once it is powered up and unlocked */
+static void etm_identify(etm_s *const etm)
+{
+	if (etm->identified)
+		return;
+	if (etm->version == 4U) {
+		etm->pairs = etm_read(etm, ETM4_IDR4) & ETM4_IDR4_PAIRS_MASK;
+		etm->branch_broadcast = etm_read(etm, ETM4_IDR0) & ETM4_IDR0_TRCBB;
+	} else {
+		etm->pairs = etm_read(etm, ETM3_CCR) & ETM3_CCR_PAIRS_MASK;
+		etm->alt_branch = etm_read(etm, ETM3_IDR) & ETM3_IDR_ALT_BRANCH;
+		/* Every branch's address is output, not only those the program image can't tell */
+		etm->branch_broadcast = true;
+	}
+	etm->identified = !etm->ap->dp->fault;
+}
+
+/* Programs the ETM to trace, or leaves it in programming mode where it traces nothing */
+static bool etm3_program(etm_s *const etm, const bool enable)
+{
+	etm_write(etm, CORESIGHT_LAR, CORESIGHT_LAR_KEY);
+	etm_write(etm, ETM3_OSLAR, 0);
+	/* Powered up and in programming mode, only the port size is kept */
+	const uint32_t cr = etm_read(etm, ETM3_CR) & ETM3_CR_PORT_SIZE_MASK;
+	etm_write(etm, ETM3_CR, cr | ETM3_CR_PROGRAM);
+	if (!etm_ap_wait(etm->ap, etm->base + ETM3_SR, ETM3_SR_PROGRAM, 0))
+		return false;
+	etm_identify(etm);
+	if (!enable)
+		return true;
+	if (etm->filter_count > etm->pairs)
+		return false;
+
+	etm_write(etm, ETM3_TRACEIDR, etm->trace_id);
+	etm_write(etm, ETM3_TRIGGER, ETM3_EVENT_NEVER);
+	etm_write(etm, ETM3_TEEVR, ETM3_EVENT_ALWAYS);
+	etm_write(etm, ETM3_TSSCR, 0);
+	etm_write(etm, ETM3_SYNCFR, ETM3_SYNC_BYTES);
+	/* Excluding no range at all traces everything */
+	uint32_t tecr1 = etm->filter_count ? 0U : ETM3_TECR1_EXCLUDE;
+	for (size_t i = 0; i < etm->filter_count; ++i) {
+		etm_write(etm, ETM3_ACVR(i * 2U), etm->filter[i][0]);
+		etm_write(etm, ETM3_ACVR((i * 2U) + 1U), etm->filter[i][1]);
+		etm_write(etm, ETM3_ACTR(i * 2U), ETM3_ACTR_EXECUTE);
+		etm_write(etm, ETM3_ACTR((i * 2U) + 1U), ETM3_ACTR_EXECUTE);
+		tecr1 |= 1U << i;
+	}
+	etm_write(etm, ETM3_TECR1, tecr1);
+	etm_write(etm, ETM3_CR, cr | ETM3_CR_BRANCH_OUTPUT | ETM3_CR_ENABLE | ETM3_CR_PROGRAM);
+	etm_write(etm, ETM3_CR, cr | ETM3_CR_BRANCH_OUTPUT | ETM3_CR_ENABLE);
+	return etm_ap_wait(etm->ap, etm->base + ETM3_SR, ETM3_SR_PROGRAM, ETM3_SR_PROGRAM);
+}
+
+static bool etm4_program(etm_s *const etm, const bool enable)
+{
+	etm_write(etm, CORESIGHT_LAR, CORESIGHT_LAR_KEY);
+	etm_write(etm, ETM4_OSLAR, 0);
+	etm_write(etm, ETM4_PDCR, etm_read(etm, ETM4_PDCR) | ETM4_PDCR_PU);
+	etm_write(etm, ETM4_PRGCTLR, 0);
+	if (!etm_ap_wait(etm->ap, etm->base + ETM4_STATR, ETM4_STATR_IDLE, 0))
+		return false;
+	etm_identify(etm);
+	if (!enable)
+		return true;
+	if (etm->filter_count > etm->pairs)
+		return false;
+
+	/* Branch broadcast puts the destination of every branch in the trace */
+	etm_write(etm, ETM4_CONFIGR, etm->branch_broadcast ? ETM4_CONFIGR_BB : 0U);
+	if (etm->branch_broadcast)
+		etm_write(etm, ETM4_BBCTLR, 0);
+	etm_write(etm, ETM4_EVENTCTL0R, 0);
+	etm_write(etm, ETM4_EVENTCTL1R, 0);
+	etm_write(etm, ETM4_STALLCTLR, 0);
+	etm_write(etm, ETM4_TSCTLR, 0);
+	etm_write(etm, ETM4_SYNCPR, ETM4_SYNCPR_256);
+	etm_write(etm, ETM4_CCCTLR, 0);
+	etm_write(etm, ETM4_TRACEIDR, etm->trace_id);
+	etm_write(etm, ETM4_VICTLR, ETM4_VICTLR_ALWAYS);
+	etm_write(etm, ETM4_VISSCTLR, 0);
+	/* Including no range at all traces everything */
+	uint32_t viiectlr = 0;
+	for (size_t i = 0; i < etm->filter_count; ++i) {
+		for (size_t j = 0; j < 2U; ++j) {
+			etm_write(etm, ETM4_ACVR((i * 2U) + j), etm->filter[i][j]);
+			etm_write(etm, ETM4_ACVR((i * 2U) + j) + 4U, 0);
+			etm_write(etm, ETM4_ACATR((i * 2U) + j), 0);
+			etm_write(etm, ETM4_ACATR((i * 2U) + j) + 4U, 0);
+		}
+		viiectlr |= 1U << i;
+	}
+	etm_write(etm, ETM4_VIIECTLR, viiectlr);
+	etm_write(etm, ETM4_PRGCTLR, ETM4_PRGCTLR_EN);
+	return etm_ap_wait(etm->ap, etm->base + ETM4_STATR, ETM4_STATR_IDLE, ETM4_STATR_IDLE);
+}
+
+static bool etm_enable(target *const t, etm_s *const etm, const bool enable)
+{
+	bool ok = etm->version == 4U ? etm4_program(etm, enable) : etm3_program(etm, enable);
+	if (ok && enable && !etm->sink->running && !etm->sink->trace)
+		ok = etm_sink_start(etm->sink);
+	etm->enabled = ok && enable;
+	return !target_check_error(t) && ok;
+}
+
+typedef enum etm_address_kind {
+	ETM_ADDRESS_START,     /* Where the trace starts, or starts again after a gap */
+	ETM_ADDRESS_BRANCH,    /* The destination of a branch */
+	ETM_ADDRESS_EXCEPTION, /* The destination of a branch into an exception, info is its number */
+	ETM_ADDRESS_RETURN,    /* The return address of an exception taken, info is its type (ETMv4) */
+} etm_address_kind_e;
+
+typedef void (*etm_address_fn)(void *context, uint32_t address, etm_address_kind_e kind, uint32_t info);
+
+#define ETM_PACKET_MAX 16U
+
+typedef struct etm_decoder {
+	const etm_s *etm;
+	etm_address_fn address;
+	void *context;
+	bool synced;
+	size_t zeros;
+	uint8_t packet[ETM_PACKET_MAX];
+	size_t len;
+	/* The address is known in full, and the next one reported starts the trace again */
+	bool valid;
+	bool gap;
+	/* ETMv3 in ARM rather than Thumb state */
+	bool arm;
+	/* ETMv4, the next address is the return address of an exception */
+	bool exception;
+	uint32_t exception_type;
+	/* Newest first, ETMv3 only uses the first */
+	uint32_t history[3];
+} etm_decoder_s;
+
+static void etm_report(etm_decoder_s *const dec, const uint32_t address, etm_address_kind_e kind, const uint32_t info)
+{
+	dec->history[2] = dec->history[1];
+	dec->history[1] = dec->history[0];
+	dec->history[0] = address;
+	if (!dec->valid)
+		return;
+	if (dec->gap)
+		kind = ETM_ADDRESS_START;
+	dec->gap = false;
+	dec->address(dec->context, address, kind, info);
+}
+
+/* Length of a field with a continuation bit in all bytes but its last, 0 while incomplete */
+static size_t etm_field_len(const uint8_t *const field, const size_t len, const size_t max)
+{
+	for (size_t i = 0; i < len; ++i) {
+		if (!(field[i] & 0x80U) || i + 1U == max)
+			return i + 1U;
+	}
+	return 0;
+}
+
+/*
+ * A branch address packet: up to 5 address bytes with continuation bits,
+ * giving only the low address bits that changed, then any exception bytes.
+ * With the alternative encoding the last address byte but the header and a
+ * fifth byte holds one address bit less, bit 6 saying exception bytes follow.
+ */
+static int etm3_branch(etm_decoder_s *const dec)
+{
+	const uint8_t *const p = dec->packet;
+	size_t last = 0;
+	while (last < 4U && (p[last] & 0x80U)) {
+		if (last + 1U == dec->len)
+			return 0;
+		++last;
+	}
+	bool exception = false;
+	if (last == 4U || (last && dec->etm->alt_branch))
+		exception = p[last] & 0x40U;
+	if (exception) {
+		const size_t exception_len = etm_field_len(p + last + 1U, dec->len - last - 1U, 3U);
+		if (!exception_len)
+			return 0;
+	}
+
+	bool arm = dec->arm;
+	if (last == 4U && !(p[4] & 0x20U))
+		arm = !(p[4] & 0x10U);
+	const uint32_t shift = arm ? 2U : 1U;
+	uint32_t bits = (p[0] >> 1U) & 0x3fU;
+	uint32_t width = 6U;
+	for (size_t i = 1; i <= last && i < 4U; ++i) {
+		const uint32_t byte_width = i == last && dec->etm->alt_branch ? 6U : 7U;
+		bits |= (p[i] & ((1U << byte_width) - 1U)) << width;
+		width += byte_width;
+	}
+	if (last == 4U) {
+		const uint32_t byte_width = arm ? 3U : 4U;
+		bits |= (p[4] & ((1U << byte_width) - 1U)) << width;
+		width += byte_width;
+		dec->valid = true;
+	}
+	width = MIN(width + shift, 32U);
+	const uint32_t mask = width == 32U ? UINT32_MAX : (1U << width) - 1U;
+	const uint32_t address = (dec->history[0] & ~mask) | ((bits << shift) & mask);
+	dec->arm = arm;
+
+	if (exception) {
+		const uint8_t *const info = p + last + 1U;
+		const size_t info_len = dec->len - last - 1U;
+		const uint32_t number = ((info[0] >> 1U) & 0xfU) | (info_len > 1U ? (info[1] & 0x1fU) << 4U : 0U);
+		etm_report(dec, address, ETM_ADDRESS_EXCEPTION, number);
+	} else
+		etm_report(dec, address, ETM_ADDRESS_BRANCH, 0);
+	return 1;
+}
+
+/* Returns 1 once the packet is complete and was taken, 0 while it isn't complete and -1 if it isn't known */
+static int etm3_packet(etm_decoder_s *const dec)
+{
+	const uint8_t *const p = dec->packet;
+	const uint8_t header = p[0];
+	if (header & 1U)
+		return etm3_branch(dec);
+	/* P-headers, the atoms say whether instructions ran, not where */
+	if ((header & 0x81U) == 0x80U)
+		return 1;
+	switch (header) {
+	case 0x08U: { /* I-sync, an information byte and the address, no context ID is traced */
+		if (dec->len < 6U)
+			return 0;
+		const uint32_t address = p[2] | (p[3] << 8U) | (p[4] << 16U) | ((uint32_t)p[5] << 24U);
+		/* Reported only where it isn't the periodic one repeating where the trace is */
+		const bool restart = !dec->valid || ((p[1] >> 5U) & 3U);
+		dec->arm = !(address & 1U);
+		dec->gap |= restart;
+		if (restart) {
+			dec->valid = true;
+			etm_report(dec, address & ~1U, ETM_ADDRESS_START, 0);
+		} else
+			dec->history[0] = address & ~1U;
+		return 1;
+	}
+	case 0x0cU: /* Trigger */
+	case 0x66U: /* Ignore */
+	case 0x6eU: /* Context ID, with no ID traced */
+	case 0x76U: /* Exception exit */
+	case 0x7eU: /* Exception entry */
+		return 1;
+	case 0x3cU: /* VMID */
+		return dec->len == 2U;
+	case 0x42U: /* Timestamp */
+	case 0x46U:
+		return dec->len > 1U && etm_field_len(p + 1U, dec->len - 1U, 9U);
+	default:
+		return -1;
+	}
+}
+
+/* Context information, then the VMID and context ID it says follow */
+static size_t etm4_context_len(const uint8_t *const context, const size_t len)
+{
+	if (!len)
+		return 0;
+	const size_t context_len = 1U + (context[0] & 0x40U ? 1U : 0U) + (context[0] & 0x80U ? 4U : 0U);
+	return len >= context_len ? context_len : 0U;
+}
+
+/* The low 32 bits of a long address, IS0 (A32) being word and IS1 (T32) halfword aligned */
+static uint32_t etm4_long_address(const uint8_t *const bytes, const bool is1)
+{
+	const uint32_t high = (bytes[2] << 16U) | ((uint32_t)bytes[3] << 24U);
+	if (is1)
+		return ((bytes[0] & 0x7fU) << 1U) | (bytes[1] << 8U) | high;
+	return ((bytes[0] & 0x7fU) << 2U) | ((bytes[1] & 0x7fU) << 9U) | high;
+}
+
+static void etm4_address(etm_decoder_s *const dec, const uint32_t address)
+{
+	if (dec->exception) {
+		dec->exception = false;
+		etm_report(dec, address, ETM_ADDRESS_RETURN, dec->exception_type);
+	} else
+		etm_report(dec, address, ETM_ADDRESS_BRANCH, 0);
+}
+
+static int etm4_packet(etm_decoder_s *const dec)
+{
+	const uint8_t *const p = dec->packet;
+	const size_t len = dec->len;
+	const uint8_t header = p[0];
+	/* Atoms, events and those saying the trace stopped and restarted */
+	if (header >= 0xc0U || (header & 0xf0U) == 0x70U || (header & 0xf0U) == 0x10U || header == 0x07U ||
+		header == 0x80U || header == 0x88U)
+		return 1;
+	switch (header) {
+	case 0x01U: { /* Trace info, PLCTL then the fields it says are there */
+		if (len < 2U)
+			return 0;
+		const size_t plctl_len = etm_field_len(p + 1U, len - 1U, 4U);
+		if (!plctl_len)
+			return 0;
+		size_t pos = 1U + plctl_len;
+		for (size_t field = 0; field < 4U; ++field) {
+			if (!(p[1] & (1U << field)))
+				continue;
+			const size_t field_len = pos < len ? etm_field_len(p + pos, len - pos, 5U) : 0U;
+			if (!field_len)
+				return 0;
+			pos += field_len;
+		}
+		memset(dec->history, 0, sizeof(dec->history));
+		dec->valid = false;
+		dec->gap = true;
+		return 1;
+	}
+	case 0x02U: /* Timestamp, the second with a cycle count */
+	case 0x03U: {
+		const size_t timestamp_len = len > 1U ? etm_field_len(p + 1U, len - 1U, 9U) : 0U;
+		if (!timestamp_len)
+			return 0;
+		if (header == 0x02U)
+			return 1;
+		const size_t pos = 1U + timestamp_len;
+		return pos < len && etm_field_len(p + pos, len - pos, 3U);
+	}
+	case 0x04U: /* Trace on, after a gap */
+		dec->gap = true;
+		return 1;
+	case 0x05U: /* Function return */
+		return 1;
+	case 0x06U: { /* Exception, its return address comes next */
+		const size_t info_len = len > 1U ? etm_field_len(p + 1U, len - 1U, 2U) : 0U;
+		if (!info_len)
+			return 0;
+		dec->exception = true;
+		dec->exception_type = ((p[1] >> 1U) & 0x1fU) | (info_len > 1U ? (p[2] & 0x1fU) << 5U : 0U);
+		return 1;
+	}
+	case 0x81U: /* Context */
+		return len > 1U && etm4_context_len(p + 1U, len - 1U);
+	case 0x82U: /* Long address with context */
+	case 0x83U:
+	case 0x85U:
+	case 0x86U: {
+		const size_t address_len = header >= 0x85U ? 8U : 4U;
+		if (len < 2U + address_len || !etm4_context_len(p + 1U + address_len, len - 1U - address_len))
+			return 0;
+		dec->valid = true;
+		etm4_address(dec, etm4_long_address(p + 1U, header == 0x83U || header == 0x86U));
+		return 1;
+	}
+	case 0x90U: /* Exact match, an address from the history again */
+	case 0x91U:
+	case 0x92U:
+		etm4_address(dec, dec->history[header & 3U]);
+		return 1;
+	case 0x95U: /* Short address, the low bits that changed */
+	case 0x96U: {
+		if (len < 2U || (len == 2U && (p[1] & 0x80U)))
+			return 0;
+		const uint32_t shift = header == 0x96U ? 1U : 2U;
+		const uint32_t width = len == 3U ? 15U : 7U;
+		const uint32_t bits = (p[1] & 0x7fU) | (len == 3U ? (uint32_t)p[2] << 7U : 0U);
+		const uint32_t mask = ((1U << width) - 1U) << shift;
+		etm4_address(dec, (dec->history[0] & ~mask & ~((1U << shift) - 1U)) | (bits << shift));
+		return 1;
+	}
+	case 0x9aU: /* Long address */
+	case 0x9bU:
+	case 0x9dU:
+	case 0x9eU:
+		if (len < (header >= 0x9dU ? 9U : 5U))
+			return 0;
+		dec->valid = true;
+		etm4_address(dec, etm4_long_address(p + 1U, header == 0x9bU || header == 0x9eU));
+		return 1;
+	default:
+		return -1;
+	}
+}
+
+static void etm_decode_byte(etm_decoder_s *const dec, const uint8_t byte)
+{
+	/* Both sync on a run of zeros ended by 0x80, 5 of them for ETMv3 and 11 for ETMv4 */
+	const size_t sync_zeros = dec->etm->version == 4U ? 11U : 5U;
+	if (!dec->synced) {
+		if (byte == 0x80U && dec->zeros >= sync_zeros) {
+			dec->synced = true;
+			dec->len = 0;
+			dec->valid = false;
+			dec->gap = true;
+		}
+		dec->zeros = byte ? 0U : dec->zeros + 1U;
+		return;
+	}
+	/* An A-sync, however long its run of zeros, or ETMv4's discard and overflow */
+	if (dec->len && dec->packet[0] == 0x00U) {
+		if (!byte)
+			++dec->zeros;
+		else if (byte == 0x80U || (dec->etm->version == 4U && !dec->zeros && (byte == 0x03U || byte == 0x05U))) {
+			dec->gap |= byte != 0x80U;
+			dec->len = 0;
+		} else
+			dec->synced = false;
+		return;
+	}
+	dec->packet[dec->len++] = byte;
+	if (byte == 0x00U && dec->len == 1U) {
+		dec->zeros = 0;
+		return;
+	}
+	const int result = dec->etm->version == 4U ? etm4_packet(dec) : etm3_packet(dec);
+	if (result > 0)
+		dec->len = 0;
+	else if (result < 0 || dec->len == ETM_PACKET_MAX) {
+		/* Lost in the trace, wait for the next sync */
+		dec->synced = false;
+		dec->zeros = 0;
+	}
+}
+
+/*
+ * Takes the formatter's frames apart. Even bytes are either data, their
+ * low bit in the frame's last byte, or a new trace ID which the last byte
+ * says takes effect before or after the odd byte following.
+ */
+static void etm_decode(const etm_s *const etm, const uint8_t *const trace, const size_t len,
+	const etm_address_fn address, void *const context)
+{
+	etm_decoder_s dec = {.etm = etm, .address = address, .context = context};
+	uint8_t id = 0;
+	for (size_t offset = 0; offset + ETM_FRAME_SIZE <= len; offset += ETM_FRAME_SIZE) {
+		const uint8_t *const frame = trace + offset;
+		const uint8_t aux = frame[ETM_FRAME_SIZE - 1U];
+		for (size_t i = 0; i < ETM_FRAME_SIZE - 1U; i += 2U) {
+			const bool aux_bit = aux & (1U << (i / 2U));
+			const bool last = i == ETM_FRAME_SIZE - 2U;
+			if (!(frame[i] & 1U)) {
+				if (id == etm->trace_id)
+					etm_decode_byte(&dec, (frame[i] & 0xfeU) | aux_bit);
+			} else if (aux_bit && !last) {
+				if (id == etm->trace_id)
+					etm_decode_byte(&dec, frame[i + 1U]);
+				id = frame[i] >> 1U;
+				continue;
+			} else
+				id = frame[i] >> 1U;
+			if (!last && id == etm->trace_id)
+				etm_decode_byte(&dec, frame[i + 1U]);
+		}
+	}
+}
+
+typedef struct etm_dump {
+	size_t skip;
+	size_t count;
+	bool print;
+} etm_dump_s;
+
+static void etm_dump_address(void *const context, const uint32_t address, const etm_address_kind_e kind,
+	const uint32_t info)
+{
+	etm_dump_s *const dump = (etm_dump_s *)context;
+	if (dump->print && dump->count >= dump->skip) {
+		switch (kind) {
+		case ETM_ADDRESS_START:
+			gdb_outf("0x%08" PRIx32 " start\n", address);
+			break;
+		case ETM_ADDRESS_EXCEPTION:
+			gdb_outf("0x%08" PRIx32 " exception %" PRIu32 "\n", address, info);
+			break;
+		case ETM_ADDRESS_RETURN:
+			gdb_outf("0x%08" PRIx32 " exception type %" PRIu32 " returns here\n", address, info);
+			break;
+		default:
+			gdb_outf("0x%08" PRIx32 "\n", address);
+		}
+	}
+	++dump->count;
+}
+
+static void etm_dump(etm_s *const etm, const size_t count)
+{
+	etm_sink_s *const sink = etm->sink;
+	if (!etm_sink_read_trace(sink)) {
+		gdb_out("No trace to read\n");
+		return;
+	}
+	/* Counted first, for only the newest count to be printed */
+	etm_dump_s dump = {0};
+	etm_decode(etm, sink->trace, sink->trace_len, etm_dump_address, &dump);
+	const size_t total = dump.count;
+	dump = (etm_dump_s){.skip = count && count < total ? total - count : 0U, .print = true};
+	etm_decode(etm, sink->trace, sink->trace_len, etm_dump_address, &dump);
+	gdb_outf("%u addresses from %u bytes of trace\n", (unsigned)total, (unsigned)sink->trace_len);
+}
+
+static bool etm_cmd(target *t, int argc, const char **argv)
+{
+	etm_s *const etm = t->etm;
+	if (argc > 1 && !strcmp(argv[1], "enable")) {
+		if (!etm_enable(t, etm, true)) {
+			if (etm->filter_count > etm->pairs)
+				gdb_outf("The ETM has %u address range comparators\n", etm->pairs);
+			return false;
+		}
+	} else if (argc > 1 && !strcmp(argv[1], "disable")) {
+		if (!etm_enable(t, etm, false))
+			return false;
+	} else if (argc > 1 && !strcmp(argv[1], "filter")) {
+		if (argc == 3 && !strcmp(argv[2], "clear"))
+			etm->filter_count = 0;
+		else if (argc == 4 && etm->filter_count < ETM_FILTERS_MAX) {
+			etm->filter[etm->filter_count][0] = strtoul(argv[2], NULL, 0);
+			etm->filter[etm->filter_count++][1] = strtoul(argv[3], NULL, 0);
+		} else {
+			gdb_outf("Up to %u ranges, see \"monitor etm filter START END\"\n", ETM_FILTERS_MAX);
+			return false;
+		}
+		/* The ETM picks the ranges up when it is programmed again */
+		if (etm->enabled && !etm_enable(t, etm, true))
+			return false;
+	} else if (argc > 1 && !strcmp(argv[1], "dump")) {
+		etm_dump(etm, argc > 2 ? strtoul(argv[2], NULL, 0) : 0U);
+		return true;
+	}
+	gdb_outf("ETMv%u %s, trace ID 0x%02x", etm->version, etm->enabled ? "enabled" : "disabled", etm->trace_id);
+	if (etm->identified)
+		gdb_outf(", %u address range comparators", etm->pairs);
+	gdb_outf("\n%s at 0x%08" PRIx32 ", %" PRIu32 " bytes\n", etm->sink->kind == ETM_SINK_TMC ? "TMC" : "ETB",
+		etm->sink->base, etm->sink->words * 4U);
+	for (size_t i = 0; i < etm->filter_count; ++i)
+		gdb_outf("Tracing 0x%08" PRIx32 " to 0x%08" PRIx32 "\n", etm->filter[i][0], etm->filter[i][1]);
+	return true;
+}
@@ -0,0 +1,88 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ETM_H
+#define __ETM_H
+
+#include "target.h"
+#include "adiv5.h"
+
+#define ETM_FUNNELS_MAX 4U
+#define ETM_FILTERS_MAX 4U
+
+typedef enum etm_sink_kind {
+	ETM_SINK_ETB,
+	ETM_SINK_TMC,
+} etm_sink_kind_e;
+
+/* A trace funnel on the way from the ETMs to the trace buffer */
+typedef struct etm_funnel {
+	ADIv5_AP_t *ap;
+	uint32_t base;
+} etm_funnel_s;
+
+/* The on-chip trace buffer of a DP, shared by the cores whose ETMs trace into it */
+typedef struct etm_sink {
+	/* The sink and funnels may be on another AP than the cores, a reference is held on each */
+	ADIv5_AP_t *ap;
+	uint32_t base;
+	etm_sink_kind_e kind;
+	/* RAM size in words */
+	uint32_t words;
+	etm_funnel_s funnels[ETM_FUNNELS_MAX];
+	size_t funnel_count;
+	size_t refcnt;
+	bool running;
+	/* Formatted trace read since a core halted, NULL until read */
+	uint8_t *trace;
+	size_t trace_len;
+} etm_sink_s;
+
+/* A core's Embedded Trace Macrocell, reached through the AP the core holds a reference on */
+typedef struct etm {
+	ADIv5_AP_t *ap;
+	uint32_t base;
+	/* Architecture major version, 3 or 4 */
+	uint8_t version;
+	uint8_t trace_id;
+	/* What the ETM has, read once it has been powered up */
+	bool identified;
+	uint8_t pairs;
+	bool alt_branch;
+	bool branch_broadcast;
+	bool enabled;
+	/* Address ranges traced, everything when there are none */
+	uint32_t filter[ETM_FILTERS_MAX][2];
+	size_t filter_count;
+	etm_sink_s *sink;
+} etm_s;
+
+/* Called from the ROM table walk for each ETM found on the AP being walked */
+void etm_probe(uint32_t base, uint16_t part_number);
+/* And for the trace buffers and funnels, which may be on any AP of the DP */
+void etm_sink_probe(ADIv5_AP_t *ap, uint32_t base, uint16_t part_number);
+void etm_funnel_probe(ADIv5_AP_t *ap, uint32_t base);
+/* Hands the ETMs found on the AP to its cores in order, first being the first core found on it */
+void etm_assign(ADIv5_AP_t *ap, target *first);
+/* Once all APs of the DP have been walked, gives the trace buffer found to the cores from first on */
+void etm_assign_sink(target *first);
+void etm_free(target *t);
+
+/* Drops the trace read and restarts the capture, the core is about to run or be reset */
+void etm_invalidate(target *t);
+
+#endif /* __ETM_H */
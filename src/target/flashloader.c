@@ -0,0 +1,212 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This file implements a generic streaming Flash loader for Cortex-M targets.
+ *
+ * A small stub is loaded into target RAM, followed by a control block and a
+ * ring buffer. While the stub programs the Flash out of the ring buffer the
+ * probe keeps refilling it, so the SWD link never has to wait for a program
+ * operation to finish and the per-operation status polling happens on the
+ * target instead of over the wire.
+ *
+ * Drivers whose Flash controller takes an address and data per word, rather
+ * than stores to the Flash itself, or that program whole pages by command,
+ * supply a stub of their own for the same control block.
+ *
+ * Control block layout, all fields 32 bits:
+ *   0x00 write pointer, advanced by the probe after filling the ring buffer
+ *   0x04 read pointer, advanced by the stub after each program operation
+ *   0x08 status register value if the stub stopped on an error
+ *   0x0c end of the ring buffer
+ *   0x10 address of the Flash status register
+ *   0x14 busy mask
+ *   0x18 error mask
+ *   0x1c ready mask, status bits that read as 1 when the controller is idle
+ *   0x20 start of the ring buffer
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "cortexm.h"
+#include "flashloader.h"
+
+static const uint16_t flashloader_stub16[] = {
+#include "flashstub/flashloader16.stub"
+};
+
+static const uint16_t flashloader_stub32[] = {
+#include "flashstub/flashloader32.stub"
+};
+
+static const uint16_t flashloader_stub64[] = {
+#include "flashstub/flashloader64.stub"
+};
+
+static const uint16_t flashloader_stub_half_page64[] = {
+#include "flashstub/flashloader512.stub"
+};
+
+static const uint16_t flashloader_stub_half_page128[] = {
+#include "flashstub/flashloader1024.stub"
+};
+
+static const uint16_t flashloader_stub_row[] = {
+#include "flashstub/flashloader2048.stub"
+};
+
+#define FLASHLOADER_WP       0x00U
+#define FLASHLOADER_RP       0x04U
+#define FLASHLOADER_STATUS   0x08U
+#define FLASHLOADER_BUF_END  0x0cU
+#define FLASHLOADER_SR_ADDR  0x10U
+#define FLASHLOADER_BUSY     0x14U
+#define FLASHLOADER_ERROR    0x18U
+#define FLASHLOADER_READY    0x1cU
+#define FLASHLOADER_CTRL_LEN 0x20U
+
+/* Largest ring buffer to use, and the smallest buffer and write worth starting the loader for */
+#define FLASHLOADER_BUF_MAX  4096U
+#define FLASHLOADER_BUF_MIN  256U
+/* Give up if the stub makes no progress for this long */
+#define FLASHLOADER_STALL_MS 1000U
+
+static struct target_ram *flashloader_ram(target *t)
+{
+	/* Prefer the main SRAM, which is the region every family can execute from */
+	for (struct target_ram *r = t->ram; r; r = r->next) {
+		if (r->start <= 0x20000000U && 0x20000000U - r->start < r->length)
+			return r;
+	}
+	return t->ram;
+}
+
+int flashloader_write(target *t, const struct flashloader_params *params,
+	target_addr dest, const void *src, size_t len)
+{
+	const uint16_t *stub = params->stub;
+	size_t stub_len = params->stub_len;
+	/* The store-and-poll stub for the width, unless the driver brings its own */
+	if (!stub) {
+		switch (params->width) {
+		case 2:
+			stub = flashloader_stub16;
+			stub_len = sizeof(flashloader_stub16);
+			break;
+		case 4:
+			stub = flashloader_stub32;
+			stub_len = sizeof(flashloader_stub32);
+			break;
+		case 8:
+			stub = flashloader_stub64;
+			stub_len = sizeof(flashloader_stub64);
+			break;
+		case 64: /* Half pages of STM32L0 and STM32L1, written without waiting in between */
+			stub = flashloader_stub_half_page64;
+			stub_len = sizeof(flashloader_stub_half_page64);
+			break;
+		case 128:
+			stub = flashloader_stub_half_page128;
+			stub_len = sizeof(flashloader_stub_half_page128);
+			break;
+		case 256: /* A row of 32 double words, written without waiting in between */
+			stub = flashloader_stub_row;
+			stub_len = sizeof(flashloader_stub_row);
+			break;
+		default:
+			return 1;
+		}
+	}
+
+	struct target_ram *ram = flashloader_ram(t);
+	if (t->flash_loader_disabled || !ram || len % params->width || len < FLASHLOADER_BUF_MIN)
+		return 1;
+	const target_addr stub_addr = ram->start;
+	const target_addr ctrl = ALIGN(stub_addr + stub_len, 4U);
+	const target_addr buf = ctrl + FLASHLOADER_CTRL_LEN;
+	if (buf - ram->start >= ram->length)
+		return 1;
+	size_t buf_len = MIN(ram->length - (buf - ram->start), FLASHLOADER_BUF_MAX);
+	buf_len -= buf_len % params->width;
+	if (buf_len < FLASHLOADER_BUF_MIN || buf_len < 2U * params->width)
+		return 1;
+	const target_addr buf_end = buf + buf_len;
+
+	const bool cache = target_mem_cache_suspend(t);
+	target_mem_write(t, stub_addr, stub, stub_len);
+	const uint32_t ctrl_block[FLASHLOADER_CTRL_LEN / 4U] = {
+		buf, buf, 0, buf_end, params->sr_addr, params->busy_mask, params->error_mask, params->ready_mask,
+	};
+	target_mem_write(t, ctrl, ctrl_block, sizeof(ctrl_block));
+	if (target_check_error(t) || cortexm_start_stub(t, stub_addr, ctrl, dest, len, params->stub_arg)) {
+		target_mem_cache_resume(t, cache);
+		return 1;
+	}
+
+	const uint8_t *data = (const uint8_t *)src;
+	target_addr wp = buf;
+	target_addr last_rp = buf;
+	platform_timeout stall;
+	platform_timeout_set(&stall, FLASHLOADER_STALL_MS);
+	int ret = 0;
+	while (len) {
+		const uint32_t poll_start = platform_time_us();
+		uint32_t state[2];
+		target_mem_read(t, state, ctrl + FLASHLOADER_RP, sizeof(state));
+		if (target_check_error(t) || state[1]) {
+			ret = -1;
+			break;
+		}
+		const target_addr rp = state[0];
+		if (rp != last_rp) {
+			last_rp = rp;
+			platform_timeout_set(&stall, FLASHLOADER_STALL_MS);
+		}
+		/* One unit always stays free so a full ring can't look empty */
+		size_t space = (rp + buf_len - wp - params->width) % buf_len;
+		if (!space) {
+			/* Waiting on the stub to make room is the loader's BSY-poll */
+			target_flash_stats_poll(t, 1U, platform_time_us() - poll_start);
+			if (platform_timeout_is_expired(&stall)) {
+				DEBUG_WARN("Flash loader stalled at %08" PRIx32 "\n", dest);
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+		const size_t chunk = MIN(MIN(space, len), buf_end - wp);
+		target_mem_write(t, wp, data, chunk);
+		data += chunk;
+		len -= chunk;
+		wp += chunk;
+		if (wp == buf_end)
+			wp = buf;
+		target_mem_write32(t, ctrl + FLASHLOADER_WP, wp);
+	}
+
+	/* Once the stub has all its data it only has the last operations to finish */
+	const int result = cortexm_wait_stub(t, ret ? 0 : FLASHLOADER_STALL_MS);
+	if (result) {
+		if (result == 1)
+			DEBUG_WARN("Flash loader error, status %08" PRIx32 "\n",
+				target_mem_read32(t, ctrl + FLASHLOADER_STATUS));
+		ret = -1;
+	}
+	target_mem_cache_resume(t, cache);
+	return ret;
+}
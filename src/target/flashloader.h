@@ -0,0 +1,53 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FLASHLOADER_H
+#define __FLASHLOADER_H
+
+#include "target.h"
+
+/*
+ * Describes how a Flash controller is driven by the streaming loader: the loader
+ * stores width bytes at a time (2, 4 or 8, or a 64 or 128 byte half page or 256 byte row) and then polls the
+ * status register at sr_addr until none of busy_mask is set, failing if any of
+ * error_mask is. Bits of ready_mask read as 1 rather than 0 when the controller
+ * is idle, for controllers with a ready flag in place of a busy one.
+ * Controllers programmed through address and data registers rather than by
+ * stores to the Flash supply their own stub, which follows the same protocol
+ * and is passed stub_arg in r3.
+ * The caller must have unlocked the controller and enabled programming already.
+ */
+struct flashloader_params {
+	uint16_t width;
+	target_addr sr_addr;
+	uint32_t busy_mask;
+	uint32_t error_mask;
+	uint32_t ready_mask;
+	const uint16_t *stub;
+	size_t stub_len;
+	uint32_t stub_arg;
+};
+
+/*
+ * Program len bytes from src to dest using a loader running from target RAM.
+ * Returns 0 on success, -1 on a programming error and 1 if the loader can't be
+ * used for this target or request, in which case the caller writes the data itself.
+ */
+int flashloader_write(target *t, const struct flashloader_params *params,
+	target_addr dest, const void *src, size_t len);
+
+#endif
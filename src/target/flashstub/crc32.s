@@ -0,0 +1,57 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ Position independent CRC32 (poly 0x04C11DB7, MSB first, as used by GDB's
+@ qCRC) for any Cortex-M, a nibble at a time from a 16 entry table.
+@ r0: data, r1: length, r2: initial crc, r3: where to store the result.
+
+	.syntax unified
+	.thumb
+	.text
+	.global crc32_stub
+crc32_stub:
+	adr	r4, table
+loop:
+	cmp	r1, #0
+	beq	done
+	ldrb	r5, [r0]
+	adds	r0, #1
+	lsrs	r6, r2, #28
+	lsrs	r7, r5, #4
+	eors	r6, r7
+	lsls	r6, r6, #2
+	ldr	r6, [r4, r6]
+	lsls	r2, r2, #4
+	eors	r2, r6
+	lsrs	r6, r2, #28
+	lsls	r7, r5, #28
+	lsrs	r7, r7, #28
+	eors	r6, r7
+	lsls	r6, r6, #2
+	ldr	r6, [r4, r6]
+	lsls	r2, r2, #4
+	eors	r2, r6
+	subs	r1, #1
+	b	loop
+done:
+	str	r2, [r3]
+	bkpt	#0
+
+	.align	2
+table:
+	.word	0x00000000, 0x04C11DB7, 0x09823B6E, 0x0D4326D9
+	.word	0x130476DC, 0x17C56B6B, 0x1A864DB2, 0x1E475005
+	.word	0x2608EDB8, 0x22C9F00F, 0x2F8AD6D6, 0x2B4BCB61
+	.word	0x350C9B64, 0x31CD86D3, 0x3C8EA00A, 0x384FBDBD
@@ -0,0 +1,72 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+@ Streaming flash loader for the EFM32 Memory System Controller, taking its
+@ data through the ring buffer described in target/flashloader.c. Each word
+@ is loaded into the MSC as address, data and WRITEONCE, then BUSY is polled.
+@ The control block's status register is MSC_STATUS. Only ARMv6-M is used.
+@ r0: control block, r1: destination, r2: length (a multiple of 4).
+
+	.syntax unified
+	.thumb
+	.text
+	.global efm32_flash_write_stub
+efm32_flash_write_stub:
+	ldr	r3, [r0, #16]		@ MSC_STATUS, the registers are addressed from the MSC base
+	subs	r3, #0x1c
+	ldr	r4, [r0, #4]		@ Read pointer
+loop:
+	cmp	r2, #0
+	beq	done
+wait_data:
+	ldr	r5, [r0, #0]		@ Wait for the probe to move the write pointer
+	cmp	r5, r4
+	beq	wait_data
+	str	r1, [r3, #0x10]		@ MSC_ADDRB
+	movs	r5, #1			@ LADDRIM
+	str	r5, [r3, #0x0c]		@ MSC_WRITECMD
+	movs	r6, #8			@ WDATAREADY
+wait_wdata:
+	ldr	r5, [r3, #0x1c]
+	tst	r5, r6
+	beq	wait_wdata
+	ldr	r5, [r4, #0]
+	str	r5, [r3, #0x18]		@ MSC_WDATA
+	str	r6, [r3, #0x0c]		@ WRITEONCE, the same bit as WDATAREADY
+wait_busy:
+	ldr	r5, [r3, #0x1c]
+	ldr	r6, [r0, #20]		@ Busy mask
+	tst	r5, r6
+	bne	wait_busy
+	ldr	r6, [r0, #24]		@ Error mask
+	tst	r5, r6
+	bne	error
+	adds	r1, #4
+	adds	r4, #4
+	ldr	r5, [r0, #12]		@ End of the ring buffer
+	cmp	r4, r5
+	bne	nowrap
+	movs	r4, r0
+	adds	r4, #32			@ Ring buffer follows the control block
+nowrap:
+	str	r4, [r0, #4]
+	subs	r2, #4
+	b	loop
+error:
+	str	r5, [r0, #8]		@ Report the status register
+	bkpt	#1
+done:
+	bkpt	#0
@@ -0,0 +1,87 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ Streaming flash loader, see target/flashloader.c for the control block.
+@ WIDTH is the number of bytes per program operation (2, 4 or 8, or 64, 128
+@ or 256 for a half page or row of double words written back to back) and is
+@ given on the command line with --defsym. Only ARMv6-M instructions are used.
+@ r0: control block, r1: destination, r2: length (a multiple of WIDTH).
+
+	.syntax unified
+	.thumb
+	.text
+	.global flashloader_stub
+flashloader_stub:
+	ldr	r3, [r0, #16]		@ Flash status register
+	ldr	r4, [r0, #4]		@ Read pointer
+loop:
+	cmp	r2, #0
+	beq	done
+wait_data:
+	ldr	r5, [r0, #0]		@ Wait for the probe to move the write pointer
+	cmp	r5, r4
+	beq	wait_data
+.if WIDTH == 2
+	ldrh	r5, [r4, #0]
+	strh	r5, [r1, #0]
+.elseif WIDTH == 4
+	ldr	r5, [r4, #0]
+	str	r5, [r1, #0]
+.elseif WIDTH == 8
+	ldr	r5, [r4, #0]
+	ldr	r6, [r4, #4]
+	str	r5, [r1, #0]
+	str	r6, [r1, #4]
+.else
+	movs	r6, #(WIDTH / 8)
+copy_row:
+	ldmia	r4!, {r5, r7}
+	stmia	r1!, {r5, r7}
+	subs	r6, #1
+	bne	copy_row
+.endif
+wait_busy:
+	ldr	r5, [r3, #0]
+	ldr	r6, [r0, #28]		@ Ready mask, flips the bits that read as 1 when idle
+	eors	r5, r6
+	ldr	r6, [r0, #20]		@ Busy mask
+	tst	r5, r6
+	bne	wait_busy
+	ldr	r6, [r0, #24]		@ Error mask
+	tst	r5, r6
+	bne	error
+.if WIDTH <= 8
+	adds	r1, #WIDTH
+	adds	r4, #WIDTH
+.endif
+	ldr	r5, [r0, #12]		@ End of the ring buffer
+	cmp	r4, r5
+	bne	nowrap
+	movs	r4, r0
+	adds	r4, #32			@ Ring buffer follows the control block
+nowrap:
+	str	r4, [r0, #4]
+.if WIDTH < 256
+	subs	r2, #WIDTH
+.else
+	subs	r2, #128		@ A whole row doesn't fit the immediate
+	subs	r2, #128
+.endif
+	b	loop
+error:
+	str	r5, [r0, #8]		@ Report the status register
+	bkpt	#1
+done:
+	bkpt	#0
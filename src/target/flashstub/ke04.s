@@ -0,0 +1,79 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+@ Streaming flash loader for the KE04 FTMRE, taking its data through the ring
+@ buffer described in target/flashloader.c. Each double word is loaded into
+@ FCCOB as a Program Flash command, the FCCOBIX byte selecting each halfword,
+@ then launched by clearing CCIF, which is polled. Only ARMv6-M is used.
+@ r0: control block, r1: destination, r2: length (a multiple of 8),
+@ r3: FTMRE base.
+
+	.syntax unified
+	.thumb
+	.text
+	.global ke04_flash_write_stub
+ke04_flash_write_stub:
+	ldr	r4, [r0, #4]		@ Read pointer
+loop:
+	cmp	r2, #0
+	beq	done
+wait_data:
+	ldr	r5, [r0, #0]		@ Wait for the probe to move the write pointer
+	cmp	r5, r4
+	beq	wait_data
+	movs	r5, #0
+	strb	r5, [r3, #1]		@ FCCOBIX 0: command and address bits 23:16
+	lsrs	r6, r1, #16
+	movs	r7, #6			@ Program Flash
+	lsls	r7, r7, #8
+	orrs	r6, r7
+	strh	r6, [r3, #8]
+	movs	r5, #1
+	strb	r5, [r3, #1]		@ FCCOBIX 1: address bits 15:0
+	strh	r1, [r3, #8]
+	movs	r5, #2
+data:
+	strb	r5, [r3, #1]		@ FCCOBIX 2 to 5: the data halfwords
+	ldrh	r6, [r4, #0]
+	strh	r6, [r3, #8]
+	adds	r4, #2
+	adds	r5, #1
+	cmp	r5, #6
+	bne	data
+	movs	r5, #0x80		@ Launch by clearing CCIF
+	strb	r5, [r3, #5]
+wait_ccif:
+	ldrb	r5, [r3, #5]		@ FSTAT
+	lsls	r6, r5, #24		@ CCIF into the sign bit
+	bpl	wait_ccif
+	movs	r6, #0x30		@ ACCERR and FPVIOL
+	tst	r5, r6
+	bne	error
+	adds	r1, #8
+	ldr	r5, [r0, #12]		@ End of the ring buffer
+	cmp	r4, r5
+	bne	nowrap
+	movs	r4, r0
+	adds	r4, #32			@ Ring buffer follows the control block
+nowrap:
+	str	r4, [r0, #4]
+	subs	r2, #8
+	b	loop
+error:
+	str	r5, [r0, #8]		@ Report the status register
+	bkpt	#1
+done:
+	bkpt	#0
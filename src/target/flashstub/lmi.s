@@ -0,0 +1,71 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+@ Streaming flash loader for the Stellaris/Tiva Flash controller, taking its
+@ data through the ring buffer described in target/flashloader.c. Each word
+@ is loaded as FMA, FMD and a WRITE command, then FMC is polled until the
+@ controller clears WRITE. The control block's status register is FMC.
+@ Only ARMv6-M instructions are used.
+@ r0: control block, r1: destination, r2: length (a multiple of 4).
+
+	.syntax unified
+	.thumb
+	.text
+	.global lmi_flash_write_stub
+lmi_flash_write_stub:
+	ldr	r3, [r0, #16]		@ FMC, the registers are addressed from FMA
+	subs	r3, #8
+	ldr	r4, [r0, #4]		@ Read pointer
+	ldr	r7, fmc_write
+loop:
+	cmp	r2, #0
+	beq	done
+wait_data:
+	ldr	r5, [r0, #0]		@ Wait for the probe to move the write pointer
+	cmp	r5, r4
+	beq	wait_data
+	str	r1, [r3, #0]		@ FMA
+	ldr	r5, [r4, #0]
+	str	r5, [r3, #4]		@ FMD
+	str	r7, [r3, #8]		@ FMC
+wait_busy:
+	ldr	r5, [r3, #8]
+	ldr	r6, [r0, #20]		@ Busy mask
+	tst	r5, r6
+	bne	wait_busy
+	ldr	r6, [r0, #24]		@ Error mask
+	tst	r5, r6
+	bne	error
+	adds	r1, #4
+	adds	r4, #4
+	ldr	r5, [r0, #12]		@ End of the ring buffer
+	cmp	r4, r5
+	bne	nowrap
+	movs	r4, r0
+	adds	r4, #32			@ Ring buffer follows the control block
+nowrap:
+	str	r4, [r0, #4]
+	subs	r2, #4
+	b	loop
+error:
+	str	r5, [r0, #8]		@ Report the status register
+	bkpt	#1
+done:
+	bkpt	#0
+
+	.align	2
+fmc_write:
+	.word	0xa4420001		@ WRKEY | WRITE
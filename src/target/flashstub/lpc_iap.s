@@ -0,0 +1,40 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ Runs a chain of LPC IAP commands, stopping at the first one that fails,
+@ so that prepare, copy and compare cost one halt and resume together.
+@ r4: first command block, each 5 command then 5 status and result words
+@ r5: number of commands, at least 1
+@ r6: IAP entry point, with the Thumb bit set
+@ r4-r6 are callee saved, so they survive the IAP calls.
+
+	.syntax unified
+	.thumb
+	.text
+	.global lpc_iap_stub
+lpc_iap_stub:
+loop:
+	movs	r0, r4
+	movs	r1, r4
+	adds	r1, #20
+	blx	r6
+	ldr	r0, [r4, #20]
+	cmp	r0, #0
+	bne	done
+	adds	r4, #40
+	subs	r5, #1
+	bne	loop
+done:
+	bkpt	#0
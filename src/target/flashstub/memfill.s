@@ -0,0 +1,43 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ Position independent memory fill for any Cortex-M, words where aligned.
+@ r0: start, r1: end, r2: pattern as a word, its first byte for start.
+@ Leaves r0 at end.
+
+	.syntax unified
+	.thumb
+	.text
+	.global memfill_stub
+memfill_stub:
+	movs	r4, #8
+loop:
+	cmp	r0, r1
+	bhs	done
+	lsls	r5, r0, #30
+	bne	byte
+	adds	r5, r0, #4
+	cmp	r5, r1
+	bhi	byte
+	str	r2, [r0]
+	mov	r0, r5
+	b	loop
+byte:
+	strb	r2, [r0]
+	adds	r0, #1
+	rors	r2, r4
+	b	loop
+done:
+	bkpt	#0
@@ -0,0 +1,56 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ Position independent pattern search for any Cortex-M, looking at every
+@ multiple of the pattern's size from start.
+@ r0: start, r1: end, r2: pattern, its first byte lowest,
+@ r3: pattern size in bytes, plus 0x100 to look for where it isn't instead.
+@ Leaves r0 where it was found, or at end.
+
+	.syntax unified
+	.thumb
+	.text
+	.global memfind_stub
+memfind_stub:
+	lsrs	r7, r3, #8
+	uxtb	r3, r3
+loop:
+	adds	r4, r0, r3
+	cmp	r4, r1
+	bhi	done
+	movs	r5, #0
+	mov	r4, r3
+byte:
+	subs	r4, #1
+	ldrb	r6, [r0, r4]
+	lsls	r5, r5, #8
+	orrs	r5, r6
+	cmp	r4, #0
+	bne	byte
+	cmp	r5, r2
+	beq	match
+	cmp	r7, #0
+	bne	found
+	b	next
+match:
+	cmp	r7, #0
+	beq	found
+next:
+	adds	r0, r0, r3
+	b	loop
+done:
+	mov	r0, r1
+found:
+	bkpt	#0
@@ -0,0 +1,90 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ Streaming page loader for the Atmel EEFC and FLASHCALW Flash controllers,
+@ taking its data through the ring buffer described in target/flashloader.c.
+@ Each 512 byte page is copied into the page latch, then the write page
+@ command is issued and FRDY polled. The command register sits just below
+@ the control block's status register. With CLEAR_BUFFER set, the latch is
+@ cleared first as the FLASHCALW needs. Only ARMv6-M instructions are used.
+@ r0: control block, r1: destination, r2: length (a multiple of 512),
+@ r3: command word for the first page, the page number advances from there.
+
+	.syntax unified
+	.thumb
+	.text
+	.global sam_page_write_stub
+sam_page_write_stub:
+	ldr	r7, [r0, #16]		@ FSR, the command register precedes it
+	subs	r7, #4
+	ldr	r4, [r0, #4]		@ Read pointer
+loop:
+	cmp	r2, #0
+	beq	done
+wait_data:
+	ldr	r5, [r0, #0]		@ Wait for the probe to move the write pointer
+	cmp	r5, r4
+	beq	wait_data
+.if CLEAR_BUFFER
+	ldr	r5, clear_page_buffer
+	str	r5, [r7, #0]
+wait_clear:
+	ldr	r5, [r7, #4]
+	ldr	r6, [r0, #28]		@ Ready mask
+	tst	r5, r6
+	beq	wait_clear
+.endif
+	movs	r6, #128		@ Words in a page
+copy:
+	ldr	r5, [r4, #0]
+	str	r5, [r1, #0]
+	adds	r4, #4
+	adds	r1, #4
+	subs	r6, #1
+	bne	copy
+	str	r3, [r7, #0]		@ Write page
+wait_ready:
+	ldr	r5, [r7, #4]
+	ldr	r6, [r0, #28]		@ Ready mask
+	tst	r5, r6
+	beq	wait_ready
+	ldr	r6, [r0, #24]		@ Error mask
+	tst	r5, r6
+	bne	error
+	movs	r5, #1
+	lsls	r5, #8
+	adds	r3, r3, r5		@ Next page number
+	ldr	r5, [r0, #12]		@ End of the ring buffer
+	cmp	r4, r5
+	bne	nowrap
+	movs	r4, r0
+	adds	r4, #32			@ Ring buffer follows the control block
+nowrap:
+	str	r4, [r0, #4]
+	movs	r5, #2
+	lsls	r5, #8
+	subs	r2, r2, r5
+	b	loop
+error:
+	str	r5, [r0, #8]		@ Report the status register
+	bkpt	#1
+done:
+	bkpt	#0
+.if CLEAR_BUFFER
+
+	.align	2
+clear_page_buffer:
+	.word	0xa5000003		@ KEY | CPB
+.endif
@@ -47,22 +47,195 @@ void jtag_add_device(const uint32_t dev_index, const jtag_dev_t *jtag_dev)
 }
 #endif
 
+/* Bits shifted at a time while reading the chain out */
+#define JTAG_SCAN_CHUNK 32U
+/* Longest IR chain the scan can take apart, ir_prescan has to be able to hold it */
+#define JTAG_MAX_IR_CHAIN 256U
+
+static const uint8_t zeros[JTAG_SCAN_CHUNK / 8U];
+
+/*
+ * The chain found by the last scan. A rescan that reads back the same IDCODEs
+ * takes the IR lengths from here rather than taking the IR chain apart again.
+ */
+static struct {
+	uint32_t dev_count;
+	uint32_t idcode[JTAG_MAX_DEVS];
+	uint8_t ir_len[JTAG_MAX_DEVS];
+} jtag_chain_cache;
+
+/*
+ * Straight after reset each device has either its 32 bit IDCODE, which always
+ * has bit 0 set, or the 1 bit BYPASS register, which captures 0, in DR. Shift
+ * the chain out a chunk at a time, feeding in ones, until a whole IDCODE of
+ * ones says we're reading back what went in. Returns the device count.
+ */
+static size_t jtag_scan_idcodes(void)
+{
+	jtagtap_shift_dr();
+	uint64_t bits = 0;
+	size_t avail = 0;
+	size_t device = 0;
+	while (true) {
+		if (avail < 32U) {
+			uint32_t chunk = 0;
+			jtag_proc.jtagtap_tdi_tdo_seq((uint8_t *)&chunk, false, ones, JTAG_SCAN_CHUNK);
+			bits |= (uint64_t)chunk << avail;
+			avail += JTAG_SCAN_CHUNK;
+		}
+		uint32_t idcode = 0;
+		if (bits & 1U) {
+			idcode = (uint32_t)bits;
+			if (idcode == UINT32_MAX)
+				break;
+			bits >>= 32U;
+			avail -= 32U;
+		} else {
+			bits >>= 1U;
+			--avail;
+		}
+		if (device == JTAG_MAX_DEVS) {
+			DEBUG_WARN("jtag_scan: Maximum device count exceeded\n");
+			device = 0;
+			break;
+		}
+		jtag_devs[device++].jd_idcode = idcode;
+	}
+	DEBUG_INFO("Return to Run-Test/Idle\n");
+	jtag_proc.jtagtap_next(true, true);
+	jtagtap_return_idle(1);
+	return device;
+}
+
+/* Shift ones into the whole IR chain, leaving every device in BYPASS */
+static void jtag_scan_ir_bypass(size_t ir_chain)
+{
+	while (ir_chain) {
+		const size_t chunk = MIN(ir_chain, sizeof(ones) * 8U);
+		jtag_proc.jtagtap_tdi_seq(false, ones, chunk);
+		ir_chain -= chunk;
+	}
+}
+
+static bool jtag_ir_capture_bit(const uint32_t *const capture, const size_t bit)
+{
+	return capture[bit / 32U] & (1U << (bit % 32U));
+}
+
+/*
+ * Capture the IR chain, then clear it with zeros and time how long the ones
+ * that follow take to come out to get its length. Each IR captures 01 in its
+ * two lowest bits, which is where a device starts. Higher bits may capture
+ * either, so when that finds more starts than there are devices, the split
+ * is ambiguous and the IR lengths have to be given.
+ */
+static bool jtag_scan_irs(const size_t dev_count)
+{
+	uint32_t capture[JTAG_MAX_IR_CHAIN / 32U];
+	jtagtap_shift_ir();
+	/* Where the adaptor can defer captures these go out as one, there's nothing to decide until they're all in */
+	for (size_t i = 0; i < sizeof(capture) / sizeof(*capture); ++i) {
+		if (jtag_proc.jtagtap_tdi_tdo_seq_deferred)
+			jtag_proc.jtagtap_tdi_tdo_seq_deferred((uint8_t *)&capture[i], false, zeros, 32U);
+		else
+			jtag_proc.jtagtap_tdi_tdo_seq((uint8_t *)&capture[i], false, zeros, 32U);
+	}
+	jtag_flush(&jtag_proc);
+
+	size_t ir_chain = 0;
+	for (; ir_chain < JTAG_MAX_IR_CHAIN; ir_chain += JTAG_SCAN_CHUNK) {
+		uint32_t chunk = 0;
+		jtag_proc.jtagtap_tdi_tdo_seq((uint8_t *)&chunk, false, ones, JTAG_SCAN_CHUNK);
+		if (chunk) {
+			ir_chain += __builtin_ctz(chunk);
+			break;
+		}
+	}
+	/* The whole chain has seen ones by now, so all devices are left in BYPASS */
+	if (ir_chain >= JTAG_MAX_IR_CHAIN) {
+		DEBUG_WARN("jtag_scan: Maximum IR length exceeded\n");
+		return false;
+	}
+
+	/* A single device owns the whole chain, whatever its IR captures */
+	if (dev_count == 1U) {
+		jtag_devs[0].ir_len = ir_chain;
+		return ir_chain <= JTAG_MAX_IR_LEN;
+	}
+
+	size_t device = 0;
+	for (size_t bit = 0; bit + 1U < ir_chain; ++bit) {
+		if (!jtag_ir_capture_bit(capture, bit) || jtag_ir_capture_bit(capture, bit + 1U))
+			continue;
+		/* IEEE 1149.1 requires the first bit to be a 1, but not all devices conform (see #1130 on GH) */
+		if (!device && bit) {
+			DEBUG_WARN("jtag_scan: Sanity check failed: IR[0] shifted out as 0, give the IR lengths\n");
+			return false;
+		}
+		if (device == dev_count) {
+			DEBUG_WARN("jtag_scan: IR capture is ambiguous, give the IR lengths\n");
+			return false;
+		}
+		jtag_devs[device].ir_prescan = bit;
+		jtag_devs[device].jd_dev = device;
+		if (device)
+			jtag_devs[device - 1U].ir_len = bit - jtag_devs[device - 1U].ir_prescan;
+		++device;
+	}
+	if (device != dev_count) {
+		DEBUG_WARN("jtag_scan: Sanity check failed: IR capture has %zu devices of %zu\n", device, dev_count);
+		return false;
+	}
+	jtag_devs[device - 1U].ir_len = ir_chain - jtag_devs[device - 1U].ir_prescan;
+	for (device = 0; device < dev_count; ++device) {
+		if (jtag_devs[device].ir_len > JTAG_MAX_IR_LEN) {
+			DEBUG_WARN("jtag_scan: Maximum IR length exceeded\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool jtag_scan_cached(const size_t dev_count)
+{
+	if (jtag_chain_cache.dev_count != dev_count)
+		return false;
+	for (size_t device = 0; device < dev_count; ++device) {
+		if (jtag_chain_cache.idcode[device] != jtag_devs[device].jd_idcode)
+			return false;
+	}
+	DEBUG_INFO("Chain matches the last scan, reusing its IR lengths\n");
+	size_t prescan = 0;
+	for (size_t device = 0; device < dev_count; ++device) {
+		jtag_devs[device].ir_len = jtag_chain_cache.ir_len[device];
+		jtag_devs[device].ir_prescan = prescan;
+		jtag_devs[device].jd_dev = device;
+		prescan += jtag_chain_cache.ir_len[device];
+	}
+	jtagtap_shift_ir();
+	jtag_scan_ir_bypass(prescan);
+	return true;
+}
+
+static void jtag_scan_cache_chain(void)
+{
+	jtag_chain_cache.dev_count = jtag_dev_count;
+	for (size_t device = 0; device < jtag_dev_count; ++device) {
+		jtag_chain_cache.idcode[device] = jtag_devs[device].jd_idcode;
+		jtag_chain_cache.ir_len[device] = jtag_devs[device].ir_len;
+	}
+}
+
 /* Scan JTAG chain for devices, store IR length and IDCODE (if present).
- * Reset TAP state machine.
- * Select Shift-IR state.
- * Each device is assumed to shift out IR at 0x01. (this may not always be true)
- * Shift in ones until we read two consecutive ones, then we have shifted out the
- * 	IRs of all devices.
+ * Reset TAP state machine, which loads all IRs with IDCODE or BYPASS.
+ * Select Shift-DR state and read out the IDCODEs, which also counts the devices.
  *
- * After this process all the IRs are loaded with the BYPASS command.
+ * Select Shift-IR state. Unless IR lengths are given or the IDCODEs match
+ * the last scan, take the captured IRs apart as jtag_scan_irs() describes.
+ * Either way the IRs are left loaded with the BYPASS command.
  * Select Shift-DR state.
  * Shift in ones and count zeros shifted out. Should be one for each device.
- * Check this against device count obtained by IR scan above.
- *
- * Reset the TAP state machine again. This should load all IRs with IDCODE.
- * For each device, shift out one bit. If this is zero IDCODE isn't present,
- *	continue to next device. If this is one shift out the remaining 31 bits
- *	of the IDCODE register.
+ * Check this against device count obtained by IDCODE scan above.
  */
 uint32_t jtag_scan(const uint8_t *irlens)
 {
@@ -85,14 +258,18 @@ uint32_t jtag_scan(const uint8_t *irlens)
 #endif
 	jtag_proc.jtagtap_reset();
 
+	DEBUG_INFO("Change state to Shift-DR\n");
+	const size_t dev_count = jtag_scan_idcodes();
+	if (!dev_count)
+		return 0;
+
 	if (irlens) {
 		DEBUG_WARN("Given list of IR lengths, skipping probe\n");
 		DEBUG_INFO("Change state to Shift-IR\n");
 		jtagtap_shift_ir();
 
 		size_t device = 0;
-		for (size_t prescan = 0; device <= JTAG_MAX_DEVS && jtag_devs[device].ir_len <= JTAG_MAX_IR_LEN;
-			++device) {
+		for (size_t prescan = 0; device < JTAG_MAX_DEVS; ++device) {
 			if (irlens[device] == 0)
 				break;
 
@@ -109,46 +286,15 @@ uint32_t jtag_scan(const uint8_t *irlens)
 			prescan += irlens[device];
 		}
 		jtag_dev_count = device;
-	} else {
-		DEBUG_INFO("Change state to Shift-IR\n");
-		jtagtap_shift_ir();
-
+	} else if (jtag_scan_cached(dev_count))
+		jtag_dev_count = dev_count;
+	else {
 		DEBUG_INFO("Scanning out IRs\n");
-		/* IEEE 1149.1 requires the first bit to be a 1, but not all devices conform (see #1130 on GH) */
-		if (!jtag_proc.jtagtap_next(false, true))
-			DEBUG_WARN("jtag_scan: Sanity check failed: IR[0] shifted out as 0\n");
-
-		jtag_devs[0].ir_len = 1;
-		size_t device = 0;
-		for (size_t prescan = 1; device <= JTAG_MAX_DEVS && jtag_devs[device].ir_len <= JTAG_MAX_IR_LEN;) {
-			/* If we read out a '1' from TDO, we're at the end of the current device and the start of the next */
-			if (jtag_proc.jtagtap_next(false, true)) {
-				/* If the device was not actually a new device, exit */
-				if (jtag_devs[device].ir_len == 1)
-					break;
-				++device;
-				/* Set up the next device */
-				jtag_devs[device].ir_len = 1;
-				jtag_devs[device].ir_prescan = prescan;
-				jtag_devs[device].jd_dev = device;
-			} else
-				/* Otherwise we have another bit in this device's IR */
-				++jtag_devs[device].ir_len;
-			++prescan;
-		}
-		jtag_dev_count = device;
-
-		if (jtag_dev_count > JTAG_MAX_DEVS) {
-			DEBUG_WARN("jtag_scan: Maximum device count exceeded\n");
-			jtag_dev_count = 0;
-			return 0;
-		}
-
-		if (jtag_devs[jtag_dev_count].ir_len > JTAG_MAX_IR_LEN) {
-			DEBUG_WARN("jtag_scan: Maximum IR length exceeded\n");
-			jtag_dev_count = 0;
+		if (!jtag_scan_irs(dev_count)) {
+			jtag_proc.jtagtap_reset();
 			return 0;
 		}
+		jtag_dev_count = dev_count;
 	}
 
 	DEBUG_INFO("Return to Run-Test/Idle\n");
@@ -164,7 +310,7 @@ uint32_t jtag_scan(const uint8_t *irlens)
 	for (; !jtag_proc.jtagtap_next(false, true) && device <= jtag_dev_count; ++device)
 		jtag_devs[device].dr_postscan = jtag_dev_count - device - 1;
 
-	if (device != jtag_dev_count) {
+	if (device != jtag_dev_count || device != dev_count) {
 		DEBUG_WARN("jtag_scan: Sanity check failed: BYPASS dev count doesn't match IR scan\n");
 		jtag_dev_count = 0;
 		return 0;
@@ -173,30 +319,14 @@ uint32_t jtag_scan(const uint8_t *irlens)
 	DEBUG_INFO("Return to Run-Test/Idle\n");
 	jtag_proc.jtagtap_next(true, true);
 	jtagtap_return_idle(1);
-	if (!jtag_dev_count)
-		return 0;
 
 	/* Fill in the ir_postscan fields */
 	for (size_t device = jtag_dev_count - 1; device > 0; --device)
 		jtag_devs[device - 1].ir_postscan = jtag_devs[device].ir_postscan + jtag_devs[device].ir_len;
+	jtag_scan_cache_chain();
 
-	/* Reset jtagtap: should take all devs to IDCODE */
+	/* Reset jtagtap: should take all devs back to IDCODE */
 	jtag_proc.jtagtap_reset();
-	jtagtap_shift_dr();
-	/* Now shift out the ID codes for all the attached devices. */
-	for (size_t device = 0; device < jtag_dev_count; ++device) {
-		if (!jtag_proc.jtagtap_next(false, true))
-			continue;
-		jtag_devs[device].jd_idcode = 1U;
-		for (size_t bit = 1; bit < 32; ++bit) {
-			if (jtag_proc.jtagtap_next(false, true))
-				jtag_devs[device].jd_idcode |= 1U << bit;
-		}
-
-	}
-	DEBUG_INFO("Return to Run-Test/Idle\n");
-	jtag_proc.jtagtap_next(true, true);
-	jtagtap_return_idle(jtag_proc.tap_idle_cycles);
 
 #if PC_HOSTED == 1
 	/*Transfer needed device information to firmware jtag_devs */
@@ -204,30 +334,25 @@ uint32_t jtag_scan(const uint8_t *irlens)
 		platform_add_jtag_dev(device, jtag_devs + device);
 #endif
 
-	for (size_t device = 0; device < jtag_dev_count; ++device) {
-		DEBUG_INFO("IDCode 0x%08" PRIx32, jtag_devs[device].jd_idcode);
-		for (size_t descr = 0; dev_descr[descr].idcode; ++descr) {
-			if ((jtag_devs[device].jd_idcode & dev_descr[descr].idmask) == dev_descr[descr].idcode) {
-				DEBUG_INFO(": %s", dev_descr[descr].descr ? dev_descr[descr].descr : "Unknown");
-				break;
-			}
-		}
-		DEBUG_INFO("\n");
-	}
-
 	/* Check for known devices and handle accordingly */
 	for (size_t device = 0; device < jtag_dev_count; device++) {
-		for (size_t descr = 0; dev_descr[descr].idcode; descr++) {
-			if ((jtag_devs[device].jd_idcode & dev_descr[descr].idmask) == dev_descr[descr].idcode) {
-				jtag_devs[device].current_ir = UINT32_MAX;
-				/* Save description in table */
-				jtag_devs[device].jd_descr = dev_descr[descr].descr;
-				/* Call handler to initialise/probe device further */
-				if (dev_descr[descr].handler)
-					dev_descr[descr].handler(device);
+		DEBUG_INFO("IDCode 0x%08" PRIx32, jtag_devs[device].jd_idcode);
+		size_t descr = 0;
+		for (; dev_descr[descr].idcode; descr++) {
+			if ((jtag_devs[device].jd_idcode & dev_descr[descr].idmask) == dev_descr[descr].idcode)
 				break;
-			}
 		}
+		if (!dev_descr[descr].idcode) {
+			DEBUG_INFO("\n");
+			continue;
+		}
+		DEBUG_INFO(": %s\n", dev_descr[descr].descr ? dev_descr[descr].descr : "Unknown");
+		jtag_devs[device].current_ir = UINT32_MAX;
+		/* Save description in table */
+		jtag_devs[device].jd_descr = dev_descr[descr].descr;
+		/* Call handler to initialise/probe device further */
+		if (dev_descr[descr].handler)
+			dev_descr[descr].handler(device);
 	}
 
 	return jtag_dev_count;
@@ -250,16 +375,37 @@ void jtag_dev_write_ir(jtag_proc_t *jp, const uint8_t jd_index, const uint32_t i
 	jtagtap_return_idle(1);
 }
 
-void jtag_dev_shift_dr(
-	jtag_proc_t *jp, const uint8_t jd_index, uint8_t *dout, const uint8_t *din, const size_t clock_cycles)
+static void jtag_dev_shift_dr_seq(jtag_proc_t *jp, const uint8_t jd_index, uint8_t *dout, const uint8_t *din,
+	const size_t clock_cycles, const bool deferred)
 {
 	jtag_dev_t *d = &jtag_devs[jd_index];
 	jtagtap_shift_dr();
 	jp->jtagtap_tdi_seq(false, ones, d->dr_prescan);
-	if (dout)
+	if (dout && deferred)
+		jp->jtagtap_tdi_tdo_seq_deferred(dout, !d->dr_postscan, din, clock_cycles);
+	else if (dout)
 		jp->jtagtap_tdi_tdo_seq((uint8_t *)dout, !d->dr_postscan, (const uint8_t *)din, clock_cycles);
 	else
 		jp->jtagtap_tdi_seq(!d->dr_postscan, (const uint8_t *)din, clock_cycles);
 	jp->jtagtap_tdi_seq(true, ones, d->dr_postscan);
 	jtagtap_return_idle(1);
 }
+
+void jtag_dev_shift_dr(
+	jtag_proc_t *jp, const uint8_t jd_index, uint8_t *dout, const uint8_t *din, const size_t clock_cycles)
+{
+	jtag_dev_shift_dr_seq(jp, jd_index, dout, din, clock_cycles, false);
+}
+
+/* Where the adaptor can't defer captures, dout is simply valid straight away */
+void jtag_dev_shift_dr_deferred(
+	jtag_proc_t *jp, const uint8_t jd_index, uint8_t *dout, const uint8_t *din, const size_t clock_cycles)
+{
+	jtag_dev_shift_dr_seq(jp, jd_index, dout, din, clock_cycles, jp->jtagtap_tdi_tdo_seq_deferred != NULL);
+}
+
+void jtag_flush(jtag_proc_t *jp)
+{
+	if (jp->jtagtap_flush)
+		jp->jtagtap_flush();
+}
@@ -47,6 +47,9 @@ extern uint32_t jtag_dev_count;
 
 void jtag_dev_write_ir(jtag_proc_t *jp, uint8_t jd_index, uint32_t ir);
 void jtag_dev_shift_dr(jtag_proc_t *jp, uint8_t jd_index, uint8_t *dout, const uint8_t *din, size_t ticks);
+/* As jtag_dev_shift_dr(), but dout is only guaranteed to be written after jtag_flush() */
+void jtag_dev_shift_dr_deferred(jtag_proc_t *jp, uint8_t jd_index, uint8_t *dout, const uint8_t *din, size_t ticks);
+void jtag_flush(jtag_proc_t *jp);
 void jtag_add_device(uint32_t dev_index, const jtag_dev_t *jtag_dev);
 
 #endif /*__JTAG_SCAN_H*/
@@ -74,6 +74,8 @@
 #define FTFx_FSTAT_FPVIOL   (1 << 4)
 #define FTFx_FSTAT_MGSTAT0  (1 << 0)
 
+#define FTFx_FCNFG_RAMRDY (1 << 1)
+
 #define FTFx_FSEC_KEYEN_MSK (0b11 << 6)
 #define FTFx_FSEC_KEYEN     (0b10 << 6)
 
@@ -84,6 +86,7 @@
 /* Part of the FTFE module for K64 */
 #define FTFx_CMD_PROGRAM_PHRASE  0x07
 #define FTFx_CMD_ERASE_SECTOR    0x09
+#define FTFx_CMD_PROGRAM_SECTION 0x0b
 #define FTFx_CMD_CHECK_ERASE_ALL 0x40
 #define FTFx_CMD_READ_ONCE       0x41
 #define FTFx_CMD_PROGRAM_ONCE    0x43
@@ -94,6 +97,10 @@
 /* 8 byte phrases need to be written to the k64 flash */
 #define K64_WRITE_LEN 8
 
+/* FlexRAM, when not used for EEPROM, is the section programming buffer. It's at least 2 KB on those parts */
+#define FLEXRAM_BASE 0x14000000U
+#define FLEXRAM_SIZE 0x800U
+
 static bool kinetis_cmd_unsafe(target *t, int argc, char **argv);
 
 const struct command_s kinetis_cmd_list[] = {
@@ -114,10 +121,12 @@ static bool kinetis_cmd_unsafe(target *t, int argc, char **argv)
 static int kinetis_flash_cmd_erase(struct target_flash *f, target_addr addr, size_t len);
 static int kinetis_flash_cmd_write(struct target_flash *f, target_addr dest, const void *src, size_t len);
 static int kinetis_flash_done(struct target_flash *f);
+static bool kinetis_flash_blank_check(struct target_flash *f, target_addr addr, size_t len);
 
 struct kinetis_flash {
 	struct target_flash f;
 	uint8_t write_len;
+	bool program_section;
 };
 
 static void kinetis_add_flash(
@@ -138,11 +147,22 @@ static void kinetis_add_flash(
 	f->erase = kinetis_flash_cmd_erase;
 	f->write = kinetis_flash_cmd_write;
 	f->done = kinetis_flash_done;
+	f->blank_check = kinetis_flash_blank_check;
 	f->erased = 0xff;
 	kf->write_len = write_len;
 	target_add_flash(t, f);
 }
 
+/* Parts with the FTFE or FTFC module program whole sections at a time out of FlexRAM */
+static void kinetis_flash_program_sections(target *const t)
+{
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		struct kinetis_flash *const kf = (struct kinetis_flash *)f;
+		kf->program_section = true;
+		f->buf_size = MIN(f->blocksize, FLEXRAM_SIZE);
+	}
+}
+
 static void kl_s32k14_setup(
 	target *const t, const uint32_t sram_l, const uint32_t sram_h, const size_t flash_size, const size_t flexmem_size)
 {
@@ -152,6 +172,7 @@ static void kl_s32k14_setup(
 
 	kinetis_add_flash(t, 0x00000000, flash_size, 0x1000, K64_WRITE_LEN);   /* P-Flash, 4 KB Sectors */
 	kinetis_add_flash(t, 0x10000000, flexmem_size, 0x1000, K64_WRITE_LEN); /* FlexNVM, 4 KB Sectors */
+	kinetis_flash_program_sections(t);
 }
 
 bool kinetis_probe(target *const t)
@@ -289,6 +310,7 @@ bool kinetis_probe(target *const t)
 		target_add_ram(t, 0x20000000, 0x30000);
 		kinetis_add_flash(t, 0, 0x80000, 0x1000, K64_WRITE_LEN);
 		kinetis_add_flash(t, 0x80000, 0x80000, 0x1000, K64_WRITE_LEN);
+		kinetis_flash_program_sections(t);
 		break;
 	case 0x000: /* Older K-series */
 		switch (sdid & 0xff0) {
@@ -354,6 +376,7 @@ bool kinetis_probe(target *const t)
 		target_add_ram(t, 0x20000000, 0x00005800);                          /* SRAM_H, 22 KB */
 		kinetis_add_flash(t, 0x00000000, 0x00040000, 0x800, K64_WRITE_LEN); /* P-Flash, 256 KB, 2 KB Sectors */
 		kinetis_add_flash(t, 0x10000000, 0x00008000, 0x800, K64_WRITE_LEN); /* FlexNVM, 32 KB, 2 KB Sectors */
+		kinetis_flash_program_sections(t);
 		break;
 	/* gen1 s32k14x */
 	case 0x142: /* S32K142 */
@@ -449,6 +472,36 @@ static int kinetis_flash_cmd_erase(struct target_flash *const f, target_addr add
 	return 0;
 }
 
+/* Use the FTFx "Read 1s Section" command, MGSTAT0 is set if anything isn't erased */
+static bool kinetis_flash_blank_check(struct target_flash *const f, const target_addr addr, const size_t len)
+{
+	const struct kinetis_flash *const kf = (struct kinetis_flash *)f;
+	/* FCCOB4-5 hold the number of longwords (phrases on FTFE) to check, FCCOB6 the margin level */
+	const uint32_t units = len / kf->write_len;
+	const uint32_t param = (units & 0xffffU) << 16U;
+	if (!units || units > 0xffffU || !kinetis_fccob_cmd(f->t, FTFx_CMD_CHECK_ERASE, addr, &param, 1))
+		return false;
+	return !(target_mem_read8(f->t, FTFx_FSTAT) & FTFx_FSTAT_MGSTAT0);
+}
+
+/* Load a whole section into FlexRAM and program it with one command, rather than one command per phrase */
+static int kinetis_flash_write_sections(struct target_flash *const f, target_addr dest, const uint8_t *src, size_t len)
+{
+	const struct kinetis_flash *const kf = (struct kinetis_flash *)f;
+	while (len) {
+		const size_t section_len = MIN(len, FLEXRAM_SIZE);
+		target_mem_write(f->t, FLEXRAM_BASE, src, section_len);
+		/* FCCOB4-5 hold the number of longwords (phrases on FTFE/FTFC) to program */
+		const uint32_t param = (section_len / kf->write_len) << 16U;
+		if (!kinetis_fccob_cmd(f->t, FTFx_CMD_PROGRAM_SECTION, dest, &param, 1))
+			return 1;
+		dest += section_len;
+		src += section_len;
+		len -= section_len;
+	}
+	return 0;
+}
+
 static int kinetis_flash_cmd_write(struct target_flash *f, target_addr dest, const void *src, size_t len)
 {
 	struct kinetis_flash *const kf = (struct kinetis_flash *)f;
@@ -458,6 +511,11 @@ static int kinetis_flash_cmd_write(struct target_flash *f, target_addr dest, con
 		((uint8_t *)src)[FLASH_SECURITY_BYTE_ADDRESS - dest] = FLASH_SECURITY_BYTE_UNSECURED;
 	}
 
+	/* Sections can't be used while FlexRAM is set up as EEPROM */
+	if (kf->program_section && len % kf->write_len == 0 &&
+		(target_mem_read8(f->t, FTFx_FCNFG) & FTFx_FCNFG_RAMRDY))
+		return kinetis_flash_write_sections(f, dest, src, len);
+
 	/* Determine write command based on the alignment. */
 	uint8_t write_cmd;
 	if (kf->write_len == K64_WRITE_LEN)
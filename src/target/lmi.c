@@ -28,9 +28,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
-
-#define SRAM_BASE            0x20000000
-#define STUB_BUFFER_BASE     ALIGN(SRAM_BASE + sizeof(lmi_flash_write_stub), 4)
+#include "flashloader.h"
 
 #define BLOCK_SIZE           0x400
 
@@ -52,6 +50,7 @@
 
 #define LMI_FLASH_BASE       0x400FD000
 #define LMI_FLASH_FMA        (LMI_FLASH_BASE + 0x000)
+#define LMI_FLASH_FMD        (LMI_FLASH_BASE + 0x004)
 #define LMI_FLASH_FMC        (LMI_FLASH_BASE + 0x008)
 
 #define LMI_FLASH_FMC_WRITE  (1 << 0)
@@ -185,12 +184,30 @@ static int lmi_flash_write(struct target_flash *f, target_addr dest, const void
 {
 	target  *t = f->t;
 	target_check_error(t);
-	target_mem_write(t, SRAM_BASE, lmi_flash_write_stub, sizeof(lmi_flash_write_stub));
-	target_mem_write(t, STUB_BUFFER_BASE, src, len);
-	if (target_check_error(t))
-		return -1;
 
-	return cortexm_run_stub(t, SRAM_BASE, dest, STUB_BUFFER_BASE, len, 0);
+	/* Stream the block through the loader, which programs while the rest arrives */
+	static const struct flashloader_params loader_params = {
+		.width = 4U,
+		.sr_addr = LMI_FLASH_FMC,
+		.busy_mask = LMI_FLASH_FMC_WRITE,
+		.stub = lmi_flash_write_stub,
+		.stub_len = sizeof(lmi_flash_write_stub),
+	};
+	const int loader = flashloader_write(t, &loader_params, dest, src, len);
+	if (loader <= 0)
+		return loader;
+
+	/* Otherwise a word at a time through the debug port */
+	const uint32_t *data = src;
+	for (size_t offset = 0; offset < len; offset += 4U) {
+		target_mem_write32(t, LMI_FLASH_FMA, dest + offset);
+		target_mem_write32(t, LMI_FLASH_FMD, data[offset / 4U]);
+		target_mem_write32(t, LMI_FLASH_FMC, LMI_FLASH_FMC_WRKEY | LMI_FLASH_FMC_WRITE);
+		cortexm_mem_wait32(t, LMI_FLASH_FMC, LMI_FLASH_FMC_WRITE);
+		if (target_check_error(t))
+			return -1;
+	}
+	return 0;
 }
 
 static bool lmi_mass_erase(target *t)
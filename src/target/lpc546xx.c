@@ -178,6 +178,7 @@ static void lpc546xx_reset_attach(target *t)
 static bool lpc546xx_mass_erase(target *t)
 {
 	const int result = lpc546xx_flash_erase(t->flash, t->flash->start, t->flash->length);
+	lpc_flash_done(t->flash);
 	if (result != 0)
 		tc_printf(t, "Error erasing flash: %d\n", result);
 	return result == 0;
@@ -189,6 +190,7 @@ static bool lpc546xx_cmd_erase_sector(target *t, int argc, const char *argv[])
 		uint32_t sector_addr = strtoul(argv[1], NULL, 0);
 		sector_addr *= t->flash->blocksize;
 		int retval = lpc546xx_flash_erase(t->flash, sector_addr, 1);
+		lpc_flash_done(t->flash);
 		return retval == 0;
 	}
 	return -1;
@@ -260,6 +262,7 @@ static bool lpc546xx_cmd_write_sector(target *t, int argc, const char *argv[])
 
 		int retval = lpc546xx_flash_erase(t->flash, sector_addr, 1);
 		if (retval != 0) {
+			lpc_flash_done(t->flash);
 			return retval;
 		}
 
@@ -270,6 +273,7 @@ static bool lpc546xx_cmd_write_sector(target *t, int argc, const char *argv[])
 
 		retval = lpc_flash_write_magic_vect(t->flash, sector_addr, buf,
 						    sector_size);
+		lpc_flash_done(t->flash);
 
 		free(buf);
 
@@ -24,14 +24,35 @@
 
 #include <stdarg.h>
 
-struct flash_param {
-	uint16_t opcode;
-	uint16_t pad0;
+/* One IAP command as the chain stub hands it to the ROM */
+struct iap_op {
 	uint32_t command;
 	uint32_t words[4];
 	uint32_t status;
 	uint32_t result[4];
-} __attribute__((aligned(4)));
+};
+
+static const uint16_t lpc_iap_stub[] = {
+#include "flashstub/lpc_iap.stub"
+};
+
+/* Most commands run in one go: prepare, copy and compare */
+#define IAP_CHAIN_MAX  3U
+#define IAP_OPS_OFFSET ALIGN(sizeof(lpc_iap_stub), 4)
+/* Stub and commands, the staging buffer for the copies follows */
+#define IAP_AREA_SIZE  (IAP_OPS_OFFSET + IAP_CHAIN_MAX * sizeof(struct iap_op))
+
+/* The compare is unreliable over the first 512 bytes, which the boot ROM may be mapped over */
+#define IAP_COMPARE_MIN_ADDR 0x200U
+
+/* Target state saved at the first IAP run of a Flash session and put back when it is done */
+struct lpc_iap_session {
+	target *t;
+	uint8_t ram[IAP_AREA_SIZE];
+	uint32_t regs[];
+};
+
+static struct lpc_iap_session *lpc_iap_session;
 
 char *iap_error[] = {
 	"CMD_SUCCESS",
@@ -72,6 +93,7 @@ char *iap_error[] = {
 
 static int lpc_flash_write(struct target_flash *tf,
 						   target_addr dest, const void *src, size_t len);
+static bool lpc_flash_blank_check(struct target_flash *tf, target_addr addr, size_t len);
 
 struct lpc_flash *lpc_add_flash(target *t, target_addr addr, size_t length)
 {
@@ -88,6 +110,8 @@ struct lpc_flash *lpc_add_flash(target *t, target_addr addr, size_t length)
 	f->length = length;
 	f->erase = lpc_flash_erase;
 	f->write = lpc_flash_write;
+	f->blank_check = lpc_flash_blank_check;
+	f->done = lpc_flash_done;
 	f->erased = 0xff;
 	target_add_flash(t, f);
 	return lf;
@@ -105,49 +129,88 @@ static inline bool lpc_is_full_erase(struct lpc_flash *f, const uint32_t begin,
 	return begin == lpc_sector_for_addr(f, addr) && end == lpc_sector_for_addr(f, addr + len - 1U);
 }
 
-enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd, ...)
+/* Saving the IAP RAM and registers once for the session rather than around every run */
+static void lpc_iap_session_begin(struct lpc_flash *f)
 {
 	target *t = f->f.t;
-	struct flash_param param = {
-		.opcode = ARM_THUMB_BREAKPOINT,
-		.command = cmd,
-	};
+	if (lpc_iap_session) {
+		if (lpc_iap_session->t == t)
+			return;
+		/* Left over from a session on a target no longer attached */
+		free(lpc_iap_session);
+	}
+	lpc_iap_session = malloc(sizeof(*lpc_iap_session) + t->regs_size);
+	if (!lpc_iap_session) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return;
+	}
+	lpc_iap_session->t = t;
+	target_mem_read(t, lpc_iap_session->ram, f->iap_ram, sizeof(lpc_iap_session->ram));
+	target_regs_read(t, lpc_iap_session->regs);
+}
+
+int lpc_flash_done(struct target_flash *tf)
+{
+	struct lpc_flash *f = (struct lpc_flash *)tf;
+	struct lpc_iap_session *const session = lpc_iap_session;
+	if (!session || session->t != tf->t)
+		return 0;
+	lpc_iap_session = NULL;
+	/* restore the original data in RAM and registers */
+	target_mem_write(tf->t, f->iap_ram, session->ram, sizeof(session->ram));
+	target_regs_write(tf->t, session->regs);
+	free(session);
+	return 0;
+}
 
-	/* Pet WDT before each IAP call, if it is on */
+/*
+ * Run count IAP commands in one go through the chain stub, which stops at the
+ * first one that fails. Returns the number of commands that succeeded, the
+ * status of the failed one is left in it.
+ */
+static size_t lpc_iap_run(struct lpc_flash *f, struct iap_op *ops, const size_t count)
+{
+	target *t = f->f.t;
+
+	/* Pet WDT before each IAP run, if it is on */
 	if (f->wdt_kick)
 		f->wdt_kick(t);
 
-	/* save IAP RAM to restore after IAP call */
-	struct flash_param backup_param;
-	target_mem_read(t, &backup_param, f->iap_ram, sizeof(backup_param));
-
-	/* save registers to restore after IAP call */
+	/* save IAP RAM and registers to restore after the run, unless the session does */
+	const bool in_session = lpc_iap_session && lpc_iap_session->t == t;
+	uint8_t backup_ram[IAP_AREA_SIZE];
 	uint32_t backup_regs[t->regs_size / sizeof(uint32_t)];
-	target_regs_read(t, backup_regs);
-
-	/* fill out the remainder of the parameters */
-	va_list ap;
-	va_start(ap, cmd);
-	for (int i = 0; i < 4; i++)
-		param.words[i] = va_arg(ap, uint32_t);
-	va_end(ap);
+	if (in_session)
+		memcpy(backup_regs, lpc_iap_session->regs, t->regs_size);
+	else {
+		target_mem_read(t, backup_ram, f->iap_ram, sizeof(backup_ram));
+		target_regs_read(t, backup_regs);
+	}
 
-	/* copy the structure to RAM */
-	target_mem_write(t, f->iap_ram, &param, sizeof(param));
+	/* copy the stub and the commands to RAM, each marked as not yet run */
+	uint8_t area[IAP_AREA_SIZE] = {0};
+	memcpy(area, lpc_iap_stub, sizeof(lpc_iap_stub));
+	bool full_erase = false;
+	for (size_t i = 0; i < count; ++i) {
+		ops[i].status = IAP_STATUS_BUSY;
+		if (ops[i].command == IAP_CMD_ERASE && lpc_is_full_erase(f, ops[i].words[0], ops[i].words[1]))
+			full_erase = true;
+	}
+	memcpy(area + IAP_OPS_OFFSET, ops, count * sizeof(*ops));
+	target_mem_write(t, f->iap_ram, area, IAP_OPS_OFFSET + count * sizeof(*ops));
 
-	/* set up for the call to the IAP ROM */
+	/* set up for the run of the chain, the stub's registers are described in lpc_iap.s */
 	uint32_t regs[t->regs_size / sizeof(uint32_t)];
-	target_regs_read(t, regs);
-	regs[0] = f->iap_ram + offsetof(struct flash_param, command);
-	regs[1] = f->iap_ram + offsetof(struct flash_param, status);
+	memcpy(regs, backup_regs, sizeof(regs));
+	regs[4] = f->iap_ram + IAP_OPS_OFFSET;
+	regs[5] = count;
+	regs[6] = f->iap_entry | 1U;
 	regs[REG_MSP] = f->iap_msp;
-	regs[REG_LR] = f->iap_ram | 1;
-	regs[REG_PC] = f->iap_entry;
+	regs[REG_PC] = f->iap_ram;
 	target_regs_write(t, regs);
 
 	platform_timeout timeout;
 	platform_timeout_set(&timeout, 500);
-	const bool full_erase = cmd == IAP_CMD_ERASE && lpc_is_full_erase(f, param.words[0], param.words[1]);
 	/* start the target and wait for it to halt again */
 	target_halt_resume(t, false);
 	while (!target_halt_poll(t, NULL)) {
@@ -155,34 +218,71 @@ enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd
 			target_print_progress(&timeout);
 	}
 
-	/* copy back just the parameters structure */
-	target_mem_read(t, &param, f->iap_ram, sizeof(param));
+	/* copy back just the commands with their status and results */
+	target_mem_read(t, ops, f->iap_ram + IAP_OPS_OFFSET, count * sizeof(*ops));
 
-	/* restore the original data in RAM and registers */
-	target_mem_write(t, f->iap_ram, &backup_param, sizeof(param));
-	target_regs_write(t, backup_regs);
+	if (!in_session) {
+		/* restore the original data in RAM and registers */
+		target_mem_write(t, f->iap_ram, backup_ram, sizeof(backup_ram));
+		target_regs_write(t, backup_regs);
+	}
 
-	/* if the user expected a result, set the result (16 bytes). */
-	if (result != NULL)
-		memcpy(result, param.result, sizeof(param.result));
+	size_t completed = 0;
+	while (completed < count && ops[completed].status == IAP_STATUS_CMD_SUCCESS)
+		++completed;
 
 #if defined(ENABLE_DEBUG)
-	if (param.status != IAP_STATUS_CMD_SUCCESS) {
-		if (param.status > (sizeof(iap_error) / sizeof(char*)))
-			DEBUG_WARN("IAP  cmd %d : %" PRIu32 "\n", cmd, param.status);
+	if (completed < count) {
+		const struct iap_op *op = &ops[completed];
+		if (op->status > (sizeof(iap_error) / sizeof(char*)))
+			DEBUG_WARN("IAP  cmd %" PRIu32 " : %" PRIu32 "\n", op->command, op->status);
 		else
-			DEBUG_WARN("IAP  cmd %d : %s\n", cmd, iap_error[param.status]);
+			DEBUG_WARN("IAP  cmd %" PRIu32 " : %s\n", op->command, iap_error[op->status]);
 		DEBUG_WARN("return parameters: %08" PRIx32 " %08" PRIx32 " %08" PRIx32
-				   " %08" PRIx32 "\n", param.result[0],
-				   param.result[1], param.result[2], param.result[3]);
+				   " %08" PRIx32 "\n", op->result[0],
+				   op->result[1], op->result[2], op->result[3]);
 	}
 #endif
-	return param.status;
+	return completed;
+}
+
+enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd, ...)
+{
+	struct iap_op op = {
+		.command = cmd,
+	};
+
+	/* fill out the remainder of the parameters */
+	va_list ap;
+	va_start(ap, cmd);
+	for (int i = 0; i < 4; i++)
+		op.words[i] = va_arg(ap, uint32_t);
+	va_end(ap);
+
+	lpc_iap_run(f, &op, 1);
+
+	/* if the user expected a result, set the result (16 bytes). */
+	if (result != NULL)
+		memcpy(result, op.result, sizeof(op.result));
+	return op.status;
 }
 
 #define LPX80X_SECTOR_SIZE 0x400
 #define LPX80X_PAGE_SIZE    0x40
 
+/* IAP blank check works on whole sectors, which is what the generic erase code asks about */
+static bool lpc_flash_blank_check(struct target_flash *tf, target_addr addr, size_t len)
+{
+	struct lpc_flash *f = (struct lpc_flash *)tf;
+	/* LPC80x reserved pages are never erased, so leave that sector to lpc_flash_erase() */
+	if (f->reserved_pages && addr + len >= tf->length - 0x400U)
+		return false;
+	const uint32_t start = lpc_sector_for_addr(f, addr);
+	const uint32_t end = lpc_sector_for_addr(f, addr + len - 1U);
+	lpc_iap_session_begin(f);
+	return lpc_iap_call(f, NULL, IAP_CMD_BLANKCHECK, start, end, f->bank) == IAP_STATUS_CMD_SUCCESS;
+}
+
 int lpc_flash_erase(struct target_flash *tf, target_addr addr, size_t len)
 {
 	struct lpc_flash *f = (struct lpc_flash *)tf;
@@ -190,71 +290,85 @@ int lpc_flash_erase(struct target_flash *tf, target_addr addr, size_t len)
 	const uint32_t end = lpc_sector_for_addr(f, addr + len - 1U);
 	uint32_t last_full_sector = end;
 
-	if (lpc_iap_call(f, NULL, IAP_CMD_PREPARE, start, end, f->bank))
-		return -1;
+	lpc_iap_session_begin(f);
 
 	/* Only LPC80x has reserved pages!*/
 	if (f->reserved_pages && addr + len >= tf->length - 0x400U)
 		--last_full_sector;
 
 	if (start <= last_full_sector) {
-		/* Sector erase */
-		if (lpc_iap_call(f, NULL, IAP_CMD_ERASE, start, last_full_sector, CPU_CLK_KHZ, f->bank))
-			return -2;
-
-		/* check erase ok */
-		if (lpc_iap_call(f, NULL, IAP_CMD_BLANKCHECK, start, last_full_sector, f->bank))
-			return -3;
+		/* Sector erase, then check erase ok */
+		struct iap_op ops[] = {
+			{.command = IAP_CMD_PREPARE, .words = {start, last_full_sector, f->bank}},
+			{.command = IAP_CMD_ERASE, .words = {start, last_full_sector, CPU_CLK_KHZ, f->bank}},
+			{.command = IAP_CMD_BLANKCHECK, .words = {start, last_full_sector, f->bank}},
+		};
+		const size_t count = sizeof(ops) / sizeof(ops[0]);
+		const size_t completed = lpc_iap_run(f, ops, count);
+		if (completed < count)
+			return -1 - (int)completed;
 	}
 
 	if (last_full_sector != end) {
 		const uint32_t page_start = (addr + len - LPX80X_SECTOR_SIZE) / LPX80X_PAGE_SIZE;
 		const uint32_t page_end = page_start + LPX80X_SECTOR_SIZE / LPX80X_PAGE_SIZE - 1 - f->reserved_pages;
 
-		if (lpc_iap_call(f, NULL, IAP_CMD_PREPARE, end, end, f->bank))
-			return -1;
-
-		if (lpc_iap_call(f, NULL, IAP_CMD_ERASE_PAGE, page_start, page_end, CPU_CLK_KHZ, f->bank))
-			return -2;
+		struct iap_op ops[] = {
+			{.command = IAP_CMD_PREPARE, .words = {end, end, f->bank}},
+			{.command = IAP_CMD_ERASE_PAGE, .words = {page_start, page_end, CPU_CLK_KHZ, f->bank}},
+		};
 		/* Blank check omitted!*/
+		const size_t count = sizeof(ops) / sizeof(ops[0]);
+		const size_t completed = lpc_iap_run(f, ops, count);
+		if (completed < count)
+			return -1 - (int)completed;
 	}
 	return 0;
 }
 
+/* Prepare the sector, copy the staged data to it and compare, in a single run */
+static int lpc_flash_program(struct lpc_flash *f, uint32_t sector, target_addr dest, uint32_t bufaddr, size_t len)
+{
+	struct iap_op ops[] = {
+		{.command = IAP_CMD_PREPARE, .words = {sector, sector, f->bank}},
+		{.command = IAP_CMD_PROGRAM, .words = {dest, bufaddr, len, CPU_CLK_KHZ}},
+		{.command = IAP_CMD_COMPARE, .words = {dest, bufaddr, len}},
+	};
+	const size_t count = dest < IAP_COMPARE_MIN_ADDR ? 2U : 3U;
+	const size_t completed = lpc_iap_run(f, ops, count);
+	if (completed == count)
+		return 0;
+	if (!completed)
+		DEBUG_WARN("Prepare failed\n");
+	return -1 - (int)completed;
+}
+
 static int lpc_flash_write(struct target_flash *tf,
                     target_addr dest, const void *src, size_t len)
 {
 	struct lpc_flash *f = (struct lpc_flash *)tf;
-	/* prepare... */
 	uint32_t sector = lpc_sector_for_addr(f, dest);
-	if (lpc_iap_call(f, NULL, IAP_CMD_PREPARE, sector, sector, f->bank)) {
-		DEBUG_WARN("Prepare failed\n");
-		return -1;
-	}
-	uint32_t bufaddr = ALIGN(f->iap_ram + sizeof(struct flash_param), 4);
+	/* The staging buffer follows the stub and its commands */
+	uint32_t bufaddr = f->iap_ram + IAP_AREA_SIZE;
+	lpc_iap_session_begin(f);
+	/* Write payload to target ram */
 	target_mem_write(f->f.t, bufaddr, src, len);
 	/* Only LPC80x has reserved pages!*/
 	if ((!f->reserved_pages) || ((dest + len) <= (tf->length - len))) {
-		/* Write payload to target ram */
 		/* set the destination address and program */
-		if (lpc_iap_call(f, NULL, IAP_CMD_PROGRAM, dest, bufaddr, len, CPU_CLK_KHZ))
-			return -2;
-	} else {
-		/* On LPC80x, write top sector in pages.
-		 * Silently ignore write to the 2 reserved pages at top!*/
-		len -= 0x40 * f->reserved_pages;
-		while (len) {
-			if (lpc_iap_call(f, NULL, IAP_CMD_PREPARE, sector, sector, f->bank)) {
-				DEBUG_WARN("Prepare failed\n");
-				return -1;
-			}
-			/* set the destination address and program */
-			if (lpc_iap_call(f, NULL, IAP_CMD_PROGRAM, dest, bufaddr, LPX80X_PAGE_SIZE, CPU_CLK_KHZ))
-				return -2;
-			dest += LPX80X_PAGE_SIZE;
-			bufaddr += LPX80X_PAGE_SIZE;
-			len -= LPX80X_PAGE_SIZE;
-		}
+		return lpc_flash_program(f, sector, dest, bufaddr, len);
+	}
+	/* On LPC80x, write top sector in pages.
+	 * Silently ignore write to the 2 reserved pages at top!*/
+	len -= 0x40 * f->reserved_pages;
+	while (len) {
+		/* set the destination address and program */
+		const int result = lpc_flash_program(f, sector, dest, bufaddr, LPX80X_PAGE_SIZE);
+		if (result)
+			return result;
+		dest += LPX80X_PAGE_SIZE;
+		bufaddr += LPX80X_PAGE_SIZE;
+		len -= LPX80X_PAGE_SIZE;
 	}
 	return 0;
 }
@@ -83,6 +83,8 @@ struct lpc_flash {
 struct lpc_flash *lpc_add_flash(target *t, target_addr addr, size_t length);
 enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd, ...);
 int lpc_flash_erase(struct target_flash *f, target_addr addr, size_t len);
+/* Ends the Flash session, putting back the RAM and registers the IAP runs used */
+int lpc_flash_done(struct target_flash *f);
 int lpc_flash_write_magic_vect(struct target_flash *f,
                                target_addr dest, const void *src, size_t len);
 
@@ -92,7 +92,7 @@
 #define SRAM_STACK_OFFSET 0x00000200u /* A bit less than 512 stack room */
 #define SRAM_STACK_PTR (SRAM_BASE + SRAM_STACK_OFFSET)
 #define SRAM_WRITE_BUFFER SRAM_STACK_PTR /* Buffer right above stack */
-#define SRAM_WRITE_BUF_SIZE 0x00000400u  /* Write 1024 bytes at a tima */
+#define SRAM_WRITE_BUF_SIZE SECTOR_SIZE  /* Write a whole sector at a time */
 
 /* Watchdog */
 #define WDT_A_WTDCTL 0x4000480Cu /* Control register for watchdog */
@@ -107,18 +107,25 @@ struct msp432_flash
 	target_addr FlashCtl_programMemory; /* Flash programming routine in ROM */
 };
 
+/* The ROM call trampoline, set up once and kept while programming */
+struct msp432_priv {
+	bool prepared;
+	uint32_t regs[]; /* Registers the calls start from */
+};
+
 /* Flash operations */
 static bool msp432_sector_erase(struct target_flash *f, target_addr addr);
 static int msp432_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int msp432_flash_write(struct target_flash *f, target_addr dest,
 			      const void *src, size_t len);
+static int msp432_flash_done(struct target_flash *f);
 
 /* Utility functions */
 /* Find the the target flash that conatins a specific address */
 static struct target_flash *get_target_flash(target *t, target_addr addr);
 
-/* Call a subroutine in the MSP432 ROM (or anywhere else...)*/
-static void msp432_call_ROM(target *t, uint32_t address, uint32_t regs[]);
+/* Call a subroutine in the MSP432 ROM (or anywhere else...), returning R0 */
+static uint32_t msp432_call_ROM(target *t, uint32_t address, uint32_t r0, uint32_t r1, uint32_t r2);
 
 /* Protect or unprotect the sector containing address */
 static inline uint32_t msp432_sector_unprotect(struct msp432_flash *mf, target_addr addr)
@@ -160,6 +167,7 @@ static void msp432_add_flash(target *t, uint32_t addr, size_t length, target_add
 	f->blocksize = SECTOR_SIZE;
 	f->erase = msp432_flash_erase;
 	f->write = msp432_flash_write;
+	f->done = msp432_flash_done;
 	f->buf_size = SRAM_WRITE_BUF_SIZE;
 	f->erased = 0xff;
 	target_add_flash(t, f);
@@ -210,6 +218,15 @@ bool msp432_probe(target *t)
 		/* Unknown device, not an MSP432 or not a real TLV */
 		return false;
 	}
+	struct msp432_priv *priv = calloc(1, sizeof(*priv) + t->regs_size);
+	if (!priv) {			/* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return false;
+	}
+	t->target_storage = priv;
+	/* Each sector is erased by ROM call just before its data goes in */
+	t->flash_erase_ahead = true;
+
 	/* SRAM region, SRAM zone */
 	target_add_ram(t, SRAM_BASE, target_mem_read32(t, SYS_SRAM_SIZE));
 	/* Flash bank size */
@@ -242,23 +259,18 @@ static bool msp432_sector_erase(struct target_flash *f, target_addr addr)
 	DEBUG_WARN("Flash protect: 0x%08"PRIX32"\n",
 			   target_mem_read32(t, mf->flash_protect_register));
 
-	/* Prepare input data */
-	uint32_t regs[t->regs_size / sizeof(uint32_t)]; // Use of VLA
-	target_regs_read(t, regs);
-	regs[0] = addr; // Address of sector to erase in R0
-
 	DEBUG_INFO("Erasing sector at 0x%08"PRIX32"\n", addr);
 
-	/* Call ROM */
-	msp432_call_ROM(t, mf->FlashCtl_eraseSector, regs);
+	/* Call ROM, address of sector to erase in R0 */
+	const uint32_t result = msp432_call_ROM(t, mf->FlashCtl_eraseSector, addr, 0, 0);
 
 	// Result value in R0 is true for success
-	DEBUG_INFO("ROM return value: %"PRIu32"\n", regs[0]);
+	DEBUG_INFO("ROM return value: %"PRIu32"\n", result);
 
 	/* Restore original protection */
 	target_mem_write32(t, mf->flash_protect_register, old_prot);
 
-	return !regs[0];
+	return !result;
 }
 
 /* Erase from addr for len bytes */
@@ -269,7 +281,7 @@ static int msp432_flash_erase(struct target_flash *f, target_addr addr, size_t l
 		ret |= msp432_sector_erase(f, addr);
 
 		/* update len and addr */
-		len -= f->blocksize;
+		addr += f->blocksize;
 		if (len > f->blocksize)
 			len -= f->blocksize;
 		else
@@ -295,23 +307,24 @@ static int msp432_flash_write(struct target_flash *f, target_addr dest,
 	DEBUG_WARN("Flash protect: 0x%08"PRIX32"\n",
 			   target_mem_read32(t, mf->flash_protect_register));
 
-	/* Prepare input data */
-	uint32_t regs[t->regs_size / sizeof(uint32_t)]; // Use of VLA
-	target_regs_read(t, regs);
-	regs[0] = SRAM_WRITE_BUFFER; // Address of buffer to be flashed in R0
-	regs[1] = dest;              // Flash address to be write to in R1
-	regs[2] = len;               // Size of buffer to be flashed in R2
-
-	DEBUG_INFO("Writing 0x%04" PRIX32 " bytes at 0x%08zu\n", dest, len);
-	/* Call ROM */
-	msp432_call_ROM(t, mf->FlashCtl_programMemory, regs);
+	DEBUG_INFO("Writing 0x%04zx bytes at 0x%08" PRIX32 "\n", len, dest);
+	/* Call ROM with the buffer in R0, the Flash address in R1 and the size in R2 */
+	const uint32_t result = msp432_call_ROM(t, mf->FlashCtl_programMemory, SRAM_WRITE_BUFFER, dest, len);
 
 	/* Restore original protection */
 	target_mem_write32(t, mf->flash_protect_register, old_prot);
 
-	DEBUG_INFO("ROM return value: %"PRIu32"\n", regs[0]);
+	DEBUG_INFO("ROM return value: %"PRIu32"\n", result);
 	// Result value in R0 is true for success
-	return !regs[0];
+	return !result;
+}
+
+/* The target may run again after this, so the next call sets up afresh */
+static int msp432_flash_done(struct target_flash *f)
+{
+	struct msp432_priv *priv = f->t->target_storage;
+	priv->prepared = false;
+	return 0;
 }
 
 /* Optional commands handlers */
@@ -333,6 +346,7 @@ static bool msp432_cmd_erase_main(target *t, int argc, const char **argv)
 	f = get_target_flash(t, MAIN_FLASH_BASE + banksize);
 	ret |= msp432_flash_erase(f, MAIN_FLASH_BASE + banksize, banksize);
 
+	msp432_flash_done(f);
 	return ret;
 }
 
@@ -346,8 +360,11 @@ static bool msp432_cmd_sector_erase(target *t, int argc, const char **argv)
 	/* Find the flash structure (for the rigth protect register) */
 	struct target_flash *f = get_target_flash(t, addr);
 
-	if (f)
-		return msp432_sector_erase(f, addr);
+	if (f) {
+		const bool ret = msp432_sector_erase(f, addr);
+		msp432_flash_done(f);
+		return ret;
+	}
 	tc_printf(t, "Invalid sector address\n");
 	return false;
 }
@@ -365,15 +382,26 @@ static struct target_flash *get_target_flash(target *t, target_addr addr)
 }
 
 /* MSP432 ROM routine invocation */
-static void msp432_call_ROM(target *t, uint32_t address, uint32_t regs[])
+static uint32_t msp432_call_ROM(target *t, uint32_t address, uint32_t r0, uint32_t r1, uint32_t r2)
 {
-	/* Kill watchdog */
-	target_mem_write16(t, WDT_A_WTDCTL, WDT_A_HOLD);
-
-	/* Breakpoint at the beginning of CODE SRAM alias area */
-	target_mem_write16(t, SRAM_CODE_BASE, ARM_THUMB_BREAKPOINT);
+	struct msp432_priv *priv = t->target_storage;
+	uint32_t *regs = priv->regs;
+	/* The watchdog, return breakpoint and other registers stay put until msp432_flash_done() */
+	if (!priv->prepared) {
+		/* Kill watchdog */
+		target_mem_write16(t, WDT_A_WTDCTL, WDT_A_HOLD);
+
+		/* Breakpoint at the beginning of CODE SRAM alias area */
+		target_mem_write16(t, SRAM_CODE_BASE, ARM_THUMB_BREAKPOINT);
+
+		target_regs_read(t, regs);
+		priv->prepared = true;
+	}
 
 	/* Prepare registers */
+	regs[0] = r0;
+	regs[1] = r1;
+	regs[2] = r2;
 	regs[REG_MSP] = SRAM_STACK_PTR;    /* Stack space */
 	regs[REG_LR] = SRAM_CODE_BASE | 1; /* Return to beginning of SRAM CODE alias */
 	regs[REG_PC] = address;            /* Start at given address */
@@ -384,6 +412,8 @@ static void msp432_call_ROM(target *t, uint32_t address, uint32_t regs[])
 	target_halt_resume(t, false);
 	while (!target_halt_poll(t, NULL));
 
-	// Read registers to get result
-	target_regs_read(t, regs);
+	// Only the result in R0 is needed back
+	uint32_t result = 0;
+	target_reg_read(t, 0, &result, sizeof(result));
+	return result;
 }
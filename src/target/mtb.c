@@ -0,0 +1,293 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements branch trace with the Cortex-M0+ Micro Trace Buffer,
+ * ARM DDI0486B. The MTB writes a packet for every branch the core takes
+ * into a buffer in the target's own SRAM, at full speed and without the
+ * debugger taking part. "monitor mtb enable ADDR SIZE" gives it a part of
+ * the RAM the firmware leaves alone.
+ *
+ * A packet is two words, the source address of the branch with bit 0 set
+ * for an exception entry or return, then the destination with bit 0 set on
+ * the first packet since the trace was started. Once the core halts the
+ * buffer is read in one go, and kept until the core runs again. GDB gets it
+ * as BTS style branch trace, "record btrace bts", blocks of instructions run
+ * in sequence from the destination of one branch to the source of the next,
+ * the last one ending at the PC. "monitor mtb dump" prints the branches.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "command.h"
+#include "gdb_packet.h"
+#include "mtb.h"
+
+#define MTB_POSITION 0x000U
+#define MTB_MASTER   0x004U
+#define MTB_FLOW     0x008U
+#define MTB_BASE     0x00cU
+
+#define MTB_POSITION_WRAP         (1U << 2U)
+#define MTB_POSITION_POINTER_MASK 0xfffffff8U
+#define MTB_MASTER_EN             (1U << 31U)
+#define MTB_MASTER_MASK_MASK      0x1fU
+
+#define MTB_PACKET_EXCEPTION (1U << 0U) /* In the source word */
+#define MTB_PACKET_START     (1U << 0U) /* In the destination word */
+
+/* The buffer is 2^(MASK + 4) bytes, aligned to its size */
+#define MTB_BUF_MIN 16U
+#if PC_HOSTED == 1
+#define MTB_BUF_MAX 65536U
+#else
+#define MTB_BUF_MAX 2048U
+#endif
+
+#define MTB_BTRACE_BLOCK_FORMAT "<block begin=\"0x%08" PRIx32 "\" end=\"0x%08" PRIx32 "\"/>\n"
+#define MTB_BTRACE_BLOCK_LEN    (sizeof("<block begin=\"0x00000000\" end=\"0x00000000\"/>\n") - 1U)
+
+static const char mtb_btrace_header[] =
+	"<?xml version=\"1.0\"?>\n<!DOCTYPE btrace SYSTEM \"btrace.dtd\">\n<btrace version=\"1.0\">\n";
+static const char mtb_btrace_footer[] = "</btrace>\n";
+
+static uint32_t mtb_pending;
+
+static bool mtb_cmd(target *t, int argc, const char **argv);
+
+static const struct command_s mtb_cmd_list[] = {
+	{"mtb", mtb_cmd, "Micro Trace Buffer branch trace: (enable (ADDR SIZE)|disable|dump (COUNT))"},
+	{NULL, NULL, NULL},
+};
+
+void mtb_probe(const uint32_t base)
+{
+	mtb_pending = base;
+}
+
+static void mtb_write(const mtb_s *const mtb, const uint32_t reg, const uint32_t value)
+{
+	adiv5_mem_write(mtb->ap, mtb->base + reg, &value, sizeof(value));
+}
+
+static uint32_t mtb_read(const mtb_s *const mtb, const uint32_t reg)
+{
+	uint32_t value = 0;
+	adiv5_mem_read(mtb->ap, &value, mtb->base + reg, sizeof(value));
+	return value;
+}
+
+void mtb_assign(ADIv5_AP_t *const ap, target *const first)
+{
+	const uint32_t base = mtb_pending;
+	mtb_pending = 0;
+	if (!base || !first)
+		return;
+	mtb_s *const mtb = calloc(1, sizeof(*mtb));
+	if (!mtb) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return;
+	}
+	mtb->ap = ap;
+	mtb->base = base;
+	mtb->sram_base = mtb_read(mtb, MTB_BASE);
+	first->mtb = mtb;
+	target_add_commands(first, mtb_cmd_list, "Micro Trace Buffer");
+	DEBUG_INFO("MTB at 0x%08" PRIx32 " for %s, SRAM from 0x%08" PRIx32 "\n", base, first->driver, mtb->sram_base);
+}
+
+void mtb_invalidate(target *const t)
+{
+	mtb_s *const mtb = t->mtb;
+	if (!mtb || !mtb->trace)
+		return;
+	free(mtb->trace);
+	free(mtb->blocks);
+	mtb->trace = NULL;
+	mtb->blocks = NULL;
+	mtb->packets = 0;
+	mtb->block_count = 0;
+}
+
+void mtb_free(target *const t)
+{
+	mtb_invalidate(t);
+	free(t->mtb);
+	t->mtb = NULL;
+}
+
+bool mtb_enable(target *const t, const bool enable)
+{
+	mtb_s *const mtb = t->mtb;
+	if (!mtb->buf_size)
+		return false;
+	const uint32_t master = mtb_read(mtb, MTB_MASTER) & MTB_MASTER_MASK_MASK;
+	mtb_write(mtb, MTB_MASTER, master | (enable ? MTB_MASTER_EN : 0U));
+	return !target_check_error(t);
+}
+
+static bool mtb_setup(target *const t, const uint32_t addr, const uint32_t size)
+{
+	mtb_s *const mtb = t->mtb;
+	if (size < MTB_BUF_MIN || size > MTB_BUF_MAX || (size & (size - 1U)) || addr < mtb->sram_base ||
+		((addr - mtb->sram_base) & (size - 1U)))
+		return false;
+	const uint32_t mask = (uint32_t)__builtin_ctz(size) - 4U;
+	/* The largest MASK the part takes is implementation defined, it reads back smaller */
+	mtb_write(mtb, MTB_MASTER, mask);
+	if ((mtb_read(mtb, MTB_MASTER) & MTB_MASTER_MASK_MASK) != mask)
+		return false;
+	mtb_write(mtb, MTB_FLOW, 0);
+	mtb_write(mtb, MTB_POSITION, addr - mtb->sram_base);
+	mtb->buf_addr = addr;
+	mtb->buf_size = size;
+	mtb_invalidate(t);
+	return mtb_enable(t, true);
+}
+
+/* Reads the packets, oldest first, and works out GDB's blocks from them */
+static bool mtb_read_trace(target *const t, mtb_s *const mtb)
+{
+	if (mtb->trace)
+		return true;
+	if (!mtb->buf_size)
+		return false;
+	const uint32_t position = mtb_read(mtb, MTB_POSITION);
+	const uint32_t offset = (position & MTB_POSITION_POINTER_MASK) & (mtb->buf_size - 1U);
+	const bool wrapped = position & MTB_POSITION_WRAP;
+	uint32_t *const trace = malloc(mtb->buf_size);
+	uint16_t *const blocks = malloc((mtb->buf_size / 8U) * sizeof(*blocks));
+	if (!trace || !blocks) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		free(trace);
+		free(blocks);
+		return false;
+	}
+	/* After a wrap the oldest packet is the one about to be overwritten */
+	const uint32_t older = wrapped ? mtb->buf_size - offset : 0U;
+	if ((older && target_mem_read(t, trace, mtb->buf_addr + offset, older)) ||
+		target_mem_read(t, (uint8_t *)trace + older, mtb->buf_addr, offset) ||
+		target_reg_read(t, 15, &mtb->pc, sizeof(mtb->pc)) != sizeof(mtb->pc)) {
+		free(trace);
+		free(blocks);
+		return false;
+	}
+	mtb->trace = trace;
+	mtb->blocks = blocks;
+	mtb->packets = (older + offset) / 8U;
+
+	/*
+	 * Block i runs from the destination of packet i - 1 to the source of
+	 * packet i, or to the PC for the last one. What came before the trace
+	 * was last started belongs to another run, and is left out.
+	 */
+	mtb->block_count = 0;
+	for (size_t i = mtb->packets; i > 0; --i) {
+		const uint32_t destination = trace[((i - 1U) * 2U) + 1U];
+		const uint32_t begin = destination & ~1U;
+		const uint32_t end = i == mtb->packets ? mtb->pc : trace[i * 2U] & ~1U;
+		if (begin <= end)
+			blocks[mtb->block_count++] = i;
+		if (destination & MTB_PACKET_START)
+			break;
+	}
+	return true;
+}
+
+ssize_t mtb_btrace_read(target *const t, char *const buf, size_t offset, const size_t len)
+{
+	mtb_s *const mtb = t->mtb;
+	if (!mtb || !mtb_read_trace(t, mtb))
+		return -1;
+	/* Every block takes as many characters, so any offset is found without generating what comes before */
+	const size_t header_len = sizeof(mtb_btrace_header) - 1U;
+	const size_t blocks_len = mtb->block_count * MTB_BTRACE_BLOCK_LEN;
+	const size_t total = header_len + blocks_len + sizeof(mtb_btrace_footer) - 1U;
+	size_t done = 0;
+	while (done < len && offset < total) {
+		char block[MTB_BTRACE_BLOCK_LEN + 1U];
+		const char *piece = mtb_btrace_header;
+		size_t piece_offset = offset;
+		size_t piece_len = header_len;
+		if (offset >= header_len + blocks_len) {
+			piece = mtb_btrace_footer;
+			piece_offset = offset - header_len - blocks_len;
+			piece_len = sizeof(mtb_btrace_footer) - 1U;
+		} else if (offset >= header_len) {
+			const size_t index = mtb->blocks[(offset - header_len) / MTB_BTRACE_BLOCK_LEN];
+			const uint32_t begin = mtb->trace[((index - 1U) * 2U) + 1U] & ~1U;
+			const uint32_t end = index == mtb->packets ? mtb->pc : mtb->trace[index * 2U] & ~1U;
+			snprintf(block, sizeof(block), MTB_BTRACE_BLOCK_FORMAT, begin, end);
+			piece = block;
+			piece_offset = (offset - header_len) % MTB_BTRACE_BLOCK_LEN;
+			piece_len = MTB_BTRACE_BLOCK_LEN;
+		}
+		const size_t count = MIN(piece_len - piece_offset, len - done);
+		memcpy(buf + done, piece + piece_offset, count);
+		done += count;
+		offset += count;
+	}
+	return done;
+}
+
+static void mtb_dump(target *const t, mtb_s *const mtb, const size_t count)
+{
+	if (!mtb_read_trace(t, mtb)) {
+		gdb_out("No trace to read\n");
+		return;
+	}
+	const size_t first = count && count < mtb->packets ? mtb->packets - count : 0U;
+	for (size_t i = first; i < mtb->packets; ++i) {
+		const uint32_t source = mtb->trace[i * 2U];
+		const uint32_t destination = mtb->trace[(i * 2U) + 1U];
+		gdb_outf("0x%08" PRIx32 " -> 0x%08" PRIx32 "%s%s\n", source & ~1U, destination & ~1U,
+			source & MTB_PACKET_EXCEPTION ? " exception" : "", destination & MTB_PACKET_START ? " start" : "");
+	}
+	gdb_outf("PC 0x%08" PRIx32 ", %u branches\n", mtb->pc, (unsigned)mtb->packets);
+}
+
+static bool mtb_cmd(target *t, int argc, const char **argv)
+{
+	mtb_s *const mtb = t->mtb;
+	if (argc > 1 && !strcmp(argv[1], "enable")) {
+		bool ok;
+		if (argc == 4)
+			ok = mtb_setup(t, strtoul(argv[2], NULL, 0), strtoul(argv[3], NULL, 0));
+		else
+			ok = mtb_enable(t, true);
+		if (!ok) {
+			gdb_outf("The buffer is a power of 2 from %u to %u bytes, aligned to its size, in SRAM from 0x%08" PRIx32
+					 "\n",
+				MTB_BUF_MIN, MTB_BUF_MAX, mtb->sram_base);
+			return false;
+		}
+	} else if (argc > 1 && !strcmp(argv[1], "disable")) {
+		if (!mtb_enable(t, false))
+			return false;
+	} else if (argc > 1 && !strcmp(argv[1], "dump")) {
+		mtb_dump(t, mtb, argc > 2 ? strtoul(argv[2], NULL, 0) : 0U);
+		return true;
+	}
+	const bool enabled = mtb_read(mtb, MTB_MASTER) & MTB_MASTER_EN;
+	if (mtb->buf_size)
+		gdb_outf("MTB %s, buffer at 0x%08" PRIx32 ", %" PRIu32 " bytes\n", enabled ? "enabled" : "disabled",
+			mtb->buf_addr, mtb->buf_size);
+	else
+		gdb_out("MTB has no buffer, see \"monitor mtb enable ADDR SIZE\"\n");
+	return true;
+}
@@ -0,0 +1,54 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MTB_H
+#define __MTB_H
+
+#include "target.h"
+#include "adiv5.h"
+
+/* A Cortex-M0+ Micro Trace Buffer, and what was read of its trace since the core halted */
+typedef struct mtb {
+	ADIv5_AP_t *ap;
+	uint32_t base;
+	/* MTB_BASE, the address in SRAM the trace position counts from */
+	uint32_t sram_base;
+	/* Trace buffer in target RAM, size 0 when none was given */
+	uint32_t buf_addr;
+	uint32_t buf_size;
+	/* Packets read since the core halted, oldest first, NULL until read */
+	uint32_t *trace;
+	size_t packets;
+	/* Indices of the packets ending a block for GDB, newest first */
+	uint16_t *blocks;
+	size_t block_count;
+	uint32_t pc;
+} mtb_s;
+
+/* Called from the ROM table walk for an MTB found on the AP being walked */
+void mtb_probe(uint32_t base);
+/* Hands the MTB found on the AP, if any, to the first core found on it */
+void mtb_assign(ADIv5_AP_t *ap, target *first);
+void mtb_free(target *t);
+
+/* Drops the trace read, the core is about to run or be reset */
+void mtb_invalidate(target *t);
+bool mtb_enable(target *t, bool enable);
+/* Reads GDB's btrace XML, as much as fits len from offset, -1 on error */
+ssize_t mtb_btrace_read(target *t, char *buf, size_t offset, size_t len);
+
+#endif /* __MTB_H */
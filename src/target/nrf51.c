@@ -25,11 +25,13 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 #include "adiv5.h"
 
 static int nrf51_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int nrf51_flash_write(struct target_flash *f,
                              target_addr dest, const void *src, size_t len);
+static int nrf51_flash_done(struct target_flash *f);
 static bool nrf51_mass_erase(target *t);
 
 static bool nrf51_cmd_erase_uicr(target *t, int argc, const char **argv);
@@ -101,20 +103,37 @@ const struct command_s nrf51_read_cmd_list[] = {
 #define NRF51_PAGE_SIZE 1024
 #define NRF52_PAGE_SIZE 4096
 
+struct nrf51_flash {
+	struct target_flash f;
+	/* NVMC left in write enable mode until nrf51_flash_done() */
+	bool write_enabled;
+};
+
+/* The NVMC polls its own READY flag, which reads 1 when idle */
+static const struct flashloader_params nrf51_loader = {
+	.width = 4,
+	.sr_addr = NRF51_NVMC_READY,
+	.busy_mask = 1,
+	.error_mask = 0,
+	.ready_mask = 1,
+};
+
 static void nrf51_add_flash(target *t,
                             uint32_t addr, size_t length, size_t erasesize)
 {
-	struct target_flash *f = calloc(1, sizeof(*f));
-	if (!f) {			/* calloc failed: heap exhaustion */
+	struct nrf51_flash *nf = calloc(1, sizeof(*nf));
+	if (!nf) {			/* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	struct target_flash *f = &nf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = erasesize;
 	f->erase = nrf51_flash_erase;
 	f->write = nrf51_flash_write;
+	f->done = nrf51_flash_done;
 	f->erased = 0xff;
 	target_add_flash(t, f);
 }
@@ -160,9 +179,18 @@ bool nrf51_probe(target *t)
 	return true;
 }
 
+/* The NVMC mode is shared by all of the flash, the next write enables writes again */
+static void nrf51_write_disabled(target *t)
+{
+	for (struct target_flash *f = t->flash; f; f = f->next)
+		((struct nrf51_flash *)f)->write_enabled = false;
+}
+
 static int nrf51_flash_erase(struct target_flash *f, target_addr addr, size_t len)
 {
 	target *t = f->t;
+	nrf51_write_disabled(t);
+
 	/* Enable erase */
 	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_EEN);
 
@@ -208,20 +236,45 @@ static int nrf51_flash_write(struct target_flash *f,
                              target_addr dest, const void *src, size_t len)
 {
 	target *t = f->t;
+	struct nrf51_flash *nf = (struct nrf51_flash *)f;
 
-	/* Enable write */
-	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_WEN);
+	/* Enable write, once for the whole flash session */
+	if (!nf->write_enabled) {
+		target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_WEN);
+		/* Poll for NVMC_READY */
+		while (target_mem_read32(t, NRF51_NVMC_READY) == 0)
+			if(target_check_error(t))
+				return -1;
+		nf->write_enabled = true;
+	}
+
+	/* Let a stub write the words back to back, polling READY on the target */
+	const int loader = flashloader_write(t, &nrf51_loader, dest, src, len);
+	if (loader != 1)
+		return loader;
+
+	target_mem_write(t, dest, src, len);
 	/* Poll for NVMC_READY */
 	while (target_mem_read32(t, NRF51_NVMC_READY) == 0)
 		if(target_check_error(t))
 			return -1;
-	target_mem_write(t, dest, src, len);
+	return 0;
+}
+
+static int nrf51_flash_done(struct target_flash *f)
+{
+	target *t = f->t;
+	struct nrf51_flash *nf = (struct nrf51_flash *)f;
+	if (!nf->write_enabled)
+		return 0;
+
+	/* Return to read-only */
+	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_REN);
+	nrf51_write_disabled(t);
 	/* Poll for NVMC_READY */
 	while (target_mem_read32(t, NRF51_NVMC_READY) == 0)
 		if(target_check_error(t))
 			return -1;
-	/* Return to read-only */
-	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_REN);
 	return 0;
 }
 
@@ -39,6 +39,7 @@
 #include "general.h"
 #include "target.h"
 #include "target_internal.h"
+#include "flashloader.h"
 
 /* KE04 registers and constants */
 
@@ -110,11 +111,16 @@
 #define FLASH_SECURITY_WORD_UNSECURED 0xFFFEFFFFu
 
 
+static const uint16_t ke04_flash_write_stub[] = {
+#include "flashstub/ke04.stub"
+};
+
 /* Length in 16bit words of flash commands */
 static const uint8_t cmdLen[] = {
     4, 1, 2, 3, 6, 0, 6, 6, 1, 2, 2, 1, 5, 3, 3};
 
 /* Flash routines */
+static void ke04_flash_prepare(target *t);
 static bool ke04_command(target *t, uint8_t cmd, uint32_t addr, const uint8_t data[8]);
 static int ke04_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int ke04_flash_write(struct target_flash *f,
@@ -237,6 +243,10 @@ bool ke04_probe(target *t)
 	f->write     = ke04_flash_write;
 	f->done      = ke04_flash_done;
 	f->erased    = 0xFFu;
+	/* Several sectors per write keep the loader streaming, but only the
+	 * double words holding data get programmed */
+	f->buf_size  = FLASH_BUFFER_SIZE;
+	f->writesize = KE04_WRITE_LEN;
 	target_add_flash(t, f);
 
 	/* Add target specific commands */
@@ -254,7 +264,8 @@ static bool ke04_mass_erase(target *t)
 	return true;
 }
 
-static bool ke04_command(target *t, uint8_t cmd, uint32_t addr, const uint8_t data[8])
+/* Get the FTMRE ready to take a command */
+static void ke04_flash_prepare(target *t)
 {
 	uint8_t fstat;
 
@@ -276,6 +287,13 @@ static bool ke04_command(target *t, uint8_t cmd, uint32_t addr, const uint8_t da
 	do {
 		fstat = target_mem_read8(t, FTMRE_FSTAT);
 	} while (!(fstat & FTMRE_FSTAT_CCIF));
+}
+
+static bool ke04_command(target *t, uint8_t cmd, uint32_t addr, const uint8_t data[8])
+{
+	uint8_t fstat;
+
+	ke04_flash_prepare(t);
 
 	/* Write the flash command and the needed parameters */
 	uint8_t fccobix = 0;
@@ -349,6 +367,23 @@ static int ke04_flash_write(struct target_flash *f,
 		    FLASH_SECURITY_BYTE_UNSECURED;
 	}
 
+	/* The stub loads FCCOB and waits out each command on the target, so
+	 * only the data goes over the wire */
+	ke04_flash_prepare(t);
+	const struct flashloader_params loader_params = {
+		.width = KE04_WRITE_LEN,
+		.sr_addr = FTMRE_FSTAT,
+		.busy_mask = FTMRE_FSTAT_CCIF,
+		.error_mask = FTMRE_FSTAT_ACCERR | FTMRE_FSTAT_FPVIOL,
+		.ready_mask = FTMRE_FSTAT_CCIF,
+		.stub = ke04_flash_write_stub,
+		.stub_len = sizeof(ke04_flash_write_stub),
+		.stub_arg = FTMRE_BASE,
+	};
+	const int loader = flashloader_write(t, &loader_params, dest, src, len);
+	if (loader <= 0)
+		return loader ? 1 : 0;
+
 	while (len) {
 		if (ke04_command(f->t, CMD_PROGRAM_FLASH, dest, src)) {
 			len  -= KE04_WRITE_LEN;
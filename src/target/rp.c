@@ -41,7 +41,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
-#include "sfdp.h"
+#include "spi.h"
 
 #define RP_ID                 "Raspberry RP2040"
 #define RP_MAX_TABLE_SIZE     0x80U
@@ -50,6 +50,7 @@
 #define BOOTROM_MAGIC_MASK    0x00ffffffU
 #define BOOTROM_VERSION_SHIFT 24U
 #define RP_XIP_FLASH_BASE     0x10000000U
+#define RP_XIP_NOALLOC_BASE   0x13000000U /* Bypasses the XIP cache */
 #define RP_SRAM_BASE          0x20000000U
 #define RP_SRAM_SIZE          0x42000U
 
@@ -85,6 +86,8 @@
 #define RP_SSI_XIP_SPI_CTRL0_ADDRESS_LENGTH(x) (((x) * 2U) << 2U)
 #define RP_SSI_XIP_SPI_CTRL0_INSTR_LENGTH_8b   (2U << 8U)
 #define RP_SSI_XIP_SPI_CTRL0_WAIT_CYCLES(x)    (((x) * 8U) << 11U)
+#define RP_SSI_XIP_SPI_CTRL0_WAIT_CLOCKS(x)    ((x) << 11U)
+#define RP_SSI_XIP_SPI_CTRL0_XIP_CMD(x)        ((uint32_t)(x) << 24U)
 
 #define BOOTROM_FUNC_TABLE_ADDR      0x00000014U
 #define BOOTROM_FUNC_TABLE_TAG(x, y) ((uint8_t)(x) | ((uint8_t)(y) << 8U))
@@ -92,33 +95,19 @@
 #define FLASHSIZE_4K_SECTOR      (4U * 1024U)
 #define FLASHSIZE_32K_BLOCK      (32U * 1024U)
 #define FLASHSIZE_64K_BLOCK      (64U * 1024U)
-#define FLASHSIZE_32K_BLOCK_MASK ~(FLASHSIZE_32K_BLOCK - 1U)
-#define FLASHSIZE_64K_BLOCK_MASK ~(FLASHSIZE_64K_BLOCK - 1U)
+/* Keep each erase call short enough to report progress in between */
+#define RP_FLASH_ERASE_CHUNK     (1024U * 1024U)
 #define MAX_FLASH                (16U * 1024U * 1024U)
 
-#define RP_SPI_OPCODE(x)            (x)
-#define RP_SPI_OPCODE_MASK          0x00ffU
-#define RP_SPI_INTER_SHIFT          8U
-#define RP_SPI_INTER_LENGTH(x)      (((x) & 7U) << RP_SPI_INTER_SHIFT)
-#define RP_SPI_INTER_MASK           0x0700U
-#define RP_SPI_FRAME_OPCODE_ONLY    (1 << 11U)
-#define RP_SPI_FRAME_OPCODE_3B_ADDR (2 << 11U)
-#define RP_SPI_FRAME_MASK           0x1800U
-
-/* Instruction codes taken from Winbond W25Q16JV datasheet, as used on the
- * original Pico board from Raspberry Pi.
- * https://www.winbond.com/resource-files/w25q16jv%20spi%20revd%2008122016.pdf
- * All dev boards supported by Pico SDK V1.3.1 use SPI flash chips which support
- * these commands. Other custom boards using different SPI flash chips might
- * not support these commands
+/*
+ * Writes are staged in one of two buffers at the start of SRAM, so the next one
+ * can be loaded while the ROM is still programming the previous one.
  */
-
-#define SPI_FLASH_CMD_SECTOR_ERASE  0x20
-#define FLASHCMD_BLOCK32K_ERASE 0x52
-#define FLASHCMD_BLOCK64K_ERASE 0xd8
-#define FLASHCMD_CHIP_ERASE     0x60
-#define SPI_FLASH_CMD_READ_JEDEC_ID (RP_SPI_OPCODE(0x9fU) | RP_SPI_INTER_LENGTH(0) | RP_SPI_FRAME_OPCODE_ONLY)
-#define SPI_FLASH_CMD_READ_SFDP     (RP_SPI_OPCODE(0x5aU) | RP_SPI_INTER_LENGTH(1) | RP_SPI_FRAME_OPCODE_3B_ADDR)
+#if PC_HOSTED == 1
+#define RP_FLASH_WRITE_BUF_SIZE 0x8000U
+#else
+#define RP_FLASH_WRITE_BUF_SIZE 0x800U
+#endif
 
 typedef struct rp_priv {
 	uint16_t rom_debug_trampoline_begin;
@@ -132,13 +121,17 @@ typedef struct rp_priv {
 	uint16_t rom_reset_usb_boot;
 	bool is_prepared;
 	bool is_monitor;
+	/* A flash_range_program call is still running out of program_buffer */
+	bool program_pending;
+	uint8_t program_buffer;
+	uint32_t program_timeout;
+	int (*mem_crc32)(target *t, uint32_t *crc, target_addr addr, size_t len);
 	uint32_t regs[0x20]; /* Register playground*/
 } rp_priv_s;
 
 typedef struct rp_flash {
 	target_flash_s f;
-	uint32_t page_size;
-	uint8_t sector_erase_opcode;
+	spi_parameters_s spi_parameters;
 } rp_flash_s;
 
 static bool rp_cmd_erase_sector(target *t, int argc, const char **argv);
@@ -152,6 +145,7 @@ const struct command_s rp_cmd_list[] = {
 
 static int rp_flash_erase(target_flash_s *f, target_addr addr, size_t len);
 static int rp_flash_write(target_flash_s *f, target_addr dest, const void *src, size_t len);
+static int rp_flash_done(target_flash_s *f);
 
 static bool rp_read_rom_func_table(target *t);
 static bool rp_attach(target *t);
@@ -160,6 +154,8 @@ static void rp_flash_resume(target *t);
 static void rp_spi_read(target *t, uint16_t command, target_addr address, void *buffer, size_t length);
 static uint32_t rp_get_flash_length(target *t);
 static bool rp_mass_erase(target *t);
+static void rp_mem_read(target *t, void *dest, target_addr src, size_t len);
+static int rp_mem_crc32(target *t, uint32_t *crc, target_addr addr, size_t len);
 
 static void rp_spi_read_sfdp(target *const t, const uint32_t address, void *const buffer, const size_t length)
 {
@@ -178,10 +174,7 @@ static void rp_add_flash(target *t)
 	spi_parameters_s spi_parameters;
 	if (!sfdp_read_parameters(t, &spi_parameters, rp_spi_read_sfdp)) {
 		/* SFDP readout failed, so make some assumptions and hope for the best. */
-		spi_parameters.page_size = 256U;
-		spi_parameters.sector_size = 4096U;
-		spi_parameters.capacity = rp_get_flash_length(t);
-		spi_parameters.sector_erase_opcode = SPI_FLASH_CMD_SECTOR_ERASE;
+		spi_flash_default_parameters(&spi_parameters, rp_get_flash_length(t));
 	}
 	rp_flash_resume(t);
 
@@ -193,12 +186,12 @@ static void rp_add_flash(target *t)
 	f->blocksize = spi_parameters.sector_size;
 	f->erase = rp_flash_erase;
 	f->write = rp_flash_write;
-	f->buf_size = 2048; /* Max buffer size used otherwise */
+	f->done = rp_flash_done;
+	f->buf_size = RP_FLASH_WRITE_BUF_SIZE;
 	f->erased = 0xffU;
 	target_add_flash(t, f);
 
-	flash->page_size = spi_parameters.page_size;
-	flash->sector_erase_opcode = spi_parameters.sector_erase_opcode;
+	flash->spi_parameters = spi_parameters;
 }
 
 bool rp_probe(target *t)
@@ -223,6 +216,9 @@ bool rp_probe(target *t)
 	t->target_storage = (void *)priv_storage;
 
 	t->mass_erase = rp_mass_erase;
+	t->mem_read = rp_mem_read;
+	priv_storage->mem_crc32 = t->mem_crc32;
+	t->mem_crc32 = rp_mem_crc32;
 	t->driver = RP_ID;
 	t->target_options |= CORTEXM_TOPT_INHIBIT_NRST;
 	t->attach = rp_attach;
@@ -300,27 +296,26 @@ static bool rp_read_rom_func_table(target *const t)
 	return check == 9;
 }
 
-/* RP ROM functions calls
- *
- * timout == 0: Do not wait for poll, use for rom_reset_usb_boot()
- * timeout > 500 (ms) : display spinner
- */
-static bool rp_rom_call(target *t, uint32_t *regs, uint32_t cmd, uint32_t timeout)
+static void rp_rom_call_start(target *t, uint32_t *regs, uint32_t cmd)
 {
-	const char spinner[] = "|/-\\";
-	int spinindex = 0;
 	rp_priv_s *ps = (rp_priv_s *)t->target_storage;
 	regs[7] = cmd;
 	regs[REG_LR] = ps->rom_debug_trampoline_end;
 	regs[REG_PC] = ps->rom_debug_trampoline_begin;
 	regs[REG_MSP] = 0x20042000;
 	regs[REG_XPSR] = CORTEXM_XPSR_THUMB;
-	uint32_t dbg_regs[t->regs_size / sizeof(uint32_t)];
 	target_regs_write(t, regs);
 	/* start the target and wait for it to halt again */
 	target_halt_resume(t, false);
-	if (!timeout)
-		return false;
+}
+
+/* Wait for a call started by rp_rom_call_start(), returning true if it failed */
+static bool rp_rom_call_wait(target *t, uint32_t cmd, uint32_t timeout)
+{
+	const char spinner[] = "|/-\\";
+	int spinindex = 0;
+	rp_priv_s *ps = (rp_priv_s *)t->target_storage;
+	uint32_t dbg_regs[t->regs_size / sizeof(uint32_t)];
 	DEBUG_INFO("Call cmd %04" PRIx32 "\n", cmd);
 	platform_timeout operation_timeout;
 	platform_timeout_set(&operation_timeout, timeout);
@@ -350,6 +345,66 @@ static bool rp_rom_call(target *t, uint32_t *regs, uint32_t cmd, uint32_t timeou
 	return ret;
 }
 
+/* RP ROM functions calls
+ *
+ * timout == 0: Do not wait for poll, use for rom_reset_usb_boot()
+ * timeout > 500 (ms) : display spinner
+ */
+static bool rp_rom_call(target *t, uint32_t *regs, uint32_t cmd, uint32_t timeout)
+{
+	rp_rom_call_start(t, regs, cmd);
+	if (!timeout)
+		return false;
+	return rp_rom_call_wait(t, cmd, timeout);
+}
+
+/* Wait for the last chunk handed to flash_range_program, returning true if it failed */
+static bool rp_flash_program_wait(target *t)
+{
+	rp_priv_s *ps = (rp_priv_s *)t->target_storage;
+	if (!ps->program_pending)
+		return false;
+	ps->program_pending = false;
+	return rp_rom_call_wait(t, ps->rom_flash_range_program, ps->program_timeout);
+}
+
+/*
+ * flash_enter_cmd_xip leaves XIP on serial 03h reads. If SFDP lists a 1-1-4 fast
+ * read, switch to it so reading back the flash is quicker. That also needs the
+ * flash's QE bit set, so the quad setup is only kept if it reads the same data.
+ */
+static void rp_flash_enter_quad_xip(target *t)
+{
+	if (!t->flash || t->flash->write != rp_flash_write)
+		return;
+	const spi_fast_read_s *const fast_read = &((rp_flash_s *)t->flash)->spi_parameters.fast_read_1_1_4;
+	if (!fast_read->opcode || fast_read->mode_clocks)
+		return;
+
+	uint32_t serial_data[16];
+	uint32_t quad_data[16];
+	target_mem_read(t, serial_data, RP_XIP_NOALLOC_BASE, sizeof(serial_data));
+	const uint32_t ctrl0 = target_mem_read32(t, RP_SSI_CTRL0);
+	const uint32_t xip_ctrl0 = target_mem_read32(t, RP_SSI_XIP_SPI_CTRL0);
+	target_mem_write32(t, RP_SSI_ENABLE, 0);
+	target_mem_write32(t, RP_SSI_CTRL0,
+		(ctrl0 & ~RP_SSI_CTRL0_MASK) | RP_SSI_CTRL0_FRF_QUAD | RP_SSI_CTRL0_TMOD_EEPROM | RP_SSI_CTRL0_DATA_BITS(32));
+	target_mem_write32(t, RP_SSI_XIP_SPI_CTRL0,
+		RP_SSI_XIP_SPI_CTRL0_XIP_CMD(fast_read->opcode) | RP_SSI_XIP_SPI_CTRL0_FORMAT_STD_SPI |
+			RP_SSI_XIP_SPI_CTRL0_ADDRESS_LENGTH(3) | RP_SSI_XIP_SPI_CTRL0_INSTR_LENGTH_8b |
+			RP_SSI_XIP_SPI_CTRL0_WAIT_CLOCKS(fast_read->dummy_clocks));
+	target_mem_write32(t, RP_SSI_ENABLE, RP_SSI_ENABLE_SSI);
+	target_mem_read(t, quad_data, RP_XIP_NOALLOC_BASE, sizeof(quad_data));
+
+	if (memcmp(serial_data, quad_data, sizeof(serial_data)) != 0) {
+		DEBUG_WARN("Quad XIP reads back differently, staying on serial reads\n");
+		target_mem_write32(t, RP_SSI_ENABLE, 0);
+		target_mem_write32(t, RP_SSI_CTRL0, ctrl0);
+		target_mem_write32(t, RP_SSI_XIP_SPI_CTRL0, xip_ctrl0);
+		target_mem_write32(t, RP_SSI_ENABLE, RP_SSI_ENABLE_SSI);
+	}
+}
+
 static void rp_flash_prepare(target *t)
 {
 	rp_priv_s *ps = (rp_priv_s *)t->target_storage;
@@ -366,16 +421,34 @@ static void rp_flash_prepare(target *t)
 static void rp_flash_resume(target *t)
 {
 	rp_priv_s *ps = (rp_priv_s *)t->target_storage;
+	if (rp_flash_program_wait(t))
+		DEBUG_WARN("Write failed!\n");
 	if (ps->is_prepared) {
 		DEBUG_INFO("rp_flash_resume\n");
 		/* flush */
 		rp_rom_call(t, ps->regs, ps->rom_flash_flush_cache, 100);
 		/* enter_cmd_xip */
 		rp_rom_call(t, ps->regs, ps->rom_flash_enter_xip, 100);
+		rp_flash_enter_quad_xip(t);
 		ps->is_prepared = false;
 	}
 }
 
+/* Maximum erase time for a block of size bytes, from SFDP or the W25Q16JV datasheet figures below */
+static uint32_t rp_flash_erase_time(const rp_flash_s *const flash, const uint32_t size)
+{
+	for (size_t i = 0; i < SPI_ERASE_TYPES; ++i) {
+		const spi_erase_type_s *const erase_type = &flash->spi_parameters.erase_types[i];
+		if (erase_type->size == size && erase_type->max_time_ms)
+			return erase_type->max_time_ms;
+	}
+	if (size <= FLASHSIZE_4K_SECTOR)
+		return 400U;
+	if (size <= FLASHSIZE_32K_BLOCK)
+		return 1600U;
+	return 2000U * MAX(size / FLASHSIZE_64K_BLOCK, 1U);
+}
+
 /*
  * 4k sector erase    45/  400 ms
  * 32k block erase   120/ 1600 ms
@@ -405,38 +478,27 @@ static int rp_flash_erase(target_flash_s *f, target_addr addr, size_t len)
 
 	/* erase */
 	rp_flash_prepare(t);
-	bool ret = 0;
-	while (len) {
-		if (len >= FLASHSIZE_64K_BLOCK) {
-			const uint32_t chunk = len & FLASHSIZE_64K_BLOCK_MASK;
-			ps->regs[0] = addr;
-			ps->regs[1] = chunk;
-			ps->regs[2] = FLASHSIZE_64K_BLOCK;
-			ps->regs[3] = FLASHCMD_BLOCK64K_ERASE;
-			DEBUG_WARN("64k_ERASE addr 0x%08" PRIx32 " len 0x%" PRIx32 "\n", addr, chunk);
-			ret = rp_rom_call(t, ps->regs, ps->rom_flash_range_erase, 25100);
-			len -= chunk;
-			addr += chunk;
-		} else if (len >= FLASHSIZE_32K_BLOCK) {
-			const uint32_t chunk = len & FLASHSIZE_32K_BLOCK_MASK;
-			ps->regs[0] = addr;
-			ps->regs[1] = chunk;
-			ps->regs[2] = FLASHSIZE_32K_BLOCK;
-			ps->regs[3] = FLASHCMD_BLOCK32K_ERASE;
-			DEBUG_WARN("32k_ERASE addr 0x%08" PRIx32 " len 0x%" PRIx32 "\n", addr, chunk);
-			ret = rp_rom_call(t, ps->regs, ps->rom_flash_range_erase, 1700);
-			len -= chunk;
-			addr += chunk;
-		} else {
-			rp_flash_s *flash = (rp_flash_s *)f;
-			ps->regs[0] = addr;
-			ps->regs[1] = len;
-			ps->regs[2] = f->blocksize;
-			ps->regs[3] = flash->sector_erase_opcode;
-			DEBUG_WARN("Sector_ERASE addr 0x%08" PRIx32 " len 0x%" PRIx32 "\n", addr, (uint32_t)len);
-			ret = rp_rom_call(t, ps->regs, ps->rom_flash_range_erase, 410);
-			len = 0;
-		}
+	bool ret = rp_flash_program_wait(t);
+	if (ret)
+		DEBUG_WARN("Write failed!\n");
+	rp_flash_s *flash = (rp_flash_s *)f;
+	while (len && !ret) {
+		/* The ROM uses the block command wherever the range is aligned to it, sector erases elsewhere */
+		const size_t max_chunk = MIN(len, RP_FLASH_ERASE_CHUNK);
+		const spi_erase_type_s *block = sfdp_largest_erase_type(&flash->spi_parameters, max_chunk);
+		const uint32_t block_size = block ? block->size : f->blocksize;
+		const uint32_t chunk = max_chunk & ~(block_size - 1U);
+		ps->regs[0] = addr;
+		ps->regs[1] = chunk;
+		ps->regs[2] = block_size;
+		ps->regs[3] = block ? block->opcode : flash->spi_parameters.sector_erase_opcode;
+		DEBUG_INFO("Erase addr 0x%08" PRIx32 " len 0x%" PRIx32 " in %" PRIu32 " byte blocks\n", addr, chunk, block_size);
+		/* Allow for sector erases either side of the aligned blocks */
+		const uint32_t erase_timeout = (chunk / block_size) * rp_flash_erase_time(flash, block_size) +
+			2U * (block_size / f->blocksize) * rp_flash_erase_time(flash, f->blocksize) + 10U;
+		ret = rp_rom_call(t, ps->regs, ps->rom_flash_range_erase, erase_timeout);
+		len -= chunk;
+		addr += chunk;
 		if (ret) {
 			DEBUG_WARN("Erase failed!\n");
 			break;
@@ -444,7 +506,7 @@ static int rp_flash_erase(target_flash_s *f, target_addr addr, size_t len)
 		if (full_erase)
 			target_print_progress(&timeout);
 	}
-	rp_flash_resume(t);
+	/* XIP is only restored once the flash operations are done, see rp_flash_done() */
 	DEBUG_INFO("Erase done!\n");
 	return ret;
 }
@@ -459,33 +521,44 @@ static int rp_flash_write(target_flash_s *f, target_addr dest, const void *src,
 	}
 	dest -= f->start;
 	rp_priv_s *ps = (rp_priv_s *)t->target_storage;
-	/* Write payload to target ram */
 	rp_flash_prepare(t);
-	bool ret = 0;
-#define MAX_WRITE_CHUNK 0x1000
+	const uint8_t *data = (const uint8_t *)src;
 	while (len) {
-		uint32_t chunksize = (len <= MAX_WRITE_CHUNK) ? len : MAX_WRITE_CHUNK;
-		target_mem_write(t, RP_SRAM_BASE, src, chunksize);
+		const uint32_t chunksize = MIN(len, RP_FLASH_WRITE_BUF_SIZE);
+		/* Write payload to the target RAM buffer the ROM isn't using */
+		const target_addr buffer = RP_SRAM_BASE + ps->program_buffer * RP_FLASH_WRITE_BUF_SIZE;
+		target_mem_write(t, buffer, data, chunksize);
+		if (rp_flash_program_wait(t)) {
+			DEBUG_WARN("Write failed!\n");
+			return -1;
+		}
 		/* Programm range */
 		ps->regs[0] = dest;
-		ps->regs[1] = RP_SRAM_BASE;
+		ps->regs[1] = buffer;
 		ps->regs[2] = chunksize;
+		rp_rom_call_start(t, ps->regs, ps->rom_flash_range_program);
 		/* Loading takes 3 ms per 256 byte page
 		 * however it takes much longer if the XOSC is not enabled
 		 * so lets give ourselves a little bit more time (x10)
 		 */
-		ret |= rp_rom_call(t, ps->regs, ps->rom_flash_range_program, (3 * chunksize * 10) >> 8);
-		if (ret) {
-			DEBUG_WARN("Write failed!\n");
-			break;
-		}
+		ps->program_timeout = (3 * chunksize * 10) >> 8;
+		ps->program_pending = true;
+		ps->program_buffer ^= 1U;
 		len -= chunksize;
-		src += chunksize;
+		data += chunksize;
 		dest += chunksize;
 	}
+	return 0;
+}
+
+/* Wait for the last write and put the flash back into XIP mode */
+static int rp_flash_done(target_flash_s *f)
+{
+	target *t = f->t;
+	const bool ret = rp_flash_program_wait(t);
 	rp_flash_resume(t);
 	DEBUG_INFO("Write done!\n");
-	return ret;
+	return ret ? -1 : 0;
 }
 
 static bool rp_mass_erase(target *t)
@@ -493,10 +566,35 @@ static bool rp_mass_erase(target *t)
 	rp_priv_s *ps = (rp_priv_s *)t->target_storage;
 	ps->is_monitor = true;
 	const bool result = rp_flash_erase(t->flash, t->flash->start, t->flash->length) == 0;
+	rp_flash_resume(t);
 	ps->is_monitor = false;
 	return result;
 }
 
+/*
+ * Debugger reads of the flash (verify, dumps and qCRC) go through the no-allocate
+ * XIP alias, so they neither evict the program's cache lines nor have to look them up.
+ */
+static target_addr rp_xip_noalloc(target_addr addr, size_t len)
+{
+	if (addr >= RP_XIP_FLASH_BASE && addr + len <= RP_XIP_FLASH_BASE + MAX_FLASH)
+		return addr - RP_XIP_FLASH_BASE + RP_XIP_NOALLOC_BASE;
+	return addr;
+}
+
+static void rp_mem_read(target *t, void *dest, target_addr src, size_t len)
+{
+	adiv5_mem_read(cortexm_ap(t), dest, rp_xip_noalloc(src, len), len);
+}
+
+static int rp_mem_crc32(target *t, uint32_t *crc, target_addr addr, size_t len)
+{
+	rp_priv_s *ps = (rp_priv_s *)t->target_storage;
+	if (!ps->mem_crc32)
+		return -1;
+	return ps->mem_crc32(t, crc, rp_xip_noalloc(addr, len), len);
+}
+
 static void rp_spi_chip_select(target *const t, const bool active)
 {
 	const uint32_t state = active ? RP_GPIO_QSPI_CS_DRIVE_LOW : RP_GPIO_QSPI_CS_DRIVE_HIGH;
@@ -523,12 +621,12 @@ static void rp_spi_read(
 	rp_spi_chip_select(t, true);
 
 	/* Set up the instruction */
-	const uint8_t opcode = command & RP_SPI_OPCODE_MASK;
+	const uint8_t opcode = command & SPI_FLASH_OPCODE_MASK;
 	target_mem_write32(t, RP_SSI_DR0, opcode);
 	target_mem_read32(t, RP_SSI_DR0);
 
-	const uint16_t addr_mode = command & RP_SPI_FRAME_MASK;
-	if (addr_mode == RP_SPI_FRAME_OPCODE_3B_ADDR) {
+	const uint16_t addr_mode = command & SPI_FLASH_FRAME_MASK;
+	if (addr_mode == SPI_FLASH_FRAME_3B_ADDR) {
 		/* For each byte sent here, we have to manually clean up from the controller with a read */
 		target_mem_write32(t, RP_SSI_DR0, (address >> 16U) & 0xffU);
 		target_mem_read32(t, RP_SSI_DR0);
@@ -538,7 +636,7 @@ static void rp_spi_read(
 		target_mem_read32(t, RP_SSI_DR0);
 	}
 
-	const size_t inter_length = (command & RP_SPI_INTER_MASK) >> RP_SPI_INTER_SHIFT;
+	const size_t inter_length = (command & SPI_FLASH_DUMMY_MASK) >> SPI_FLASH_DUMMY_SHIFT;
 	for (size_t i = 0; i < inter_length; ++i) {
 		/* For each byte sent here, we have to manually clean up from the controller with a read */
 		target_mem_write32(t, RP_SSI_DR0, 0);
@@ -622,6 +720,7 @@ static bool rp_cmd_erase_sector(target *t, int argc, const char **argv)
 	rp_priv_s *ps = (rp_priv_s *)t->target_storage;
 	ps->is_monitor = true;
 	const bool result = rp_flash_erase(t->flash, start, length) == 0;
+	rp_flash_resume(t);
 	ps->is_monitor = false;
 	return result;
 }
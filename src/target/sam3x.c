@@ -27,11 +27,18 @@
 #include "general.h"
 #include "target.h"
 #include "target_internal.h"
+#include "cortexm.h"
+#include "flashloader.h"
 
 static int sam_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int sam3_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int sam_flash_write(struct target_flash *f, target_addr dest,
                              const void *src, size_t len);
+static int sam_flash_done(struct target_flash *f);
+
+static const uint16_t sam_page_write_stub[] = {
+#include "flashstub/sam_eefc.stub"
+};
 
 static int sam_gpnvm_get(target *t, uint32_t base, uint32_t *gpnvm);
 
@@ -175,6 +182,7 @@ enum sam_driver {
 struct sam_flash {
 	struct target_flash f;
 	uint32_t eefc_base;
+	uint16_t page_size;
 	uint8_t write_cmd;
 };
 
@@ -209,8 +217,11 @@ static void sam3_add_flash(target *t,
 	f->blocksize = SAM_SMALL_PAGE_SIZE;
 	f->erase = sam3_flash_erase;
 	f->write = sam_flash_write;
+	f->done = sam_flash_done;
+	/* A page at a time, the erased value padding a larger buffer would erase pages outside the image */
 	f->buf_size = SAM_SMALL_PAGE_SIZE;
 	sf->eefc_base = eefc_base;
+	sf->page_size = SAM_SMALL_PAGE_SIZE;
 	sf->write_cmd = EEFC_FCR_FCMD_EWP;
 	target_add_flash(t, f);
 }
@@ -232,8 +243,11 @@ static void sam_add_flash(target *t,
 	f->blocksize = SAM_LARGE_PAGE_SIZE * 8;
 	f->erase = sam_flash_erase;
 	f->write = sam_flash_write;
-	f->buf_size = SAM_LARGE_PAGE_SIZE;
+	f->done = sam_flash_done;
+	/* A whole erase block per write, streamed a page at a time through the loader */
+	f->buf_size = f->blocksize;
 	sf->eefc_base = eefc_base;
+	sf->page_size = SAM_LARGE_PAGE_SIZE;
 	sf->write_cmd = EEFC_FCR_FCMD_WP;
 	target_add_flash(t, f);
 }
@@ -501,6 +515,30 @@ bool sam3x_probe(target *t)
 	return false;
 }
 
+/* Wait for the EEFC to finish its last command, returning the command's
+ * error bits. Reading FSR clears them, so they are taken from the read that
+ * saw FRDY set. */
+static int sam_flash_wait(target *t, uint32_t base)
+{
+	uint32_t sr;
+	do {
+		sr = cortexm_mem_wait_ready32(t, EEFC_FSR(base), EEFC_FSR_FRDY);
+		if (target_check_error(t))
+			return -1;
+	} while (!(sr & EEFC_FSR_FRDY));
+	return sr & EEFC_FSR_ERROR;
+}
+
+/* Issue a command once the previous one is done, without waiting for this one */
+static int sam_flash_start(target *t, uint32_t base, uint8_t cmd, uint16_t arg)
+{
+	if (sam_flash_wait(t, base))
+		return -1;
+	target_mem_write32(t, EEFC_FCR(base),
+	                   EEFC_FCR_FKEY | cmd | ((uint32_t)arg << 8));
+	return 0;
+}
+
 static int
 sam_flash_cmd(target *t, uint32_t base, uint8_t cmd, uint16_t arg)
 {
@@ -510,15 +548,9 @@ sam_flash_cmd(target *t, uint32_t base, uint8_t cmd, uint16_t arg)
 	if(base == 0)
 		return -1;
 
-	target_mem_write32(t, EEFC_FCR(base),
-	                   EEFC_FCR_FKEY | cmd | ((uint32_t)arg << 8));
-
-	while (!(target_mem_read32(t, EEFC_FSR(base)) & EEFC_FSR_FRDY))
-		if(target_check_error(t))
-			return -1;
-
-	uint32_t sr = target_mem_read32(t, EEFC_FSR(base));
-	return sr & EEFC_FSR_ERROR;
+	if (sam_flash_start(t, base, cmd, arg))
+		return -1;
+	return sam_flash_wait(t, base);
 }
 
 static enum sam_driver sam_driver(target *t)
@@ -579,13 +611,46 @@ static int sam_flash_write(struct target_flash *f, target_addr dest,
 	target *t = f->t;
 	struct sam_flash *sf = (struct sam_flash *)f;
 	uint32_t base = sf->eefc_base;
-	unsigned chunk = (dest - f->start) / f->buf_size;
-
-	target_mem_write(t, dest, src, len);
-	if(sam_flash_cmd(t, base, sf->write_cmd, chunk))
-		return -1;
+	unsigned page = (dest - f->start) / sf->page_size;
+
+	int ret = 1;
+	if (sf->write_cmd == EEFC_FCR_FCMD_WP) {
+		/* The pages of an erase block are streamed through the loader,
+		 * which fills the latch and waits for FRDY on the target */
+		const struct flashloader_params loader_params = {
+			.width = SAM_LARGE_PAGE_SIZE,
+			.sr_addr = EEFC_FSR(base),
+			.error_mask = EEFC_FSR_ERROR,
+			.ready_mask = EEFC_FSR_FRDY,
+			.stub = sam_page_write_stub,
+			.stub_len = sizeof(sam_page_write_stub),
+			.stub_arg = EEFC_FCR_FKEY | EEFC_FCR_FCMD_WP | ((uint32_t)page << 8),
+		};
+		if (sam_flash_wait(t, base))
+			return -1;
+		ret = flashloader_write(t, &loader_params, dest, src, len);
+	}
+	if (ret > 0) {
+		/* Page by page over the debug port. Each command is left running
+		 * and waited for before the next on the same EEFC or in
+		 * sam_flash_done(), so on the two plane parts one plane programs
+		 * while the latch of the other is loaded. */
+		const uint8_t *data = src;
+		for (size_t offset = 0; offset < len; offset += sf->page_size) {
+			if (sam_flash_wait(t, base))
+				return -1;
+			target_mem_write(t, dest + offset, data + offset, sf->page_size);
+			if (sam_flash_start(t, base, sf->write_cmd, page++))
+				return -1;
+		}
+		ret = 0;
+	}
+	return ret;
+}
 
-	return 0;
+static int sam_flash_done(struct target_flash *f)
+{
+	return sam_flash_wait(f->t, ((struct sam_flash *)f)->eefc_base) ? -1 : 0;
 }
 
 static int sam_gpnvm_get(target *t, uint32_t base, uint32_t *gpnvm)
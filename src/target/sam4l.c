@@ -28,6 +28,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 
 /*
  * Flash Controller defines
@@ -106,6 +107,11 @@ static void sam4l_extended_reset(target *t);
 static int sam4l_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int sam4l_flash_write_buf(struct target_flash *f, target_addr dest,
 									const void *src, size_t len);
+static int sam4l_flash_done(struct target_flash *f);
+
+static const uint16_t sam4l_page_write_stub[] = {
+#include "flashstub/sam4l.stub"
+};
 
 /* why Atmel couldn't make it sequential ... */
 static const size_t __ram_size[16] = {
@@ -160,7 +166,7 @@ static const size_t __nvp_size[16] = {
 
 
 /* Arbitrary time to wait for FLASH controller to be ready */
-#define FLASH_TIMEOUT	10000
+#define FLASH_TIMEOUT_MS	1000
 
 /*
  * Populate a target_flash struct with the necessary function pointers
@@ -179,6 +185,7 @@ static void sam4l_add_flash(target *t, uint32_t addr, size_t length)
 	f->blocksize = SAM4L_PAGE_SIZE;
 	f->erase = sam4l_flash_erase;
 	f->write = sam4l_flash_write_buf;
+	f->done = sam4l_flash_done;
 	f->buf_size = SAM4L_PAGE_SIZE;
 	f->erased = 0xff;
 	/* add it into the target structures flash chain */
@@ -283,6 +290,38 @@ sam4l_extended_reset(target *t)
 	target_check_error(t);
 }
 
+/*
+ * sam4l_flash_wait
+ *
+ * Helper function, wait for the flash controller to finish its last command
+ * and be ready to receive another. The status is polled on the probe side.
+ */
+static int
+sam4l_flash_wait(target *t)
+{
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, FLASH_TIMEOUT_MS);
+	uint32_t status;
+	while (!((status = cortexm_mem_wait_ready32(t, FLASHCALW_FSR, FLASHCALW_FSR_FRDY)) &
+			FLASHCALW_FSR_FRDY)) {
+		if (target_check_error(t) || platform_timeout_is_expired(&timeout)) {
+			DEBUG_WARN("\nSAM4L: sam4l_flash_wait: Not ready! "
+					   "Status = 0x%08x\n", (unsigned int) status);
+			return -1; /* Failed */
+		}
+	}
+	return 0;
+}
+
+/* The command register value for a command on a page, with the authorization key */
+static uint32_t
+sam4l_flash_command_word(uint32_t page, uint32_t cmd)
+{
+	return (cmd & FLASHCALW_FCMD_CMD_MASK) |
+		   ((page & FLASHCALW_FCMD_PAGEN_MASK) << FLASHCALW_FCMD_PAGEN_SHIFT) |
+		   (0xA5 << FLASHCALW_FCMD_KEY_SHIFT);
+}
+
 /*
  * sam4l_flash_command
  *
@@ -296,28 +335,14 @@ sam4l_extended_reset(target *t)
 static int
 sam4l_flash_command(target *t, uint32_t page, uint32_t cmd)
 {
-	uint32_t cmd_reg;
-	uint32_t status;
-	int	timeout;
 	DEBUG_INFO("\nSAM4L: sam4l_flash_command: FSR: 0x%08x, page = %d, "
 			   "command = %d\n", (unsigned int)(FLASHCALW_FSR),
 			   (int) page, (int) cmd);
-	/* wait for Flash controller ready */
-	for (timeout = 0; timeout < FLASH_TIMEOUT; timeout++) {
-		status = target_mem_read32(t, FLASHCALW_FSR);
-		if (status & FLASHCALW_FSR_FRDY) {
-			break;
-		}
-	}
-	if (timeout == FLASH_TIMEOUT) {
-		DEBUG_WARN("\nSAM4L: sam4l_flash_command: Not ready! "
-				   "Status = 0x%08x\n", (unsigned int) status);
-		return -1; /* Failed */
+	if (sam4l_flash_wait(t)) {
+		return -1;
 	}
 	/* load up the new command */
-	cmd_reg = (cmd & FLASHCALW_FCMD_CMD_MASK) |
-			  ((page & FLASHCALW_FCMD_PAGEN_MASK) << FLASHCALW_FCMD_PAGEN_SHIFT) |
-		  	  (0xA5 << FLASHCALW_FCMD_KEY_SHIFT);
+	const uint32_t cmd_reg = sam4l_flash_command_word(page, cmd);
 	DEBUG_INFO("\nSAM4L: sam4l_flash_command: Wrting command word 0x%08x\n",
 			   (unsigned int) cmd_reg);
 	/* and kick it off */
@@ -347,6 +372,26 @@ sam4l_flash_write_buf(struct target_flash *f, target_addr addr, const void *src,
 		return -1;
 	}
 
+	/* The loader clears the page buffer, fills it a word at a time from the
+	 * target itself and writes the page, polling FRDY there rather than
+	 * over the wire. */
+	const struct flashloader_params loader_params = {
+		.width = SAM4L_PAGE_SIZE,
+		.sr_addr = FLASHCALW_FSR,
+		.error_mask = FLASHCALW_FSR_LOCKE | FLASHCALW_FSR_PROGE,
+		.ready_mask = FLASHCALW_FSR_FRDY,
+		.stub = sam4l_page_write_stub,
+		.stub_len = sizeof(sam4l_page_write_stub),
+		.stub_arg = sam4l_flash_command_word(page, FLASH_CMD_WP),
+	};
+	if (sam4l_flash_wait(t)) {
+		return -1;
+	}
+	const int ret = flashloader_write(t, &loader_params, addr, src, len);
+	if (ret <= 0) {
+		return ret;
+	}
+
 	/* clear the page buffer */
 	if (sam4l_flash_command(t, 0, FLASH_CMD_CPB)) {
 		return -1;
@@ -376,6 +421,13 @@ sam4l_flash_write_buf(struct target_flash *f, target_addr addr, const void *src,
 	return 0;
 }
 
+/* The last page written is left programming, wait for it before the Flash is read back */
+static int
+sam4l_flash_done(struct target_flash *f)
+{
+	return sam4l_flash_wait(f->t);
+}
+
 /*
  * Erase flash across the addresses specified by addr and len
  */
@@ -41,6 +41,7 @@
 
 static int samd_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int samd_flash_write(struct target_flash *f, target_addr dest, const void *src, size_t len);
+static int samd_flash_done(struct target_flash *f);
 bool samd_mass_erase(target *t);
 
 static bool samd_cmd_lock_flash(target *t, int argc, const char **argv);
@@ -67,6 +68,8 @@ const struct command_s samd_cmd_list[] = {
 /* Non-Volatile Memory Controller (NVMC) Parameters */
 #define SAMD_ROW_SIZE  256U
 #define SAMD_PAGE_SIZE 64U
+/* The flash is split into 16 regions which are locked and unlocked as a whole */
+#define SAMD_LOCK_REGIONS 16U
 
 /* -------------------------------------------------------------------------- */
 /* Non-Volatile Memory Controller (NVMC) Registers */
@@ -92,6 +95,9 @@ const struct command_s samd_cmd_list[] = {
 #define SAMD_CTRLA_CMD_SSB             0x0045U
 #define SAMD_CTRLA_CMD_INVALL          0x0046U
 
+/* Control B Register (CTRLB) */
+#define SAMD_CTRLB_MANW (1U << 7U)
+
 /* Interrupt Flag Register (INTFLAG) */
 #define SAMD_NVMC_READY (1U << 0U)
 
@@ -443,20 +449,31 @@ struct samd_descr samd_parse_device_id(uint32_t did)
 	return samd;
 }
 
+struct samd_flash {
+	struct target_flash f;
+	/* Regions unlocked since the last samd_flash_done() */
+	uint16_t unlocked;
+	bool prepared;
+	uint32_t ctrlb;
+};
+
 static void samd_add_flash(target *t, uint32_t addr, size_t length)
 {
-	struct target_flash *f = calloc(1, sizeof(*f));
-	if (!f) {			/* calloc failed: heap exhaustion */
+	struct samd_flash *sf = calloc(1, sizeof(*sf));
+	if (!sf) {			/* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	struct target_flash *f = &sf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = SAMD_ROW_SIZE;
 	f->erase = samd_flash_erase;
 	f->write = samd_flash_write;
-	f->buf_size = SAMD_PAGE_SIZE;
+	f->done = samd_flash_done;
+	f->buf_size = SAMD_ROW_SIZE;
+	f->erased = 0xff;
 	target_add_flash(t, f);
 }
 
@@ -576,20 +593,49 @@ static void samd_unlock_current_address(target *t)
 	                   SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_UNLOCK);
 }
 
+/*
+ * Switch to automatic page writes, the page being written as soon as its
+ * last word is loaded into the page buffer, for the rest of this flash operation
+ */
+static void samd_flash_prepare(struct target_flash *f)
+{
+	struct samd_flash *sf = (struct samd_flash *)f;
+	if (sf->prepared)
+		return;
+	sf->ctrlb = target_mem_read32(f->t, SAMD_NVMC_CTRLB);
+	target_mem_write32(f->t, SAMD_NVMC_CTRLB, sf->ctrlb & ~SAMD_CTRLB_MANW);
+	sf->prepared = true;
+}
+
+/*
+ * Unlock the region holding addr once per flash operation, samd_flash_done() locks it again
+ */
+static void samd_unlock_region(struct target_flash *f, target_addr addr)
+{
+	struct samd_flash *sf = (struct samd_flash *)f;
+	const uint16_t region = 1U << ((addr - f->start) / (f->length / SAMD_LOCK_REGIONS));
+	if (sf->unlocked & region)
+		return;
+	/* Must be shifted right for 16-bit address, see Datasheet §20.8.8 Address */
+	target_mem_write32(f->t, SAMD_NVMC_ADDRESS, addr >> 1);
+	samd_unlock_current_address(f->t);
+	sf->unlocked |= region;
+}
+
 /*
  * Erase flash row by row
  */
 static int samd_flash_erase(struct target_flash *f, target_addr addr, size_t len)
 {
 	target *t = f->t;
+	samd_flash_prepare(f);
 	while (len) {
+		samd_unlock_region(f, addr);
+
 		/* Write address of first word in row to erase it */
 		/* Must be shifted right for 16-bit address, see Datasheet §20.8.8 Address */
 		target_mem_write32(t, SAMD_NVMC_ADDRESS, addr >> 1);
 
-		/* Unlock */
-		samd_unlock_current_address(t);
-
 		/* Issue the erase command */
 		target_mem_write32(t, SAMD_NVMC_CTRLA,
 		                   SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_ERASEROW);
@@ -598,9 +644,6 @@ static int samd_flash_erase(struct target_flash *f, target_addr addr, size_t len
 			if (target_check_error(t))
 				return -1;
 
-		/* Lock */
-		samd_lock_current_address(t);
-
 		addr += f->blocksize;
 		if (len > f->blocksize)
 			len -= f->blocksize;
@@ -612,31 +655,48 @@ static int samd_flash_erase(struct target_flash *f, target_addr addr, size_t len
 }
 
 /*
- * Write flash page by page
+ * Write flash a row at a time, each page being written by the
+ * controller as soon as the page buffer is filled
  */
 static int samd_flash_write(struct target_flash *f,
                             target_addr dest, const void *src, size_t len)
 {
 	target *t = f->t;
+	const uint8_t *data = src;
+	samd_flash_prepare(f);
+	samd_unlock_region(f, dest);
 
-	/* Write within a single page. This may be part or all of the page */
-	target_mem_write(t, dest, src, len);
-
-	/* Unlock */
-	samd_unlock_current_address(t);
+	for (size_t offset = 0; offset < len; offset += SAMD_PAGE_SIZE) {
+		/* Filling the page buffer starts the page write */
+		target_mem_write(t, dest + offset, data + offset, SAMD_PAGE_SIZE);
 
-	/* Issue the write page command */
-	target_mem_write32(t, SAMD_NVMC_CTRLA,
-	                   SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_WRITEPAGE);
+		/* Poll for NVM Ready */
+		while ((target_mem_read32(t, SAMD_NVMC_INTFLAG) & SAMD_NVMC_READY) == 0)
+			if (target_check_error(t))
+				return -1;
+	}
 
-	/* Poll for NVM Ready */
-	while ((target_mem_read32(t, SAMD_NVMC_INTFLAG) & SAMD_NVMC_READY) == 0)
-		if (target_check_error(t))
-			return -1;
+	return 0;
+}
 
-	/* Lock */
-	samd_lock_current_address(t);
+/*
+ * Lock the regions unlocked for this flash operation and go back to manual page writes
+ */
+static int samd_flash_done(struct target_flash *f)
+{
+	struct samd_flash *sf = (struct samd_flash *)f;
+	const uint32_t region_size = f->length / SAMD_LOCK_REGIONS;
+	for (size_t region = 0; region < SAMD_LOCK_REGIONS; ++region) {
+		if (!(sf->unlocked & (1U << region)))
+			continue;
+		target_mem_write32(f->t, SAMD_NVMC_ADDRESS, (f->start + region * region_size) >> 1);
+		samd_lock_current_address(f->t);
+	}
+	sf->unlocked = 0;
 
+	if (sf->prepared)
+		target_mem_write32(f->t, SAMD_NVMC_CTRLB, sf->ctrlb);
+	sf->prepared = false;
 	return 0;
 }
 
@@ -42,6 +42,7 @@ static int samx5x_flash_erase(struct target_flash *t, target_addr addr,
 			      size_t len);
 static int samx5x_flash_write(struct target_flash *f,
 			      target_addr dest, const void *src, size_t len);
+static int samx5x_flash_done(struct target_flash *f);
 static bool samx5x_cmd_lock_flash(target *t, int argc, const char **argv);
 static bool samx5x_cmd_unlock_flash(target *t, int argc, const char **argv);
 static bool samx5x_cmd_unlock_bootprot(target *t, int argc, const char **argv);
@@ -98,6 +99,8 @@ const struct command_s samx5x_cmd_list[] = {
 /* Non-Volatile Memory Controller (NVMC) Parameters */
 #define SAMX5X_PAGE_SIZE			512
 #define SAMX5X_BLOCK_SIZE			(SAMX5X_PAGE_SIZE * 16)
+/* The flash is split into 32 regions which are locked and unlocked as a whole */
+#define SAMX5X_LOCK_REGIONS			32U
 
 /* -------------------------------------------------------------------------- */
 /* Non-Volatile Memory Controller (NVMC) Registers */
@@ -112,6 +115,10 @@ const struct command_s samx5x_cmd_list[] = {
 #define SAMX5X_NVMC_ADDRESS			(SAMX5X_NVMC + 0x14)
 #define SAMX5X_NVMC_RUNLOCK			(SAMX5X_NVMC + 0x18)
 
+/* Control A Register (CTRLA) */
+#define SAMX5X_CTRLA_WMODE_MASK			(3U << 4U)
+#define SAMX5X_CTRLA_WMODE_AP			(3U << 4U)
+
 /* Control B Register (CTRLB) */
 #define SAMX5X_CTRLB_CMD_KEY			0xA500
 #define SAMX5X_CTRLB_CMD_ERASEPAGE		0x0000
@@ -317,21 +324,32 @@ struct samx5x_descr samx5x_parse_device_id(uint32_t did)
 	return samd;
 }
 
+struct samx5x_flash {
+	struct target_flash f;
+	/* Regions unlocked since the last samx5x_flash_done() */
+	uint32_t unlocked;
+	bool prepared;
+	uint16_t ctrla;
+};
+
 static void samx5x_add_flash(target *t, uint32_t addr, size_t length,
 			     size_t erase_block_size, size_t write_page_size)
 {
-	struct target_flash *f = calloc(1, sizeof(*f));
-	if (!f) {			/* calloc failed: heap exhaustion */
+	struct samx5x_flash *sf = calloc(1, sizeof(*sf));
+	if (!sf) {			/* calloc failed: heap exhaustion */
 		DEBUG_INFO("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	struct target_flash *f = &sf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = erase_block_size;
 	f->erase = samx5x_flash_erase;
 	f->write = samx5x_flash_write;
+	f->done = samx5x_flash_done;
 	f->buf_size = write_page_size;
+	f->erased = 0xff;
 	target_add_flash(t, f);
 }
 
@@ -490,6 +508,36 @@ static int samx5x_check_nvm_error(target *t)
 	return -1;
 }
 
+/**
+ * Switch to automatic page writes, the page being written as soon as its
+ * last word is loaded into the page buffer, for the rest of this flash operation
+ */
+static void samx5x_flash_prepare(struct target_flash *f)
+{
+	struct samx5x_flash *sf = (struct samx5x_flash *)f;
+	if (sf->prepared)
+		return;
+	sf->ctrla = target_mem_read16(f->t, SAMX5X_NVMC_CTRLA);
+	target_mem_write16(f->t, SAMX5X_NVMC_CTRLA,
+			   (sf->ctrla & ~SAMX5X_CTRLA_WMODE_MASK) | SAMX5X_CTRLA_WMODE_AP);
+	sf->prepared = true;
+}
+
+/**
+ * Unlock the region holding addr once per flash operation,
+ * samx5x_flash_done() locks it again
+ */
+static void samx5x_unlock_region(struct target_flash *f, target_addr addr)
+{
+	struct samx5x_flash *sf = (struct samx5x_flash *)f;
+	const uint32_t region = 1U << ((addr - f->start) / (f->length / SAMX5X_LOCK_REGIONS));
+	if (sf->unlocked & region)
+		return;
+	target_mem_write32(f->t, SAMX5X_NVMC_ADDRESS, addr);
+	samx5x_unlock_current_address(f->t);
+	sf->unlocked |= region;
+}
+
 #define NVM_ERROR_BITS_MSG						\
 	"Warning: Found NVM error bits set while preparing to %s\n"	\
 	"         flash block at 0x%08"PRIx32" (length 0x%zx).\n"	\
@@ -529,12 +577,11 @@ static int samx5x_flash_erase(struct target_flash *f, target_addr addr,
             return -1;
         }
 
+	samx5x_flash_prepare(f);
 	while (len) {
+		samx5x_unlock_region(f, addr);
 		target_mem_write32(t, SAMX5X_NVMC_ADDRESS, addr);
 
-		/* Unlock */
-		samx5x_unlock_current_address(t);
-
 		/* Issue the erase command */
 		target_mem_write32(t, SAMX5X_NVMC_CTRLB,
 				   SAMX5X_CTRLB_CMD_KEY |
@@ -553,9 +600,6 @@ static int samx5x_flash_erase(struct target_flash *f, target_addr addr,
                     return -1;
                 }
 
-		/* Lock */
-		samx5x_lock_current_address(t);
-
 		addr += f->blocksize;
 		len -= f->blocksize;
 	}
@@ -564,7 +608,8 @@ static int samx5x_flash_erase(struct target_flash *f, target_addr addr,
 }
 
 /**
- * Write flash page by page
+ * Write flash page by page, each page being written by the
+ * controller as soon as the page buffer is filled
  */
 static int samx5x_flash_write(struct target_flash *f,
 			      target_addr dest, const void *src, size_t len)
@@ -578,24 +623,22 @@ static int samx5x_flash_write(struct target_flash *f,
 		samx5x_clear_nvm_error(t);
 	}
 
-	/* Unlock */
-	target_mem_write32(t, SAMX5X_NVMC_ADDRESS, dest);
-	samx5x_unlock_current_address(t);
+	samx5x_flash_prepare(f);
+	samx5x_unlock_region(f, dest);
 
-	/* Write within a single page. This may be part or all of the page */
-	target_mem_write(t, dest, src, len);
+	const uint8_t *data = src;
+	for (size_t offset = 0; offset < len && !error; offset += SAMX5X_PAGE_SIZE) {
+		/* Filling the page buffer starts the page write */
+		target_mem_write(t, dest + offset, data + offset, SAMX5X_PAGE_SIZE);
 
-	/* Issue the write page command */
-	target_mem_write32(t, SAMX5X_NVMC_CTRLB,
-			   SAMX5X_CTRLB_CMD_KEY | SAMX5X_CTRLB_CMD_WRITEPAGE);
-
-	/* Poll for NVM Ready */
-	while ((target_mem_read32(t, SAMX5X_NVMC_STATUS) &
-		SAMX5X_STATUS_READY) == 0)
-		if (target_check_error(t) || samx5x_check_nvm_error(t)) {
-			error = true;
-			break;
-		}
+		/* Poll for NVM Ready */
+		while ((target_mem_read32(t, SAMX5X_NVMC_STATUS) &
+			SAMX5X_STATUS_READY) == 0)
+			if (target_check_error(t) || samx5x_check_nvm_error(t)) {
+				error = true;
+				break;
+			}
+	}
 
 	if (error || target_check_error(t) || samx5x_check_nvm_error(t)) {
 		DEBUG_WARN("Error writing flash page at 0x%08"PRIx32
@@ -603,9 +646,27 @@ static int samx5x_flash_write(struct target_flash *f,
 		return -1;
 	}
 
-	/* Lock */
-	samx5x_lock_current_address(t);
+	return 0;
+}
+
+/**
+ * Lock the regions unlocked for this flash operation and go back to the previous write mode
+ */
+static int samx5x_flash_done(struct target_flash *f)
+{
+	struct samx5x_flash *sf = (struct samx5x_flash *)f;
+	const uint32_t region_size = f->length / SAMX5X_LOCK_REGIONS;
+	for (size_t region = 0; region < SAMX5X_LOCK_REGIONS; ++region) {
+		if (!(sf->unlocked & (1U << region)))
+			continue;
+		target_mem_write32(f->t, SAMX5X_NVMC_ADDRESS, f->start + region * region_size);
+		samx5x_lock_current_address(f->t);
+	}
+	sf->unlocked = 0;
 
+	if (sf->prepared)
+		target_mem_write16(f->t, SAMX5X_NVMC_CTRLA, sf->ctrla);
+	sf->prepared = false;
 	return 0;
 }
 
@@ -64,23 +64,50 @@ static inline size_t sfdp_memory_density_to_capacity_bits(const uint8_t *const d
 		return SFDP_DENSITY_VALUE(density) + 1U;
 }
 
+static uint32_t sfdp_erase_time_ms(const uint32_t erase_timing, const size_t type)
+{
+	static const uint16_t units_ms[4] = {1U, 16U, 128U, 1000U};
+	const uint8_t time = SFDP_ERASE_TIME(erase_timing, type);
+	const uint32_t typical = SFDP_ERASE_TIME_COUNT(time) * units_ms[SFDP_ERASE_TIME_UNIT(time)];
+	return typical * SFDP_ERASE_TIME_MULTIPLIER(erase_timing);
+}
+
+static void sfdp_fast_read(spi_fast_read_s *const fast_read, const timings_and_opcode_s *const entry)
+{
+	fast_read->opcode = entry->opcode;
+	fast_read->dummy_clocks = SFDP_FAST_READ_DUMMY_CLOCKS(entry->timings);
+	fast_read->mode_clocks = SFDP_FAST_READ_MODE_CLOCKS(entry->timings);
+}
+
 static spi_parameters_s sfdp_read_basic_parameter_table(target *const t, const uint32_t address, const size_t length,
 	const read_sfdp_func sfdp_read)
 {
 	sfdp_basic_parameter_table_s parameter_table;
+	/* Older devices have a shorter table, anything they don't provide reads as zero */
+	memset(&parameter_table, 0, sizeof(parameter_table));
 	const size_t table_length = MIN(sizeof(sfdp_basic_parameter_table_s), length);
 	sfdp_read(t, address, &parameter_table, table_length);
 
 	spi_parameters_s result;
+	memset(&result, 0, sizeof(result));
 	result.capacity = sfdp_memory_density_to_capacity_bits(parameter_table.memory_density) >> 3U;
 	for (size_t i = 0; i < SFDP_ERASE_TYPES; ++i) {
 		erase_parameters_s *erase_type = &parameter_table.erase_types[i];
-		if (erase_type->opcode == parameter_table.sector_erase_opcode) {
+		if (!erase_type->erase_size_exponent)
+			continue;
+		result.erase_types[i].size = SFDP_ERASE_SIZE(erase_type);
+		result.erase_types[i].opcode = erase_type->opcode;
+		if (table_length >= offsetof(sfdp_basic_parameter_table_s, erase_timing) + sizeof(uint32_t))
+			result.erase_types[i].max_time_ms = sfdp_erase_time_ms(parameter_table.erase_timing, i);
+		if (erase_type->opcode == parameter_table.sector_erase_opcode && !result.sector_size) {
 			result.sector_erase_opcode = erase_type->opcode;
 			result.sector_size = SFDP_ERASE_SIZE(erase_type);
-			break;
 		}
 	}
+	if (parameter_table.value2 & SFDP_SUPPORTS_FAST_1_1_4)
+		sfdp_fast_read(&result.fast_read_1_1_4, &parameter_table.fast_quad_output);
+	if (parameter_table.value2 & SFDP_SUPPORTS_FAST_1_4_4)
+		sfdp_fast_read(&result.fast_read_1_4_4, &parameter_table.fast_quad_io);
 	result.page_size = SFDP_PAGE_SIZE(parameter_table);
 	return result;
 }
@@ -107,3 +134,16 @@ bool sfdp_read_parameters(target *const t, spi_parameters_s *params, const read_
 	}
 	return false;
 }
+
+const spi_erase_type_s *sfdp_largest_erase_type(const spi_parameters_s *const params, const size_t len)
+{
+	const spi_erase_type_s *result = NULL;
+	for (size_t i = 0; i < SPI_ERASE_TYPES; ++i) {
+		const spi_erase_type_s *const erase_type = &params->erase_types[i];
+		if (!erase_type->size || erase_type->size > len)
+			continue;
+		if (!result || erase_type->size > result->size)
+			result = erase_type;
+	}
+	return result;
+}
@@ -46,15 +46,34 @@ typedef struct spi_flash_id {
 	uint8_t capacity;
 } spi_flash_id_s;
 
+#define SPI_ERASE_TYPES 4U
+
+typedef struct spi_erase_type {
+	uint32_t size; /* 0 if this entry is unused */
+	uint32_t max_time_ms; /* 0 if the device doesn't say */
+	uint8_t opcode;
+} spi_erase_type_s;
+
+typedef struct spi_fast_read {
+	uint8_t opcode; /* 0 if the mode isn't supported */
+	uint8_t dummy_clocks;
+	uint8_t mode_clocks;
+} spi_fast_read_s;
+
 typedef struct spi_parameters {
 	uint32_t page_size;
 	uint32_t sector_size;
 	size_t capacity;
 	uint8_t sector_erase_opcode;
+	spi_erase_type_s erase_types[SPI_ERASE_TYPES];
+	spi_fast_read_s fast_read_1_1_4;
+	spi_fast_read_s fast_read_1_4_4;
 } spi_parameters_s;
 
 typedef void (*read_sfdp_func)(target *t, uint32_t address, void *buffer, size_t length);
 
 bool sfdp_read_parameters(target *t, spi_parameters_s *params, read_sfdp_func sfdp_read);
+/* Returns the largest erase type no bigger than len, or NULL */
+const spi_erase_type_s *sfdp_largest_erase_type(const spi_parameters_s *params, size_t len);
 
 #endif /*SFDP_H*/
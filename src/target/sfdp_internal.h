@@ -54,6 +54,17 @@
 
 #define SFDP_ERASE_TYPES            4U
 #define SFDP_ERASE_SIZE(erase_type) (1U << ((erase_type)->erase_size_exponent))
+/* Erase timings: a 4 bit multiplier for the maximum, then 7 bits of typical time per erase type */
+#define SFDP_ERASE_TIME_MULTIPLIER(timing) ((((timing) & 0xfU) + 1U) * 2U)
+#define SFDP_ERASE_TIME(timing, type)      (((timing) >> (4U + ((type) * 7U))) & 0x7fU)
+#define SFDP_ERASE_TIME_COUNT(time)        (((time) & 0x1fU) + 1U)
+#define SFDP_ERASE_TIME_UNIT(time)         ((time) >> 5U)
+
+/* Fast read support flags in the third byte of the first DWORD */
+#define SFDP_SUPPORTS_FAST_1_4_4 (1U << 5U)
+#define SFDP_SUPPORTS_FAST_1_1_4 (1U << 6U)
+#define SFDP_FAST_READ_DUMMY_CLOCKS(timings) ((timings) & 0x1fU)
+#define SFDP_FAST_READ_MODE_CLOCKS(timings)  ((timings) >> 5U)
 #define SFDP_PAGE_SIZE(parameter_table) \
 	(1U << ((parameter_table).programming_and_chip_erase_timing.programming_timing_ratio_and_page_size >> 4U))
 
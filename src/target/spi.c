@@ -0,0 +1,207 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Generic SPI NOR Flash programming. The Flash is identified by its JEDEC ID
+ * and SFDP tables, erased with the largest erase unit that fits and written a
+ * page at a time, all through the transfer functions of the target's SPI or
+ * QSPI controller. Reading back and CRC32 go through the memory mapped window
+ * as any other memory does.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "spi.h"
+
+/* 3-byte addressing is all the commands here do */
+#define SPI_FLASH_MAX_3B_ADDR   (16U * 1024U * 1024U)
+#define SPI_FLASH_MANUFACTURER_MACRONIX 0xc2U
+#define SPI_FLASH_PROGRAM_TIMEOUT 50U
+#define SPI_FLASH_ERASE_TIMEOUT   2000U
+
+static int spi_flash_erase(target_flash_s *f, target_addr addr, size_t len);
+static int spi_flash_write(target_flash_s *f, target_addr dest, const void *src, size_t len);
+static int spi_flash_done(target_flash_s *f);
+
+/* sfdp_read_parameters() only hands over the target, this is what it reads through */
+static spi_read_func spi_sfdp_read;
+
+static void spi_read_sfdp(target *const t, const uint32_t address, void *const buffer, const size_t length)
+{
+	spi_sfdp_read(t, SPI_FLASH_CMD_READ_SFDP, address, buffer, length);
+}
+
+void spi_flash_default_parameters(spi_parameters_s *const params, const size_t capacity)
+{
+	memset(params, 0, sizeof(*params));
+	params->page_size = 256U;
+	params->sector_size = 4096U;
+	params->capacity = capacity;
+	params->sector_erase_opcode = SPI_FLASH_OPCODE_SECTOR_ERASE;
+	params->erase_types[0] = (spi_erase_type_s){4U * 1024U, 400U, SPI_FLASH_OPCODE_SECTOR_ERASE};
+	params->erase_types[1] = (spi_erase_type_s){32U * 1024U, 1600U, SPI_FLASH_OPCODE_BLOCK32_ERASE};
+	params->erase_types[2] = (spi_erase_type_s){64U * 1024U, 2000U, SPI_FLASH_OPCODE_BLOCK64_ERASE};
+}
+
+bool spi_flash_read_parameters(
+	target *const t, const spi_bus_s *const bus, spi_parameters_s *const params, spi_flash_id_s *const id)
+{
+	bus->read(t, SPI_FLASH_CMD_READ_JEDEC_ID, 0, id, sizeof(*id));
+	DEBUG_INFO("Flash device ID: %02x %02x %02x\n", id->manufacturer, id->type, id->capacity);
+	/* Nothing driving MISO reads back as all ones or all zeros */
+	if ((id->manufacturer == 0xffU && id->type == 0xffU) || (id->manufacturer == 0U && id->type == 0U))
+		return false;
+
+	spi_sfdp_read = bus->read;
+	if (sfdp_read_parameters(t, params, spi_read_sfdp))
+		return true;
+	/* No SFDP, so make some assumptions from the JEDEC ID and hope for the best */
+	if (id->capacity < 8U || id->capacity > 31U)
+		return false;
+	spi_flash_default_parameters(params, 1U << id->capacity);
+	return true;
+}
+
+static void spi_flash_prepare(spi_flash_s *const flash)
+{
+	if (flash->prepared)
+		return;
+	if (flash->bus.prepare)
+		flash->bus.prepare(flash->f.t);
+	flash->prepared = true;
+}
+
+static void spi_flash_resume(spi_flash_s *const flash)
+{
+	if (!flash->prepared)
+		return;
+	if (flash->bus.resume)
+		flash->bus.resume(flash->f.t);
+	flash->prepared = false;
+}
+
+spi_flash_s *spi_flash_add(target *const t, const target_addr begin, const size_t length, const spi_bus_s *const bus)
+{
+	spi_flash_s *const flash = calloc(1, sizeof(*flash));
+	if (!flash) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return NULL;
+	}
+	flash->bus = *bus;
+	flash->f.t = t;
+
+	spi_flash_prepare(flash);
+	const bool found = spi_flash_read_parameters(t, bus, &flash->params, &flash->id);
+	spi_flash_resume(flash);
+	if (!found || !flash->params.sector_size) {
+		DEBUG_WARN("No SPI Flash found behind the controller\n");
+		free(flash);
+		return NULL;
+	}
+	if (!flash->params.page_size)
+		flash->params.page_size = 256U;
+
+	/* Macronix parts take 0x32 as something else, they program 4 lines with 0x38 and a quad address */
+	flash->page_program = SPI_FLASH_CMD_PAGE_PROGRAM;
+	if (bus->quad && flash->params.fast_read_1_1_4.opcode && flash->id.manufacturer != SPI_FLASH_MANUFACTURER_MACRONIX)
+		flash->page_program = SPI_FLASH_CMD_QUAD_PAGE_PROGRAM;
+
+	target_flash_s *const f = &flash->f;
+	f->start = begin;
+	f->length = MIN(MIN(length, flash->params.capacity), SPI_FLASH_MAX_3B_ADDR);
+	f->blocksize = flash->params.sector_size;
+	f->erase = spi_flash_erase;
+	f->write = spi_flash_write;
+	f->done = spi_flash_done;
+	f->buf_size = flash->params.page_size;
+	f->erased = 0xffU;
+	target_add_flash(t, f);
+	DEBUG_INFO("SPI Flash: %zu kiB at 0x%08" PRIx32 "\n", f->length / 1024U, begin);
+	return flash;
+}
+
+static bool spi_flash_wait(spi_flash_s *const flash, const uint32_t timeout_ms, platform_timeout *const progress)
+{
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, timeout_ms);
+	uint8_t status = SPI_FLASH_STATUS_BUSY;
+	while (status & SPI_FLASH_STATUS_BUSY) {
+		flash->bus.read(flash->f.t, SPI_FLASH_CMD_READ_STATUS, 0, &status, sizeof(status));
+		if (target_check_error(flash->f.t))
+			return false;
+		if (platform_timeout_is_expired(&timeout)) {
+			DEBUG_WARN("SPI Flash timed out, status 0x%02x\n", status);
+			return false;
+		}
+		if (progress)
+			target_print_progress(progress);
+	}
+	return true;
+}
+
+static int spi_flash_erase(target_flash_s *const f, const target_addr addr, const size_t len)
+{
+	spi_flash_s *const flash = (spi_flash_s *)f;
+	spi_flash_prepare(flash);
+	platform_timeout progress;
+	platform_timeout_set(&progress, 500);
+	target_addr offset = addr - f->start;
+	size_t remaining = len;
+	while (remaining) {
+		/* The largest erase unit that both fits and is aligned to where we are */
+		const size_t align = offset ? offset & -offset : remaining;
+		const spi_erase_type_s *const erase_type = sfdp_largest_erase_type(&flash->params, MIN(remaining, align));
+		if (!erase_type)
+			return -1;
+		flash->bus.read(f->t, SPI_FLASH_CMD_WRITE_ENABLE, 0, NULL, 0);
+		flash->bus.read(f->t, SPI_FLASH_CMD_ERASE(erase_type->opcode), offset, NULL, 0);
+		const uint32_t timeout = erase_type->max_time_ms ? erase_type->max_time_ms : SPI_FLASH_ERASE_TIMEOUT;
+		if (!spi_flash_wait(flash, timeout, &progress))
+			return -1;
+		offset += erase_type->size;
+		remaining -= MIN(remaining, erase_type->size);
+	}
+	return 0;
+}
+
+static int spi_flash_write(target_flash_s *const f, const target_addr dest, const void *const src, const size_t len)
+{
+	spi_flash_s *const flash = (spi_flash_s *)f;
+	spi_flash_prepare(flash);
+	const uint8_t *data = (const uint8_t *)src;
+	target_addr offset = dest - f->start;
+	size_t remaining = len;
+	while (remaining) {
+		/* Programming wraps around within the page, so never cross into the next */
+		const size_t amount = MIN(remaining, flash->params.page_size - (offset % flash->params.page_size));
+		flash->bus.read(f->t, SPI_FLASH_CMD_WRITE_ENABLE, 0, NULL, 0);
+		flash->bus.write(f->t, flash->page_program, offset, data, amount);
+		if (!spi_flash_wait(flash, SPI_FLASH_PROGRAM_TIMEOUT, NULL))
+			return -1;
+		offset += amount;
+		data += amount;
+		remaining -= amount;
+	}
+	return 0;
+}
+
+/* Back to memory mapped mode, which is what reading back and verifying use */
+static int spi_flash_done(target_flash_s *const f)
+{
+	spi_flash_resume((spi_flash_s *)f);
+	return target_check_error(f->t) ? -1 : 0;
+}
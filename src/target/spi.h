@@ -0,0 +1,91 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Programs external SPI Flash through whatever SPI controller of the target
+ * it hangs off, a driver only providing the transfers for its controller.
+ */
+#ifndef __SPI_H
+#define __SPI_H
+
+#include "target.h"
+#include "target_internal.h"
+#include "sfdp.h"
+
+/* Commands handed to the transfer functions are the opcode, the dummy bytes
+ * clocked out after the address and how the command is framed */
+#define SPI_FLASH_OPCODE(x)         ((x) & SPI_FLASH_OPCODE_MASK)
+#define SPI_FLASH_OPCODE_MASK       0x00ffU
+#define SPI_FLASH_DUMMY_SHIFT       8U
+#define SPI_FLASH_DUMMY_LEN(x)      (((x) << SPI_FLASH_DUMMY_SHIFT) & SPI_FLASH_DUMMY_MASK)
+#define SPI_FLASH_DUMMY_MASK        0x0700U
+#define SPI_FLASH_FRAME_OPCODE_ONLY (1U << 11U)
+#define SPI_FLASH_FRAME_3B_ADDR     (2U << 11U)
+#define SPI_FLASH_FRAME_MASK        0x1800U
+/* The data phase goes over all four lines */
+#define SPI_FLASH_DATA_QUAD         (1U << 13U)
+
+/* Instruction codes taken from the Winbond W25Q16JV datasheet, as used on the
+ * original Pico board from Raspberry Pi. Most SPI NOR Flash of other makes
+ * takes the same ones
+ */
+#define SPI_FLASH_OPCODE_SECTOR_ERASE  0x20U
+#define SPI_FLASH_OPCODE_BLOCK32_ERASE 0x52U
+#define SPI_FLASH_OPCODE_BLOCK64_ERASE 0xd8U
+
+#define SPI_FLASH_CMD_WRITE_ENABLE      (SPI_FLASH_OPCODE(0x06U) | SPI_FLASH_FRAME_OPCODE_ONLY)
+#define SPI_FLASH_CMD_READ_STATUS       (SPI_FLASH_OPCODE(0x05U) | SPI_FLASH_FRAME_OPCODE_ONLY)
+#define SPI_FLASH_CMD_READ_JEDEC_ID     (SPI_FLASH_OPCODE(0x9fU) | SPI_FLASH_FRAME_OPCODE_ONLY)
+#define SPI_FLASH_CMD_READ_SFDP         (SPI_FLASH_OPCODE(0x5aU) | SPI_FLASH_DUMMY_LEN(1U) | SPI_FLASH_FRAME_3B_ADDR)
+#define SPI_FLASH_CMD_PAGE_PROGRAM      (SPI_FLASH_OPCODE(0x02U) | SPI_FLASH_FRAME_3B_ADDR)
+#define SPI_FLASH_CMD_QUAD_PAGE_PROGRAM (SPI_FLASH_OPCODE(0x32U) | SPI_FLASH_FRAME_3B_ADDR | SPI_FLASH_DATA_QUAD)
+#define SPI_FLASH_CMD_ERASE(opcode)     (SPI_FLASH_OPCODE(opcode) | SPI_FLASH_FRAME_3B_ADDR)
+
+#define SPI_FLASH_STATUS_BUSY 0x01U
+#define SPI_FLASH_STATUS_WEL  0x02U
+
+/* Transfers command, then reads or writes length bytes. length 0 only sends the command */
+typedef void (*spi_read_func)(target *t, uint16_t command, target_addr address, void *buffer, size_t length);
+typedef void (*spi_write_func)(target *t, uint16_t command, target_addr address, const void *buffer, size_t length);
+
+typedef struct spi_bus {
+	spi_read_func read;
+	spi_write_func write;
+	/* Optional, take the controller out of and back into memory mapped mode
+	 * around transfers */
+	void (*prepare)(target *t);
+	void (*resume)(target *t);
+	/* The controller is wired up for quad data */
+	bool quad;
+} spi_bus_s;
+
+typedef struct spi_flash {
+	target_flash_s f;
+	spi_parameters_s params;
+	spi_flash_id_s id;
+	spi_bus_s bus;
+	uint16_t page_program;
+	bool prepared;
+} spi_flash_s;
+
+/* What W25Q and most other parts do, for when the Flash has no SFDP tables */
+void spi_flash_default_parameters(spi_parameters_s *params, size_t capacity);
+/* Reads the JEDEC ID and SFDP tables through bus, false if nothing answers */
+bool spi_flash_read_parameters(target *t, const spi_bus_s *bus, spi_parameters_s *params, spi_flash_id_s *id);
+/* Adds the Flash behind bus, memory mapped at begin with up to length of it visible */
+spi_flash_s *spi_flash_add(target *t, target_addr begin, size_t length, const spi_bus_s *bus);
+
+#endif /* __SPI_H */
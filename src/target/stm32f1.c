@@ -38,6 +38,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 
 static bool stm32f1_cmd_option(target *t, int argc, const char **argv);
 
@@ -90,6 +91,9 @@ static bool stm32f1_mass_erase(target *t);
 
 #define DBGMCU_IDCODE    0xE0042000
 #define DBGMCU_IDCODE_F0 0x40015800
+#define DBGMCU_CR        0xE0042004
+/* DBG_SLEEP, DBG_STOP and DBG_STANDBY */
+#define DBGMCU_CR_LOWPOWER 0x7U
 
 #define FLASHSIZE    0x1FFFF7E0
 #define FLASHSIZE_F0 0x1FFFF7CC
@@ -108,6 +112,7 @@ static void stm32f1_add_flash(target *t, uint32_t addr, size_t length, size_t er
 	f->erase = stm32f1_flash_erase;
 	f->write = stm32f1_flash_write;
 	f->buf_size = erasesize;
+	f->writesize = 256;
 	f->erased = 0xff;
 	target_add_flash(t, f);
 }
@@ -236,6 +241,20 @@ bool at32fxx_probe(target *t)
 	return true;
 }
 
+static bool stm32f1_check_id(target *t)
+{
+	if ((t->cpuid & CPUID_PARTNO_MASK) == CORTEX_M0)
+		return (target_mem_read32(t, DBGMCU_IDCODE_F0) & 0xfffU) == t->part_id;
+	return (target_mem_read32(t, DBGMCU_IDCODE) & 0xfffU) == t->part_id;
+}
+
+/* The F0 DBGMCU needs its APB clock on first, so only the F1/F3 parts get this */
+static void stm32f1_lowpower_debug(target *t)
+{
+	t->lowpower_debug_reg = DBGMCU_CR;
+	t->lowpower_debug_bits = DBGMCU_CR_LOWPOWER;
+}
+
 /**
     \brief identify the stm32f1 chip
 */
@@ -268,6 +287,8 @@ bool stm32f1_probe(target *t)
 			t->driver = "STM32F1 medium density";
 		}
 		t->part_id = device_id;
+		t->check_id = stm32f1_check_id;
+		stm32f1_lowpower_debug(t);
 		return true;
 
 	case 0x414: /* High density */
@@ -275,18 +296,22 @@ bool stm32f1_probe(target *t)
 	case 0x428: /* Value Line, High Density */
 		t->driver = "STM32F1  VL density";
 		t->part_id = device_id;
+		t->check_id = stm32f1_check_id;
 		target_add_ram(t, 0x20000000, 0x10000);
 		stm32f1_add_flash(t, 0x8000000, 0x80000, 0x800);
 		target_add_commands(t, stm32f1_cmd_list, "STM32 HF/CL/VL-HD");
+		stm32f1_lowpower_debug(t);
 		return true;
 
 	case 0x430: /* XL-density */
 		t->driver = "STM32F1  XL density";
 		t->part_id = device_id;
+		t->check_id = stm32f1_check_id;
 		target_add_ram(t, 0x20000000, 0x18000);
 		stm32f1_add_flash(t, 0x8000000, 0x80000, 0x800);
 		stm32f1_add_flash(t, 0x8080000, 0x80000, 0x800);
 		target_add_commands(t, stm32f1_cmd_list, "STM32 XL/VL-XL");
+		stm32f1_lowpower_debug(t);
 		return true;
 
 	case 0x438: /* STM32F303x6/8 and STM32F328 */
@@ -299,9 +324,11 @@ bool stm32f1_probe(target *t)
 	case 0x439: /* STM32F302C8 */
 		t->driver = "STM32F3";
 		t->part_id = device_id;
+		t->check_id = stm32f1_check_id;
 		target_add_ram(t, 0x20000000, 0x10000);
 		stm32f1_add_flash(t, 0x8000000, 0x80000, 0x800);
 		target_add_commands(t, stm32f1_cmd_list, "STM32F3");
+		stm32f1_lowpower_debug(t);
 		return true;
 
 	case 0x444: /* STM32F03 RM0091 Rev.7, STM32F030x[4|6] RM0360 Rev. 4*/
@@ -340,6 +367,7 @@ bool stm32f1_probe(target *t)
 	target_add_commands(t, stm32f1_cmd_list, "STM32F0");
 
 	t->part_id = device_id;
+	t->check_id = stm32f1_check_id;
 
 	return true;
 }
@@ -357,6 +385,38 @@ static int stm32f1_flash_unlock(target *t, uint32_t bank_offset)
 	return 0;
 }
 
+/*
+ * Poll the status registers of the banks in use until neither is busy. On XL
+ * density parts both banks are checked in the same loop, so one bank can finish
+ * while the other is still working.
+ */
+static bool stm32f1_flash_wait(target *t, bool bank1, bool bank2, uint32_t *sr1, uint32_t *sr2)
+{
+	uint32_t status1 = 0;
+	uint32_t status2 = 0;
+	do {
+		if (bank1)
+			status1 = cortexm_mem_wait32(t, FLASH_SR, FLASH_SR_BSY);
+		if (bank2)
+			status2 = cortexm_mem_wait32(t, FLASH_SR + FLASH_BANK2_OFFSET, FLASH_SR_BSY);
+		if (target_check_error(t))
+			return false;
+	} while ((status1 | status2) & FLASH_SR_BSY);
+	*sr1 = status1;
+	*sr2 = status2;
+	return true;
+}
+
+static void stm32f1_flash_erase_page(target *t, uint32_t bank_offset, target_addr addr)
+{
+	/* Flash page erase instruction */
+	target_mem_write32(t, FLASH_CR + bank_offset, FLASH_CR_PER);
+	/* write address to FMA */
+	target_mem_write32(t, FLASH_AR + bank_offset, addr);
+	/* Flash page erase start instruction */
+	target_mem_write32(t, FLASH_CR + bank_offset, FLASH_CR_STRT | FLASH_CR_PER);
+}
+
 static int stm32f1_flash_erase(struct target_flash *f, target_addr addr, size_t len)
 {
 	target *t = f->t;
@@ -371,32 +431,29 @@ static int stm32f1_flash_erase(struct target_flash *f, target_addr addr, size_t
 		if (stm32f1_flash_unlock(t, 0))
 			return -1;
 
-	while (len) {
-		uint32_t bank_offset = 0;
-		if (addr >= FLASH_BANK_SPLIT)
-			bank_offset = FLASH_BANK2_OFFSET;
-
-		/* Flash page erase instruction */
-		target_mem_write32(t, FLASH_CR + bank_offset, FLASH_CR_PER);
-		/* write address to FMA */
-		target_mem_write32(t, FLASH_AR + bank_offset, addr);
-		/* Flash page erase start instruction */
-		target_mem_write32(t, FLASH_CR + bank_offset, FLASH_CR_STRT | FLASH_CR_PER);
+	/* When the range spans both banks, they each erase a page at the same time */
+	target_addr bank1_addr = addr;
+	const target_addr bank1_end = end < FLASH_BANK_SPLIT ? end + 1U : FLASH_BANK_SPLIT;
+	target_addr bank2_addr = addr < FLASH_BANK_SPLIT ? FLASH_BANK_SPLIT : addr;
+	while (bank1_addr < bank1_end || bank2_addr <= end) {
+		const bool bank1 = bank1_addr < bank1_end;
+		const bool bank2 = bank2_addr <= end;
+		if (bank1) {
+			stm32f1_flash_erase_page(t, 0, bank1_addr);
+			bank1_addr += f->blocksize;
+		}
+		if (bank2) {
+			stm32f1_flash_erase_page(t, FLASH_BANK2_OFFSET, bank2_addr);
+			bank2_addr += f->blocksize;
+		}
 
 		/* Read FLASH_SR to poll for BSY bit */
-		while (target_mem_read32(t, FLASH_SR + bank_offset) & FLASH_SR_BSY) {
-			if (target_check_error(t)) {
-				DEBUG_WARN("stm32f1 flash erase: comm error\n");
-				return -1;
-			}
+		uint32_t sr1;
+		uint32_t sr2;
+		if (!stm32f1_flash_wait(t, bank1, bank2, &sr1, &sr2)) {
+			DEBUG_WARN("stm32f1 flash erase: comm error\n");
+			return -1;
 		}
-
-		if (len > f->blocksize)
-			len -= f->blocksize;
-		else
-			len = 0;
-
-		addr += f->blocksize;
 	}
 
 	/* Check for error */
@@ -418,59 +475,58 @@ static int stm32f1_flash_erase(struct target_flash *f, target_addr addr, size_t
 	return 0;
 }
 
+/* Both banks program a halfword at a time, bank 2 has its own status register */
+static const struct flashloader_params stm32f1_loader[2] = {
+	{.width = 2U, .sr_addr = FLASH_SR, .busy_mask = FLASH_SR_BSY, .error_mask = SR_ERROR_MASK},
+	{.width = 2U, .sr_addr = FLASH_SR + FLASH_BANK2_OFFSET, .busy_mask = FLASH_SR_BSY, .error_mask = SR_ERROR_MASK},
+};
+
+/* Start programming a bank without waiting for the last halfword to complete */
+static int stm32f1_flash_write_bank(target *t, size_t bank, target_addr dest, const void *src, size_t len)
+{
+	const uint32_t bank_offset = bank ? FLASH_BANK2_OFFSET : 0U;
+	/* The erase may have been skipped for blank blocks, so the bank can still be locked */
+	if ((target_mem_read32(t, FLASH_CR + bank_offset) & FLASH_CR_LOCK) && stm32f1_flash_unlock(t, bank_offset))
+		return -1;
+	target_mem_write32(t, FLASH_CR + bank_offset, FLASH_CR_PG);
+	const int loader = flashloader_write(t, &stm32f1_loader[bank], dest, src, len);
+	if (loader < 0)
+		return -1;
+	if (loader)
+		cortexm_mem_write_sized(t, dest, src, len, ALIGN_HALFWORD);
+	return 0;
+}
+
 static int stm32f1_flash_write(struct target_flash *f, target_addr dest, const void *src, size_t len)
 {
 	target *t = f->t;
-	uint32_t sr;
-	size_t length = 0;
-
-	if (dest < FLASH_BANK_SPLIT) {
-		if ((dest + len - 1) >= FLASH_BANK_SPLIT)
-			length = FLASH_BANK_SPLIT - dest;
-		else
-			length = len;
+	size_t bank1_len = 0;
+	if (dest < FLASH_BANK_SPLIT)
+		bank1_len = MIN(len, FLASH_BANK_SPLIT - dest);
+	const size_t bank2_len = t->part_id == 0x430 ? len - bank1_len : 0;
 
-		target_mem_write32(t, FLASH_CR, FLASH_CR_PG);
-		cortexm_mem_write_sized(t, dest, src, length, ALIGN_HALFWORD);
+	/* Bank 2 is started while bank 1 is still finishing its data */
+	if (bank1_len && stm32f1_flash_write_bank(t, 0, dest, src, bank1_len))
+		return -1;
+	if (bank2_len &&
+		stm32f1_flash_write_bank(t, 1, dest + bank1_len, (const uint8_t *)src + bank1_len, bank2_len))
+		return -1;
 
-		/* Read FLASH_SR to poll for BSY bit */
-		/* Wait for completion or an error */
-		do {
-			sr = target_mem_read32(t, FLASH_SR);
-			if (target_check_error(t)) {
-				DEBUG_WARN("stm32f1 flash write: comm error\n");
-				return -1;
-			}
-		} while (sr & FLASH_SR_BSY);
-
-		if (sr & SR_ERROR_MASK) {
-			DEBUG_WARN("stm32f1 flash write error 0x%" PRIx32 "\n", sr);
-			return -1;
-		}
-		dest += length;
-		src += length;
+	/* Wait for completion or an error */
+	uint32_t sr1;
+	uint32_t sr2;
+	if (!stm32f1_flash_wait(t, bank1_len, bank2_len, &sr1, &sr2)) {
+		DEBUG_WARN("stm32f1 flash write: comm error\n");
+		return -1;
 	}
-
-	length = len - length;
-	if (t->part_id == 0x430 && length) { /* Write on bank 2 */
-		target_mem_write32(t, FLASH_CR + FLASH_BANK2_OFFSET, FLASH_CR_PG);
-		cortexm_mem_write_sized(t, dest, src, length, ALIGN_HALFWORD);
-		/* Read FLASH_SR to poll for BSY bit */
-		/* Wait for completion or an error */
-		do {
-			sr = target_mem_read32(t, FLASH_SR + FLASH_BANK2_OFFSET);
-			if (target_check_error(t)) {
-				DEBUG_WARN("stm32f1 flash bank2 write: comm error\n");
-				return -1;
-			}
-		} while (sr & FLASH_SR_BSY);
-
-		if (sr & SR_ERROR_MASK) {
-			DEBUG_WARN("stm32f1 flash bank2 write error 0x%" PRIx32 "\n", sr);
-			return -1;
-		}
+	if (sr1 & SR_ERROR_MASK) {
+		DEBUG_WARN("stm32f1 flash write error 0x%" PRIx32 "\n", sr1);
+		return -1;
+	}
+	if (sr2 & SR_ERROR_MASK) {
+		DEBUG_WARN("stm32f1 flash bank2 write error 0x%" PRIx32 "\n", sr2);
+		return -1;
 	}
-
 	return 0;
 }
 
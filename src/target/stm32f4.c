@@ -36,13 +36,14 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 
 static bool stm32f4_cmd_option(target *t, int argc, char **argv);
 static bool stm32f4_cmd_psize(target *t, int argc, char **argv);
 
 const struct command_s stm32f4_cmd_list[] = {
 	{"option", (cmd_handler)stm32f4_cmd_option, "Manipulate option bytes"},
-	{"psize", (cmd_handler)stm32f4_cmd_psize, "Configure flash write parallelism: (x8|x16|x32(default)|x64)"},
+	{"psize", (cmd_handler)stm32f4_cmd_psize, "Configure flash write parallelism: (auto(default)|x8|x16|x32|x64)"},
 	{NULL, NULL, NULL}
 };
 
@@ -50,6 +51,8 @@ static bool stm32f4_attach(target *t);
 static int stm32f4_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int stm32f4_flash_write(struct target_flash *f, target_addr dest, const void *src, size_t len);
 static bool stm32f4_mass_erase(target *t);
+static bool stm32f4_cmd_erase(target *t, uint32_t ctrl_reg);
+static int stm32f4_flash_bank_erase(struct target_flash *f);
 
 /* Flash Program and Erase Controller Register Map */
 #define FPEC_BASE	0x40023C00
@@ -112,6 +115,8 @@ static bool stm32f4_mass_erase(target *t);
 struct stm32f4_flash {
 	struct target_flash f;
 	enum align psize;
+	/* Pick psize from the target voltage at each erase */
+	bool psize_auto;
 	uint8_t base_sector;
 	uint8_t bank_split;
 };
@@ -156,10 +161,17 @@ static void stm32f4_add_flash(target *t,
 	f->erase = stm32f4_flash_erase;
 	f->write = stm32f4_flash_write;
 	f->buf_size = 1024;
+	f->writesize = 256;
 	f->erased = 0xff;
+	/* The ITCM aliases of F7 Flash are left to erase sector by sector */
+	if (addr >= AXIM_BASE) {
+		f->bank_erase = stm32f4_flash_bank_erase;
+		f->bank_id = base_sector >= 16U;
+	}
 	sf->base_sector = base_sector;
 	sf->bank_split = split;
 	sf->psize = ALIGN_WORD;
+	sf->psize_auto = true;
 	target_add_flash(t, f);
 }
 
@@ -206,6 +218,13 @@ static void stm32f4_detach(target *t)
 	cortexm_detach(t);
 }
 
+static bool stm32f4_check_id(target *t)
+{
+	const uint16_t dev_id = target_mem_read32(t, DBGMCU_IDCODE) & 0xfffU;
+	/* F405 revision A reads as F205, see stm32f4_probe() */
+	return dev_id == t->part_id || (t->part_id == ID_STM32F40X && dev_id == ID_STM32F20X);
+}
+
 bool stm32f4_probe(target *t)
 {
 	if (t->part_id == ID_STM32F20X) {
@@ -233,6 +252,7 @@ bool stm32f4_probe(target *t)
 		t->detach = stm32f4_detach;
 		t->driver = stm32f4_get_chip_name(t->part_id);
 		t->attach = stm32f4_attach;
+		t->check_id = stm32f4_check_id;
 		target_add_commands(t, stm32f4_cmd_list, t->driver);
 		return true;
 	default:
@@ -391,6 +411,37 @@ static void stm32f4_flash_unlock(target *t)
 	}
 }
 
+/*
+ * The widest parallelism the supply allows without VPP, RM0090 table 8: x32 from
+ * 2.7V, x16 from 2.1V and x8 below that. x64 needs VPP and is only used when asked for.
+ */
+static enum align stm32f4_psize_for_voltage(void)
+{
+#ifdef PLATFORM_HAS_POWER_SWITCH
+	/* In tenths of a volt, 0 when the probe can't tell */
+	const uint32_t voltage = platform_target_voltage_sense();
+	if (voltage && voltage < 21U)
+		return ALIGN_BYTE;
+	if (voltage && voltage < 27U)
+		return ALIGN_HALFWORD;
+#endif
+	return ALIGN_WORD;
+}
+
+static enum align stm32f4_flash_psize(target *t)
+{
+	enum align psize = ALIGN_WORD;
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		if (f->write != stm32f4_flash_write)
+			continue;
+		struct stm32f4_flash *sf = (struct stm32f4_flash *)f;
+		if (sf->psize_auto)
+			sf->psize = stm32f4_psize_for_voltage();
+		psize = sf->psize;
+	}
+	return psize;
+}
+
 static int stm32f4_flash_erase(struct target_flash *f, target_addr addr,
 							   size_t len)
 {
@@ -401,12 +452,7 @@ static int stm32f4_flash_erase(struct target_flash *f, target_addr addr,
 	uint8_t sector = sf->base_sector + (addr - f->start)/f->blocksize;
 	stm32f4_flash_unlock(t);
 
-	enum align psize = ALIGN_WORD;
-	for (struct target_flash *currf = t->flash; currf; currf = currf->next) {
-		if (currf->write == stm32f4_flash_write) {
-			psize = ((struct stm32f4_flash *)currf)->psize;
-		}
-	}
+	const enum align psize = stm32f4_flash_psize(t);
 	while(len) {
 		uint32_t cr = FLASH_CR_EOPIE | FLASH_CR_ERRIE | FLASH_CR_SER |
 			(psize * FLASH_CR_PSIZE16) | (sector << 3);
@@ -449,13 +495,22 @@ static int stm32f4_flash_write(struct target_flash *f,
 	target *t = f->t;
 	uint32_t sr;
 	enum align psize = ((struct stm32f4_flash *)f)->psize;
+	/* The erase may have been skipped for blank sectors, so unlock here too */
+	stm32f4_flash_unlock(t);
 	target_mem_write32(t, FLASH_CR,
 					   (psize * FLASH_CR_PSIZE16) | FLASH_CR_PG);
-	cortexm_mem_write_sized(t, dest, src, len, psize);
-	/* Read FLASH_SR to poll for BSY bit */
+	/* The loader has no byte variant, x8 parallelism falls back to direct writes */
+	const struct flashloader_params loader_params = {
+		.width = 1U << psize, .sr_addr = FLASH_SR, .busy_mask = FLASH_SR_BSY, .error_mask = SR_ERROR_MASK,
+	};
+	const int loader = flashloader_write(t, &loader_params, dest, src, len);
+	if (loader < 0)
+		return -1;
+	if (loader)
+		cortexm_mem_write_sized(t, dest, src, len, psize);
 	/* Wait for completion or an error */
 	do {
-		sr = target_mem_read32(t, FLASH_SR);
+		sr = cortexm_mem_wait32(t, FLASH_SR, FLASH_SR_BSY);
 		if(target_check_error(t)) {
 			DEBUG_WARN("stm32f4 flash write: comm error\n");
 			return -1;
@@ -472,12 +527,25 @@ static int stm32f4_flash_write(struct target_flash *f,
 static bool stm32f4_mass_erase(target *t)
 {
 	struct stm32f4_flash *sf = (struct stm32f4_flash *)t->flash;
-	stm32f4_flash_unlock(t);
-
 	/* Flash mass erase start instruction */
 	uint32_t ctrl_reg =  FLASH_CR_MER;
 	if (sf->bank_split)
 		ctrl_reg |=  FLASH_CR_MER1;
+	return stm32f4_cmd_erase(t, ctrl_reg);
+}
+
+/* MER erases bank 1 (or everything on single bank parts), MER1 bank 2 */
+static int stm32f4_flash_bank_erase(struct target_flash *f)
+{
+	return stm32f4_cmd_erase(f->t, f->bank_id ? FLASH_CR_MER1 : FLASH_CR_MER) ? 0 : -1;
+}
+
+static bool stm32f4_cmd_erase(target *t, uint32_t ctrl_reg)
+{
+	stm32f4_flash_unlock(t);
+
+	/* Mass erase is faster with wider parallelism too */
+	ctrl_reg |= stm32f4_flash_psize(t) * FLASH_CR_PSIZE16;
 	target_mem_write32(t, FLASH_CR, ctrl_reg);
 	target_mem_write32(t, FLASH_CR, ctrl_reg | FLASH_CR_STRT);
 
@@ -706,18 +774,20 @@ static bool stm32f4_cmd_option(target *t, int argc, char *argv[])
 static bool stm32f4_cmd_psize(target *t, int argc, char *argv[])
 {
 	if (argc == 1) {
-		enum align psize = ALIGN_WORD;
+		bool psize_auto = true;
 		for (struct target_flash *f = t->flash; f; f = f->next) {
 			if (f->write == stm32f4_flash_write) {
-				psize = ((struct stm32f4_flash *)f)->psize;
+				psize_auto = ((struct stm32f4_flash *)f)->psize_auto;
 			}
 		}
-		tc_printf(t, "Flash write parallelism: %s\n",
+		const enum align psize = stm32f4_flash_psize(t);
+		tc_printf(t, "Flash write parallelism: %s%s\n", psize_auto ? "auto, " : "",
 		          psize == ALIGN_DWORD ? "x64" :
 		          psize == ALIGN_WORD ? "x32" :
 				  psize == ALIGN_HALFWORD ? "x16" : "x8");
 	} else {
-		enum align psize;
+		enum align psize = ALIGN_WORD;
+		const bool psize_auto = !strcmp(argv[1], "auto");
 		if (!strcmp(argv[1], "x8")) {
 			psize = ALIGN_BYTE;
 		} else if (!strcmp(argv[1], "x16")) {
@@ -726,13 +796,14 @@ static bool stm32f4_cmd_psize(target *t, int argc, char *argv[])
 			psize = ALIGN_WORD;
 		} else if (!strcmp(argv[1], "x64")) {
 			psize = ALIGN_DWORD;
-		} else {
-			tc_printf(t, "usage: monitor psize (x8|x16|x32|x32)\n");
+		} else if (!psize_auto) {
+			tc_printf(t, "usage: monitor psize (auto|x8|x16|x32|x64)\n");
 			return false;
 		}
 		for (struct target_flash *f = t->flash; f; f = f->next) {
 			if (f->write == stm32f4_flash_write) {
 				((struct stm32f4_flash *)f)->psize = psize;
+				((struct stm32f4_flash *)f)->psize_auto = psize_auto;
 			}
 		}
 	}
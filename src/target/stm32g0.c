@@ -45,6 +45,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 #include "command.h"
 
 /* FLASH */
@@ -71,6 +72,7 @@
 #define FLASH_CR_LOCK                   (1U << 31U)
 #define FLASH_CR_OBL_LAUNCH             (1U << 27U)
 #define FLASH_CR_OPTSTART               (1U << 17U)
+#define FLASH_CR_FSTPG                  (1U << 18U)
 #define FLASH_CR_START                  (1U << 16U)
 #define FLASH_CR_MER2                   (1U << 15U)
 #define FLASH_CR_MER1                   (1U << 2U)
@@ -100,6 +102,9 @@
 	 FLASH_SR_OPERR)
 #define FLASH_SR_BSY_MASK               (FLASH_SR_BSY2 | FLASH_SR_BSY1)
 
+/* Fast programming writes a row of 32 double words at a time */
+#define FLASH_ROW_SIZE                  256U
+
 #define FLASH_OPTKEYR                   (G0_FLASH_BASE + 0x00C)
 #define FLASH_OPTKEYR_KEY1              0x08192A3B
 #define FLASH_OPTKEYR_KEY2              0x4C5D6E7F
@@ -156,12 +161,17 @@ typedef struct stm32g0_saved_regs {
 typedef struct stm32g0_priv {
 	stm32g0_saved_regs_s saved_regs;
 	bool irreversible_enabled;
+	/* Banks (bit 0 for bank 1) mass erased, so whole rows can use fast programming */
+	uint8_t fast_program;
+	/* Banks with a bank erase still running while the other bank is written */
+	uint8_t erasing;
 } stm32g0_priv_s;
 
 static bool stm32g0_attach(target *t);
 static void stm32g0_detach(target *t);
 static int stm32g0_flash_erase(target_flash_s *f, target_addr addr, size_t len);
 static int stm32g0_flash_write(target_flash_s *f, target_addr dest, const void *src, size_t len);
+static int stm32g0_flash_done(target_flash_s *f);
 static bool stm32g0_mass_erase(target *t);
 
 /* Custom commands */
@@ -189,7 +199,10 @@ static void stm32g0_add_flash(target *t, uint32_t addr, size_t length, size_t bl
 	f->blocksize = blocksize;
 	f->erase = stm32g0_flash_erase;
 	f->write = stm32g0_flash_write;
+	f->done = stm32g0_flash_done;
 	f->buf_size = blocksize;
+	/* Padding double words can't be programmed again later, ECC covers them */
+	f->writesize = FLASH_ROW_SIZE;
 	f->erased = 0xffU;
 	target_add_flash(t, f);
 }
@@ -328,6 +341,39 @@ static bool stm32g0_wait_busy(target *const t)
 	return true;
 }
 
+/* Index of the bank holding addr, 0 for bank 1 which the OTP area goes with */
+static uint8_t stm32g0_flash_bank(const target_flash_s *const f, const target_addr addr)
+{
+	if (f->t->part_id != STM32G0B_C || addr >= FLASH_OTP_START)
+		return 0U;
+	return addr - f->start >= f->length / 2U ? 1U : 0U;
+}
+
+/* Wait for the operations on one bank only, the other may still be erasing */
+static uint32_t stm32g0_wait_bank(target *const t, const uint8_t bank)
+{
+	return cortexm_mem_wait32(t, FLASH_SR, bank ? FLASH_SR_BSY2 : FLASH_SR_BSY1);
+}
+
+/* Collect the result of a bank erase left running by stm32g0_flash_erase() */
+static bool stm32g0_erase_finish(target *const t, const uint8_t banks)
+{
+	stm32g0_priv_s *ps = (stm32g0_priv_s *)t->target_storage;
+	if (!(ps->erasing & banks))
+		return true;
+	uint32_t status = 0;
+	for (uint8_t bank = 0; bank < 2U; ++bank) {
+		if (ps->erasing & banks & (1U << bank))
+			status = stm32g0_wait_bank(t, bank);
+	}
+	ps->erasing &= ~banks;
+	if (!(status & FLASH_SR_ERROR_MASK) && !target_check_error(t))
+		return true;
+	DEBUG_WARN("stm32g0 bank erase error: sr 0x%" PRIx32 "\n", status);
+	ps->fast_program = 0U;
+	return false;
+}
+
 static void stm32g0_flash_op_finish(target *t)
 {
 	target_mem_write32(t, FLASH_SR, FLASH_SR_EOP); // Clear EOP
@@ -358,17 +404,40 @@ static int stm32g0_flash_erase(target_flash_s *f, target_addr addr, size_t len)
 		return 0;
 	}
 
-	const size_t pages_to_erase = ((len - 1U) / f->blocksize) + 1U;
+	stm32g0_priv_s *ps = (stm32g0_priv_s *)t->target_storage;
+	size_t pages_to_erase = ((len - 1U) / f->blocksize) + 1U;
 	size_t bank1_end_page = FLASH_BANK2_START_PAGE - 1U;
 	if (t->part_id == STM32G0B_C) // Dual-bank devices
 		bank1_end_page = ((f->length / 2U) - 1U) / f->blocksize;
+	const size_t bank_pages = bank1_end_page + 1U;
 	uint32_t page = (addr - f->start) / f->blocksize;
 
 	stm32g0_flash_unlock(t);
 
-	for (size_t pages_erased = 0U; pages_erased < pages_to_erase; ++pages_erased) {
+	while (pages_to_erase) {
 		if (page < FLASH_BANK2_START_PAGE && page > bank1_end_page)
 			page = FLASH_BANK2_START_PAGE;
+		const uint8_t bank = page >= FLASH_BANK2_START_PAGE ? 1U : 0U;
+
+		/*
+		 * A whole bank of a dual-bank device is erased with a bank erase, which
+		 * is left running so that the other bank can be written meanwhile.
+		 * The bank is then also ready for fast programming.
+		 */
+		if (t->part_id == STM32G0B_C && page % FLASH_BANK2_START_PAGE == 0 && pages_to_erase >= bank_pages) {
+			target_mem_write32(t, FLASH_CR, (bank ? FLASH_CR_MER2 : FLASH_CR_MER1) | FLASH_CR_START);
+			ps->erasing |= 1U << bank;
+			ps->fast_program |= 1U << bank;
+			pages_to_erase -= bank_pages;
+			page += bank_pages;
+			if (pages_to_erase && !stm32g0_erase_finish(t, 1U << bank)) {
+				stm32g0_flash_op_finish(t);
+				return -1;
+			}
+			continue;
+		}
+		ps->fast_program &= ~(1U << bank);
+		--pages_to_erase;
 
 		/* Erase */
 		uint32_t ctrl = (page << FLASH_CR_PNB_SHIFT) | FLASH_CR_PER;
@@ -390,7 +459,10 @@ static int stm32g0_flash_erase(target_flash_s *f, target_addr addr, size_t len)
 	const uint32_t status = target_mem_read32(t, FLASH_SR);
 	if (status & FLASH_SR_ERROR_MASK)
 		DEBUG_WARN("stm32g0 flash erase error: sr 0x%" PRIx32 "\n", status);
-	stm32g0_flash_op_finish(t);
+	if (ps->erasing) /* Keep the bank erase bits while it runs */
+		stm32g0_flash_lock(t);
+	else
+		stm32g0_flash_op_finish(t);
 	return (status & FLASH_SR_ERROR_MASK) ? -1 : 0;
 }
 
@@ -413,18 +485,53 @@ static int stm32g0_flash_write(target_flash_s *f, target_addr dest, const void *
 		return -1;
 	}
 
+	/* Only the bank written has to be idle, the other one may still be erasing */
+	const uint8_t bank = stm32g0_flash_bank(f, dest);
+	if (!stm32g0_erase_finish(t, 1U << bank)) {
+		stm32g0_flash_op_finish(t);
+		return -1;
+	}
+
 	stm32g0_flash_unlock(t);
 
-	target_mem_write32(t, FLASH_CR, FLASH_CR_PG);
-	target_mem_write(t, dest, src, len);
+	struct flashloader_params loader_params = {
+		.width = 8U,
+		.sr_addr = FLASH_SR,
+		.busy_mask = bank ? FLASH_SR_BSY2 : FLASH_SR_BSY1,
+		.error_mask = FLASH_SR_ERROR_MASK,
+	};
+	int loader = 1;
+	/*
+	 * Fast programming needs the 32 double words of a row written back to back,
+	 * which only the loader can guarantee, so there is no SWD fallback for it.
+	 */
+	if ((ps->fast_program & (1U << bank)) && dest < FLASH_OTP_START && !(dest % FLASH_ROW_SIZE) &&
+		!(len % FLASH_ROW_SIZE)) {
+		target_mem_write32(t, FLASH_CR, FLASH_CR_FSTPG);
+		loader_params.width = FLASH_ROW_SIZE;
+		loader = flashloader_write(t, &loader_params, dest, src, len);
+		target_mem_write32(t, FLASH_CR, 0);
+		loader_params.width = 8U;
+	}
+	if (loader > 0) {
+		target_mem_write32(t, FLASH_CR, FLASH_CR_PG);
+		loader = flashloader_write(t, &loader_params, dest, src, len);
+		if (loader)
+			target_mem_write(t, dest, src, len);
+	}
+	if (loader < 0) {
+		ps->fast_program &= ~(1U << bank);
+		stm32g0_flash_op_finish(t);
+		return -1;
+	}
 	/* Wait for completion or an error */
-	if (!stm32g0_wait_busy(t)) {
+	const uint32_t status = stm32g0_wait_bank(t, bank);
+	if (target_check_error(t)) {
 		DEBUG_WARN("stm32g0 flash write: comm error\n");
 		stm32g0_flash_op_finish(t);
 		return -1;
 	}
 
-	const uint32_t status = target_mem_read32(t, FLASH_SR);
 	if (status & FLASH_SR_ERROR_MASK) {
 		DEBUG_WARN("stm32g0 flash write error: sr 0x%" PRIx32 "\n", status);
 		stm32g0_flash_op_finish(t);
@@ -440,6 +547,18 @@ static int stm32g0_flash_write(target_flash_s *f, target_addr dest, const void *
 	return 0;
 }
 
+/* Wait for a bank erase that outlived the writes, such as for a bank left empty */
+static int stm32g0_flash_done(target_flash_s *f)
+{
+	target *const t = f->t;
+	stm32g0_priv_s *ps = (stm32g0_priv_s *)t->target_storage;
+	if (!ps->erasing)
+		return 0;
+	const bool ok = stm32g0_erase_finish(t, ps->erasing);
+	stm32g0_flash_op_finish(t);
+	return ok ? 0 : -1;
+}
+
 static bool stm32g0_mass_erase(target *t)
 {
 	const uint32_t flash_cr = FLASH_CR_MER1 | FLASH_CR_MER2 | FLASH_CR_START;
@@ -461,6 +580,8 @@ static bool stm32g0_mass_erase(target *t)
 	/* Check for error */
 	uint16_t flash_sr = target_mem_read32(t, FLASH_SR);
 	error = flash_sr & FLASH_SR_ERROR_MASK;
+	if (!error)
+		((stm32g0_priv_s *)t->target_storage)->fast_program = 3U;
 
 exit_cleanup:
 	stm32g0_flash_lock(t);
@@ -503,7 +624,10 @@ static bool stm32g0_cmd_erase_bank(target *t, int argc, const char **argv)
 	/* Check for error */
 	const uint16_t flash_sr = target_mem_read32(t, FLASH_SR);
 	stm32g0_flash_lock(t);
-	return !(flash_sr & FLASH_SR_ERROR_MASK);
+	if (flash_sr & FLASH_SR_ERROR_MASK)
+		return false;
+	((stm32g0_priv_s *)t->target_storage)->fast_program |= (flash_cr & FLASH_CR_MER2) ? 2U : 1U;
+	return true;
 }
 
 static void stm32g0_flash_option_unlock(target *t)
@@ -36,6 +36,8 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
+#include "spi.h"
 
 /* static bool stm32h7_cmd_option(target *t, int argc, char *argv[]); */
 static bool stm32h7_uid(target *t, int argc, const char **argv);
@@ -55,7 +57,9 @@ const struct command_s stm32h7_cmd_list[] = {
 
 static int stm32h7_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int stm32h7_flash_write(struct target_flash *f, target_addr dest, const void *src, size_t len);
+static int stm32h7_flash_done(struct target_flash *f);
 static bool stm32h7_mass_erase(target *t);
+static int stm32h7_flash_bank_erase(struct target_flash *f);
 
 static const char stm32h7_driver_str[] = "STM32H7";
 
@@ -145,6 +149,41 @@ enum stm32h7_regs {
 #define NUM_SECTOR_PER_BANK 8
 #define FLASH_SECTOR_SIZE 	0x20000
 #define BANK2_START         0x08100000
+
+/* QUADSPI, RM0433 23. The H72x and H7Bx have OCTOSPI instead */
+#define QSPI_BASE			0x52005000
+#define QSPI_CR				(QSPI_BASE + 0x00)
+#define QSPI_DCR			(QSPI_BASE + 0x04)
+#define QSPI_SR				(QSPI_BASE + 0x08)
+#define QSPI_FCR			(QSPI_BASE + 0x0c)
+#define QSPI_DLR			(QSPI_BASE + 0x10)
+#define QSPI_CCR			(QSPI_BASE + 0x14)
+#define QSPI_AR				(QSPI_BASE + 0x18)
+#define QSPI_DR				(QSPI_BASE + 0x20)
+#define QSPI_CR_EN			(1 << 0)
+#define QSPI_CR_ABORT		(1 << 1)
+#define QSPI_CR_DFM			(1 << 6)
+#define QSPI_DCR_FSIZE_SHIFT	16
+#define QSPI_DCR_FSIZE_MASK		(0x1f << 16)
+#define QSPI_SR_TCF			(1 << 1)
+#define QSPI_SR_BUSY		(1 << 5)
+#define QSPI_FCR_CTCF		(1 << 1)
+#define QSPI_CCR_IMODE_1LINE	(1 << 8)
+#define QSPI_CCR_ADMODE_1LINE	(1 << 10)
+#define QSPI_CCR_ADSIZE_24BIT	(2 << 12)
+#define QSPI_CCR_DCYC_SHIFT		18
+#define QSPI_CCR_DMODE_MASK		(3 << 24)
+#define QSPI_CCR_DMODE_1LINE	(1 << 24)
+#define QSPI_CCR_DMODE_4LINES	(3 << 24)
+#define QSPI_CCR_FMODE_MASK		(3U << 26)
+#define QSPI_CCR_FMODE_WRITE	(0U << 26)
+#define QSPI_CCR_FMODE_READ		(1U << 26)
+#define QSPI_CCR_FMODE_MMAP		(3U << 26)
+#define QSPI_BANK_BASE		0x90000000
+#define QSPI_TIMEOUT		100
+/* Fast read, 1 line and 8 dummy cycles, for when the application hadn't mapped the Flash */
+#define QSPI_CCR_FAST_READ	(QSPI_CCR_FMODE_MMAP | QSPI_CCR_IMODE_1LINE | QSPI_CCR_ADMODE_1LINE | \
+	QSPI_CCR_ADSIZE_24BIT | QSPI_CCR_DMODE_1LINE | (8 << QSPI_CCR_DCYC_SHIFT) | 0x0b)
 enum ID_STM32H7 {
 	ID_STM32H74x  = 0x4500,      /* RM0433, RM0399 */
 	ID_STM32H7Bx  = 0x4800,      /* RM0455 */
@@ -155,10 +194,14 @@ struct stm32h7_flash {
 	struct target_flash f;
 	enum align psize;
 	uint32_t regbase;
+	/* Flash words have been queued on this bank without waiting for them */
+	bool write_pending;
 };
 
 struct stm32h7_priv_s {
 	uint32_t dbg_cr;
+	/* QUADSPI memory mapped setup of the application, while the Flash behind it is programmed */
+	uint32_t qspi_ccr;
 };
 
 static void stm32h7_add_flash(target *t, uint32_t addr, size_t length, size_t blocksize)
@@ -175,15 +218,119 @@ static void stm32h7_add_flash(target *t, uint32_t addr, size_t length, size_t bl
 	f->blocksize = blocksize;
 	f->erase = stm32h7_flash_erase;
 	f->write = stm32h7_flash_write;
+	f->done = stm32h7_flash_done;
 	f->buf_size = 2048;
+	/* Rows of 8 Flash words, padding ones would take ECC and couldn't be programmed later */
+	f->writesize = 256;
 	f->erased = 0xff;
+	f->bank_erase = stm32h7_flash_bank_erase;
 	sf->regbase = FPEC1_BASE;
-	if (addr >= BANK2_START)
+	if (addr >= BANK2_START) {
 		sf->regbase = FPEC2_BASE;
+		f->bank_id = 1;
+	}
 	sf->psize = ALIGN_DWORD;
 	target_add_flash(t, f);
 }
 
+static bool stm32h7_qspi_wait(target *t, uint32_t mask, uint32_t value)
+{
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, QSPI_TIMEOUT);
+	while ((target_mem_read32(t, QSPI_SR) & mask) != value) {
+		if (target_check_error(t) || platform_timeout_is_expired(&timeout)) {
+			DEBUG_WARN("QUADSPI timed out\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+static void stm32h7_qspi_command(target *t, uint16_t command, target_addr address, size_t length, uint32_t fmode)
+{
+	stm32h7_qspi_wait(t, QSPI_SR_BUSY, 0);
+	target_mem_write32(t, QSPI_FCR, QSPI_FCR_CTCF);
+	uint32_t ccr = fmode | QSPI_CCR_IMODE_1LINE | (command & SPI_FLASH_OPCODE_MASK);
+	ccr |= ((command & SPI_FLASH_DUMMY_MASK) >> SPI_FLASH_DUMMY_SHIFT) * 8U << QSPI_CCR_DCYC_SHIFT;
+	if (length) {
+		target_mem_write32(t, QSPI_DLR, length - 1U);
+		ccr |= (command & SPI_FLASH_DATA_QUAD) ? QSPI_CCR_DMODE_4LINES : QSPI_CCR_DMODE_1LINE;
+	}
+	const bool has_address = (command & SPI_FLASH_FRAME_MASK) == SPI_FLASH_FRAME_3B_ADDR;
+	if (has_address)
+		ccr |= QSPI_CCR_ADMODE_1LINE | QSPI_CCR_ADSIZE_24BIT;
+	/* The transfer starts with this write, or that of the address */
+	target_mem_write32(t, QSPI_CCR, ccr);
+	if (has_address)
+		target_mem_write32(t, QSPI_AR, address);
+}
+
+static void stm32h7_qspi_read(target *t, uint16_t command, target_addr address, void *buffer, size_t length)
+{
+	stm32h7_qspi_command(t, command, address, length, length ? QSPI_CCR_FMODE_READ : QSPI_CCR_FMODE_WRITE);
+	uint8_t *const data = (uint8_t *)buffer;
+	for (size_t i = 0; i < length; ++i)
+		data[i] = target_mem_read8(t, QSPI_DR);
+	stm32h7_qspi_wait(t, QSPI_SR_TCF, QSPI_SR_TCF);
+}
+
+static void stm32h7_qspi_write(target *t, uint16_t command, target_addr address, const void *buffer, size_t length)
+{
+	stm32h7_qspi_command(t, command, address, length, QSPI_CCR_FMODE_WRITE);
+	/* Whole words where we can, each goes into the FIFO as 4 bytes */
+	const uint8_t *const data = (const uint8_t *)buffer;
+	size_t i = 0;
+	for (; i + 4U <= length; i += 4U)
+		target_mem_write32(t, QSPI_DR, data[i] | (data[i + 1U] << 8U) | (data[i + 2U] << 16U) |
+			((uint32_t)data[i + 3U] << 24U));
+	for (; i < length; ++i)
+		target_mem_write8(t, QSPI_DR, data[i]);
+	stm32h7_qspi_wait(t, QSPI_SR_TCF, QSPI_SR_TCF);
+}
+
+/* Memory mapped mode has to be aborted for anything else */
+static void stm32h7_qspi_prepare(target *t)
+{
+	struct stm32h7_priv_s *ps = (struct stm32h7_priv_s*)t->target_storage;
+	ps->qspi_ccr = target_mem_read32(t, QSPI_CCR);
+	target_mem_write32(t, QSPI_CR, target_mem_read32(t, QSPI_CR) | QSPI_CR_ABORT);
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, QSPI_TIMEOUT);
+	while ((target_mem_read32(t, QSPI_CR) & QSPI_CR_ABORT) && !platform_timeout_is_expired(&timeout))
+		continue;
+}
+
+static void stm32h7_qspi_resume(target *t)
+{
+	struct stm32h7_priv_s *ps = (struct stm32h7_priv_s*)t->target_storage;
+	uint32_t ccr = ps->qspi_ccr;
+	if ((ccr & QSPI_CCR_FMODE_MASK) != QSPI_CCR_FMODE_MMAP)
+		ccr = QSPI_CCR_FAST_READ;
+	stm32h7_qspi_wait(t, QSPI_SR_BUSY, 0);
+	target_mem_write32(t, QSPI_CCR, ccr);
+}
+
+/* External Flash on QUADSPI, when the application has set the controller up.
+ * We know neither the pins nor the clocks it's wired up with otherwise */
+static void stm32h7_qspi_add_flash(target *t)
+{
+	const uint32_t cr = target_mem_read32(t, QSPI_CR);
+	const uint32_t fsize = (target_mem_read32(t, QSPI_DCR) & QSPI_DCR_FSIZE_MASK) >> QSPI_DCR_FSIZE_SHIFT;
+	if (!(cr & QSPI_CR_EN) || !fsize || (cr & QSPI_CR_DFM))
+		return;
+	const uint32_t ccr = target_mem_read32(t, QSPI_CCR);
+	const spi_bus_s bus = {
+		.read = stm32h7_qspi_read,
+		.write = stm32h7_qspi_write,
+		.prepare = stm32h7_qspi_prepare,
+		.resume = stm32h7_qspi_resume,
+		.quad = (ccr & QSPI_CCR_FMODE_MASK) == QSPI_CCR_FMODE_MMAP &&
+			(ccr & QSPI_CCR_DMODE_MASK) == QSPI_CCR_DMODE_4LINES,
+	};
+	/* FSIZE + 1 address bits, only 24 of which the commands carry */
+	spi_flash_add(t, QSPI_BANK_BASE, 2U << MIN(fsize, 23U), &bus);
+}
+
 static bool stm32h7_attach(target *t)
 {
 	if (!cortexm_attach(t))
@@ -211,6 +358,8 @@ static bool stm32h7_attach(target *t)
 	/* Add the flash to memory map. */
 	stm32h7_add_flash(t, 0x8000000, 0x100000, FLASH_SECTOR_SIZE);
 	stm32h7_add_flash(t, 0x8100000, 0x100000, FLASH_SECTOR_SIZE);
+	if (t->part_id == ID_STM32H74x)
+		stm32h7_qspi_add_flash(t);
 	return true;
 }
 
@@ -250,11 +399,13 @@ static bool stm32h7_flash_unlock(target *t, const uint32_t addr)
 	if (addr >= BANK2_START)
 		regbase = FPEC2_BASE;
 
-	while (target_mem_read32(t, regbase + FLASH_SR) & FLASH_SR_BSY) {
+	/* Also waits out flash words a previous write left queued */
+	uint32_t status;
+	while ((status = target_mem_read32(t, regbase + FLASH_SR)) & (FLASH_SR_BSY | FLASH_SR_QW)) {
 		if (target_check_error(t))
 			return false;
 	}
-	const uint32_t status = target_mem_read32(t, regbase + FLASH_SR) & FLASH_SR_ERROR_MASK;
+	status &= FLASH_SR_ERROR_MASK;
 	if (status) {
 		DEBUG_WARN("%s error 0x%08" PRIx32, __func__, status);
 		target_mem_write32(t, regbase + FLASH_CCR, status);
@@ -308,33 +459,72 @@ static int stm32h7_flash_erase(struct target_flash *f, target_addr addr, size_t
 	return 0;
 }
 
+/*
+ * Each bank has its own controller, so a write only queues its flash words and
+ * returns. The controller keeps programming the tail of the data while the next
+ * buffer is transferred, or while the other bank is being written. Errors are
+ * picked up by the next operation on the bank or by stm32h7_flash_done().
+ */
 static int stm32h7_flash_write(struct target_flash *f, target_addr dest, const void *src, size_t len)
 {
 	target *t = f->t;
 	struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
 	enum align psize = sf->psize;
+	sf->write_pending = false;
 	if (!stm32h7_flash_unlock(t, dest))
 		return -1;
 	uint32_t cr = psize * FLASH_CR_PSIZE16;
 	target_mem_write32(t, sf->regbase + FLASH_CR, cr);
 	cr |= FLASH_CR_PG;
 	target_mem_write32(t, sf->regbase + FLASH_CR, cr);
-	/* does H7 stall?*/
-	uint32_t status_reg = sf->regbase + FLASH_SR;
-	uint32_t status = 0;
-	target_mem_write(t, dest, src, len);
-	while ((status = target_mem_read32(t, status_reg)) & FLASH_SR_BSY) {
-		if(target_check_error(t)) {
+	/* The loader stores a double word at a time and waits whenever a 256 bit flash word is queued */
+	const struct flashloader_params loader_params = {
+		.width = 8U,
+		.sr_addr = sf->regbase + FLASH_SR,
+		.busy_mask = FLASH_SR_QW,
+		.error_mask = FLASH_SR_ERROR_MASK,
+	};
+	const int loader = psize == ALIGN_DWORD ? flashloader_write(t, &loader_params, dest, src, len) : 1;
+	if (loader < 0) {
+		DEBUG_WARN("stm32h7_flash_write: loader failed, sr %08" PRIx32 "\n",
+			target_mem_read32(t, sf->regbase + FLASH_SR));
+		target_mem_write32(t, sf->regbase + FLASH_CR, 0);
+		return -1;
+	}
+	if (loader)
+		target_mem_write(t, dest, src, len);
+	/* A flash word that is only partly written is never queued by itself */
+	if (len % 32U)
+		target_mem_write32(t, sf->regbase + FLASH_CR, cr | FLASH_CR_FW);
+	if (target_check_error(t)) {
+		DEBUG_WARN("stm32h7_flash_write: comm failed\n");
+		return -1;
+	}
+	sf->write_pending = true;
+	return 0;
+}
+
+static int stm32h7_flash_done(struct target_flash *f)
+{
+	target *t = f->t;
+	struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
+	if (!sf->write_pending)
+		return 0;
+	sf->write_pending = false;
+	uint32_t status;
+	while ((status = target_mem_read32(t, sf->regbase + FLASH_SR)) & (FLASH_SR_BSY | FLASH_SR_QW)) {
+		if (target_check_error(t)) {
 			DEBUG_WARN("stm32h7_flash_write: BSY comm failed\n");
 			return -1;
 		}
 	}
+	/* Close write windows.*/
+	target_mem_write32(t, sf->regbase + FLASH_CR, 0);
 	if (status & FLASH_SR_ERROR_MASK) {
 		DEBUG_WARN("stm32h7_flash_write: error sr %08" PRIx32 "\n", status);
+		target_mem_write32(t, sf->regbase + FLASH_CCR, status & FLASH_SR_ERROR_MASK);
 		return -1;
 	}
-	/* Close write windows.*/
-	target_mem_write32(t, sf->regbase + FLASH_CR, 0);
 	return 0;
 }
 
@@ -372,6 +562,18 @@ static bool stm32h7_check_bank(target *const t, const uint32_t reg_base)
 	return !(status & FLASH_SR_ERROR_MASK);
 }
 
+static int stm32h7_flash_bank_erase(struct target_flash *f)
+{
+	struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
+	if (!stm32h7_erase_bank(f->t, sf->psize, f->start, sf->regbase))
+		return -1;
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, 500);
+	if (!stm32h7_wait_erase_bank(f->t, &timeout, sf->regbase))
+		return -1;
+	return stm32h7_check_bank(f->t, sf->regbase) ? 0 : -1;
+}
+
 /* Both banks are erased in parallel.*/
 static bool stm32h7_mass_erase(target *t)
 {
@@ -78,6 +78,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 
 #define STM32Lx_NVM_PECR(p)    ((p) + 0x04)
 #define STM32Lx_NVM_PEKEYR(p)  ((p) + 0x0C)
@@ -148,6 +149,15 @@ static int stm32lx_nvm_prog_write(struct target_flash *f, target_addr destinatio
 
 static int stm32lx_nvm_data_erase(struct target_flash *f, target_addr addr, size_t len);
 static int stm32lx_nvm_data_write(struct target_flash *f, target_addr destination, const void *source, size_t size);
+static int stm32lx_nvm_done(struct target_flash *f);
+
+/* The NVM is unlocked and PECR set up once for all the writes to a region,
+ * rather than again for each buffer, until an erase or the end of the session */
+struct stm32lx_flash {
+	struct target_flash f;
+	bool prepared;
+	uint32_t pecr;
+};
 
 static bool stm32lx_cmd_option(target *t, int argc, char **argv);
 static bool stm32lx_cmd_eeprom(target *t, int argc, char **argv);
@@ -220,34 +230,40 @@ static uint32_t stm32lx_nvm_option_size(target *t)
 
 static void stm32l_add_flash(target *t, uint32_t addr, size_t length, size_t erasesize)
 {
-	struct target_flash *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	struct stm32lx_flash *lf = calloc(1, sizeof(*lf));
+	if (!lf) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	struct target_flash *f = &lf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = erasesize;
 	f->erase = stm32lx_nvm_prog_erase;
 	f->write = stm32lx_nvm_prog_write;
-	f->buf_size = erasesize / 2;
+	f->done = stm32lx_nvm_done;
+	/* Both half pages of a page per write. Not more, the buffer is padded
+	 * with the erased value of 0 and would program pages not erased. */
+	f->buf_size = erasesize;
 	target_add_flash(t, f);
 }
 
 static void stm32l_add_eeprom(target *t, uint32_t addr, size_t length)
 {
-	struct target_flash *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	struct stm32lx_flash *lf = calloc(1, sizeof(*lf));
+	if (!lf) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	struct target_flash *f = &lf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = 4;
 	f->erase = stm32lx_nvm_data_erase;
 	f->write = stm32lx_nvm_data_write;
+	f->done = stm32lx_nvm_done;
 	target_add_flash(t, f);
 }
 
@@ -267,6 +283,9 @@ bool stm32l0_probe(target *t)
 		stm32l_add_flash(t, 0x8000000, 0x80000, 0x100);
 		//stm32l_add_eeprom(t, 0x8080000, 0x4000);
 		target_add_commands(t, stm32lx_cmd_list, "STM32L1x");
+		/* DBG_SLEEP, DBG_STOP and DBG_STANDBY, the L0 DBGMCU needs its clock enabling first */
+		t->lowpower_debug_reg = STM32L1_DBGMCU_IDCODE_PHYS + 4U;
+		t->lowpower_debug_bits = 0x7U;
 		return true;
 	case 0x457: /* STM32L0xx Cat1 */
 	case 0x425: /* STM32L0xx Cat2 */
@@ -321,6 +340,69 @@ static bool stm32lx_nvm_opt_unlock(target *t, uint32_t nvm)
 	return !(target_mem_read32(t, STM32Lx_NVM_PECR(nvm)) & STM32Lx_NVM_PECR_OPTLOCK);
 }
 
+/* Any other NVM operation locks PECR again or changes its mode */
+static void stm32lx_nvm_unprepare(target *t)
+{
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		if (f->erase == stm32lx_nvm_prog_erase || f->erase == stm32lx_nvm_data_erase)
+			((struct stm32lx_flash *)f)->prepared = false;
+	}
+}
+
+/** Unlock the NVM and select the programming mode pecr, unless already
+    done for this region since the last erase. */
+static bool stm32lx_nvm_prepare(struct target_flash *f, uint32_t pecr)
+{
+	struct stm32lx_flash *lf = (struct stm32lx_flash *)f;
+	if (lf->prepared && lf->pecr == pecr)
+		return true;
+
+	target *t = f->t;
+	const uint32_t nvm = stm32lx_nvm_phys(t);
+	stm32lx_nvm_unprepare(t);
+	if (!stm32lx_nvm_prog_data_unlock(t, nvm))
+		return false;
+
+	/* Wait for BSY to clear because we cannot write the PECR until
+	   the previous operation completes on STM32Lxxx. */
+	while (target_mem_read32(t, STM32Lx_NVM_SR(nvm)) & STM32Lx_NVM_SR_BSY)
+		if (target_check_error(t))
+			return false;
+
+	target_mem_write32(t, STM32Lx_NVM_SR(nvm), STM32Lx_NVM_SR_ERR_M);
+	target_mem_write32(t, STM32Lx_NVM_PECR(nvm), pecr);
+	lf->prepared = true;
+	lf->pecr = pecr;
+	return true;
+}
+
+/** Lock the NVM again at the end of a session and collect any error
+    left by the writes that were not waited for. */
+static int stm32lx_nvm_done(struct target_flash *f)
+{
+	struct stm32lx_flash *lf = (struct stm32lx_flash *)f;
+	if (!lf->prepared)
+		return 0;
+
+	target *t = f->t;
+	const uint32_t nvm = stm32lx_nvm_phys(t);
+	lf->prepared = false;
+
+	/* Disable further programming by locking PECR */
+	stm32lx_nvm_lock(t, nvm);
+
+	/* Wait for completion or an error */
+	uint32_t sr;
+	do {
+		sr = target_mem_read32(t, STM32Lx_NVM_SR(nvm));
+	} while (sr & STM32Lx_NVM_SR_BSY);
+
+	if ((sr & STM32Lx_NVM_SR_ERR_M) || !(sr & STM32Lx_NVM_SR_EOP) || target_check_error(t))
+		return -1;
+
+	return 0;
+}
+
 /** Erase a region of program flash using operations through the debug
     interface.  This is slower than stubbed versions(see NOTES).  The
     flash array is erased for all pages from addr to addr+len
@@ -331,6 +413,7 @@ static int stm32lx_nvm_prog_erase(struct target_flash *f, target_addr addr, size
 	const size_t page_size = f->blocksize;
 	const uint32_t nvm = stm32lx_nvm_phys(t);
 
+	stm32lx_nvm_unprepare(t);
 	if (!stm32lx_nvm_prog_data_unlock(t, nvm))
 		return -1;
 
@@ -370,37 +453,35 @@ static int stm32lx_nvm_prog_erase(struct target_flash *f, target_addr addr, size
 	return 0;
 }
 
-/** Write to program flash using operations through the debug
-    interface. */
+/** Write to program flash a half page at a time. Half page writes have
+    to follow each other without a gap, which a loader in RAM does
+    reliably, otherwise they are made through the debug interface. */
 static int stm32lx_nvm_prog_write(struct target_flash *f, target_addr dest, const void *src, size_t size)
 {
 	target *t = f->t;
 	const uint32_t nvm = stm32lx_nvm_phys(t);
+	const size_t half_page = f->blocksize / 2U;
 
-	if (!stm32lx_nvm_prog_data_unlock(t, nvm))
+	if (!stm32lx_nvm_prepare(f, STM32Lx_NVM_PECR_PROG | STM32Lx_NVM_PECR_FPRG))
 		return -1;
 
-	/* Wait for BSY to clear because we cannot write the PECR until
-	   the previous operation completes on STM32Lxxx. */
-	while (target_mem_read32(t, STM32Lx_NVM_SR(nvm)) & STM32Lx_NVM_SR_BSY)
-		if (target_check_error(t))
+	const struct flashloader_params params = {
+		.width = half_page,
+		.sr_addr = STM32Lx_NVM_SR(nvm),
+		.busy_mask = STM32Lx_NVM_SR_BSY,
+		.error_mask = STM32Lx_NVM_SR_ERR_M,
+	};
+	const int result = flashloader_write(t, &params, dest, src, size);
+	if (result <= 0)
+		return result;
+
+	const uint8_t *data = src;
+	for (size_t offset = 0; offset < size; offset += half_page) {
+		target_mem_write(t, dest + offset, data + offset, half_page);
+		const uint32_t sr = cortexm_mem_wait32(t, STM32Lx_NVM_SR(nvm), STM32Lx_NVM_SR_BSY);
+		if ((sr & STM32Lx_NVM_SR_ERR_M) || target_check_error(t))
 			return -1;
-
-	target_mem_write32(t, STM32Lx_NVM_PECR(nvm), STM32Lx_NVM_PECR_PROG | STM32Lx_NVM_PECR_FPRG);
-	target_mem_write(t, dest, src, size);
-
-	/* Disable further programming by locking PECR */
-	stm32lx_nvm_lock(t, nvm);
-
-	/* Wait for completion or an error */
-	uint32_t sr;
-	do {
-		sr = target_mem_read32(t, STM32Lx_NVM_SR(nvm));
-	} while (sr & STM32Lx_NVM_SR_BSY);
-
-	if ((sr & STM32Lx_NVM_SR_ERR_M) || !(sr & STM32Lx_NVM_SR_EOP) || target_check_error(t))
-		return -1;
-
+	}
 	return 0;
 }
 
@@ -418,6 +499,7 @@ static int stm32lx_nvm_data_erase(struct target_flash *f, target_addr addr, size
 	len += (addr & 3);
 	addr &= ~3;
 
+	stm32lx_nvm_unprepare(t);
 	if (!stm32lx_nvm_prog_data_unlock(t, nvm))
 		return -1;
 
@@ -461,15 +543,14 @@ static int stm32lx_nvm_data_erase(struct target_flash *f, target_addr addr, size
 static int stm32lx_nvm_data_write(struct target_flash *f, target_addr destination, const void *src, size_t size)
 {
 	target *t = f->t;
-	const uint32_t nvm = stm32lx_nvm_phys(t);
 	const bool is_stm32l1 = stm32lx_is_stm32l1(t);
 	uint32_t *source = (uint32_t *)src;
 
-	if (!stm32lx_nvm_prog_data_unlock(t, nvm))
+	if (!stm32lx_nvm_prepare(f, is_stm32l1 ? 0 : STM32Lx_NVM_PECR_DATA))
 		return -1;
 
-	target_mem_write32(t, STM32Lx_NVM_PECR(nvm), is_stm32l1 ? 0 : STM32Lx_NVM_PECR_DATA);
-
+	/* The bus holds each write until the previous one completes, so the words
+	   follow each other without polling and errors are collected when done */
 	while (size) {
 		size -= 4;
 		uint32_t v = *source++;
@@ -479,19 +560,6 @@ static int stm32lx_nvm_data_write(struct target_flash *f, target_addr destinatio
 		if (target_check_error(t))
 			return -1;
 	}
-
-	/* Disable further programming by locking PECR */
-	stm32lx_nvm_lock(t, nvm);
-
-	/* Wait for completion or an error */
-	uint32_t sr;
-	do {
-		sr = target_mem_read32(t, STM32Lx_NVM_SR(nvm));
-	} while (sr & STM32Lx_NVM_SR_BSY);
-
-	if ((sr & STM32Lx_NVM_SR_ERR_M) || !(sr & STM32Lx_NVM_SR_EOP) || target_check_error(t))
-		return -1;
-
 	return 0;
 }
 
@@ -40,6 +40,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 #include "gdb_packet.h"
 
 static bool stm32l4_cmd_erase_bank1(target *t, int argc, const char **argv);
@@ -56,6 +57,7 @@ const struct command_s stm32l4_cmd_list[] = {
 static int stm32l4_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int stm32l4_flash_write(struct target_flash *f, target_addr dest, const void *src, size_t len);
 static bool stm32l4_mass_erase(target *t);
+static int stm32l4_flash_bank_erase(struct target_flash *f);
 
 /* Flash Program ad Erase Controller Register Map */
 #define L4_FPEC_BASE			0x40022000
@@ -130,8 +132,13 @@ enum {
 struct stm32l4_flash {
 	struct target_flash f;
 	uint32_t bank1_start;
+	/* The bank has been mass erased, so whole rows can use fast programming */
+	bool fast_program;
 };
 
+/* Fast programming writes a row of 32 double words at a time */
+#define STM32L4_ROW_SIZE	256U
+
 struct stm32l4_priv_s {
 	uint32_t dbgmcu_cr;
 };
@@ -379,7 +386,11 @@ static void stm32l4_add_flash(target *t, uint32_t addr, size_t length, size_t bl
 	f->erase = stm32l4_flash_erase;
 	f->write = stm32l4_flash_write;
 	f->buf_size = 2048;
+	/* Padding double words can't be programmed again later, ECC covers them */
+	f->writesize = STM32L4_ROW_SIZE;
 	f->erased = 0xff;
+	f->bank_erase = stm32l4_flash_bank_erase;
+	f->bank_id = addr >= bank1_start;
 	sf->bank1_start = bank1_start;
 	target_add_flash(t, f);
 }
@@ -585,6 +596,7 @@ static int stm32l4_flash_erase(struct target_flash *f, target_addr addr, size_t
 	const uint32_t blocksize = f->blocksize;
 	uint32_t page = (addr - 0x08000000) / blocksize;
 	const uint32_t bank1_start = ((struct stm32l4_flash *)f)->bank1_start;
+	((struct stm32l4_flash *)f)->fast_program = false;
 	while (len) {
 		uint32_t ctrl_reg = FLASH_CR_PER | (page << FLASH_CR_PAGE_SHIFT);
 		if (addr >= bank1_start)
@@ -617,8 +629,36 @@ static int stm32l4_flash_erase(struct target_flash *f, target_addr addr, size_t
 static int stm32l4_flash_write(struct target_flash *f, target_addr dest, const void *src, size_t len)
 {
 	target *t = f->t;
-	stm32l4_flash_write32(t, FLASH_CR, FLASH_CR_PG);
-	target_mem_write(t, dest, src, len);
+	struct stm32l4_flash *sf = (struct stm32l4_flash *)f;
+	struct stm32l4_info const *chip = stm32l4_get_chip_info(t->part_id);
+	struct flashloader_params loader_params = {
+		.width = 8U,
+		.sr_addr = chip->flash_regs_map[FLASH_SR],
+		.busy_mask = FLASH_SR_BSY,
+		.error_mask = FLASH_SR_ERROR_MASK,
+	};
+	int loader = 1;
+	/*
+	 * Fast programming needs the 32 double words of a row written back to back,
+	 * which only the loader can guarantee, so there is no SWD fallback for it.
+	 */
+	if (sf->fast_program && !(dest % STM32L4_ROW_SIZE) && !(len % STM32L4_ROW_SIZE)) {
+		stm32l4_flash_write32(t, FLASH_CR, FLASH_CR_FSTPG);
+		loader_params.width = STM32L4_ROW_SIZE;
+		loader = flashloader_write(t, &loader_params, dest, src, len);
+		stm32l4_flash_write32(t, FLASH_CR, 0);
+		loader_params.width = 8U;
+	}
+	if (loader > 0) {
+		stm32l4_flash_write32(t, FLASH_CR, FLASH_CR_PG);
+		loader = flashloader_write(t, &loader_params, dest, src, len);
+		if (loader)
+			target_mem_write(t, dest, src, len);
+	}
+	if (loader < 0) {
+		sf->fast_program = false;
+		return -1;
+	}
 	/* Wait for completion or an error */
 	uint32_t status;
 	do {
@@ -636,6 +676,23 @@ static int stm32l4_flash_write(struct target_flash *f, target_addr dest, const v
 	return 0;
 }
 
+/* Mark the banks erased by MER1 and MER2 in action as ready for fast programming */
+static void stm32l4_fast_program_enable(target *const t, const uint32_t action)
+{
+	const enum FAM_STM32L4 family = stm32l4_get_chip_info(t->part_id)->family;
+	/* Only used on the families whose reference manuals describe it with this sequence */
+	if (family != FAM_STM32L4xx && family != FAM_STM32L4Rx && family != FAM_STM32G4xx && family != FAM_STM32WLxx)
+		return;
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		if (f->write != stm32l4_flash_write)
+			continue;
+		struct stm32l4_flash *sf = (struct stm32l4_flash *)f;
+		/* Single bank parts (bank1_start of -1) are erased whole by either bit */
+		if (sf->bank1_start == (uint32_t)-1 || (action & (f->bank_id ? FLASH_CR_MER2 : FLASH_CR_MER1)))
+			sf->fast_program = true;
+	}
+}
+
 static bool stm32l4_cmd_erase(target *const t, const uint32_t action)
 {
 	stm32l4_flash_unlock(t);
@@ -654,7 +711,11 @@ static bool stm32l4_cmd_erase(target *const t, const uint32_t action)
 	}
 
 	/* Check for error */
-	return !(stm32l4_flash_read32(t, FLASH_SR) & FLASH_SR_ERROR_MASK);
+	if (stm32l4_flash_read32(t, FLASH_SR) & FLASH_SR_ERROR_MASK)
+		return false;
+	if (action & (FLASH_CR_MER1 | FLASH_CR_MER2))
+		stm32l4_fast_program_enable(t, action);
+	return true;
 }
 
 static bool stm32l4_mass_erase(target *const t)
@@ -662,6 +723,16 @@ static bool stm32l4_mass_erase(target *const t)
 	return stm32l4_cmd_erase(t, FLASH_CR_MER1 | FLASH_CR_MER2);
 }
 
+/* Single bank parts (bank1_start of -1) take the same mass erase as stm32l4_mass_erase() */
+static int stm32l4_flash_bank_erase(struct target_flash *f)
+{
+	const uint32_t bank1_start = ((struct stm32l4_flash *)f)->bank1_start;
+	uint32_t action = FLASH_CR_MER1 | FLASH_CR_MER2;
+	if (bank1_start != (uint32_t)-1)
+		action = f->bank_id ? FLASH_CR_MER2 : FLASH_CR_MER1;
+	return stm32l4_cmd_erase(f->t, action) ? 0 : -1;
+}
+
 static bool stm32l4_cmd_erase_bank1(target *const t, const int argc, const char **const argv)
 {
 	(void)argc;
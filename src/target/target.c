@@ -21,23 +21,89 @@
 #include "general.h"
 #include "target_internal.h"
 #include "gdb_packet.h"
+#include "command.h"
+#include "crc32.h"
+#include "stats.h"
+#include "cti.h"
+#include "mtb.h"
+#include "etm.h"
 
 #include <stdarg.h>
 #include <unistd.h>
 
 target *target_list = NULL;
+/* Set the driver's debug-in-low-power bits on attach, see target_s.lowpower_debug_reg */
+bool target_lowpower_debug = false;
 
-#define STDOUT_READ_BUF_SIZE	64
+#define STDOUT_READ_BUF_SIZE	256
+
+/*
+ * The memory read cache is a small direct mapped cache of target memory,
+ * used to serve GDB's repeated small reads (stack, vectors, code around
+ * the PC) while the target is halted. Only RAM and Flash described in the
+ * target memory map are cached, peripheral space is always read directly.
+ */
+#ifndef TARGET_MEM_CACHE_LINES
+#define TARGET_MEM_CACHE_LINES	8U
+#endif
+#define TARGET_MEM_CACHE_LINE_SIZE	64U
+
+/*
+ * Bulk reads continuing where the last one ended, as from GDB's "dump memory"
+ * or an IDE memory view, fetch this much in one go. The following reads of
+ * the run are then served from the probe rather than each starting a new
+ * transfer on the target.
+ */
+#ifndef TARGET_MEM_READAHEAD_SIZE
+#define TARGET_MEM_READAHEAD_SIZE	2048U
+#endif
+
+/* Largest erase block delta flashing will collect on the probe */
+#ifndef TARGET_FLASH_DELTA_MAX_BLOCK
+#define TARGET_FLASH_DELTA_MAX_BLOCK	2048U
+#endif
+
+struct target_mem_cache {
+	target_addr tag[TARGET_MEM_CACHE_LINES];
+	uint8_t data[TARGET_MEM_CACHE_LINES][TARGET_MEM_CACHE_LINE_SIZE];
+	/* Where the last bulk read ended, and the data fetched beyond it */
+	target_addr next_addr;
+	target_addr readahead_addr;
+	size_t readahead_len;
+	uint8_t readahead[TARGET_MEM_READAHEAD_SIZE];
+};
 
 static int target_flash_write_buffered(struct target_flash *f, target_addr dest, const void *src, size_t len);
 static int target_flash_done_buffered(struct target_flash *f);
+static int target_flash_erase_blocks(struct target_flash *f, target_addr addr, size_t len);
+static bool target_flash_delta_capable(struct target_flash *f);
+static void target_flash_delta_mark(struct target_flash *f, target_addr addr, size_t len);
+static int target_flash_erase_ahead(struct target_flash *f, target_addr addr, size_t len);
+static int target_flash_write_delta(struct target_flash *f, target_addr dest, const void *src, size_t len);
+static int target_flash_done_delta(struct target_flash *f);
 
 static bool target_cmd_mass_erase(target *t, int argc, const char **argv);
 static bool target_cmd_range_erase(target *t, int argc, const char **argv);
+static bool target_cmd_mem_cache(target *t, int argc, const char **argv);
+static bool target_cmd_fill(target *t, int argc, const char **argv);
+static bool target_cmd_find(target *t, int argc, const char **argv);
+static bool target_cmd_stackcheck(target *t, int argc, const char **argv);
+static bool target_cmd_flash_delta(target *t, int argc, const char **argv);
+static bool target_cmd_flash_erase_ahead(target *t, int argc, const char **argv);
+static bool target_cmd_flash_loader(target *t, int argc, const char **argv);
+static bool target_cmd_flash_stats(target *t, int argc, const char **argv);
 
 const struct command_s target_cmd_list[] = {
 	{"erase_mass", (cmd_handler)target_cmd_mass_erase, "Erase whole device Flash"},
 	{"erase_range", (cmd_handler)target_cmd_range_erase, "Erase a range of memory on a device"},
+	{"mem_cache", (cmd_handler)target_cmd_mem_cache, "Cache memory reads while halted: (enable|disable)"},
+	{"fill", (cmd_handler)target_cmd_fill, "Fill memory with a pattern: <address> <length> <pattern>"},
+	{"find", (cmd_handler)target_cmd_find, "Find a pattern in memory, or where it isn't: <address> <length> <pattern> [not]"},
+	{"stackcheck", (cmd_handler)target_cmd_stackcheck, "Stack usage of painted stacks: <start> <end> [<start> <end>...] [pattern]"},
+	{"flash_delta", (cmd_handler)target_cmd_flash_delta, "Skip Flash blocks that already hold the new data: (enable|disable)"},
+	{"flash_erase_ahead", (cmd_handler)target_cmd_flash_erase_ahead, "Erase Flash blocks as their data comes in: (enable|disable)"},
+	{"flash_loader", (cmd_handler)target_cmd_flash_loader, "Program Flash using a loader in target RAM: (enable|disable)"},
+	{"flash_stats", (cmd_handler)target_cmd_flash_stats, "Time per Flash programming phase, printed when done: (enable|disable)"},
 	{NULL, NULL, NULL}
 };
 
@@ -80,6 +146,7 @@ target *target_new(void)
 	t->halt_request = (void*)nop_function;
 	t->halt_poll = (void*)nop_function;
 	t->halt_resume = (void*)nop_function;
+	t->halt_wait = (void*)false_function;
 	t->check_error = (void*)false_function;
 
 	t->target_storage = NULL;
@@ -98,7 +165,14 @@ int target_foreach(void (*cb)(int, target *t, void *context), void *context)
 }
 
 
+static void target_mem_map_changed(target *t)
+{
+	free(t->mem_map);
+	t->mem_map = NULL;
+}
+
 void target_ram_map_free(target *t) {
+	target_mem_map_changed(t);
 	while (t->ram) {
 		void * next = t->ram->next;
 		free(t->ram);
@@ -107,10 +181,13 @@ void target_ram_map_free(target *t) {
 }
 
 void target_flash_map_free(target *t) {
+	target_mem_map_changed(t);
 	while (t->flash) {
 		void * next = t->flash->next;
 		if (t->flash->buf)
 			free(t->flash->buf);
+		free(t->flash->delta_buf);
+		free(t->flash->delta_pending);
 		free(t->flash);
 		t->flash = next;
 	}
@@ -138,6 +215,11 @@ void target_list_free(void)
 			target_list->commands = tc;
 		}
 		free(target_list->target_storage);
+		free(target_list->mem_cache);
+		free(target_list->reg_cache);
+		free(target_list->cti);
+		mtb_free(target_list);
+		etm_free(target_list);
 		target_mem_map_free(target_list);
 		while (target_list->bw_list) {
 			void * next = target_list->bw_list->next;
@@ -173,12 +255,28 @@ target *target_attach_n(const size_t n, struct target_controller *tc)
 {
 	target *t  = target_list;
 	for (size_t i = 1; t; t = t->next, ++i) {
-		if (i == n)
-			return target_attach(t, tc);
+		if (i != n)
+			continue;
+		/* Attached before, the board may have been reset or swapped since */
+		if (t->tc && !target_revalidate(t)) {
+			platform_target_clk_output_enable(false);
+			return NULL;
+		}
+		return target_attach(t, tc);
 	}
 	return NULL;
 }
 
+/* Check a target of the last scan still answers as the part probed, so it can be attached without a scan */
+bool target_revalidate(target *t)
+{
+	platform_target_clk_output_enable(true);
+	if (t->revalidate && t->revalidate(t))
+		return true;
+	DEBUG_WARN("%s no longer matches the scan, scan again\n", t->driver);
+	return false;
+}
+
 target *target_attach(target *t, struct target_controller *tc)
 {
 	if (t->tc)
@@ -186,6 +284,7 @@ target *target_attach(target *t, struct target_controller *tc)
 
 	t->tc = tc;
 	platform_target_clk_output_enable(true);
+	target_mem_cache_invalidate(t, false);
 
 	if (!t->attach(t)) {
 		platform_target_clk_output_enable(false);
@@ -193,6 +292,12 @@ target *target_attach(target *t, struct target_controller *tc)
 	}
 
 	t->attached = true;
+	if (target_lowpower_debug && t->lowpower_debug_reg) {
+		/* Keep the debug clocks running through sleep/stop/standby, or halt polls time out */
+		t->lowpower_debug_saved = target_mem_read32(t, t->lowpower_debug_reg);
+		target_mem_write32(t, t->lowpower_debug_reg, t->lowpower_debug_saved | t->lowpower_debug_bits);
+		t->lowpower_debug_set = true;
+	}
 	return t;
 }
 
@@ -208,15 +313,18 @@ void target_add_ram(target *t, target_addr start, uint32_t len)
 	ram->length = len;
 	ram->next = t->ram;
 	t->ram = ram;
+	target_mem_map_changed(t);
 }
 
 void target_add_flash(target *t, struct target_flash *f)
 {
 	if (f->buf_size == 0)
-		f->buf_size = MIN(f->blocksize, 0x400);
+		f->buf_size = MIN(f->blocksize, FLASH_BUFFER_SIZE);
 	f->t = t;
+	f->delta_addr = -1;
 	f->next = t->flash;
 	t->flash = f;
+	target_mem_map_changed(t);
 }
 
 static ssize_t map_ram(char *buf, size_t len, struct target_ram *ram)
@@ -238,21 +346,39 @@ static ssize_t map_flash(char *buf, size_t len, struct target_flash *f)
 	return i;
 }
 
-bool target_mem_map(target *t, char *tmp, size_t len)
+/* Room for the XML of each region, see map_ram() and map_flash() */
+#define MEM_MAP_HEADER_SIZE 32U
+#define MEM_MAP_RAM_SIZE    64U
+#define MEM_MAP_FLASH_SIZE  128U
+
+/* The memory map XML for GDB is built once after the map changes, as GDB reads it in pieces */
+const char *target_mem_map(target *t, size_t *len)
 {
-	size_t i = 0;
-	i = snprintf(&tmp[i], len - i, "<memory-map>");
-	/* Map each defined RAM */
-	for (struct target_ram *r = t->ram; r; r = r->next)
-		i += map_ram(&tmp[i], len - i, r);
-	/* Map each defined Flash */
-	for (struct target_flash *f = t->flash; f; f = f->next)
-		i += map_flash(&tmp[i], len - i, f);
-	i += snprintf(&tmp[i], len - i, "</memory-map>");
+	if (!t->mem_map) {
+		size_t size = MEM_MAP_HEADER_SIZE;
+		for (struct target_ram *r = t->ram; r; r = r->next)
+			size += MEM_MAP_RAM_SIZE;
+		for (struct target_flash *f = t->flash; f; f = f->next)
+			size += MEM_MAP_FLASH_SIZE;
+		char *map = malloc(size);
+		if (!map) { /* malloc failed: heap exhaustion */
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
+			return NULL;
+		}
 
-	if (i > (len -2))
-		return false;
-	return true;
+		size_t i = snprintf(map, size, "<memory-map>");
+		/* Map each defined RAM */
+		for (struct target_ram *r = t->ram; r; r = r->next)
+			i += map_ram(&map[i], size - i, r);
+		/* Map each defined Flash */
+		for (struct target_flash *f = t->flash; f; f = f->next)
+			i += map_flash(&map[i], size - i, f);
+		i += snprintf(&map[i], size - i, "</memory-map>");
+		t->mem_map = map;
+		t->mem_map_len = i;
+	}
+	*len = t->mem_map_len;
+	return t->mem_map;
 }
 
 struct target_flash *target_flash_for_addr(target *t, uint32_t addr)
@@ -264,33 +390,200 @@ struct target_flash *target_flash_for_addr(target *t, uint32_t addr)
 	return NULL;
 }
 
+static inline bool target_flash_same_bank(struct target_flash *f, struct target_flash *g)
+{
+	return g->bank_erase == f->bank_erase && g->bank_id == f->bank_id;
+}
+
+/* Check if the erase range covers every target_flash making up f's bank */
+static bool target_flash_bank_covered(struct target_flash *f, target_addr start, target_addr end)
+{
+	if (!f->bank_erase)
+		return false;
+	for (struct target_flash *g = f->t->flash; g; g = g->next) {
+		if (target_flash_same_bank(f, g) && (g->start < start || g->start + g->length > end))
+			return false;
+	}
+	return true;
+}
+
+/* Only the lowest addressed part of a bank issues the bank erase */
+static bool target_flash_bank_first(struct target_flash *f)
+{
+	for (struct target_flash *g = f->t->flash; g; g = g->next) {
+		if (target_flash_same_bank(f, g) && g->start < f->start)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Flash statistics. A session runs from the first erase or write after a
+ * target_flash_done() up to the next one. Calls into the drivers are timed
+ * against their region, along with the polling the BSY-poll helpers do in
+ * them. The rest of the session went on waiting for GDB and moving the data.
+ */
+static uint32_t target_flash_session_begin(target *t)
+{
+	const uint32_t now = platform_time_us();
+	if (!t->flash_session) {
+		for (struct target_flash *f = t->flash; f; f = f->next)
+			memset(&f->stats, 0, sizeof(f->stats));
+		t->flash_session = true;
+		t->flash_session_start = now;
+		t->flash_session_busy_us = 0;
+	}
+	return now;
+}
+
+static inline void target_flash_session_busy(target *t, const uint32_t start)
+{
+	t->flash_session_busy_us += platform_time_us() - start;
+}
+
+void target_flash_stats_poll(target *t, const uint32_t polls, const uint32_t us)
+{
+	if (!t->flash_active)
+		return;
+	t->flash_active->stats.polls += polls;
+	t->flash_active->stats.poll_us += us;
+}
+
+static int target_flash_driver_erase(struct target_flash *f, const target_addr addr, const size_t len)
+{
+	f->t->flash_active = f;
+	const uint32_t start = platform_time_us();
+	const int ret = f->erase(f, addr, len);
+	f->stats.erase_us += platform_time_us() - start;
+	++f->stats.erase_calls;
+	f->stats.erase_bytes += len;
+	f->t->flash_active = NULL;
+	return ret;
+}
+
+static int target_flash_driver_bank_erase(struct target_flash *f)
+{
+	f->t->flash_active = f;
+	const uint32_t start = platform_time_us();
+	const int ret = f->bank_erase(f);
+	f->stats.erase_us += platform_time_us() - start;
+	++f->stats.erase_calls;
+	for (struct target_flash *g = f->t->flash; g; g = g->next) {
+		if (target_flash_same_bank(f, g))
+			f->stats.erase_bytes += g->length;
+	}
+	f->t->flash_active = NULL;
+	return ret;
+}
+
+static int target_flash_driver_write(struct target_flash *f, const target_addr dest, const void *src, const size_t len)
+{
+	f->t->flash_active = f;
+	const uint32_t start = platform_time_us();
+	const int ret = f->write(f, dest, src, len);
+	f->stats.write_us += platform_time_us() - start;
+	++f->stats.write_calls;
+	f->stats.write_bytes += len;
+	f->t->flash_active = NULL;
+	return ret;
+}
+
+static int target_flash_driver_done(struct target_flash *f)
+{
+	f->t->flash_active = f;
+	const uint32_t start = platform_time_us();
+	const int ret = f->done(f);
+	f->stats.done_us += platform_time_us() - start;
+	f->t->flash_active = NULL;
+	return ret;
+}
+
+static uint32_t target_flash_rate(const uint32_t bytes, const uint32_t us)
+{
+	return us ? (uint32_t)((uint64_t)bytes * 1000000U / us) : 0;
+}
+
+static void target_flash_stats_show(target *t)
+{
+	const uint32_t session_us = t->flash_session ? platform_time_us() - t->flash_session_start : t->flash_session_us;
+	if (!session_us) {
+		tc_printf(t, "No Flash programmed yet\n");
+		return;
+	}
+	tc_printf(t, "Flash session: %" PRIu32 " us, %" PRIu32 " us in the drivers and checks, %" PRIu32
+		" us waiting for GDB and its data\n", session_us, t->flash_session_busy_us,
+		session_us - MIN(session_us, t->flash_session_busy_us));
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		const target_flash_stats_s *const stats = &f->stats;
+		if (!stats->erase_calls && !stats->write_calls && !stats->blank_check_us && !stats->done_us)
+			continue;
+		const uint32_t region_us = stats->erase_us + stats->blank_check_us + stats->write_us + stats->done_us;
+		tc_printf(t, "0x%08" PRIx32 ": %" PRIu32 " bytes written at %" PRIu32 " B/s, %" PRIu32
+			" B/s counting erase and checks\n", f->start, stats->write_bytes,
+			target_flash_rate(stats->write_bytes, stats->write_us), target_flash_rate(stats->write_bytes, region_us));
+		tc_printf(t, "  erase: %" PRIu32 " calls, %" PRIu32 " bytes, %" PRIu32 " us, blank checks %" PRIu32 " us\n",
+			stats->erase_calls, stats->erase_bytes, stats->erase_us, stats->blank_check_us);
+		tc_printf(t, "  write: %" PRIu32 " calls, %" PRIu32 " us, done %" PRIu32 " us\n", stats->write_calls,
+			stats->write_us, stats->done_us);
+		tc_printf(t, "  busy polls: %" PRIu32 " in %" PRIu32 " us\n", stats->polls, stats->poll_us);
+	}
+}
+
 int target_flash_erase(target *t, target_addr addr, size_t len)
 {
+	const uint32_t entered = target_flash_session_begin(t);
+	const bool cache_halted = target_mem_cache_suspend(t);
+	const target_addr start = addr;
+	const target_addr end = addr + len;
 	int ret = 0;
 	while (len) {
 		struct target_flash *f = target_flash_for_addr(t, addr);
 		if (!f) {
 			DEBUG_WARN("Erase stopped at 0x%06" PRIx32 "\n", addr);
-			return ret;
+			break;
 		}
 		size_t tmptarget = MIN(addr + len, f->start + f->length);
 		size_t tmplen = tmptarget - addr;
-		ret |= f->erase(f, addr, tmplen);
+		/* In delta mode the erase waits until the new data has been seen */
+		if (target_flash_delta_capable(f))
+			target_flash_delta_mark(f, addr, tmplen);
+		else if (target_flash_bank_covered(f, start, end)) {
+			/* Whole banks go much faster with the driver's bank erase */
+			if (target_flash_bank_first(f))
+				ret |= target_flash_driver_bank_erase(f);
+		} else if (t->flash_erase_ahead)
+			target_flash_delta_mark(f, addr, tmplen);
+		else
+			ret |= target_flash_erase_blocks(f, addr, tmplen);
 		addr += tmplen;
 		len -= tmplen;
 	}
+	target_mem_cache_resume(t, cache_halted);
+	target_flash_session_busy(t, entered);
 	return ret;
 }
 
 int target_flash_write(target *t, target_addr dest, const void *src, size_t len)
 {
+	const uint32_t entered = target_flash_session_begin(t);
+	const bool cache_halted = target_mem_cache_suspend(t);
 	int ret = 0;
 	while (len) {
 		struct target_flash *f = target_flash_for_addr(t, dest);
-		if (!f)
-			return 1;
+		if (!f) {
+			ret = 1;
+			break;
+		}
 		size_t tmptarget = MIN(dest + len, f->start + f->length);
 		size_t tmplen = tmptarget - dest;
+		if (target_flash_delta_capable(f)) {
+			ret |= target_flash_write_delta(f, dest, src, tmplen);
+			dest += tmplen;
+			src += tmplen;
+			len -= tmplen;
+			continue;
+		}
+		ret |= target_flash_erase_ahead(f, dest, tmplen);
 		ret |= target_flash_write_buffered(f, dest, src, tmplen);
 		dest += tmplen;
 		src += tmplen;
@@ -301,35 +594,94 @@ int target_flash_write(target *t, target_addr dest, const void *src, size_t len)
 		if (dest == f->start + f->length)
 			ret |= target_flash_done_buffered(f);
 	}
+	target_mem_cache_resume(t, cache_halted);
+	target_flash_session_busy(t, entered);
 	return ret;
 }
 
 int target_flash_done(target *t)
 {
+	const uint32_t entered = target_flash_session_begin(t);
+	const bool cache_halted = target_mem_cache_suspend(t);
+	int ret = 0;
 	for (struct target_flash *f = t->flash; f; f = f->next) {
-		int tmp = target_flash_done_buffered(f);
-		if (tmp)
-			return tmp;
+		ret = target_flash_done_delta(f);
+		if (ret)
+			break;
+		ret = target_flash_done_buffered(f);
+		if (ret)
+			break;
 		if (f->done) {
-			tmp = f->done(f);
-			if (tmp)
-				return tmp;
+			ret = target_flash_driver_done(f);
+			if (ret)
+				break;
 		}
 	}
-	return 0;
+	target_mem_cache_resume(t, cache_halted);
+	target_flash_session_busy(t, entered);
+	t->flash_session_us = platform_time_us() - t->flash_session_start;
+	t->flash_session = false;
+	if (t->flash_stats_print)
+		target_flash_stats_show(t);
+	return ret;
+}
+
+/* The unit the parts of the buffer holding data are written in */
+static size_t target_flash_write_size(const struct target_flash *f)
+{
+	if (f->writesize && f->buf_size % f->writesize == 0)
+		return f->writesize;
+	return f->buf_size;
+}
+
+/* One bit per write unit holding data, kept after the buffer itself */
+static uint8_t *target_flash_dirty_map(const struct target_flash *f)
+{
+	return (uint8_t *)f->buf + f->buf_size;
+}
+
+static bool target_flash_unit_dirty(const uint8_t *dirty, size_t unit)
+{
+	return dirty[unit / 8U] & (1U << (unit % 8U));
+}
+
+/* Write out each run of units holding data, leaving the padding untouched */
+static int target_flash_flush_buffered(struct target_flash *f)
+{
+	const size_t unit_size = target_flash_write_size(f);
+	const size_t units = f->buf_size / unit_size;
+	uint8_t *const dirty = target_flash_dirty_map(f);
+	int ret = 0;
+	for (size_t unit = 0; unit < units;) {
+		if (!target_flash_unit_dirty(dirty, unit)) {
+			++unit;
+			continue;
+		}
+		size_t end = unit + 1U;
+		while (end < units && target_flash_unit_dirty(dirty, end))
+			++end;
+		const size_t offset = unit * unit_size;
+		ret |= target_flash_driver_write(f, f->buf_addr + offset, (uint8_t *)f->buf + offset, (end - unit) * unit_size);
+		unit = end;
+	}
+	memset(dirty, 0, (units + 7U) / 8U);
+	return ret;
 }
 
 int target_flash_write_buffered(struct target_flash *f, target_addr dest, const void *src, size_t len)
 {
 	int ret = 0;
+	const size_t unit_size = target_flash_write_size(f);
 
 	if (f->buf == NULL) {
-		/* Allocate flash sector buffer */
-		f->buf = malloc(f->buf_size);
+		/* Allocate flash sector buffer, followed by the map of the units holding data */
+		const size_t map_len = (f->buf_size / unit_size + 7U) / 8U;
+		f->buf = malloc(f->buf_size + map_len);
 		if (!f->buf) {			/* malloc failed: heap exhaustion */
 			DEBUG_WARN("malloc: failed in %s\n", __func__);
 			return 1;
 		}
+		memset(target_flash_dirty_map(f), 0, map_len);
 		f->buf_addr = -1;
 	}
 	while (len) {
@@ -338,8 +690,7 @@ int target_flash_write_buffered(struct target_flash *f, target_addr dest, const
 		if (base != f->buf_addr) {
 			if (f->buf_addr != (uint32_t)-1) {
 				/* Write sector to flash if valid */
-				ret |= f->write(f, f->buf_addr,
-				                f->buf, f->buf_size);
+				ret |= target_flash_flush_buffered(f);
 			}
 			/* Setup buffer for a new sector */
 			f->buf_addr = base;
@@ -348,6 +699,9 @@ int target_flash_write_buffered(struct target_flash *f, target_addr dest, const
 		/* Copy chunk into sector buffer */
 		size_t sectlen = MIN(f->buf_size - offset, len);
 		memcpy(f->buf + offset, src, sectlen);
+		uint8_t *const dirty = target_flash_dirty_map(f);
+		for (size_t unit = offset / unit_size; unit <= (offset + sectlen - 1U) / unit_size; ++unit)
+			dirty[unit / 8U] |= 1U << (unit % 8U);
 		dest += sectlen;
 		src += sectlen;
 		len -= sectlen;
@@ -359,8 +713,8 @@ int target_flash_done_buffered(struct target_flash *f)
 {
 	int ret = 0;
 	if ((f->buf != NULL) &&(f->buf_addr != (uint32_t)-1)) {
-		/* Write sector to flash if valid */
-		ret = f->write(f, f->buf_addr, f->buf, f->buf_size);
+		/* Write sector to flash if valid, nothing if no data went into it */
+		ret = target_flash_flush_buffered(f);
 		f->buf_addr = -1;
 		free(f->buf);
 		f->buf = NULL;
@@ -369,6 +723,191 @@ int target_flash_done_buffered(struct target_flash *f)
 	return ret;
 }
 
+/* Check a block is blank with the driver's blank check or by reading it back */
+static bool target_flash_blank(struct target_flash *f, target_addr addr, size_t len)
+{
+	if (f->blank_check)
+		return f->blank_check(f, addr, len);
+
+	uint8_t data[256];
+	while (len) {
+		const size_t chunk = MIN(len, sizeof(data));
+		if (target_mem_read(f->t, data, addr, chunk))
+			return false;
+		for (size_t i = 0; i < chunk; ++i) {
+			if (data[i] != f->erased)
+				return false;
+		}
+		addr += chunk;
+		len -= chunk;
+	}
+	return true;
+}
+
+/*
+ * Erase the erase blocks covering a range, skipping any that are already blank.
+ * Runs of blocks that do need erasing are passed to the driver in one go.
+ */
+static int target_flash_erase_blocks(struct target_flash *f, target_addr addr, size_t len)
+{
+	const target_addr end = addr + len;
+	target_addr block = addr - (addr - f->start) % f->blocksize;
+	target_addr run_start = block;
+	size_t run_len = 0;
+	int ret = 0;
+	for (; block < end; block += f->blocksize) {
+		const size_t block_len = MIN(f->blocksize, f->start + f->length - block);
+		f->t->flash_active = f;
+		const uint32_t start = platform_time_us();
+		const bool blank = target_flash_blank(f, block, block_len);
+		f->stats.blank_check_us += platform_time_us() - start;
+		f->t->flash_active = NULL;
+		if (blank) {
+			if (run_len)
+				ret |= target_flash_driver_erase(f, run_start, run_len);
+			run_len = 0;
+		} else {
+			if (!run_len)
+				run_start = block;
+			run_len += block_len;
+		}
+	}
+	if (run_len)
+		ret |= target_flash_driver_erase(f, run_start, run_len);
+	return ret;
+}
+
+/*
+ * Delta flashing collects each erase block in full before touching it. Blocks GDB
+ * asked to erase are only erased and written if their CRC differs from what is
+ * already in Flash. Erase blocks larger than TARGET_FLASH_DELTA_MAX_BLOCK, or not
+ * a whole number of write buffers, go through the normal erase and write path.
+ */
+static bool target_flash_delta_capable(struct target_flash *f)
+{
+	return f->t->flash_delta && f->blocksize <= TARGET_FLASH_DELTA_MAX_BLOCK &&
+		f->blocksize % f->buf_size == 0;
+}
+
+static inline size_t target_flash_delta_block(struct target_flash *f, target_addr addr)
+{
+	return (addr - f->start) / f->blocksize;
+}
+
+static inline bool target_flash_delta_is_pending(struct target_flash *f, size_t block)
+{
+	return f->delta_pending && (f->delta_pending[block / 8U] & (1U << (block % 8U)));
+}
+
+static void target_flash_delta_mark(struct target_flash *f, target_addr addr, size_t len)
+{
+	if (!f->delta_pending) {
+		const size_t blocks = (f->length + f->blocksize - 1U) / f->blocksize;
+		f->delta_pending = calloc(1, (blocks + 7U) / 8U);
+		if (!f->delta_pending) { /* malloc failed: heap exhaustion */
+			DEBUG_WARN("calloc: failed in %s\n", __func__);
+			target_flash_erase_blocks(f, addr, len);
+			return;
+		}
+	}
+	const size_t last = target_flash_delta_block(f, addr + len - 1U);
+	for (size_t block = target_flash_delta_block(f, addr); block <= last; ++block)
+		f->delta_pending[block / 8U] |= 1U << (block % 8U);
+}
+
+/*
+ * Erase-ahead: rather than holding up each vFlashErase, the blocks GDB asked
+ * to erase are erased once data for them comes in, along with the block after.
+ * That one's erase then overlaps with GDB sending the data for this one, which
+ * pays off most on parts erasing in the background or in another bank. A
+ * failure comes out of the write, GDB hears of it on its next Flash packet.
+ */
+static int target_flash_erase_ahead(struct target_flash *f, target_addr addr, size_t len)
+{
+	if (!f->delta_pending)
+		return 0;
+	const size_t blocks = (f->length + f->blocksize - 1U) / f->blocksize;
+	const size_t last = MIN(target_flash_delta_block(f, addr + len - 1U) + 1U, blocks - 1U);
+	int ret = 0;
+	for (size_t block = target_flash_delta_block(f, addr); block <= last; ++block) {
+		if (!target_flash_delta_is_pending(f, block))
+			continue;
+		f->delta_pending[block / 8U] &= ~(1U << (block % 8U));
+		ret |= target_flash_erase_blocks(f, f->start + block * f->blocksize, f->blocksize);
+	}
+	return ret;
+}
+
+/* Write out the block being collected, erasing it first if it was asked for and differs */
+static int target_flash_delta_flush(struct target_flash *f)
+{
+	if (f->delta_addr == (target_addr)-1)
+		return 0;
+	const target_addr addr = f->delta_addr;
+	const size_t block = target_flash_delta_block(f, addr);
+	f->delta_addr = -1;
+
+	if (target_flash_delta_is_pending(f, block)) {
+		f->delta_pending[block / 8U] &= ~(1U << (block % 8U));
+		uint32_t crc;
+		if (target_mem_crc32(f->t, &crc, addr, f->blocksize) == 0 &&
+			crc == crc32_buf(0xffffffffU, f->delta_buf, f->blocksize)) {
+			DEBUG_INFO("Flash block at 0x%08" PRIx32 " unchanged\n", addr);
+			return 0;
+		}
+		if (target_flash_erase_blocks(f, addr, f->blocksize))
+			return 1;
+	}
+	int ret = target_flash_write_buffered(f, addr, f->delta_buf, f->blocksize);
+	ret |= target_flash_done_buffered(f);
+	return ret;
+}
+
+static int target_flash_write_delta(struct target_flash *f, target_addr dest, const void *src, size_t len)
+{
+	if (!f->delta_buf) {
+		f->delta_buf = malloc(f->blocksize);
+		if (!f->delta_buf) { /* malloc failed: heap exhaustion */
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
+			return 1;
+		}
+	}
+	int ret = 0;
+	while (len) {
+		const uint32_t offset = (dest - f->start) % f->blocksize;
+		const target_addr base = dest - offset;
+		if (base != f->delta_addr) {
+			ret |= target_flash_delta_flush(f);
+			f->delta_addr = base;
+			memset(f->delta_buf, f->erased, f->blocksize);
+		}
+		const size_t blocklen = MIN(f->blocksize - offset, len);
+		memcpy((uint8_t *)f->delta_buf + offset, src, blocklen);
+		dest += blocklen;
+		src = (const uint8_t *)src + blocklen;
+		len -= blocklen;
+	}
+	return ret;
+}
+
+/* Flush the last collected block, then erase whatever GDB asked for but sent no data for */
+static int target_flash_done_delta(struct target_flash *f)
+{
+	int ret = target_flash_delta_flush(f);
+	if (f->delta_pending) {
+		const size_t blocks = (f->length + f->blocksize - 1U) / f->blocksize;
+		for (size_t block = 0; block < blocks; ++block) {
+			if (target_flash_delta_is_pending(f, block))
+				ret |= target_flash_erase_blocks(f, f->start + block * f->blocksize, f->blocksize);
+		}
+	}
+	free(f->delta_pending);
+	f->delta_pending = NULL;
+	free(f->delta_buf);
+	f->delta_buf = NULL;
+	return ret;
+}
+
 void target_print_progress(platform_timeout *const timeout)
 {
 	if (platform_timeout_is_expired(timeout)) {
@@ -377,9 +916,128 @@ void target_print_progress(platform_timeout *const timeout)
 	}
 }
 
+/* Memory read cache */
+void target_mem_cache_invalidate(target *t, bool halted)
+{
+	t->mem_cache_halted = halted;
+	if (t->mem_cache) {
+		memset(t->mem_cache->tag, 0xff, sizeof(t->mem_cache->tag));
+		t->mem_cache->next_addr = -1;
+		t->mem_cache->readahead_len = 0;
+	}
+}
+
+/*
+ * Flash drivers and target commands may run code on the target or change
+ * memory behind our back, so keep the cache out of the way while they run
+ */
+bool target_mem_cache_suspend(target *t)
+{
+	const bool halted = t->mem_cache_halted;
+	target_mem_cache_invalidate(t, false);
+	return halted;
+}
+
+void target_mem_cache_resume(target *t, bool halted)
+{
+	target_mem_cache_invalidate(t, halted);
+}
+
+static bool target_mem_cacheable(target *t, target_addr addr, size_t len)
+{
+	for (struct target_ram *r = t->ram; r; r = r->next) {
+		if (addr >= r->start && addr - r->start + len <= r->length)
+			return true;
+	}
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		if (addr >= f->start && addr - f->start + len <= f->length)
+			return true;
+	}
+	return false;
+}
+
+static int target_mem_read_cached(target *t, uint8_t *dest, target_addr src, size_t len)
+{
+	struct target_mem_cache *cache = t->mem_cache;
+	while (len) {
+		const target_addr base = src & ~(TARGET_MEM_CACHE_LINE_SIZE - 1U);
+		const size_t offset = src - base;
+		const size_t chunk = MIN(TARGET_MEM_CACHE_LINE_SIZE - offset, len);
+		if (target_mem_cacheable(t, base, TARGET_MEM_CACHE_LINE_SIZE)) {
+			const size_t line = (base / TARGET_MEM_CACHE_LINE_SIZE) % TARGET_MEM_CACHE_LINES;
+			if (cache->tag[line] != base) {
+				t->mem_read(t, cache->data[line], base, TARGET_MEM_CACHE_LINE_SIZE);
+				if (target_check_error(t)) {
+					cache->tag[line] = -1;
+					return 1;
+				}
+				cache->tag[line] = base;
+			}
+			memcpy(dest, cache->data[line] + offset, chunk);
+		} else {
+			t->mem_read(t, dest, src, chunk);
+			if (target_check_error(t))
+				return 1;
+		}
+		dest += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+/*
+ * A bulk read served from the data read ahead, or starting a run of reads
+ * from where the last one ended, in which case the data beyond it is
+ * fetched along with it.
+ */
+static int target_mem_read_ahead(target *t, uint8_t *dest, target_addr src, size_t len)
+{
+	struct target_mem_cache *cache = t->mem_cache;
+	const bool sequential = src == cache->next_addr;
+	cache->next_addr = src + len;
+	if (cache->readahead_len && src >= cache->readahead_addr &&
+		src - cache->readahead_addr + len <= cache->readahead_len) {
+		memcpy(dest, cache->readahead + (src - cache->readahead_addr), len);
+		return 0;
+	}
+	cache->readahead_len = 0;
+	if (!sequential || !target_mem_cacheable(t, src, TARGET_MEM_READAHEAD_SIZE)) {
+		t->mem_read(t, dest, src, len);
+		return target_check_error(t);
+	}
+	t->mem_read(t, cache->readahead, src, TARGET_MEM_READAHEAD_SIZE);
+	if (target_check_error(t))
+		return 1;
+	memcpy(dest, cache->readahead, len);
+	cache->readahead_addr = src;
+	cache->readahead_len = TARGET_MEM_READAHEAD_SIZE;
+	return 0;
+}
+
+static struct target_mem_cache *target_mem_cache_get(target *t)
+{
+	if (!t->mem_cache) {
+		t->mem_cache = malloc(sizeof(*t->mem_cache));
+		if (!t->mem_cache) { /* malloc failed: heap exhaustion, read uncached */
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
+			return NULL;
+		}
+		target_mem_cache_invalidate(t, t->mem_cache_halted);
+	}
+	return t->mem_cache;
+}
+
 /* Wrapper functions */
 void target_detach(target *t)
 {
+	target_mem_cache_invalidate(t, false);
+	mtb_invalidate(t);
+	etm_invalidate(t);
+	if (t->lowpower_debug_set) {
+		target_mem_write32(t, t->lowpower_debug_reg, t->lowpower_debug_saved);
+		t->lowpower_debug_set = false;
+	}
 	t->detach(t);
 	platform_target_clk_output_enable(false);
 	t->attached = false;
@@ -399,16 +1057,93 @@ bool target_attached(target *t) { return t->attached; }
 /* Memory access functions */
 int target_mem_read(target *t, void *dest, target_addr src, size_t len)
 {
+	/* Small reads go through the cache lines, bulk reads smaller than the
+	 * read ahead buffer may be part of a sequential run */
+	if (t->mem_cache_halted && !t->mem_cache_disabled && len < TARGET_MEM_READAHEAD_SIZE &&
+		target_mem_cache_get(t)) {
+		if (len <= TARGET_MEM_CACHE_LINE_SIZE)
+			return target_mem_read_cached(t, dest, src, len);
+		return target_mem_read_ahead(t, dest, src, len);
+	}
 	t->mem_read(t, dest, src, len);
 	return target_check_error(t);
 }
 
 int target_mem_write(target *t, target_addr dest, const void *src, size_t len)
 {
+	target_mem_cache_invalidate(t, t->mem_cache_halted);
 	t->mem_write(t, dest, src, len);
 	return target_check_error(t);
 }
 
+/* Checksum a memory range on the target if the driver can, reading it back otherwise */
+int target_mem_crc32(target *t, uint32_t *crc, target_addr addr, size_t len)
+{
+	if (t->mem_crc32 && t->mem_crc32(t, crc, addr, len) == 0)
+		return 0;
+	return generic_crc32(t, crc, addr, len);
+}
+
+/* Up to a few kB at a time through the probe where the target can't do it itself */
+#define TARGET_MEM_BLOCK_SIZE 256U
+
+int target_mem_fill(target *t, target_addr addr, size_t len, uint32_t pattern, size_t size)
+{
+	if (size != 1U && size != 2U && size != 4U)
+		return -1;
+	for (; size < 4U; size *= 2U)
+		pattern = (pattern & ((1U << (size * 8U)) - 1U)) * ((1U << (size * 8U)) + 1U);
+	if (t->mem_fill && t->mem_fill(t, addr, len, pattern) == 0)
+		return 0;
+
+	uint8_t block[TARGET_MEM_BLOCK_SIZE];
+	for (size_t i = 0; i < sizeof(block); ++i)
+		block[i] = pattern >> ((i % 4U) * 8U);
+	while (len) {
+		const size_t chunk = MIN(len, sizeof(block));
+		if (target_mem_write(t, addr, block, chunk))
+			return -1;
+		addr += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+int target_mem_find(target *t, target_addr *found, target_addr addr, size_t len, uint32_t pattern, size_t size,
+	bool mismatch)
+{
+	if (size != 1U && size != 2U && size != 4U)
+		return -1;
+	if (size < 4U)
+		pattern &= (1U << (size * 8U)) - 1U;
+	/* A partial pattern at the end can't match */
+	len -= len % size;
+	if (t->mem_find) {
+		const int ret = t->mem_find(t, found, addr, len, pattern, size, mismatch);
+		if (ret >= 0)
+			return ret;
+	}
+
+	uint8_t block[TARGET_MEM_BLOCK_SIZE];
+	while (len) {
+		const size_t chunk = MIN(len, sizeof(block));
+		if (target_mem_read(t, block, addr, chunk))
+			return -1;
+		for (size_t offset = 0; offset < chunk; offset += size) {
+			uint32_t value = 0;
+			for (size_t i = size; i--;)
+				value = (value << 8U) | block[offset + i];
+			if ((value == pattern) != mismatch) {
+				*found = addr + offset;
+				return 0;
+			}
+		}
+		addr += chunk;
+		len -= chunk;
+	}
+	return 1;
+}
+
 /* Register access functions */
 ssize_t target_reg_read(target *t, int reg, void *data, size_t max)
 {
@@ -430,6 +1165,15 @@ void target_regs_read(target *t, void *data)
 		x += t->reg_read(t, i++, data + x, t->regs_size - x);
 	}
 }
+
+void target_regs_read_core(target *t, void *data)
+{
+	if (t->regs_read_core)
+		t->regs_read_core(t, data);
+	else
+		target_regs_read(t, data);
+}
+
 void target_regs_write(target *t, const void *data)
 {
 	if (t->regs_write) {
@@ -442,14 +1186,96 @@ void target_regs_write(target *t, const void *data)
 }
 
 /* Halt/resume functions */
-void target_reset(target *t) { t->reset(t); }
+void target_reset(target *t)
+{
+	target_mem_cache_invalidate(t, false);
+	mtb_invalidate(t);
+	etm_invalidate(t);
+	t->reset(t);
+}
+
 void target_halt_request(target *t) { t->halt_request(t); }
+
 enum target_halt_reason target_halt_poll(target *t, target_addr *watch)
 {
-	return t->halt_poll(t, watch);
+	STATS_INC(halt_polls);
+	const enum target_halt_reason reason = t->halt_poll(t, watch);
+	/* On error the target list has been freed, so t must not be touched */
+	if (reason == TARGET_HALT_ERROR)
+		return reason;
+	if (!t->mem_cache_halted || reason == TARGET_HALT_RUNNING)
+		target_mem_cache_invalidate(t, reason != TARGET_HALT_RUNNING);
+	return reason;
 }
 
-void target_halt_resume(target *t, bool step) { t->halt_resume(t, step); }
+void target_halt_resume(target *t, bool step)
+{
+	target_mem_cache_invalidate(t, false);
+	mtb_invalidate(t);
+	etm_invalidate(t);
+	cti_resume_prepare(t);
+	t->halt_resume(t, step);
+	cti_resume_finish(t, step);
+}
+
+/*
+ * Step through [start, end), only halting for good once PC leaves the range.
+ * Targets without support take a single step, a stop inside the range is
+ * allowed and the debugger just asks again.
+ */
+void target_halt_resume_range(target *t, target_addr start, target_addr end)
+{
+	target_mem_cache_invalidate(t, false);
+	mtb_invalidate(t);
+	etm_invalidate(t);
+	cti_resume_prepare(t);
+	if (t->halt_resume_range)
+		t->halt_resume_range(t, start, end);
+	else
+		t->halt_resume(t, true);
+}
+
+/* Returns false if the target can't wait cheaply and the caller should sleep instead */
+bool target_halt_wait(target *t, uint32_t timeout_ms)
+{
+	return t->halt_wait(t, timeout_ms);
+}
+
+/* Returns how many of the count samples were taken, none if the target can't be sampled */
+size_t target_pc_sample(target *t, uint32_t *pcs, size_t count)
+{
+	if (!t->pc_sample)
+		return 0;
+	return t->pc_sample(t, pcs, count);
+}
+
+/*
+ * True if memory can't be accessed while the target runs. As a first
+ * approximation all ARM cores allow it and no RISC-V core does.
+ */
+bool target_no_background_memory_access(target *t)
+{
+	return t && target_core_name(t) && strstr(target_core_name(t), "RVDBG");
+}
+
+/* Branch trace for GDB's btrace, only cores with a Micro Trace Buffer have it */
+bool target_branch_trace_enable(target *t, bool enable)
+{
+	return t->mtb && mtb_enable(t, enable);
+}
+
+size_t target_branch_trace_size(target *t)
+{
+	return t->mtb ? t->mtb->buf_size : 0;
+}
+
+/* Reads the btrace XML from offset, -1 if the core has no trace */
+ssize_t target_branch_trace_read(target *t, char *buf, size_t offset, size_t len)
+{
+	if (!t->mtb)
+		return -1;
+	return mtb_btrace_read(t, buf, offset, len);
+}
 
 /* Command line for semihosting get_cmdline */
 void target_set_cmdline(target *t, char *cmdline) {
@@ -544,6 +1370,166 @@ static bool target_cmd_mass_erase(target *const t, const int argc, const char **
 	return result;
 }
 
+/* The pattern is as wide as it is written, 0xab fills bytes and 0xabcd half words */
+static bool target_cmd_parse_pattern(const char *arg, uint32_t *pattern, size_t *size)
+{
+	char *end = NULL;
+	*pattern = strtoul(arg, &end, 0);
+	if (end == arg || *end)
+		return false;
+	const char *digits = arg;
+	if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X'))
+		digits += 2;
+	const size_t digit_count = end - digits;
+	*size = digit_count <= 2U ? 1U : digit_count <= 4U ? 2U : 4U;
+	return true;
+}
+
+static bool target_cmd_fill(target *const t, const int argc, const char **const argv)
+{
+	uint32_t pattern = 0;
+	size_t size = 0;
+	if (argc != 4 || !target_cmd_parse_pattern(argv[3], &pattern, &size)) {
+		gdb_out("usage: monitor fill <address> <length> <pattern>\n");
+		return false;
+	}
+	const target_addr addr = strtoul(argv[1], NULL, 0);
+	const size_t len = strtoul(argv[2], NULL, 0);
+	if (target_mem_fill(t, addr, len, pattern, size)) {
+		tc_printf(t, "Fill failed\n");
+		return false;
+	}
+	return true;
+}
+
+static bool target_cmd_find(target *const t, const int argc, const char **const argv)
+{
+	uint32_t pattern = 0;
+	size_t size = 0;
+	const bool mismatch = argc == 5 && !strcmp(argv[4], "not");
+	if ((argc != 4 && !mismatch) || !target_cmd_parse_pattern(argv[3], &pattern, &size)) {
+		gdb_out("usage: monitor find <address> <length> <pattern> [not]\n");
+		return false;
+	}
+	const target_addr addr = strtoul(argv[1], NULL, 0);
+	const size_t len = strtoul(argv[2], NULL, 0);
+	target_addr found = 0;
+	const int ret = target_mem_find(t, &found, addr, len, pattern, size, mismatch);
+	if (ret < 0) {
+		tc_printf(t, "Find failed\n");
+		return false;
+	}
+	if (ret)
+		tc_printf(t, "Not found\n");
+	else
+		tc_printf(t, "Found at 0x%08" PRIx32 "\n", found);
+	return true;
+}
+
+/* What FreeRTOS paints its stacks with, Zephyr's 0xaa can be given instead */
+#define TARGET_STACK_PAINT 0xa5a5a5a5U
+
+/*
+ * The stacks grow down, so the first word from the start that isn't paint is
+ * as deep as they went. That takes a full scan, stacks can have holes of paint
+ * in use from locals never written, which a binary search would stop at.
+ */
+static bool target_cmd_stackcheck(target *const t, const int argc, const char **const argv)
+{
+	uint32_t pattern = TARGET_STACK_PAINT;
+	size_t size = 4U;
+	/* The ranges come in pairs, an odd one out at the end is the pattern */
+	const int ranges = (argc - 1) / 2;
+	if (!ranges || (argc % 2 == 0 && !target_cmd_parse_pattern(argv[argc - 1], &pattern, &size))) {
+		gdb_out("usage: monitor stackcheck <start> <end> [<start> <end>...] [pattern]\n");
+		return false;
+	}
+	bool result = true;
+	for (int range = 0; range < ranges; ++range) {
+		const target_addr start = strtoul(argv[1 + range * 2], NULL, 0);
+		const target_addr end = strtoul(argv[2 + range * 2], NULL, 0);
+		if (end <= start) {
+			tc_printf(t, "0x%08" PRIx32 "-0x%08" PRIx32 ": empty range\n", start, end);
+			result = false;
+			continue;
+		}
+		target_addr used_from = end;
+		const int ret = target_mem_find(t, &used_from, start, end - start, pattern, size, true);
+		if (ret < 0) {
+			tc_printf(t, "0x%08" PRIx32 "-0x%08" PRIx32 ": read failed\n", start, end);
+			result = false;
+			continue;
+		}
+		const uint32_t used = end - used_from;
+		const uint32_t total = end - start;
+		tc_printf(t, "0x%08" PRIx32 "-0x%08" PRIx32 ": %" PRIu32 " of %" PRIu32 " bytes used (%" PRIu32 "%%)%s\n",
+			start, end, used, total, (uint32_t)((uint64_t)used * 100U / total), used_from == start ? ", overflowed?" : "");
+	}
+	return result;
+}
+
+static bool target_cmd_mem_cache(target *const t, const int argc, const char **const argv)
+{
+	if (argc == 2) {
+		bool enable = false;
+		if (!parse_enable_or_disable(argv[1], &enable))
+			return false;
+		t->mem_cache_disabled = !enable;
+		target_mem_cache_invalidate(t, t->mem_cache_halted);
+	}
+	tc_printf(t, "Memory read cache: %s\n", t->mem_cache_disabled ? "disabled" : "enabled");
+	return true;
+}
+
+static bool target_cmd_flash_delta(target *const t, const int argc, const char **const argv)
+{
+	if (argc == 2) {
+		bool enable = false;
+		if (!parse_enable_or_disable(argv[1], &enable))
+			return false;
+		t->flash_delta = enable;
+	}
+	tc_printf(t, "Delta flashing: %s\n", t->flash_delta ? "enabled" : "disabled");
+	return true;
+}
+
+static bool target_cmd_flash_erase_ahead(target *const t, const int argc, const char **const argv)
+{
+	if (argc == 2) {
+		bool enable = false;
+		if (!parse_enable_or_disable(argv[1], &enable))
+			return false;
+		t->flash_erase_ahead = enable;
+	}
+	tc_printf(t, "Flash erase-ahead: %s\n", t->flash_erase_ahead ? "enabled" : "disabled");
+	return true;
+}
+
+static bool target_cmd_flash_loader(target *const t, const int argc, const char **const argv)
+{
+	if (argc == 2) {
+		bool enable = false;
+		if (!parse_enable_or_disable(argv[1], &enable))
+			return false;
+		t->flash_loader_disabled = !enable;
+	}
+	tc_printf(t, "Flash loader: %s\n", t->flash_loader_disabled ? "disabled" : "enabled");
+	return true;
+}
+
+static bool target_cmd_flash_stats(target *const t, const int argc, const char **const argv)
+{
+	if (argc == 2) {
+		bool enable = false;
+		if (!parse_enable_or_disable(argv[1], &enable))
+			return false;
+		t->flash_stats_print = enable;
+	}
+	tc_printf(t, "Flash statistics when done: %s\n", t->flash_stats_print ? "printed" : "not printed");
+	target_flash_stats_show(t);
+	return true;
+}
+
 static bool target_cmd_range_erase(target *const t, const int argc, const char **const argv)
 {
 	if (argc < 3) {
@@ -563,7 +1549,8 @@ static bool target_cmd_range_erase(target *const t, const int argc, const char *
 
 	const target_addr aligned_addr = addr & ~(flash->blocksize - 1U);
 	const uint32_t aligned_length = length + (addr - aligned_addr);
-	return target_flash_erase(t, aligned_addr, aligned_length) == 0;
+	/* target_flash_done() completes any erase deferred for delta flashing or erase-ahead */
+	return target_flash_erase(t, aligned_addr, aligned_length) == 0 && target_flash_done(t) == 0;
 }
 
 /* Accessor functions */
@@ -572,6 +1559,11 @@ size_t target_regs_size(target *t)
 	return t->regs_size;
 }
 
+size_t target_regs_size_core(target *t)
+{
+	return t->regs_read_core ? t->regs_size_core : t->regs_size;
+}
+
 const char *target_tdesc(target *t)
 {
 	return t->tdesc ? t->tdesc : "";
@@ -606,6 +1598,7 @@ uint32_t target_mem_read32(target *t, uint32_t addr)
 
 void target_mem_write32(target *t, uint32_t addr, uint32_t value)
 {
+	target_mem_cache_invalidate(t, t->mem_cache_halted);
 	t->mem_write(t, addr, &value, sizeof(value));
 }
 
@@ -618,6 +1611,7 @@ uint16_t target_mem_read16(target *t, uint32_t addr)
 
 void target_mem_write16(target *t, uint32_t addr, uint16_t value)
 {
+	target_mem_cache_invalidate(t, t->mem_cache_halted);
 	t->mem_write(t, addr, &value, sizeof(value));
 }
 
@@ -630,6 +1624,7 @@ uint8_t target_mem_read8(target *t, uint32_t addr)
 
 void target_mem_write8(target *t, uint32_t addr, uint8_t value)
 {
+	target_mem_cache_invalidate(t, t->mem_cache_halted);
 	t->mem_write(t, addr, &value, sizeof(value));
 }
 
@@ -646,8 +1641,12 @@ int target_command(target *t, int argc, const char *argv[])
 {
 	for (struct target_command_s *tc = t->commands; tc; tc = tc->next)
 		for(const struct command_s *c = tc->cmds; c->cmd; c++)
-			if(!strncmp(argv[0], c->cmd, strlen(argv[0])))
-				return (c->handler(t, argc, argv)) ? 0 : 1;
+			if(!strncmp(argv[0], c->cmd, strlen(argv[0]))) {
+				const bool cache_halted = target_mem_cache_suspend(t);
+				const bool result = c->handler(t, argc, argv);
+				target_mem_cache_resume(t, cache_halted);
+				return result ? 0 : 1;
+			}
 	return -1;
 }
 
@@ -692,21 +1691,27 @@ int tc_read(target *t, int fd, target_addr buf, unsigned int count)
 	return t->tc->read(t->tc, fd, buf, count);
 }
 
+#ifdef PLATFORM_HAS_USBUART
+/* Redirected console output is served by the probe, without a round trip to GDB */
+static bool tc_redirected(target *t, int fd)
+{
+	return t->stdout_redirected && (fd == STDOUT_FILENO || fd == STDERR_FILENO);
+}
+#endif
+
 int tc_write(target *t, int fd, target_addr buf, unsigned int count)
 {
 #ifdef PLATFORM_HAS_USBUART
-	if (t->stdout_redirected && (fd == STDOUT_FILENO || fd == STDERR_FILENO)) {
-		while (count) {
+	if (tc_redirected(t, fd)) {
+		for (unsigned int done = 0; done < count;) {
 			uint8_t tmp[STDOUT_READ_BUF_SIZE];
-			unsigned int cnt = sizeof(tmp);
-			if (cnt > count)
-				cnt = count;
-			target_mem_read(t, tmp, buf, cnt);
+			const unsigned int cnt = MIN(sizeof(tmp), count - done);
+			if (target_mem_read(t, tmp, buf + done, cnt))
+				return done;
 			usbuart_send_stdout(tmp, cnt);
-			count -= cnt;
-			buf += cnt;
+			done += cnt;
 		}
-		return 0;
+		return count;
 	}
 #endif
 
@@ -768,6 +1773,10 @@ int tc_gettimeofday(target *t, target_addr tv, target_addr tz)
 
 int tc_isatty(target *t, int fd)
 {
+#ifdef PLATFORM_HAS_USBUART
+	if (tc_redirected(t, fd))
+		return 1;
+#endif
 	if (t->tc->isatty == NULL) {
 		return 1;
 	}
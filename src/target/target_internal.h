@@ -38,6 +38,25 @@ typedef int (*flash_erase_func)(target_flash_s *f, target_addr addr, size_t len)
 typedef int (*flash_write_func)(target_flash_s *f, target_addr dest,
                                 const void *src, size_t len);
 typedef int (*flash_done_func)(target_flash_s *f);
+typedef int (*flash_bank_erase_func)(target_flash_s *f);
+/* Returns true if everything in the range reads as the erased value */
+typedef bool (*flash_blank_check_func)(target_flash_s *f, target_addr addr, size_t len);
+
+/* Where the time went programming a Flash region in the last session, see
+ * "monitor flash_stats". Times are in microseconds, polls are status reads
+ * made by the BSY-poll helpers while the region's driver was running */
+typedef struct target_flash_stats {
+	uint32_t erase_calls;
+	uint32_t erase_bytes;
+	uint32_t erase_us;
+	uint32_t blank_check_us;
+	uint32_t write_calls;
+	uint32_t write_bytes;
+	uint32_t write_us;
+	uint32_t done_us;
+	uint32_t polls;
+	uint32_t poll_us;
+} target_flash_stats_s;
 
 struct target_flash {
 	target_addr start;
@@ -46,12 +65,26 @@ struct target_flash {
 	flash_erase_func erase;
 	flash_write_func write;
 	flash_done_func done;
+	flash_blank_check_func blank_check; /* Optional, read back otherwise */
+	/* Optional, erases every target_flash with the same bank_erase and bank_id
+	 * in one go. Used when an erase request covers all of them */
+	flash_bank_erase_func bank_erase;
+	uint8_t bank_id;
 	target *t;
 	uint8_t erased;
 	size_t buf_size;
+	/* Optional, the unit write accepts within the buffer. Only the units of a
+	 * buffer that hold data are written then, rather than the whole buffer */
+	size_t writesize;
 	struct target_flash *next;
 	target_addr buf_addr;
 	void *buf;
+	/* One bit per erase block GDB asked to erase that hasn't been yet, for
+	 * delta flashing and erase-ahead, and the block delta flashing collects */
+	uint8_t *delta_pending;
+	target_addr delta_addr;
+	void *delta_buf;
+	target_flash_stats_s stats;
 };
 
 typedef bool (*cmd_handler)(target *t, int argc, const char **argv);
@@ -86,6 +119,10 @@ struct target_s {
 	bool (*attach)(target *t);
 	void (*detach)(target *t);
 	bool (*check_error)(target *t);
+	/* Optional, checks the part probed still answers without scanning again, see target_revalidate() */
+	bool (*revalidate)(target *t);
+	/* Optional, the driver's part of that, reading its ID registers again */
+	bool (*check_id)(target *t);
 
 	/* Memory access functions */
 	void (*mem_read)(target *t, void *dest, target_addr src,
@@ -97,9 +134,18 @@ struct target_s {
 	size_t regs_size;
 	const char *tdesc;
 	void (*regs_read)(target *t, void *data);
+	/* Optional, reads the leading regs_size_core bytes, all 'g' covers when
+	 * the rest costs more than it's worth every stop. GDB uses 'p' for those */
+	void (*regs_read_core)(target *t, void *data);
+	size_t regs_size_core;
 	void (*regs_write)(target *t, const void *data);
 	ssize_t (*reg_read)(target *t, int reg, void *data, size_t max);
 	ssize_t (*reg_write)(target *t, int reg, const void *data, size_t size);
+	/* Register cache for drivers that support it, one bit per 32-bit word in
+	 * the valid and dirty masks. Only meaningful while the target is halted */
+	uint32_t *reg_cache;
+	uint64_t reg_cache_valid;
+	uint64_t reg_cache_dirty;
 
 	/* Halt/resume functions */
 	void (*reset)(target *t);
@@ -107,6 +153,18 @@ struct target_s {
 	void (*halt_request)(target *t);
 	enum target_halt_reason (*halt_poll)(target *t, target_addr *watch);
 	void (*halt_resume)(target *t, bool step);
+	/* Optional, single steps until PC leaves [start, end) before halt_poll reports */
+	void (*halt_resume_range)(target *t, target_addr start, target_addr end);
+	/* Optional, blocks on the probe for up to timeout_ms until the core halts */
+	bool (*halt_wait)(target *t, uint32_t timeout_ms);
+	/* Optional, samples the PC of the running core without halting it */
+	size_t (*pc_sample)(target *t, uint32_t *pcs, size_t count);
+	/* Cross trigger interface of the core, if one was found */
+	struct cti *cti;
+	/* Micro Trace Buffer of the core, if one was found */
+	struct mtb *mtb;
+	/* Embedded Trace Macrocell of the core, if one was found */
+	struct etm *etm;
 
 	/* Break-/watchpoint functions */
 	int (*breakwatch_set)(target *t, struct breakwatch*);
@@ -116,6 +174,14 @@ struct target_s {
 	/* Recovery functions */
 	bool (*mass_erase)(target *t);
 
+	/* Optional on-target CRC32 of a memory range, as for qCRC */
+	int (*mem_crc32)(target *t, uint32_t *crc, target_addr addr, size_t len);
+	/* Optional on-target fill and search, as for target_mem_fill() and target_mem_find().
+	 * The pattern comes replicated to a word for filling. Non-zero (-1) falls back */
+	int (*mem_fill)(target *t, target_addr addr, size_t len, uint32_t pattern);
+	int (*mem_find)(target *t, target_addr *found, target_addr addr, size_t len, uint32_t pattern, size_t size,
+		bool mismatch);
+
 	/* target-defined options */
 	unsigned target_options;
 
@@ -127,6 +193,35 @@ struct target_s {
 
 	struct target_ram *ram;
 	struct target_flash *flash;
+	/* XML of the above for GDB, see target_mem_map() */
+	char *mem_map;
+	size_t mem_map_len;
+
+	/* Memory read cache, only used while the target is known to be halted */
+	struct target_mem_cache *mem_cache;
+	bool mem_cache_disabled;
+	bool mem_cache_halted;
+	/* Skip erasing and writing flash blocks whose contents already match */
+	bool flash_delta;
+	/* Leave erasing a Flash block until its data comes in, see target_flash_erase_ahead() */
+	bool flash_erase_ahead;
+	/* Don't program flash through a loader running from target RAM */
+	bool flash_loader_disabled;
+	/* Flash statistics: print them at target_flash_done(), the region whose
+	 * driver is running and the session, see target_flash_session_begin() */
+	bool flash_stats_print;
+	struct target_flash *flash_active;
+	bool flash_session;
+	uint32_t flash_session_start;
+	uint32_t flash_session_busy_us;
+	uint32_t flash_session_us;
+
+	/* Debug register keeping the debug clocks up in sleep/stop/standby, set on
+	 * attach when target_lowpower_debug is and restored on detach. 0 if none */
+	target_addr lowpower_debug_reg;
+	uint32_t lowpower_debug_bits;
+	uint32_t lowpower_debug_saved;
+	bool lowpower_debug_set;
 
 	/* Other stuff */
 	const char *driver;
@@ -161,6 +256,13 @@ void target_add_ram(target *t, target_addr start, uint32_t len);
 void target_add_flash(target *t, struct target_flash *f);
 
 struct target_flash *target_flash_for_addr(target *t, uint32_t addr);
+/* Counts polls for a busy Flash controller, taking us, against the region being programmed */
+void target_flash_stats_poll(target *t, uint32_t polls, uint32_t us);
+
+/* Memory read cache control */
+void target_mem_cache_invalidate(target *t, bool halted);
+bool target_mem_cache_suspend(target *t);
+void target_mem_cache_resume(target *t, bool halted);
 
 /* Convenience function for MMIO access */
 uint32_t target_mem_read32(target *t, uint32_t addr);
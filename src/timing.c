@@ -19,14 +19,23 @@
  */
 #include "general.h"
 
+/* Timeouts of up to half the wrap of platform_time_us(), 35 minutes, work */
+#define TIMEOUT_MAX_US (UINT32_MAX / 2U)
+
 void platform_timeout_set(platform_timeout *t, uint32_t ms)
 {
+	/* Kept at a tick at least, code written for the ms timebase relies on that */
 	if (ms <= SYSTICKMS)
 		ms = SYSTICKMS;
-	t->time = platform_time_ms() + ms;
+	platform_timeout_set_us(t, ms > TIMEOUT_MAX_US / 1000U ? TIMEOUT_MAX_US : ms * 1000U);
+}
+
+void platform_timeout_set_us(platform_timeout *t, uint32_t us)
+{
+	t->time = platform_time_us() + MIN(us, TIMEOUT_MAX_US);
 }
 
 bool platform_timeout_is_expired(platform_timeout *t)
 {
-	return platform_time_ms() > t->time;
+	return (int32_t)(platform_time_us() - t->time) > 0;
 }